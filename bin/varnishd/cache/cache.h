@@ -62,6 +62,7 @@ enum req_fsm_nxt {
 	REQ_FSM_MORE,
 	REQ_FSM_DONE,
 	REQ_FSM_DISEMBARK,
+	REQ_FSM_PARK,		/* the transport parks the delivery */
 };
 
 /*--------------------------------------------------------------------*/
@@ -104,6 +105,7 @@ struct busyobj;
 struct cli;
 struct cli_proto;
 struct director;
+struct hsh_pfx;
 struct iovec;
 struct mempool;
 struct objcore;
@@ -114,6 +116,7 @@ struct transport;
 struct req;
 struct sess;
 struct suckaddr;
+struct tag_ref;
 struct vrt_priv;
 struct vsb;
 struct worker;
@@ -157,6 +160,7 @@ struct ws {
 	char			*f;		/* (F)ree/front pointer */
 	char			*r;		/* (R)eserved length */
 	char			*e;		/* (E)nd of buffer */
+	char			*h;		/* (H)igh water mark */
 };
 
 /*--------------------------------------------------------------------
@@ -171,6 +175,9 @@ struct http {
 	txt			*hd;
 	unsigned char		*hdf;
 #define HDF_FILTER		(1 << 0)	/* Filtered by Connection */
+	uint16_t		*hdx;		/* Name index, see cache_http.c */
+	uint16_t		*hdw;		/* Well-known headers, by id */
+	unsigned		hdx_mask;
 
 	/* NB: ->nhd and below zeroed/initialized by http_Teardown */
 	uint16_t		nhd;		/* Next free hd */
@@ -182,6 +189,17 @@ struct http {
 	uint16_t		status;
 	uint8_t			protover;
 	uint8_t			conds;		/* If-* headers present */
+
+	/* Accept-Encoding as parsed by RFC2616_Req_Gzip() & co. */
+	const char		*ae_hdr;
+	uint8_t			ae_bits;
+};
+
+/* A token from a header list, with its q value, see http_QList() */
+struct http_qval {
+	const char		*b;
+	const char		*e;
+	double			q;
 };
 
 /*--------------------------------------------------------------------
@@ -217,6 +235,7 @@ struct vfp_ctx {
 struct http_conn {
 	unsigned		magic;
 #define HTTP_CONN_MAGIC		0x3e19edd1
+	int			corked;		/* see V1L_CorkFd() */
 
 	int			*rfd;
 	enum sess_close		doclose;
@@ -250,22 +269,42 @@ struct acct_bereq {
 
 /*--------------------------------------------------------------------*/
 
+enum lat_e {
+#define VSC_LAT(n, d)	LAT_##n,
+#include "tbl/vsc_lat.h"
+	LAT__MAX
+};
+
 #define L0(t, n)
 #define L1(t, n)		t n;
 #define VSC_FF(n,t,l,s,f,v,d,e)	L##l(t, n)
 struct dstat {
 	unsigned		summs;
 #include "tbl/vsc_f_main.h"
+	uint64_t		lat[LAT__MAX][VSC_LAT_NBUCKET];
 };
 #undef L0
 #undef L1
 
 /*--------------------------------------------------------------------*/
 
+struct vsl_trace;
+
 struct vsl_log {
 	uint32_t		*wlb, *wlp, *wle;
 	unsigned		wlr;
 	unsigned		wid;
+	unsigned		full;
+	struct vsl_trace	*trace;
+};
+
+enum vsl_span_e {
+	VSL_SPAN_LOOKUP,
+	VSL_SPAN_WAITINGLIST,
+	VSL_SPAN_CONNECT,
+	VSL_SPAN_TTFB,
+	VSL_SPAN_ESI,
+	VSL_SPAN__MAX
 };
 
 /*--------------------------------------------------------------------*/
@@ -291,21 +330,33 @@ struct pool_task {
 	VTAILQ_ENTRY(pool_task)		list;
 	task_func_t			*func;
 	void				*priv;
+	double				t_queued;
+	uint32_t			fq_key;		/* SES_FairKey() */
+	struct pool_fq			*fq;
+	VTAILQ_ENTRY(pool_task)		fq_list;
 };
 
+VTAILQ_HEAD(taskhead, pool_task);
+
 /*
- * tasks are taken off the queues in this order
+ * tasks are taken off the queues in this order, except that the client
+ * queues from TASK_QUEUE_HIGH to TASK_QUEUE_BULK share by weight
  *
  * prios up to TASK_QUEUE_RESERVE are run from the reserve
  */
 enum task_prio {
 	TASK_QUEUE_BO,
 #define TASK_QUEUE_RESERVE	TASK_QUEUE_BO
+	TASK_QUEUE_HIGH,	/* Client work with req.priority > 0 */
 	TASK_QUEUE_REQ,
+	TASK_QUEUE_BULK,	/* Client work which can wait, see h2 */
 	TASK_QUEUE_VCA,
 	TASK_QUEUE_END
 };
 
+#define TASK_QUEUE_CLIENT(prio)	\
+	((prio) >= TASK_QUEUE_HIGH && (prio) <= TASK_QUEUE_BULK)
+
 /*--------------------------------------------------------------------*/
 
 struct worker {
@@ -315,6 +366,7 @@ struct worker {
 	struct objhead		*nobjhead;
 	struct objcore		*nobjcore;
 	void			*nhashpriv;
+	struct hsh_pfx		*hsh_pfx;	// see HSH_AddPrefix()
 	struct dstat		stats[1];
 	struct vsl_log		*vsl;		// borrowed from req/bo
 
@@ -338,16 +390,31 @@ struct worker {
 
 	uintptr_t		stack_start;
 	uintptr_t		stack_end;
+
+#define EXP_BATCH		16
+	unsigned		exp_nbatch;
+	uint8_t			exp_cmds[EXP_BATCH];
+	struct objcore		*exp_batch[EXP_BATCH];
 };
 
 /* Stored object -----------------------------------------------------
  * This is just to encapsulate the fields owned by the stevedore
  */
 
+/* What an object on Transient storage is there for, for accounting */
+enum transient_e {
+	TRANSIENT_OTHER = 0,
+	TRANSIENT_PASS,
+	TRANSIENT_SHORTLIVED,
+	TRANSIENT_SYNTH,
+	TRANSIENT_REQBODY,
+};
+
 struct storeobj {
 	const struct stevedore	*stevedore;
 	void			*priv;
 	uintptr_t		priv2;
+	uint8_t			transient;	/* enum transient_e */
 };
 
 /* Busy Objcore structure --------------------------------------------
@@ -372,6 +439,11 @@ struct boc {
 	enum boc_state_e	state;
 	uint8_t			*vary;
 	uint64_t		len_so_far;
+	uint64_t		len_woken;	/* see ObjExtend() */
+	double			t_woken;
+	uint64_t		len_hint;
+	uint64_t		delivered_so_far;
+	uint64_t		transit_buffer;
 };
 
 /* Object core structure ---------------------------------------------
@@ -426,13 +498,22 @@ struct objcore {
 
 	uint16_t		oa_present;
 
+	/* Copies of small fixed size OA's, see ObjBocDone() */
+	uint16_t		oa_inline;
+	uint8_t			oa_flags[1];
+	uint8_t			oa_len[8];
+	uint8_t			oa_lastmodified[8];
+
 	unsigned		timer_idx;	// XXX 4Gobj limit
-	float			last_lru;
+	double			last_lru;
+	uint8_t			lru_ref;	// clock mode LRU reference
+	uint32_t		vary_hash;	// see VRY_Hash(), 0: none
 	VTAILQ_ENTRY(objcore)	hsh_list;
 	VTAILQ_ENTRY(objcore)	lru_list;
 	VTAILQ_ENTRY(objcore)	ban_list;
 	VSTAILQ_ENTRY(objcore)	exp_list;
 	struct ban		*ban;
+	struct tag_ref		*tags;	/* see cache_tag.c */
 };
 
 /* Busy Object structure ---------------------------------------------
@@ -501,6 +582,15 @@ struct busyobj {
 	enum director_state_e	director_state;
 	struct vcl		*vcl;
 
+	/* Second backend to try for a slow fetch, see vbe_dir_hedge() */
+	const struct director	*hedge;
+	double			hedge_delay;
+
+	/* Waiting for the backend without a thread, see vbf_park() */
+	unsigned		can_park;
+	unsigned		parked;
+	struct waited		*park;
+
 	struct vsl_log		vsl[1];
 
 	uint8_t			digest[DIGEST_LEN];
@@ -542,17 +632,23 @@ struct req {
 
 	/* The busy objhead we sleep on */
 	struct objhead		*hash_objhead;
+	/* The object the rush handed us, if any */
+	struct objcore		*hash_oc;
 
 	/* Built Vary string */
 	uint8_t			*vary_b;
 	uint8_t			*vary_l;
 	uint8_t			*vary_e;
+	uint32_t		vary_hash;
 
 	uint8_t			digest[DIGEST_LEN];
+	float			synth_ttl;	/* resp.ttl in vcl_synth */
 
 	double			d_ttl;
+	long			priority;	/* req.priority */
 
 	ssize_t			req_bodybytes;	/* Parsed req bodybytes */
+	ssize_t			req_body_tee;	/* see VRB_Tee() */
 	const struct stevedore	*storage;
 
 	const struct director	*director_hint;
@@ -625,7 +721,8 @@ struct sess {
 #define SESS_MAGIC		0x2c2f9c5a
 
 	uint16_t		sattr[SA_LAST];
-	int			refcnt;
+	unsigned		refcnt:31;
+	unsigned		shrunk:1;	/* see ses_shrink() */
 	int			fd;
 	uint32_t		vxid;
 
@@ -658,10 +755,14 @@ const char *BAN_AddTest(struct ban_proto *,
 const char *BAN_Commit(struct ban_proto *b);
 void BAN_Abandon(struct ban_proto *b);
 
+/* for bans from peers */
+const char *BAN_Replay(const uint8_t *ptr, unsigned len, unsigned *nban);
+
 /* for stevedoes resurrecting bans */
 void BAN_Hold(void);
 void BAN_Release(void);
 void BAN_Reload(const uint8_t *ban, unsigned len);
+void BAN_Dump(struct vsb *);
 struct ban *BAN_FindBan(double t0);
 void BAN_RefBan(struct objcore *oc, struct ban *);
 double BAN_Time(const struct ban *ban);
@@ -705,12 +806,17 @@ extern pthread_t cli_thread;
 /* cache_exp.c */
 void EXP_Rearm(struct objcore *, double now, double ttl, double grace,
     double keep);
+void EXP_RearmBatch(struct worker *, struct objcore *, double now,
+    double ttl, double grace, double keep);
+void EXP_Flush(struct worker *);
 
 /* cache_fetch.c */
 enum vbf_fetch_mode_e {
 	VBF_NORMAL = 0,
 	VBF_PASS = 1,
 	VBF_BACKGROUND = 2,
+	VBF_VARIANT = 3,
+	VBF_GZIP = 4,
 };
 void VBF_Fetch(struct worker *wrk, struct req *req,
     struct objcore *oc, struct objcore *oldoc, enum vbf_fetch_mode_e);
@@ -726,7 +832,7 @@ enum vgzret_e {
 };
 
 enum vgz_flag { VGZ_NORMAL, VGZ_ALIGN, VGZ_RESET, VGZ_FINISH };
-// struct vgz *VGZ_NewUngzip(struct vsl_log *vsl, const char *id);
+struct vgz *VGZ_NewGunzip(struct vsl_log *vsl, const char *id);
 struct vgz *VGZ_NewGzip(struct vsl_log *vsl, const char *id);
 void VGZ_Ibuf(struct vgz *, const void *, ssize_t len);
 int VGZ_IbufEmpty(const struct vgz *vg);
@@ -734,7 +840,7 @@ void VGZ_Obuf(struct vgz *, void *, ssize_t len);
 int VGZ_ObufFull(const struct vgz *vg);
 enum vgzret_e VGZ_Gzip(struct vgz *, const void **, ssize_t *len,
     enum vgz_flag);
-// enum vgzret_e VGZ_Gunzip(struct vgz *, const void **, ssize_t *len);
+enum vgzret_e VGZ_Gunzip(struct vgz *, const void **, ssize_t *len);
 enum vgzret_e VGZ_Destroy(struct vgz **);
 
 enum vgz_ua_e {
@@ -744,9 +850,12 @@ enum vgz_ua_e {
 };
 
 void VGZ_UpdateObj(const struct vfp_ctx *, struct vgz*, enum vgz_ua_e);
+int VGZ_GunzipObj(struct vfp_ctx *, struct objcore *);
+int VGZ_GzipObj(struct vfp_ctx *, struct objcore *);
 
 /* cache_http.c */
 unsigned HTTP_estimate(unsigned nhttp);
+unsigned HTTP_IndexSize(unsigned nhttp);
 void HTTP_Copy(struct http *to, const struct http * const fm);
 struct http *HTTP_create(void *p, uint16_t nhttp);
 const char *http_Status2Reason(unsigned, const char **);
@@ -754,8 +863,12 @@ unsigned http_EstimateWS(const struct http *fm, unsigned how);
 void http_PutResponse(struct http *to, const char *proto, uint16_t status,
     const char *response);
 void http_FilterReq(struct http *to, const struct http *fm, unsigned how);
-void HTTP_Encode(const struct http *fm, uint8_t *, unsigned len, unsigned how);
+unsigned HTTP_Encode(const struct http *fm, uint8_t *, unsigned len,
+    unsigned how, int dict);
 int HTTP_Decode(struct http *to, const uint8_t *fm);
+unsigned HTTP_EncodeStatic(const struct http *fm, uint8_t *, unsigned len,
+    unsigned how);
+const char *HTTP_GetStatic(struct worker *, struct objcore *, unsigned *);
 void http_ForceHeader(struct http *to, const char *hdr, const char *val);
 void http_PrintfHeader(struct http *to, const char *fmt, ...)
     __v_printflike(2, 3);
@@ -766,11 +879,13 @@ void http_ForceField(const struct http *to, unsigned n, const char *t);
 void HTTP_Setup(struct http *, struct ws *, struct vsl_log *, enum VSL_tag_e);
 void http_Teardown(struct http *ht);
 int http_GetHdr(const struct http *hp, const char *hdr, const char **ptr);
+int http_GetHdrId(const struct http *hp, unsigned id, const char **ptr);
 int http_GetHdrToken(const struct http *hp, const char *hdr,
     const char *token, const char **pb, const char **pe);
 int http_GetHdrField(const struct http *hp, const char *hdr,
     const char *field, const char **ptr);
 double http_GetHdrQ(const struct http *hp, const char *hdr, const char *field);
+unsigned http_QList(const char *h, struct http_qval *qv, unsigned nqv);
 ssize_t http_GetContentLength(const struct http *hp);
 uint16_t http_GetStatus(const struct http *hp);
 int http_IsStatus(const struct http *hp, int);
@@ -810,9 +925,6 @@ extern const char H__Status[];
 extern const char H__Proto[];
 extern const char H__Reason[];
 
-/* cache_http2_deliver.c */
-void V2D_Init(void);
-
 /* cache_main.c */
 #define VXID(u) ((u) & VSL_IDENTMASK)
 uint32_t VXID_Get(struct worker *, uint32_t marker);
@@ -852,9 +964,15 @@ struct VSC_C_lck *Lck_CreateClass(const char *name);
 void MPL_AssertSane(void *item);
 struct mempool * MPL_New(const char *name, volatile struct poolparam *pp,
     volatile unsigned *cur_size);
+typedef unsigned mpl_extra_f(void);
+void MPL_Extra(struct mempool *, mpl_extra_f *);
 void MPL_Destroy(struct mempool **mpp);
 void *MPL_Get(struct mempool *mpl, unsigned *size);
 void MPL_Free(struct mempool *mpl, void *item);
+void MPL_FreeUsed(struct mempool *mpl, void *item, size_t used);
+void MPL_Magazine(struct mempool *mpl);
+void MPL_SyncStats(void);
+void MPL_Drain(void);
 
 /* cache_obj.c */
 struct objcore * ObjNew(struct worker *);
@@ -862,6 +980,8 @@ void ObjDestroy(struct worker *, struct objcore **);
 typedef int objiterate_f(void *priv, int flush, const void *ptr, ssize_t len);
 int ObjIterate(struct worker *, struct objcore *,
     void *priv, objiterate_f *func, int final);
+int ObjIterateFrom(struct worker *, struct objcore *, ssize_t off,
+    void *priv, objiterate_f *func, int final);
 int ObjGetSpace(struct worker *, struct objcore *, ssize_t *sz, uint8_t **ptr);
 void ObjExtend(struct worker *, struct objcore *, ssize_t l);
 uint64_t ObjWaitExtend(const struct worker *, const struct objcore *,
@@ -915,6 +1035,7 @@ const char *sess_close_2str(enum sess_close sc, int want_desc);
 
 /* cache_pool.c */
 int Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio);
+int Pool_Task_List(struct pool *pp, struct taskhead *th, enum task_prio prio);
 int Pool_Task_Arg(struct worker *, enum task_prio, task_func_t *,
     const void *arg, size_t arg_len);
 void Pool_Sumstat(struct worker *w);
@@ -922,18 +1043,35 @@ int Pool_TrySumstat(struct worker *wrk);
 void Pool_PurgeStat(unsigned nobj);
 int Pool_Task_Any(struct pool_task *task, enum task_prio prio);
 
+/* cache_synth.c [SYN] */
+struct objcore *SYN_Lookup(struct worker *, const struct req *, double now);
+void SYN_Insert(struct worker *, const struct req *, double now, double ttl);
+
+/* cache_admit.c [ADM] */
+void ADM_Touch(const uint8_t *digest);
+int ADM_Admit(struct worker *, const struct stevedore *,
+    const uint8_t *digest, uint64_t size);
+
+/* cache_tag.c [TAG] */
+void TAG_Insert(struct worker *, struct objcore *, const struct http *);
+void TAG_DestroyObj(struct worker *, struct objcore *);
+unsigned TAG_Purge(struct worker *, const char *keys, int soft);
+
 /* cache_range.c [VRG] */
 void VRG_dorange(struct req *req, const char *r);
+int VRG_DeliverObj(struct req *, void *priv, int final);
 
 /* cache_req.c */
 struct req *Req_New(const struct worker *, struct sess *);
 void Req_Release(struct req *);
 int Req_Cleanup(struct sess *sp, struct worker *wrk, struct req *req);
 void Req_Fail(struct req *req, enum sess_close reason);
+enum task_prio Req_Prio(const struct req *);
 
 /* cache_req_body.c */
 int VRB_Ignore(struct req *);
 ssize_t VRB_Cache(struct req *, ssize_t maxsize);
+int VRB_Tee(struct req *, ssize_t maxsize);
 ssize_t VRB_Iterate(struct req *, objiterate_f *func, void *priv);
 void VRB_Free(struct req *);
 
@@ -949,6 +1087,7 @@ void SES_Delete(struct sess *, enum sess_close reason, double now);
 void SES_Ref(struct sess *sp);
 void SES_Rel(struct sess *sp);
 int SES_Reschedule_Req(struct req *);
+uint32_t SES_FairKey(const struct sess *, const char *identity);
 void SES_SetTransport(struct worker *, struct sess *, struct req *,
     const struct transport *);
 
@@ -976,6 +1115,8 @@ enum htc_status_e HTC_RxStuff(struct http_conn *, htc_complete_f *,
 #include "tbl/sess_attr.h"
 
 void SES_Set_String_Attr(struct sess *sp, enum sess_attr a, const char *src);
+int SES_Set_String_Attr_Len(struct sess *sp, enum sess_attr a,
+    const char *src, unsigned len);
 const char *SES_Get_String_Attr(const struct sess *sp, enum sess_attr a);
 
 /* cache_shmlog.c */
@@ -994,6 +1135,7 @@ void VSLbt(struct vsl_log *, enum VSL_tag_e tag, txt t);
 void VSLb_ts(struct vsl_log *, const char *event, double first, double *pprev,
     double now);
 void VSLb_bin(struct vsl_log *, enum VSL_tag_e, ssize_t, const void*);
+void VSLb_u64(struct vsl_log *, enum VSL_tag_e, const uint64_t *, unsigned);
 
 static inline void
 VSLb_ts_req(struct req *req, const char *event, double now)
@@ -1015,12 +1157,19 @@ VSLb_ts_busyobj(struct busyobj *bo, const char *event, double now)
 
 
 void VSL_Flush(struct vsl_log *, int overflow);
+int VSL_Masked(enum VSL_tag_e);
+void VSL_Trace(struct vsl_log *, struct ws *, uint32_t parent,
+    const struct vsl_log *pvsl, double t0);
+void VSL_Span(const struct vsl_log *, enum vsl_span_e, double t0, double t1);
+void VSL_SpanEnd(const struct vsl_log *, enum vsl_span_e, double t1);
 
 #endif
 
 /* cache_vary.c */
 int VRY_Create(struct busyobj *bo, struct vsb **psb);
-int VRY_Match(struct req *, const uint8_t *vary);
+uint32_t VRY_Hash(const uint8_t *vary);
+int VRY_HashMatch(const struct req *, uint32_t hash);
+int VRY_Match(struct req *, const uint8_t *vary, uint32_t hash);
 void VRY_Prep(struct req *);
 void VRY_Clear(struct req *);
 enum vry_finish_flag { KEEP, DISCARD };
@@ -1053,6 +1202,7 @@ char *VRT_StringList(char *d, unsigned dl, const char *p, va_list ap);
 typedef void *bgthread_t(struct worker *, void *priv);
 void WRK_BgThread(pthread_t *thr, const char *name, bgthread_t *func,
     void *priv);
+void WRK_Latency(struct worker *, enum lat_e, double);
 
 /* cache_ws.c */
 
@@ -1068,7 +1218,11 @@ void *WS_Alloc(struct ws *ws, unsigned bytes);
 void *WS_Copy(struct ws *ws, const void *str, int len);
 uintptr_t WS_Snapshot(struct ws *ws);
 int WS_Overflowed(const struct ws *ws);
+unsigned WS_HighWater(const struct ws *ws);
+unsigned WS_Quartile(const struct ws *ws);
 void *WS_Printf(struct ws *ws, const char *fmt, ...) __v_printflike(2, 3);
+struct vsb *WS_VSB_new(struct vsb *, struct ws *);
+char *WS_VSB_finish(struct vsb *, struct ws *, size_t *);
 int WS_Inside(const struct ws *, const void *, const void *);
 void WS_Assert_Allocated(const struct ws *ws, const void *ptr, ssize_t len);
 
@@ -1081,7 +1235,8 @@ WS_Front(const struct ws *ws)
 /* cache_rfc2616.c */
 void RFC2616_Ttl(struct busyobj *, double now, double *t_origin,
     float *ttl, float *grace, float *keep);
-unsigned RFC2616_Req_Gzip(const struct http *);
+unsigned RFC2616_Req_Gzip(struct http *);
+unsigned RFC2616_Req_Brotli(struct http *);
 int RFC2616_Do_Cond(const struct req *sp);
 void RFC2616_Weaken_Etag(struct http *hp);
 void RFC2616_Vary_AE(struct http *hp);
@@ -1089,6 +1244,7 @@ void RFC2616_Vary_AE(struct http *hp);
 /* stevedore.c */
 int STV_NewObject(struct worker *, struct objcore *,
     const struct stevedore *, unsigned len);
+int STV_FileRange(const void *ptr, size_t len, int *fd, off_t *off);
 
 /*
  * A normal pointer difference is signed, but we never want a negative value
@@ -36,6 +36,7 @@
 #include "cache.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -53,6 +54,7 @@ static pthread_t	VCA_thread;
 static double vca_pace = 0.0;
 static struct lock pace_mtx;
 static unsigned pool_accepting;
+static int accept_nonblock = -1;
 
 struct wrk_accept {
 	unsigned		magic;
@@ -63,6 +65,7 @@ struct wrk_accept {
 	socklen_t		acceptaddrlen;
 	int			acceptsock;
 	struct listen_sock	*acceptlsock;
+	unsigned		local_fixed;
 };
 
 struct poolsock {
@@ -72,6 +75,7 @@ struct poolsock {
 	struct listen_sock		*lsock;
 	struct pool_task		task;
 	struct pool			*pool;
+	unsigned			local_fixed;	/* see vca_local_fixed() */
 };
 
 /*--------------------------------------------------------------------
@@ -224,14 +228,21 @@ vca_tcp_opt_test(int sock)
 	}
 }
 
+/*
+ * Unix domain sockets take the SOL_SOCKET options, but there is no TCP
+ * beneath them for the rest.
+ */
+
 static void
-vca_tcp_opt_set(int sock, int force)
+vca_tcp_opt_set(int sock, unsigned uds, int force)
 {
 	int n;
 	struct tcp_opt *to;
 
 	for (n = 0; n < n_tcp_opts; n++) {
 		to = &tcp_opts[n];
+		if (uds && to->level == IPPROTO_TCP)
+			continue;
 		if (to->need || force) {
 			VTCP_Assert(setsockopt(sock,
 			    to->level, to->optname, to->ptr, to->sz));
@@ -282,10 +293,44 @@ vca_pace_good(void)
 	Lck_Unlock(&pace_mtx);
 }
 
+/*--------------------------------------------------------------------
+ * A socket listening on one address and port only accepts connections
+ * to that, so its sessions can have the listen address for local.ip
+ * without asking getsockname(2) every time.
+ */
+
+static unsigned
+vca_local_fixed(const struct listen_sock *ls)
+{
+	const struct sockaddr *sa;
+	socklen_t sl;
+
+	if (ls->uds != NULL || VSA_Port(ls->addr) == 0)
+		return (0);
+	sa = VSA_Get_Sockaddr(ls->addr, &sl);
+	AN(sa);
+	switch (sa->sa_family) {
+	case AF_INET:
+		return (((const struct sockaddr_in *)(const void *)sa)->
+		    sin_addr.s_addr != htonl(INADDR_ANY));
+	case AF_INET6:
+		return (!IN6_IS_ADDR_UNSPECIFIED(
+		    &((const struct sockaddr_in6 *)(const void *)sa)->
+		    sin6_addr));
+	default:
+		return (0);
+	}
+}
+
 /*--------------------------------------------------------------------
  * The pool-task for a newly accepted session
  *
  * Called from assigned worker thread
+ *
+ * Whether accepted sockets inherit O_NONBLOCK from the listen socket
+ * is up to the kernel, so we find out on the first one rather than make
+ * every one blocking.  The local address is only formatted for the
+ * SessOpen record when somebody wants that.
  */
 
 static void __match_proto__(task_func_t)
@@ -294,6 +339,7 @@ vca_make_session(struct worker *wrk, void *arg)
 	struct sess *sp;
 	struct req *req;
 	struct wrk_accept *wa;
+	const struct listen_sock *ls;
 	struct sockaddr_storage ss;
 	struct suckaddr *sa;
 	socklen_t sl;
@@ -304,8 +350,13 @@ vca_make_session(struct worker *wrk, void *arg)
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CAST_OBJ_NOTNULL(wa, arg, WRK_ACCEPT_MAGIC);
+	ls = wa->acceptlsock;
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
 
-	if (VTCP_blocking(wa->acceptsock)) {
+	if (accept_nonblock < 0)
+		accept_nonblock =
+		    (fcntl(wa->acceptsock, F_GETFL) & O_NONBLOCK) != 0;
+	if (accept_nonblock && VTCP_blocking(wa->acceptsock)) {
 		closefd(&wa->acceptsock);
 		wrk->stats->sess_drop++;	// XXX Better counter ?
 		WS_Release(wrk->aws, 0);
@@ -338,39 +389,49 @@ vca_make_session(struct worker *wrk, void *arg)
 	sp->fd = wa->acceptsock;
 	wa->acceptsock = -1;
 
-	assert(wa->acceptaddrlen <= vsa_suckaddr_len);
+	/* Unix domain socket sessions get the listener's bogo-address */
 	SES_Reserve_remote_addr(sp, &sa);
-	AN(VSA_Build(sa, &wa->acceptaddr, wa->acceptaddrlen));
+	if (ls->uds != NULL) {
+		memcpy(sa, ls->addr, vsa_suckaddr_len);
+	} else {
+		assert(wa->acceptaddrlen <= vsa_suckaddr_len);
+		AN(VSA_Build(sa, &wa->acceptaddr, wa->acceptaddrlen));
+	}
 	sp->sattr[SA_CLIENT_ADDR] = sp->sattr[SA_REMOTE_ADDR];
 
 	VTCP_name(sa, raddr, sizeof raddr, rport, sizeof rport);
 	SES_Set_String_Attr(sp, SA_CLIENT_IP, raddr);
 	SES_Set_String_Attr(sp, SA_CLIENT_PORT, rport);
 
-	sl = sizeof ss;
-	AZ(getsockname(sp->fd, (void*)&ss, &sl));
 	SES_Reserve_local_addr(sp, &sa);
-	AN(VSA_Build(sa, &ss, sl));
+	if (ls->uds != NULL || wa->local_fixed) {
+		memcpy(sa, ls->addr, vsa_suckaddr_len);
+	} else {
+		sl = sizeof ss;
+		AZ(getsockname(sp->fd, (void*)&ss, &sl));
+		AN(VSA_Build(sa, &ss, sl));
+	}
 	sp->sattr[SA_SERVER_ADDR] = sp->sattr[SA_LOCAL_ADDR];
 
-	VTCP_name(sa, laddr, sizeof laddr, lport, sizeof lport);
-
 	VSL(SLT_Begin, sp->vxid, "sess 0 %s",
 	    wa->acceptlsock->transport->name);
-	VSL(SLT_SessOpen, sp->vxid, "%s %s %s %s %s %.6f %d",
-	    raddr, rport, wa->acceptlsock->name, laddr, lport,
-	    sp->t_open, sp->fd);
+	if (!VSL_Masked(SLT_SessOpen)) {
+		VTCP_name(sa, laddr, sizeof laddr, lport, sizeof lport);
+		VSL(SLT_SessOpen, sp->vxid, "%s %s %s %s %s %.6f %d",
+		    raddr, rport, wa->acceptlsock->name, laddr, lport,
+		    sp->t_open, sp->fd);
+	}
 
 	WS_Release(wrk->aws, 0);
 
 	vca_pace_good();
 	wrk->stats->sess_conn++;
 
-	if (need_test) {
+	if (need_test && ls->uds == NULL) {
 		vca_tcp_opt_test(sp->fd);
 		need_test = 0;
 	}
-	vca_tcp_opt_set(sp->fd, 0);
+	vca_tcp_opt_set(sp->fd, ls->uds != NULL, 0);
 
 	req = Req_New(wrk, sp);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -406,6 +467,7 @@ vca_accept_task(struct worker *wrk, void *arg)
 	while (!ps->pool->die) {
 		INIT_OBJ(&wa, WRK_ACCEPT_MAGIC);
 		wa.acceptlsock = ls;
+		wa.local_fixed = ps->local_fixed;
 
 		vca_pace_check();
 
@@ -488,9 +550,14 @@ VCA_NewPool(struct pool *pp)
 	struct poolsock *ps;
 
 	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		/* Of a SO_REUSEPORT group only the one which is ours */
+		if (ls->nreuse > 0 &&
+		    pp->pool_no % ls->nreuse != ls->reuse_idx)
+			continue;
 		ALLOC_OBJ(ps, POOLSOCK_MAGIC);
 		AN(ps);
 		ps->lsock = ls;
+		ps->local_fixed = vca_local_fixed(ls);
 		ps->task.func = vca_accept_task;
 		ps->task.priv = ps;
 		ps->pool = pp;
@@ -526,6 +593,11 @@ vca_acct(void *arg)
 	VTAILQ_FOREACH(ls, &heritage.socks, list) {
 		CHECK_OBJ_NOTNULL(ls->transport, TRANSPORT_MAGIC);
 		assert (ls->sock > 0);		// We know where stdin is
+		if (ls->uds != NULL) {
+			AZ(listen(ls->sock, cache_param->listen_depth));
+			vca_tcp_opt_set(ls->sock, 1, 1);
+			continue;
+		}
 		if (cache_param->tcp_fastopen) {
 			int i;
 			i = VTCP_fastopen(ls->sock, cache_param->listen_depth);
@@ -535,7 +607,7 @@ vca_acct(void *arg)
 				    ls->sock, i, strerror(errno));
 		}
 		AZ(listen(ls->sock, cache_param->listen_depth));
-		vca_tcp_opt_set(ls->sock, 1);
+		vca_tcp_opt_set(ls->sock, 0, 1);
 		if (cache_param->accept_filter) {
 			int i;
 			i = VTCP_filter_http(ls->sock);
@@ -548,6 +620,8 @@ vca_acct(void *arg)
 
 	need_test = 1;
 	pool_accepting = 1;
+	VSC_C_main->startup_ms =
+	    (uint64_t)((VTIM_mono() - heritage.t_launch) * 1e3);
 
 	t0 = VTIM_real();
 	while (1) {
@@ -557,7 +631,7 @@ vca_acct(void *arg)
 				if (ls->sock == -2)
 					continue;	// raced VCA_Shutdown
 				assert (ls->sock > 0);
-				vca_tcp_opt_set(ls->sock, 1);
+				vca_tcp_opt_set(ls->sock, ls->uds != NULL, 1);
 			}
 		}
 		now = VTIM_real();
@@ -601,6 +675,12 @@ ccf_listen_address(struct cli *cli, const char * const *av, void *priv)
 		VTIM_sleep(.1);
 
 	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		if (ls->reuse_idx > 0)
+			continue;
+		if (ls->uds != NULL) {
+			VCLI_Out(cli, "%s -\n", ls->name);
+			continue;
+		}
 		VTCP_myname(ls->sock, h, sizeof h, p, sizeof p);
 		VCLI_Out(cli, "%s %s\n", h, p);
 	}
@@ -654,6 +734,9 @@ XPORT_Init(void)
 	VTAILQ_INSERT_TAIL(&transports, &PROXY_transport, list);
 	VTAILQ_INSERT_TAIL(&transports, &HTTP1_transport, list);
 	VTAILQ_INSERT_TAIL(&transports, &H2_transport, list);
+#if defined(HAVE_OPENSSL)
+	VTAILQ_INSERT_TAIL(&transports, &TLS_transport, list);
+#endif
 
 	n = 0;
 	VTAILQ_FOREACH(xp, &transports, list)
@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Admission of fetched objects into storage which is full.
+ *
+ * Every lookup counts its hash digest in a count-min sketch of small
+ * saturating counters, behind a "doorkeeper" bloom filter which takes
+ * the first sighting of a digest, so that one-off requests do not
+ * fill up the sketch.  When a fetch would have to nuke an object from
+ * the LRU to make room, the new object is only admitted if it is not
+ * less popular than the one which would go, otherwise it is made
+ * hit-for-miss.  Stevedores which know their free space tell us if
+ * room must be made, for the others we go by whether they have had to
+ * nuke in the last second.
+ *
+ * After a number of counts proportional to the size of the sketch all
+ * counters are halved and the doorkeeper cleared, so that it follows
+ * what is popular now.
+ *
+ * The digest is already a cryptographic hash, so the counter indices
+ * are taken straight from it.  Updates are not locked, a lost or
+ * torn update only makes an estimate a bit off.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache.h"
+#include "cache_priv.h"
+
+#include "storage/storage.h"
+#include "vend.h"
+#include "vrt.h"
+#include "vtim.h"
+
+#define ADM_ROWS		4
+#define ADM_CMAX		15
+#define ADM_SAMPLE		10	/* counts per counter between agings */
+
+static uint8_t			*adm_sketch;	/* ADM_ROWS rows */
+static uint64_t			*adm_door;
+static uint32_t			adm_mask;
+static uint32_t			adm_sample;
+static uint32_t			adm_count;
+
+static uint32_t
+adm_word(const uint8_t *digest, unsigned u)
+{
+
+	return (vle32dec(digest + 4 * u));
+}
+
+/* Set the two doorkeeper bits, returns if they were both set */
+
+static int
+adm_door_test_set(const uint8_t *digest)
+{
+	uint32_t a, b;
+	uint64_t ma, mb;
+	int r;
+
+	a = adm_word(digest, ADM_ROWS) & adm_mask;
+	b = adm_word(digest, ADM_ROWS + 1) & adm_mask;
+	ma = (uint64_t)1 << (a & 63);
+	mb = (uint64_t)1 << (b & 63);
+	r = (adm_door[a >> 6] & ma) && (adm_door[b >> 6] & mb);
+	if (!r) {
+		adm_door[a >> 6] |= ma;
+		adm_door[b >> 6] |= mb;
+	}
+	return (r);
+}
+
+static void
+adm_age(void)
+{
+	size_t u;
+
+	for (u = 0; u < ADM_ROWS * ((size_t)adm_mask + 1); u++)
+		adm_sketch[u] >>= 1;
+	memset(adm_door, 0, ((adm_mask >> 6) + 1) * sizeof *adm_door);
+}
+
+/*--------------------------------------------------------------------
+ * Count a lookup of the digest.  The counters at the minimum are the
+ * only ones raised, which keeps the estimates of other digests sharing
+ * the other counters down.
+ */
+
+void
+ADM_Touch(const uint8_t *digest)
+{
+	uint8_t *c[ADM_ROWS], min = ADM_CMAX;
+	unsigned u;
+
+	if (adm_sketch == NULL)
+		return;
+	AN(digest);
+	if (__sync_add_and_fetch(&adm_count, 1) == adm_sample) {
+		adm_count = 0;
+		adm_age();
+	}
+	if (!adm_door_test_set(digest))
+		return;
+	for (u = 0; u < ADM_ROWS; u++) {
+		c[u] = adm_sketch + (size_t)u * (adm_mask + 1) +
+		    (adm_word(digest, u) & adm_mask);
+		if (*c[u] < min)
+			min = *c[u];
+	}
+	if (min == ADM_CMAX)
+		return;
+	for (u = 0; u < ADM_ROWS; u++)
+		if (*c[u] == min)
+			*c[u] = min + 1;
+}
+
+static unsigned
+adm_estimate(const uint8_t *digest)
+{
+	unsigned u, min = ADM_CMAX, n;
+	uint32_t a, b;
+
+	for (u = 0; u < ADM_ROWS; u++) {
+		n = adm_sketch[(size_t)u * (adm_mask + 1) +
+		    (adm_word(digest, u) & adm_mask)];
+		if (n < min)
+			min = n;
+	}
+	a = adm_word(digest, ADM_ROWS) & adm_mask;
+	b = adm_word(digest, ADM_ROWS + 1) & adm_mask;
+	if ((adm_door[a >> 6] & ((uint64_t)1 << (a & 63))) &&
+	    (adm_door[b >> 6] & ((uint64_t)1 << (b & 63))))
+		min++;
+	return (min);
+}
+
+/*--------------------------------------------------------------------
+ * Should the object with this digest go into this stevedore?
+ */
+
+int
+ADM_Admit(struct worker *wrk, const struct stevedore *stv,
+    const uint8_t *digest, uint64_t size)
+{
+	uint8_t victim[DIGEST_LEN];
+	unsigned c, v;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	AN(digest);
+
+	if (adm_sketch == NULL || stv->lru == NULL)
+		return (1);
+	if (stv->var_free_space != NULL) {
+		if (stv->var_free_space(stv) >= (VCL_BYTES)size)
+			return (1);
+	} else if (VTIM_real() - LRU_LastNuke(stv->lru) > 1.)
+		return (1);
+	if (!LRU_Victim(stv->lru, victim))
+		return (1);
+	c = adm_estimate(digest);
+	v = adm_estimate(victim);
+	if (c >= v) {
+		wrk->stats->cache_admitted++;
+		return (1);
+	}
+	VSLb(wrk->vsl, SLT_Debug, "Admission denied %u < %u", c, v);
+	wrk->stats->cache_not_admitted++;
+	return (0);
+}
+
+void
+ADM_Init(void)
+{
+	unsigned n;
+
+	if (cache_param->admission_sketch == 0)
+		return;
+	for (n = 64; n < cache_param->admission_sketch && n < (1U << 28); )
+		n <<= 1;
+	adm_mask = n - 1;
+	adm_sample = ADM_SAMPLE * n;
+	adm_sketch = calloc(ADM_ROWS, n);
+	AN(adm_sketch);
+	adm_door = calloc(n >> 6, sizeof *adm_door);
+	AN(adm_door);
+}
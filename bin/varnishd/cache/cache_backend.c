@@ -32,6 +32,9 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
 #include <stdlib.h>
 
 #include "cache.h"
@@ -55,18 +58,166 @@
 			dst = cache_param->tmx;				\
 	} while (0)
 
+/*--------------------------------------------------------------------
+ * Take one of the .max_connections, called with bp->mtx held.
+ *
+ * With backend_wait_timeout, a fetch which finds them all taken waits
+ * for one to be given back in vbe_dir_finish(), unless there are already
+ * backend_wait_limit fetches waiting.
+ */
+
+static int
+vbe_dir_take(struct backend *bp)
+{
+	double t0, tmo;
+
+	Lck_AssertHeld(&bp->mtx);
+	if (bp->max_connections > 0 && bp->n_conn >= bp->max_connections) {
+		tmo = cache_param->backend_wait_timeout;
+		if (tmo <= 0.0 || bp->n_wait >= cache_param->backend_wait_limit)
+			return (-1);
+		bp->n_wait++;
+		bp->vsc->wait++;
+		t0 = VTIM_real();
+		while (bp->n_conn >= bp->max_connections &&
+		    Lck_CondWait(&bp->cond, &bp->mtx, t0 + tmo) != ETIMEDOUT)
+			continue;
+		bp->n_wait--;
+		bp->vsc->wait--;
+		bp->vsc->wait_usec += (uint64_t)((VTIM_real() - t0) * 1e6);
+		if (bp->n_conn >= bp->max_connections) {
+			bp->vsc->wait_timeout++;
+			return (-1);
+		}
+		bp->vsc->wait_done++;
+	}
+	bp->n_conn++;
+	bp->vsc->conn++;
+	bp->vsc->req++;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Circuit breaker, called with bp->mtx held.
+ *
+ * After backend_breaker_fails fetches in a row failed, the backend is
+ * sick for backend_breaker_open, so fetches go elsewhere or fail fast.
+ * Then one fetch at a time is let through to try it out, and the first
+ * which succeeds closes the breaker again.
+ *
+ * vbe_dir_try() takes the trial for bo if the breaker is not closed,
+ * vbe_dir_breaker() tells it how a fetch went, ok < 0 meaning we do not
+ * know, because the fetch never got to ask the backend.
+ */
+
+static int
+vbe_dir_try(struct backend *bp, const struct busyobj *bo)
+{
+
+	Lck_AssertHeld(&bp->mtx);
+	if (bp->cb_until == 0.0 || bp->admin_health != vbe_ah_probe)
+		return (0);
+	if (bp->cb_trial != NULL || VTIM_real() < bp->cb_until)
+		return (-1);
+	bp->cb_trial = bo;
+	return (0);
+}
+
+static void
+vbe_dir_breaker(struct backend *bp, const struct busyobj *bo, int ok)
+{
+	int trial;
+
+	Lck_AssertHeld(&bp->mtx);
+	trial = bo != NULL && bp->cb_trial == bo;
+	if (trial)
+		bp->cb_trial = NULL;
+	if (ok > 0) {
+		bp->cb_fails = 0;
+		if (bp->cb_until != 0.0) {
+			bp->cb_until = 0.0;
+			bp->cb_trial = NULL;
+			bp->health_changed = VTIM_real();
+			VDI_HealthTimed(0);
+		}
+		return;
+	}
+	if (ok < 0)
+		return;
+	if (bp->cb_until != 0.0) {
+		/* Only the trial decides while the breaker is open */
+		if (trial) {
+			bp->cb_until =
+			    VTIM_real() + cache_param->backend_breaker_open;
+			VSC_C_main->backend_breaker++;
+			VDI_HealthChanged();
+		}
+		return;
+	}
+	if (cache_param->backend_breaker_fails == 0 ||
+	    ++bp->cb_fails < cache_param->backend_breaker_fails)
+		return;
+	bp->cb_until = VTIM_real() + cache_param->backend_breaker_open;
+	bp->health_changed = VTIM_real();
+	VSC_C_main->backend_breaker++;
+	VSL(SLT_Debug, 0, "%s circuit breaker open after %u failures",
+	    bp->display_name, bp->cb_fails);
+	VDI_HealthTimed(1);
+}
+
+static void
+vbe_dir_outcome(struct backend *bp, const struct busyobj *bo, int ok)
+{
+
+	Lck_Lock(&bp->mtx);
+	vbe_dir_breaker(bp, bo, ok);
+	Lck_Unlock(&bp->mtx);
+}
+
+/* Give one back, called with bp->mtx held */
+
+static void
+vbe_dir_give(struct backend *bp)
+{
+
+	Lck_AssertHeld(&bp->mtx);
+	assert(bp->n_conn > 0);
+	bp->n_conn--;
+	bp->vsc->conn--;
+	if (bp->n_wait > 0)
+		AZ(pthread_cond_signal(&bp->cond));
+}
+
 /*--------------------------------------------------------------------
  * Get a connection to the backend
+ *
+ * With pending non-NULL a new connection may come back still connecting,
+ * with *pending set, and vbe_dir_opened() must wait until it is done.
  */
 
-static struct vbc *
-vbe_dir_getfd(struct worker *wrk, struct backend *bp, struct busyobj *bo)
+static void
+vbe_dir_opened(const struct backend *bp, struct busyobj *bo,
+    const struct vbc *vc)
 {
-	struct vbc *vc;
-	double tmod;
 	char abuf1[VTCP_ADDRBUFSIZE], abuf2[VTCP_ADDRBUFSIZE];
 	char pbuf1[VTCP_PORTBUFSIZE], pbuf2[VTCP_PORTBUFSIZE];
 
+	if (bp->proxy_header != 0)
+		VPX_Send_Proxy(vc->fd, bp->proxy_header, bo->sp);
+
+	VTCP_myname(vc->fd, abuf1, sizeof abuf1, pbuf1, sizeof pbuf1);
+	VTCP_hisname(vc->fd, abuf2, sizeof abuf2, pbuf2, sizeof pbuf2);
+	VSLb(bo->vsl, SLT_BackendOpen, "%d %s %s %s %s %s",
+	    vc->fd, bp->display_name, abuf2, pbuf2, abuf1, pbuf1);
+}
+
+static struct vbc *
+vbe_dir_getfd(struct worker *wrk, struct backend *bp, struct busyobj *bo,
+    int *pending)
+{
+	struct vbc *vc;
+	double tmod, t, now;
+
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
@@ -78,12 +229,6 @@ vbe_dir_getfd(struct worker *wrk, struct backend *bp, struct busyobj *bo)
 		return (NULL);
 	}
 
-	if (bp->max_connections > 0 && bp->n_conn >= bp->max_connections) {
-		// XXX: per backend stats ?
-		VSC_C_main->backend_busy++;
-		return (NULL);
-	}
-
 	AZ(bo->htc);
 	bo->htc = WS_Alloc(bo->ws, sizeof *bo->htc);
 	if (bo->htc == NULL)
@@ -91,11 +236,33 @@ vbe_dir_getfd(struct worker *wrk, struct backend *bp, struct busyobj *bo)
 		return (NULL);
 	bo->htc->doclose = SC_NULL;
 
+	Lck_Lock(&bp->mtx);
+	if (vbe_dir_try(bp, bo)) {
+		Lck_Unlock(&bp->mtx);
+		VSC_C_main->backend_unhealthy++;
+		bo->htc = NULL;
+		return (NULL);
+	}
+	if (vbe_dir_take(bp)) {
+		vbe_dir_breaker(bp, bo, -1);
+		Lck_Unlock(&bp->mtx);
+		// XXX: per backend stats ?
+		VSC_C_main->backend_busy++;
+		bo->htc = NULL;
+		return (NULL);
+	}
+	Lck_Unlock(&bp->mtx);
+
 	FIND_TMO(connect_timeout, tmod, bo, bp);
-	vc = VBT_Get(bp->tcp_pool, tmod, bp, wrk);
+	t = VTIM_real();
+	vc = VBT_Get(bp->tcp_pool, tmod, bp, wrk, pending);
 	if (vc == NULL) {
 		// XXX: Per backend stats ?
 		VSC_C_main->backend_fail++;
+		Lck_Lock(&bp->mtx);
+		vbe_dir_give(bp);
+		vbe_dir_breaker(bp, bo, 0);
+		Lck_Unlock(&bp->mtx);
 		bo->htc = NULL;
 		return (NULL);
 	}
@@ -103,20 +270,6 @@ vbe_dir_getfd(struct worker *wrk, struct backend *bp, struct busyobj *bo)
 	assert(vc->fd >= 0);
 	AN(vc->addr);
 
-	Lck_Lock(&bp->mtx);
-	bp->n_conn++;
-	bp->vsc->conn++;
-	bp->vsc->req++;
-	Lck_Unlock(&bp->mtx);
-
-	if (bp->proxy_header != 0)
-		VPX_Send_Proxy(vc->fd, bp->proxy_header, bo->sp);
-
-	VTCP_myname(vc->fd, abuf1, sizeof abuf1, pbuf1, sizeof pbuf1);
-	VTCP_hisname(vc->fd, abuf2, sizeof abuf2, pbuf2, sizeof pbuf2);
-	VSLb(bo->vsl, SLT_BackendOpen, "%d %s %s %s %s %s",
-	    vc->fd, bp->display_name, abuf2, pbuf2, abuf1, pbuf1);
-
 	INIT_OBJ(bo->htc, HTTP_CONN_MAGIC);
 	bo->htc->priv = vc;
 	bo->htc->rfd = &vc->fd;
@@ -124,6 +277,17 @@ vbe_dir_getfd(struct worker *wrk, struct backend *bp, struct busyobj *bo)
 	    bo->htc->first_byte_timeout, bo, bp);
 	FIND_TMO(between_bytes_timeout,
 	    bo->htc->between_bytes_timeout, bo, bp);
+
+	if (pending != NULL && *pending) {
+		vc->connect_tmo = tmod;
+		/* Ended by vbe_dir_connected() */
+		VSL_Span(bo->vsl, VSL_SPAN_CONNECT, t, NAN);
+		return (vc);
+	}
+	now = W_TIM_real(wrk);
+	WRK_Latency(wrk, LAT_connect, now - t);
+	VSL_Span(bo->vsl, VSL_SPAN_CONNECT, t, now);
+	vbe_dir_opened(bp, bo, vc);
 	return (vc);
 }
 
@@ -152,31 +316,304 @@ vbe_dir_finish(const struct director *d, struct worker *wrk,
 	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
 
 	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
-	CAST_OBJ_NOTNULL(vbc, bo->htc->priv, VBC_MAGIC);
-	bo->htc->priv = NULL;
-	if (vbc->state != VBC_STATE_USED)
-		VBT_Wait(wrk, vbc);
-	if (bo->htc->doclose != SC_NULL || bp->proxy_header != 0) {
-		VSLb(bo->vsl, SLT_BackendClose, "%d %s", vbc->fd,
-		    bp->display_name);
-		VBT_Close(bp->tcp_pool, &vbc);
+	if (bp->http2) {
+		/* The connection is not ours to close */
+		H2F_Finish(bo);
 		Lck_Lock(&bp->mtx);
 	} else {
-		VSLb(bo->vsl, SLT_BackendReuse, "%d %s", vbc->fd,
-		    bp->display_name);
-		Lck_Lock(&bp->mtx);
-		VSC_C_main->backend_recycle++;
-		VBT_Recycle(wrk, bp->tcp_pool, &vbc);
+		CAST_OBJ_NOTNULL(vbc, bo->htc->priv, VBC_MAGIC);
+		bo->htc->priv = NULL;
+		if (vbc->state != VBC_STATE_USED)
+			VBT_Wait(wrk, vbc);
+		if (bo->htc->doclose != SC_NULL || bp->proxy_header != 0) {
+			VSLb(bo->vsl, SLT_BackendClose, "%d %s", vbc->fd,
+			    bp->display_name);
+			VBT_Close(bp->tcp_pool, &vbc);
+			Lck_Lock(&bp->mtx);
+		} else {
+			VSLb(bo->vsl, SLT_BackendReuse, "%d %s", vbc->fd,
+			    bp->display_name);
+			Lck_Lock(&bp->mtx);
+			VSC_C_main->backend_recycle++;
+			VBT_Recycle(wrk, bp->tcp_pool, &vbc);
+		}
 	}
-	assert(bp->n_conn > 0);
-	bp->n_conn--;
-	bp->vsc->conn--;
+	vbe_dir_give(bp);
 #define ACCT(foo)	bp->vsc->foo += bo->acct.foo;
 #include "tbl/acct_fields_bereq.h"
 	Lck_Unlock(&bp->mtx);
 	bo->htc = NULL;
 }
 
+/*--------------------------------------------------------------------
+ * Get a connection and send the request on it.
+ *
+ * With can_park, a fetch which has to open a new connection parks on it
+ * until connect(2) is done, rather than wait in poll(2).  We return 1
+ * then, and vbe_dir_connected() sends the request when we come back.
+ */
+
+static int
+vbe_dir_send(struct worker *wrk, struct busyobj *bo, struct vbc *vbc)
+{
+	int i;
+
+	i = V1F_SendReq(wrk, bo, &bo->acct.bereq_hdrbytes, 0);
+
+	if (vbc->state != VBC_STATE_USED)
+		VBT_Wait(wrk, vbc);
+
+	assert(vbc->state == VBC_STATE_USED);
+	return (i);
+}
+
+static int
+vbe_dir_sendreq(struct worker *wrk, struct backend *bp, struct busyobj *bo,
+    int *extrachance, int can_park)
+{
+	struct vbc *vbc;
+	int pending = 0;
+
+	vbc = vbe_dir_getfd(wrk, bp, bo, can_park ? &pending : NULL);
+	if (vbc == NULL) {
+		VSLb(bo->vsl, SLT_FetchError, "no backend connection");
+		return (-2);
+	}
+	AN(bo->htc);
+	if (!vbc->reused)
+		*extrachance = 0;
+
+	if (pending) {
+		CHECK_OBJ(vbc->waited, WAITED_MAGIC);
+		vbc->waited->fd = vbc->fd;
+		vbc->waited->idle = VTIM_real();
+		vbc->waited->tmo = &vbc->connect_tmo;
+		vbc->waited->want_write = 1;
+		bo->park = vbc->waited;
+		wrk->stats->fetch_parked_connect++;
+		return (1);
+	}
+
+	return (vbe_dir_send(wrk, bo, vbc));
+}
+
+static int
+vbe_dir_connected(struct worker *wrk, const struct backend *bp,
+    struct busyobj *bo, struct vbc *vbc)
+{
+	double now;
+
+	vbc->waited->want_write = 0;
+	now = W_TIM_real(wrk);
+	VSL_SpanEnd(bo->vsl, VSL_SPAN_CONNECT, now);
+	if (vbc->waited->priv2 == WAITER_TIMEOUT)
+		errno = ETIMEDOUT;
+	else if (!VBT_Connected(vbc)) {
+		WRK_Latency(wrk, LAT_connect, now - vbc->waited->idle);
+		vbe_dir_opened(bp, bo, vbc);
+		return (vbe_dir_send(wrk, bo, vbc));
+	}
+	VSC_C_main->backend_fail++;
+	VSLb(bo->vsl, SLT_FetchError, "backend connect failed: %d %s",
+	    errno, strerror(errno));
+	bo->htc->doclose = SC_TX_ERROR;
+	return (-1);
+}
+
+/*--------------------------------------------------------------------
+ * Rather than wait for the response in read(2), let the fetch park
+ * on the connection, unless the response is already here.
+ */
+
+static int
+vbe_dir_park(struct busyobj *bo)
+{
+	struct vbc *vbc;
+	struct pollfd pfd[1];
+
+	if (!bo->can_park)
+		return (0);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(vbc, bo->htc->priv, VBC_MAGIC);
+
+	pfd->fd = vbc->fd;
+	pfd->events = POLLIN;
+	pfd->revents = 0;
+	if (poll(pfd, 1, 0) != 0)
+		return (0);
+
+	CHECK_OBJ(vbc->waited, WAITED_MAGIC);
+	vbc->waited->fd = vbc->fd;
+	vbc->waited->idle = VTIM_real_coarse();
+	vbc->waited->tmo = &bo->htc->first_byte_timeout;
+	bo->park = vbc->waited;
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * A .http2 backend fetches on a stream of a shared connection, the
+ * stream counts against .max_connections, but nothing is parked.
+ */
+
+static int
+vbe_dir_h2gethdrs(const struct director *d, struct worker *wrk,
+    struct backend *bp, struct busyobj *bo)
+{
+	double tmod;
+
+	AZ(bo->htc);
+	if (!VBE_Healthy(bp, NULL))
+		VSC_C_main->backend_unhealthy++;
+	else
+		bo->htc = WS_Alloc(bo->ws, sizeof *bo->htc);
+	if (bo->htc == NULL) {
+		VSLb(bo->vsl, SLT_FetchError, "no backend connection");
+		return (-1);
+	}
+	INIT_OBJ(bo->htc, HTTP_CONN_MAGIC);
+	bo->htc->doclose = SC_NULL;
+	FIND_TMO(first_byte_timeout,
+	    bo->htc->first_byte_timeout, bo, bp);
+	FIND_TMO(between_bytes_timeout,
+	    bo->htc->between_bytes_timeout, bo, bp);
+	FIND_TMO(connect_timeout, tmod, bo, bp);
+
+	if (!http_GetHdr(bo->bereq, H_Host, NULL) && bp->hosthdr != NULL)
+		http_PrintfHeader(bo->bereq, "Host: %s", bp->hosthdr);
+
+	Lck_Lock(&bp->mtx);
+	if (vbe_dir_take(bp)) {
+		Lck_Unlock(&bp->mtx);
+		VSC_C_main->backend_busy++;
+		VSLb(bo->vsl, SLT_FetchError, "no backend connection");
+		bo->htc = NULL;
+		return (-1);
+	}
+	Lck_Unlock(&bp->mtx);
+
+	if (H2F_GetHdrs(wrk, bo, bp, tmod) == 0)
+		return (0);
+	vbe_dir_finish(d, wrk, bo);
+	AZ(bo->htc);
+	return (-1);
+}
+
+/*--------------------------------------------------------------------
+ * Hedged fetches
+ *
+ * A director can name a second backend in bo->hedge: if the response
+ * headers do not start to arrive within bo->hedge_delay, the request is
+ * sent there as well, and whichever backend answers first gets the
+ * fetch.  The other connection is closed.
+ *
+ * Only for GET and HEAD without a request body, between HTTP/1 backends,
+ * and only while fewer than backend_hedge_max hedges are in flight.
+ */
+
+static vdi_gethdrs_f vbe_dir_gethdrs;
+
+static unsigned vbe_n_hedge;
+
+static int
+vbe_dir_hedgeable(const struct director *d, const struct director *hd,
+    const struct busyobj *bo)
+{
+	const struct backend *bp;
+	const char *m;
+
+	CHECK_OBJ_NOTNULL(hd, DIRECTOR_MAGIC);
+	/* Finish and getbody must come back to us, see vbe_dir_hedge() */
+	if (hd == d || bo->director_resp != d || hd->gethdrs != vbe_dir_gethdrs)
+		return (0);
+	CAST_OBJ_NOTNULL(bp, hd->priv, BACKEND_MAGIC);
+	if (bp->http2 || bo->hedge_delay <= 0.0)
+		return (0);
+	if (bo->req != NULL && bo->req->req_body_status != REQ_BODY_NONE)
+		return (0);
+	m = http_GetMethod(bo->bereq);
+	return (!strcmp(m, "GET") || !strcmp(m, "HEAD"));
+}
+
+/*
+ * Called with the request sent on bo->htc.  Returns 1 with bo->htc on the
+ * hedge if that answered first, 0 with bo->htc where it was, or -1 if
+ * neither answered within first_byte_timeout.
+ */
+
+static int
+vbe_dir_hedge(struct worker *wrk, const struct director *d,
+    const struct director *hd, struct busyobj *bo)
+{
+	struct http_conn *htc, *htc2;
+	struct backend *bp, *bp2;
+	struct vbc *vbc;
+	struct pollfd pfd[2];
+	int i, extrachance, tmo;
+
+	CAST_OBJ_NOTNULL(bp2, hd->priv, BACKEND_MAGIC);
+	htc = bo->htc;
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(vbc, htc->priv, VBC_MAGIC);
+
+	pfd[0].fd = vbc->fd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	if (poll(pfd, 1, (int)ceil(bo->hedge_delay * 1e3)) != 0)
+		return (0);
+
+	if (__sync_add_and_fetch(&vbe_n_hedge, 1) >
+	    cache_param->backend_hedge_max) {
+		(void)__sync_sub_and_fetch(&vbe_n_hedge, 1);
+		return (0);
+	}
+
+	bo->htc = NULL;
+	if (!http_GetHdr(bo->bereq, H_Host, NULL) && bp2->hosthdr != NULL)
+		http_PrintfHeader(bo->bereq, "Host: %s", bp2->hosthdr);
+	i = vbe_dir_sendreq(wrk, bp2, bo, &extrachance, 0);
+	if (i != 0) {
+		if (i != -2)
+			vbe_dir_finish(hd, wrk, bo);
+		AZ(bo->htc);
+		bo->htc = htc;
+		(void)__sync_sub_and_fetch(&vbe_n_hedge, 1);
+		return (0);
+	}
+	VSC_C_main->backend_hedge++;
+	VSLb(bo->vsl, SLT_Debug, "Hedged to %s after %.3f",
+	    bp2->display_name, bo->hedge_delay);
+	htc2 = bo->htc;
+	CAST_OBJ_NOTNULL(vbc, htc2->priv, VBC_MAGIC);
+	pfd[1].fd = vbc->fd;
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+	pfd[0].revents = 0;
+
+	tmo = (int)ceil((htc->first_byte_timeout - bo->hedge_delay) * 1e3);
+	i = poll(pfd, 2, tmo > 0 ? tmo : 0);
+	(void)__sync_sub_and_fetch(&vbe_n_hedge, 1);
+
+	if (i > 0 && pfd[0].revents == 0) {
+		/* The hedge won, drop the first connection */
+		VSC_C_main->backend_hedge_won++;
+		bo->htc = htc;
+		htc->doclose = SC_RX_TIMEOUT;
+		vbe_dir_finish(d, wrk, bo);
+		CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
+		vbe_dir_outcome(bp, bo, -1);
+		bo->htc = htc2;
+		return (1);
+	}
+	vbe_dir_finish(hd, wrk, bo);
+	vbe_dir_outcome(bp2, bo, -1);
+	bo->htc = htc;
+	if (i > 0)
+		return (0);
+	VSLb(bo->vsl, SLT_FetchError, "first byte timeout");
+	htc->doclose = SC_RX_TIMEOUT;
+	return (-1);
+}
+
 static int __match_proto__(vdi_gethdrs_f)
 vbe_dir_gethdrs(const struct director *d, struct worker *wrk,
     struct busyobj *bo)
@@ -184,41 +621,69 @@ vbe_dir_gethdrs(const struct director *d, struct worker *wrk,
 	int i, extrachance = 1;
 	struct backend *bp;
 	struct vbc *vbc;
+	const struct director *hd;
 
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
 
-	/*
-	 * Now that we know our backend, we can set a default Host:
-	 * header if one is necessary.  This cannot be done in the VCL
-	 * because the backend may be chosen by a director.
-	 */
-	if (!http_GetHdr(bo->bereq, H_Host, NULL) && bp->hosthdr != NULL)
-		http_PrintfHeader(bo->bereq, "Host: %s", bp->hosthdr);
-
-	do {
-		vbc = vbe_dir_getfd(wrk, bp, bo);
-		if (vbc == NULL) {
-			VSLb(bo->vsl, SLT_FetchError, "no backend connection");
-			return (-1);
+	hd = bo->hedge;
+	bo->hedge = NULL;
+
+	if (bp->http2)
+		return (vbe_dir_h2gethdrs(d, wrk, bp, bo));
+
+	if (bo->parked) {
+		/* Back from parking on connect(2) or for the response */
+		CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+		CAST_OBJ_NOTNULL(vbc, bo->htc->priv, VBC_MAGIC);
+		assert(bo->park == vbc->waited);
+		bo->park = NULL;
+		extrachance = vbc->reused;
+		i = 0;
+		if (vbc->waited->want_write)
+			i = vbe_dir_connected(wrk, bp, bo, vbc);
+		else if (vbc->waited->priv2 == WAITER_TIMEOUT) {
+			VSLb(bo->vsl, SLT_FetchError, "first byte timeout");
+			bo->htc->doclose = SC_RX_TIMEOUT;
+			i = -1;
 		}
-		AN(bo->htc);
-		if (vbc->state != VBC_STATE_STOLEN)
+	} else {
+		/*
+		 * Now that we know our backend, we can set a default Host:
+		 * header if one is necessary.  This cannot be done in the VCL
+		 * because the backend may be chosen by a director.
+		 */
+		if (!http_GetHdr(bo->bereq, H_Host, NULL) &&
+		    bp->hosthdr != NULL)
+			http_PrintfHeader(bo->bereq, "Host: %s", bp->hosthdr);
+		if (hd != NULL && !vbe_dir_hedgeable(d, hd, bo))
+			hd = NULL;
+		i = vbe_dir_sendreq(wrk, bp, bo, &extrachance,
+		    bo->can_park && hd == NULL);
+		if (i > 0)
+			return (i);
+		if (i == 0 && hd != NULL)
+			i = vbe_dir_hedge(wrk, d, hd, bo);
+		if (i > 0) {
+			/* From here on the fetch belongs to the hedge */
+			d = hd;
+			CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
+			bo->director_resp = d;
 			extrachance = 0;
+			i = 0;
+		}
+	}
 
-		i = V1F_SendReq(wrk, bo, &bo->acct.bereq_hdrbytes, 0);
-
-		if (vbc->state != VBC_STATE_USED)
-			VBT_Wait(wrk, vbc);
-
-		assert(vbc->state == VBC_STATE_USED);
-
+	while (i != -2) {
+		if (i == 0 && vbe_dir_park(bo))
+			return (1);
 		if (i == 0)
 			i = V1F_FetchRespHdr(bo);
 		if (i == 0) {
 			AN(bo->htc->priv);
+			vbe_dir_outcome(bp, bo, 1);
 			return (0);
 		}
 
@@ -236,7 +701,13 @@ vbe_dir_gethdrs(const struct director *d, struct worker *wrk,
 		    bo->req->req_body_status != REQ_BODY_CACHED)
 			break;
 		VSC_C_main->backend_retry++;
-	} while (extrachance);
+		if (!extrachance)
+			break;
+		i = vbe_dir_sendreq(wrk, bp, bo, &extrachance, 0);
+	}
+	/* With -2 we never got to the backend, or vbe_dir_getfd() knows */
+	if (i != -2)
+		vbe_dir_outcome(bp, bo, 0);
 	return (-1);
 }
 
@@ -244,13 +715,17 @@ static int __match_proto__(vdi_getbody_f)
 vbe_dir_getbody(const struct director *d, struct worker *wrk,
     struct busyobj *bo)
 {
+	struct backend *bp;
 
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	CHECK_OBJ_NOTNULL(bo->vfc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
 
+	if (bp->http2)
+		return (H2F_Setup_Fetch(bo->vfc, bo->htc));
 	return (V1F_Setup_Fetch(bo->vfc, bo->htc));
 }
 
@@ -258,14 +733,18 @@ static const struct suckaddr * __match_proto__(vdi_getip_f)
 vbe_dir_getip(const struct director *d, struct worker *wrk,
     struct busyobj *bo)
 {
+	struct backend *bp;
 	struct vbc *vbc;
 
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
-	CAST_OBJ_NOTNULL(vbc, bo->htc->priv, VBC_MAGIC);
+	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
 
+	if (bp->http2)
+		return (H2F_GetIP(bo));
+	CAST_OBJ_NOTNULL(vbc, bo->htc->priv, VBC_MAGIC);
 	return (vbc->addr);
 }
 
@@ -293,9 +772,15 @@ vbe_dir_http1pipe(const struct director *d, struct req *req, struct busyobj *bo)
 
 	req->res_mode = RES_PIPE;
 
-	vbc = vbe_dir_getfd(req->wrk, bp, bo);
+	vbc = NULL;
+	if (!bp->http2)
+		vbc = vbe_dir_getfd(req->wrk, bp, bo, NULL);
 
-	if (vbc == NULL) {
+	if (bp->http2) {
+		VSLb(bo->vsl, SLT_FetchError,
+		    "cannot pipe to an HTTP/2 backend");
+		retval = SC_TX_ERROR;
+	} else if (vbc == NULL) {
 		VSLb(bo->vsl, SLT_FetchError, "no backend connection");
 		retval = SC_TX_ERROR;
 	} else {
@@ -306,6 +791,7 @@ vbe_dir_http1pipe(const struct director *d, struct req *req, struct busyobj *bo)
 		VSLb_ts_req(req, "PipeSess", W_TIM_real(req->wrk));
 		bo->htc->doclose = SC_TX_PIPE;
 		vbe_dir_finish(d, req->wrk, bo);
+		vbe_dir_outcome(bp, bo, i == 0 ? 1 : 0);
 		retval = SC_TX_PIPE;
 	}
 	V1P_Charge(req, &v1a, bp->vsc);
@@ -327,8 +813,13 @@ vbe_panic(const struct director *d, struct vsb *vsb)
 		VSB_printf(vsb, "ipv4 = %s,\n", bp->ipv4_addr);
 	if (bp->ipv6_addr != NULL)
 		VSB_printf(vsb, "ipv6 = %s,\n", bp->ipv6_addr);
-	VSB_printf(vsb, "port = %s,\n", bp->port);
+	if (bp->path != NULL)
+		VSB_printf(vsb, "path = %s,\n", bp->path);
+	else
+		VSB_printf(vsb, "port = %s,\n", bp->port);
 	VSB_printf(vsb, "hosthdr = %s,\n", bp->hosthdr);
+	if (bp->http2)
+		VSB_printf(vsb, "http2 = true,\n");
 	VSB_printf(vsb, "health = %s,\n",
 	    bp->healthy ? "healthy" : "sick");
 	VSB_printf(vsb, "admin_health = %s, changed = %f,\n",
@@ -41,6 +41,8 @@ struct vbp_target;
 struct vrt_ctx;
 struct vrt_backend_probe;
 struct tcp_pool;
+struct tcp_shard;
+struct h2f_pool;
 
 /*--------------------------------------------------------------------
  * An instance of a backend from a VCL program.
@@ -51,6 +53,13 @@ struct backend {
 #define BACKEND_MAGIC		0x64c4c7c6
 
 	unsigned		n_conn;
+	unsigned		n_wait;
+	pthread_cond_t		cond;	/* for n_conn, see vbe_dir_take() */
+
+	/* Circuit breaker, see vbe_dir_breaker() */
+	unsigned		cb_fails;
+	double			cb_until;	/* 0: closed */
+	const struct busyobj	*cb_trial;
 
 	VTAILQ_ENTRY(backend)	list;
 	VTAILQ_ENTRY(backend)	vcl_list;
@@ -63,6 +72,7 @@ struct backend {
 
 
 	struct vbp_target	*probe;
+	VTAILQ_ENTRY(backend)	probe_list;
 	unsigned		healthy;
 	const char		*admin_health;
 	double			health_changed;
@@ -70,6 +80,7 @@ struct backend {
 	struct VSC_C_vbe	*vsc;
 
 	struct tcp_pool		*tcp_pool;
+	struct h2f_pool		*h2f_pool;	/* .http2 only */
 
 	struct director		director[1];
 
@@ -91,8 +102,11 @@ struct vbc {
 #define VBC_STATE_USED		(1<<1)
 #define VBC_STATE_STOLEN	(1<<2)
 #define VBC_STATE_CLEANUP	(1<<3)
+	uint8_t			reused;
 	struct waited		waited[1];
+	double			connect_tmo;	/* while parked connecting */
 	struct tcp_pool		*tcp_pool;
+	struct tcp_shard	*tcp_shard;
 
 	pthread_cond_t		*cond;
 };
@@ -105,6 +119,7 @@ struct vbc {
 void VBE_fill_director(struct backend *be);
 
 /* cache_backend_cfg.c */
+extern const char * const vbe_ah_probe;
 unsigned VBE_Healthy(const struct backend *b, double *changed);
 #ifdef VCL_MET_MAX
 void VBE_Event(struct backend *, enum vcl_event_e);
@@ -115,20 +130,30 @@ void VBE_Delete(struct backend *be);
 void VBP_Insert(struct backend *b, struct vrt_backend_probe const *p,
     struct tcp_pool *);
 void VBP_Remove(struct backend *b);
-void VBP_Control(const struct backend *b, int stop);
+void VBP_Control(struct backend *b, int stop);
 void VBP_Status(struct cli *cli, const struct backend *, int details);
 
 /* cache_backend_tcp.c */
 struct tcp_pool *VBT_Ref(const struct suckaddr *ip4,
-    const struct suckaddr *ip6);
+    const struct suckaddr *ip6, const char *path);
 void VBT_Rel(struct tcp_pool **tpp);
 int VBT_Open(const struct tcp_pool *tp, double tmo, const struct suckaddr **sa);
 void VBT_Recycle(const struct worker *, struct tcp_pool *, struct vbc **);
 void VBT_Close(struct tcp_pool *tp, struct vbc **vbc);
 struct vbc *VBT_Get(struct tcp_pool *, double tmo, const struct backend *,
-    struct worker *);
+    struct worker *, int *pending);
+int VBT_Connected(const struct vbc *);
 void VBT_Wait(struct worker *, struct vbc *);
 
+/* http2/cache_http2_fetch.c */
+struct h2f_pool *H2F_New(void);
+void H2F_Delete(struct h2f_pool **);
+int H2F_GetHdrs(struct worker *, struct busyobj *, const struct backend *,
+    double tmo);
+int H2F_Setup_Fetch(struct vfp_ctx *, struct http_conn *);
+void H2F_Finish(struct busyobj *);
+const struct suckaddr *H2F_GetIP(const struct busyobj *);
+
 /* cache_vcl.c */
 int VCL_AddBackend(struct vcl *, struct backend *);
 void VCL_DelBackend(struct backend *);
@@ -53,7 +53,7 @@ static struct lock backends_mtx;
 
 static const char * const vbe_ah_healthy	= "healthy";
 static const char * const vbe_ah_sick		= "sick";
-static const char * const vbe_ah_probe		= "probe";
+const char * const vbe_ah_probe		= "probe";
 static const char * const vbe_ah_deleted	= "deleted";
 
 /*--------------------------------------------------------------------
@@ -73,7 +73,8 @@ VRT_new_backend(VRT_CTX, const struct vrt_backend *vrt)
 
 	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(vrt, VRT_BACKEND_MAGIC);
-	assert(vrt->ipv4_suckaddr != NULL || vrt->ipv6_suckaddr != NULL);
+	assert(vrt->ipv4_suckaddr != NULL || vrt->ipv6_suckaddr != NULL ||
+	    vrt->path != NULL);
 
 	vcl = ctx->vcl;
 	AN(vcl);
@@ -83,6 +84,7 @@ VRT_new_backend(VRT_CTX, const struct vrt_backend *vrt)
 	ALLOC_OBJ(b, BACKEND_MAGIC);
 	XXXAN(b);
 	Lck_New(&b->mtx, lck_backend);
+	AZ(pthread_cond_init(&b->cond, NULL));
 
 #define DA(x)	do { if (vrt->x != NULL) REPLACE((b->x), (vrt->x)); } while (0)
 #define DN(x)	do { b->x = vrt->x; } while (0)
@@ -112,13 +114,18 @@ VRT_new_backend(VRT_CTX, const struct vrt_backend *vrt)
 	Lck_Lock(&backends_mtx);
 	VTAILQ_INSERT_TAIL(&backends, b, list);
 	VSC_C_main->n_backend++;
-	b->tcp_pool = VBT_Ref(vrt->ipv4_suckaddr, vrt->ipv6_suckaddr);
+	b->tcp_pool = VBT_Ref(vrt->ipv4_suckaddr, vrt->ipv6_suckaddr,
+	    vrt->path);
 	if (vbp != NULL) {
-		tp = VBT_Ref(vrt->ipv4_suckaddr, vrt->ipv6_suckaddr);
+		tp = VBT_Ref(vrt->ipv4_suckaddr, vrt->ipv6_suckaddr,
+		    vrt->path);
 		assert(b->tcp_pool == tp);
 	}
 	Lck_Unlock(&backends_mtx);
 
+	if (b->http2)
+		b->h2f_pool = H2F_New();
+
 	VBE_fill_director(b);
 
 	if (vbp != NULL)
@@ -152,6 +159,7 @@ VRT_delete_backend(VRT_CTX, struct director **dp)
 	Lck_Lock(&be->mtx);
 	be->admin_health = vbe_ah_deleted;
 	be->health_changed = VTIM_real();
+	VDI_HealthChanged();
 	be->cooled = VTIM_real() + 60.;
 	Lck_Unlock(&be->mtx);
 	Lck_Lock(&backends_mtx);
@@ -208,6 +216,9 @@ VBE_Delete(struct backend *be)
 	VBT_Rel(&be->tcp_pool);
 	Lck_Unlock(&backends_mtx);
 
+	if (be->h2f_pool != NULL)
+		H2F_Delete(&be->h2f_pool);
+
 #define DA(x)	do { if (be->x != NULL) free(be->x); } while (0)
 #define DN(x)	/**/
 	VRT_BACKEND_HANDLE();
@@ -216,6 +227,10 @@ VBE_Delete(struct backend *be)
 
 	free(be->display_name);
 	AZ(be->vsc);
+	AZ(be->n_wait);
+	if (be->cb_until != 0.0)
+		VDI_HealthTimed(0);
+	AZ(pthread_cond_destroy(&be->cond));
 	Lck_Delete(&be->mtx);
 	FREE_OBJ(be);
 }
@@ -249,8 +264,13 @@ VBE_Healthy(const struct backend *backend, double *changed)
 	if (changed != NULL)
 		*changed = backend->health_changed;
 
-	if (backend->admin_health == vbe_ah_probe)
+	if (backend->admin_health == vbe_ah_probe) {
+		/* An open circuit breaker, or one trying a fetch */
+		if (backend->cb_until != 0.0 && (backend->cb_trial != NULL ||
+		    VTIM_real() < backend->cb_until))
+			return (0);
 		return (backend->healthy);
+	}
 
 	if (backend->admin_health == vbe_ah_sick)
 		return (0);
@@ -335,15 +355,17 @@ do_list(struct cli *cli, struct backend *b, void *priv)
 
 	VCLI_Out(cli, " %-10s", b->admin_health);
 
-	if (b->probe == NULL)
+	if (b->admin_health == vbe_ah_probe && b->cb_until != 0.0 &&
+	    !VBE_Healthy(b, NULL))
+		VCLI_Out(cli, " %-20s", "Sick (breaker)");
+	else if (b->probe == NULL)
 		VCLI_Out(cli, " %-20s", "Healthy (no probe)");
-	else {
-		if (b->healthy)
-			VCLI_Out(cli, " %-20s", "Healthy ");
-		else
-			VCLI_Out(cli, " %-20s", "Sick ");
+	else if (b->healthy)
+		VCLI_Out(cli, " %-20s", "Healthy ");
+	else
+		VCLI_Out(cli, " %-20s", "Sick ");
+	if (b->probe != NULL)
 		VBP_Status(cli, b, *probes);
-	}
 
 	VTIM_format(b->health_changed, time_str);
 	VCLI_Out(cli, " %s", time_str);
@@ -391,8 +413,10 @@ do_set_health(struct cli *cli, struct backend *b, void *priv)
 	prev = VBE_Healthy(b, NULL);
 	if (b->admin_health != vbe_ah_deleted)
 		b->admin_health = *ah;
-	if (prev != VBE_Healthy(b, NULL))
+	if (prev != VBE_Healthy(b, NULL)) {
 		b->health_changed = VTIM_real();
+		VDI_HealthChanged();
+	}
 
 	return (0);
 }
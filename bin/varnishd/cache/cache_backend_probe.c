@@ -33,6 +33,10 @@
  * retire the backend, so the thread owns the health information, which
  * the backend references, rather than the other way around.
  *
+ * Backends with the same addresses and identical probes, typically the
+ * same backend in several loaded VCLs, share one target, so the backend
+ * server is only polled once.
+ *
  */
 
 #include "config.h"
@@ -62,7 +66,10 @@ struct vbp_target {
 
 	VRT_BACKEND_PROBE_FIELDS()
 
-	struct backend			*backend;
+	VTAILQ_ENTRY(vbp_target)	list;
+	VTAILQ_HEAD(, backend)		backends;
+	unsigned			refcnt;
+	unsigned			n_enabled;
 	struct tcp_pool			*tcp_pool;
 
 	char				*req;
@@ -88,12 +95,16 @@ struct vbp_target {
 static struct lock			vbp_mtx;
 static pthread_cond_t			vbp_cond;
 static struct binheap			*vbp_heap;
+static VTAILQ_HEAD(, vbp_target)	vbp_targets =
+    VTAILQ_HEAD_INITIALIZER(vbp_targets);
 
 /*--------------------------------------------------------------------*/
 
 static void
 vbp_delete(struct vbp_target *vt)
 {
+	assert(VTAILQ_EMPTY(&vt->backends));
+	VSC_C_main->n_probe--;
 #define DN(x)	/**/
 	VRT_BACKEND_PROBE_HANDLE();
 #undef DN
@@ -145,45 +156,58 @@ vbp_has_poked(struct vbp_target *vt)
 }
 
 static void
-vbp_update_backend(struct vbp_target *vt)
+vbp_update_one(const struct vbp_target *vt, struct backend *be)
 {
 	unsigned i;
 	char bits[10];
 	const char *logmsg;
 
 	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
+	CHECK_OBJ_NOTNULL(be, BACKEND_MAGIC);
+	Lck_AssertHeld(&vbp_mtx);
 
-	Lck_Lock(&vbp_mtx);
-	if (vt->backend != NULL) {
-		i = 0;
+	i = 0;
 #define BITMAP(n, c, t, b) \
-		bits[i++] = (vt->n & 1) ? c : '-';
+	bits[i++] = (vt->n & 1) ? c : '-';
 #include "tbl/backend_poll.h"
-		bits[i] = '\0';
-
-		if (vt->good >= vt->threshold) {
-			if (vt->backend->healthy)
-				logmsg = "Still healthy";
-			else {
-				logmsg = "Back healthy";
-				vt->backend->health_changed = VTIM_real();
-			}
-			vt->backend->healthy = 1;
-		} else {
-			if (vt->backend->healthy) {
-				logmsg = "Went sick";
-				vt->backend->health_changed = VTIM_real();
-			} else
-				logmsg = "Still sick";
-			vt->backend->healthy = 0;
+	bits[i] = '\0';
+
+	if (vt->good >= vt->threshold) {
+		if (be->healthy)
+			logmsg = "Still healthy";
+		else {
+			logmsg = "Back healthy";
+			be->health_changed = VTIM_real();
+			VDI_HealthChanged();
 		}
-		VSL(SLT_Backend_health, 0, "%s %s %s %u %u %u %.6f %.6f %s",
-		    vt->backend->display_name, logmsg, bits,
-		    vt->good, vt->threshold, vt->window,
-		    vt->last, vt->avg, vt->resp_buf);
-		if (vt->backend != NULL && vt->backend->vsc != NULL)
-			vt->backend->vsc->happy = vt->happy;
+		be->healthy = 1;
+	} else {
+		if (be->healthy) {
+			logmsg = "Went sick";
+			be->health_changed = VTIM_real();
+			VDI_HealthChanged();
+		} else
+			logmsg = "Still sick";
+		be->healthy = 0;
 	}
+	VSL(SLT_Backend_health, 0, "%s %s %s %u %u %u %.6f %.6f %s",
+	    be->display_name, logmsg, bits,
+	    vt->good, vt->threshold, vt->window,
+	    vt->last, vt->avg, vt->resp_buf);
+	if (be->vsc != NULL)
+		be->vsc->happy = vt->happy;
+}
+
+static void
+vbp_update_backend(struct vbp_target *vt)
+{
+	struct backend *be;
+
+	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
+
+	Lck_Lock(&vbp_mtx);
+	VTAILQ_FOREACH(be, &vt->backends, probe_list)
+		vbp_update_one(vt, be);
 	Lck_Unlock(&vbp_mtx);
 }
 
@@ -506,8 +530,13 @@ vbp_set_defaults(struct vbp_target *vt, const struct vrt_backend_probe *vp)
 /*--------------------------------------------------------------------
  */
 
+/*--------------------------------------------------------------------
+ * Only warm backends are on the target's list, and the target is only
+ * polled while there are any.
+ */
+
 void
-VBP_Control(const struct backend *be, int enable)
+VBP_Control(struct backend *be, int enable)
 {
 	struct vbp_target *vt;
 
@@ -515,6 +544,25 @@ VBP_Control(const struct backend *be, int enable)
 	vt = be->probe;
 	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
 
+	Lck_Lock(&vbp_mtx);
+	if (enable) {
+		VTAILQ_INSERT_TAIL(&vt->backends, be, probe_list);
+		if (vt->n_enabled++ > 0) {
+			/* Already polled for somebody else */
+			vbp_update_one(vt, be);
+			Lck_Unlock(&vbp_mtx);
+			return;
+		}
+	} else {
+		assert(vt->n_enabled > 0);
+		if (--vt->n_enabled > 0) {
+			VTAILQ_REMOVE(&vt->backends, be, probe_list);
+			Lck_Unlock(&vbp_mtx);
+			return;
+		}
+	}
+	Lck_Unlock(&vbp_mtx);
+
 	vbp_reset(vt);
 	vbp_update_backend(vt);
 
@@ -527,10 +575,30 @@ VBP_Control(const struct backend *be, int enable)
 	} else {
 		assert(vt->heap_idx != BINHEAP_NOIDX);
 		binheap_delete(vbp_heap, vt->heap_idx);
+		VTAILQ_REMOVE(&vt->backends, be, probe_list);
+		assert(VTAILQ_EMPTY(&vt->backends));
 	}
 	Lck_Unlock(&vbp_mtx);
 }
 
+/*--------------------------------------------------------------------
+ * Same addresses, same request, same timing: same probe.
+ */
+
+static int
+vbp_same(const struct vbp_target *a, const struct vbp_target *b)
+{
+
+	if (a->tcp_pool != b->tcp_pool)
+		return (0);
+	if (a->req_len != b->req_len || memcmp(a->req, b->req, a->req_len))
+		return (0);
+#define DN(x)	do { if (a->x != b->x) return (0); } while (0)
+	VRT_BACKEND_PROBE_HANDLE();
+#undef DN
+	return (1);
+}
+
 /*--------------------------------------------------------------------
  * Insert/Remove/Use called from cache_backend.c
  */
@@ -539,7 +607,7 @@ void
 VBP_Insert(struct backend *b, const struct vrt_backend_probe *vp,
     struct tcp_pool *tp)
 {
-	struct vbp_target *vt;
+	struct vbp_target *vt, *vt2;
 
 	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
 	CHECK_OBJ_NOTNULL(vp, VRT_BACKEND_PROBE_MAGIC);
@@ -550,14 +618,35 @@ VBP_Insert(struct backend *b, const struct vrt_backend_probe *vp,
 	XXXAN(vt);
 
 	vt->tcp_pool = tp;
-	vt->backend = b;
-	b->probe = vt;
+	VTAILQ_INIT(&vt->backends);
 
 	vbp_set_defaults(vt, vp);
 	vbp_build_req(vt, vp, b);
 
+	Lck_Lock(&vbp_mtx);
+	VTAILQ_FOREACH(vt2, &vbp_targets, list)
+		if (vbp_same(vt, vt2))
+			break;
+	if (vt2 != NULL) {
+		vt2->refcnt++;
+		b->probe = vt2;
+		vbp_update_one(vt2, b);
+		Lck_Unlock(&vbp_mtx);
+		VBT_Rel(&vt->tcp_pool);
+		free(vt->req);
+		FREE_OBJ(vt);
+		return;
+	}
+	vt->refcnt = 1;
+	b->probe = vt;
+	VTAILQ_INSERT_TAIL(&vbp_targets, vt, list);
+	VSC_C_main->n_probe++;
+	Lck_Unlock(&vbp_mtx);
+
 	vbp_reset(vt);
-	vbp_update_backend(vt);
+	Lck_Lock(&vbp_mtx);
+	vbp_update_one(vt, b);
+	Lck_Unlock(&vbp_mtx);
 }
 
 void
@@ -570,12 +659,20 @@ VBP_Remove(struct backend *be)
 	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
 
 	Lck_Lock(&vbp_mtx);
+	if (!be->healthy)
+		VDI_HealthChanged();
 	be->healthy = 1;
 	be->probe = NULL;
-	vt->backend = NULL;
-	if (vt->running) {
-		vt->running = -1;
+	assert(vt->refcnt > 0);
+	if (--vt->refcnt > 0) {
 		vt = NULL;
+	} else {
+		AZ(vt->n_enabled);
+		VTAILQ_REMOVE(&vbp_targets, vt, list);
+		if (vt->running) {
+			vt->running = -1;
+			vt = NULL;
+		}
 	}
 	Lck_Unlock(&vbp_mtx);
 	if (vt != NULL) {
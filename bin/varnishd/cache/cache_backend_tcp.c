@@ -34,6 +34,9 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <stdlib.h>
 
 #include "cache.h"
@@ -42,35 +45,74 @@
 #include "vsa.h"
 #include "vtcp.h"
 #include "vtim.h"
+#include "vus.h"
 
 #include "cache_director.h"
 #include "cache_backend.h"
 #include "cache_pool.h"
 
-struct tcp_pool {
-	unsigned		magic;
-#define TCP_POOL_MAGIC		0x28b0e42a
-
-	char			*name;
-	struct suckaddr		*ip4;
-	struct suckaddr		*ip6;
+/*
+ * The idle connections of a pool are kept in one shard per worker
+ * thread pool, each with its own lock, so fetches from different
+ * thread pools to the same endpoint do not contend.  A worker first
+ * looks in the shard of its own thread pool and steals from the
+ * sibling shards only when that is empty.
+ *
+ * The most recently recycled connection of a shard is parked in the
+ * shard itself rather than handed to the waiter, so under steady load
+ * the next fetch takes it over without waiting for the waiter to let
+ * go of it.  A parked connection is not watched for the backend closing
+ * it, but the fetch gets a retry on a reused connection anyway.
+ *
+ * With backend_warm_conns, a shard which runs low on idle connections
+ * has a task on its thread pool open new ones ahead of demand.
+ */
 
-	VTAILQ_ENTRY(tcp_pool)	list;
-	int			refcnt;
+struct tcp_shard {
 	struct lock		mtx;
+	struct tcp_pool		*tcp_pool;
 
 	VTAILQ_HEAD(, vbc)	connlist;
 	int			n_conn;
+	struct vbc		*hot;
 
 	VTAILQ_HEAD(, vbc)	killlist;
 	int			n_kill;
 
 	int			n_used;
 
+	int			peak_used;
+	double			peak_t;
+	int			warming;
+	int			dying;
+	struct pool_task	warm_task;
+};
+
+struct tcp_pool {
+	unsigned		magic;
+#define TCP_POOL_MAGIC		0x28b0e42a
+
+	char			*name;
+	struct suckaddr		*ip4;
+	struct suckaddr		*ip6;
+	char			*path;	/* Unix domain socket */
+
+	VTAILQ_ENTRY(tcp_pool)	list;
+	int			refcnt;
+
+	struct tcp_shard	shard[MAX_THREAD_POOLS];
 };
 
 static VTAILQ_HEAD(, tcp_pool)	pools = VTAILQ_HEAD_INITIALIZER(pools);
 
+static struct tcp_shard *
+tcp_shard(struct tcp_pool *tp, const struct worker *wrk)
+{
+
+	CHECK_OBJ_NOTNULL(wrk->pool, POOL_MAGIC);
+	return (&tp->shard[wrk->pool->pool_no % MAX_THREAD_POOLS]);
+}
+
 /*--------------------------------------------------------------------
  * Waiter-handler
  */
@@ -79,54 +121,70 @@ static void  __match_proto__(waiter_handle_f)
 tcp_handle(struct waited *w, enum wait_event ev, double now)
 {
 	struct vbc *vbc;
-	struct tcp_pool *tp;
+	struct tcp_shard *ts;
 
 	CAST_OBJ_NOTNULL(vbc, w->priv1, VBC_MAGIC);
 	(void)ev;
 	(void)now;
 	CHECK_OBJ_NOTNULL(vbc->tcp_pool, TCP_POOL_MAGIC);
-	tp = vbc->tcp_pool;
+	ts = vbc->tcp_shard;
+	AN(ts);
 
-	Lck_Lock(&tp->mtx);
+	Lck_Lock(&ts->mtx);
 
 	switch(vbc->state) {
 	case VBC_STATE_STOLEN:
 		vbc->state = VBC_STATE_USED;
-		VTAILQ_REMOVE(&tp->connlist, vbc, list);
+		VTAILQ_REMOVE(&ts->connlist, vbc, list);
 		AN(vbc->cond);
 		AZ(pthread_cond_signal(vbc->cond));
 		break;
 	case VBC_STATE_AVAIL:
 		VTCP_close(&vbc->fd);
-		VTAILQ_REMOVE(&tp->connlist, vbc, list);
-		tp->n_conn--;
+		VTAILQ_REMOVE(&ts->connlist, vbc, list);
+		ts->n_conn--;
 		FREE_OBJ(vbc);
 		break;
 	case VBC_STATE_CLEANUP:
 		VTCP_close(&vbc->fd);
-		tp->n_kill--;
-		VTAILQ_REMOVE(&tp->killlist, vbc, list);
+		ts->n_kill--;
+		VTAILQ_REMOVE(&ts->killlist, vbc, list);
 		memset(vbc, 0x11, sizeof *vbc);
 		free(vbc);
 		break;
 	default:
 		WRONG("Wrong vbc state");
 	}
-	Lck_Unlock(&tp->mtx);
+	Lck_Unlock(&ts->mtx);
 }
 
 /*--------------------------------------------------------------------
- * Reference a TCP pool given by {ip4, ip6} pair.  Create if it
- * doesn't exist already.
+ * Reference a TCP pool given by {ip4, ip6} pair or a Unix domain
+ * socket path.  Create if it doesn't exist already.
+ *
+ * Connections over a Unix domain socket have no IP address, they get
+ * the bogo-address 0.0.0.0:0 in ip4, like client sessions coming in on
+ * a Unix domain socket listener.
  */
 
 struct tcp_pool *
-VBT_Ref(const struct suckaddr *ip4, const struct suckaddr *ip6)
+VBT_Ref(const struct suckaddr *ip4, const struct suckaddr *ip6,
+    const char *path)
 {
 	struct tcp_pool *tp;
+	struct tcp_shard *ts;
+	struct sockaddr_in bogo;
+	int i;
 
 	VTAILQ_FOREACH(tp, &pools, list) {
 		assert(tp->refcnt > 0);
+		if (path != NULL || tp->path != NULL) {
+			if (path == NULL || tp->path == NULL ||
+			    strcmp(path, tp->path))
+				continue;
+			tp->refcnt++;
+			return (tp);
+		}
 		if (ip4 == NULL) {
 			if (tp->ip4 != NULL)
 				continue;
@@ -151,14 +209,24 @@ VBT_Ref(const struct suckaddr *ip4, const struct suckaddr *ip6)
 
 	ALLOC_OBJ(tp, TCP_POOL_MAGIC);
 	AN(tp);
-	if (ip4 != NULL)
+	if (path != NULL) {
+		REPLACE(tp->path, path);
+		memset(&bogo, 0, sizeof bogo);
+		bogo.sin_family = AF_INET;
+		tp->ip4 = VSA_Malloc(&bogo, sizeof bogo);
+		AN(tp->ip4);
+	} else if (ip4 != NULL)
 		tp->ip4 = VSA_Clone(ip4);
-	if (ip6 != NULL)
+	if (path == NULL && ip6 != NULL)
 		tp->ip6 = VSA_Clone(ip6);
 	tp->refcnt = 1;
-	Lck_New(&tp->mtx, lck_backend_tcp);
-	VTAILQ_INIT(&tp->connlist);
-	VTAILQ_INIT(&tp->killlist);
+	for (i = 0; i < MAX_THREAD_POOLS; i++) {
+		ts = &tp->shard[i];
+		ts->tcp_pool = tp;
+		Lck_New(&ts->mtx, lck_backend_tcp);
+		VTAILQ_INIT(&ts->connlist);
+		VTAILQ_INIT(&ts->killlist);
+	}
 	VTAILQ_INSERT_HEAD(&pools, tp, list);
 	return (tp);
 }
@@ -171,36 +239,52 @@ void
 VBT_Rel(struct tcp_pool **tpp)
 {
 	struct tcp_pool *tp;
+	struct tcp_shard *ts;
 	struct vbc *vbc, *vbc2;
+	int i, n_used = 0;
 
 	TAKE_OBJ_NOTNULL(tp, tpp, TCP_POOL_MAGIC);
 	assert(tp->refcnt > 0);
 	if (--tp->refcnt > 0)
 		return;
-	AZ(tp->n_used);
+	for (i = 0; i < MAX_THREAD_POOLS; i++)
+		n_used += tp->shard[i].n_used;
+	AZ(n_used);
 	VTAILQ_REMOVE(&pools, tp, list);
 	free(tp->name);
 	free(tp->ip4);
 	free(tp->ip6);
-	Lck_Lock(&tp->mtx);
-	VTAILQ_FOREACH_SAFE(vbc, &tp->connlist, list, vbc2) {
-		VTAILQ_REMOVE(&tp->connlist, vbc, list);
-		tp->n_conn--;
-		assert(vbc->state == VBC_STATE_AVAIL);
-		vbc->state = VBC_STATE_CLEANUP;
-		(void)shutdown(vbc->fd, SHUT_WR);
-		VTAILQ_INSERT_TAIL(&tp->killlist, vbc, list);
-		tp->n_kill++;
-	}
-	while (tp->n_kill) {
-		Lck_Unlock(&tp->mtx);
-		(void)usleep(20000);
-		Lck_Lock(&tp->mtx);
+	free(tp->path);
+	for (i = 0; i < MAX_THREAD_POOLS; i++) {
+		ts = &tp->shard[i];
+		Lck_Lock(&ts->mtx);
+		ts->dying = 1;
+		if (ts->hot != NULL) {
+			vbc = ts->hot;
+			ts->hot = NULL;
+			ts->n_conn--;
+			VTCP_close(&vbc->fd);
+			FREE_OBJ(vbc);
+		}
+		VTAILQ_FOREACH_SAFE(vbc, &ts->connlist, list, vbc2) {
+			VTAILQ_REMOVE(&ts->connlist, vbc, list);
+			ts->n_conn--;
+			assert(vbc->state == VBC_STATE_AVAIL);
+			vbc->state = VBC_STATE_CLEANUP;
+			(void)shutdown(vbc->fd, SHUT_WR);
+			VTAILQ_INSERT_TAIL(&ts->killlist, vbc, list);
+			ts->n_kill++;
+		}
+		while (ts->n_kill || ts->warming) {
+			Lck_Unlock(&ts->mtx);
+			(void)usleep(20000);
+			Lck_Lock(&ts->mtx);
+		}
+		Lck_Unlock(&ts->mtx);
+		Lck_Delete(&ts->mtx);
+		AZ(ts->n_conn);
+		AZ(ts->n_kill);
 	}
-	Lck_Unlock(&tp->mtx);
-	Lck_Delete(&tp->mtx);
-	AZ(tp->n_conn);
-	AZ(tp->n_kill);
 
 	FREE_OBJ(tp);
 }
@@ -208,40 +292,88 @@ VBT_Rel(struct tcp_pool **tpp)
 /*--------------------------------------------------------------------
  * Open a new connection from pool.  This is a distinct function since
  * probing cannot use a recycled connection.
+ *
+ * Fast Open is only used for fetches, everybody else wants to know the
+ * connection works when this returns.
  */
 
-int
-VBT_Open(const struct tcp_pool *tp, double tmo, const struct suckaddr **sa)
+static int
+tcp_open(const struct tcp_pool *tp, double tmo, const struct suckaddr **sa,
+    int fastopen, int async)
 {
 	int s;
 	int msec;
+	int (*func)(const struct suckaddr *, int);
 
 	CHECK_OBJ_NOTNULL(tp, TCP_POOL_MAGIC);
 
 	msec = (int)floor(tmo * 1000.0);
+	if (tp->path != NULL) {
+		*sa = tp->ip4;
+		return (VUS_connect(tp->path, msec));
+	}
+	/* The caller waits and calls VBT_Connected() */
+	if (async)
+		msec = -1;
+	func = fastopen ? VTCP_connect_fastopen : VTCP_connect;
 	if (cache_param->prefer_ipv6) {
 		*sa = tp->ip6;
-		s = VTCP_connect(tp->ip6, msec);
+		s = func(tp->ip6, msec);
 		if (s >= 0)
 			return (s);
 	}
 	*sa = tp->ip4;
-	s = VTCP_connect(tp->ip4, msec);
+	s = func(tp->ip4, msec);
 	if (s < 0 && !cache_param->prefer_ipv6) {
 		*sa = tp->ip6;
-		s = VTCP_connect(tp->ip6, msec);
+		s = func(tp->ip6, msec);
 	}
 	return (s);
 }
 
+int
+VBT_Open(const struct tcp_pool *tp, double tmo, const struct suckaddr **sa)
+{
+
+	return (tcp_open(tp, tmo, sa, 0, 0));
+}
+
+/*--------------------------------------------------------------------
+ * Find out if the connect(2) of a connection VBT_Get() left pending
+ * worked.  The connection is made blocking if it did, on failure it
+ * is left for the caller to VBT_Close() it.
+ */
+
+int
+VBT_Connected(const struct vbc *vbc)
+{
+	int k;
+	socklen_t l;
+
+	CHECK_OBJ_NOTNULL(vbc, VBC_MAGIC);
+	assert(vbc->fd >= 0);
+	l = sizeof k;
+	AZ(getsockopt(vbc->fd, SOL_SOCKET, SO_ERROR, &k, &l));
+	if (k) {
+		errno = k;
+		return (-1);
+	}
+	(void)VTCP_blocking(vbc->fd);
+	return (0);
+}
+
 /*--------------------------------------------------------------------
  * Recycle a connection.
+ *
+ * The connection goes into the shard of the recycling worker's
+ * thread pool, regardless of where it came from.
  */
 
 void
 VBT_Recycle(const struct worker *wrk, struct tcp_pool *tp, struct vbc **vbcp)
 {
 	struct vbc *vbc;
+	struct tcp_shard *ts;
 	int i = 0;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -253,12 +385,24 @@ VBT_Recycle(const struct worker *wrk, struct tcp_pool *tp, struct vbc **vbcp)
 	assert(vbc->state == VBC_STATE_USED);
 	assert(vbc->fd > 0);
 
-	Lck_Lock(&tp->mtx);
-	tp->n_used--;
-
+	Lck_Lock(&vbc->tcp_shard->mtx);
+	vbc->tcp_shard->n_used--;
+	Lck_Unlock(&vbc->tcp_shard->mtx);
+
+	ts = tcp_shard(tp, wrk);
+	Lck_Lock(&ts->mtx);
+	vbc->tcp_shard = ts;
+	if (ts->hot == NULL && !ts->dying) {
+		vbc->state = VBC_STATE_AVAIL;
+		vbc->waited->idle = VTIM_real_coarse();
+		ts->hot = vbc;
+		ts->n_conn++;
+		Lck_Unlock(&ts->mtx);
+		return;
+	}
 	vbc->waited->priv1 = vbc;
 	vbc->waited->fd = vbc->fd;
-	vbc->waited->idle = VTIM_real();
+	vbc->waited->idle = VTIM_real_coarse();
 	vbc->state = VBC_STATE_AVAIL;
 	vbc->waited->func = tcp_handle;
 	vbc->waited->tmo = &cache_param->backend_idle_timeout;
@@ -269,13 +413,13 @@ VBT_Recycle(const struct worker *wrk, struct tcp_pool *tp, struct vbc **vbcp)
 		// XXX: stats
 		vbc = NULL;
 	} else {
-		VTAILQ_INSERT_HEAD(&tp->connlist, vbc, list);
+		VTAILQ_INSERT_HEAD(&ts->connlist, vbc, list);
 		i++;
 	}
 
 	if (vbc != NULL)
-		tp->n_conn++;
-	Lck_Unlock(&tp->mtx);
+		ts->n_conn++;
+	Lck_Unlock(&ts->mtx);
 
 	if (i && DO_DEBUG(DBG_VTC_MODE)) {
 		/*
@@ -303,6 +447,7 @@ void
 VBT_Close(struct tcp_pool *tp, struct vbc **vbcp)
 {
 	struct vbc *vbc;
+	struct tcp_shard *ts;
 
 	CHECK_OBJ_NOTNULL(tp, TCP_POOL_MAGIC);
 	vbc = *vbcp;
@@ -312,20 +457,174 @@ VBT_Close(struct tcp_pool *tp, struct vbc **vbcp)
 	assert(vbc->state == VBC_STATE_USED);
 	assert(vbc->fd > 0);
 
-	Lck_Lock(&tp->mtx);
-	tp->n_used--;
+	ts = vbc->tcp_shard;
+	AN(ts);
+	Lck_Lock(&ts->mtx);
+	ts->n_used--;
 	if (vbc->state == VBC_STATE_STOLEN) {
 		(void)shutdown(vbc->fd, SHUT_WR);
 		vbc->state = VBC_STATE_CLEANUP;
-		VTAILQ_INSERT_HEAD(&tp->killlist, vbc, list);
-		tp->n_kill++;
+		VTAILQ_INSERT_HEAD(&ts->killlist, vbc, list);
+		ts->n_kill++;
 	} else {
 		assert(vbc->state == VBC_STATE_USED);
 		VTCP_close(&vbc->fd);
 		memset(vbc, 0x44, sizeof *vbc);
 		free(vbc);
 	}
-	Lck_Unlock(&tp->mtx);
+	Lck_Unlock(&ts->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * The hot connection is not watched by the waiter, so we look for a
+ * close or reset from the backend before handing it out.  An idle
+ * backend connection has nothing else to say.
+ */
+
+static int
+tcp_hot_alive(int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return (poll(&pfd, 1, 0) == 0);
+}
+
+/*--------------------------------------------------------------------
+ * Take the first available connection from a shard, if any.
+ */
+
+static struct vbc *
+tcp_take(struct tcp_pool *tp, struct tcp_shard *ts, struct worker *wrk)
+{
+	struct vbc *vbc;
+
+	Lck_AssertHeld(&ts->mtx);
+	vbc = ts->hot;
+	if (vbc != NULL) {
+		CHECK_OBJ(vbc, VBC_MAGIC);
+		assert(vbc->state == VBC_STATE_AVAIL);
+		ts->hot = NULL;
+		ts->n_conn--;
+		if (VTIM_real_coarse() - vbc->waited->idle <
+		    cache_param->backend_idle_timeout &&
+		    tcp_hot_alive(vbc->fd)) {
+			wrk->stats->backend_reuse++;
+			wrk->stats->backend_handoff++;
+			vbc->state = VBC_STATE_USED;
+			vbc->reused = 1;
+			return (vbc);
+		}
+		VTCP_close(&vbc->fd);
+		FREE_OBJ(vbc);
+	}
+	vbc = VTAILQ_FIRST(&ts->connlist);
+	CHECK_OBJ_ORNULL(vbc, VBC_MAGIC);
+	if (vbc == NULL || vbc->state == VBC_STATE_STOLEN)
+		return (NULL);
+	assert(vbc->tcp_pool == tp);
+	assert(vbc->tcp_shard == ts);
+	assert(vbc->state == VBC_STATE_AVAIL);
+	VTAILQ_REMOVE(&ts->connlist, vbc, list);
+	VTAILQ_INSERT_TAIL(&ts->connlist, vbc, list);
+	ts->n_conn--;
+	wrk->stats->backend_reuse++;
+	vbc->state = VBC_STATE_STOLEN;
+	vbc->reused = 1;
+	vbc->cond = &wrk->cond;
+	return (vbc);
+}
+
+/*--------------------------------------------------------------------
+ * Pre-warming: keep as many idle connections as the recent peak of
+ * connections in use, capped by the parameter.
+ */
+
+static int
+tcp_warm_target(const struct tcp_shard *ts)
+{
+	int n;
+
+	n = (int)cache_param->backend_warm_conns;
+	if (n > ts->peak_used)
+		n = ts->peak_used;
+	return (n);
+}
+
+static void __match_proto__(task_func_t)
+tcp_warm_task(struct worker *wrk, void *priv)
+{
+	struct tcp_shard *ts;
+	struct tcp_pool *tp;
+	struct vbc *vbc;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	ts = priv;
+	AN(ts);
+	tp = ts->tcp_pool;
+	CHECK_OBJ_NOTNULL(tp, TCP_POOL_MAGIC);
+	assert(ts == tcp_shard(tp, wrk));
+
+	Lck_Lock(&ts->mtx);
+	AN(ts->warming);
+	while (!ts->dying && ts->n_conn < tcp_warm_target(ts)) {
+		Lck_Unlock(&ts->mtx);
+		ALLOC_OBJ(vbc, VBC_MAGIC);
+		AN(vbc);
+		INIT_OBJ(vbc->waited, WAITED_MAGIC);
+		vbc->tcp_pool = tp;
+		vbc->fd = VBT_Open(tp, cache_param->connect_timeout,
+		    &vbc->addr);
+		Lck_Lock(&ts->mtx);
+		if (vbc->fd < 0) {
+			FREE_OBJ(vbc);
+			break;
+		}
+		if (ts->dying) {
+			VTCP_close(&vbc->fd);
+			FREE_OBJ(vbc);
+			break;
+		}
+		vbc->tcp_shard = ts;
+		vbc->waited->priv1 = vbc;
+		vbc->waited->fd = vbc->fd;
+		vbc->waited->idle = VTIM_real_coarse();
+		vbc->state = VBC_STATE_AVAIL;
+		vbc->waited->func = tcp_handle;
+		vbc->waited->tmo = &cache_param->backend_idle_timeout;
+		if (Wait_Enter(wrk->pool->waiter, vbc->waited)) {
+			VTCP_close(&vbc->fd);
+			FREE_OBJ(vbc);
+			break;
+		}
+		VTAILQ_INSERT_HEAD(&ts->connlist, vbc, list);
+		ts->n_conn++;
+		wrk->stats->backend_warm++;
+	}
+	ts->warming = 0;
+	Lck_Unlock(&ts->mtx);
+}
+
+static int
+tcp_warm_check(struct tcp_shard *ts)
+{
+	double now;
+
+	Lck_AssertHeld(&ts->mtx);
+	if (cache_param->backend_warm_conns == 0)
+		return (0);
+	now = VTIM_real_coarse();
+	if (ts->n_used > ts->peak_used ||
+	    now - ts->peak_t > cache_param->backend_idle_timeout) {
+		ts->peak_used = ts->n_used;
+		ts->peak_t = now;
+	}
+	if (ts->warming || ts->dying || ts->n_conn >= tcp_warm_target(ts))
+		return (0);
+	ts->warming = 1;
+	return (1);
 }
 
 /*--------------------------------------------------------------------
@@ -334,48 +633,86 @@ VBT_Close(struct tcp_pool *tp, struct vbc **vbcp)
 
 struct vbc *
 VBT_Get(struct tcp_pool *tp, double tmo, const struct backend *be,
-    struct worker *wrk)
+    struct worker *wrk, int *pending)
 {
 	struct vbc *vbc;
+	struct tcp_shard *ts, *ts2;
+	struct pollfd pfd[1];
+	unsigned u, n;
+	int warm;
 
 	CHECK_OBJ_NOTNULL(tp, TCP_POOL_MAGIC);
 	CHECK_OBJ_NOTNULL(be, BACKEND_MAGIC);
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 
-	Lck_Lock(&tp->mtx);
-	vbc = VTAILQ_FIRST(&tp->connlist);
-	CHECK_OBJ_ORNULL(vbc, VBC_MAGIC);
-	if (vbc == NULL || vbc->state == VBC_STATE_STOLEN)
-		vbc = NULL;
-	else {
-		assert(vbc->tcp_pool == tp);
-		assert(vbc->state == VBC_STATE_AVAIL);
-		VTAILQ_REMOVE(&tp->connlist, vbc, list);
-		VTAILQ_INSERT_TAIL(&tp->connlist, vbc, list);
-		tp->n_conn--;
-		VSC_C_main->backend_reuse++;
-		vbc->state = VBC_STATE_STOLEN;
-		vbc->cond = &wrk->cond;
+	ts = tcp_shard(tp, wrk);
+	Lck_Lock(&ts->mtx);
+	vbc = tcp_take(tp, ts, wrk);
+	ts->n_used++;			// Opening mostly works
+	warm = tcp_warm_check(ts);
+	Lck_Unlock(&ts->mtx);
+
+	if (warm) {
+		ts->warm_task.func = tcp_warm_task;
+		ts->warm_task.priv = ts;
+		if (Pool_Task(wrk->pool, &ts->warm_task, TASK_QUEUE_REQ)) {
+			Lck_Lock(&ts->mtx);
+			ts->warming = 0;
+			Lck_Unlock(&ts->mtx);
+		}
 	}
-	tp->n_used++;			// Opening mostly works
-	Lck_Unlock(&tp->mtx);
 
-	if (vbc != NULL)
+	/* Steal from the sibling shards, but do not queue for them */
+	n = cache_param->wthread_pools;
+	if (n > MAX_THREAD_POOLS)
+		n = MAX_THREAD_POOLS;
+	for (u = 1; vbc == NULL && u < n; u++) {
+		ts2 = &tp->shard[(wrk->pool->pool_no + u) % n];
+		if (ts2 == ts || ts2->n_conn == 0)
+			continue;
+		if (Lck_Trylock(&ts2->mtx))
+			continue;
+		vbc = tcp_take(tp, ts2, wrk);
+		Lck_Unlock(&ts2->mtx);
+	}
+
+	if (vbc != NULL) {
+		if (vbc->tcp_shard != ts) {
+			/* n_used follows the connection */
+			Lck_Lock(&ts->mtx);
+			ts->n_used--;
+			Lck_Unlock(&ts->mtx);
+			Lck_Lock(&vbc->tcp_shard->mtx);
+			vbc->tcp_shard->n_used++;
+			Lck_Unlock(&vbc->tcp_shard->mtx);
+		}
 		return (vbc);
+	}
 
 	ALLOC_OBJ(vbc, VBC_MAGIC);
 	AN(vbc);
 	INIT_OBJ(vbc->waited, WAITED_MAGIC);
 	vbc->state = VBC_STATE_USED;
 	vbc->tcp_pool = tp;
-	vbc->fd = VBT_Open(tp, tmo, &vbc->addr);
+	vbc->tcp_shard = ts;
+	vbc->fd = tcp_open(tp, tmo, &vbc->addr, cache_param->backend_fastopen,
+	    pending != NULL);
+	if (vbc->fd >= 0 && pending != NULL && tp->path == NULL) {
+		pfd->fd = vbc->fd;
+		pfd->events = POLLOUT;
+		pfd->revents = 0;
+		if (poll(pfd, 1, 0) == 0)
+			*pending = 1;
+		else
+			vbc->fd = VTCP_connected(vbc->fd);
+	}
 	if (vbc->fd < 0) {
 		FREE_OBJ(vbc);
-		Lck_Lock(&tp->mtx);
-		tp->n_used--;		// Nope, didn't work after all.
-		Lck_Unlock(&tp->mtx);
+		Lck_Lock(&ts->mtx);
+		ts->n_used--;		// Nope, didn't work after all.
+		Lck_Unlock(&ts->mtx);
 	} else
-		VSC_C_main->backend_conn++;
+		wrk->stats->backend_conn++;
 
 	return (vbc);
 }
@@ -386,17 +723,18 @@ VBT_Get(struct tcp_pool *tp, double tmo, const struct backend *be,
 void
 VBT_Wait(struct worker *wrk, struct vbc *vbc)
 {
-	struct tcp_pool *tp;
+	struct tcp_shard *ts;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(vbc, VBC_MAGIC);
-	tp = vbc->tcp_pool;
-	CHECK_OBJ_NOTNULL(tp, TCP_POOL_MAGIC);
+	CHECK_OBJ_NOTNULL(vbc->tcp_pool, TCP_POOL_MAGIC);
+	ts = vbc->tcp_shard;
+	AN(ts);
 	assert(vbc->cond == &wrk->cond);
-	Lck_Lock(&tp->mtx);
+	Lck_Lock(&ts->mtx);
 	while (vbc->state == VBC_STATE_STOLEN)
-		AZ(Lck_CondWait(&wrk->cond, &tp->mtx, 0));
+		AZ(Lck_CondWait(&wrk->cond, &ts->mtx, 0));
 	assert(vbc->state == VBC_STATE_USED);
 	vbc->cond = NULL;
-	Lck_Unlock(&tp->mtx);
+	Lck_Unlock(&ts->mtx);
 }
@@ -40,10 +40,15 @@
 #include "vend.h"
 #include "vmb.h"
 
+#if PCRE_MAJOR < 8 || (PCRE_MAJOR == 8 && PCRE_MINOR < 20)
+#  define pcre_free_study pcre_free
+#endif
+
 struct lock ban_mtx;
 int ban_shutdown;
 struct banhead_s ban_head = VTAILQ_HEAD_INITIALIZER(ban_head);
 struct ban * volatile ban_start;
+static int ban_journal;
 
 static pthread_t ban_thread;
 static int ban_holds;
@@ -54,6 +59,8 @@ struct ban_test {
 	const char		*arg1_spec;
 	const char		*arg2;
 	const void		*arg2_spec;
+	const char		*hdr;		/* header to look up */
+	pcre_extra		*arg2_extra;
 };
 
 /*--------------------------------------------------------------------
@@ -79,6 +86,7 @@ BAN_Free(struct ban *b)
 	AZ(b->refcount);
 	assert(VTAILQ_EMPTY(&b->objcore));
 
+	ban_uncompile(b);
 	if (b->spec != NULL)
 		free(b->spec);
 	FREE_OBJ(b);
@@ -149,6 +157,146 @@ ban_equal(const uint8_t *bs1, const uint8_t *bs2)
 	return (!memcmp(bs1 + BANS_LENGTH, bs2 + BANS_LENGTH, u - BANS_LENGTH));
 }
 
+/*--------------------------------------------------------------------
+ * The live (not completed) bans, hashed by their spec sans timestamp,
+ * so that finding duplicates does not take a walk of the ban list.
+ * Completed bans have their spec cut short, and are never equal to
+ * anything anyway.
+ */
+
+VTAILQ_HEAD(ban_dups_s, ban);
+
+static struct ban_dups_s *ban_dups;
+static unsigned ban_dups_nbucket;
+static unsigned ban_dups_n;
+
+static uint32_t
+ban_dups_hash(const uint8_t *bs)
+{
+	const uint8_t *p, *e;
+	uint32_t h = 0x811c9dc5;
+
+	/* What ban_equal() compares */
+	e = bs + ban_len(bs);
+	for (p = bs + BANS_LENGTH; p < e; p++) {
+		h ^= *p;
+		h *= 0x01000193;
+	}
+	return (h);
+}
+
+static void
+ban_dups_grow(void)
+{
+	struct ban_dups_s *old;
+	struct ban *b;
+	unsigned u, n;
+
+	old = ban_dups;
+	n = ban_dups_nbucket;
+	ban_dups_nbucket = n == 0 ? 64 : n * 2;
+	ban_dups = calloc(ban_dups_nbucket, sizeof *ban_dups);
+	AN(ban_dups);
+	for (u = 0; u < ban_dups_nbucket; u++)
+		VTAILQ_INIT(&ban_dups[u]);
+	for (u = 0; u < n; u++) {
+		while ((b = VTAILQ_FIRST(&old[u])) != NULL) {
+			VTAILQ_REMOVE(&old[u], b, d_list);
+			VTAILQ_INSERT_TAIL(&ban_dups[b->d_hash &
+			    (ban_dups_nbucket - 1)], b, d_list);
+		}
+	}
+	free(old);
+}
+
+void
+ban_dups_insert(struct ban *b)
+{
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+	AZ(b->d_live);
+	if (b->flags & BANS_FLAG_COMPLETED)
+		return;
+	if (ban_dups_n >= ban_dups_nbucket * 2)
+		ban_dups_grow();
+	b->d_hash = ban_dups_hash(b->spec);
+	VTAILQ_INSERT_HEAD(&ban_dups[b->d_hash & (ban_dups_nbucket - 1)],
+	    b, d_list);
+	b->d_live = 1;
+	ban_dups_n++;
+}
+
+void
+ban_dups_remove(struct ban *b)
+{
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+	if (!b->d_live)
+		return;
+	VTAILQ_REMOVE(&ban_dups[b->d_hash & (ban_dups_nbucket - 1)],
+	    b, d_list);
+	b->d_live = 0;
+	assert(ban_dups_n > 0);
+	ban_dups_n--;
+}
+
+/*
+ * Complete the live bans with the same spec as b which are older than it,
+ * and b itself if there is a newer one.
+ */
+
+void
+ban_dups_mark(struct ban *b)
+{
+	struct ban_dups_s *bh;
+	struct ban *bi, *bi2;
+	double t;
+	int newer = 0;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+	if (!b->d_live)
+		return;
+	t = ban_time(b->spec);
+	bh = &ban_dups[b->d_hash & (ban_dups_nbucket - 1)];
+	VTAILQ_FOREACH_SAFE(bi, bh, d_list, bi2) {
+		if (bi == b || bi->d_hash != b->d_hash ||
+		    !ban_equal(bi->spec, b->spec))
+			continue;
+		if (ban_time(bi->spec) > t) {
+			newer = 1;
+			continue;
+		}
+		ban_mark_completed(bi);
+		VSC_C_main->bans_dups++;
+	}
+	if (newer) {
+		ban_mark_completed(b);
+		VSC_C_main->bans_dups++;
+	}
+}
+
+/* Is there a live ban with this spec, no older than t ? */
+
+int
+ban_dups_find(const uint8_t *spec, double t)
+{
+	struct ban *bi;
+	uint32_t h;
+
+	Lck_AssertHeld(&ban_mtx);
+	if (ban_dups_n == 0)
+		return (0);
+	h = ban_dups_hash(spec);
+	VTAILQ_FOREACH(bi, &ban_dups[h & (ban_dups_nbucket - 1)], d_list)
+		if (bi->d_hash == h && ban_equal(bi->spec, spec) &&
+		    ban_time(bi->spec) >= t)
+			return (1);
+	return (0);
+}
+
 void
 ban_mark_completed(struct ban *b)
 {
@@ -158,6 +306,7 @@ ban_mark_completed(struct ban *b)
 	Lck_AssertHeld(&ban_mtx);
 
 	AN(b->spec);
+	ban_dups_remove(b);
 	if (!(b->flags & BANS_FLAG_COMPLETED)) {
 		ln = ban_len(b->spec);
 		b->flags |= BANS_FLAG_COMPLETED;
@@ -165,8 +314,19 @@ ban_mark_completed(struct ban *b)
 		VWMB();
 		vbe32enc(b->spec + BANS_LENGTH, BANS_HEAD_LEN);
 		VSC_C_main->bans_completed++;
-		VSC_C_main->bans_persisted_fragmentation +=
-		    ln - ban_len(b->spec);
+		if (!ban_journal) {
+			VSC_C_main->bans_persisted_fragmentation +=
+			    ln - ban_len(b->spec);
+			return;
+		}
+		/*
+		 * The truncated spec is a complete ban in its own right:
+		 * append it as a tombstone, the full spec already on disk
+		 * is garbage from now on.
+		 */
+		VSC_C_main->bans_persisted_bytes += BANS_HEAD_LEN;
+		VSC_C_main->bans_persisted_fragmentation += ln;
+		ban_info_new(b->spec, BANS_HEAD_LEN);
 	}
 }
 
@@ -210,6 +370,149 @@ ban_iter(const uint8_t **bs, struct ban_test *bt)
 		bt->arg2_spec = ban_get_lump(bs);
 }
 
+/*--------------------------------------------------------------------
+ * Check that a spec from elsewhere holds tests which ban_iter() can
+ * pick apart without running off its end.  The spec must be aligned
+ * as if it came from malloc(3).
+ */
+
+static int
+ban_check_lump(const uint8_t *bs, unsigned len, unsigned *u, unsigned *ln)
+{
+
+	while (*u < len && bs[*u] == 0xff)
+		(*u)++;
+	if (len - *u < PRNDUP(sizeof(uint32_t)))
+		return (-1);
+	*ln = vbe32dec(bs + *u);
+	*u += PRNDUP(sizeof(uint32_t));
+	if (!PAOK(bs + *u) || *ln == 0 || *ln > len - *u)
+		return (-1);
+	*u += *ln;
+	return (0);
+}
+
+int
+ban_check(const uint8_t *bs, unsigned len)
+{
+	unsigned u, ln;
+	uint8_t arg, oper;
+	size_t sz;
+
+	if (len <= BANS_HEAD_LEN || ban_len(bs) != len)
+		return (-1);
+	for (u = BANS_HEAD_LEN; u < len; ) {
+		arg = bs[u++];
+		switch (arg) {
+		case BANS_ARG_URL:
+		case BANS_ARG_OBJSTATUS:
+			break;
+		case BANS_ARG_REQHTTP:
+		case BANS_ARG_OBJHTTP:
+			if (u == len)
+				return (-1);
+			ln = bs[u];
+			if (ln < 2 || ln + 2 > len - u ||
+			    bs[u + ln] != ':' || bs[u + ln + 1] != '\0')
+				return (-1);
+			u += ln + 2;
+			break;
+		default:
+			return (-1);
+		}
+		if (ban_check_lump(bs, len, &u, &ln) || bs[u - 1] != '\0')
+			return (-1);
+		if (u == len)
+			return (-1);
+		oper = bs[u++];
+		switch (oper) {
+		case BANS_OPER_EQ:
+		case BANS_OPER_NEQ:
+			break;
+		case BANS_OPER_MATCH:
+		case BANS_OPER_NMATCH:
+			if (ban_check_lump(bs, len, &u, &ln))
+				return (-1);
+			if (pcre_fullinfo((const void *)(bs + u - ln), NULL,
+			    PCRE_INFO_SIZE, &sz) || sz != ln)
+				return (-1);
+			break;
+		default:
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Decode the tests of a ban once, so that ban_evaluate() does not have
+ * to walk the spec for every object.  The tests point into b->spec,
+ * which stays put until BAN_Free(), and the regexps get studied.
+ */
+
+int
+ban_compile(struct ban *b)
+{
+	const uint8_t *bs, *be;
+	struct ban_test bt, *tp;
+	const char *err;
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	AN(b->spec);
+	AZ(b->test);
+
+	be = b->spec + ban_len(b->spec);
+	for (n = 0, bs = b->spec + BANS_HEAD_LEN; bs < be; n++)
+		ban_iter(&bs, &bt);
+	if (n == 0)
+		return (0);
+
+	b->test = calloc(n, sizeof *b->test);
+	if (b->test == NULL)
+		return (-1);
+
+	for (tp = b->test, bs = b->spec + BANS_HEAD_LEN; bs < be; tp++) {
+		ban_iter(&bs, tp);
+		switch (tp->arg1) {
+		case BANS_ARG_REQHTTP:
+		case BANS_ARG_OBJHTTP:
+			tp->hdr = tp->arg1_spec;
+			break;
+		case BANS_ARG_OBJSTATUS:
+			tp->hdr = H__Status;
+			break;
+		default:
+			break;
+		}
+		if (tp->arg2_spec != NULL) {
+			err = NULL;
+			tp->arg2_extra = pcre_study(tp->arg2_spec, 0, &err);
+			/* Not fatal, it just runs slower */
+			if (err != NULL)
+				tp->arg2_extra = NULL;
+		}
+	}
+	b->ntest = n;
+	return (0);
+}
+
+void
+ban_uncompile(struct ban *b)
+{
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	if (b->test == NULL)
+		return;
+	for (u = 0; u < b->ntest; u++)
+		if (b->test[u].arg2_extra != NULL)
+			pcre_free_study(b->test[u].arg2_extra);
+	free(b->test);
+	b->test = NULL;
+	b->ntest = 0;
+}
+
 /*--------------------------------------------------------------------
  * A new object is created, grab a reference to the newest ban
  */
@@ -318,16 +621,35 @@ ban_export(void)
 	VSC_C_main->bans_persisted_fragmentation = 0;
 }
 
+/*--------------------------------------------------------------------
+ * The full ban list, oldest first, in the format BAN_Reload() takes.
+ */
+
+void
+BAN_Dump(struct vsb *vsb)
+{
+	struct ban *b;
+
+	AN(vsb);
+	Lck_Lock(&ban_mtx);
+	VTAILQ_FOREACH_REVERSE(b, &ban_head, banhead_s, list)
+		AZ(VSB_bcat(vsb, b->spec, ban_len(b->spec)));
+	Lck_Unlock(&ban_mtx);
+}
+
 /*
- * For both of these we do a full export on info failure to remove
- * holes in the exported list.
- * XXX: we should keep track of the size of holes in the last exported list
- * XXX: check if the ban_export should be batched in ban_cleantail
+ * Once BAN_Compile() has exported the list, the stevedores hold an
+ * append-only journal of it: new bans are appended in full, and bans
+ * which are completed or dropped get a BANS_HEAD_LEN completed copy
+ * appended as a tombstone, which ban_reload() applies to the earlier
+ * record.  The holes this leaves are accounted for in
+ * bans_persisted_fragmentation, and the journal is only compacted by a
+ * full export when a stevedore runs out of space for it, and at
+ * shutdown.
  */
 void
 ban_info_new(const uint8_t *ban, unsigned len)
 {
-	/* XXX martin pls review if ban_mtx needs to be held */
 	Lck_AssertHeld(&ban_mtx);
 	if (STV_BanInfoNew(ban, len))
 		ban_export();
@@ -336,8 +658,20 @@ ban_info_new(const uint8_t *ban, unsigned len)
 void
 ban_info_drop(const uint8_t *ban, unsigned len)
 {
-	/* XXX martin pls review if ban_mtx needs to be held */
+	uint8_t hd[BANS_HEAD_LEN];
+
 	Lck_AssertHeld(&ban_mtx);
+	if (ban_journal && !(ban[BANS_FLAGS] & BANS_FLAG_COMPLETED)) {
+		memcpy(hd, ban, BANS_HEAD_LEN);
+		hd[BANS_FLAGS] |= BANS_FLAG_COMPLETED;
+		vbe32enc(hd + BANS_LENGTH, BANS_HEAD_LEN);
+		VSC_C_main->bans_persisted_bytes += BANS_HEAD_LEN;
+		VSC_C_main->bans_persisted_fragmentation += BANS_HEAD_LEN;
+		if (STV_BanInfoNew(hd, BANS_HEAD_LEN)) {
+			ban_export();
+			return;
+		}
+	}
 	if (STV_BanInfoDrop(ban, len))
 		ban_export();
 }
@@ -348,6 +682,9 @@ ban_info_drop(const uint8_t *ban, unsigned len)
  *
  * If a newer ban has same condition, mark the inserted ban COMPLETED,
  * also mark any older bans, with the same condition COMPLETED.
+ *
+ * A completed ban with the time of one already in place is a tombstone
+ * from the journal, and completes that ban.
  */
 
 static void
@@ -367,10 +704,14 @@ ban_reload(const uint8_t *ban, unsigned len)
 		t1 = ban_time(b->spec);
 		assert(t1 < t2);
 		t2 = t1;
-		if (t1 == t0)
+		if (t1 == t0) {
+			if (ban[BANS_FLAGS] & BANS_FLAG_COMPLETED)
+				ban_mark_completed(b);
 			return;
+		}
 		if (t1 < t0)
 			break;
+		/* We walk the newer bans anyway, completed ones too */
 		if (ban_equal(b->spec, ban))
 			duplicate = 1;
 	}
@@ -383,6 +724,7 @@ ban_reload(const uint8_t *ban, unsigned len)
 	b2->spec = malloc(len);
 	AN(b2->spec);
 	memcpy(b2->spec, ban, len);
+	AZ(ban_compile(b2));
 	if (ban[BANS_FLAGS] & BANS_FLAG_REQ) {
 		VSC_C_main->bans_req++;
 		b2->flags |= BANS_FLAG_REQ;
@@ -398,14 +740,8 @@ ban_reload(const uint8_t *ban, unsigned len)
 	VSC_C_main->bans_persisted_bytes += len;
 
 	/* Hunt down older duplicates */
-	for (b = VTAILQ_NEXT(b2, list); b != NULL; b = VTAILQ_NEXT(b, list)) {
-		if (b->flags & BANS_FLAG_COMPLETED)
-			continue;
-		if (ban_equal(b->spec, ban)) {
-			ban_mark_completed(b);
-			VSC_C_main->bans_dups++;
-		}
-	}
+	ban_dups_insert(b2);
+	ban_dups_mark(b2);
 }
 
 /*--------------------------------------------------------------------
@@ -422,9 +758,6 @@ BAN_Reload(const uint8_t *ptr, unsigned len)
 	pe = ptr + len;
 	Lck_Lock(&ban_mtx);
 	while (ptr < pe) {
-		/* XXX: This can be optimized by traversing the live
-		 * ban list together with the reload list (combining
-		 * the loops in BAN_Reload and ban_reload). */
 		l = ban_len(ptr);
 		assert(ptr + l <= pe);
 		ban_reload(ptr, l);
@@ -453,59 +786,55 @@ BAN_Time(const struct ban *b)
  */
 
 int
-ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
+ban_evaluate(struct worker *wrk, const struct ban *b, struct objcore *oc,
     const struct http *reqhttp, unsigned *tests)
 {
-	struct ban_test bt;
-	const uint8_t *be;
+	const struct ban_test *bt, *be;
 	const char *p;
 	const char *arg1;
 
-	be = bs + ban_len(bs);
-	bs += BANS_HEAD_LEN;
-	while (bs < be) {
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	be = b->test + b->ntest;
+	for (bt = b->test; bt < be; bt++) {
 		(*tests)++;
-		ban_iter(&bs, &bt);
 		arg1 = NULL;
-		switch (bt.arg1) {
+		switch (bt->arg1) {
 		case BANS_ARG_URL:
 			AN(reqhttp);
 			arg1 = reqhttp->hd[HTTP_HDR_URL].b;
 			break;
 		case BANS_ARG_REQHTTP:
 			AN(reqhttp);
-			(void)http_GetHdr(reqhttp, bt.arg1_spec, &p);
+			(void)http_GetHdr(reqhttp, bt->hdr, &p);
 			arg1 = p;
 			break;
 		case BANS_ARG_OBJHTTP:
-			arg1 = HTTP_GetHdrPack(wrk, oc, bt.arg1_spec);
-			break;
 		case BANS_ARG_OBJSTATUS:
-			arg1 = HTTP_GetHdrPack(wrk, oc, H__Status);
+			arg1 = HTTP_GetHdrPack(wrk, oc, bt->hdr);
 			break;
 		default:
 			WRONG("Wrong BAN_ARG code");
 		}
 
-		switch (bt.oper) {
+		switch (bt->oper) {
 		case BANS_OPER_EQ:
-			if (arg1 == NULL || strcmp(arg1, bt.arg2))
+			if (arg1 == NULL || strcmp(arg1, bt->arg2))
 				return (0);
 			break;
 		case BANS_OPER_NEQ:
-			if (arg1 != NULL && !strcmp(arg1, bt.arg2))
+			if (arg1 != NULL && !strcmp(arg1, bt->arg2))
 				return (0);
 			break;
 		case BANS_OPER_MATCH:
 			if (arg1 == NULL ||
-			    pcre_exec(bt.arg2_spec, NULL, arg1, strlen(arg1),
-			    0, 0, NULL, 0) < 0)
+			    pcre_exec(bt->arg2_spec, bt->arg2_extra, arg1,
+			    strlen(arg1), 0, 0, NULL, 0) < 0)
 				return (0);
 			break;
 		case BANS_OPER_NMATCH:
 			if (arg1 != NULL &&
-			    pcre_exec(bt.arg2_spec, NULL, arg1, strlen(arg1),
-			    0, 0, NULL, 0) >= 0)
+			    pcre_exec(bt->arg2_spec, bt->arg2_extra, arg1,
+			    strlen(arg1), 0, 0, NULL, 0) >= 0)
 				return (0);
 			break;
 		default:
@@ -515,6 +844,31 @@ ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
 	return (1);
 }
 
+/*--------------------------------------------------------------------
+ * Is this ban a single equality test against the object, in which
+ * case the lurker can look it up by value instead of evaluating it.
+ */
+
+int
+ban_single_eq(const struct ban *b, const char **hdr, const char **val)
+{
+	const struct ban_test *bt;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	AN(hdr);
+	AN(val);
+	if (b->ntest != 1)
+		return (0);
+	bt = b->test;
+	if (bt->oper != BANS_OPER_EQ)
+		return (0);
+	if (bt->arg1 != BANS_ARG_OBJHTTP && bt->arg1 != BANS_ARG_OBJSTATUS)
+		return (0);
+	*hdr = bt->hdr;
+	*val = bt->arg2;
+	return (1);
+}
+
 /*--------------------------------------------------------------------
  * Check an object against all applicable bans
  *
@@ -573,7 +927,7 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 		CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
 		if (b->flags & BANS_FLAG_COMPLETED)
 			continue;
-		if (ban_evaluate(wrk, b->spec, oc, req->http, &tests))
+		if (ban_evaluate(wrk, b, oc, req->http, &tests))
 			break;
 	}
 
@@ -777,6 +1131,7 @@ BAN_Compile(void)
 	ban_info_new(b->spec, ban_len(b->spec));
 
 	ban_export();
+	ban_journal = 1;
 
 	Lck_Unlock(&ban_mtx);
 
@@ -798,6 +1153,7 @@ BAN_Init(void)
 	bp = BAN_Build();
 	AN(bp);
 	AZ(pthread_cond_init(&ban_lurker_cond, NULL));
+	ban_repl_init();
 	AZ(BAN_Commit(bp));
 	Lck_Lock(&ban_mtx);
 	ban_mark_completed(VTAILQ_FIRST(&ban_head));
@@ -86,6 +86,8 @@
 
 /*--------------------------------------------------------------------*/
 
+struct ban_test;
+
 struct ban {
 	unsigned		magic;
 #define BAN_MAGIC		0x700b08ea
@@ -96,6 +98,14 @@ struct ban {
 
 	VTAILQ_HEAD(,objcore)	objcore;
 	uint8_t			*spec;
+	struct ban_test		*test;		/* compiled spec */
+	unsigned		ntest;
+	int			indexed;	/* lurker only */
+
+	/* Index of live bans by spec, see ban_dups_insert() */
+	VTAILQ_ENTRY(ban)	d_list;
+	uint32_t		d_hash;
+	int			d_live;
 };
 
 VTAILQ_HEAD(banhead_s,ban);
@@ -112,9 +122,22 @@ unsigned ban_len(const uint8_t *banspec);
 void ban_info_new(const uint8_t *ban, unsigned len);
 void ban_info_drop(const uint8_t *ban, unsigned len);
 
-int ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
+int ban_compile(struct ban *b);
+void ban_uncompile(struct ban *b);
+int ban_evaluate(struct worker *wrk, const struct ban *b, struct objcore *oc,
     const struct http *reqhttp, unsigned *tests);
+int ban_single_eq(const struct ban *b, const char **hdr, const char **val);
 double ban_time(const uint8_t *banspec);
 int ban_equal(const uint8_t *bs1, const uint8_t *bs2);
+void ban_dups_insert(struct ban *b);
+void ban_dups_remove(struct ban *b);
+void ban_dups_mark(struct ban *b);
+int ban_dups_find(const uint8_t *spec, double t);
+int ban_check(const uint8_t *bs, unsigned len);
 void BAN_Free(struct ban *b);
 void ban_kick_lurker(void);
+
+/* cache_ban_repl.c */
+void ban_repl_init(void);
+void ban_repl_queue(const uint8_t *banspec, unsigned len);
+int ban_repl_dup(const struct ban *b, double t_origin);
@@ -45,6 +45,7 @@ struct ban_proto {
 
 	struct vsb		*vsb;
 	char			*err;
+	double			t_origin;	/* ban from a peer */
 };
 
 /*--------------------------------------------------------------------
@@ -282,6 +283,10 @@ BAN_Commit(struct ban_proto *bp)
 	memcpy(b->spec + BANS_HEAD_LEN, VSB_data(bp->vsb), ln);
 	ln += BANS_HEAD_LEN;
 	vbe32enc(b->spec + BANS_LENGTH, ln);
+	if (ban_compile(b)) {
+		BAN_Free(b);
+		return (ban_error(bp, ban_build_err_no_mem));
+	}
 
 	Lck_Lock(&ban_mtx);
 	if (ban_shutdown) {
@@ -290,6 +295,12 @@ BAN_Commit(struct ban_proto *bp)
 		BAN_Free(b);
 		return (ban_error(bp, "Shutting down"));
 	}
+	if (bp->t_origin > 0. && ban_repl_dup(b, bp->t_origin)) {
+		Lck_Unlock(&ban_mtx);
+		BAN_Free(b);
+		BAN_Abandon(bp);
+		return (NULL);
+	}
 	bi = VTAILQ_FIRST(&ban_head);
 	VTAILQ_INSERT_HEAD(&ban_head, b, list);
 	ban_start = b;
@@ -305,18 +316,13 @@ BAN_Commit(struct ban_proto *bp)
 
 	if (bi != NULL)
 		ban_info_new(b->spec, ln);	/* Notify stevedores */
+	if (bp->t_origin == 0.)
+		ban_repl_queue(b->spec, ln);	/* Send to peers */
 
-	if (cache_param->ban_dups) {
-		/* Hunt down duplicates, and mark them as completed */
-		for (bi = VTAILQ_NEXT(b, list); bi != NULL;
-		    bi = VTAILQ_NEXT(bi, list)) {
-			if (!(bi->flags & BANS_FLAG_COMPLETED) &&
-			    ban_equal(b->spec, bi->spec)) {
-				ban_mark_completed(bi);
-				VSC_C_main->bans_dups++;
-			}
-		}
-	}
+	ban_dups_insert(b);
+	if (cache_param->ban_dups)
+		/* Mark older duplicates as completed */
+		ban_dups_mark(b);
 	if (!(b->flags & BANS_FLAG_REQ))
 		ban_kick_lurker();
 	Lck_Unlock(&ban_mtx);
@@ -324,3 +330,57 @@ BAN_Commit(struct ban_proto *bp)
 	BAN_Abandon(bp);
 	return (NULL);
 }
+
+/*--------------------------------------------------------------------
+ * Commit the bans in a batch from a peer, which are in the format of
+ * BAN_Dump().  Each one is checked before it is built into a ban of
+ * our own, and a ban which is here already is skipped.
+ */
+
+const char *
+BAN_Replay(const uint8_t *ptr, unsigned len, unsigned *nban)
+{
+	struct ban_proto *bp;
+	const uint8_t *pe;
+	uint8_t *spec;
+	unsigned l;
+
+	AN(ptr);
+	AN(nban);
+	*nban = 0;
+	pe = ptr + len;
+	while (ptr < pe) {
+		if (pe - ptr < BANS_HEAD_LEN)
+			return ("Truncated ban");
+		l = ban_len(ptr);
+		if (l < BANS_HEAD_LEN || l > pe - ptr)
+			return ("Malformed ban length");
+		/* The specs of a batch are not aligned */
+		spec = malloc(l);
+		if (spec == NULL)
+			return (ban_build_err_no_mem);
+		memcpy(spec, ptr, l);
+		if (ban_check(spec, l)) {
+			free(spec);
+			return ("Malformed ban");
+		}
+		bp = BAN_Build();
+		if (bp == NULL) {
+			free(spec);
+			return (ban_build_err_no_mem);
+		}
+		bp->flags = spec[BANS_FLAGS] &
+		    (BANS_FLAG_REQ | BANS_FLAG_OBJ | BANS_FLAG_HTTP);
+		bp->t_origin = ban_time(spec);
+		AZ(VSB_bcat(bp->vsb, spec + BANS_HEAD_LEN, l - BANS_HEAD_LEN));
+		free(spec);
+		if (BAN_Commit(bp) != NULL) {
+			/* The error is in bp, which goes away */
+			BAN_Abandon(bp);
+			return ("Cannot add ban");
+		}
+		(*nban)++;
+		ptr += l;
+	}
+	return (NULL);
+}
@@ -30,11 +30,14 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+
 #include "cache.h"
 #include "cache_ban.h"
 
 #include "hash/hash_slinger.h"
 #include "vtim.h"
+#include "vtree.h"
 
 static struct objcore oc_mark_cnt = { .magic = OBJCORE_MAGIC, };
 static struct objcore oc_mark_end = { .magic = OBJCORE_MAGIC, };
@@ -84,6 +87,7 @@ ban_cleantail(const struct ban *victim)
 				VSC_C_main->bans_req--;
 			VSC_C_main->bans--;
 			VSC_C_main->bans_deleted++;
+			ban_dups_remove(b);
 			VTAILQ_REMOVE(&ban_head, b, list);
 			VTAILQ_INSERT_TAIL(&freelist, b, list);
 			VSC_C_main->bans_persisted_fragmentation +=
@@ -105,6 +109,146 @@ ban_cleantail(const struct ban *victim)
 	return (r);
 }
 
+/*--------------------------------------------------------------------
+ * Bans which are a single equality test against an object header, for
+ * instance "obj.http.x-tag == foo", are indexed by header and value, so
+ * that each object costs one lookup per header rather than one test
+ * per ban.
+ */
+
+struct ban_idx_e {
+	unsigned			magic;
+#define BAN_IDX_E_MAGIC			0x3c1b77a5
+	VRB_ENTRY(ban_idx_e)		entry;
+	const char			*val;
+	struct ban			*ban;
+};
+
+VRB_HEAD(ban_idx_tree, ban_idx_e);
+
+struct ban_idx_h {
+	unsigned			magic;
+#define BAN_IDX_H_MAGIC			0x9f4b0e21
+	VTAILQ_ENTRY(ban_idx_h)		list;
+	const char			*hdr;
+	struct ban_idx_tree		tree;
+};
+
+VTAILQ_HEAD(ban_idx, ban_idx_h);
+
+static inline int
+ban_idx_cmp(const struct ban_idx_e *a, const struct ban_idx_e *b)
+{
+
+	return (strcmp(a->val, b->val));
+}
+
+VRB_PROTOTYPE_STATIC(ban_idx_tree, ban_idx_e, entry, ban_idx_cmp)
+VRB_GENERATE_STATIC(ban_idx_tree, ban_idx_e, entry, ban_idx_cmp)
+
+static void
+ban_idx_add(struct ban_idx *idx, struct ban *b)
+{
+	struct ban_idx_h *ih;
+	struct ban_idx_e *ie;
+	const char *hdr, *val;
+
+	AZ(b->indexed);
+	if (!ban_single_eq(b, &hdr, &val))
+		return;
+	VTAILQ_FOREACH(ih, idx, list)
+		if (!strcasecmp(ih->hdr, hdr))
+			break;
+	if (ih == NULL) {
+		ALLOC_OBJ(ih, BAN_IDX_H_MAGIC);
+		if (ih == NULL)
+			return;
+		ih->hdr = hdr;
+		VRB_INIT(&ih->tree);
+		VTAILQ_INSERT_TAIL(idx, ih, list);
+	}
+	ALLOC_OBJ(ie, BAN_IDX_E_MAGIC);
+	if (ie == NULL)
+		return;
+	ie->val = val;
+	ie->ban = b;
+	if (VRB_INSERT(ban_idx_tree, &ih->tree, ie) != NULL) {
+		/* An older duplicate, test it the slow way */
+		FREE_OBJ(ie);
+		return;
+	}
+	b->indexed = 1;
+}
+
+static struct ban *
+ban_idx_lookup(struct worker *wrk, struct ban_idx *idx, struct objcore *oc,
+    unsigned *tests)
+{
+	struct ban_idx_h *ih;
+	struct ban_idx_e *ie, key;
+
+	VTAILQ_FOREACH(ih, idx, list) {
+		CHECK_OBJ_NOTNULL(ih, BAN_IDX_H_MAGIC);
+		(*tests)++;
+		key.val = HTTP_GetHdrPack(wrk, oc, ih->hdr);
+		if (key.val == NULL)
+			continue;
+		ie = VRB_FIND(ban_idx_tree, &ih->tree, &key);
+		if (ie == NULL)
+			continue;
+		CHECK_OBJ_NOTNULL(ie, BAN_IDX_E_MAGIC);
+		/* A ban overtaken by a newer dup is not in our way */
+		if (!(ie->ban->flags & BANS_FLAG_COMPLETED))
+			return (ie->ban);
+	}
+	return (NULL);
+}
+
+static void
+ban_idx_fini(struct ban_idx *idx)
+{
+	struct ban_idx_h *ih;
+	struct ban_idx_e *ie, *ie2;
+
+	while ((ih = VTAILQ_FIRST(idx)) != NULL) {
+		CHECK_OBJ_NOTNULL(ih, BAN_IDX_H_MAGIC);
+		VTAILQ_REMOVE(idx, ih, list);
+		VRB_FOREACH_SAFE(ie, ban_idx_tree, &ih->tree, ie2) {
+			CHECK_OBJ_NOTNULL(ie, BAN_IDX_E_MAGIC);
+			VRB_REMOVE(ban_idx_tree, &ih->tree, ie);
+			ie->ban->indexed = 0;
+			FREE_OBJ(ie);
+		}
+		FREE_OBJ(ih);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * The objects of one ban are tested by the lurker thread, and if there
+ * are many of them, by up to ban_lurker_threads - 1 helper tasks on the
+ * worker pools.  They all take their objects off the same list, one at
+ * a time under ban_mtx, so each object is seen by exactly one of them.
+ */
+
+struct ban_lurk {
+	unsigned			magic;
+#define BAN_LURK_MAGIC			0x5e0a3c17
+	struct ban			*bt;
+	struct ban			*bd;
+	struct banhead_s		*obans;
+	struct ban_idx			*idx;
+	int				done;
+	unsigned			nhelper;
+	pthread_cond_t			cond;
+};
+
+struct ban_helper {
+	unsigned			magic;
+#define BAN_HELPER_MAGIC		0x1d6e8f42
+	struct pool_task		task;
+	struct ban_lurk			*lurk;
+};
+
 /*--------------------------------------------------------------------
  * Our task here is somewhat tricky:  The canonical locking order is
  * objhead->mtx first, then ban_mtx, because that is the order which
@@ -118,16 +262,24 @@ ban_cleantail(const struct ban *victim)
  */
 
 static struct objcore *
-ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
+ban_lurker_getfirst(struct vsl_log *vsl, struct ban_lurk *lurk)
 {
 	struct objhead *oh;
 	struct objcore *oc, *noc;
+	struct ban *bt;
 	int move_oc = 1;
 
+	CHECK_OBJ_NOTNULL(lurk, BAN_LURK_MAGIC);
+	bt = lurk->bt;
 	Lck_Lock(&ban_mtx);
 
 	oc = VTAILQ_FIRST(&bt->objcore);
 	while (1) {
+		if (lurk->done) {
+			/* Another thread emptied the list */
+			oc = NULL;
+			break;
+		}
 		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
 		if (oc == &oc_mark_cnt) {
@@ -137,6 +289,7 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 				    ban_list);
 				VTAILQ_REMOVE(&bt->objcore, &oc_mark_end,
 				    ban_list);
+				lurk->done = 1;
 				oc = NULL;
 				break;
 			}
@@ -147,12 +300,14 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 			assert(move_oc == 0);
 
 			/* hold off to give lookup a chance and reiterate */
-			Lck_Unlock(&ban_mtx);
 			VSC_C_main->bans_lurker_contention++;
+			Lck_Unlock(&ban_mtx);
 			VSL_Flush(vsl, 0);
 			VTIM_sleep(cache_param->ban_lurker_holdoff);
 			Lck_Lock(&ban_mtx);
 
+			if (lurk->done)
+				continue;
 			oc = VTAILQ_FIRST(&bt->objcore);
 			assert(oc == &oc_mark_cnt);
 			continue;
@@ -172,7 +327,7 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 				 * dismantled under our feet - grab a ref
 				 */
 				AZ(oc->flags & OC_F_BUSY);
-				oc->refcnt += 1;
+				(void)__sync_add_and_fetch(&oc->refcnt, 1);
 				VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
 				VTAILQ_INSERT_TAIL(&bt->objcore, oc, ban_list);
 				Lck_Unlock(&oh->mtx);
@@ -195,37 +350,38 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 }
 
 static void
-ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
-    struct banhead_s *obans, struct ban *bd)
+ban_lurker_test_ocs(struct worker *wrk, struct vsl_log *vsl,
+    struct ban_lurk *lurk, unsigned *batch)
 {
-	struct ban *bl, *bln;
+	struct ban *bl, *bt, *bd, *hit;
 	struct objcore *oc;
 	unsigned tests;
+	uint64_t tested = 0, tests_tested = 0, killed = 0;
 	int i;
 
-	/*
-	 * First see if there is anything to do, and if so, insert markers
-	 */
-	Lck_Lock(&ban_mtx);
-	oc = VTAILQ_FIRST(&bt->objcore);
-	if (oc != NULL) {
-		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_cnt, ban_list);
-		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_end, ban_list);
-	}
-	Lck_Unlock(&ban_mtx);
-	if (oc == NULL)
-		return;
-
+	CHECK_OBJ_NOTNULL(lurk, BAN_LURK_MAGIC);
+	bt = lurk->bt;
+	bd = lurk->bd;
 	while (1) {
-		if (++ban_batch > cache_param->ban_lurker_batch) {
+		if (++(*batch) > cache_param->ban_lurker_batch) {
 			VTIM_sleep(cache_param->ban_lurker_sleep);
-			ban_batch = 0;
+			*batch = 0;
 		}
-		oc = ban_lurker_getfirst(vsl, bt);
+		oc = ban_lurker_getfirst(vsl, lurk);
 		if (oc == NULL)
-			return;
+			break;
 		i = 0;
-		VTAILQ_FOREACH_REVERSE_SAFE(bl, obans, banhead_s, l_list, bln) {
+		tests = 0;
+		hit = NULL;
+		if (!VTAILQ_EMPTY(lurk->idx) && oc->ban == bt)
+			hit = ban_idx_lookup(wrk, lurk->idx, oc, &tests);
+		/*
+		 * The indexed bans are accounted for as if each had been
+		 * tested on its own, so the counters mean what they always
+		 * did, but all it takes is a pointer comparison.
+		 */
+		tests = 0;
+		VTAILQ_FOREACH_REVERSE(bl, lurk->obans, banhead_s, l_list) {
 			if (oc->ban != bt) {
 				/*
 				 * HSH_Lookup() grabbed this oc, killed
@@ -235,21 +391,25 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 			}
 			if (bl->flags & BANS_FLAG_COMPLETED) {
 				/* Ban was overtaken by new (dup) ban */
-				VTAILQ_REMOVE(obans, bl, l_list);
 				continue;
 			}
 			AZ(bl->flags & BANS_FLAG_REQ);
-			tests = 0;
-			i = ban_evaluate(wrk, bl->spec, oc, NULL, &tests);
-			VSC_C_main->bans_lurker_tested++;
-			VSC_C_main->bans_lurker_tests_tested += tests;
-			if (i) {
-				VSLb(vsl, SLT_ExpBan, "%u banned by lurker",
-				    ObjGetXID(wrk, oc));
-				HSH_Kill(oc);
-				VSC_C_main->bans_lurker_obj_killed++;
-				break;
+			if (bl->indexed) {
+				i = (bl == hit);
+				tests++;
+			} else {
+				i = ban_evaluate(wrk, bl, oc, NULL, &tests);
 			}
+			tested++;
+			if (i)
+				break;
+		}
+		tests_tested += tests;
+		if (i) {
+			VSLb(vsl, SLT_ExpBan, "%u banned by lurker",
+			    ObjGetXID(wrk, oc));
+			HSH_Kill(oc);
+			killed++;
 		}
 		if (i == 0 && oc->ban == bt) {
 			Lck_Lock(&ban_mtx);
@@ -267,6 +427,105 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 		}
 		(void)HSH_DerefObjCore(wrk, &oc, 0);
 	}
+	Lck_Lock(&ban_mtx);
+	VSC_C_main->bans_lurker_tested += tested;
+	VSC_C_main->bans_lurker_tests_tested += tests_tested;
+	VSC_C_main->bans_lurker_obj_killed += killed;
+	Lck_Unlock(&ban_mtx);
+}
+
+static void __match_proto__(task_func_t)
+ban_lurker_helper(struct worker *wrk, void *priv)
+{
+	struct ban_helper *bh;
+	struct ban_lurk *lurk;
+	struct vsl_log vsl;
+	unsigned batch = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(bh, priv, BAN_HELPER_MAGIC);
+	lurk = bh->lurk;
+	CHECK_OBJ_NOTNULL(lurk, BAN_LURK_MAGIC);
+
+	VSL_Setup(&vsl, NULL, 0);
+	ban_lurker_test_ocs(wrk, &vsl, lurk, &batch);
+	VSL_Flush(&vsl, 0);
+
+	Lck_Lock(&ban_mtx);
+	assert(lurk->nhelper > 0);
+	if (--lurk->nhelper == 0)
+		AZ(pthread_cond_signal(&lurk->cond));
+	Lck_Unlock(&ban_mtx);
+}
+
+static void
+ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
+    struct banhead_s *obans, struct ban *bd, struct ban_idx *idx)
+{
+	struct ban_lurk lurk;
+	struct ban_helper *bh = NULL;
+	struct ban *bl, *bln;
+	struct objcore *oc;
+	unsigned u, n = 0;
+
+	/* Drop bans overtaken by new (dup) bans before sharing obans */
+	VTAILQ_FOREACH_SAFE(bl, obans, l_list, bln)
+		if (bl->flags & BANS_FLAG_COMPLETED)
+			VTAILQ_REMOVE(obans, bl, l_list);
+
+	INIT_OBJ(&lurk, BAN_LURK_MAGIC);
+	lurk.bt = bt;
+	lurk.bd = bd;
+	lurk.obans = obans;
+	lurk.idx = idx;
+
+	/*
+	 * First see if there is anything to do, and if so, insert markers
+	 */
+	Lck_Lock(&ban_mtx);
+	oc = VTAILQ_FIRST(&bt->objcore);
+	if (oc != NULL) {
+		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_cnt, ban_list);
+		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_end, ban_list);
+		if (bt->refcount > cache_param->ban_lurker_batch)
+			n = cache_param->ban_lurker_threads - 1;
+	}
+	Lck_Unlock(&ban_mtx);
+	if (oc == NULL)
+		return;
+
+	if (n > 0) {
+		bh = calloc(n, sizeof *bh);
+		if (bh == NULL)
+			n = 0;
+		AZ(pthread_cond_init(&lurk.cond, NULL));
+	}
+	for (u = 0; u < n; u++) {
+		bh[u].magic = BAN_HELPER_MAGIC;
+		bh[u].lurk = &lurk;
+		bh[u].task.func = ban_lurker_helper;
+		bh[u].task.priv = &bh[u];
+		Lck_Lock(&ban_mtx);
+		lurk.nhelper++;
+		Lck_Unlock(&ban_mtx);
+		if (Pool_Task_Any(&bh[u].task, TASK_QUEUE_REQ)) {
+			Lck_Lock(&ban_mtx);
+			lurk.nhelper--;
+			Lck_Unlock(&ban_mtx);
+			break;
+		}
+	}
+
+	ban_lurker_test_ocs(wrk, vsl, &lurk, &ban_batch);
+
+	if (n > 0) {
+		Lck_Lock(&ban_mtx);
+		while (lurk.nhelper > 0)
+			(void)Lck_CondWait(&lurk.cond, &ban_mtx, 0);
+		Lck_Unlock(&ban_mtx);
+		AZ(pthread_cond_destroy(&lurk.cond));
+		free(bh);
+	}
 }
 
 /*--------------------------------------------------------------------
@@ -284,6 +543,7 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 {
 	struct ban *b, *bd;
 	struct banhead_s obans;
+	struct ban_idx idx;
 	double d, dt, n;
 
 	dt = 49.62;		// Random, non-magic
@@ -298,9 +558,10 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 	d = VTIM_real() - cache_param->ban_lurker_age;
 	bd = NULL;
 	VTAILQ_INIT(&obans);
+	VTAILQ_INIT(&idx);
 	for (; b != NULL; b = VTAILQ_NEXT(b, list)) {
 		if (bd != NULL && bd != b)
-			ban_lurker_test_ban(wrk, vsl, b, &obans, bd);
+			ban_lurker_test_ban(wrk, vsl, b, &obans, bd, &idx);
 		if (b->flags & BANS_FLAG_COMPLETED)
 			continue;
 		if (b->flags & BANS_FLAG_REQ) {
@@ -311,6 +572,7 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 		n = ban_time(b->spec) - d;
 		if (n < 0) {
 			VTAILQ_INSERT_TAIL(&obans, b, l_list);
+			ban_idx_add(&idx, b);
 			if (bd == NULL)
 				bd = b;
 		} else if (n < dt) {
@@ -323,6 +585,7 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 	 * containted the first oban, all obans were on the tail and we're
 	 * done.
 	 */
+	ban_idx_fini(&idx);
 	if (ban_cleantail(VTAILQ_FIRST(&obans)))
 		return (dt);
 
@@ -0,0 +1,329 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Replication of bans to peer caches.
+ *
+ * Bans added here, from the CLI or from VCL, are queued in their
+ * binary form, and a thread sends what it has every
+ * ban_replicate_delay to each of the peers in the ban_replicate
+ * parameter, in one BAN request per peer.  The VCL of the peer hands
+ * the body to std.ban_replay(), which commits the bans with
+ * BAN_Replay().  A peer which cannot be reached keeps its bans until
+ * the next batch.
+ *
+ * A ban from a peer keeps the time it had there, and it is not added
+ * if an identical ban was added here since, so a batch which arrives
+ * twice does no harm.  Like with ban_dups, an older identical ban is
+ * completed by the new one.  Bans from peers are not sent on.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cache_ban.h"
+
+#include "vtcp.h"
+#include "vtim.h"
+
+#define BAN_REPL_MAX		(1024 * 1024)	/* bans waiting for a peer */
+
+struct ban_peer {
+	unsigned		magic;
+#define BAN_PEER_MAGIC		0x4b1e9a37
+	VTAILQ_ENTRY(ban_peer)	list;
+	char			*addr;
+	struct vsb		*vsb;		/* bans not delivered */
+	unsigned		nban;
+};
+
+static VTAILQ_HEAD(, ban_peer) ban_peers =
+    VTAILQ_HEAD_INITIALIZER(ban_peers);
+static struct vsb		*ban_repl_vsb;	/* under ban_mtx */
+static unsigned			ban_repl_n;
+static unsigned			ban_repl_backlog;
+static pthread_cond_t		ban_repl_cond;
+static pthread_t		ban_repl_thread;
+
+/*--------------------------------------------------------------------
+ * Called by BAN_Commit() for a ban added here.
+ */
+
+void
+ban_repl_queue(const uint8_t *banspec, unsigned len)
+{
+
+	Lck_AssertHeld(&ban_mtx);
+	if (len <= BANS_HEAD_LEN || cache_param->ban_replicate.list[0] == '\0')
+		return;
+	AZ(VSB_bcat(ban_repl_vsb, banspec, len));
+	if (ban_repl_n++ == 0)
+		AZ(pthread_cond_signal(&ban_repl_cond));
+}
+
+/*--------------------------------------------------------------------
+ * Called by BAN_Commit() for each ban from a peer:  Is there an identical
+ * ban which was added after the ban was added on the peer?  Then all
+ * the objects which the ban is about have been tested against it.
+ */
+
+int
+ban_repl_dup(const struct ban *b, double t_origin)
+{
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+	VSC_C_main->bans_repl_recv++;
+	if (!ban_dups_find(b->spec, t_origin))
+		return (0);
+	VSC_C_main->bans_repl_dups++;
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * Bring the list of peers in line with the parameter.
+ */
+
+static void
+ban_repl_peers(const char *list)
+{
+	struct ban_peer *bp, *bp2;
+	const char *p, *q;
+	size_t l;
+
+	VTAILQ_FOREACH_SAFE(bp, &ban_peers, list, bp2) {
+		l = strlen(bp->addr);
+		for (p = list; (p = strstr(p, bp->addr)) != NULL; p += l)
+			if ((p == list || p[-1] == ' ') &&
+			    (p[l] == '\0' || p[l] == ' '))
+				break;
+		if (p != NULL)
+			continue;
+		VTAILQ_REMOVE(&ban_peers, bp, list);
+		free(bp->addr);
+		VSB_destroy(&bp->vsb);
+		FREE_OBJ(bp);
+	}
+	for (p = list; *p != '\0'; p = q) {
+		while (*p == ' ')
+			p++;
+		for (q = p; *q != '\0' && *q != ' '; q++)
+			continue;
+		if (q == p)
+			continue;
+		VTAILQ_FOREACH(bp, &ban_peers, list)
+			if (!strncmp(bp->addr, p, q - p) &&
+			    bp->addr[q - p] == '\0')
+				break;
+		if (bp != NULL)
+			continue;
+		ALLOC_OBJ(bp, BAN_PEER_MAGIC);
+		AN(bp);
+		bp->addr = strndup(p, q - p);
+		AN(bp->addr);
+		bp->vsb = VSB_new_auto();
+		AN(bp->vsb);
+		VTAILQ_INSERT_TAIL(&ban_peers, bp, list);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Send the bans of a peer in a BAN request, and see that it says 200.
+ */
+
+static int
+ban_repl_write(int fd, const char *p, ssize_t len)
+{
+	ssize_t l;
+
+	while (len > 0) {
+		l = write(fd, p, len);
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l <= 0)
+			return (-1);
+		p += l;
+		len -= l;
+	}
+	return (0);
+}
+
+static int
+ban_repl_send(const struct ban_peer *bp)
+{
+	struct vsb *vsb;
+	const char *err;
+	char buf[64];
+	int fd, i;
+	ssize_t l, r;
+
+	CHECK_OBJ_NOTNULL(bp, BAN_PEER_MAGIC);
+	fd = VTCP_open(bp->addr, "80", cache_param->connect_timeout, &err);
+	if (fd < 0) {
+		VSL(SLT_Error, 0, "ban_replicate: %s: %s", bp->addr,
+		    err != NULL ? err : strerror(errno));
+		return (-1);
+	}
+	VTCP_set_read_timeout(fd, cache_param->first_byte_timeout);
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_printf(vsb, "BAN / HTTP/1.1\r\n");
+	VSB_printf(vsb, "Host: %s\r\n", bp->addr);
+	VSB_printf(vsb, "Content-Type: application/x-varnish-bans\r\n");
+	VSB_printf(vsb, "Content-Length: %zd\r\n", VSB_len(bp->vsb));
+	VSB_printf(vsb, "Connection: close\r\n\r\n");
+	AZ(VSB_finish(vsb));
+	i = ban_repl_write(fd, VSB_data(vsb), VSB_len(vsb));
+	if (i == 0)
+		i = ban_repl_write(fd, VSB_data(bp->vsb), VSB_len(bp->vsb));
+	VSB_destroy(&vsb);
+
+	l = 0;
+	while (i == 0 && l < 12) {
+		r = read(fd, buf + l, sizeof buf - 1 - l);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			i = -1;
+		else
+			l += r;
+	}
+	VTCP_close(&fd);
+	if (i == 0) {
+		buf[l] = '\0';
+		if (strncmp(buf, "HTTP/1.", 7) || strncmp(buf + 8, " 200", 4))
+			i = -1;
+	}
+	if (i)
+		VSL(SLT_Error, 0, "ban_replicate: %s: %s", bp->addr,
+		    l > 0 ? "Bans not taken" : "No response");
+	return (i);
+}
+
+/*--------------------------------------------------------------------
+ * Give each peer the batch, and try to deliver everything it has.
+ */
+
+static void
+ban_repl_batch(const struct vsb *batch, unsigned n)
+{
+	struct ban_peer *bp;
+	struct vsb *vsb;
+	unsigned failed = 0, sent = 0, dropped = 0, backlog = 0;
+
+	VTAILQ_FOREACH(bp, &ban_peers, list) {
+		if (n > 0) {
+			if (VSB_len(bp->vsb) + VSB_len(batch) > BAN_REPL_MAX) {
+				dropped += bp->nban;
+				VSB_clear(bp->vsb);
+				bp->nban = 0;
+			}
+			AZ(VSB_bcat(bp->vsb, VSB_data(batch), VSB_len(batch)));
+			bp->nban += n;
+		}
+		if (bp->nban == 0)
+			continue;
+		AZ(VSB_finish(bp->vsb));
+		if (ban_repl_send(bp)) {
+			/* Keep them, where more can be added */
+			vsb = VSB_new_auto();
+			AN(vsb);
+			AZ(VSB_bcat(vsb, VSB_data(bp->vsb), VSB_len(bp->vsb)));
+			VSB_destroy(&bp->vsb);
+			bp->vsb = vsb;
+			failed++;
+			backlog = 1;
+			continue;
+		}
+		VSB_clear(bp->vsb);
+		bp->nban = 0;
+		sent++;
+	}
+
+	Lck_Lock(&ban_mtx);
+	VSC_C_main->bans_repl_sent += sent;
+	VSC_C_main->bans_repl_failed += failed;
+	VSC_C_main->bans_repl_dropped += dropped;
+	ban_repl_backlog = backlog;
+	Lck_Unlock(&ban_mtx);
+}
+
+static void * __match_proto__(bgthread_t)
+ban_repl(struct worker *wrk, void *priv)
+{
+	struct addrparam ap;
+	struct vsb *batch, *vsb;
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+	batch = VSB_new_auto();
+	AN(batch);
+	Lck_Lock(&ban_mtx);
+	while (1) {
+		if (ban_repl_n == 0) {
+			/* Bans which did not make it are tried again */
+			if (Lck_CondWait(&ban_repl_cond, &ban_mtx,
+			    ban_repl_backlog ? VTIM_real() + 1. : 0) == 0 &&
+			    ban_repl_n == 0)
+				continue;
+		}
+		Lck_Unlock(&ban_mtx);
+		VTIM_sleep(cache_param->ban_replicate_delay);
+		Lck_Lock(&ban_mtx);
+		vsb = ban_repl_vsb;
+		ban_repl_vsb = batch;
+		batch = vsb;
+		n = ban_repl_n;
+		ban_repl_n = 0;
+		Lck_Unlock(&ban_mtx);
+
+		AZ(VSB_finish(batch));
+		ap = cache_param->ban_replicate;
+		ap.list[sizeof ap.list - 1] = '\0';
+		ban_repl_peers(ap.list);
+		ban_repl_batch(batch, n);
+		VSB_clear(batch);
+		Lck_Lock(&ban_mtx);
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------*/
+
+void
+ban_repl_init(void)
+{
+
+	ban_repl_vsb = VSB_new_auto();
+	AN(ban_repl_vsb);
+	AZ(pthread_cond_init(&ban_repl_cond, NULL));
+	WRK_BgThread(&ban_repl_thread, "ban-replicate", ban_repl, NULL);
+}
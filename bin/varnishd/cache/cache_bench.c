@@ -0,0 +1,703 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Micro-benchmarks of the hot paths, for debug.bench.
+ *
+ * They run in the CLI thread of the child, against the real parameters,
+ * shared memory log and hash, so the numbers include what the code does
+ * in production, logging and locking and all.  Each reports the time,
+ * the workspace and, with jemalloc, the heap bytes it takes per
+ * operation.  The counters will show the work they did.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache.h"
+#include "cache_priv.h"
+
+#include "binary_heap.h"
+#include "common/heritage.h"
+#include "hash/hash_slinger.h"
+#include "vcli_serve.h"
+#include "vend.h"
+#include "vre.h"
+#include "vrnd.h"
+#include "vsha256.h"
+#include "vtim.h"
+
+#ifdef HAVE_MALLCTL
+int mallctl(const char *, void *, size_t *, void *, size_t);
+#endif
+
+struct bch {
+	unsigned		magic;
+#define BCH_MAGIC		0x1c3a7be5
+	unsigned		n;
+	struct worker		*wrk;
+	struct ws		ws[1];
+	struct vsl_log		vsl[1];
+
+	double			t0;
+	uint64_t		heap0;
+
+	double			t;
+	uintmax_t		ws_bytes;
+	uint64_t		heap;
+};
+
+typedef void bch_func_f(struct bch *);
+
+static const char bch_req[] =
+    "GET /images/cat.jpg?size=large HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:56.0) "
+	"Gecko/20100101 Firefox/56.0\r\n"
+    "Accept: image/webp,image/*,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.example.com/\r\n"
+    "Cookie: session=5f0c2a77e1; theme=dark\r\n"
+    "Connection: keep-alive\r\n"
+    "If-Modified-Since: Mon, 02 Oct 2017 10:00:00 GMT\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+static const char * const bch_resp[] = {
+	"Date: Mon, 09 Oct 2017 12:00:00 GMT",
+	"Server: Apache/2.4.25 (Debian)",
+	"Last-Modified: Mon, 02 Oct 2017 10:00:00 GMT",
+	"ETag: \"5b3c-55a8f3d2c9e80\"",
+	"Accept-Ranges: bytes",
+	"Content-Length: 23356",
+	"Cache-Control: max-age=3600",
+	"Vary: Accept-Encoding",
+	"Content-Type: text/html; charset=UTF-8",
+	NULL
+};
+
+/*--------------------------------------------------------------------*/
+
+static uint64_t
+bch_heap(void)
+{
+#ifdef HAVE_MALLCTL
+	uint64_t u;
+	size_t sz = sizeof u;
+
+	if (mallctl("thread.allocated", &u, &sz, NULL, 0) == 0)
+		return (u);
+#endif
+	return (0);
+}
+
+static void
+bch_start(struct bch *b)
+{
+
+	CHECK_OBJ_NOTNULL(b, BCH_MAGIC);
+	b->ws_bytes = 0;
+	b->heap0 = bch_heap();
+	b->t0 = VTIM_mono();
+}
+
+static void
+bch_stop(struct bch *b)
+{
+
+	CHECK_OBJ_NOTNULL(b, BCH_MAGIC);
+	b->t = VTIM_mono() - b->t0;
+	b->heap = bch_heap() - b->heap0;
+}
+
+/* End of one operation: account and give back its workspace */
+
+static inline void
+bch_ws(struct bch *b)
+{
+
+	b->ws_bytes += pdiff(b->ws->s, b->ws->f);
+	WS_Reset(b->ws, 0);
+}
+
+static struct http *
+bch_http(struct bch *b, enum VSL_tag_e whence)
+{
+	struct http *hp;
+	void *p;
+
+	p = malloc(HTTP_estimate(cache_param->http_max_hdr));
+	AN(p);
+	hp = HTTP_create(p, cache_param->http_max_hdr);
+	HTTP_Setup(hp, b->ws, b->vsl, whence);
+	return (hp);
+}
+
+static void
+bch_dissect(struct bch *b, struct http *hp, char *buf)
+{
+	struct http_conn htc[1];
+
+	INIT_OBJ(htc, HTTP_CONN_MAGIC);
+	htc->ws = b->ws;
+	memcpy(buf, bch_req, sizeof bch_req);
+	htc->rxbuf_b = buf;
+	htc->rxbuf_e = buf + sizeof bch_req - 1;
+	HTTP_Setup(hp, b->ws, b->vsl, SLT_ReqMethod);
+	AZ(HTTP1_DissectRequest(htc, hp));
+}
+
+/*--------------------------------------------------------------------
+ * One expiry rearm in a heap of 64k objects: pop the root and put it
+ * back with a later key.
+ */
+
+struct bch_item {
+	unsigned		key;
+	unsigned		idx;
+};
+
+static int
+bch_heap_cmp(void *priv, const void *a, const void *b)
+{
+	const struct bch_item *aa = a, *bb = b;
+
+	(void)priv;
+	return (aa->key < bb->key);
+}
+
+static void
+bch_heap_update(void *priv, void *a, unsigned u)
+{
+	struct bch_item *aa = a;
+
+	(void)priv;
+	aa->idx = u;
+}
+
+static void
+bch_binheap_n(struct bch *b, unsigned arity)
+{
+	struct binheap *bh;
+	struct bch_item *it, *p;
+	unsigned u, nit = 1 << 16;
+
+	bh = binheap_new_dary(NULL, bch_heap_cmp, bch_heap_update, arity);
+	AN(bh);
+	it = calloc(nit, sizeof *it);
+	AN(it);
+	for (u = 0; u < nit; u++) {
+		it[u].key = VRND_RandomTestable();
+		binheap_insert(bh, &it[u]);
+	}
+	bch_start(b);
+	for (u = 0; u < b->n; u++) {
+		p = binheap_root(bh);
+		binheap_delete(bh, p->idx);
+		p->key += 1 + (u * 2654435761U >> 16);
+		binheap_insert(bh, p);
+	}
+	bch_stop(b);
+	for (u = 0; u < nit; u++)
+		binheap_delete(bh, it[u].idx);
+	binheap_destroy(&bh);
+	free(it);
+}
+
+static void
+bch_binheap(struct bch *b)
+{
+	bch_binheap_n(b, 2);
+}
+
+static void
+bch_binheap8(struct bch *b)
+{
+	bch_binheap_n(b, 8);
+}
+
+/*--------------------------------------------------------------------
+ * The digest of the default vcl_hash{}
+ */
+
+static void
+bch_sha256(struct bch *b)
+{
+	static const char url[] = "/images/cat.jpg?size=large";
+	static const char host[] = "www.example.com";
+	VSHA256_CTX ctx;
+	unsigned char digest[VSHA256_LEN];
+	unsigned u;
+
+	bch_start(b);
+	for (u = 0; u < b->n; u++) {
+		VSHA256_Init(&ctx);
+		VSHA256_Update(&ctx, url, sizeof url - 1);
+		VSHA256_Update(&ctx, "#", 1);
+		VSHA256_Update(&ctx, host, sizeof host - 1);
+		VSHA256_Update(&ctx, "#", 1);
+		VSHA256_Final(digest, &ctx);
+	}
+	bch_stop(b);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+bch_vre(struct bch *b)
+{
+	static const char url[] = "/images/cat.jpg?size=large";
+	vre_t *re;
+	const char *err;
+	int ov[30], erroff;
+	unsigned u;
+
+	re = VRE_compile("^/(images|css|js)/[^/]+\\.(png|jpe?g|gif|css|js)",
+	    0, &err, &erroff);
+	AN(re);
+	bch_start(b);
+	for (u = 0; u < b->n; u++)
+		assert(VRE_exec(re, url, sizeof url - 1, 0, 0, ov, 30,
+		    &cache_param->vre_limits) > 0);
+	bch_stop(b);
+	VRE_free(&re);
+}
+
+/*--------------------------------------------------------------------
+ * Dissecting a browser request, including the copy into the buffer
+ */
+
+static void
+bch_http1_dissect(struct bch *b)
+{
+	struct http *hp;
+	char buf[sizeof bch_req];
+	unsigned u;
+
+	hp = bch_http(b, SLT_ReqMethod);
+	bch_start(b);
+	for (u = 0; u < b->n; u++) {
+		bch_dissect(b, hp, buf);
+		bch_ws(b);
+	}
+	bch_stop(b);
+	free(hp);
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct http *
+bch_resp_http(struct bch *b)
+{
+	struct http *hp;
+	const char * const *p;
+
+	hp = bch_http(b, SLT_BerespMethod);
+	http_PutResponse(hp, "HTTP/1.1", 200, NULL);
+	for (p = bch_resp; *p != NULL; p++)
+		http_SetHeader(hp, *p);
+	return (hp);
+}
+
+static void
+bch_http_encode(struct bch *b)
+{
+	struct http *hp;
+	uint8_t buf[2048];
+	unsigned u;
+
+	hp = bch_resp_http(b);
+	bch_start(b);
+	for (u = 0; u < b->n; u++)
+		(void)HTTP_Encode(hp, buf, sizeof buf, HTTPH_A_INS, 0);
+	bch_stop(b);
+	free(hp);
+	WS_Reset(b->ws, 0);
+}
+
+static void
+bch_http_decode(struct bch *b)
+{
+	struct http *hp, *hp2;
+	uint8_t buf[2048];
+	unsigned u;
+
+	hp = bch_resp_http(b);
+	(void)HTTP_Encode(hp, buf, sizeof buf, HTTPH_A_INS, 0);
+	hp2 = bch_http(b, SLT_RespMethod);
+	bch_start(b);
+	for (u = 0; u < b->n; u++) {
+		AZ(HTTP_Decode(hp2, buf));
+		bch_ws(b);
+	}
+	bch_stop(b);
+	free(hp);
+	free(hp2);
+}
+
+/*--------------------------------------------------------------------
+ * Two variants of an object which varies on Accept-Encoding and
+ * Accept-Language, the second language matches.
+ */
+
+static uint8_t *
+bch_vary(uint8_t *p, const char *hdr, const char *val)
+{
+	size_t lh = strlen(hdr), lv = strlen(val);
+
+	vbe16enc(p, lv);
+	p[2] = lh + 1;
+	memcpy(p + 3, hdr, lh);
+	p[3 + lh] = ':';
+	p[4 + lh] = '\0';
+	memcpy(p + 5 + lh, val, lv);
+	return (p + 5 + lh + lv);
+}
+
+static void
+bch_vry_match(struct bch *b)
+{
+	struct req *req;
+	uint8_t v1[256], v2[256], *p;
+	char buf[sizeof bch_req], *wsb;
+	unsigned u;
+
+	p = bch_vary(v1, "Accept-Encoding", "gzip");
+	p = bch_vary(p, "Accept-Language", "de-DE,de;q=0.7");
+	memcpy(p, "\xff\xff", 3);
+	p = bch_vary(v2, "Accept-Encoding", "gzip, deflate, br");
+	p = bch_vary(p, "Accept-Language", "en-US,en;q=0.5");
+	memcpy(p, "\xff\xff", 3);
+
+	ALLOC_OBJ(req, REQ_MAGIC);
+	AN(req);
+	wsb = malloc(4096);
+	AN(wsb);
+	WS_Init(req->ws, "req", wsb, 4096);
+	req->http = bch_http(b, SLT_ReqMethod);
+	bch_dissect(b, req->http, buf);
+	bch_start(b);
+	for (u = 0; u < b->n; u++) {
+		VRY_Prep(req);
+		AZ(VRY_Match(req, v1, 0));
+		AN(VRY_Match(req, v2, 0));
+		VRY_Finish(req, DISCARD);
+	}
+	bch_stop(b);
+	WS_Reset(b->ws, 0);
+	free(req->http);
+	free(wsb);
+	FREE_OBJ(req);
+}
+
+/*--------------------------------------------------------------------
+ * Hits on 64k objheads, through the configured hash
+ */
+
+static void
+bch_hash_lookup(struct bch *b)
+{
+	const struct hash_slinger *hs = heritage.hash;
+	struct objhead **ohs, *oh;
+	uint8_t *digests;
+	unsigned u, i, noh_n = 1 << 16;
+	VSHA256_CTX ctx;
+
+	CHECK_OBJ_NOTNULL(hs, SLINGER_MAGIC);
+	digests = malloc(noh_n * VSHA256_LEN);
+	AN(digests);
+	ohs = calloc(noh_n, sizeof *ohs);
+	AN(ohs);
+	for (u = 0; u < noh_n; u++) {
+		VSHA256_Init(&ctx);
+		VSHA256_Update(&ctx, "bench", 5);
+		VSHA256_Update(&ctx, &u, sizeof u);
+		VSHA256_Final(digests + u * VSHA256_LEN, &ctx);
+		if (b->wrk->nobjhead == NULL) {
+			b->wrk->nobjhead = HSH_NewObjHead();
+			b->wrk->stats->n_objecthead++;
+		}
+		if (hs->prep != NULL)
+			hs->prep(b->wrk);
+		ohs[u] = hs->lookup(b->wrk, digests + u * VSHA256_LEN,
+		    &b->wrk->nobjhead);
+		AZ(b->wrk->nobjhead);
+		Lck_Unlock(&ohs[u]->mtx);
+	}
+	b->wrk->nobjhead = HSH_NewObjHead();
+	b->wrk->stats->n_objecthead++;
+
+	bch_start(b);
+	for (u = 0, i = 0; u < b->n; u++) {
+		i = (i * 1103515245U + 12345U) & (noh_n - 1);
+		if (hs->prep != NULL)
+			hs->prep(b->wrk);
+		oh = hs->lookup(b->wrk, digests + i * VSHA256_LEN,
+		    &b->wrk->nobjhead);
+		assert(oh == ohs[i]);
+		Lck_Unlock(&oh->mtx);
+		(void)HSH_DerefObjHead(b->wrk, &oh);
+	}
+	bch_stop(b);
+
+	for (u = 0; u < noh_n; u++)
+		(void)HSH_DerefObjHead(b->wrk, &ohs[u]);
+	free(ohs);
+	free(digests);
+}
+
+/*--------------------------------------------------------------------
+ * Gzip and gunzip of a 16k page, one vgz per operation like one per
+ * fetch or delivery.
+ */
+
+static char *
+bch_page(size_t *lp)
+{
+	struct vsb *vsb;
+	char *p;
+	unsigned u;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_cat(vsb, "<html><body><ul>\n");
+	for (u = 0; VSB_len(vsb) < 16384 - 64; u++)
+		VSB_printf(vsb, "<li><a href=\"/item/%u\">Item %u</a></li>\n",
+		    u, u * 7);
+	VSB_cat(vsb, "</ul></body></html>\n");
+	AZ(VSB_finish(vsb));
+	*lp = VSB_len(vsb);
+	p = strdup(VSB_data(vsb));
+	AN(p);
+	VSB_destroy(&vsb);
+	return (p);
+}
+
+static size_t
+bch_gzip1(struct bch *b, const char *page, size_t len, char *buf,
+    size_t blen)
+{
+	struct vgz *vg;
+	const void *dp;
+	ssize_t dl;
+	enum vgzret_e vr;
+
+	vg = VGZ_NewGzip(b->vsl, "G F -");
+	VGZ_Ibuf(vg, page, len);
+	VGZ_Obuf(vg, buf, blen);
+	do
+		vr = VGZ_Gzip(vg, &dp, &dl, VGZ_FINISH);
+	while (vr == VGZ_OK);
+	assert(vr == VGZ_END);
+	(void)VGZ_Destroy(&vg);
+	return ((const char *)dp + dl - buf);
+}
+
+static void
+bch_gzip(struct bch *b)
+{
+	char *page, *buf;
+	size_t len;
+	unsigned u;
+
+	page = bch_page(&len);
+	buf = malloc(2 * len);
+	AN(buf);
+	bch_start(b);
+	for (u = 0; u < b->n; u++)
+		(void)bch_gzip1(b, page, len, buf, 2 * len);
+	bch_stop(b);
+	free(buf);
+	free(page);
+}
+
+static void
+bch_gunzip(struct bch *b)
+{
+	char *page, *gz, *buf;
+	size_t len, gzlen;
+	struct vgz *vg;
+	const void *dp;
+	ssize_t dl;
+	enum vgzret_e vr;
+	unsigned u;
+
+	page = bch_page(&len);
+	gz = malloc(2 * len);
+	AN(gz);
+	gzlen = bch_gzip1(b, page, len, gz, 2 * len);
+	buf = malloc(len);
+	AN(buf);
+	bch_start(b);
+	for (u = 0; u < b->n; u++) {
+		vg = VGZ_NewGunzip(b->vsl, "U D -");
+		VGZ_Ibuf(vg, gz, gzlen);
+		VGZ_Obuf(vg, buf, len);
+		do
+			vr = VGZ_Gunzip(vg, &dp, &dl);
+		while (vr == VGZ_OK);
+		assert(vr == VGZ_END);
+		(void)VGZ_Destroy(&vg);
+	}
+	bch_stop(b);
+	AZ(memcmp(buf, page, len));
+	free(buf);
+	free(gz);
+	free(page);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+bch_vslb(struct bch *b)
+{
+	unsigned u;
+
+	bch_start(b);
+	for (u = 0; u < b->n; u++)
+		VSLb(b->vsl, SLT_VCL_Log, "bench %u", u);
+	bch_stop(b);
+	VSL_Flush(b->vsl, 0);
+}
+
+/*--------------------------------------------------------------------*/
+
+static const struct bch_test {
+	const char		*name;
+	bch_func_f		*func;
+	unsigned		n;
+} bch_tests[] = {
+	{ "binheap",		bch_binheap,		1000000 },
+	{ "binheap8",		bch_binheap8,		1000000 },
+	{ "sha256",		bch_sha256,		1000000 },
+	{ "vre",		bch_vre,		1000000 },
+	{ "http1_dissect",	bch_http1_dissect,	200000 },
+	{ "http_encode",	bch_http_encode,	500000 },
+	{ "http_decode",	bch_http_decode,	500000 },
+	{ "vry_match",		bch_vry_match,		1000000 },
+	{ "hash_lookup",	bch_hash_lookup,	1000000 },
+	{ "gzip",		bch_gzip,		2000 },
+	{ "gunzip",		bch_gunzip,		10000 },
+	{ "vslb",		bch_vslb,		1000000 },
+	{ NULL,			NULL,			0 }
+};
+
+static void
+bch_run(struct cli *cli, struct bch *b, const struct bch_test *bt,
+    unsigned n)
+{
+	char hb[16];
+
+	b->n = n > 0 ? n : bt->n;
+	bt->func(b);
+#ifdef HAVE_MALLCTL
+	bprintf(hb, "%.1f", (double)b->heap / b->n);
+#else
+	strcpy(hb, "-");
+#endif
+	VCLI_Out(cli, "%-14s %10u %10.1f %10.1f %10s\n", bt->name, b->n,
+	    b->t * 1e9 / b->n, (double)b->ws_bytes / b->n, hb);
+}
+
+static void __match_proto__(cli_func_t)
+bch_cli(struct cli *cli, const char * const *av, void *priv)
+{
+	const struct bch_test *bt;
+	struct bch b[1];
+	unsigned n = 0;
+	char *p, *wsb;
+	int i, all = 1;
+
+	(void)priv;
+	for (i = 2; av[i] != NULL; i++) {
+		if (!strcmp(av[i], "-n")) {
+			if (av[++i] == NULL ||
+			    (n = strtoul(av[i], &p, 0)) == 0 || *p != '\0') {
+				VCLI_Out(cli, "-n wants a count");
+				VCLI_SetResult(cli, CLIS_PARAM);
+				return;
+			}
+			continue;
+		}
+		for (bt = bch_tests; bt->name != NULL; bt++)
+			if (!strcmp(av[i], bt->name))
+				break;
+		if (bt->name == NULL) {
+			VCLI_Out(cli, "Unknown benchmark: %s", av[i]);
+			VCLI_SetResult(cli, CLIS_PARAM);
+			return;
+		}
+		all = 0;
+	}
+
+	INIT_OBJ(b, BCH_MAGIC);
+	ALLOC_OBJ(b->wrk, WORKER_MAGIC);
+	AN(b->wrk);
+	wsb = malloc(cache_param->workspace_client);
+	AN(wsb);
+	WS_Init(b->ws, "bch", wsb, cache_param->workspace_client);
+	VSL_Setup(b->vsl, NULL, 0);
+	b->vsl->wid = VXID_Get(b->wrk, VSL_CLIENTMARKER);
+	b->wrk->vsl = b->vsl;
+
+	VCLI_Out(cli, "%-14s %10s %10s %10s %10s\n",
+	    "bench", "ops", "ns/op", "ws B/op", "heap B/op");
+	if (all) {
+		for (bt = bch_tests; bt->name != NULL; bt++)
+			bch_run(cli, b, bt, n);
+	} else {
+		for (i = 2; av[i] != NULL; i++) {
+			if (!strcmp(av[i], "-n")) {
+				i++;
+				continue;
+			}
+			for (bt = bch_tests; strcmp(av[i], bt->name); bt++)
+				continue;
+			bch_run(cli, b, bt, n);
+		}
+	}
+
+	b->wrk->vsl = NULL;
+	VSL_End(b->vsl);
+	free(b->vsl->wlb);
+	free(wsb);
+	HSH_Cleanup(b->wrk);
+	Pool_Sumstat(b->wrk);
+	FREE_OBJ(b->wrk);
+}
+
+static struct cli_proto bch_cmds[] = {
+	{ CLICMD_DEBUG_BENCH,			"d", bch_cli },
+	{ NULL }
+};
+
+void
+BCH_Init(void)
+{
+
+	CLI_AddFuncs(bch_cmds);
+}
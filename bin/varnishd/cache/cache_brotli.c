@@ -0,0 +1,287 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Interaction with the brotli library.
+ *
+ * Objects are compressed on the way into the cache with beresp.do_brotli
+ * and decompressed on the way out to clients which do not accept brotli.
+ * Unlike gzip there are no magic bits to keep track of, brotli streams
+ * cannot be spliced, so ESI objects are never brotli'ed.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_BROTLI)
+
+#include <stdlib.h>
+
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+
+#include "cache.h"
+#include "cache_filter.h"
+
+struct vbr {
+	unsigned		magic;
+#define VBR_MAGIC		0x4e2b36a1
+	struct vsl_log		*vsl;
+	const char		*id;
+
+	BrotliEncoderState	*enc;
+	BrotliDecoderState	*dec;
+	int			finish;
+
+	uint8_t			*m_buf;
+	size_t			m_sz;
+	size_t			m_len;
+
+	const uint8_t		*next_in;
+	size_t			avail_in;
+	size_t			total_in;
+	size_t			total_out;
+};
+
+/*--------------------------------------------------------------------*/
+
+static struct vbr *
+vbr_new(struct vsl_log *vsl, const char *id, int enc)
+{
+	struct vbr *vb;
+
+	ALLOC_OBJ(vb, VBR_MAGIC);
+	if (vb == NULL)
+		return (NULL);
+	vb->vsl = vsl;
+	vb->id = id;
+	if (enc) {
+		VSC_C_main->n_brotli++;
+		vb->enc = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+		if (vb->enc != NULL)
+			AN(BrotliEncoderSetParameter(vb->enc,
+			    BROTLI_PARAM_QUALITY, cache_param->brotli_quality));
+	} else {
+		VSC_C_main->n_unbrotli++;
+		vb->dec = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+	}
+
+	/* Same buffer size as for the in-transit gzip work */
+	vb->m_sz = cache_param->gzip_buffer;
+	vb->m_buf = malloc(vb->m_sz);
+	if ((vb->enc == NULL && vb->dec == NULL) || vb->m_buf == NULL) {
+		if (vb->enc != NULL)
+			BrotliEncoderDestroyInstance(vb->enc);
+		if (vb->dec != NULL)
+			BrotliDecoderDestroyInstance(vb->dec);
+		free(vb->m_buf);
+		FREE_OBJ(vb);
+		return (NULL);
+	}
+	return (vb);
+}
+
+static void
+vbr_destroy(struct vbr **vbp)
+{
+	struct vbr *vb;
+
+	TAKE_OBJ_NOTNULL(vb, vbp, VBR_MAGIC);
+	AN(vb->id);
+	VSLb(vb->vsl, SLT_Brotli, "%s %zu %zu",
+	    vb->id, vb->total_in, vb->total_out);
+	if (vb->enc != NULL)
+		BrotliEncoderDestroyInstance(vb->enc);
+	if (vb->dec != NULL)
+		BrotliDecoderDestroyInstance(vb->dec);
+	free(vb->m_buf);
+	FREE_OBJ(vb);
+}
+
+/*--------------------------------------------------------------------
+ * VDP for unbrotli'ing
+ */
+
+int __match_proto__(vdp_bytes)
+VDP_unbrotli(struct req *req, enum vdp_action act, void **priv,
+    const void *ptr, ssize_t len)
+{
+	BrotliDecoderResult r;
+	struct vbr *vb;
+	uint8_t *next_out;
+	size_t avail_out;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+
+	if (act == VDP_INIT) {
+		vb = vbr_new(req->vsl, "U D -", 0);
+		if (vb == NULL)
+			return (-1);
+		*priv = vb;
+		http_Unset(req->resp, H_Content_Encoding);
+		req->resp_len = -1;
+		return (0);
+	}
+
+	CAST_OBJ_NOTNULL(vb, *priv, VBR_MAGIC);
+
+	if (act == VDP_FINI) {
+		/* NB: Unbrotli'ing may or may not have completed. */
+		AZ(len);
+		vbr_destroy(&vb);
+		*priv = NULL;
+		return (0);
+	}
+
+	if (len == 0)
+		return (0);
+
+	vb->next_in = ptr;
+	vb->avail_in = len;
+	do {
+		next_out = vb->m_buf + vb->m_len;
+		avail_out = vb->m_sz - vb->m_len;
+		r = BrotliDecoderDecompressStream(vb->dec,
+		    &vb->avail_in, &vb->next_in, &avail_out, &next_out, NULL);
+		if (r == BROTLI_DECODER_RESULT_ERROR) {
+			VSLb(req->vsl, SLT_Error, "Unbrotli error: %s",
+			    BrotliDecoderErrorString(
+			    BrotliDecoderGetErrorCode(vb->dec)));
+			return (-1);
+		}
+		vb->total_out += (next_out - vb->m_buf) - vb->m_len;
+		vb->m_len = next_out - vb->m_buf;
+		if (vb->m_len > 0 && (vb->m_len == vb->m_sz ||
+		    r != BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT)) {
+			if (VDP_bytes(req, VDP_FLUSH, vb->m_buf, vb->m_len))
+				return (req->vdp_retval);
+			vb->m_len = 0;
+		}
+	} while (r == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT ||
+	    (r == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT && vb->avail_in > 0));
+	vb->total_in += len - vb->avail_in;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * VFP_BROTLI
+ *
+ * A VFP for brotli'ing an object as we receive it from the backend
+ */
+
+static enum vfp_status __match_proto__(vfp_init_f)
+vfp_brotli_init(struct vfp_ctx *vc, struct vfp_entry *vfe)
+{
+	struct vbr *vb;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
+
+	if (http_HdrIs(vc->http, H_Content_Length, "0")) {
+		http_Unset(vc->http, H_Content_Encoding);
+		return (VFP_NULL);
+	}
+	if (http_GetHdr(vc->http, H_Content_Encoding, NULL))
+		return (VFP_NULL);
+
+	vb = vbr_new(vc->wrk->vsl, vfe->vfp->priv1, 1);
+	if (vb == NULL)
+		return (VFP_ERROR);
+	vfe->priv1 = vb;
+
+	http_Unset(vc->http, H_Content_Length);
+	RFC2616_Weaken_Etag(vc->http);
+	http_SetHeader(vc->http, "Content-Encoding: br");
+	RFC2616_Vary_AE(vc->http);
+	return (VFP_OK);
+}
+
+static enum vfp_status __match_proto__(vfp_pull_f)
+vfp_brotli_pull(struct vfp_ctx *vc, struct vfp_entry *vfe, void *p,
+    ssize_t *lp)
+{
+	struct vbr *vb;
+	enum vfp_status vp;
+	uint8_t *next_out;
+	size_t avail_out;
+	ssize_t l;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
+	CAST_OBJ_NOTNULL(vb, vfe->priv1, VBR_MAGIC);
+	AN(p);
+	AN(lp);
+	next_out = p;
+	avail_out = *lp;
+	*lp = 0;
+	do {
+		if (vb->avail_in == 0 && !vb->finish) {
+			l = vb->m_sz;
+			vp = VFP_Suck(vc, vb->m_buf, &l);
+			if (vp == VFP_ERROR)
+				return (vp);
+			if (vp == VFP_END)
+				vb->finish = 1;
+			vb->next_in = vb->m_buf;
+			vb->avail_in = l;
+			vb->total_in += l;
+		}
+		if (!BrotliEncoderCompressStream(vb->enc, vb->finish ?
+		    BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS,
+		    &vb->avail_in, &vb->next_in, &avail_out, &next_out, NULL))
+			return (VFP_Error(vc, "Brotli failed"));
+		if (next_out != p) {
+			*lp = next_out - (uint8_t *)p;
+			vb->total_out += *lp;
+			return (VFP_OK);
+		}
+	} while (!BrotliEncoderIsFinished(vb->enc));
+	return (VFP_END);
+}
+
+static void __match_proto__(vfp_fini_f)
+vfp_brotli_fini(struct vfp_ctx *vc, struct vfp_entry *vfe)
+{
+	struct vbr *vb;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
+
+	if (vfe->priv1 != NULL) {
+		CAST_OBJ_NOTNULL(vb, vfe->priv1, VBR_MAGIC);
+		vfe->priv1 = NULL;
+		vbr_destroy(&vb);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+const struct vfp vfp_brotli = {
+	.name = "BROTLI",
+	.init = vfp_brotli_init,
+	.pull = vfp_brotli_pull,
+	.fini = vfp_brotli_fini,
+	.priv1 = "B F -",
+};
+
+#endif /* defined(HAVE_BROTLI) */
@@ -45,6 +45,14 @@ static struct mempool		*vbopool;
 /*--------------------------------------------------------------------
  */
 
+static unsigned __match_proto__(mpl_extra_f)
+vbo_extra(void)
+{
+
+	/* bo->bereq0, bo->bereq and bo->beresp */
+	return (3 * HTTP_IndexSize(cache_param->http_max_hdr));
+}
+
 void
 VBO_Init(void)
 {
@@ -52,6 +60,14 @@ VBO_Init(void)
 	vbopool = MPL_New("busyobj", &cache_param->vbo_pool,
 	    &cache_param->workspace_backend);
 	AN(vbopool);
+	MPL_Extra(vbopool, vbo_extra);
+}
+
+void
+VBO_Magazine(void)
+{
+
+	MPL_Magazine(vbopool);
 }
 
 /*--------------------------------------------------------------------
@@ -72,13 +88,13 @@ vbo_New(void)
 }
 
 static void
-vbo_Free(struct busyobj **bop)
+vbo_Free(struct busyobj **bop, size_t used)
 {
 	struct busyobj *bo;
 
 	TAKE_OBJ_NOTNULL(bo, bop, BUSYOBJ_MAGIC);
 	AZ(bo->htc);
-	MPL_Free(vbopool, bo);
+	MPL_FreeUsed(vbopool, bo, used);
 }
 
 struct busyobj *
@@ -124,6 +140,7 @@ VBO_GetBusyObj(struct worker *wrk, const struct req *req)
 	assert(p < bo->end);
 
 	WS_Init(bo->ws, "bo", p, bo->end - p);
+	VSL_Trace(bo->vsl, bo->ws, req->vsl->wid, req->vsl, NAN);
 
 	bo->do_stream = 1;
 
@@ -146,6 +163,8 @@ void
 VBO_ReleaseBusyObj(struct worker *wrk, struct busyobj **pbo)
 {
 	struct busyobj *bo;
+	uint64_t *c, v[6];
+	size_t used;
 
 	CHECK_OBJ_ORNULL(wrk, WORKER_MAGIC);
 	TAKE_OBJ_NOTNULL(bo, pbo, BUSYOBJ_MAGIC);
@@ -157,13 +176,13 @@ VBO_ReleaseBusyObj(struct worker *wrk, struct busyobj **pbo)
 	VRTPRIV_dynamic_kill(bo->privs, (uintptr_t)bo);
 	assert(VTAILQ_EMPTY(&bo->privs->privs));
 
-	VSLb(bo->vsl, SLT_BereqAcct, "%ju %ju %ju %ju %ju %ju",
-	    (uintmax_t)bo->acct.bereq_hdrbytes,
-	    (uintmax_t)bo->acct.bereq_bodybytes,
-	    (uintmax_t)(bo->acct.bereq_hdrbytes + bo->acct.bereq_bodybytes),
-	    (uintmax_t)bo->acct.beresp_hdrbytes,
-	    (uintmax_t)bo->acct.beresp_bodybytes,
-	    (uintmax_t)(bo->acct.beresp_hdrbytes + bo->acct.beresp_bodybytes));
+	v[0] = bo->acct.bereq_hdrbytes;
+	v[1] = bo->acct.bereq_bodybytes;
+	v[2] = bo->acct.bereq_hdrbytes + bo->acct.bereq_bodybytes;
+	v[3] = bo->acct.beresp_hdrbytes;
+	v[4] = bo->acct.beresp_bodybytes;
+	v[5] = bo->acct.beresp_hdrbytes + bo->acct.beresp_bodybytes;
+	VSLb_u64(bo->vsl, SLT_BereqAcct, v, 6);
 
 	VSL_End(bo->vsl);
 
@@ -177,8 +196,17 @@ VBO_ReleaseBusyObj(struct worker *wrk, struct busyobj **pbo)
 
 	VCL_Rel(&bo->vcl);
 
+	switch (WS_Quartile(bo->ws)) {
+	case 0:	c = &VSC_C_main->ws_backend_25; break;
+	case 1:	c = &VSC_C_main->ws_backend_50; break;
+	case 2:	c = &VSC_C_main->ws_backend_75; break;
+	default: c = &VSC_C_main->ws_backend_100; break;
+	}
+	(void)__sync_add_and_fetch(c, 1);
+	used = pdiff(bo, bo->ws->s) + WS_HighWater(bo->ws);
+
 	memset(&bo->retries, 0,
 	    sizeof *bo - offsetof(struct busyobj, retries));
 
-	vbo_Free(&bo);
+	vbo_Free(&bo, used);
 }
@@ -132,11 +132,19 @@ vdp_objiterator(void *priv, int flush, const void *ptr, ssize_t len)
 int
 VDP_DeliverObj(struct req *req)
 {
-	int r;
+	struct vdp_entry *vdp;
+	int r, final;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
-	r = ObjIterate(req->wrk, req->objcore, req, vdp_objiterator,
-	    req->objcore->flags & OC_F_PRIVATE ? 1 : 0);
+	final = req->objcore->flags & OC_F_PRIVATE &&
+	    !req->synth_cached ? 1 : 0;
+	vdp = VTAILQ_FIRST(&req->vdp);
+	/* Ranges of the object as stored can skip what they don't need */
+	if (vdp != NULL && vdp->func == VDP_range)
+		r = VRG_DeliverObj(req, vdp->priv, final);
+	else
+		r = ObjIterate(req->wrk, req->objcore, req, vdp_objiterator,
+		    final);
 	if (r < 0)
 		return (r);
 	return (0);
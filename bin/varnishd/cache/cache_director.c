@@ -50,6 +50,7 @@ vdi_resolve(struct worker *wrk, struct busyobj *bo)
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 
+	bo->hedge = NULL;
 	for (d = bo->director_req; d != NULL && d->resolve != NULL; d = d2) {
 		CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 		d2 = d->resolve(d, wrk, bo);
@@ -64,7 +65,14 @@ vdi_resolve(struct worker *wrk, struct busyobj *bo)
 	return (d);
 }
 
-/* Get a set of response headers -------------------------------------*/
+/* Get a set of response headers -------------------------------------
+ *
+ * If bo->can_park is set, the director may return 1 rather than block
+ * waiting for the response.  It must then point bo->park at a waited
+ * for the backend connection, and will be called again, with bo->parked
+ * set, once that is readable, or writable if want_write is set, or timed
+ * out.  The wait_event is passed in bo->park->priv2.
+ */
 
 int
 VDI_GetHdr(struct worker *wrk, struct busyobj *bo)
@@ -75,12 +83,28 @@ VDI_GetHdr(struct worker *wrk, struct busyobj *bo)
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 
-	d = vdi_resolve(wrk, bo);
+	if (bo->parked) {
+		/* Coming back, stay with the backend we parked on */
+		assert(bo->director_state == DIR_S_HDRS);
+		d = bo->director_resp;
+		CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	} else {
+		d = vdi_resolve(wrk, bo);
+		if (d != NULL)
+			bo->director_state = DIR_S_HDRS;
+	}
 	if (d != NULL) {
 		AN(d->gethdrs);
-		bo->director_state = DIR_S_HDRS;
 		i = d->gethdrs(d, wrk, bo);
 	}
+	bo->parked = 0;
+	if (i > 0) {
+		/* The director wants to wait, see vbf_park() */
+		AN(bo->can_park);
+		AN(bo->park);
+		bo->parked = 1;
+		return (i);
+	}
 	if (i)
 		bo->director_state = DIR_S_NULL;
 	return (i);
@@ -180,6 +204,46 @@ VDI_Healthy(const struct director *d, const struct busyobj *bo)
 	return (d->healthy(d, bo, NULL));
 }
 
+/*--------------------------------------------------------------------
+ * A generation number for the health of all backends.
+ *
+ * Bumped whenever a backend goes sick or healthy, so directors can cache
+ * who of their children is healthy for as long as it does not change.
+ * Zero is never a valid generation, we return it while the health of
+ * some backend depends on the time, see VDI_HealthTimed().
+ */
+
+static unsigned vdi_health_gen = 1;
+static unsigned vdi_health_timed;
+
+void
+VDI_HealthChanged(void)
+{
+
+	if (__sync_add_and_fetch(&vdi_health_gen, 1) == 0)
+		(void)__sync_add_and_fetch(&vdi_health_gen, 1);
+}
+
+void
+VDI_HealthTimed(int on)
+{
+
+	if (on)
+		(void)__sync_add_and_fetch(&vdi_health_timed, 1);
+	else
+		AN(__sync_fetch_and_sub(&vdi_health_timed, 1));
+	VDI_HealthChanged();
+}
+
+unsigned
+VDI_HealthGen(void)
+{
+
+	if (vdi_health_timed)
+		return (0);
+	return (vdi_health_gen);
+}
+
 /* Dump panic info -----------------------------------------------------
  */
 
@@ -91,4 +91,7 @@ void VDI_Finish(struct worker *wrk, struct busyobj *bo);
 enum sess_close VDI_Http1Pipe(struct req *, struct busyobj *);
 
 int VDI_Healthy(const struct director *, const struct busyobj *);
+void VDI_HealthChanged(void);
+void VDI_HealthTimed(int);
+unsigned VDI_HealthGen(void);
 void VDI_Panic(const struct director *, struct vsb *, const char *nm);
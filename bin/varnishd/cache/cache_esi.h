@@ -28,6 +28,8 @@
  */
 
 #define	VEC_GZ	(0x21)
+#define	VEC_ID	(0x22)		/* + 8 byte length + 4 byte crc of body */
+#define	VEC_ID_LEN	(1 + 8 + 4)
 #define	VEC_V1	(0x40 + 1)
 #define	VEC_V2	(0x40 + 2)
 #define	VEC_V8	(0x40 + 8)
@@ -37,6 +37,7 @@
 
 #include "cache_transport.h"
 #include "cache_filter.h"
+#include "hash/hash_slinger.h"
 
 #include "vtim.h"
 #include "cache_esi.h"
@@ -45,6 +46,8 @@
 
 static vtr_deliver_f ved_deliver;
 static vtr_reembark_f ved_reembark;
+static vtr_deliver_f ved_prefetch_deliver;
+static vtr_reembark_f ved_prefetch_reembark;
 
 static const uint8_t gzip_hdr[] = {
 	0x1f, 0x8b, 0x08,
@@ -53,6 +56,27 @@ static const uint8_t gzip_hdr[] = {
 	0x02, 0x03
 };
 
+/*
+ * With esi_memo, the objects of the includes of a page, by src, host and
+ * whether they were asked for gzip'ed.  The memo belongs to the top ESI
+ * object's ecx, and is shared by the ecx's of nested ESI objects.
+ */
+
+struct ved_memo {
+	unsigned			magic;
+#define VED_MEMO_MAGIC			0x5d0b1c3e
+	VTAILQ_ENTRY(ved_memo)		list;
+	struct objcore			*oc;
+	int				isgzip;
+	const char			*src;
+	const char			*host;
+};
+
+struct ved_memos {
+	VTAILQ_HEAD(, ved_memo)		head;
+	unsigned			n;
+};
+
 struct ecx {
 	unsigned	magic;
 #define ECX_MAGIC	0x0b0f9163
@@ -66,6 +90,15 @@ struct ecx {
 	struct req	*preq;
 	ssize_t		l_crc;
 	uint32_t	crc;
+
+	/* Where ved_prefetch() got to, and how many includes that is */
+	const uint8_t	*pf_p;
+	unsigned	pf_ahead;
+
+	struct ved_memos	*memo;
+	struct ved_memos	memos;
+	const char		*i_src;
+	const char		*i_host;
 };
 
 static const struct transport VED_transport = {
@@ -75,6 +108,13 @@ static const struct transport VED_transport = {
 	.reembark =	ved_reembark,
 };
 
+static const struct transport VED_prefetch_transport = {
+	.magic =	TRANSPORT_MAGIC,
+	.name =		"ESI_PREFETCH",
+	.deliver =	ved_prefetch_deliver,
+	.reembark =	ved_prefetch_reembark,
+};
+
 /*--------------------------------------------------------------------*/
 
 static void __match_proto__(vtr_reembark_f)
@@ -93,21 +133,120 @@ ved_reembark(struct worker *wrk, struct req *req)
 
 /*--------------------------------------------------------------------*/
 
+static struct ved_memo *
+ved_memo_find(const struct ecx *ecx, const char *src, const char *host)
+{
+	struct ved_memo *m;
+
+	CHECK_OBJ_NOTNULL(ecx, ECX_MAGIC);
+	if (ecx->memo == NULL)
+		return (NULL);
+	VTAILQ_FOREACH(m, &ecx->memo->head, list) {
+		CHECK_OBJ(m, VED_MEMO_MAGIC);
+		if (m->isgzip == ecx->isgzip && !strcmp(m->src, src) &&
+		    !strcmp(m->host, host))
+			return (m);
+	}
+	return (NULL);
+}
+
+/* Called from ved_deliver(), when the include has passed vcl_deliver{} */
 static void
-ved_include(struct req *preq, const char *src, const char *host,
-    struct ecx *ecx)
+ved_memo_add(struct ecx *ecx, const struct req *req, const struct boc *boc)
+{
+	struct ved_memo *m;
+	size_t ls, lh;
+	char *p;
+
+	CHECK_OBJ_NOTNULL(ecx, ECX_MAGIC);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	if (ecx->memo == NULL || ecx->i_src == NULL || req->esi_memo)
+		return;
+	if (ecx->memo->n >= cache_param->esi_memo)
+		return;
+	if (boc != NULL || req->objcore->flags & (OC_F_PRIVATE | OC_F_PASS))
+		return;
+	if (!http_IsStatus(req->resp, 200))
+		return;
+	if (ved_memo_find(ecx, ecx->i_src, ecx->i_host) != NULL)
+		return;
+
+	ls = strlen(ecx->i_src) + 1;
+	lh = strlen(ecx->i_host) + 1;
+	m = malloc(sizeof *m + ls + lh);
+	if (m == NULL)
+		return;
+	INIT_OBJ(m, VED_MEMO_MAGIC);
+	p = (char *)(m + 1);
+	memcpy(p, ecx->i_src, ls);
+	m->src = p;
+	memcpy(p + ls, ecx->i_host, lh);
+	m->host = p + ls;
+	m->isgzip = ecx->isgzip;
+	m->oc = req->objcore;
+	HSH_Ref(m->oc);
+	VTAILQ_INSERT_TAIL(&ecx->memo->head, m, list);
+	ecx->memo->n++;
+}
+
+static void
+ved_memo_fini(struct worker *wrk, struct ecx *ecx)
+{
+	struct ved_memo *m;
+
+	CHECK_OBJ_NOTNULL(ecx, ECX_MAGIC);
+	if (ecx->memo != &ecx->memos)
+		return;
+	while ((m = VTAILQ_FIRST(&ecx->memos.head)) != NULL) {
+		CHECK_OBJ(m, VED_MEMO_MAGIC);
+		VTAILQ_REMOVE(&ecx->memos.head, m, list);
+		(void)HSH_DerefObjCore(wrk, &m->oc, 0);
+		free(m);
+	}
+	ecx->memo = NULL;
+}
+
+/*
+ * Set up req to deliver the remembered object, straight from the
+ * transmit step.  Returns zero if the object could not be used.
+ */
+
+static int
+ved_memo_use(struct req *req, const struct ved_memo *m)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(m, VED_MEMO_MAGIC);
+	HTTP_Setup(req->resp, req->ws, req->vsl, SLT_RespMethod);
+	if (HTTP_Decode(req->resp,
+	    ObjGetAttr(req->wrk, m->oc, OA_HEADERS, NULL))) {
+		http_Teardown(req->resp);
+		return (0);
+	}
+	http_ForceField(req->resp, HTTP_HDR_PROTO, "HTTP/1.1");
+	req->objcore = m->oc;
+	HSH_Ref(req->objcore);
+	req->is_hit = 1;
+	req->esi_memo = 1;
+	req->req_step = R_STP_TRANSMIT;
+	VSLb(req->vsl, SLT_Hit, "%u", ObjGetXID(req->wrk, req->objcore));
+	req->wrk->stats->esi_memo++;
+	return (1);
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct req *
+ved_new_req(struct req *preq, const char *src, const char *host,
+    const struct ecx *ecx)
 {
 	struct worker *wrk;
 	struct req *req;
-	enum req_fsm_nxt s;
 
 	CHECK_OBJ_NOTNULL(preq, REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(ecx, ECX_MAGIC);
 	wrk = preq->wrk;
 
-	if (preq->esi_level >= cache_param->max_esi_depth)
-		return;
-
 	req = Req_New(wrk, preq->sp);
 	SES_Ref(preq->sp);
 	req->req_body_status = REQ_BODY_NONE;
@@ -158,9 +297,6 @@ ved_include(struct req *preq, const char *src, const char *host,
 	/* Reset request to status before we started messing with it */
 	HTTP_Copy(req->http, req->http0);
 
-	req->vcl = preq->vcl;
-	preq->vcl = NULL;
-
 	/*
 	 * XXX: We should decide if we should cache the director
 	 * XXX: or not (for session/backend coupling).  Until then
@@ -170,6 +306,30 @@ ved_include(struct req *preq, const char *src, const char *host,
 	req->t_req = preq->t_req;
 	assert(isnan(req->t_first));
 	assert(isnan(req->t_prev));
+	return (req);
+}
+
+static void
+ved_include(struct req *preq, const char *src, const char *host,
+    struct ecx *ecx)
+{
+	struct worker *wrk;
+	struct req *req;
+	struct ved_memo *m;
+	enum req_fsm_nxt s;
+
+	CHECK_OBJ_NOTNULL(preq, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(ecx, ECX_MAGIC);
+	wrk = preq->wrk;
+
+	if (preq->esi_level >= cache_param->max_esi_depth)
+		return;
+
+	m = ved_memo_find(ecx, src, host);
+	req = ved_new_req(preq, src, host, ecx);
+
+	req->vcl = preq->vcl;
+	preq->vcl = NULL;
 
 	req->transport = &VED_transport;
 	req->transport_priv = ecx;
@@ -177,9 +337,16 @@ ved_include(struct req *preq, const char *src, const char *host,
 	THR_SetRequest(req);
 
 	VSLb_ts_req(req, "Start", W_TIM_real(wrk));
+	VSL_Trace(req->vsl, req->ws, preq->vsl->wid, preq->vsl, req->t_first);
 
 	req->ws_req = WS_Snapshot(req->ws);
 
+	req->wrk = wrk;
+	if (m == NULL || !ved_memo_use(req, m)) {
+		ecx->i_src = src;
+		ecx->i_host = host;
+	}
+
 	while (1) {
 		req->wrk = wrk;
 		ecx->woken = 0;
@@ -197,10 +364,15 @@ ved_include(struct req *preq, const char *src, const char *host,
 		ecx->woken = 0;
 		AZ(req->wrk);
 	}
+	ecx->i_src = NULL;
+	ecx->i_host = NULL;
 
+	Lck_Lock(&req->sp->mtx);
 	VRTPRIV_dynamic_kill(req->sp->privs, (uintptr_t)req);
+	Lck_Unlock(&req->sp->mtx);
 	CNT_AcctLogCharge(wrk->stats, req);
 	VSL_End(req->vsl);
+	VSL_Span(preq->vsl, VSL_SPAN_ESI, req->t_first, req->t_prev);
 
 	preq->vcl = req->vcl;
 	req->vcl = NULL;
@@ -214,9 +386,6 @@ ved_include(struct req *preq, const char *src, const char *host,
 
 /*--------------------------------------------------------------------*/
 
-//#define Debug(fmt, ...) printf(fmt, __VA_ARGS__)
-#define Debug(fmt, ...) /**/
-
 static ssize_t
 ved_decode_len(struct req *req, const uint8_t **pp)
 {
@@ -247,6 +416,178 @@ ved_decode_len(struct req *req, const uint8_t **pp)
 	return (l);
 }
 
+/*--------------------------------------------------------------------
+ * Prefetching includes
+ *
+ * Includes further down the ESI object are run through VCL on other
+ * worker threads, for no other purpose than to get their fetches going
+ * while we deliver what comes before them.  When ved_include() gets to
+ * them, they are hits or busy objects we can stream from.
+ *
+ * A prefetch request is its own top request, and nothing of the
+ * parent is used once it is scheduled, so it can outlive the parent.
+ * Passes are not prefetched, they would only fetch everything twice.
+ */
+
+static void
+ved_prefetch_fini(struct worker *wrk, struct req *req)
+{
+	struct sess *sp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	sp = req->sp;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+
+	Lck_Lock(&sp->mtx);
+	VRTPRIV_dynamic_kill(sp->privs, (uintptr_t)req);
+	VRTPRIV_dynamic_kill(sp->privs, (uintptr_t)&req->top);
+	Lck_Unlock(&sp->mtx);
+	CNT_AcctLogCharge(wrk->stats, req);
+	VSL_End(req->vsl);
+	VCL_Rel(&req->vcl);
+	req->wrk = NULL;
+	Req_Release(req);
+	SES_Rel(sp);
+}
+
+static void __match_proto__(task_func_t)
+ved_prefetch_task(struct worker *wrk, void *priv)
+{
+	struct req *req;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(req, priv, REQ_MAGIC);
+	AN(req->is_prefetch);
+
+	THR_SetRequest(req);
+	if (CNT_Request(wrk, req) == REQ_FSM_DONE)
+		ved_prefetch_fini(wrk, req);
+	/* else we are on a waiting list, see ved_prefetch_reembark() */
+	THR_SetRequest(NULL);
+}
+
+static void __match_proto__(vtr_reembark_f)
+ved_prefetch_reembark(struct worker *wrk, struct req *req)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	AN(req->is_prefetch);
+	if (!SES_Reschedule_Req(req))
+		return;
+	wrk->stats->busy_wakeup--;
+	wrk->stats->busy_killed++;
+	ved_prefetch_fini(wrk, req);
+}
+
+static void __match_proto__(vtr_deliver_f)
+ved_prefetch_deliver(struct req *req, struct boc *boc, int wantbody)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
+	(void)wantbody;
+	VDP_close(req);
+}
+
+/*
+ * Find the next include from ecx->pf_p on
+ */
+
+static int
+ved_next_include(struct req *req, struct ecx *ecx, const char **src,
+    const char **host)
+{
+	const uint8_t *q;
+
+	CHECK_OBJ_NOTNULL(ecx, ECX_MAGIC);
+	while (ecx->pf_p < ecx->e) {
+		switch (*ecx->pf_p) {
+		case VEC_V1:
+		case VEC_V2:
+		case VEC_V8:
+			(void)ved_decode_len(req, &ecx->pf_p);
+			if (ecx->isgzip) {
+				(void)ved_decode_len(req, &ecx->pf_p);
+				ecx->pf_p += 4;
+			}
+			break;
+		case VEC_S1:
+		case VEC_S2:
+		case VEC_S8:
+			(void)ved_decode_len(req, &ecx->pf_p);
+			break;
+		case VEC_INCL:
+			*host = (const char *)ecx->pf_p + 1;
+			q = (const void *)strchr(*host, '\0');
+			AN(q);
+			*src = (const char *)q + 1;
+			q = (const void *)strchr(*src, '\0');
+			AN(q);
+			ecx->pf_p = q + 1;
+			return (1);
+		default:
+			WRONG("ESI-codes: Illegal code");
+		}
+	}
+	return (0);
+}
+
+/*
+ * Called before the include at ecx->p is delivered, to keep up to
+ * esi_prefetch includes after it on their way.
+ */
+
+static void
+ved_prefetch(struct req *preq, struct ecx *ecx)
+{
+	struct req *req;
+	const char *src, *host;
+
+	CHECK_OBJ_NOTNULL(preq, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(ecx, ECX_MAGIC);
+	assert(*ecx->p == VEC_INCL);
+
+	if (ecx->pf_p > ecx->p) {
+		/* This one was prefetched */
+		AN(ecx->pf_ahead);
+		ecx->pf_ahead--;
+	} else {
+		/* Skip the include we are about to do ourselves */
+		ecx->pf_p = ecx->p;
+		AN(ved_next_include(preq, ecx, &src, &host));
+		AZ(ecx->pf_ahead);
+	}
+
+	if (preq->esi_level >= cache_param->max_esi_depth || preq->vcl == NULL)
+		return;
+
+	while (ecx->pf_ahead < cache_param->esi_prefetch &&
+	    ved_next_include(preq, ecx, &src, &host)) {
+		ecx->pf_ahead++;
+		req = ved_new_req(preq, src, host, ecx);
+		req->top = req;
+		req->is_prefetch = 1;
+		req->vcl = preq->vcl;
+		VCL_Ref(req->vcl);
+		req->transport = &VED_prefetch_transport;
+		VSLb_ts_req(req, "Start", W_TIM_real(preq->wrk));
+		VSL_Trace(req->vsl, req->ws, preq->vsl->wid, preq->vsl,
+		    req->t_first);
+		req->ws_req = WS_Snapshot(req->ws);
+		req->task.func = ved_prefetch_task;
+		req->task.priv = req;
+		preq->wrk->stats->esi_prefetch++;
+		if (SES_Reschedule_Req(req))
+			ved_prefetch_fini(preq->wrk, req);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+//#define Debug(fmt, ...) printf(fmt, __VA_ARGS__)
+#define Debug(fmt, ...) /**/
+
 /*---------------------------------------------------------------------
  */
 
@@ -268,6 +609,14 @@ VDP_ESI(struct req *req, enum vdp_action act, void **priv,
 		AN(ecx);
 		assert(sizeof gzip_hdr == 10);
 		ecx->preq = req;
+		if (req->esi_level > 0 && req->transport == &VED_transport) {
+			CAST_OBJ_NOTNULL(pecx, req->transport_priv,
+			    ECX_MAGIC);
+			ecx->memo = pecx->memo;
+		} else if (cache_param->esi_memo > 0) {
+			VTAILQ_INIT(&ecx->memos.head);
+			ecx->memo = &ecx->memos;
+		}
 		*priv = ecx;
 		RFC2616_Weaken_Etag(req->resp);
 		req->res_mode |= RES_ESI;
@@ -277,6 +626,7 @@ VDP_ESI(struct req *req, enum vdp_action act, void **priv,
 	}
 	CAST_OBJ_NOTNULL(ecx, *priv, ECX_MAGIC);
 	if (act == VDP_FINI) {
+		ved_memo_fini(req->wrk, ecx);
 		FREE_OBJ(ecx);
 		*priv = NULL;
 		return (0);
@@ -299,6 +649,11 @@ VDP_ESI(struct req *req, enum vdp_action act, void **priv,
 			assert(l > 0);
 			ecx->e = ecx->p + l;
 
+			if (*ecx->p == VEC_ID) {
+				/* Only of interest to esi_reuse */
+				assert(l > VEC_ID_LEN);
+				ecx->p += VEC_ID_LEN;
+			}
 			if (*ecx->p == VEC_GZ) {
 				if (pecx == NULL)
 					retval = VDP_bytes(req, VDP_NULL,
@@ -347,6 +702,9 @@ VDP_ESI(struct req *req, enum vdp_action act, void **priv,
 				ecx->state = 4;
 				break;
 			case VEC_INCL:
+				if (cache_param->esi_prefetch > 0 ||
+				    ecx->pf_ahead > 0)
+					ved_prefetch(req, ecx);
 				ecx->p++;
 				q = (void*)strchr((const char*)ecx->p, '\0');
 				AN(q);
@@ -403,10 +761,12 @@ VDP_ESI(struct req *req, enum vdp_action act, void **priv,
 			 * There is no guarantee that the 'l' bytes are all
 			 * in the same storage segment, so loop over storage
 			 * until we have processed them all.
+			 * A flush is only passed on at the end of the storage,
+			 * so that the pieces in between can go out together.
 			 */
 			if (ecx->l <= len) {
 				if (ecx->state == 3)
-					retval = VDP_bytes(req, act,
+					retval = VDP_bytes(req, VDP_NULL,
 					    pp, ecx->l);
 				len -= ecx->l;
 				pp += ecx->l;
@@ -415,6 +775,8 @@ VDP_ESI(struct req *req, enum vdp_action act, void **priv,
 			}
 			if (ecx->state == 3 && len > 0)
 				retval = VDP_bytes(req, act, pp, len);
+			else if (act == VDP_FLUSH)
+				retval = VDP_bytes(req, act, NULL, 0);
 			ecx->l -= len;
 			return (retval);
 		case 99:
@@ -792,6 +1154,8 @@ ved_deliver(struct req *req, struct boc *boc, int wantbody)
 	if (wantbody == 0)
 		return;
 
+	ved_memo_add(ecx, req, boc);
+
 	if (boc == NULL && ObjGetLen(req->wrk, req->objcore) == 0)
 		return;
 
@@ -37,6 +37,8 @@
 #include "cache_filter.h"
 
 #include "cache_esi.h"
+#include "vend.h"
+#include "vgz.h"
 
 /*---------------------------------------------------------------------
  */
@@ -55,6 +57,13 @@ struct vef_priv {
 	char			*ibuf_i;
 	char			*ibuf_o;
 	ssize_t			ibuf_sz;
+
+	/* esi_reuse, see vfp_esi_reuse() */
+	int			hash;
+	int			reuse;
+	uint32_t		crc;
+	ssize_t			l_crc;
+	ssize_t			reparse;
 };
 
 static ssize_t
@@ -113,6 +122,7 @@ vfp_esi_end(struct vfp_ctx *vc, struct vef_priv *vef,
 	struct vsb *vsb;
 	ssize_t l;
 	void *p;
+	uint8_t *q;
 
 	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(vef, VEF_MAGIC);
@@ -123,8 +133,20 @@ vfp_esi_end(struct vfp_ctx *vc, struct vef_priv *vef,
 		if (retval == VFP_END) {
 			l = VSB_len(vsb);
 			assert(l > 0);
-			p = ObjSetAttr(vc->wrk, vc->oc,
-			    OA_ESIDATA, l, VSB_data(vsb));
+			if (vef->hash) {
+				p = ObjSetAttr(vc->wrk, vc->oc,
+				    OA_ESIDATA, VEC_ID_LEN + l, NULL);
+				if (p != NULL) {
+					q = p;
+					q[0] = VEC_ID;
+					vbe64enc(q + 1, vef->l_crc);
+					vbe32enc(q + 9, vef->crc);
+					memcpy(q + VEC_ID_LEN,
+					    VSB_data(vsb), l);
+				}
+			} else
+				p = ObjSetAttr(vc->wrk, vc->oc,
+				    OA_ESIDATA, l, VSB_data(vsb));
 			if (p == NULL) {
 				retval = VFP_Error(vc,
 				    "Could not allocate storage for esidata");
@@ -219,10 +241,100 @@ vfp_esi_gzip_pull(struct vfp_ctx *vc, struct vfp_entry *vfe, void *p,
 	return (vp);
 }
 
+/*---------------------------------------------------------------------
+ * With esi_reuse, uncompressed ESI objects get a VEC_ID record with the
+ * length and CRC32 of their body, in front of their ESI instructions.
+ *
+ * If the stale object we are refetching has one, and the backend says
+ * the new body has the same length, we do not parse the new body as it
+ * comes in, we just CRC it.  If it turns out to be identical, the stale
+ * objects ESI instructions are copied, otherwise we parse what is in
+ * the object by now and carry on as usual.
+ *
+ * The URL and the ESI feature bits are part of the CRC, since relative
+ * includes and the parse depends on them.
+ */
+
+static int
+vfp_esi_reusable(const struct vfp_ctx *vc)
+{
+	const struct busyobj *bo;
+	const uint8_t *p;
+	ssize_t l;
+
+	bo = vc->bo;
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	/* Private objects lose what was delivered, we may need it again */
+	if (bo->stale_oc == NULL || bo->stale_oc->boc != NULL ||
+	    bo->is_gzip || bo->uncacheable)
+		return (0);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	if (bo->htc->content_length <= 0)
+		return (0);
+	p = ObjGetAttr(vc->wrk, bo->stale_oc, OA_ESIDATA, &l);
+	if (p == NULL || l < VEC_ID_LEN || *p != VEC_ID)
+		return (0);
+	return (vbe64dec(p + 1) == (uint64_t)bo->htc->content_length);
+}
+
+static int __match_proto__(objiterate_f)
+vfp_esi_reparse(void *priv, int flush, const void *ptr, ssize_t len)
+{
+	struct vef_priv *vef;
+
+	CAST_OBJ_NOTNULL(vef, priv, VEF_MAGIC);
+	(void)flush;
+	assert(len <= vef->reparse);
+	if (len > 0)
+		VEP_Parse(vef->vep, ptr, len);
+	vef->reparse -= len;
+	return (vef->reparse == 0);
+}
+
+static enum vfp_status
+vfp_esi_reuse(struct vfp_ctx *vc, struct vef_priv *vef, const void *p,
+    ssize_t l)
+{
+	struct objcore *stale_oc;
+	const uint8_t *q;
+	ssize_t ql;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(vef, VEF_MAGIC);
+	stale_oc = vc->bo->stale_oc;
+	CHECK_OBJ_NOTNULL(stale_oc, OBJCORE_MAGIC);
+	AN(vef->reuse);
+	vef->reuse = 0;
+
+	q = ObjGetAttr(vc->wrk, stale_oc, OA_ESIDATA, &ql);
+	AN(q);
+	assert(ql >= VEC_ID_LEN && *q == VEC_ID);
+	if (vbe64dec(q + 1) == (uint64_t)vef->l_crc &&
+	    vbe32dec(q + 9) == vef->crc) {
+		if (ObjCopyAttr(vc->wrk, vc->oc, stale_oc, OA_ESIDATA))
+			return (VFP_Error(vc,
+			    "Could not allocate storage for esidata"));
+		vc->wrk->stats->esi_reuse++;
+		return (VFP_END);
+	}
+
+	/* Not the same body after all, catch up on the parsing */
+	CHECK_OBJ_NOTNULL(vc->oc->boc, BOC_MAGIC);
+	vef->reparse = vc->oc->boc->len_so_far;
+	if (vef->reparse > 0)
+		AN(ObjIterate(vc->wrk, vc->oc, vef, vfp_esi_reparse, 0));
+	AZ(vef->reparse);
+	if (l > 0)
+		VEP_Parse(vef->vep, p, l);
+	return (VFP_END);
+}
+
 static enum vfp_status __match_proto__(vfp_init_f)
 vfp_esi_init(struct vfp_ctx *vc, struct vfp_entry *vfe)
 {
 	struct vef_priv *vef;
+	const char *url;
+	uint8_t f[4];
 
 	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(vc->esi_req, HTTP_MAGIC);
@@ -230,6 +342,19 @@ vfp_esi_init(struct vfp_ctx *vc, struct vfp_entry *vfe)
 	if (vef == NULL)
 		return (VFP_ERROR);
 	vef->vep = VEP_Init(vc, vc->esi_req, NULL, NULL);
+	if (cache_param->esi_reuse) {
+		url = vc->esi_req->hd[HTTP_HDR_URL].b;
+		AN(url);
+		vef->hash = 1;
+		vef->crc = crc32(0L, Z_NULL, 0);
+		vef->crc = crc32(vef->crc, (const void *)url, strlen(url) + 1);
+		f[0] = FEATURE(FEATURE_ESI_IGNORE_HTTPS) ? 1 : 0;
+		f[1] = FEATURE(FEATURE_ESI_DISABLE_XML_CHECK) ? 1 : 0;
+		f[2] = FEATURE(FEATURE_ESI_IGNORE_OTHER_ELEMENTS) ? 1 : 0;
+		f[3] = FEATURE(FEATURE_ESI_REMOVE_BOM) ? 1 : 0;
+		vef->crc = crc32(vef->crc, f, sizeof f);
+		vef->reuse = vfp_esi_reusable(vc);
+	}
 	vfe->priv1 = vef;
 	return (VFP_OK);
 }
@@ -252,8 +377,16 @@ vfp_esi_pull(struct vfp_ctx *vc, struct vfp_entry *vfe, void *p, ssize_t *lp)
 			*lp = d;
 	}
 	vp = VFP_Suck(vc, p, lp);
-	if (vp != VFP_ERROR && *lp > 0)
-		VEP_Parse(vef->vep, p, *lp);
+	if (vp != VFP_ERROR && *lp > 0) {
+		if (vef->hash) {
+			vef->crc = crc32(vef->crc, p, *lp);
+			vef->l_crc += *lp;
+		}
+		if (!vef->reuse)
+			VEP_Parse(vef->vep, p, *lp);
+	}
+	if (vp == VFP_END && vef->reuse)
+		vp = vfp_esi_reuse(vc, vef, p, *lp);
 	if (vp == VFP_END) {
 		vp = vfp_esi_end(vc, vef, vp);
 		vfe->priv1 = NULL;
@@ -335,7 +335,10 @@ vep_mark_common(struct vep_state *vep, const char *p, enum vep_mark mark)
 		vep->o_wait = 0;
 	}
 
-	/* Transfer pending bytes CRC into active mode CRC */
+	/*
+	 * Transfer pending bytes CRC into active mode CRC
+	 * The CRCs are only emitted into gzip'ed ESI objects.
+	 */
 	if (vep->o_pending) {
 		(void)vep->cb(vep->vc, vep->cb_priv, vep->o_pending,
 		     VGZ_NORMAL);
@@ -343,8 +346,9 @@ vep_mark_common(struct vep_state *vep, const char *p, enum vep_mark mark)
 			vep->crc = vep->crcp;
 			vep->o_crc = vep->o_pending;
 		} else {
-			vep->crc = crc32_combine(vep->crc,
-			    vep->crcp, vep->o_pending);
+			if (vep->dogzip)
+				vep->crc = crc32_combine(vep->crc,
+				    vep->crcp, vep->o_pending);
 			vep->o_crc += vep->o_pending;
 		}
 		vep->crcp = crc32(0L, Z_NULL, 0);
@@ -356,7 +360,8 @@ vep_mark_common(struct vep_state *vep, const char *p, enum vep_mark mark)
 	AN(vep->ver_p);
 	l = p - vep->ver_p;
 	assert(l >= 0);
-	vep->crc = crc32(vep->crc, (const void*)vep->ver_p, l);
+	if (vep->dogzip)
+		vep->crc = crc32(vep->crc, (const void*)vep->ver_p, l);
 	vep->o_crc += l;
 	vep->ver_p = p;
 
@@ -389,7 +394,8 @@ vep_mark_pending(struct vep_state *vep, const char *p)
 	AN(vep->ver_p);
 	l = p - vep->ver_p;
 	assert(l > 0);
-	vep->crcp = crc32(vep->crcp, (const void *)vep->ver_p, l);
+	if (vep->dogzip)
+		vep->crcp = crc32(vep->crcp, (const void *)vep->ver_p, l);
 	vep->ver_p = p;
 
 	vep->o_pending += l;
@@ -32,6 +32,7 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "cache.h"
@@ -53,9 +54,29 @@ struct exp_priv {
 	pthread_cond_t			condvar;
 
 	pthread_rwlock_t		cb_rwl;
+
+	struct VSC_C_exp		*stats;
+	uint64_t			mailed_seen;
 };
 
-static struct exp_priv *exphdl;
+/*
+ * The expiry work can be split over a number of shards, each with its
+ * own inbox, binheap and thread.  An objcore always maps to the same
+ * shard by its address, and its exp_flags are protected by that
+ * shard's mtx.
+ */
+
+static struct exp_priv **exphdl;
+static unsigned exp_nshard;
+
+static struct exp_priv *
+exp_shard(const struct objcore *oc)
+{
+
+	if (exp_nshard == 1)
+		return (exphdl[0]);
+	return (exphdl[((uintptr_t)oc >> 4) % exp_nshard]);
+}
 
 /*--------------------------------------------------------------------
  * Calculate an objects effective ttl time, taking req.ttl into account
@@ -79,28 +100,97 @@ EXP_Ttl(const struct req *req, const struct objcore *oc)
  * Post an objcore to the exp_thread's inbox.
  */
 
+static int
+exp_post(struct exp_priv *ep, struct objcore *oc, uint8_t cmds)
+{
+
+	Lck_AssertHeld(&ep->mtx);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	assert(oc->refcnt > 0);
+
+	if (!((cmds | oc->exp_flags) & OC_EF_REFD))
+		return (0);
+	if (!(oc->exp_flags & OC_EF_POSTED)) {
+		if (cmds & OC_EF_REMOVE)
+			VSTAILQ_INSERT_HEAD(&ep->inbox, oc, exp_list);
+		else
+			VSTAILQ_INSERT_TAIL(&ep->inbox, oc, exp_list);
+		ep->stats->inbox++;
+	}
+	oc->exp_flags |= cmds | OC_EF_POSTED;
+	AN(oc->exp_flags & OC_EF_REFD);
+	ep->stats->mailed++;
+	return (1);
+}
+
 static void
 exp_mail_it(struct objcore *oc, uint8_t cmds)
 {
+	struct exp_priv *ep;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	assert(oc->refcnt > 0);
+
+	ep = exp_shard(oc);
+	Lck_Lock(&ep->mtx);
+	if (exp_post(ep, oc, cmds))
+		AZ(pthread_cond_signal(&ep->condvar));
+	Lck_Unlock(&ep->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Mail an objcore through the worker's batch.
+ *
+ * The batch is flushed in order, one lock per shard, so the inbox sees
+ * the same commands as it would have from exp_mail_it(), only later.
+ * The caller must hold a reference to every batched objcore until it
+ * has called EXP_Flush().
+ */
+
+static void
+exp_batch_it(struct worker *wrk, struct objcore *oc, uint8_t cmds)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
 
-	Lck_Lock(&exphdl->mtx);
-	if ((cmds | oc->exp_flags) & OC_EF_REFD) {
-		if (!(oc->exp_flags & OC_EF_POSTED)) {
-			if (cmds & OC_EF_REMOVE)
-				VSTAILQ_INSERT_HEAD(&exphdl->inbox,
-				    oc, exp_list);
-			else
-				VSTAILQ_INSERT_TAIL(&exphdl->inbox,
-				    oc, exp_list);
+	if (wrk->exp_nbatch == EXP_BATCH)
+		EXP_Flush(wrk);
+	wrk->exp_batch[wrk->exp_nbatch] = oc;
+	wrk->exp_cmds[wrk->exp_nbatch] = cmds;
+	wrk->exp_nbatch++;
+}
+
+void
+EXP_Flush(struct worker *wrk)
+{
+	struct exp_priv *ep;
+	struct objcore *oc;
+	unsigned u, v, n;
+	int sig;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	n = wrk->exp_nbatch;
+	assert(n <= EXP_BATCH);
+	for (u = 0; u < n; u++) {
+		if (wrk->exp_batch[u] == NULL)
+			continue;
+		ep = exp_shard(wrk->exp_batch[u]);
+		sig = 0;
+		Lck_Lock(&ep->mtx);
+		for (v = u; v < n; v++) {
+			oc = wrk->exp_batch[v];
+			if (oc == NULL || exp_shard(oc) != ep)
+				continue;
+			sig |= exp_post(ep, oc, wrk->exp_cmds[v]);
+			wrk->exp_batch[v] = NULL;
 		}
-		oc->exp_flags |= cmds | OC_EF_POSTED;
-		AN(oc->exp_flags & OC_EF_REFD);
-		VSC_C_main->exp_mailed++;
-		AZ(pthread_cond_signal(&exphdl->condvar));
+		if (sig)
+			AZ(pthread_cond_signal(&ep->condvar));
+		Lck_Unlock(&ep->mtx);
 	}
-	Lck_Unlock(&exphdl->mtx);
+	wrk->exp_nbatch = 0;
 }
 
 /*--------------------------------------------------------------------
@@ -140,10 +230,12 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 /*--------------------------------------------------------------------
  * We have changed one or more of the object timers, tell the exp_thread
  *
+ * With a worker, the move is batched, see exp_batch_it().
  */
 
-void
-EXP_Rearm(struct objcore *oc, double now, double ttl, double grace, double keep)
+static void
+exp_rearm(struct worker *wrk, struct objcore *oc, double now, double ttl,
+    double grace, double keep)
 {
 	double when;
 
@@ -165,10 +257,30 @@ EXP_Rearm(struct objcore *oc, double now, double ttl, double grace, double keep)
 	VSL(SLT_ExpKill, 0, "EXP_Rearm p=%p E=%.9f e=%.9f f=0x%x", oc,
 	    oc->timer_when, when, oc->flags);
 
-	if (when < oc->t_origin || when < oc->timer_when)
+	if (!(when < oc->t_origin || when < oc->timer_when))
+		return;
+	if (wrk != NULL)
+		exp_batch_it(wrk, oc, OC_EF_MOVE);
+	else
 		exp_mail_it(oc, OC_EF_MOVE);
 }
 
+void
+EXP_Rearm(struct objcore *oc, double now, double ttl, double grace, double keep)
+{
+
+	exp_rearm(NULL, oc, now, ttl, grace, keep);
+}
+
+void
+EXP_RearmBatch(struct worker *wrk, struct objcore *oc, double now, double ttl,
+    double grace, double keep)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	exp_rearm(wrk, oc, now, ttl, grace, keep);
+}
+
 /*--------------------------------------------------------------------
  * Handle stuff in the inbox
  */
@@ -190,6 +302,8 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags)
 			binheap_delete(ep->heap, oc->timer_idx);
 		}
 		assert(oc->timer_idx == BINHEAP_NOIDX);
+		if (!(flags & OC_EF_INSERT))
+			ep->stats->heap--;
 		oc->exp_flags &= ~OC_EF_REFD;
 		assert(oc->refcnt > 0);
 		AZ(oc->exp_flags);
@@ -214,11 +328,12 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags)
 
 	if (flags & OC_EF_INSERT) {
 		assert(oc->timer_idx == BINHEAP_NOIDX);
-		binheap_insert(exphdl->heap, oc);
+		binheap_insert(ep->heap, oc);
 		assert(oc->timer_idx != BINHEAP_NOIDX);
+		ep->stats->heap++;
 	} else if (flags & OC_EF_MOVE) {
 		assert(oc->timer_idx != BINHEAP_NOIDX);
-		binheap_reorder(exphdl->heap, oc->timer_idx);
+		binheap_reorder(ep->heap, oc->timer_idx);
 		assert(oc->timer_idx != BINHEAP_NOIDX);
 	} else {
 		WRONG("Objcore state wrong in inbox");
@@ -248,7 +363,8 @@ exp_expire(struct exp_priv *ep, double now)
 	if (oc->timer_when > now)
 		return (oc->timer_when);
 
-	VSC_C_main->n_expired++;
+	ep->wrk->stats->n_expired++;
+	ep->stats->expired++;
 
 	Lck_Lock(&ep->mtx);
 	if (oc->exp_flags & OC_EF_POSTED) {
@@ -266,6 +382,7 @@ exp_expire(struct exp_priv *ep, double now)
 		assert(oc->timer_idx != BINHEAP_NOIDX);
 		binheap_delete(ep->heap, oc->timer_idx);
 		assert(oc->timer_idx == BINHEAP_NOIDX);
+		ep->stats->heap--;
 
 		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 		VSLb(&ep->vsl, SLT_ExpKill, "EXP_Expired x=%u t=%.0f",
@@ -302,6 +419,20 @@ object_update(void *priv, void *p, unsigned u)
 	oc->timer_idx = u;
 }
 
+/*--------------------------------------------------------------------
+ * Objects are mailed to the shard under its mtx, account them in the
+ * worker stats so they get summed into the main counters.
+ */
+
+static void
+exp_sumstat(struct exp_priv *ep)
+{
+
+	Lck_AssertHeld(&ep->mtx);
+	ep->wrk->stats->exp_mailed += ep->stats->mailed - ep->mailed_seen;
+	ep->mailed_seen = ep->stats->mailed;
+}
+
 static void * __match_proto__(bgthread_t)
 exp_thread(struct worker *wrk, void *priv)
 {
@@ -313,7 +444,8 @@ exp_thread(struct worker *wrk, void *priv)
 	CAST_OBJ_NOTNULL(ep, priv, EXP_PRIV_MAGIC);
 	ep->wrk = wrk;
 	VSL_Setup(&ep->vsl, NULL, 0);
-	ep->heap = binheap_new(NULL, object_cmp, object_update);
+	/* This one gets big, see the binheap_c_test benchmark */
+	ep->heap = binheap_new_dary(NULL, object_cmp, object_update, 8);
 	AN(ep->heap);
 	while (1) {
 
@@ -323,14 +455,23 @@ exp_thread(struct worker *wrk, void *priv)
 		if (oc != NULL) {
 			assert(oc->refcnt >= 1);
 			VSTAILQ_REMOVE(&ep->inbox, oc, objcore, exp_list);
-			VSC_C_main->exp_received++;
+			ep->stats->inbox--;
+			ep->stats->received++;
+			wrk->stats->exp_received++;
 			tnext = 0;
 			flags = oc->exp_flags;
 			oc->exp_flags &= OC_EF_REFD;
-		} else if (tnext > t) {
+		}
+		if (oc == NULL && tnext > t) {
+			exp_sumstat(ep);
 			VSL_Flush(&ep->vsl, 0);
 			Pool_Sumstat(wrk);
 			(void)Lck_CondWait(&ep->condvar, &ep->mtx, tnext);
+		} else if (wrk->stats->exp_received + wrk->stats->n_expired >=
+		    cache_param->wthread_stats_rate) {
+			/* Do not let a backlog hold up the main counters */
+			exp_sumstat(ep);
+			(void)Pool_TrySumstat(wrk);
 		}
 		Lck_Unlock(&ep->mtx);
 
@@ -351,14 +492,27 @@ EXP_Init(void)
 {
 	struct exp_priv *ep;
 	pthread_t pt;
-
-	ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
-	AN(ep);
-
-	Lck_New(&ep->mtx, lck_exp);
-	AZ(pthread_cond_init(&ep->condvar, NULL));
-	VSTAILQ_INIT(&ep->inbox);
-	AZ(pthread_rwlock_init(&ep->cb_rwl, NULL));
-	exphdl = ep;
-	WRK_BgThread(&pt, "cache-timeout", exp_thread, ep);
+	unsigned u;
+	char nm[8];
+
+	exp_nshard = cache_param->expiry_shards;
+	assert(exp_nshard > 0);
+	exphdl = calloc(exp_nshard, sizeof *exphdl);
+	AN(exphdl);
+	for (u = 0; u < exp_nshard; u++) {
+		ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
+		AN(ep);
+
+		Lck_New(&ep->mtx, lck_exp);
+		AZ(pthread_cond_init(&ep->condvar, NULL));
+		VSTAILQ_INIT(&ep->inbox);
+		AZ(pthread_rwlock_init(&ep->cb_rwl, NULL));
+		bprintf(nm, "%u", u);
+		ep->stats = VSM_Alloc(sizeof *ep->stats,
+		    VSC_CLASS, VSC_type_exp, nm);
+		AN(ep->stats);
+		memset(ep->stats, 0, sizeof *ep->stats);
+		exphdl[u] = ep;
+		WRK_BgThread(&pt, "cache-timeout", exp_thread, ep);
+	}
 }
@@ -32,9 +32,11 @@
 #include "cache.h"
 #include "cache_director.h"
 #include "cache_filter.h"
+#include "cache_pool.h"
 #include "hash/hash_slinger.h"
 #include "storage/storage.h"
 #include "vcl.h"
+#include "vrnd.h"
 #include "vtim.h"
 
 /*--------------------------------------------------------------------
@@ -67,6 +69,10 @@ vbf_allocobj(struct busyobj *bo, unsigned l)
 	if (stv == NULL)
 		return (0);
 
+	if (oc->stobj->transient == TRANSIENT_OTHER)
+		oc->stobj->transient = bo->uncacheable ?
+		    TRANSIENT_PASS : TRANSIENT_SHORTLIVED;
+
 	if (STV_NewObject(bo->wrk, bo->fetch_objcore, stv, l))
 		return (1);
 
@@ -93,9 +99,9 @@ vbf_allocobj(struct busyobj *bo, unsigned l)
 static int
 vbf_beresp2obj(struct busyobj *bo)
 {
-	unsigned l, l2;
+	unsigned l, l2, sl = 0, how;
 	const char *b;
-	uint8_t *bp;
+	uint8_t *bp, *hp = NULL;
 	struct vsb *vary = NULL;
 	int varyl = 0;
 
@@ -123,32 +129,85 @@ vbf_beresp2obj(struct busyobj *bo)
 			AZ(vary);
 	}
 
-	l2 = http_EstimateWS(bo->beresp,
-	    bo->uncacheable ? HTTPH_A_PASS : HTTPH_A_INS);
+	/* Too unpopular to make room for, see cache_admit.c */
+	if (!bo->uncacheable && bo->storage != NULL &&
+	    !(bo->fetch_objcore->flags & OC_F_PRIVATE) &&
+	    bo->fetch_objcore->ttl + bo->fetch_objcore->grace +
+	    bo->fetch_objcore->keep >= cache_param->shortlived &&
+	    !ADM_Admit(bo->wrk, bo->storage, bo->digest,
+	    bo->htc != NULL && bo->htc->content_length > 0 ?
+	    bo->htc->content_length : cache_param->fetch_chunksize))
+		bo->uncacheable = 1;
+
+	how = bo->uncacheable ? HTTPH_A_PASS : HTTPH_A_INS;
+	l2 = http_EstimateWS(bo->beresp, how);
+
+	/* for HTTP_Encode() VSLH call */
+	bo->beresp->logtag = SLT_ObjMethod;
+
+	/*
+	 * With the header dictionary, the encoded headers can be much
+	 * smaller than the estimate, so encode them up front and size
+	 * the object to fit.
+	 */
+	if (cache_param->http_hdr_dict > 0 && bo->storage != NULL &&
+	    !bo->storage->persistent) {
+		if (WS_Reserve(bo->ws, 0) >= l2) {
+			hp = (uint8_t *)bo->ws->f;
+			l2 = HTTP_Encode(bo->beresp, hp, l2, how, 1);
+		} else
+			WS_Release(bo->ws, 0);
+	}
 	l += l2;
 
+	/* A copy of the headers as sent on HTTP/1, see cnt_deliver() */
+	if (bo->do_static && (bo->uncacheable || bo->do_esi ||
+	    bo->do_gzip || bo->do_gunzip || bo->do_brotli ||
+	    !http_IsStatus(bo->beresp, 200) ||
+	    http_GetHdr(bo->beresp, H_Content_Encoding, NULL)))
+		bo->do_static = 0;
+	if (bo->do_static) {
+		sl = HTTP_EncodeStatic(bo->beresp, NULL, 0, how);
+		l += sl;
+	}
+
 	if (bo->uncacheable)
 		bo->fetch_objcore->flags |= OC_F_PASS;
 
-	if (!vbf_allocobj(bo, l))
+	/* Let the stevedore make room for a small body up front */
+	if (bo->htc != NULL && bo->htc->content_length > 0)
+		bo->fetch_objcore->boc->len_hint = bo->htc->content_length;
+
+	if (!vbf_allocobj(bo, l)) {
+		if (hp != NULL)
+			WS_Release(bo->ws, 0);
 		return (-1);
+	}
 
 	if (vary != NULL) {
 		AN(ObjSetAttr(bo->wrk, bo->fetch_objcore, OA_VARY, varyl,
 			VSB_data(vary)));
+		bo->fetch_objcore->vary_hash =
+		    VRY_Hash((const uint8_t *)VSB_data(vary));
 		VSB_destroy(&vary);
 	}
 
 	AZ(ObjSetU32(bo->wrk, bo->fetch_objcore, OA_VXID, VXID(bo->vsl->wid)));
 
-	/* for HTTP_Encode() VSLH call */
-	bo->beresp->logtag = SLT_ObjMethod;
-
 	/* Filter into object */
-	bp = ObjSetAttr(bo->wrk, bo->fetch_objcore, OA_HEADERS, l2, NULL);
+	bp = ObjSetAttr(bo->wrk, bo->fetch_objcore, OA_HEADERS, l2 + sl,
+	    sl > 0 ? NULL : hp);
 	AN(bp);
-	HTTP_Encode(bo->beresp, bp, l2,
-	    bo->uncacheable ? HTTPH_A_PASS : HTTPH_A_INS);
+	if (hp != NULL) {
+		if (sl > 0)
+			memcpy(bp, hp, l2);
+		WS_Release(bo->ws, 0);
+	} else
+		(void)HTTP_Encode(bo->beresp, bp, l2, how, 0);
+	if (sl > 0) {
+		(void)HTTP_EncodeStatic(bo->beresp, bp + l2, sl, how);
+		ObjSetFlag(bo->wrk, bo->fetch_objcore, OF_STATIC, 1);
+	}
 
 	if (http_GetHdr(bo->beresp, H_Last_Modified, &b))
 		AZ(ObjSetDouble(bo->wrk, bo->fetch_objcore, OA_LASTMODIFIED,
@@ -157,6 +216,9 @@ vbf_beresp2obj(struct busyobj *bo)
 		AZ(ObjSetDouble(bo->wrk, bo->fetch_objcore, OA_LASTMODIFIED,
 		    floor(bo->fetch_objcore->t_origin)));
 
+	if (!(bo->fetch_objcore->flags & OC_F_PRIVATE))
+		TAG_Insert(bo->wrk, bo->fetch_objcore, bo->beresp);
+
 	return (0);
 }
 
@@ -191,6 +253,7 @@ vbf_stp_mkbereq(struct worker *wrk, struct busyobj *bo)
 		AZ(bo->stale_oc);
 
 	if (bo->stale_oc != NULL &&
+	    !(bo->fetch_objcore->flags & OC_F_VARIANT) &&
 	    ObjCheckFlag(bo->wrk, bo->stale_oc, OF_IMSCAND) &&
 	    (bo->stale_oc->boc != NULL || ObjGetLen(wrk, bo->stale_oc) != 0)) {
 		AZ(bo->stale_oc->flags & OC_F_PASS);
@@ -212,6 +275,8 @@ vbf_stp_mkbereq(struct worker *wrk, struct busyobj *bo)
 		bo->req = NULL;
 		ObjSetState(bo->wrk, bo->fetch_objcore, BOS_REQ_DONE);
 	}
+	if (bo->fetch_objcore->flags & OC_F_VARIANT)
+		return (F_STP_VARIANT);
 	return (F_STP_STARTFETCH);
 }
 
@@ -241,6 +306,7 @@ vbf_stp_retry(struct worker *wrk, struct busyobj *bo)
 	bo->storage = NULL;
 	bo->storage_hint = NULL;
 	bo->do_esi = 0;
+	bo->do_static = 0;
 	bo->do_stream = 1;
 
 	/* reset fetch processors */
@@ -254,6 +320,22 @@ vbf_stp_retry(struct worker *wrk, struct busyobj *bo)
 	return (F_STP_STARTFETCH);
 }
 
+/*--------------------------------------------------------------------
+ * Spread out the expiry of objects fetched together, see ttl_jitter.
+ */
+
+static void
+vbf_jitter(struct busyobj *bo)
+{
+	struct objcore *oc;
+
+	oc = bo->fetch_objcore;
+	oc->ttl -= oc->ttl * cache_param->ttl_jitter * 1e-2 *
+	    VRND_RandomTestableDouble();
+	VSLb(bo->vsl, SLT_TTL, "Jitter %.0f %.0f %.0f %.0f",
+	    oc->ttl, oc->grace, oc->keep, oc->t_origin);
+}
+
 /*--------------------------------------------------------------------
  * Setup bereq from bereq0, run vcl_backend_fetch
  */
@@ -261,8 +343,6 @@ vbf_stp_retry(struct worker *wrk, struct busyobj *bo)
 static enum fetch_step
 vbf_stp_startfetch(struct worker *wrk, struct busyobj *bo)
 {
-	int i;
-	double now;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
@@ -290,9 +370,32 @@ vbf_stp_startfetch(struct worker *wrk, struct busyobj *bo)
 	assert(bo->fetch_objcore->boc->state <= BOS_REQ_DONE);
 
 	AZ(bo->htc);
+	bo->can_park = cache_param->fetch_park && bo->req == NULL;
+	return (F_STP_GETHDRS);
+}
+
+/*--------------------------------------------------------------------
+ * Get the backend response headers, possibly parking on the way.
+ */
+
+static enum fetch_step
+vbf_stp_gethdrs(struct worker *wrk, struct busyobj *bo)
+{
+	int i;
+	double now;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+
 	i = VDI_GetHdr(wrk, bo);
+	if (i > 0)
+		return (F_STP_PARK);
 
 	now = W_TIM_real(wrk);
+	if (!i) {
+		WRK_Latency(wrk, LAT_ttfb, now - bo->t_prev);
+		VSL_Span(bo->vsl, VSL_SPAN_TTFB, bo->t_prev, now);
+	}
 	VSLb_ts_busyobj(bo, "Beresp", now);
 
 	if (i) {
@@ -478,6 +581,8 @@ vbf_stp_startfetch(struct worker *wrk, struct busyobj *bo)
 	}
 	if (bo->do_pass || bo->uncacheable)
 		bo->fetch_objcore->flags |= OC_F_PASS;
+	else if (cache_param->ttl_jitter > 0 && bo->fetch_objcore->ttl > 0.)
+		vbf_jitter(bo);
 
 	assert(wrk->handling == VCL_RET_DELIVER);
 
@@ -577,6 +682,7 @@ static enum fetch_step
 vbf_stp_fetch(struct worker *wrk, struct busyobj *bo)
 {
 	const char *p;
+	int defer_gzip = 0;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
@@ -599,7 +705,10 @@ vbf_stp_fetch(struct worker *wrk, struct busyobj *bo)
 
 	/* We do nothing unless the param is set */
 	if (!cache_param->http_gzip_support)
-		bo->do_gzip = bo->do_gunzip = 0;
+		bo->do_gzip = bo->do_gunzip = bo->do_brotli = 0;
+#if !defined(HAVE_BROTLI)
+	bo->do_brotli = 0;
+#endif
 
 	if (bo->htc->content_length == 0)
 		http_Unset(bo->beresp, H_Content_Encoding);
@@ -612,6 +721,20 @@ vbf_stp_fetch(struct worker *wrk, struct busyobj *bo)
 		assert(bo->is_gzip == 0 || bo->is_gunzip == 0);
 	}
 
+	/*
+	 * We won't brotli unless it is non-empty, and either gzip'ed,
+	 * which we gunzip first, or not encoded.  A brotli stream does
+	 * not lend itself to ESI, so do_esi wins.
+	 */
+	if (bo->htc->body_status == BS_NONE ||
+	    bo->htc->content_length == 0 || bo->do_esi ||
+	    (!bo->is_gzip && !bo->is_gunzip))
+		bo->do_brotli = 0;
+	if (bo->do_brotli) {
+		bo->do_gzip = 0;
+		bo->do_gunzip = bo->is_gzip;
+	}
+
 	/* We won't gunzip unless it is non-empty and gzip'ed */
 	if (bo->htc->body_status == BS_NONE ||
 	    bo->htc->content_length == 0 ||
@@ -627,6 +750,13 @@ vbf_stp_fetch(struct worker *wrk, struct busyobj *bo)
 	/* But we can't do both at the same time */
 	assert(bo->do_gzip == 0 || bo->do_gunzip == 0);
 
+	/* Leave the gzip'ing for a later hit, see vbf_stp_gzip() */
+	if (bo->do_gzip && cache_param->gzip_deferred &&
+	    !bo->do_esi && !bo->uncacheable) {
+		bo->do_gzip = 0;
+		defer_gzip = 1;
+	}
+
 	if (bo->do_gunzip || (bo->is_gzip && bo->do_esi))
 		vbf_vfp_push(bo, &vfp_gunzip, 1);
 
@@ -637,6 +767,10 @@ vbf_stp_fetch(struct worker *wrk, struct busyobj *bo)
 			vbf_vfp_push(bo, &vfp_esi_gzip, 1);
 		} else if (bo->do_esi) {
 			vbf_vfp_push(bo, &vfp_esi, 1);
+#if defined(HAVE_BROTLI)
+		} else if (bo->do_brotli) {
+			vbf_vfp_push(bo, &vfp_brotli, 1);
+#endif
 		} else if (bo->do_gzip) {
 			vbf_vfp_push(bo, &vfp_gzip, 1);
 		} else if (bo->is_gzip && !bo->do_gunzip) {
@@ -674,9 +808,15 @@ vbf_stp_fetch(struct worker *wrk, struct busyobj *bo)
 	if (bo->do_gzip || (bo->is_gzip && !bo->do_gunzip))
 		ObjSetFlag(bo->wrk, bo->fetch_objcore, OF_GZIPED, 1);
 
-	if (bo->do_gzip || bo->do_gunzip)
+	if (bo->do_brotli)
+		ObjSetFlag(bo->wrk, bo->fetch_objcore, OF_BROTLI, 1);
+
+	if (bo->do_gzip || bo->do_gunzip || bo->do_brotli)
 		ObjSetFlag(bo->wrk, bo->fetch_objcore, OF_CHGGZIP, 1);
 
+	if (defer_gzip)
+		ObjSetFlag(bo->wrk, bo->fetch_objcore, OF_DEFERGZIP, 1);
+
 	if (!(bo->fetch_objcore->flags & OC_F_PASS) &&
 	    http_IsStatus(bo->beresp, 200) && (
 	      http_GetHdr(bo->beresp, H_Last_Modified, &p) ||
@@ -698,6 +838,10 @@ vbf_stp_fetch(struct worker *wrk, struct busyobj *bo)
 	assert(bo->fetch_objcore->boc->state == BOS_REQ_DONE);
 
 	if (bo->do_stream) {
+		/* Only private objects free what has been delivered */
+		if (bo->fetch_objcore->flags & OC_F_PRIVATE)
+			bo->fetch_objcore->boc->transit_buffer =
+			    cache_param->transit_buffer;
 		ObjSetState(wrk, bo->fetch_objcore, BOS_PREP_STREAM);
 		HSH_Unbusy(wrk, bo->fetch_objcore);
 		ObjSetState(wrk, bo->fetch_objcore, BOS_STREAM);
@@ -785,6 +929,7 @@ vbf_stp_condfetch(struct worker *wrk, struct busyobj *bo)
 		    OA_ESIDATA));
 
 	AZ(ObjCopyAttr(bo->wrk, bo->fetch_objcore, bo->stale_oc, OA_FLAGS));
+	ObjSetFlag(bo->wrk, bo->fetch_objcore, OF_STATIC, bo->do_static);
 	AZ(ObjCopyAttr(bo->wrk, bo->fetch_objcore, bo->stale_oc, OA_GZIPBITS));
 
 	if (bo->do_stream) {
@@ -806,6 +951,148 @@ vbf_stp_condfetch(struct worker *wrk, struct busyobj *bo)
 	return (F_STP_FETCHEND);
 }
 
+/*--------------------------------------------------------------------
+ * Make an identity variant of the gzip'ed stale_oc, without bothering
+ * the backend: same headers less the Content-Encoding, same lifetime
+ * and the body gunzip'ed.
+ */
+
+static enum fetch_step
+vbf_stp_variant(struct worker *wrk, struct busyobj *bo)
+{
+	struct objcore *oc;
+	const uint8_t *hdrs;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	oc = bo->fetch_objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(oc->flags & OC_F_VARIANT);
+	CHECK_OBJ_NOTNULL(bo->stale_oc, OBJCORE_MAGIC);
+	AZ(bo->req);
+	assert(oc->boc->state == BOS_REQ_DONE);
+
+	HTTP_Setup(bo->beresp, bo->ws, bo->vsl, SLT_BerespMethod);
+	hdrs = ObjGetAttr(wrk, bo->stale_oc, OA_HEADERS, NULL);
+	if (hdrs == NULL || HTTP_Decode(bo->beresp, hdrs)) {
+		wrk->stats->fetch_failed++;
+		return (F_STP_FAIL);
+	}
+	http_Unset(bo->beresp, H_Content_Encoding);
+	http_Unset(bo->beresp, H_Content_Length);
+	RFC2616_Weaken_Etag(bo->beresp);
+
+	oc->t_origin = bo->stale_oc->t_origin;
+	oc->ttl = bo->stale_oc->ttl;
+	oc->grace = bo->stale_oc->grace;
+	oc->keep = bo->stale_oc->keep;
+	bo->do_stream = 0;
+	bo->storage = bo->stale_oc->stobj->stevedore;
+
+	bo->vfc->bo = bo;
+	bo->vfc->oc = oc;
+	bo->vfc->wrk = bo->wrk;
+	bo->vfc->http = bo->beresp;
+
+	if (vbf_beresp2obj(bo)) {
+		(void)VFP_Error(bo->vfc, "Could not get storage");
+		wrk->stats->fetch_failed++;
+		return (F_STP_FAIL);
+	}
+	ObjSetFlag(wrk, oc, OF_CHGGZIP, 1);
+
+	if (VGZ_GunzipObj(bo->vfc, bo->stale_oc) ||
+	    (bo->stale_oc->flags & OC_F_FAILED)) {
+		(void)VFP_Error(bo->vfc, "Template object failed");
+		wrk->stats->fetch_failed++;
+		return (F_STP_FAIL);
+	}
+
+	AZ(ObjSetU64(wrk, oc, OA_LEN, oc->boc->len_so_far));
+	HSH_Unbusy(wrk, oc);
+	ObjSetState(wrk, oc, BOS_FINISHED);
+	VSLb_ts_busyobj(bo, "BerespBody", W_TIM_real(wrk));
+	VSC_C_main->n_gunzip_variant++;
+	return (F_STP_DONE);
+}
+
+/*--------------------------------------------------------------------
+ * Make the gzip'ed copy of a stale_oc stored with gzip_deferred, again
+ * without bothering the backend, and let it replace stale_oc.
+ *
+ * The bereq was made by VBF_Fetch() before we were scheduled.
+ */
+
+static enum fetch_step
+vbf_stp_gzip(struct worker *wrk, struct busyobj *bo)
+{
+	struct objcore *oc;
+	const uint8_t *hdrs;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	oc = bo->fetch_objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->stale_oc, OBJCORE_MAGIC);
+	AN(ObjCheckFlag(wrk, bo->stale_oc, OF_DEFERGZIP));
+	AZ(bo->req);
+	assert(oc->boc->state == BOS_REQ_DONE);
+
+	HTTP_Setup(bo->beresp, bo->ws, bo->vsl, SLT_BerespMethod);
+	hdrs = ObjGetAttr(wrk, bo->stale_oc, OA_HEADERS, NULL);
+	if (hdrs == NULL || HTTP_Decode(bo->beresp, hdrs)) {
+		wrk->stats->fetch_failed++;
+		return (F_STP_FAIL);
+	}
+	http_Unset(bo->beresp, H_Content_Length);
+	RFC2616_Weaken_Etag(bo->beresp);
+	http_SetHeader(bo->beresp, "Content-Encoding: gzip");
+	RFC2616_Vary_AE(bo->beresp);
+
+	oc->t_origin = bo->stale_oc->t_origin;
+	oc->ttl = bo->stale_oc->ttl;
+	oc->grace = bo->stale_oc->grace;
+	oc->keep = bo->stale_oc->keep;
+	bo->do_stream = 0;
+	bo->storage = bo->stale_oc->stobj->stevedore;
+
+	bo->vfc->bo = bo;
+	bo->vfc->oc = oc;
+	bo->vfc->wrk = bo->wrk;
+	bo->vfc->http = bo->beresp;
+
+	if (vbf_beresp2obj(bo)) {
+		(void)VFP_Error(bo->vfc, "Could not get storage");
+		wrk->stats->fetch_failed++;
+		return (F_STP_FAIL);
+	}
+	ObjSetFlag(wrk, oc, OF_GZIPED, 1);
+	ObjSetFlag(wrk, oc, OF_CHGGZIP, 1);
+	if (ObjCheckFlag(wrk, bo->stale_oc, OF_IMSCAND))
+		ObjSetFlag(wrk, oc, OF_IMSCAND, 1);
+
+	if (VGZ_GzipObj(bo->vfc, bo->stale_oc) ||
+	    (bo->stale_oc->flags & OC_F_FAILED)) {
+		(void)VFP_Error(bo->vfc, "Template object failed");
+		wrk->stats->fetch_failed++;
+		return (F_STP_FAIL);
+	}
+
+	/* Don't shadow whatever made stale_oc go away meanwhile */
+	if (bo->stale_oc->flags & OC_F_DYING) {
+		(void)VFP_Error(bo->vfc, "Template object was killed");
+		return (F_STP_FAIL);
+	}
+
+	AZ(ObjSetU64(wrk, oc, OA_LEN, oc->boc->len_so_far));
+	HSH_Unbusy(wrk, oc);
+	HSH_Kill(bo->stale_oc);
+	ObjSetState(wrk, oc, BOS_FINISHED);
+	VSLb_ts_busyobj(bo, "BerespBody", W_TIM_real(wrk));
+	VSC_C_main->n_gzip_deferred++;
+	return (F_STP_DONE);
+}
+
 /*--------------------------------------------------------------------
  * Create synth object
  */
@@ -831,6 +1118,7 @@ vbf_stp_error(struct worker *wrk, struct busyobj *bo)
 
 	if(bo->fetch_objcore->stobj->stevedore != NULL)
 		ObjFreeObj(bo->wrk, bo->fetch_objcore);
+	bo->fetch_objcore->stobj->transient = TRANSIENT_SYNTH;
 
 	// XXX: reset all beresp flags ?
 
@@ -937,6 +1225,57 @@ vbf_stp_done(void)
 	NEEDLESS(return(F_STP_DONE));
 }
 
+static enum fetch_step
+vbf_stp_park(void)
+{
+	WRONG("Just plain wrong");
+	NEEDLESS(return(F_STP_PARK));
+}
+
+/*--------------------------------------------------------------------
+ * Parking a fetch
+ *
+ * The director has handed us the connection to wait on, still
+ * connecting or with the request sent.  Once the waiter calls back the fetch continues on whatever
+ * thread is available, at F_STP_GETHDRS.  The waiter may call back
+ * before the parking thread is done, so we enter it last.
+ */
+
+static void __match_proto__(waiter_handle_f)
+vbf_unpark(struct waited *wp, enum wait_event ev, double now)
+{
+	struct busyobj *bo;
+
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	CAST_OBJ_NOTNULL(bo, wp->priv1, BUSYOBJ_MAGIC);
+	(void)now;
+	assert(wp == bo->park);
+	AN(bo->parked);
+	wp->priv2 = ev;
+	AZ(Pool_Task_Any(&bo->fetch_task, TASK_QUEUE_BO));
+}
+
+static void
+vbf_park(struct worker *wrk, struct busyobj *bo)
+{
+	struct waited *wp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	wp = bo->park;
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	AN(bo->parked);
+
+	wrk->stats->fetch_parked++;
+	wp->priv1 = bo;
+	wp->func = vbf_unpark;
+	bo->wrk = NULL;
+	wrk->vsl = NULL;
+	THR_SetBusyobj(NULL);
+	if (Wait_Enter(wrk->pool->waiter, wp))
+		vbf_unpark(wp, WAITER_ACTION, 0.);
+}
+
 static void __match_proto__(task_func_t)
 vbf_fetch_thread(struct worker *wrk, void *priv)
 {
@@ -945,14 +1284,22 @@ vbf_fetch_thread(struct worker *wrk, void *priv)
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CAST_OBJ_NOTNULL(bo, priv, BUSYOBJ_MAGIC);
-	CHECK_OBJ_NOTNULL(bo->req, REQ_MAGIC);
+	CHECK_OBJ_ORNULL(bo->req, REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(bo->fetch_objcore, OBJCORE_MAGIC);
 
 	THR_SetBusyobj(bo);
-	stp = F_STP_MKBEREQ;
-	assert(isnan(bo->t_first));
-	assert(isnan(bo->t_prev));
-	VSLb_ts_busyobj(bo, "Start", W_TIM_real(wrk));
+	if (bo->parked) {
+		AZ(bo->wrk);
+		stp = F_STP_GETHDRS;
+	} else {
+		if (bo->req != NULL)
+			stp = F_STP_MKBEREQ;
+		else
+			stp = F_STP_GZIP; /* VBF_GZIP made the bereq already */
+		assert(isnan(bo->t_first));
+		assert(isnan(bo->t_prev));
+		VSLb_ts_busyobj(bo, "Start", W_TIM_real(wrk));
+	}
 
 	bo->wrk = wrk;
 	wrk->vsl = bo->vsl;
@@ -966,7 +1313,7 @@ vbf_fetch_thread(struct worker *wrk, void *priv)
 	}
 #endif
 
-	while (stp != F_STP_DONE) {
+	while (stp != F_STP_DONE && stp != F_STP_PARK) {
 		CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 		assert(bo->fetch_objcore->boc->refcount >= 1);
 		switch(stp) {
@@ -980,6 +1327,11 @@ vbf_fetch_thread(struct worker *wrk, void *priv)
 		}
 	}
 
+	if (stp == F_STP_PARK) {
+		vbf_park(wrk, bo);
+		return;
+	}
+
 	assert(bo->director_state == DIR_S_NULL);
 
 	http_Teardown(bo->bereq);
@@ -1012,6 +1364,7 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 	struct boc *boc;
 	struct busyobj *bo;
 	const char *how;
+	enum task_prio prio;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -1024,6 +1377,8 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 	case VBF_PASS:		how = "pass"; break;
 	case VBF_NORMAL:	how = "fetch"; break;
 	case VBF_BACKGROUND:	how = "bgfetch"; break;
+	case VBF_VARIANT:	how = "variant"; break;
+	case VBF_GZIP:		how = "gzip"; break;
 	default:		WRONG("Wrong fetch mode");
 	}
 
@@ -1053,6 +1408,28 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 	AZ(bo->fetch_objcore);
 	bo->fetch_objcore = oc;
 
+	AZ(bo->req);
+	bo->req = req;
+
+	if (mode == VBF_GZIP) {
+		/*
+		 * Nobody should wait for a thread at the lower priority
+		 * we give this, so make the bereq here and let go of the
+		 * req right away.
+		 */
+		CHECK_OBJ_NOTNULL(oldoc, OBJCORE_MAGIC);
+		assert(req->req_body_status == REQ_BODY_NONE);
+		bo->wrk = wrk;
+		(void)vbf_stp_mkbereq(wrk, bo);
+		bo->wrk = NULL;
+		AZ(bo->req);
+		prio = TASK_QUEUE_REQ;
+	} else if (mode == VBF_BACKGROUND && Req_Prio(req) == TASK_QUEUE_BULK)
+		/* Nobody waits for it, so it can wait with its class */
+		prio = TASK_QUEUE_BULK;
+	else
+		prio = TASK_QUEUE_BO;
+
 	AZ(bo->stale_oc);
 	if (oldoc != NULL) {
 		assert(oldoc->refcnt > 0);
@@ -1060,13 +1437,11 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 		bo->stale_oc = oldoc;
 	}
 
-	AZ(bo->req);
-	bo->req = req;
-
 	bo->fetch_task.priv = bo;
 	bo->fetch_task.func = vbf_fetch_thread;
+	bo->fetch_task.fq_key = SES_FairKey(req->sp, req->client_identity);
 
-	if (Pool_Task(wrk->pool, &bo->fetch_task, TASK_QUEUE_BO)) {
+	if (Pool_Task(wrk->pool, &bo->fetch_task, prio)) {
 		wrk->stats->fetch_no_thread++;
 		(void)vbf_stp_fail(req->wrk, bo);
 		if (bo->stale_oc != NULL)
@@ -1076,7 +1451,9 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 		VBO_ReleaseBusyObj(wrk, &bo);
 	} else {
 		bo = NULL; /* ref transferred to fetch thread */
-		if (mode == VBF_BACKGROUND) {
+		if (mode == VBF_GZIP) {
+			/* Nothing to wait for */
+		} else if (mode == VBF_BACKGROUND || mode == VBF_VARIANT) {
 			ObjWaitState(oc, BOS_REQ_DONE);
 			VRB_Ignore(req);
 		} else {
@@ -1092,7 +1469,7 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 	VSLb_ts_req(req, "Fetch", W_TIM_real(wrk));
 	assert(oc->boc == boc);
 	HSH_DerefBoc(wrk, oc);
-	if (mode == VBF_BACKGROUND)
+	if (mode == VBF_BACKGROUND || mode == VBF_VARIANT || mode == VBF_GZIP)
 		(void)HSH_DerefObjCore(wrk, &oc, HSH_RUSH_POLICY);
 	THR_SetBusyobj(NULL);
 }
@@ -81,6 +81,10 @@ VFP_GetStorage(struct vfp_ctx *vc, ssize_t *sz, uint8_t **ptr)
 		l = *sz;
 	if (l == 0)
 		l = cache_param->fetch_chunksize;
+	/* Delivered storage can only be freed a whole segment at a time */
+	if (vc->oc->boc->transit_buffer > 0 &&
+	    l > vc->oc->boc->transit_buffer)
+		l = vc->oc->boc->transit_buffer;
 	*sz = l;
 	if (!ObjGetSpace(vc->wrk, vc->oc, sz, ptr)) {
 		*sz = 0;
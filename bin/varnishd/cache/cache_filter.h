@@ -71,6 +71,9 @@ struct vfp_entry {
 extern const struct vfp vfp_gunzip;
 extern const struct vfp vfp_gzip;
 extern const struct vfp vfp_testgunzip;
+#if defined(HAVE_BROTLI)
+extern const struct vfp vfp_brotli;
+#endif
 extern const struct vfp vfp_esi;
 extern const struct vfp vfp_esi_gzip;
 
@@ -114,4 +117,8 @@ void VDP_close(struct req *req);
 int VDP_DeliverObj(struct req *req);
 
 vdp_bytes VDP_gunzip;
+#if defined(HAVE_BROTLI)
+vdp_bytes VDP_unbrotli;
+#endif
 vdp_bytes VDP_ESI;
+vdp_bytes VDP_range;
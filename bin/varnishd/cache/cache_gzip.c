@@ -61,9 +61,105 @@ struct vgz {
 
 	intmax_t		bits;
 
+	unsigned		level;
+	unsigned		memlevel;
+	VTAILQ_ENTRY(vgz)	list;
+
 	z_stream		vz;
 };
 
+/*
+ * Finished (de)compressors, reset and with their buffer, to save
+ * setting up a new one.
+ */
+
+static struct lock vgz_mtx;
+static VTAILQ_HEAD(, vgz) vgz_pool[2] = {
+	VTAILQ_HEAD_INITIALIZER(vgz_pool[0]),
+	VTAILQ_HEAD_INITIALIZER(vgz_pool[1]),
+};
+static unsigned vgz_npool[2];
+
+static void
+vgz_free(struct vgz *vg)
+{
+
+	CHECK_OBJ_NOTNULL(vg, VGZ_MAGIC);
+	if (vg->dir == VGZ_GZ)
+		(void)deflateEnd(&vg->vz);
+	else
+		(void)inflateEnd(&vg->vz);
+	free(vg->m_buf);
+	FREE_OBJ(vg);
+}
+
+static struct vgz *
+vgz_reuse(int dir, struct vsl_log *vsl, const char *id)
+{
+	struct vgz *vg;
+
+	Lck_Lock(&vgz_mtx);
+	vg = VTAILQ_FIRST(&vgz_pool[dir]);
+	if (vg != NULL) {
+		VTAILQ_REMOVE(&vgz_pool[dir], vg, list);
+		vgz_npool[dir]--;
+	}
+	Lck_Unlock(&vgz_mtx);
+	if (vg == NULL)
+		return (NULL);
+	CHECK_OBJ(vg, VGZ_MAGIC);
+	assert(vg->dir == dir);
+	if (dir == VGZ_GZ && (vg->level != cache_param->gzip_level ||
+	    vg->memlevel != cache_param->gzip_memlevel)) {
+		vgz_free(vg);
+		return (NULL);
+	}
+	vg->vsl = vsl;
+	vg->id = id;
+	vg->last_i = 0;
+	vg->flag = VGZ_NORMAL;
+	vg->m_len = 0;
+	vg->bits = 0;
+	VSC_C_main->n_gzip_reused++;
+	return (vg);
+}
+
+/* Returns true if vg went back to the pool */
+static int
+vgz_recycle(struct vgz *vg)
+{
+	int i;
+
+	CHECK_OBJ_NOTNULL(vg, VGZ_MAGIC);
+	if (vgz_npool[vg->dir] >= cache_param->gzip_pool)
+		return (0);
+	if (vg->dir == VGZ_GZ)
+		i = deflateReset(&vg->vz);
+	else
+		i = inflateReset(&vg->vz);
+	if (i != Z_OK)
+		return (0);
+	vg->vz.next_in = NULL;
+	vg->vz.avail_in = 0;
+	vg->vz.next_out = NULL;
+	vg->vz.avail_out = 0;
+	Lck_Lock(&vgz_mtx);
+	i = vgz_npool[vg->dir] < cache_param->gzip_pool;
+	if (i) {
+		VTAILQ_INSERT_HEAD(&vgz_pool[vg->dir], vg, list);
+		vgz_npool[vg->dir]++;
+	}
+	Lck_Unlock(&vgz_mtx);
+	return (i);
+}
+
+void
+VGZ_Init(void)
+{
+
+	Lck_New(&vgz_mtx, lck_vgz);
+}
+
 static const char *
 vgz_msg(const struct vgz *vg)
 {
@@ -80,6 +176,9 @@ vgz_gunzip(struct vsl_log *vsl, const char *id)
 {
 	struct vgz *vg;
 
+	vg = vgz_reuse(VGZ_UN, vsl, id);
+	if (vg != NULL)
+		return (vg);
 	ALLOC_OBJ(vg, VGZ_MAGIC);
 	AN(vg);
 	vg->vsl = vsl;
@@ -96,7 +195,7 @@ vgz_gunzip(struct vsl_log *vsl, const char *id)
 	return (vg);
 }
 
-static struct vgz *
+struct vgz *
 VGZ_NewGunzip(struct vsl_log *vsl, const char *id)
 {
 	VSC_C_main->n_gunzip++;
@@ -117,11 +216,16 @@ VGZ_NewGzip(struct vsl_log *vsl, const char *id)
 	int i;
 
 	VSC_C_main->n_gzip++;
+	vg = vgz_reuse(VGZ_GZ, vsl, id);
+	if (vg != NULL)
+		return (vg);
 	ALLOC_OBJ(vg, VGZ_MAGIC);
 	AN(vg);
 	vg->vsl = vsl;
 	vg->id = id;
 	vg->dir = VGZ_GZ;
+	vg->level = cache_param->gzip_level;
+	vg->memlevel = cache_param->gzip_memlevel;
 
 	/*
 	 * From zconf.h:
@@ -134,10 +238,10 @@ VGZ_NewGzip(struct vsl_log *vsl, const char *id)
 	 * memLevel [1..9] (-> 1K->256K)
 	 */
 	i = deflateInit2(&vg->vz,
-	    cache_param->gzip_level,		/* Level */
+	    vg->level,				/* Level */
 	    Z_DEFLATED,				/* Method */
 	    16 + 15,				/* Window bits (16=gzip) */
-	    cache_param->gzip_memlevel,		/* memLevel */
+	    vg->memlevel,			/* memLevel */
 	    Z_DEFAULT_STRATEGY);
 	assert(Z_OK == i);
 	return (vg);
@@ -151,10 +255,14 @@ vgz_getmbuf(struct vgz *vg)
 {
 
 	CHECK_OBJ_NOTNULL(vg, VGZ_MAGIC);
-	AZ(vg->m_sz);
 	AZ(vg->m_len);
-	AZ(vg->m_buf);
 
+	if (vg->m_buf != NULL) {
+		/* Kept from a previous use */
+		if (vg->m_sz == cache_param->gzip_buffer)
+			return (0);
+		free(vg->m_buf);
+	}
 	vg->m_sz = cache_param->gzip_buffer;
 	vg->m_buf = malloc(vg->m_sz);
 	if (vg->m_buf == NULL) {
@@ -207,7 +315,7 @@ VGZ_ObufFull(const struct vgz *vg)
 
 /*--------------------------------------------------------------------*/
 
-static enum vgzret_e
+enum vgzret_e
 VGZ_Gunzip(struct vgz *vg, const void **pptr, ssize_t *plen)
 {
 	int i;
@@ -363,28 +471,131 @@ VDP_gunzip(struct req *req, enum vdp_action act, void **priv,
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * G[un]zip a stored object into the object being fetched, for identity
+ * variants of gzip'ed objects and for deferred gzip'ing.
+ */
+
+struct vgz_obj {
+	unsigned		magic;
+#define VGZ_OBJ_MAGIC		0x4a0c6e19
+	struct vfp_ctx		*vc;
+	struct vgz		*vg;
+	enum vgz_flag		flag;
+};
+
+static int __match_proto__(objiterate_f)
+vgz_obj_iter(void *priv, int flush, const void *ptr, ssize_t len)
+{
+	struct vgz_obj *vo;
+	enum vgzret_e vr;
+	const void *dp;
+	ssize_t dl, l;
+	uint8_t *pd;
+
+	(void)flush;
+	CAST_OBJ_NOTNULL(vo, priv, VGZ_OBJ_MAGIC);
+	if (len == 0 && vo->flag != VGZ_FINISH)
+		return (0);
+	VGZ_Ibuf(vo->vg, ptr, len);
+	do {
+		l = 0;
+		if (VFP_GetStorage(vo->vc, &l, &pd) != VFP_OK)
+			return (-1);
+		VGZ_Obuf(vo->vg, pd, l);
+		if (vo->vg->dir == VGZ_GZ) {
+			vr = VGZ_Gzip(vo->vg, &dp, &dl, vo->flag);
+			if (vr < VGZ_OK)
+				return (VFP_Error(vo->vc, "Gzip failed"));
+			if (dl > 0)
+				VGZ_UpdateObj(vo->vc, vo->vg, VUA_UPDATE);
+		} else {
+			vr = VGZ_Gunzip(vo->vg, &dp, &dl);
+			if (vr < VGZ_OK)
+				return (VFP_Error(vo->vc,
+				    "Invalid Gzip data: %s", vgz_msg(vo->vg)));
+		}
+		if (dl > 0)
+			VFP_Extend(vo->vc, dl);
+	} while (!VGZ_IbufEmpty(vo->vg) || (vr == VGZ_OK &&
+	    (dl == l || vo->flag == VGZ_FINISH)));
+	return (0);
+}
+
+int
+VGZ_GunzipObj(struct vfp_ctx *vc, struct objcore *oc)
+{
+	struct vgz_obj vo;
+	int r;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	INIT_OBJ(&vo, VGZ_OBJ_MAGIC);
+	vo.vc = vc;
+	vo.vg = VGZ_NewGunzip(vc->wrk->vsl, "U F -");
+	AN(vo.vg);
+	r = ObjIterate(vc->wrk, oc, &vo, vgz_obj_iter, 0);
+	if (VGZ_Destroy(&vo.vg) != VGZ_END && r == 0)
+		r = VFP_Error(vc, "Gunzip error at the very end");
+	return (r);
+}
+
+int
+VGZ_GzipObj(struct vfp_ctx *vc, struct objcore *oc)
+{
+	struct vgz_obj vo;
+	int r;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	INIT_OBJ(&vo, VGZ_OBJ_MAGIC);
+	vo.vc = vc;
+	vo.vg = VGZ_NewGzip(vc->wrk->vsl, "G F -");
+	AN(vo.vg);
+	r = ObjIterate(vc->wrk, oc, &vo, vgz_obj_iter, 0);
+	if (r == 0) {
+		vo.flag = VGZ_FINISH;
+		r = vgz_obj_iter(&vo, 1, "", 0);
+	}
+	if (r == 0)
+		VGZ_UpdateObj(vc, vo.vg, VUA_END_GZIP);
+	if (VGZ_Destroy(&vo.vg) != VGZ_END && r == 0)
+		r = VFP_Error(vc, "Gzip error at the very end");
+	return (r);
+}
+
 /*--------------------------------------------------------------------*/
 
+static void
+vgz_setbits(const struct vfp_ctx *vc, intmax_t start_bit, intmax_t last_bit,
+    intmax_t stop_bit, intmax_t len)
+{
+	char *p;
+
+	p = ObjSetAttr(vc->wrk, vc->oc, OA_GZIPBITS, 32, NULL);
+	AN(p);
+	vbe64enc(p, start_bit);
+	vbe64enc(p + 8, last_bit);
+	vbe64enc(p + 16, stop_bit);
+	if (len >= 0)
+		vbe64enc(p + 24, len);
+}
+
 void
 VGZ_UpdateObj(const struct vfp_ctx *vc, struct vgz *vg, enum vgz_ua_e e)
 {
-	char *p;
-	intmax_t ii;
+	intmax_t ii, len = -1;
 
 	CHECK_OBJ_NOTNULL(vg, VGZ_MAGIC);
 	ii = vg->vz.start_bit + vg->vz.last_bit + vg->vz.stop_bit;
 	if (e == VUA_UPDATE && ii == vg->bits)
 		return;
 	vg->bits = ii;
-	p = ObjSetAttr(vc->wrk, vc->oc, OA_GZIPBITS, 32, NULL);
-	AN(p);
-	vbe64enc(p, vg->vz.start_bit);
-	vbe64enc(p + 8, vg->vz.last_bit);
-	vbe64enc(p + 16, vg->vz.stop_bit);
 	if (e == VUA_END_GZIP)
-		vbe64enc(p + 24, vg->vz.total_in);
+		len = vg->vz.total_in;
 	if (e == VUA_END_GUNZIP)
-		vbe64enc(p + 24, vg->vz.total_out);
+		len = vg->vz.total_out;
+	vgz_setbits(vc, vg->vz.start_bit, vg->vz.last_bit, vg->vz.stop_bit, len);
 }
 
 /*--------------------------------------------------------------------
@@ -409,6 +620,11 @@ VGZ_Destroy(struct vgz **vgp)
 	    (intmax_t)vg->vz.start_bit,
 	    (intmax_t)vg->vz.last_bit,
 	    (intmax_t)vg->vz.stop_bit);
+
+	/* Only a cleanly finished stream is worth resetting */
+	if (vg->last_i == Z_STREAM_END && vgz_recycle(vg))
+		return (VGZ_END);
+
 	if (vg->dir == VGZ_GZ)
 		i = deflateEnd(&vg->vz);
 	else
@@ -438,6 +654,11 @@ VGZ_Destroy(struct vgz **vgp)
 #define VFP_GZIP	1
 #define VFP_TESTGUNZIP	2
 
+struct pgz;
+static struct pgz *pgz_new(void);
+static enum vfp_status vfp_pgzip_pull(struct vfp_ctx *, struct pgz *,
+    uint8_t *, ssize_t *);
+
 static enum vfp_status __match_proto__(vfp_init_f)
 vfp_gzip_init(struct vfp_ctx *vc, struct vfp_entry *vfe)
 {
@@ -454,6 +675,17 @@ vfp_gzip_init(struct vfp_ctx *vc, struct vfp_entry *vfe)
 	if (vfe->vfp->priv2 == VFP_GZIP) {
 		if (http_GetHdr(vc->http, H_Content_Encoding, NULL))
 			return (VFP_NULL);
+		if (cache_param->gzip_parallel > 0 &&
+		    http_GetContentLength(vc->http) >=
+		    cache_param->gzip_parallel) {
+			vfe->priv1 = pgz_new();
+			vfe->priv2 = 1;
+			http_Unset(vc->http, H_Content_Length);
+			RFC2616_Weaken_Etag(vc->http);
+			http_SetHeader(vc->http, "Content-Encoding: gzip");
+			RFC2616_Vary_AE(vc->http);
+			return (VFP_OK);
+		}
 		vg = VGZ_NewGzip(vc->wrk->vsl, vfe->vfp->priv1);
 	} else {
 		if (!http_HdrIs(vc->http, H_Content_Encoding, "gzip"))
@@ -559,9 +791,11 @@ vfp_gzip_pull(struct vfp_ctx *vc, struct vfp_entry *vfe, void *p,
 
 	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
-	CAST_OBJ_NOTNULL(vg, vfe->priv1, VGZ_MAGIC);
 	AN(p);
 	AN(lp);
+	if (vfe->priv2)
+		return (vfp_pgzip_pull(vc, vfe->priv1, p, lp));
+	CAST_OBJ_NOTNULL(vg, vfe->priv1, VGZ_MAGIC);
 	l = *lp;
 	*lp = 0;
 	VGZ_Obuf(vg, p, l);
@@ -595,6 +829,305 @@ vfp_gzip_pull(struct vfp_ctx *vc, struct vfp_entry *vfe, void *p,
 	return (VFP_END);
 }
 
+/*--------------------------------------------------------------------
+ * VFP_GZIP in parallel
+ *
+ * Bodies of at least gzip_parallel bytes are cut into PGZ_BLOCK sized
+ * blocks, which are compressed as raw deflate on helper tasks, each
+ * primed with the last 32k of the block before it, the way pigz does.
+ * All but the last block end in a sync flush, so they are byte aligned
+ * and can be concatenated behind our own gzip header.  The last one is
+ * finished, and its bit offsets give OA_GZIPBITS.  The crc32 of the
+ * blocks is folded together with crc32_combine() for the trailer.
+ */
+
+#define PGZ_BLOCK	(1024 * 1024)
+#define PGZ_DICT	32768
+#define PGZ_NBLK	4
+
+struct pgz_blk {
+	unsigned		magic;
+#define PGZ_BLK_MAGIC		0x5b1d6a09
+	struct pool_task	task;
+	struct pgz		*pgz;
+
+	enum {
+		PGZ_IDLE,
+		PGZ_BUSY,
+		PGZ_DONE,
+	}			state;
+	int			last;
+	int			error;
+
+	uint8_t			*in;
+	ssize_t			in_len;
+	uint8_t			*dict;
+	unsigned		dict_len;
+
+	uint8_t			*out;
+	ssize_t			out_sz;
+	ssize_t			out_len;
+	ssize_t			out_off;
+
+	uLong			crc;
+	intmax_t		last_bit;
+	intmax_t		stop_bit;
+};
+
+struct pgz {
+	unsigned		magic;
+#define PGZ_MAGIC		0x2be1e68f
+	struct lock		mtx;
+	pthread_cond_t		cond;
+
+	int			level;
+	int			memlevel;
+
+	struct pgz_blk		blk[PGZ_NBLK];
+	unsigned		nfill;
+	unsigned		nemit;
+	int			eof;
+
+	uint8_t			tail[10];
+	unsigned		tail_len;
+	unsigned		tail_off;
+
+	uLong			crc;
+	uintmax_t		isize;
+	uintmax_t		osize;
+};
+
+static void
+pgz_compress(struct pgz_blk *blk)
+{
+	z_stream zs;
+	ssize_t sz;
+	int flush, i;
+
+	CHECK_OBJ_NOTNULL(blk, PGZ_BLK_MAGIC);
+	memset(&zs, 0, sizeof zs);
+	i = deflateInit2(&zs, blk->pgz->level, Z_DEFLATED, -15,
+	    blk->pgz->memlevel, Z_DEFAULT_STRATEGY);
+	if (i != Z_OK) {
+		blk->error = 1;
+		return;
+	}
+	if (blk->dict_len > 0)
+		AZ(deflateSetDictionary(&zs, blk->dict, blk->dict_len));
+	/* The bound is for Z_FINISH, leave room for the sync flush */
+	sz = deflateBound(&zs, blk->in_len) + 64;
+	if (blk->out_sz < sz) {
+		free(blk->out);
+		blk->out_sz = sz;
+		blk->out = malloc(blk->out_sz);
+		AN(blk->out);
+	}
+	flush = blk->last ? Z_FINISH : Z_SYNC_FLUSH;
+	zs.next_in = blk->in;
+	zs.avail_in = blk->in_len;
+	zs.next_out = blk->out;
+	zs.avail_out = blk->out_sz;
+	do {
+		if (zs.avail_out == 0) {
+			blk->out = realloc(blk->out, blk->out_sz * 2);
+			AN(blk->out);
+			zs.next_out = blk->out + blk->out_sz;
+			zs.avail_out = blk->out_sz;
+			blk->out_sz *= 2;
+		}
+		i = deflate(&zs, flush);
+	} while (i == Z_OK && (zs.avail_out == 0 || flush == Z_FINISH));
+	blk->error = (i != (blk->last ? Z_STREAM_END : Z_OK)) ||
+	    zs.avail_in != 0;
+	blk->out_len = zs.total_out;
+	blk->out_off = 0;
+	blk->last_bit = zs.last_bit;
+	blk->stop_bit = zs.stop_bit;
+	blk->crc = crc32(0L, blk->in, blk->in_len);
+	(void)deflateEnd(&zs);
+}
+
+static void __match_proto__(task_func_t)
+pgz_task(struct worker *wrk, void *priv)
+{
+	struct pgz_blk *blk;
+	struct pgz *pgz;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(blk, priv, PGZ_BLK_MAGIC);
+	pgz = blk->pgz;
+	pgz_compress(blk);
+	Lck_Lock(&pgz->mtx);
+	blk->state = PGZ_DONE;
+	AZ(pthread_cond_broadcast(&pgz->cond));
+	Lck_Unlock(&pgz->mtx);
+}
+
+static struct pgz *
+pgz_new(void)
+{
+	struct pgz *pgz;
+	unsigned u;
+
+	ALLOC_OBJ(pgz, PGZ_MAGIC);
+	AN(pgz);
+	Lck_New(&pgz->mtx, lck_vgz);
+	AZ(pthread_cond_init(&pgz->cond, NULL));
+	pgz->level = cache_param->gzip_level;
+	pgz->memlevel = cache_param->gzip_memlevel;
+	for (u = 0; u < PGZ_NBLK; u++) {
+		pgz->blk[u].magic = PGZ_BLK_MAGIC;
+		pgz->blk[u].pgz = pgz;
+		pgz->blk[u].task.func = pgz_task;
+		pgz->blk[u].task.priv = &pgz->blk[u];
+	}
+
+	/* The header deflateInit2() would have written */
+	pgz->tail[0] = 0x1f;
+	pgz->tail[1] = 0x8b;
+	pgz->tail[2] = Z_DEFLATED;
+	pgz->tail[8] = pgz->level == 9 ? 2 : pgz->level < 2 ? 4 : 0;
+	pgz->tail[9] = 3;
+	pgz->tail_len = 10;
+
+	VSC_C_main->n_gzip++;
+	VSC_C_main->n_gzip_parallel++;
+	return (pgz);
+}
+
+static void
+pgz_destroy(struct pgz **pgzp)
+{
+	struct pgz *pgz;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(pgz, pgzp, PGZ_MAGIC);
+	Lck_Lock(&pgz->mtx);
+	for (u = 0; u < PGZ_NBLK; u++)
+		while (pgz->blk[u].state == PGZ_BUSY)
+			(void)Lck_CondWait(&pgz->cond, &pgz->mtx, 0);
+	Lck_Unlock(&pgz->mtx);
+	for (u = 0; u < PGZ_NBLK; u++) {
+		free(pgz->blk[u].in);
+		free(pgz->blk[u].dict);
+		free(pgz->blk[u].out);
+	}
+	AZ(pthread_cond_destroy(&pgz->cond));
+	Lck_Delete(&pgz->mtx);
+	FREE_OBJ(pgz);
+}
+
+/* Read the next block and hand it to a helper */
+static enum vfp_status
+pgz_fill(struct vfp_ctx *vc, struct pgz *pgz)
+{
+	struct pgz_blk *blk, *prev;
+	enum vfp_status vp = VFP_OK;
+	ssize_t l;
+
+	blk = &pgz->blk[pgz->nfill % PGZ_NBLK];
+	assert(blk->state == PGZ_IDLE);
+	if (blk->in == NULL) {
+		blk->in = malloc(PGZ_BLOCK);
+		blk->dict = malloc(PGZ_DICT);
+		if (blk->in == NULL || blk->dict == NULL)
+			return (VFP_Error(vc, "Out of memory for gzip"));
+	}
+	blk->in_len = 0;
+	while (vp == VFP_OK && blk->in_len < PGZ_BLOCK) {
+		l = PGZ_BLOCK - blk->in_len;
+		vp = VFP_Suck(vc, blk->in + blk->in_len, &l);
+		if (vp == VFP_ERROR)
+			return (vp);
+		blk->in_len += l;
+	}
+	blk->last = (vp == VFP_END);
+	pgz->eof = blk->last;
+
+	/* The previous block is not emitted yet, so its input is intact */
+	blk->dict_len = 0;
+	if (pgz->nfill > 0) {
+		prev = &pgz->blk[(pgz->nfill - 1) % PGZ_NBLK];
+		blk->dict_len = prev->in_len < PGZ_DICT ?
+		    prev->in_len : PGZ_DICT;
+		memcpy(blk->dict, prev->in + prev->in_len - blk->dict_len,
+		    blk->dict_len);
+	}
+	pgz->nfill++;
+
+	blk->state = PGZ_BUSY;
+	if (Pool_Task_Any(&blk->task, TASK_QUEUE_BO))
+		pgz_task(vc->wrk, blk);
+	return (VFP_OK);
+}
+
+static enum vfp_status
+vfp_pgzip_pull(struct vfp_ctx *vc, struct pgz *pgz, uint8_t *p, ssize_t *lp)
+{
+	struct pgz_blk *blk;
+	ssize_t l, len;
+
+	CHECK_OBJ_NOTNULL(pgz, PGZ_MAGIC);
+	len = *lp;
+	*lp = 0;
+
+	/* Header, or trailer once the last block is out */
+	if (pgz->tail_off < pgz->tail_len) {
+		if (pgz->nemit == 0 && pgz->tail_off == 0)
+			vgz_setbits(vc, 80, 0, 0, -1);
+		l = pgz->tail_len - pgz->tail_off;
+		if (l > len)
+			l = len;
+		memcpy(p, pgz->tail + pgz->tail_off, l);
+		pgz->tail_off += l;
+		pgz->osize += l;
+		*lp = l;
+		if (pgz->tail_off == pgz->tail_len && pgz->eof &&
+		    pgz->nemit == pgz->nfill)
+			return (VFP_END);
+		return (VFP_OK);
+	}
+
+	while (!pgz->eof && pgz->nfill - pgz->nemit < PGZ_NBLK)
+		if (pgz_fill(vc, pgz) == VFP_ERROR)
+			return (VFP_ERROR);
+	assert(pgz->nemit < pgz->nfill);
+
+	blk = &pgz->blk[pgz->nemit % PGZ_NBLK];
+	Lck_Lock(&pgz->mtx);
+	while (blk->state != PGZ_DONE)
+		(void)Lck_CondWait(&pgz->cond, &pgz->mtx, 0);
+	Lck_Unlock(&pgz->mtx);
+	if (blk->error)
+		return (VFP_Error(vc, "Gzip failed"));
+
+	l = blk->out_len - blk->out_off;
+	if (l > len)
+		l = len;
+	memcpy(p, blk->out + blk->out_off, l);
+	blk->out_off += l;
+	*lp = l;
+	if (blk->out_off < blk->out_len)
+		return (VFP_OK);
+
+	pgz->crc = crc32_combine(pgz->crc, blk->crc, blk->in_len);
+	pgz->isize += blk->in_len;
+	if (blk->last) {
+		vgz_setbits(vc, 80,
+		    (intmax_t)pgz->osize * 8 + blk->last_bit,
+		    (intmax_t)pgz->osize * 8 + blk->stop_bit,
+		    (intmax_t)pgz->isize);
+		vle32enc(pgz->tail, pgz->crc);
+		vle32enc(pgz->tail + 4, pgz->isize);
+		pgz->tail_len = 8;
+		pgz->tail_off = 0;
+	}
+	pgz->osize += blk->out_len;
+	pgz->nemit++;
+	blk->state = PGZ_IDLE;
+	return (VFP_OK);
+}
+
 /*--------------------------------------------------------------------
  * VFP_TESTGZIP
  *
@@ -648,11 +1181,16 @@ static void __match_proto__(vfp_fini_f)
 vfp_gzip_fini(struct vfp_ctx *vc, struct vfp_entry *vfe)
 {
 	struct vgz *vg;
+	struct pgz *pgz;
 
 	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
 
-	if (vfe->priv1 != NULL) {
+	if (vfe->priv1 != NULL && vfe->priv2) {
+		CAST_OBJ_NOTNULL(pgz, vfe->priv1, PGZ_MAGIC);
+		vfe->priv1 = NULL;
+		pgz_destroy(&pgz);
+	} else if (vfe->priv1 != NULL) {
 		CAST_OBJ_NOTNULL(vg, vfe->priv1, VGZ_MAGIC);
 		vfe->priv1 = NULL;
 		(void)VGZ_Destroy(&vg);
@@ -72,13 +72,29 @@ struct rush {
 static const struct hash_slinger *hash;
 static struct objhead *private_oh;
 
-static void hsh_rush1(struct worker *, struct objhead *, struct rush *, int);
+static void hsh_rush1(struct worker *, struct objhead *, struct rush *, int,
+    struct objcore *);
 static void hsh_rush2(struct worker *, struct rush *);
 
+/*---------------------------------------------------------------------
+ * The objcore refcount is only ever changed atomically, because
+ * HSH_Ref() and HSH_DerefObjCore() do so without holding oh->mtx when
+ * they can.  The transition to zero, which takes the objcore off the
+ * objhead, always happens under oh->mtx, so anybody who finds an
+ * objcore on the objhead with the lock held can still trust refcnt.
+ */
+
+static inline void
+hsh_ocref(struct objcore *oc)
+{
+
+	(void)__sync_add_and_fetch(&oc->refcnt, 1);
+}
+
 /*---------------------------------------------------------------------*/
 
-static struct objhead *
-hsh_newobjhead(void)
+struct objhead *
+HSH_NewObjHead(void)
 {
 	struct objhead *oh;
 
@@ -104,7 +120,7 @@ hsh_prealloc(struct worker *wrk)
 	CHECK_OBJ_NOTNULL(wrk->nobjcore, OBJCORE_MAGIC);
 
 	if (wrk->nobjhead == NULL) {
-		wrk->nobjhead = hsh_newobjhead();
+		wrk->nobjhead = HSH_NewObjHead();
 		wrk->stats->n_objecthead++;
 	}
 	CHECK_OBJ_NOTNULL(wrk->nobjhead, OBJHEAD_MAGIC);
@@ -153,6 +169,8 @@ HSH_Cleanup(struct worker *wrk)
 		free(wrk->nhashpriv);
 		wrk->nhashpriv = NULL;
 	}
+	free(wrk->hsh_pfx);
+	wrk->hsh_pfx = NULL;
 }
 
 void
@@ -174,10 +192,70 @@ HSH_AddString(struct req *req, void *ctx, const char *str)
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	AN(ctx);
 	if (str != NULL) {
-		SHA256_Update(ctx, str, strlen(str));
+		VSHA256_Update(ctx, str, strlen(str));
 		VSLb(req->vsl, SLT_Hash, "%s", str);
 	} else
-		SHA256_Update(ctx, &str, 1);
+		VSHA256_Update(ctx, &str, 1);
+}
+
+/*---------------------------------------------------------------------
+ * Add a prefix which is the same for many requests, typically a salt
+ * and the Host header.  When it starts the hash and fills at least one
+ * SHA256 block, each worker keeps the hash state after it in a small
+ * direct mapped table, so the next request with the same prefix only
+ * has to copy that state and hash the rest of its key.
+ */
+
+#define HSH_PFX_MIN	64		/* One SHA256 block */
+#define HSH_PFX_SLOTS	8
+
+struct hsh_pfx {
+	size_t			len;
+	VSHA256_CTX		sha;
+	uint8_t			key[HSH_PFX_MAX];
+};
+
+void
+HSH_AddPrefix(struct req *req, void *ctx, const void *ptr, size_t len)
+{
+	VSHA256_CTX *sha = ctx;
+	struct worker *wrk;
+	struct hsh_pfx *hp;
+	const uint8_t *p = ptr;
+	uint32_t h = 2166136261U;	/* FNV-1a */
+	size_t u;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	wrk = req->wrk;
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(ctx);
+	AN(ptr);
+	assert(len <= HSH_PFX_MAX);
+
+	if (sha->count != 0 || len < HSH_PFX_MIN) {
+		VSHA256_Update(sha, ptr, len);
+		return;
+	}
+
+	if (wrk->hsh_pfx == NULL) {
+		wrk->hsh_pfx = calloc(HSH_PFX_SLOTS, sizeof *wrk->hsh_pfx);
+		if (wrk->hsh_pfx == NULL) {
+			VSHA256_Update(sha, ptr, len);
+			return;
+		}
+	}
+
+	for (u = 0; u < len; u++)
+		h = (h ^ p[u]) * 16777619U;
+	hp = &wrk->hsh_pfx[h % HSH_PFX_SLOTS];
+	if (hp->len == len && !memcmp(hp->key, ptr, len)) {
+		memcpy(sha, &hp->sha, sizeof *sha);
+		return;
+	}
+	VSHA256_Update(sha, ptr, len);
+	memcpy(&hp->sha, sha, sizeof hp->sha);
+	memcpy(hp->key, ptr, len);
+	hp->len = len;
 }
 
 /*---------------------------------------------------------------------
@@ -188,8 +266,8 @@ HSH_AddString(struct req *req, void *ctx, const char *str)
  */
 
 static struct hsh_magiclist {
-	unsigned char was[SHA256_LEN];
-	unsigned char now[SHA256_LEN];
+	unsigned char was[VSHA256_LEN];
+	unsigned char now[VSHA256_LEN];
 } hsh_magiclist[] = {
 	{ .now = {	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -238,19 +316,19 @@ hsh_testmagic(void *result)
 	static int nused = 0;
 
 	for (i = 0; i < nused; i++)
-		if (!memcmp(hsh_magiclist[i].was, result, SHA256_LEN))
+		if (!memcmp(hsh_magiclist[i].was, result, VSHA256_LEN))
 			break;
 	if (i == nused && i < HSH_NMAGIC)
-		memcpy(hsh_magiclist[nused++].was, result, SHA256_LEN);
+		memcpy(hsh_magiclist[nused++].was, result, VSHA256_LEN);
 	if (i == nused)
 		return;
 	assert(i < HSH_NMAGIC);
 	fprintf(stderr, "HASHMAGIC: <");
-	for (j = 0; j < SHA256_LEN; j++)
+	for (j = 0; j < VSHA256_LEN; j++)
 		fprintf(stderr, "%02x", ((unsigned char*)result)[j]);
 	fprintf(stderr, "> -> <");
-	memcpy(result, hsh_magiclist[i].now, SHA256_LEN);
-	for (j = 0; j < SHA256_LEN; j++)
+	memcpy(result, hsh_magiclist[i].now, VSHA256_LEN);
+	for (j = 0; j < VSHA256_LEN; j++)
 		fprintf(stderr, "%02x", ((unsigned char*)result)[j]);
 	fprintf(stderr, ">\n");
 }
@@ -289,7 +367,7 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 	   objecthead. The new object inherits our objhead reference. */
 	oc->objhead = oh;
 	VTAILQ_INSERT_TAIL(&oh->objcs, oc, hsh_list);
-	oc->refcnt++;				// For EXP_Insert
+	hsh_ocref(oc);				// For EXP_Insert
 	Lck_Unlock(&oh->mtx);
 
 	BAN_RefBan(oc, ban);
@@ -303,7 +381,7 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
 	oc->flags &= ~OC_F_BUSY;
 	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
+		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY, NULL);
 	Lck_Unlock(&oh->mtx);
 	hsh_rush2(wrk, &rush);
 }
@@ -330,6 +408,83 @@ hsh_insert_busyobj(struct worker *wrk, struct objhead *oh)
 	return (oc);
 }
 
+/*---------------------------------------------------------------------
+ * Insert a busy objcore for an identity variant of the gzip'ed object
+ * oc, unless it has one already or one is on its way.  Variants of
+ * older incarnations of the object are killed while we are here.
+ */
+
+struct objcore *
+HSH_Variant(struct worker *wrk, struct objcore *oc)
+{
+	struct objhead *oh;
+	struct objcore *oc2, *boc = NULL;
+	int found = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(oc->flags & OC_F_VARIANT);
+	oh = oc->objhead;
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+
+	hsh_prealloc(wrk);
+	Lck_Lock(&oh->mtx);
+	VTAILQ_FOREACH(oc2, &oh->objcs, hsh_list) {
+		CHECK_OBJ_NOTNULL(oc2, OBJCORE_MAGIC);
+		if (!(oc2->flags & OC_F_VARIANT) ||
+		    (oc2->flags & (OC_F_DYING | OC_F_FAILED)))
+			continue;
+		if (oc2->boc != NULL || oc2->t_origin >= oc->t_origin) {
+			found = 1;
+		} else {
+			oc2->flags |= OC_F_DYING;
+			EXP_Remove(oc2);
+		}
+	}
+	if (!found) {
+		boc = hsh_insert_busyobj(wrk, oh);
+		boc->flags |= OC_F_VARIANT;
+		oh->refcnt++;
+	}
+	Lck_Unlock(&oh->mtx);
+	return (boc);
+}
+
+/*---------------------------------------------------------------------
+ * Insert a busy objcore to replace oc, unless something is already
+ * being fetched for this objhead, or a replacement is in place.
+ */
+
+struct objcore *
+HSH_Replace(struct worker *wrk, struct objcore *oc)
+{
+	struct objhead *oh;
+	struct objcore *oc2, *boc = NULL;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(oc->flags & OC_F_VARIANT);
+	oh = oc->objhead;
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+
+	hsh_prealloc(wrk);
+	Lck_Lock(&oh->mtx);
+	VTAILQ_FOREACH(oc2, &oh->objcs, hsh_list) {
+		CHECK_OBJ_NOTNULL(oc2, OBJCORE_MAGIC);
+		if (oc2 == oc || (oc2->flags &
+		    (OC_F_VARIANT | OC_F_DYING | OC_F_FAILED)))
+			continue;
+		if (oc2->boc != NULL || oc2->t_origin >= oc->t_origin)
+			break;
+	}
+	if (oc2 == NULL) {
+		boc = hsh_insert_busyobj(wrk, oh);
+		oh->refcnt++;
+	}
+	Lck_Unlock(&oh->mtx);
+	return (boc);
+}
+
 /*---------------------------------------------------------------------
  */
 
@@ -361,6 +516,21 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	if (DO_DEBUG(DBG_HASHEDGE))
 		hsh_testmagic(req->digest);
 
+	if (req->hash_oc != NULL) {
+		/*
+		 * The object we waited for was handed to us when it was
+		 * unbusied, so there is no need to look it up again.
+		 */
+		CHECK_OBJ_NOTNULL(req->hash_oc, OBJCORE_MAGIC);
+		oh = req->hash_objhead;
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		req->hash_objhead = NULL;
+		*ocp = req->hash_oc;
+		req->hash_oc = NULL;
+		assert(HSH_DerefObjHead(wrk, &oh));
+		return (HSH_HIT);
+	}
+
 	if (req->hash_objhead != NULL) {
 		/*
 		 * This req came off the waiting list, and brings an
@@ -403,6 +573,10 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		if (oc->flags & OC_F_FAILED)
 			continue;
 
+		/* Identity variants are only for those who can't gunzip */
+		if ((oc->flags & OC_F_VARIANT) && RFC2616_Req_Gzip(req->http))
+			continue;
+
 		if (oc->boc != NULL && oc->boc->state < BOS_STREAM) {
 			CHECK_OBJ_ORNULL(oc->boc, BOC_MAGIC);
 
@@ -410,7 +584,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 				continue;
 
 			if (oc->boc->vary != NULL &&
-			    !VRY_Match(req, oc->boc->vary))
+			    !VRY_Match(req, oc->boc->vary, 0))
 				continue;
 
 			busy_found = 1;
@@ -427,8 +601,12 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		}
 
 		if (ObjHasAttr(wrk, oc, OA_VARY)) {
+			if (!VRY_HashMatch(req, oc->vary_hash)) {
+				wrk->stats->cache_vary_skip++;
+				continue;
+			}
 			vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
-			if (!VRY_Match(req, vary))
+			if (!VRY_Match(req, vary, oc->vary_hash))
 				continue;
 		}
 
@@ -444,7 +622,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 				oc = NULL;
 				*bocp = hsh_insert_busyobj(wrk, oh);
 			} else {
-				oc->refcnt++;
+				hsh_ocref(oc);
 				if (oc->hits < LONG_MAX)
 					oc->hits++;
 			}
@@ -471,7 +649,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	if (exp_oc != NULL) {
 		assert(oh->refcnt > 1);
 		assert(exp_oc->objhead == oh);
-		exp_oc->refcnt++;
+		hsh_ocref(exp_oc);
 
 		if (!busy_found) {
 			*bocp = hsh_insert_busyobj(wrk, oh);
@@ -506,6 +684,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		VSLb(req->vsl, SLT_Debug, "on waiting list <%p>", oh);
 
 	wrk->stats->busy_sleep++;
+	wrk->stats->n_waitinglist++;
 	/*
 	 * The objhead reference transfers to the sess, we get it
 	 * back when the sess comes off the waiting list and
@@ -518,15 +697,42 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	return (HSH_BUSY);
 }
 
+/*---------------------------------------------------------------------
+ * Can a waiting req be given the object it waited for without a new
+ * lookup?  Only the plain cases, anything which could make HSH_Lookup()
+ * decide otherwise goes through the lookup.
+ */
+
+static int
+hsh_can_handover(struct worker *wrk, struct objcore *oc,
+    const struct req *req)
+{
+
+	if (oc->flags & (OC_F_PRIVATE | OC_F_PASS | OC_F_HFP |
+	    OC_F_DYING | OC_F_FAILED))
+		return (0);
+	if (oc->ttl <= 0.)
+		return (0);
+	if (ObjHasAttr(wrk, oc, OA_VARY))
+		return (0);
+	return (EXP_Ttl(req, oc) >= req->t_req);
+}
+
 /*---------------------------------------------------------------------
  * Pick the req's we are going to rush from the waiting list
+ *
+ * If we have the object they waited for, the req's which can use it
+ * as it is get a reference to it and are all rushed at once, since
+ * they will not come back to the objhead to look for it.  The others
+ * are rushed max at a time.
  */
 
 static void
-hsh_rush1(struct worker *wrk, struct objhead *oh, struct rush *r, int max)
+hsh_rush1(struct worker *wrk, struct objhead *oh, struct rush *r, int max,
+    struct objcore *oc)
 {
 	unsigned u;
-	struct req *req;
+	struct req *req, *req2;
 
 	if (max == 0)
 		return;
@@ -537,19 +743,34 @@ hsh_rush1(struct worker *wrk, struct objhead *oh, struct rush *r, int max)
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 	CHECK_OBJ_NOTNULL(r, RUSH_MAGIC);
+	CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
 	VTAILQ_INIT(&r->reqs);
 	Lck_AssertHeld(&oh->mtx);
-	for (u = 0; u < max; u++) {
-		req = VTAILQ_FIRST(&oh->waitinglist);
-		if (req == NULL)
-			break;
+	u = 0;
+	VTAILQ_FOREACH_SAFE(req, &oh->waitinglist, w_list, req2) {
 		CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
-		wrk->stats->busy_wakeup++;
 		AZ(req->wrk);
+		AZ(req->hash_oc);
+		if (oc != NULL && hsh_can_handover(wrk, oc, req)) {
+			hsh_ocref(oc);
+			if (oc->hits < LONG_MAX)
+				oc->hits++;
+			req->hash_oc = oc;
+			wrk->stats->busy_handover++;
+		} else if (u < (unsigned)max)
+			u++;
+		else if (oc == NULL)
+			break;
+		else
+			continue;
+		wrk->stats->busy_wakeup++;
+		wrk->stats->n_waitinglist--;
 		VTAILQ_REMOVE(&oh->waitinglist, req, w_list);
 		VTAILQ_INSERT_TAIL(&r->reqs, req, w_list);
 		req->waitinglist = 0;
 	}
+	if (!VTAILQ_EMPTY(&r->reqs))
+		wrk->stats->busy_rush++;
 }
 
 /*---------------------------------------------------------------------
@@ -598,7 +819,7 @@ double keep)
 		ocp = (void*)wrk->aws->f;
 		Lck_Lock(&oh->mtx);
 		assert(oh->refcnt > 0);
-		now = VTIM_real();
+		now = VTIM_real_coarse();
 		VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
 			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 			assert(oc->objhead == oh);
@@ -619,7 +840,7 @@ double keep)
 				more = 1;
 				break;
 			}
-			oc->refcnt++;
+			hsh_ocref(oc);
 			spc -= sizeof *ocp;
 			ocp[nobj++] = oc;
 		}
@@ -628,7 +849,11 @@ double keep)
 		for (n = 0; n < nobj; n++) {
 			oc = ocp[n];
 			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-			EXP_Rearm(oc, now, ttl, grace, keep);
+			EXP_RearmBatch(wrk, oc, now, ttl, grace, keep);
+		}
+		EXP_Flush(wrk);
+		for (n = 0; n < nobj; n++) {
+			oc = ocp[n];
 			(void)HSH_DerefObjCore(wrk, &oc, 0);
 		}
 	} while (more);
@@ -669,6 +894,7 @@ void
 HSH_Abandon(struct objcore *oc)
 {
 	struct objhead *oh;
+	struct boc *boc;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	oh = oc->objhead;
@@ -676,7 +902,15 @@ HSH_Abandon(struct objcore *oc)
 
 	Lck_Lock(&oh->mtx);
 	oc->flags |= OC_F_ABANDON;
+	boc = oc->boc;
 	Lck_Unlock(&oh->mtx);
+
+	/* The fetch may be waiting for us, see ObjExtend() */
+	if (boc != NULL && boc->transit_buffer > 0) {
+		Lck_Lock(&boc->mtx);
+		AZ(pthread_cond_broadcast(&boc->cond));
+		Lck_Unlock(&boc->mtx);
+	}
 }
 
 /*---------------------------------------------------------------------
@@ -710,13 +944,13 @@ HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 	assert(oh->refcnt > 0);
 	assert(oc->refcnt > 0);
 	if (!(oc->flags & OC_F_PRIVATE))
-		oc->refcnt++;			// For EXP_Insert
+		hsh_ocref(oc);			// For EXP_Insert
 	/* XXX: strictly speaking, we should sort in Date: order. */
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
 	oc->flags &= ~OC_F_BUSY;
 	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
+		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY, oc);
 	Lck_Unlock(&oh->mtx);
 	if (!(oc->flags & OC_F_PRIVATE))
 		EXP_Insert(wrk, oc);
@@ -760,7 +994,7 @@ HSH_Snipe(const struct worker *wrk, struct objcore *oc)
 	if (oc->refcnt == 1 && !Lck_Trylock(&oc->objhead->mtx)) {
 		if (oc->refcnt == 1 && !(oc->flags & OC_F_DYING)) {
 			oc->flags |= OC_F_DYING;
-			oc->refcnt++;
+			hsh_ocref(oc);
 			retval = 1;
 		}
 		Lck_Unlock(&oc->objhead->mtx);
@@ -783,10 +1017,9 @@ HSH_Ref(struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	oh = oc->objhead;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-	Lck_Lock(&oh->mtx);
+	/* The caller holds a reference, so it cannot go away under us */
 	assert(oc->refcnt > 0);
-	oc->refcnt++;
-	Lck_Unlock(&oh->mtx);
+	hsh_ocref(oc);
 }
 
 /*---------------------------------------------------------------------
@@ -852,7 +1085,7 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 	struct objcore *oc;
 	struct objhead *oh;
 	struct rush rush;
-	unsigned r;
+	int r;
 
 	AN(ocp);
 	oc = *ocp;
@@ -866,13 +1099,26 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 	oh = oc->objhead;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 
+	/*
+	 * Unless it is the last reference, or there are waiters to rush,
+	 * dropping a reference does not need the objhead.
+	 */
+	if (rushmax == 0 || VTAILQ_EMPTY(&oh->waitinglist)) {
+		r = oc->refcnt;
+		while (r > 1) {
+			if (__sync_bool_compare_and_swap(&oc->refcnt, r, r - 1))
+				return (r - 1);
+			r = oc->refcnt;
+		}
+	}
+
 	Lck_Lock(&oh->mtx);
 	assert(oh->refcnt > 0);
-	r = --oc->refcnt;
+	r = __sync_sub_and_fetch(&oc->refcnt, 1);
 	if (!r)
 		VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
 	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, rushmax);
+		hsh_rush1(wrk, oh, &rush, rushmax, NULL);
 	Lck_Unlock(&oh->mtx);
 	hsh_rush2(wrk, &rush);
 	if (r != 0)
@@ -883,6 +1129,9 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 	BAN_DestroyObj(oc);
 	AZ(oc->ban);
 
+	if (oc->tags != NULL)
+		TAG_DestroyObj(wrk, oc);
+
 	if (oc->stobj->stevedore != NULL)
 		ObjFreeObj(wrk, oc);
 	ObjDestroy(wrk, &oc);
@@ -923,7 +1172,7 @@ HSH_DerefObjHead(struct worker *wrk, struct objhead **poh)
 	 */
 	Lck_Lock(&oh->mtx);
 	while (oh->refcnt == 1 && !VTAILQ_EMPTY(&oh->waitinglist)) {
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_ALL);
+		hsh_rush1(wrk, oh, &rush, HSH_RUSH_ALL, NULL);
 		Lck_Unlock(&oh->mtx);
 		hsh_rush2(wrk, &rush);
 		Lck_Lock(&oh->mtx);
@@ -941,10 +1190,10 @@ void
 HSH_Init(const struct hash_slinger *slinger)
 {
 
-	assert(DIGEST_LEN == SHA256_LEN);	/* avoid #include pollution */
+	assert(DIGEST_LEN == VSHA256_LEN);	/* avoid #include pollution */
 	hash = slinger;
 	if (hash->start != NULL)
 		hash->start();
-	private_oh = hsh_newobjhead();
+	private_oh = HSH_NewObjHead();
 	private_oh->refcnt = 1;
 }
@@ -34,9 +34,11 @@
 #include <stddef.h>
 #include "cache.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "vend.h"
 #include "vct.h"
+#include "vhdr.h"
 #include "vtim.h"
 
 #define HTTPH(a, b, c) char b[] = "*" a ":";
@@ -138,12 +140,115 @@ http_Status2Reason(unsigned status, const char **sstr)
 
 /*--------------------------------------------------------------------*/
 
+/*--------------------------------------------------------------------
+ * Header name index
+ *
+ * An open addressing hash table, at most half full, from header names
+ * to the first hd[] slot with that name, so that http_findhdr() does
+ * not have to walk all the headers.  hdx[0] holds how many of hd[]
+ * are indexed and the table follows.  For the well-known headers the
+ * first slot is also kept in hdw[], by their vhdr.h id.
+ *
+ * Headers added at the end are indexed on the next lookup, anything
+ * which moves headers around or renames one in place must call
+ * http_hdx_reset(), and the index gets rebuilt on the next lookup.
+ */
+
+static unsigned
+http_hdx_len(unsigned nhttp)
+{
+	unsigned u;
+
+	for (u = 4; u < 2 * nhttp; u <<= 1)
+		continue;
+	return (u);
+}
+
+static unsigned
+http_hdx_hash(const char *b, unsigned l)
+{
+	unsigned h = 2166136261U;
+
+	/* NB: Folds more than letters, but never apart what strncasecmp
+	 * considers equal */
+	while (l-- > 0)
+		h = (h ^ (*b++ | 0x20)) * 16777619U;
+	return (h);
+}
+
+static void
+http_hdx_reset(const struct http *hp)
+{
+
+	if (hp->hdx != NULL)
+		hp->hdx[0] = 0;
+}
+
+static int
+http_hdx_match(const struct http *hp, unsigned u, unsigned l, const char *hdr)
+{
+
+	Tcheck(hp->hd[u]);
+	return (hp->hd[u].e >= hp->hd[u].b + l + 1 &&
+	    hp->hd[u].b[l] == ':' &&
+	    !strncasecmp(hdr, hp->hd[u].b, l));
+}
+
+static void
+http_hdx_sync(const struct http *hp)
+{
+	uint16_t *tbl;
+	unsigned u, i, id;
+	const char *p;
+
+	AN(hp->hdx);
+	AN(hp->hdw);
+	tbl = hp->hdx + 1;
+	if (hp->hdx[0] < HTTP_HDR_FIRST || hp->hdx[0] > hp->nhd) {
+		memset(tbl, 0, sizeof *tbl * (hp->hdx_mask + 1));
+		memset(hp->hdw, 0, sizeof *hp->hdw * VHDR_NID);
+		hp->hdx[0] = HTTP_HDR_FIRST;
+	}
+	for (u = hp->hdx[0]; u < hp->nhd; u++) {
+		if (hp->hd[u].b == NULL)
+			continue;
+		p = memchr(hp->hd[u].b, ':', Tlen(hp->hd[u]));
+		if (p == NULL)
+			continue;
+		id = VHDR_Id(hp->hd[u].b, p - hp->hd[u].b);
+		if (id != 0 && hp->hdw[id] == 0)
+			hp->hdw[id] = (uint16_t)u;
+		i = http_hdx_hash(hp->hd[u].b, p - hp->hd[u].b);
+		for (; tbl[i & hp->hdx_mask] != 0; i++)
+			if (http_hdx_match(hp, tbl[i & hp->hdx_mask],
+			    p - hp->hd[u].b, hp->hd[u].b))
+				break;
+		if (tbl[i & hp->hdx_mask] == 0)
+			tbl[i & hp->hdx_mask] = (uint16_t)u;
+	}
+	hp->hdx[0] = hp->nhd;
+}
+
+/*--------------------------------------------------------------------
+ * The name index is part of HTTP_estimate(), but req and busyobj get
+ * their mempool items enlarged by it, see MPL_Extra(), so it does not
+ * eat into workspace_client or workspace_backend.
+ */
+
+unsigned
+HTTP_IndexSize(unsigned nhttp)
+{
+
+	return (PRNDUP(sizeof(uint16_t) * (1 + http_hdx_len(nhttp) + VHDR_NID)));
+}
+
 unsigned
 HTTP_estimate(unsigned nhttp)
 {
 
 	/* XXX: We trust the structs to size-aligned as necessary */
-	return (PRNDUP(sizeof (struct http) + sizeof(txt) * nhttp + nhttp));
+	return (PRNDUP(sizeof (struct http) + sizeof(txt) * nhttp + nhttp) +
+	    HTTP_IndexSize(nhttp));
 }
 
 struct http *
@@ -151,11 +256,17 @@ HTTP_create(void *p, uint16_t nhttp)
 {
 	struct http *hp;
 
+	/* Mempools only promise to clear the used part of a workspace */
+	memset(p, 0, HTTP_estimate(nhttp));
 	hp = p;
 	hp->magic = HTTP_MAGIC;
 	hp->hd = (void*)(hp + 1);
 	hp->shd = nhttp;
-	hp->hdf = (void*)(hp->hd + nhttp);
+	hp->hdx = (void*)(hp->hd + nhttp);
+	hp->hdx_mask = http_hdx_len(nhttp) - 1;
+	hp->hdx[0] = 0;
+	hp->hdw = hp->hdx + 1 + hp->hdx_mask + 1;
+	hp->hdf = (void*)(hp->hdw + VHDR_NID);
 	return (hp);
 }
 
@@ -187,6 +298,7 @@ http_Teardown(struct http *hp)
 	memset(&hp->nhd, 0, sizeof *hp - offsetof(struct http, nhd));
 	memset(hp->hd, 0, sizeof *hp->hd * hp->shd);
 	memset(hp->hdf, 0, sizeof *hp->hdf * hp->shd);
+	http_hdx_reset(hp);
 }
 
 /*--------------------------------------------------------------------*/
@@ -199,6 +311,7 @@ HTTP_Copy(struct http *to, const struct http * const fm)
 	memcpy(&to->nhd, &fm->nhd, sizeof *to - offsetof(struct http, nhd));
 	memcpy(to->hd, fm->hd, fm->nhd * sizeof *to->hd);
 	memcpy(to->hdf, fm->hdf, fm->nhd * sizeof *to->hdf);
+	http_hdx_reset(to);
 }
 
 /*--------------------------------------------------------------------*/
@@ -209,6 +322,8 @@ http_SetH(const struct http *to, unsigned n, const char *fm)
 
 	assert(n < to->nhd);
 	AN(fm);
+	if (to->hdx != NULL && n < to->hdx[0])
+		http_hdx_reset(to);	/* May not be the same name */
 	to->hd[n].b = TRUST_ME(fm);
 	to->hd[n].e = strchr(to->hd[n].b, '\0');
 	to->hdf[n] = 0;
@@ -256,7 +371,16 @@ http_IsHdr(const txt *hh, const char *hdr)
 static unsigned
 http_findhdr(const struct http *hp, unsigned l, const char *hdr)
 {
-	unsigned u;
+	unsigned u, i;
+
+	if (hp->hdx != NULL && memchr(hdr, ':', l) == NULL) {
+		http_hdx_sync(hp);
+		i = http_hdx_hash(hdr, l);
+		for (; (u = hp->hdx[1 + (i & hp->hdx_mask)]) != 0; i++)
+			if (http_hdx_match(hp, u, l, hdr))
+				return (u);
+		return (0);
+	}
 
 	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
@@ -357,6 +481,7 @@ http_CollectHdr(struct http *hp, const char *hdr)
 	if (b == NULL)
 		return;
 	hp->nhd = (uint16_t)d;
+	http_hdx_reset(hp);
 	AN(e);
 	*b = '\0';
 	hp->hd[f].b = hp->ws->f;
@@ -391,6 +516,34 @@ http_GetHdr(const struct http *hp, const char *hdr, const char **ptr)
 	return (1);
 }
 
+/*--------------------------------------------------------------------
+ * Same as http_GetHdr() for a well-known header, by its vhdr.h id
+ */
+
+int
+http_GetHdrId(const struct http *hp, unsigned id, const char **ptr)
+{
+	unsigned u;
+	const char *p;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	assert(id > 0 && id < VHDR_NID);
+	http_hdx_sync(hp);
+	u = hp->hdw[id];
+	if (u == 0) {
+		if (ptr != NULL)
+			*ptr = NULL;
+		return (0);
+	}
+	if (ptr != NULL) {
+		p = hp->hd[u].b + strlen(VHDR_Name(id)) + 1;
+		while (vct_issp(*p))
+			p++;
+		*ptr = p;
+	}
+	return (1);
+}
+
 /*-----------------------------------------------------------------------------
  * Split source string at any of the separators, return pointer to first
  * and last+1 char of substrings, with whitespace trimed at both ends.
@@ -530,18 +683,13 @@ http_GetHdrToken(const struct http *hp, const char *hdr,
  * Find a given headerfields Q value.
  */
 
-double
-http_GetHdrQ(const struct http *hp, const char *hdr, const char *field)
+static double
+http_qvalue(const char *hb, const char *he)
 {
-	const char *hb, *he, *b, *e;
-	int i;
+	const char *b, *e;
 	double a, f;
 
-	i = http_GetHdrToken(hp, hdr, field, &hb, &he);
-	if (!i)
-		return (0.);
-
-	if (hb == NULL)
+	if (hb == NULL || hb == he)
 		return (1.);
 	while(http_split(&hb, he, ";", &b, &e)) {
 		if (*b != 'q')
@@ -575,6 +723,46 @@ http_GetHdrQ(const struct http *hp, const char *hdr, const char *field)
 	return (a);
 }
 
+double
+http_GetHdrQ(const struct http *hp, const char *hdr, const char *field)
+{
+	const char *hb, *he;
+
+	if (!http_GetHdrToken(hp, hdr, field, &hb, &he))
+		return (0.);
+	return (http_qvalue(hb, he));
+}
+
+/*--------------------------------------------------------------------
+ * Split a header value like Accept-Encoding into its tokens and their
+ * q values in one pass, for those who look at more than one token.
+ * At most nqv tokens are returned, in the order of the header.
+ */
+
+unsigned
+http_QList(const char *h, struct http_qval *qv, unsigned nqv)
+{
+	const char *b, *e, *p;
+	unsigned n = 0;
+
+	AN(qv);
+	if (h == NULL)
+		return (0);
+	while (n < nqv && http_split(&h, NULL, ",", &b, &e)) {
+		for (p = b; p < e && *p != ';' && !vct_issp(*p); p++)
+			continue;
+		if (p == b)
+			continue;
+		qv[n].b = b;
+		qv[n].e = p;
+		for (; p < e && vct_issp(*p); p++)
+			continue;
+		qv[n].q = http_qvalue(p, e);
+		n++;
+	}
+	return (n);
+}
+
 /*--------------------------------------------------------------------
  * Find a given headerfields value.
  */
@@ -817,6 +1005,114 @@ http_EstimateWS(const struct http *fm, unsigned how)
 	return (PRNDUP(l + 1L));
 }
 
+/*--------------------------------------------------------------------
+ * Dictionary of header lines shared between objects.
+ *
+ * HTTP_Encode() can store a header line it has seen before as a
+ * reference into the dictionary: HDICT_REF followed by the index in
+ * two bytes of seven bits each, with the top bit set, so the packed
+ * headers are still a list of NUL terminated strings.  Entries are
+ * never freed, the decoded headers point straight into them.
+ *
+ * A line is only taken in on its second sighting, and hdict_seen[]
+ * is the (lossy) memory of the first.
+ */
+
+#define HDICT_REF	'\001'
+#define HDICT_MAX	(1U << 14)
+#define HDICT_SLOTS	(HDICT_MAX * 2)
+#define HDICT_SEEN	4096
+
+static struct lock hdict_mtx;
+static const char *hdict_ent[HDICT_MAX];
+static unsigned hdict_len[HDICT_MAX];
+static unsigned hdict_n;
+static uint16_t hdict_slot[HDICT_SLOTS];	/* index + 1 */
+static uint32_t hdict_seen[HDICT_SEEN];
+
+static uint32_t
+hdict_hash(const char *b, unsigned l)
+{
+	uint32_t h = 2166136261U;
+
+	while (l-- > 0)
+		h = (h ^ (uint8_t)*b++) * 16777619U;
+	return (h);
+}
+
+/*
+ * Lines unlikely to be the same across objects would only clog up the
+ * dictionary.
+ */
+
+static int
+hdict_unique(const txt *hh)
+{
+
+	return (http_IsHdr(hh, H_Date) || http_IsHdr(hh, H_Expires) ||
+	    http_IsHdr(hh, H_Last_Modified) || http_IsHdr(hh, H_ETag) ||
+	    http_IsHdr(hh, H_Content_Length) || http_IsHdr(hh, H_Age) ||
+	    http_IsHdr(hh, H_Set_Cookie) || http_IsHdr(hh, H_Location) ||
+	    http_IsHdr(hh, H_Content_MD5) || http_IsHdr(hh, H_Content_Range));
+}
+
+/* Find or add the line, returns the index or -1 */
+
+static int
+hdict_lookup(const txt *hh)
+{
+	unsigned l, u;
+	uint32_t h;
+	char *p;
+	int i;
+
+	Lck_AssertHeld(&hdict_mtx);
+	l = Tlen(*hh);
+	h = hdict_hash(hh->b, l);
+	for (u = h % HDICT_SLOTS; hdict_slot[u] != 0; u = (u + 1) % HDICT_SLOTS) {
+		i = hdict_slot[u] - 1;
+		if (hdict_len[i] == l && !memcmp(hdict_ent[i], hh->b, l))
+			return (i);
+	}
+	if (hdict_seen[h % HDICT_SEEN] != h) {
+		hdict_seen[h % HDICT_SEEN] = h;
+		return (-1);
+	}
+	if (hdict_n >= cache_param->http_hdr_dict || hdict_n >= HDICT_MAX)
+		return (-1);
+	p = malloc(l + 1L);
+	if (p == NULL)
+		return (-1);
+	memcpy(p, hh->b, l);
+	p[l] = '\0';
+	i = hdict_n++;
+	hdict_ent[i] = p;
+	hdict_len[i] = l;
+	hdict_slot[u] = i + 1;
+	VSC_C_main->hdict_entries = hdict_n;
+	return (i);
+}
+
+/* Resolve a packed header line, which may be a dictionary reference */
+
+static const char *
+hdict_get(const char *p, const char **e)
+{
+	unsigned i;
+
+	if (*p != HDICT_REF) {
+		if (e != NULL)
+			*e = strchr(p, '\0');
+		return (p);
+	}
+	assert(p[1] & 0x80 && p[2] & 0x80 && p[3] == '\0');
+	i = ((p[1] & 0x7f) << 7) | (p[2] & 0x7f);
+	assert(i < hdict_n);
+	if (e != NULL)
+		*e = hdict_ent[i] + hdict_len[i];
+	return (hdict_ent[i]);
+}
+
 /*--------------------------------------------------------------------
  * Encode http struct as byte string.
  *
@@ -826,12 +1122,14 @@ http_EstimateWS(const struct http *fm, unsigned how)
  * XXX: It could possibly be a good idea for later HTTP versions.
  */
 
-void
-HTTP_Encode(const struct http *fm, uint8_t *p0, unsigned l, unsigned how)
+unsigned
+HTTP_Encode(const struct http *fm, uint8_t *p0, unsigned l, unsigned how,
+    int dict)
 {
-	unsigned u, w;
+	unsigned u, w, nref = 0;
 	uint16_t n;
 	uint8_t *p, *e;
+	int i;
 
 	AN(p0);
 	AN(l);
@@ -843,6 +1141,8 @@ HTTP_Encode(const struct http *fm, uint8_t *p0, unsigned l, unsigned how)
 	vbe16enc(p + 2, fm->status);
 	p += 4;
 	CHECK_OBJ_NOTNULL(fm, HTTP_MAGIC);
+	if (dict)
+		Lck_Lock(&hdict_mtx);
 	for (u = 0; u < fm->nhd; u++) {
 		if (u == HTTP_HDR_METHOD || u == HTTP_HDR_URL)
 			continue;
@@ -855,14 +1155,80 @@ HTTP_Encode(const struct http *fm, uint8_t *p0, unsigned l, unsigned how)
 #include "tbl/http_headers.h"
 		http_VSLH(fm, u);
 		w = Tlen(fm->hd[u]) + 1L;
-		assert(p + w + 1 <= e);
-		memcpy(p, fm->hd[u].b, w);
-		p += w;
+		i = -1;
+		if (dict && w > 4 && !hdict_unique(&fm->hd[u]))
+			i = hdict_lookup(&fm->hd[u]);
+		if (i >= 0) {
+			assert(p + 5 <= e);
+			*p++ = HDICT_REF;
+			*p++ = 0x80 | (i >> 7);
+			*p++ = 0x80 | (i & 0x7f);
+			*p++ = '\0';
+			nref++;
+		} else {
+			assert(p + w + 1 <= e);
+			memcpy(p, fm->hd[u].b, w);
+			p += w;
+		}
 		n++;
 	}
+	if (dict) {
+		VSC_C_main->hdict_refs += nref;
+		Lck_Unlock(&hdict_mtx);
+	}
 	*p++ = '\0';
 	assert(p <= e);
 	vbe16enc(p0, n + 1);
+	return (p - p0);
+}
+
+/*--------------------------------------------------------------------
+ * Serialize the status line and the headers HTTP_Encode() would keep
+ * as a ready to send HTTP/1 block, followed by its length.  With p0 ==
+ * NULL only the length is calculated.  The headers which depend on the
+ * request and the object age are added at delivery time.
+ */
+
+unsigned
+HTTP_EncodeStatic(const struct http *fm, uint8_t *p0, unsigned l,
+    unsigned how)
+{
+	unsigned u, n = 0;
+
+#define HES(ptr, len)						\
+	do {							\
+		if (p0 != NULL) {				\
+			assert(n + (len) <= l);			\
+			memcpy(p0 + n, (ptr), (len));		\
+		}						\
+		n += (len);					\
+	} while (0)
+
+	CHECK_OBJ_NOTNULL(fm, HTTP_MAGIC);
+	HES("HTTP/1.1 ", 9);
+	HES(fm->hd[HTTP_HDR_STATUS].b, Tlen(fm->hd[HTTP_HDR_STATUS]));
+	HES(" ", 1);
+	HES(fm->hd[HTTP_HDR_REASON].b, Tlen(fm->hd[HTTP_HDR_REASON]));
+	HES("\r\n", 2);
+	for (u = HTTP_HDR_FIRST; u < fm->nhd; u++) {
+		Tcheck(fm->hd[u]);
+		if (fm->hdf[u] & HDF_FILTER)
+			continue;
+#define HTTPH(a, b, c) \
+		if (((c) & how) && http_IsHdr(&fm->hd[u], (b))) \
+			continue;
+#include "tbl/http_headers.h"
+		if (http_IsHdr(&fm->hd[u], H_Content_Length))
+			continue;
+		HES(fm->hd[u].b, Tlen(fm->hd[u]));
+		HES("\r\n", 2);
+	}
+#undef HES
+	if (p0 != NULL) {
+		assert(n + 4 == l);
+		vbe32enc(p0 + n, n);
+	}
+	return (n + 4);
 }
 
 /*--------------------------------------------------------------------
@@ -876,6 +1242,7 @@ HTTP_Decode(struct http *to, const uint8_t *fm)
 	CHECK_OBJ_NOTNULL(to, HTTP_MAGIC);
 	AN(to->vsl);
 	AN(fm);
+	http_hdx_reset(to);
 	if (vbe16dec(fm) <= to->shd) {
 		to->status = vbe16dec(fm + 2);
 		fm += 4;
@@ -888,9 +1255,9 @@ HTTP_Decode(struct http *to, const uint8_t *fm)
 			}
 			if (*fm == '\0')
 				return (0);
-			to->hd[to->nhd].b = (const void*)fm;
+			to->hd[to->nhd].b = hdict_get((const void*)fm,
+			    &to->hd[to->nhd].e);
 			fm = (const void*)strchr((const void*)fm, '\0');
-			to->hd[to->nhd].e = (const void*)fm;
 			fm++;
 			http_VSLH(to, to->nhd);
 		}
@@ -913,6 +1280,32 @@ HTTP_GetStatusPack(struct worker *wrk, struct objcore *oc)
 	return(vbe16dec(ptr + 2));
 }
 
+/*--------------------------------------------------------------------
+ * Find the block from HTTP_EncodeStatic() at the end of OA_HEADERS
+ */
+
+const char *
+HTTP_GetStatic(struct worker *wrk, struct objcore *oc, unsigned *lp)
+{
+	const char *ptr;
+	ssize_t len;
+	unsigned l;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(lp);
+
+	if (!ObjCheckFlag(wrk, oc, OF_STATIC))
+		return (NULL);
+	ptr = ObjGetAttr(wrk, oc, OA_HEADERS, &len);
+	AN(ptr);
+	assert(len > 4);
+	l = vbe32dec(ptr + len - 4);
+	assert(l + 4 < len);
+	*lp = l;
+	return (ptr + len - 4 - l);
+}
+
 /*--------------------------------------------------------------------*/
 
 /* Get the first packed header */
@@ -944,7 +1337,7 @@ HTTP_IterHdrPack(struct worker *wrk, struct objcore *oc, const char **p)
 const char *
 HTTP_GetHdrPack(struct worker *wrk, struct objcore *oc, const char *hdr)
 {
-	const char *ptr;
+	const char *ptr, *pp;
 	unsigned l;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -964,17 +1357,18 @@ HTTP_GetHdrPack(struct worker *wrk, struct objcore *oc, const char *hdr)
 		ptr += 4;	/* Skip nhd and status */
 
 		if (!strcmp(hdr, ":proto:"))
-			return (ptr);
+			return (hdict_get(ptr, NULL));
 		ptr = strchr(ptr, '\0') + 1;
 		if (!strcmp(hdr, ":status:"))
-			return (ptr);
+			return (hdict_get(ptr, NULL));
 		ptr = strchr(ptr, '\0') + 1;
 		if (!strcmp(hdr, ":reason:"))
-			return (ptr);
+			return (hdict_get(ptr, NULL));
 		WRONG("Unknown magic packed header");
 	}
 
-	HTTP_FOREACH_PACK(wrk, oc, ptr) {
+	HTTP_FOREACH_PACK(wrk, oc, pp) {
+		ptr = hdict_get(pp, NULL);
 		if (!strncasecmp(ptr, hdr, l)) {
 			ptr += l;
 			while (vct_islws(*ptr))
@@ -996,7 +1390,7 @@ HTTP_Merge(struct worker *wrk, struct objcore *oc, struct http *to)
 {
 	const char *ptr;
 	unsigned u;
-	const char *p;
+	const char *p, *h;
 	unsigned nhd_before_merge;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -1012,16 +1406,17 @@ HTTP_Merge(struct worker *wrk, struct objcore *oc, struct http *to)
 	for (u = 0; u < HTTP_HDR_FIRST; u++) {
 		if (u == HTTP_HDR_METHOD || u == HTTP_HDR_URL)
 			continue;
-		http_SetH(to, u, ptr);
+		http_SetH(to, u, hdict_get(ptr, NULL));
 		ptr = strchr(ptr, '\0') + 1;
 	}
 	nhd_before_merge = to->nhd;
 	while (*ptr != '\0') {
-		p = strchr(ptr, ':');
+		h = hdict_get(ptr, NULL);
+		p = strchr(h, ':');
 		AN(p);
-		u = http_findhdr(to, p - ptr, ptr);
+		u = http_findhdr(to, p - h, h);
 		if (u == 0 || u >= nhd_before_merge)
-			http_SetHeader(to, ptr);
+			http_SetHeader(to, h);
 		ptr = strchr(ptr, '\0') + 1;
 	}
 }
@@ -1036,6 +1431,7 @@ http_filterfields(struct http *to, const struct http *fm, unsigned how)
 	CHECK_OBJ_NOTNULL(fm, HTTP_MAGIC);
 	CHECK_OBJ_NOTNULL(to, HTTP_MAGIC);
 	to->nhd = HTTP_HDR_FIRST;
+	http_hdx_reset(to);
 	to->status = fm->status;
 	for (u = HTTP_HDR_FIRST; u < fm->nhd; u++) {
 		Tcheck(fm->hd[u]);
@@ -1194,7 +1590,11 @@ http_Unset(struct http *hp, const char *hdr)
 {
 	uint16_t u, v;
 
-	for (v = u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+	/* Headers before the first one to go stay where they are */
+	v = (uint16_t)http_findhdr(hp, hdr[0] - 1, hdr + 1);
+	if (v == 0)
+		return;
+	for (u = v; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
 		if (http_IsHdr(&hp->hd[u], hdr)) {
 			http_VSLH_del(hp, u);
@@ -1207,6 +1607,7 @@ http_Unset(struct http *hp, const char *hdr)
 		v++;
 	}
 	hp->nhd = v;
+	http_hdx_reset(hp);
 }
 
 /*--------------------------------------------------------------------*/
@@ -1217,4 +1618,6 @@ HTTP_Init(void)
 
 #define HTTPH(a, b, c) b[0] = (char)strlen(b + 1);
 #include "tbl/http_headers.h"
+	VHDR_Init();
+	Lck_New(&hdict_mtx, lck_hdict);
 }
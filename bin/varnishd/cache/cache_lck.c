@@ -40,6 +40,13 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+
+#include "cache_priv.h"
+#include "vcli_serve.h"
+#include "vtim.h"
+
+struct lck_site;
 
 struct ilck {
 	unsigned		magic;
@@ -49,10 +56,160 @@ struct ilck {
 	pthread_t		owner;
 	const char		*w;
 	struct VSC_C_lck	*stat;
+	struct lck_site		*site;
+	double			t_held;
+	unsigned		spinner;
+	unsigned		spin;
 };
 
 static pthread_mutexattr_t attr;
 
+/*--------------------------------------------------------------------
+ * Adaptive spinning for the LOCK_SPIN() classes.
+ *
+ * A thread which finds such a lock held watches it for a while before
+ * it goes to sleep in the kernel.  Like the glibc adaptive mutexes,
+ * each lock keeps a running average of how long it took to get, and
+ * spins for at most twice that, capped by the lock_spin parameter.
+ * On a single CPU the holder cannot run while we spin, so we don't.
+ */
+
+#if defined(__i386__) || defined(__x86_64__)
+#  define LCK_PAUSE()	__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#  define LCK_PAUSE()	__asm__ __volatile__("yield")
+#else
+#  define LCK_PAUSE()	do { } while (0)
+#endif
+
+#define LCK_NSPINCLASS		8
+
+static struct VSC_C_lck *lck_spinclass[LCK_NSPINCLASS];
+static unsigned lck_nspinclass;
+static int lck_nospin;
+
+static void
+lck_spin(struct ilck *il)
+{
+	unsigned u, max;
+	int r = EBUSY;
+
+	max = cache_param->lock_spin;
+	if (max > il->spin * 2 + 10)
+		max = il->spin * 2 + 10;
+	for (u = 0; u < max; u++) {
+		LCK_PAUSE();
+		if (*(volatile int *)&il->held)
+			continue;
+		r = pthread_mutex_trylock(&il->mtx);
+		if (r == 0)
+			break;
+		assert(r == EBUSY);
+	}
+	if (r != 0)
+		AZ(pthread_mutex_lock(&il->mtx));
+	else
+		il->stat->spun++;
+	/* Under the lock now */
+	if (u > il->spin)
+		il->spin += (u - il->spin + 7) / 8;
+	else
+		il->spin -= (il->spin - u) / 8;
+}
+
+/*--------------------------------------------------------------------
+ * Contention profiling.
+ *
+ * While the lck_profile debug bit is set, the time spent waiting for
+ * and holding locks is accounted to the lock class, and to the call
+ * site which took the lock.  Sites are never removed from the table,
+ * so lookups need no lock, only adding a site does.
+ */
+
+struct lck_site {
+	const char * volatile	p;
+	int			l;
+	const char		*w;
+	uint64_t		locks;
+	uint64_t		contended;
+	uint64_t		trylock_fail;
+	uint64_t		wait_ns;
+	uint64_t		hold_ns;
+};
+
+#define LCK_NSITE		1024
+
+static struct lck_site lck_sites[LCK_NSITE];
+static pthread_mutex_t lck_site_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static struct lck_site *
+lck_site(const struct ilck *il, const char *p, int l)
+{
+	struct lck_site *s;
+	uintptr_t h;
+	unsigned u;
+
+	h = ((uintptr_t)p >> 2) ^ ((uintptr_t)il->w >> 2) ^ (l * 2654435761U);
+	for (u = 0; u < LCK_NSITE; u++) {
+		s = &lck_sites[(h + u) % LCK_NSITE];
+		if (s->p == NULL) {
+			AZ(pthread_mutex_lock(&lck_site_mtx));
+			if (s->p == NULL) {
+				s->l = l;
+				s->w = il->w;
+				__sync_synchronize();
+				s->p = p;
+			}
+			AZ(pthread_mutex_unlock(&lck_site_mtx));
+		}
+		if (s->p == p && s->l == l && s->w == il->w)
+			return (s);
+	}
+	return (NULL);
+}
+
+static void
+lck_wait(struct ilck *il, struct lck_site *s, double dt)
+{
+	struct VSC_C_lck *st = il->stat;
+
+	st->wait_us += (uint64_t)(dt * 1e6);
+#define LCK_WAIT(n, d, i, b, sec)		\
+	if (dt <= sec)				\
+		st->wait_##b++;			\
+	else
+	VSC_LAT_BUCKETS(LCK_WAIT, , )
+#undef LCK_WAIT
+		WRONG("lock wait histogram");
+	if (s != NULL)
+		(void)__sync_add_and_fetch(&s->wait_ns, (uint64_t)(dt * 1e9));
+}
+
+static void
+lck_hold_begin(struct ilck *il, struct lck_site *s)
+{
+
+	il->site = s;
+	il->t_held = VTIM_mono();
+	if (s != NULL)
+		(void)__sync_add_and_fetch(&s->locks, 1);
+}
+
+static void
+lck_hold_end(struct ilck *il)
+{
+	double dt;
+
+	if (il->t_held == 0.)
+		return;
+	dt = VTIM_mono() - il->t_held;
+	il->t_held = 0.;
+	il->stat->hold_us += (uint64_t)(dt * 1e6);
+	if (il->site != NULL)
+		(void)__sync_add_and_fetch(&il->site->hold_ns,
+		    (uint64_t)(dt * 1e9));
+}
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -106,15 +263,38 @@ void __match_proto__()
 Lck__Lock(struct lock *lck, const char *p, int l)
 {
 	struct ilck *ilck;
+	struct lck_site *s = NULL;
+	double t = 0.;
+	int r;
 
 	CAST_OBJ_NOTNULL(ilck, lck->priv, ILCK_MAGIC);
 	if (DO_DEBUG(DBG_WITNESS))
 		Lck_Witness_Lock(ilck, p, l, "");
-	AZ(pthread_mutex_lock(&ilck->mtx));
+	r = pthread_mutex_trylock(&ilck->mtx);
+	if (r != 0) {
+		assert(r == EBUSY);
+		if (DO_DEBUG(DBG_LCK_PROFILE))
+			t = VTIM_mono();
+		if (ilck->spinner && !lck_nospin && cache_param->lock_spin > 0)
+			lck_spin(ilck);
+		else
+			AZ(pthread_mutex_lock(&ilck->mtx));
+	}
 	AZ(ilck->held);
 	ilck->stat->locks++;
 	ilck->owner = pthread_self();
 	ilck->held = 1;
+	if (DO_DEBUG(DBG_LCK_PROFILE))
+		s = lck_site(ilck, p, l);
+	if (r != 0) {
+		ilck->stat->contended++;
+		if (s != NULL)
+			(void)__sync_add_and_fetch(&s->contended, 1);
+		if (t != 0.)
+			lck_wait(ilck, s, VTIM_mono() - t);
+	}
+	if (DO_DEBUG(DBG_LCK_PROFILE))
+		lck_hold_begin(ilck, s);
 }
 
 void __match_proto__()
@@ -128,6 +308,7 @@ Lck__Unlock(struct lock *lck, const char *p, int l)
 	CAST_OBJ_NOTNULL(ilck, lck->priv, ILCK_MAGIC);
 	assert(pthread_equal(ilck->owner, pthread_self()));
 	AN(ilck->held);
+	lck_hold_end(ilck);
 	ilck->held = 0;
 	/*
 	 * #ifdef POSIX_STUPIDITY:
@@ -149,6 +330,7 @@ int __match_proto__()
 Lck__Trylock(struct lock *lck, const char *p, int l)
 {
 	struct ilck *ilck;
+	struct lck_site *s;
 	int r;
 
 	CAST_OBJ_NOTNULL(ilck, lck->priv, ILCK_MAGIC);
@@ -161,6 +343,14 @@ Lck__Trylock(struct lock *lck, const char *p, int l)
 		ilck->held = 1;
 		ilck->stat->locks++;
 		ilck->owner = pthread_self();
+		if (DO_DEBUG(DBG_LCK_PROFILE))
+			lck_hold_begin(ilck, lck_site(ilck, p, l));
+	} else {
+		/* Not under the lock, so the class counter is approximate */
+		ilck->stat->trylock_fail++;
+		if (DO_DEBUG(DBG_LCK_PROFILE) &&
+		    (s = lck_site(ilck, p, l)) != NULL)
+			(void)__sync_add_and_fetch(&s->trylock_fail, 1);
 	}
 	return (r);
 }
@@ -188,6 +378,7 @@ int __match_proto__()
 Lck_CondWait(pthread_cond_t *cond, struct lock *lck, double when)
 {
 	struct ilck *ilck;
+	struct lck_site *s;
 	int retval = 0;
 	struct timespec ts;
 	double t;
@@ -195,6 +386,8 @@ Lck_CondWait(pthread_cond_t *cond, struct lock *lck, double when)
 	CAST_OBJ_NOTNULL(ilck, lck->priv, ILCK_MAGIC);
 	AN(ilck->held);
 	assert(pthread_equal(ilck->owner, pthread_self()));
+	s = ilck->site;
+	lck_hold_end(ilck);
 	ilck->held = 0;
 	if (when == 0) {
 		AZ(pthread_cond_wait(cond, &ilck->mtx));
@@ -209,6 +402,8 @@ Lck_CondWait(pthread_cond_t *cond, struct lock *lck, double when)
 	AZ(ilck->held);
 	ilck->held = 1;
 	ilck->owner = pthread_self();
+	if (DO_DEBUG(DBG_LCK_PROFILE))
+		lck_hold_begin(ilck, s);
 	return (retval);
 }
 
@@ -216,6 +411,7 @@ void
 Lck__New(struct lock *lck, struct VSC_C_lck *st, const char *w)
 {
 	struct ilck *ilck;
+	unsigned u;
 
 	AN(st);
 	AN(w);
@@ -224,7 +420,10 @@ Lck__New(struct lock *lck, struct VSC_C_lck *st, const char *w)
 	AN(ilck);
 	ilck->w = w;
 	ilck->stat = st;
-	ilck->stat->creat++;
+	(void)__sync_add_and_fetch(&ilck->stat->creat, 1);
+	for (u = 0; u < lck_nspinclass; u++)
+		if (lck_spinclass[u] == st)
+			ilck->spinner = 1;
 	AZ(pthread_mutex_init(&ilck->mtx, &attr));
 	lck->priv = ilck;
 }
@@ -241,6 +440,81 @@ Lck_Delete(struct lock *lck)
 	FREE_OBJ(ilck);
 }
 
+/*--------------------------------------------------------------------*/
+
+static int
+lck_site_cmp(const void *a, const void *b)
+{
+	const struct lck_site * const *sa = a;
+	const struct lck_site * const *sb = b;
+	int i;
+
+	i = ((*sa)->wait_ns < (*sb)->wait_ns) -
+	    ((*sa)->wait_ns > (*sb)->wait_ns);
+	if (i == 0)
+		i = ((*sa)->hold_ns < (*sb)->hold_ns) -
+		    ((*sa)->hold_ns > (*sb)->hold_ns);
+	return (i);
+}
+
+static void __match_proto__(cli_func_t)
+lck_cli_profile(struct cli *cli, const char * const *av, void *priv)
+{
+	struct lck_site *s, *sort[LCK_NSITE];
+	const char *w;
+	unsigned u, n = 0;
+
+	(void)priv;
+	if (av[2] != NULL && strcmp(av[2], "-r")) {
+		VCLI_Out(cli, "Unknown argument '%s'", av[2]);
+		VCLI_SetResult(cli, CLIS_PARAM);
+		return;
+	}
+	for (u = 0; u < LCK_NSITE; u++) {
+		s = &lck_sites[u];
+		if (s->p == NULL)
+			continue;
+		if (av[2] != NULL) {
+			s->locks = s->contended = s->trylock_fail = 0;
+			s->wait_ns = s->hold_ns = 0;
+		} else if (s->locks != 0 || s->trylock_fail != 0)
+			sort[n++] = s;
+	}
+	if (av[2] != NULL)
+		return;
+	if (n == 0) {
+		VCLI_Out(cli, "No lock profile, set the lck_profile debug bit");
+		return;
+	}
+	qsort(sort, n, sizeof *sort, lck_site_cmp);
+	VCLI_Out(cli, "%-17s %12s %10s %8s %12s %12s  %s\n", "class",
+	    "locks", "contended", "tryfail", "wait_us", "hold_us", "site");
+	for (u = 0; u < n; u++) {
+		s = sort[u];
+		w = s->w;
+		if (!strncmp(w, "lck_", 4))
+			w += 4;
+		VCLI_Out(cli, "%-17s %12ju %10ju %8ju %12ju %12ju  %s:%d\n",
+		    w, (uintmax_t)s->locks, (uintmax_t)s->contended,
+		    (uintmax_t)s->trylock_fail, (uintmax_t)(s->wait_ns / 1000),
+		    (uintmax_t)(s->hold_ns / 1000), s->p, s->l);
+	}
+}
+
+static struct cli_proto lck_cmds[] = {
+	{ CLICMD_DEBUG_LOCK_PROFILE,		"d", lck_cli_profile },
+	{ NULL }
+};
+
+void
+LCK_InitCli(void)
+{
+
+	CLI_AddFuncs(lck_cmds);
+}
+
+/*--------------------------------------------------------------------*/
+
 struct VSC_C_lck *
 Lck_CreateClass(const char *name)
 {
@@ -260,5 +534,10 @@ LCK_Init(void)
 	AZ(pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK));
 #endif
 #define LOCK(nam)	lck_##nam = Lck_CreateClass(#nam);
+#define LOCK_SPIN(nam)						\
+	LOCK(nam)						\
+	assert(lck_nspinclass < LCK_NSPINCLASS);		\
+	lck_spinclass[lck_nspinclass++] = lck_##nam;
 #include "tbl/locks.h"
+	lck_nospin = sysconf(_SC_NPROCESSORS_ONLN) <= 1;
 }
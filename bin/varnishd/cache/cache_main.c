@@ -228,29 +228,38 @@ child_main(void)
 	Lck_New(&vxid_lock, lck_vxid);
 
 	CLI_Init();
+	LCK_InitCli();
 	PAN_Init();
 	VFP_Init();
+	VGZ_Init();
 
 	ObjInit();
 
 	VCL_Init();
 
 	HTTP_Init();
+	SYN_Init();
+	TAG_Init();
+	WRM_Init();
+	ADM_Init();
 
 	VBO_Init();
 	VBP_Init();
 	VBE_InitCfg();
 	Pool_Init();
 	V1P_Init();
-	V2D_Init();
 
 	EXP_Init();
 	HSH_Init(heritage.hash);
 	BAN_Init();
 
 	VCA_Init();
+#if defined(HAVE_OPENSSL)
+	TLS_Init();
+#endif
 
 	STV_open();
+	SNP_Init();
 
 	VMOD_Init();
 
@@ -259,6 +268,7 @@ child_main(void)
 	VRND_SeedAll();
 
 	CLI_AddFuncs(debug_cmds);
+	BCH_Init();
 
 	/* Wait for persistent storage to load if asked to */
 	if (FEATURE(FEATURE_WAIT_SILO))
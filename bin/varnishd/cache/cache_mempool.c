@@ -48,6 +48,43 @@ struct memitem {
 
 VTAILQ_HEAD(memhead_s, memitem);
 
+/*
+ * A thread can have a small magazine of items for a few pools, so it
+ * only takes the pool lock for every MPL_MAG_BULK items.  Items in a
+ * magazine are not in the pool, but they are not live either: the live
+ * gauge counts items handed out by MPL_Get(), and like the allocs and
+ * frees counters it learns about the unlocked ones in mpl_mag_sync().
+ */
+
+#define MPL_MAG_SIZE			4
+#define MPL_MAG_BULK			(MPL_MAG_SIZE / 2)
+#define MPL_MAG_MAX			4
+
+struct mpl_mag {
+	struct mempool			*mpl;
+	unsigned			n;
+	unsigned			allocs;
+	unsigned			frees;
+	unsigned			hits;
+	struct memitem			*mi[MPL_MAG_SIZE];
+};
+
+struct mpl_mags {
+	unsigned			magic;
+#define MPL_MAGS_MAGIC			0x1d6a2f61
+	struct mpl_mag			mag[MPL_MAG_MAX];
+};
+
+static pthread_key_t			mpl_mag_key;
+static pthread_once_t			mpl_mag_once = PTHREAD_ONCE_INIT;
+
+static void
+mpl_mag_init(void)
+{
+
+	AZ(pthread_key_create(&mpl_mag_key, NULL));
+}
+
 struct mempool {
 	unsigned			magic;
 #define MEMPOOL_MAGIC			0x37a75a8d
@@ -57,7 +94,9 @@ struct mempool {
 	struct lock			mtx;
 	volatile struct poolparam	*param;
 	volatile unsigned		*cur_size;
-	uint64_t			live;
+	mpl_extra_f			*extra;
+	uint64_t			live;		/* Not in the pool */
+	int64_t				used;		/* Handed out */
 	struct VSC_C_mempool		*vsc;
 	unsigned			n_pool;
 	pthread_t			thread;
@@ -65,6 +104,22 @@ struct mempool {
 	int				self_destruct;
 };
 
+/*---------------------------------------------------------------------
+ * The size we want items to be right now: the parameter, plus what the
+ * user of the pool needs on top of it, see MPL_Extra().
+ */
+
+static unsigned
+mpl_size(const struct mempool *mpl)
+{
+	unsigned sz;
+
+	sz = *mpl->cur_size;
+	if (mpl->extra != NULL)
+		sz += mpl->extra();
+	return (sz);
+}
+
 /*---------------------------------------------------------------------
  */
 
@@ -75,7 +130,7 @@ mpl_alloc(const struct mempool *mpl)
 	struct memitem *mi;
 
 	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
-	tsz = *mpl->cur_size;
+	tsz = mpl_size(mpl);
 	mi = calloc(tsz, 1);
 	AN(mi);
 	mi->magic = MEMITEM_MAGIC;
@@ -109,7 +164,7 @@ mpl_guard(void *priv)
 		mpl->t_now = VTIM_real();
 
 		if (mi != NULL && (mpl->n_pool > mpl->param->max_pool ||
-		    mi->size < *mpl->cur_size)) {
+		    mi->size < mpl_size(mpl))) {
 			FREE_OBJ(mi);
 			mi = NULL;
 		}
@@ -136,8 +191,13 @@ mpl_guard(void *priv)
 		if (Lck_Trylock(&mpl->mtx))
 			continue;
 
+		if (mpl->self_destruct && mpl->live > 0) {
+			/* Dead threads still returning their magazines */
+			Lck_Unlock(&mpl->mtx);
+			continue;
+		}
+
 		if (mpl->self_destruct) {
-			AZ(mpl->live);
 			while (1) {
 				if (mi == NULL) {
 					mi = VTAILQ_FIRST(&mpl->list);
@@ -166,7 +226,7 @@ mpl_guard(void *priv)
 		}
 
 		if (mpl->n_pool < mpl->param->min_pool &&
-		    mi != NULL && mi->size >= *mpl->cur_size) {
+		    mi != NULL && mi->size >= mpl_size(mpl)) {
 			CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
 			mpl->vsc->pool = ++mpl->n_pool;
 			mi->touched = mpl->t_now;
@@ -227,6 +287,7 @@ MPL_New(const char *name,
 {
 	struct mempool *mpl;
 
+	AZ(pthread_once(&mpl_mag_once, mpl_mag_init));
 	ALLOC_OBJ(mpl, MEMPOOL_MAGIC);
 	AN(mpl);
 	bprintf(mpl->name, "MPL_%s", name);
@@ -245,8 +306,23 @@ MPL_New(const char *name,
 }
 
 /*---------------------------------------------------------------------
- * Destroy a memory pool.  There must be no live items, and we cheat
- * and leave all the hard work to the guard thread.
+ * Make items bigger than the size parameter says, for bookkeeping which
+ * should not be paid for out of the workspace the user configured.
+ * Items already in the pool which are too small get replaced.
+ */
+
+void
+MPL_Extra(struct mempool *mpl, mpl_extra_f *func)
+{
+
+	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
+	mpl->extra = func;
+}
+
+/*---------------------------------------------------------------------
+ * Destroy a memory pool.  The only live items may be in the magazines
+ * of threads on their way out, and we cheat and leave all the hard
+ * work to the guard thread.
  */
 
 void
@@ -256,37 +332,78 @@ MPL_Destroy(struct mempool **mpp)
 
 	TAKE_OBJ_NOTNULL(mpl, mpp, MEMPOOL_MAGIC);
 	Lck_Lock(&mpl->mtx);
-	AZ(mpl->live);
 	mpl->self_destruct = 1;
 	Lck_Unlock(&mpl->mtx);
 }
 
 /*---------------------------------------------------------------------
+ * Magazines
  */
 
-void *
-MPL_Get(struct mempool *mpl, unsigned *size)
+static struct mpl_mag *
+mpl_mag_find(const struct mempool *mpl)
 {
-	struct memitem *mi;
+	struct mpl_mags *mm;
+	unsigned u;
+
+	mm = pthread_getspecific(mpl_mag_key);
+	if (mm == NULL)
+		return (NULL);
+	CHECK_OBJ(mm, MPL_MAGS_MAGIC);
+	for (u = 0; u < MPL_MAG_MAX; u++)
+		if (mm->mag[u].mpl == mpl)
+			return (&mm->mag[u]);
+	return (NULL);
+}
 
-	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
-	AN(size);
+/*
+ * Publish the live gauge.  An item taken from a magazine may be freed on
+ * another thread before its MPL_Get() was folded in, so we may briefly
+ * be behind.
+ */
 
-	Lck_Lock(&mpl->mtx);
+static void
+mpl_used(const struct mempool *mpl)
+{
 
-	mpl->vsc->allocs++;
-	mpl->vsc->live = ++mpl->live;
+	Lck_AssertHeld(&mpl->mtx);
+	mpl->vsc->live = mpl->used > 0 ? (uint64_t)mpl->used : 0;
+}
+
+/* Fold the unlocked counts of the magazine into the pool's VSC */
 
+static void
+mpl_mag_sync(struct mempool *mpl, struct mpl_mag *mag)
+{
+
+	Lck_AssertHeld(&mpl->mtx);
+	mpl->vsc->allocs += mag->allocs;
+	mpl->vsc->frees += mag->frees;
+	mpl->vsc->mag_hit += mag->hits;
+	mpl->used += mag->allocs;
+	mpl->used -= mag->frees;
+	mpl_used(mpl);
+	mag->allocs = 0;
+	mag->frees = 0;
+	mag->hits = 0;
+}
+
+/* Take an item off the pool, NULL if it ran dry */
+
+static struct memitem *
+mpl_take(struct mempool *mpl)
+{
+	struct memitem *mi;
+
+	Lck_AssertHeld(&mpl->mtx);
 	do {
 		mi = VTAILQ_FIRST(&mpl->list);
-		if (mi == NULL) {
-			mpl->vsc->randry++;
+		if (mi == NULL)
 			break;
-		}
 		mpl->vsc->pool = --mpl->n_pool;
 		CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
 		VTAILQ_REMOVE(&mpl->list, mi, list);
-		if (mi->size < *mpl->cur_size) {
+		if (mi->size < mpl_size(mpl)) {
 			mpl->vsc->toosmall++;
 			VTAILQ_INSERT_HEAD(&mpl->surplus, mi, list);
 			mi = NULL;
@@ -294,6 +411,164 @@ MPL_Get(struct mempool *mpl, unsigned *size)
 			mpl->vsc->recycle++;
 		}
 	} while (mi == NULL);
+	return (mi);
+}
+
+/* Return a (cleared) item to the pool */
+
+static void
+mpl_put(struct mempool *mpl, struct memitem *mi)
+{
+
+	Lck_AssertHeld(&mpl->mtx);
+	CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
+	if (mi->size < mpl_size(mpl)) {
+		mpl->vsc->toosmall++;
+		VTAILQ_INSERT_HEAD(&mpl->surplus, mi, list);
+	} else {
+		mpl->vsc->pool = ++mpl->n_pool;
+		mi->touched = mpl->t_now;
+		VTAILQ_INSERT_HEAD(&mpl->list, mi, list);
+	}
+}
+
+/*---------------------------------------------------------------------
+ * Give the calling thread a magazine for this pool, if it has room.
+ * MPL_Drain() must be called before the thread exits.
+ */
+
+void
+MPL_Magazine(struct mempool *mpl)
+{
+	struct mpl_mags *mm;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
+	mm = pthread_getspecific(mpl_mag_key);
+	if (mm == NULL) {
+		ALLOC_OBJ(mm, MPL_MAGS_MAGIC);
+		AN(mm);
+		AZ(pthread_setspecific(mpl_mag_key, mm));
+	}
+	CHECK_OBJ(mm, MPL_MAGS_MAGIC);
+	for (u = 0; u < MPL_MAG_MAX; u++) {
+		AZ(mm->mag[u].mpl == mpl);
+		if (mm->mag[u].mpl == NULL) {
+			mm->mag[u].mpl = mpl;
+			return;
+		}
+	}
+}
+
+/*
+ * Publish the counts of the calling thread's magazines, on a quiet
+ * moment and only where the pool lock is free.
+ */
+
+void
+MPL_SyncStats(void)
+{
+	struct mpl_mags *mm;
+	struct mpl_mag *mag;
+	unsigned u;
+
+	mm = pthread_getspecific(mpl_mag_key);
+	if (mm == NULL)
+		return;
+	CHECK_OBJ(mm, MPL_MAGS_MAGIC);
+	for (u = 0; u < MPL_MAG_MAX; u++) {
+		mag = &mm->mag[u];
+		if (mag->mpl == NULL || mag->hits == 0)
+			continue;
+		if (Lck_Trylock(&mag->mpl->mtx))
+			continue;
+		mpl_mag_sync(mag->mpl, mag);
+		Lck_Unlock(&mag->mpl->mtx);
+	}
+}
+
+void
+MPL_Drain(void)
+{
+	struct mpl_mags *mm;
+	struct mpl_mag *mag;
+	struct mempool *mpl;
+	unsigned u;
+
+	mm = pthread_getspecific(mpl_mag_key);
+	if (mm == NULL)
+		return;
+	CHECK_OBJ(mm, MPL_MAGS_MAGIC);
+	for (u = 0; u < MPL_MAG_MAX; u++) {
+		mag = &mm->mag[u];
+		mpl = mag->mpl;
+		if (mpl == NULL)
+			continue;
+		CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
+		Lck_Lock(&mpl->mtx);
+		mpl_mag_sync(mpl, mag);
+		while (mag->n > 0) {
+			mpl_put(mpl, mag->mi[--mag->n]);
+			mpl->live--;
+		}
+		Lck_Unlock(&mpl->mtx);
+	}
+	AZ(pthread_setspecific(mpl_mag_key, NULL));
+	FREE_OBJ(mm);
+}
+
+/*---------------------------------------------------------------------
+ */
+
+void *
+MPL_Get(struct mempool *mpl, unsigned *size)
+{
+	struct mpl_mag *mag;
+	struct memitem *mi;
+
+	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
+	AN(size);
+
+	mag = mpl_mag_find(mpl);
+	if (mag != NULL && mag->n > 0) {
+		mi = mag->mi[mag->n - 1];
+		CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
+		if (mi->size >= mpl_size(mpl)) {
+			mag->n--;
+			mag->allocs++;
+			mag->hits++;
+			*size = mi->size - sizeof *mi;
+			return ((void*)(uintptr_t)(mi+1));
+		}
+	}
+
+	Lck_Lock(&mpl->mtx);
+
+	mpl->vsc->allocs++;
+	mpl->live++;
+	mpl->used++;
+	mpl_used(mpl);
+
+	if (mag != NULL) {
+		mpl_mag_sync(mpl, mag);
+		mpl->vsc->mag_miss++;
+		/* Anything left is too small now */
+		while (mag->n > 0) {
+			mpl_put(mpl, mag->mi[--mag->n]);
+			mpl->live--;
+		}
+		while (mag->n < MPL_MAG_BULK) {
+			mi = mpl_take(mpl);
+			if (mi == NULL)
+				break;
+			mag->mi[mag->n++] = mi;
+			mpl->live++;
+		}
+	}
+
+	mi = mpl_take(mpl);
+	if (mi == NULL)
+		mpl->vsc->randry++;
 
 	Lck_Unlock(&mpl->mtx);
 
@@ -306,35 +581,69 @@ MPL_Get(struct mempool *mpl, unsigned *size)
 	return ((void*)(uintptr_t)(mi+1));
 }
 
+/*---------------------------------------------------------------------
+ * Return an item to the pool, clearing only the first `used` bytes.
+ *
+ * Items come out of MPL_Get() with those bytes zero, anything beyond
+ * may hold stale data from earlier users.
+ */
+
 void
-MPL_Free(struct mempool *mpl, void *item)
+MPL_FreeUsed(struct mempool *mpl, void *item, size_t used)
 {
 	struct memitem *mi;
+	struct mpl_mag *mag;
 
 	CHECK_OBJ_NOTNULL(mpl, MEMPOOL_MAGIC);
 	AN(item);
 
 	mi = (void*)((uintptr_t)item - sizeof(*mi));
 	CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
-	memset(item, 0, mi->size - sizeof *mi);
+	if (used > mi->size - sizeof *mi)
+		used = mi->size - sizeof *mi;
+	memset(item, 0, used);
+
+	mag = mpl_mag_find(mpl);
+	if (mag != NULL && mag->n < MPL_MAG_SIZE &&
+	    mi->size >= mpl_size(mpl)) {
+		mag->mi[mag->n++] = mi;
+		mag->frees++;
+		mag->hits++;
+		return;
+	}
 
 	Lck_Lock(&mpl->mtx);
 
 	mpl->vsc->frees++;
-	mpl->vsc->live = --mpl->live;
-
-	if (mi->size < *mpl->cur_size) {
-		mpl->vsc->toosmall++;
-		VTAILQ_INSERT_HEAD(&mpl->surplus, mi, list);
-	} else {
-		mpl->vsc->pool = ++mpl->n_pool;
-		mi->touched = mpl->t_now;
-		VTAILQ_INSERT_HEAD(&mpl->list, mi, list);
+	mpl->live--;
+	mpl->used--;
+	mpl_used(mpl);
+
+	if (mag != NULL) {
+		mpl_mag_sync(mpl, mag);
+		mpl->vsc->mag_miss++;
+		while (mag->n > MPL_MAG_BULK) {
+			mpl_put(mpl, mag->mi[--mag->n]);
+			mpl->live--;
+		}
 	}
 
+	mpl_put(mpl, mi);
+
 	Lck_Unlock(&mpl->mtx);
 }
 
+void
+MPL_Free(struct mempool *mpl, void *item)
+{
+	struct memitem *mi;
+
+	AN(item);
+	mi = (void*)((uintptr_t)item - sizeof(*mi));
+	CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
+	MPL_FreeUsed(mpl, item, mi->size - sizeof *mi);
+}
+
 void
 MPL_AssertSane(void *item)
 {
@@ -86,6 +86,8 @@
 #include "cache.h"
 #include "cache_obj.h"
 #include "vend.h"
+#include "vmb.h"
+#include "vtim.h"
 #include "storage/storage.h"
 #include "hash/hash_slinger.h"
 
@@ -182,7 +184,27 @@ ObjIterate(struct worker *wrk, struct objcore *oc,
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	AN(func);
 	AN(om->objiterator);
-	return (om->objiterator(wrk, oc, priv, func, final));
+	return (om->objiterator(wrk, oc, priv, func, final, 0));
+}
+
+/*====================================================================
+ * ObjIterateFrom()
+ *
+ * As ObjIterate(), but starting at byte 'off' of the body.  The stevedore
+ * skips the storage before it without handing it to func.
+ */
+
+int
+ObjIterateFrom(struct worker *wrk, struct objcore *oc, ssize_t off,
+    void *priv, objiterate_f *func, int final)
+{
+	const struct obj_methods *om = obj_getmethods(oc);
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(func);
+	assert(off >= 0);
+	AN(om->objiterator);
+	return (om->objiterator(wrk, oc, priv, func, final, off));
 }
 
 /*====================================================================
@@ -209,28 +231,64 @@ ObjGetSpace(struct worker *wrk, struct objcore *oc, ssize_t *sz, uint8_t **ptr)
 	return (om->objgetspace(wrk, oc, sz, ptr));
 }
 
+/*====================================================================
+ * With a transit buffer, the fetch waits for the client to catch up,
+ * unless the client abandoned it.  The client signals the cond when it
+ * gets further, and HSH_Abandon() when it is done.
+ */
+
+static void
+obj_extend_condwait(const struct objcore *oc)
+{
+
+	Lck_AssertHeld(&oc->boc->mtx);
+	if (oc->boc->transit_buffer == 0)
+		return;
+	assert(oc->flags & OC_F_PRIVATE);
+	while (!(oc->flags & OC_F_ABANDON) && oc->boc->len_so_far >
+	    oc->boc->delivered_so_far + oc->boc->transit_buffer)
+		(void)Lck_CondWait(&oc->boc->cond, &oc->boc->mtx, 0);
+}
+
 /*====================================================================
  * ObjExtend()
  *
  * This function extends the used part of the object a number of bytes
  * into the last space returned by ObjGetSpace()
+ *
+ * Streaming clients are only woken up once stream_wakeup_bytes have
+ * been added or stream_wakeup_interval has passed since the last time.
+ * ObjWaitExtend() does not wait longer than that for the bytes which
+ * did not wake it.  With transit_buffer the fetch waits for the client
+ * in turn, so it has to wake it every time.
  */
 
 void
 ObjExtend(struct worker *wrk, struct objcore *oc, ssize_t l)
 {
 	const struct obj_methods *om = obj_getmethods(oc);
+	double now = 0.;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc->boc, BOC_MAGIC);
 	assert(l > 0);
 
+	if (cache_param->stream_wakeup_bytes > 0)
+		now = VTIM_real();
 	Lck_Lock(&oc->boc->mtx);
 	AN(om->objextend);
 	om->objextend(wrk, oc, l);
 	oc->boc->len_so_far += l;
+	if (now == 0. || oc->boc->transit_buffer > 0 ||
+	    oc->boc->len_so_far - oc->boc->len_woken >=
+	    cache_param->stream_wakeup_bytes ||
+	    now - oc->boc->t_woken >= cache_param->stream_wakeup_interval) {
+		oc->boc->len_woken = oc->boc->len_so_far;
+		oc->boc->t_woken = now;
+		AZ(pthread_cond_broadcast(&oc->boc->cond));
+	}
+	obj_extend_condwait(oc);
 	Lck_Unlock(&oc->boc->mtx);
-	AZ(pthread_cond_broadcast(&oc->boc->cond));
 }
 
 /*====================================================================
@@ -240,17 +298,27 @@ uint64_t
 ObjWaitExtend(const struct worker *wrk, const struct objcore *oc, uint64_t l)
 {
 	uint64_t rv;
+	double when = 0.;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_NOTNULL(oc->boc, BOC_MAGIC);
+	if (cache_param->stream_wakeup_bytes > 0)
+		when = VTIM_real() + cache_param->stream_wakeup_interval;
 	Lck_Lock(&oc->boc->mtx);
+	if (oc->boc->transit_buffer > 0 && l > oc->boc->delivered_so_far) {
+		/* Let the fetch know how far the client got */
+		oc->boc->delivered_so_far = l;
+		AZ(pthread_cond_broadcast(&oc->boc->cond));
+	}
 	while (1) {
 		rv = oc->boc->len_so_far;
 		assert(l <= rv || oc->boc->state == BOS_FAILED);
 		if (rv > l || oc->boc->state >= BOS_FINISHED)
 			break;
-		(void)Lck_CondWait(&oc->boc->cond, &oc->boc->mtx, 0);
+		if (Lck_CondWait(&oc->boc->cond, &oc->boc->mtx, when) != 0 &&
+		    rv == oc->boc->len_so_far)
+			when = 0.;	/* ObjExtend() will wake us */
 	}
 	rv = oc->boc->len_so_far;
 	Lck_Unlock(&oc->boc->mtx);
@@ -361,6 +429,60 @@ ObjSlim(struct worker *wrk, struct objcore *oc)
 		om->objslim(wrk, oc);
 }
 
+/*====================================================================
+ * Once the boc is gone the attributes can no longer change, so the few
+ * small ones which every hit looks at are copied into the objcore, to
+ * spare the hit path a trip to the object in storage.
+ */
+
+static uint8_t *
+obj_inlineattr(struct objcore *oc, enum obj_attr attr, ssize_t *sz)
+{
+
+	switch (attr) {
+	case OA_FLAGS:
+		*sz = sizeof oc->oa_flags;
+		return (oc->oa_flags);
+	case OA_LEN:
+		*sz = sizeof oc->oa_len;
+		return (oc->oa_len);
+	case OA_LASTMODIFIED:
+		*sz = sizeof oc->oa_lastmodified;
+		return (oc->oa_lastmodified);
+	default:
+		return (NULL);
+	}
+}
+
+static void
+obj_inline(struct worker *wrk, struct objcore *oc,
+    const struct obj_methods *m)
+{
+	static const enum obj_attr oas[] = {
+		OA_FLAGS, OA_LEN, OA_LASTMODIFIED
+	};
+	const void *vp;
+	uint8_t *dst;
+	ssize_t l, sz;
+	uint16_t inl = 0;
+	unsigned u;
+
+	AN(m->objgetattr);
+	for (u = 0; u < sizeof oas / sizeof oas[0]; u++) {
+		if (!(oc->oa_present & (1 << oas[u])))
+			continue;
+		dst = obj_inlineattr(oc, oas[u], &sz);
+		AN(dst);
+		vp = m->objgetattr(wrk, oc, oas[u], &l);
+		if (vp == NULL || l != sz)
+			continue;
+		memcpy(dst, vp, sz);
+		inl |= 1 << oas[u];
+	}
+	VWMB();
+	oc->oa_inline = inl;
+}
+
 /*====================================================================
  * Called when the boc used to populate the objcore is going away.
  * Useful for releasing any leftovers from Trim.
@@ -378,6 +500,8 @@ ObjBocDone(struct worker *wrk, struct objcore *oc, struct boc **boc)
 		m = obj_getmethods(oc);
 		if (m->objbocdone != NULL)
 			m->objbocdone(wrk, oc, *boc);
+		if ((*boc)->state == BOS_FINISHED)
+			obj_inline(wrk, oc, m);
 	}
 	obj_deleteboc(boc);
 }
@@ -391,6 +515,7 @@ ObjFreeObj(struct worker *wrk, struct objcore *oc)
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 
+	oc->oa_inline = 0;
 	AN(m->objfree);
 	m->objfree(wrk, oc);
 	AZ(oc->stobj->stevedore);
@@ -424,15 +549,32 @@ ObjHasAttr(struct worker *wrk, struct objcore *oc, enum obj_attr attr)
  * Returns NULL on unset or zero length attributes and len set to
  * zero. Returns Non-NULL otherwise and len is updated with the attributes
  * length.
+ *
+ * Attributes copied into the objcore by ObjBocDone() are served from
+ * there.
  */
 
 const void *
 ObjGetAttr(struct worker *wrk, struct objcore *oc, enum obj_attr attr,
    ssize_t *len)
 {
-	const struct obj_methods *om = obj_getmethods(oc);
+	const struct obj_methods *om;
+	const uint8_t *p;
+	ssize_t sz;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	if (oc->oa_inline & (1 << attr)) {
+		VRMB();
+		p = obj_inlineattr(oc, attr, &sz);
+		AN(p);
+		if (len != NULL)
+			*len = sz;
+		return (p);
+	}
+
+	om = obj_getmethods(oc);
 
 	AN(om->objgetattr);
 	return (om->objgetattr(wrk, oc, attr, len));
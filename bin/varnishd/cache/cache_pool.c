@@ -36,6 +36,7 @@
 #include "config.h"
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "cache.h"
@@ -43,6 +44,11 @@
 
 static pthread_t		thr_pool_herder;
 
+#define POOL_NUMA_MAX		64
+
+static struct pool_numa		pool_numa[POOL_NUMA_MAX];
+static unsigned			pool_nnuma;
+
 static struct lock		wstat_mtx;
 struct lock			pool_mtx;
 static VTAILQ_HEAD(,pool)	pools = VTAILQ_HEAD_INITIALIZER(pools);
@@ -51,37 +57,61 @@ static VTAILQ_HEAD(,pool)	pools = VTAILQ_HEAD_INITIALIZER(pools);
  * Summing of stats into global stats counters
  */
 
+/*--------------------------------------------------------------------
+ * Fold a dstat into the shared memory counters.
+ *
+ * Most fields are zero in any given batch, and the rest go in with an
+ * atomic add each, so no worker ever waits for another to publish.
+ * Gauges which went down arrive as wrapped deltas, which is fine.
+ */
+
+#define POOL_SUMSTAT(dst, val) do {					\
+		if ((val) != 0)						\
+			(void)__sync_add_and_fetch(&(dst), (val));	\
+	} while (0)
+
 static void
-pool_sumstat(const struct dstat *src)
+pool_sumstat(const struct dstat *src, const struct pool *pp)
 {
+	struct VSC_C_numa *vn;
 
-	Lck_AssertHeld(&wstat_mtx);
 #define L0(n)
-#define L1(n) (VSC_C_main->n += src->n)
+#define L1(n) POOL_SUMSTAT(VSC_C_main->n, src->n)
 #define VSC_FF(n,t,l,s,f,v,d,e)	L##l(n);
 #include "tbl/vsc_f_main.h"
 #undef L0
 #undef L1
+#define LAT_B(n, d, i, b, s)						\
+	POOL_SUMSTAT(VSC_C_main->lat_##n##_##b, src->lat[LAT_##n][i]);
+#define VSC_LAT(n, d)	VSC_LAT_BUCKETS(LAT_B, n, d)
+#include "tbl/vsc_lat.h"
+#undef LAT_B
+	if (pp == NULL || pp->numa == NULL)
+		return;
+	vn = pp->numa->stats;
+	POOL_SUMSTAT(vn->sess, src->sess_conn);
+	POOL_SUMSTAT(vn->req, src->client_req);
+	POOL_SUMSTAT(vn->fetch, src->s_fetch);
 }
 
 void
 Pool_Sumstat(struct worker *wrk)
 {
 
-	Lck_Lock(&wstat_mtx);
-	pool_sumstat(wrk->stats);
-	Lck_Unlock(&wstat_mtx);
+	pool_sumstat(wrk->stats, wrk->pool);
 	memset(wrk->stats, 0, sizeof *wrk->stats);
 }
 
+/*
+ * Kept for the callers which used to give up on a busy lock, there is
+ * no lock to be busy anymore.
+ */
+
 int
 Pool_TrySumstat(struct worker *wrk)
 {
-	if (Lck_Trylock(&wstat_mtx))
-		return (0);
-	pool_sumstat(wrk->stats);
-	Lck_Unlock(&wstat_mtx);
-	memset(wrk->stats, 0, sizeof *wrk->stats);
+
+	Pool_Sumstat(wrk);
 	return (1);
 }
 
@@ -107,6 +137,47 @@ Pool_Task_Any(struct pool_task *task, enum task_prio prio)
 	return (Pool_Task(pp, task, prio));
 }
 
+/*--------------------------------------------------------------------
+ * Take a queued task from another pool for an idle worker of pp.
+ *
+ * The caller holds pp->mtx, so we only ever try the other locks, and
+ * give up rather than wait:  The herder will breed threads in the pool
+ * which queued the task anyway.
+ */
+
+struct pool_task *
+pool_steal(const struct pool *pp, int prio_lim)
+{
+	struct pool *vp;
+	struct pool_task *tp = NULL;
+	int i;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	Lck_AssertHeld(&pp->mtx);
+	if (prio_lim > TASK_QUEUE_VCA)
+		prio_lim = TASK_QUEUE_VCA;
+	if (Lck_Trylock(&pool_mtx))
+		return (NULL);
+	VTAILQ_FOREACH(vp, &pools, list) {
+		if (vp == pp || vp->die || vp->lqueue == 0)
+			continue;
+		if (Lck_Trylock(&vp->mtx))
+			continue;
+		for (i = 0; i < prio_lim; i++) {
+			tp = VTAILQ_FIRST(&vp->queues[i]);
+			if (tp != NULL) {
+				pool_unqueue(vp, i, tp);
+				break;
+			}
+		}
+		Lck_Unlock(&vp->mtx);
+		if (tp != NULL)
+			break;
+	}
+	Lck_Unlock(&pool_mtx);
+	return (tp);
+}
+
 /*--------------------------------------------------------------------
  * Helper function to update stats for purges under lock
  */
@@ -133,14 +204,87 @@ pool_stat_summ(struct worker *wrk, void *priv)
 	CHECK_OBJ_NOTNULL(wrk->pool, POOL_MAGIC);
 	AN(priv);
 	src = priv;
-	Lck_Lock(&wstat_mtx);
-	pool_sumstat(src);
-	Lck_Unlock(&wstat_mtx);
+	pool_sumstat(src, wrk->pool);
 	memset(src, 0, sizeof *src);
 	AZ(wrk->pool->b_stat);
 	wrk->pool->b_stat = src;
 }
 
+/*--------------------------------------------------------------------
+ * Find the NUMA nodes and their CPUs
+ *
+ * Linux tells us in /sys, anywhere else we do not bind the pools.
+ */
+
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP)
+
+static int
+pool_numa_cpulist(const char *p, cpu_set_t *cs)
+{
+	char *e;
+	unsigned long lo, hi;
+
+	CPU_ZERO(cs);
+	while (*p != '\0' && *p != '\n') {
+		lo = strtoul(p, &e, 10);
+		if (e == p)
+			return (-1);
+		hi = lo;
+		if (*e == '-') {
+			p = e + 1;
+			hi = strtoul(p, &e, 10);
+			if (e == p || hi < lo)
+				return (-1);
+		}
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+			CPU_SET(lo, cs);
+		p = e;
+		if (*p == ',')
+			p++;
+	}
+	return (CPU_COUNT(cs) > 0 ? 0 : -1);
+}
+
+static void
+pool_numa_init(void)
+{
+	struct pool_numa *pn;
+	char fn[64], buf[BUFSIZ];
+	FILE *f;
+	unsigned u;
+	int i;
+
+	for (u = 0; u < POOL_NUMA_MAX; u++) {
+		bprintf(fn, "/sys/devices/system/node/node%u/cpulist", u);
+		f = fopen(fn, "r");
+		if (f == NULL)
+			break;
+		pn = &pool_numa[pool_nnuma];
+		INIT_OBJ(pn, POOL_NUMA_MAGIC);
+		i = (fgets(buf, sizeof buf, f) == NULL ||
+		    pool_numa_cpulist(buf, &pn->cpus));
+		(void)fclose(f);
+		if (i)		/* A node without CPUs */
+			continue;
+		pn->node = u;
+		bprintf(fn, "%u", u);
+		pn->stats = VSM_Alloc(sizeof *pn->stats,
+		    VSC_CLASS, VSC_type_numa, fn);
+		AN(pn->stats);
+		memset(pn->stats, 0, sizeof *pn->stats);
+		pool_nnuma++;
+	}
+}
+
+#else
+
+static void
+pool_numa_init(void)
+{
+}
+
+#endif
+
 /*--------------------------------------------------------------------
  * Add a thread pool
  */
@@ -149,11 +293,19 @@ static struct pool *
 pool_mkpool(unsigned pool_no)
 {
 	struct pool *pp;
-	int i;
+	int i, j;
 
 	ALLOC_OBJ(pp, POOL_MAGIC);
 	if (pp == NULL)
 		return (NULL);
+	pp->pool_no = pool_no;
+	if (pool_nnuma > 0) {
+		pp->numa = &pool_numa[pool_no % pool_nnuma];
+		CHECK_OBJ(pp->numa, POOL_NUMA_MAGIC);
+		Lck_Lock(&wstat_mtx);
+		pp->numa->stats->pools++;
+		Lck_Unlock(&wstat_mtx);
+	}
 	pp->a_stat = calloc(1, sizeof *pp->a_stat);
 	AN(pp->a_stat);
 	pp->b_stat = calloc(1, sizeof *pp->b_stat);
@@ -164,13 +316,19 @@ pool_mkpool(unsigned pool_no)
 	VTAILQ_INIT(&pp->poolsocks);
 	for (i = 0; i < TASK_QUEUE_END; i++)
 		VTAILQ_INIT(&pp->queues[i]);
+	for (i = 0; i < POOL_FQ_PRIOS; i++) {
+		VTAILQ_INIT(&pp->fq_active[i]);
+		for (j = 0; j < POOL_FQ_BUCKETS; j++)
+			VTAILQ_INIT(&pp->fq[i][j].tasks);
+	}
 	AZ(pthread_cond_init(&pp->herder_cond, NULL));
+	/* Before the workers, which want magazines for its mempools */
+	SES_NewPool(pp, pool_no);
 	AZ(pthread_create(&pp->herder_thr, NULL, pool_herder, pp));
 
 	while (VTAILQ_EMPTY(&pp->idle_queue))
 		(void)usleep(10000);
 
-	SES_NewPool(pp, pool_no);
 	VCA_NewPool(pp);
 
 	return (pp);
@@ -239,6 +397,11 @@ pool_poolherder(void *priv)
 			AZ(pthread_cond_destroy(&ppx->herder_cond));
 			free(ppx->a_stat);
 			free(ppx->b_stat);
+			if (ppx->numa != NULL) {
+				Lck_Lock(&wstat_mtx);
+				ppx->numa->stats->pools--;
+				Lck_Unlock(&wstat_mtx);
+			}
 			SES_DestroyPool(ppx);
 			FREE_OBJ(ppx);
 			VSC_C_main->pools--;
@@ -257,6 +420,8 @@ Pool_Init(void)
 
 	Lck_New(&wstat_mtx, lck_wstat);
 	Lck_New(&pool_mtx, lck_wq);
+	if (cache_param->wthread_numa)
+		pool_numa_init();
 	AZ(pthread_create(&thr_pool_herder, NULL, pool_poolherder, NULL));
 	while (!VSC_C_main->pools)
 		(void)usleep(10000);
@@ -29,14 +29,36 @@
  * Private include file for the pool aware code.
  */
 
-VTAILQ_HEAD(taskhead, pool_task);
-
 struct poolsock;
 
+struct pool_numa {
+	unsigned			magic;
+#define POOL_NUMA_MAGIC			0x5e1a0c2d
+	unsigned			node;
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP)
+	cpu_set_t			cpus;
+#endif
+	struct VSC_C_numa		*stats;
+};
+
+/* Fair queuing buckets, see thread_queue_fair */
+#define POOL_FQ_PRIOS		(TASK_QUEUE_BULK - TASK_QUEUE_HIGH + 1)
+#define POOL_FQ_BUCKETS		128
+
+struct pool_fq {
+	struct taskhead			tasks;
+	VTAILQ_ENTRY(pool_fq)		list;
+	unsigned			deficit;
+};
+
+VTAILQ_HEAD(pool_fqhead, pool_fq);
+
 struct pool {
 	unsigned			magic;
 #define POOL_MAGIC			0x606658fa
 	VTAILQ_ENTRY(pool)		list;
+	unsigned			pool_no;
+	struct pool_numa		*numa;
 	VTAILQ_HEAD(,poolsock)		poolsocks;
 
 	int				die;
@@ -50,8 +72,23 @@ struct pool {
 	unsigned			nthr;
 	unsigned			dry;
 	unsigned			lqueue;
+
+	/* Herder state, see thread_pool_predict */
+	unsigned			h_lqueue;
+	double				h_idle;
 	uintmax_t			ndropped;
 	uintmax_t			nqueued;
+	uintmax_t			nshed;
+
+	/* Queue delay, see thread_queue_target */
+	double				t_above[TASK_QUEUE_END];
+	unsigned			shed;
+	unsigned			wfq;
+
+	/* Deficit round robin of client keys, see thread_queue_fair */
+	struct pool_fqhead		fq_active[POOL_FQ_PRIOS];
+	struct pool_fq			fq[POOL_FQ_PRIOS][POOL_FQ_BUCKETS];
+
 	struct dstat			*a_stat;
 	struct dstat			*b_stat;
 
@@ -62,6 +99,8 @@ struct pool {
 
 void *pool_herder(void*);
 task_func_t pool_stat_summ;
+struct pool_task *pool_steal(const struct pool *, int prio_lim);
+void pool_unqueue(struct pool *, int prio, struct pool_task *);
 extern struct lock			pool_mtx;
 void VCA_NewPool(struct pool *);
 void VCA_DestroyPool(struct pool *);
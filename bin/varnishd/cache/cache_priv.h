@@ -42,6 +42,9 @@ void VBE_Poll(void);
 /* cache_backend_poll.c */
 void VBP_Init(void);
 
+/* cache_bench.c [BCH] */
+void BCH_Init(void);
+
 /* cache_exp.c */
 double EXP_Ttl(const struct req *, const struct objcore *);
 void EXP_Insert(struct worker *wrk, struct objcore *oc);
@@ -59,6 +62,7 @@ int BAN_CheckObject(struct worker *, struct objcore *, struct req *);
 
 /* cache_busyobj.c */
 void VBO_Init(void);
+void VBO_Magazine(void);
 
 /* cache_cli.c [CLI] */
 void CLI_Init(void);
@@ -71,6 +75,9 @@ void EXP_Init(void);
 /* cache_fetch_proc.c */
 void VFP_Init(void);
 
+/* cache_gzip.c */
+void VGZ_Init(void);
+
 /* cache_http.c */
 void HTTP_Init(void);
 
@@ -84,6 +91,7 @@ struct req * THR_GetRequest(void);
 
 /* cache_lck.c */
 void LCK_Init(void);
+void LCK_InitCli(void);
 
 /* cache_obj.c */
 void ObjInit(void);
@@ -108,6 +116,19 @@ void VSL_ChgId(struct vsl_log *vsl, const char *typ, const char *why,
     uint32_t vxid);
 void VSL_End(struct vsl_log *vsl);
 
+/* cache_synth.c [SYN] */
+void SYN_Init(void);
+void SYN_Flush(const struct vcl *);
+
+/* cache_tag.c */
+void TAG_Init(void);
+
+/* cache_warm.c [WRM] */
+void WRM_Init(void);
+
+/* cache_admit.c */
+void ADM_Init(void);
+
 /* cache_vcl.c */
 struct director *VCL_DefaultDirector(const struct vcl *);
 const struct vrt_backend_probe *VCL_DefaultProbe(const struct vcl *);
@@ -126,6 +147,11 @@ void VMOD_Panic(struct vsb *);
 /* http1/cache_http1_pipe.c */
 void V1P_Init(void);
 
+/* tls/cache_tls.c */
+#if defined(HAVE_OPENSSL)
+void TLS_Init(void);
+#endif
+
 /* stevedore.c */
 void STV_open(void);
 void STV_close(void);
@@ -135,6 +161,9 @@ int STV_BanInfoDrop(const uint8_t *ban, unsigned len);
 int STV_BanInfoNew(const uint8_t *ban, unsigned len);
 void STV_BanExport(const uint8_t *banlist, unsigned len);
 
+/* storage_snapshot.c [SNP] */
+void SNP_Init(void);
+
 /* storage_persistent.c */
 void SMP_Ready(void);
 
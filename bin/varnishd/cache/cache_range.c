@@ -27,28 +27,68 @@
  * SUCH DAMAGE.
  */
 
+
 #include "config.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "cache/cache.h"
 #include "cache/cache_filter.h"
 
 #include "vct.h"
+#include "vrnd.h"
 
 /*--------------------------------------------------------------------*/
 
+struct vrg_part {
+	ssize_t			low;
+	ssize_t			high;
+	const char		*hdr;
+};
+
 struct vrg_priv {
 	unsigned		magic;
 #define VRG_PRIV_MAGIC		0xb886e711
 	ssize_t			range_low;
 	ssize_t			range_high;
 	ssize_t			range_off;
+
+	/* multipart/byteranges */
+	struct req		*req;
+	struct vrg_part		*part;
+	unsigned		n_part;
+	unsigned		i_part;
+	const char		*hdr;
+	const char		*closing;
 };
 
-static int __match_proto__(vdp_bytes)
-vrg_range_bytes(struct req *req, enum vdp_action act, void **priv,
+/*
+ * Move on to the next part of a multipart/byteranges response, returns
+ * zero when there are no more.
+ */
+
+static int
+vrg_next_part(struct vrg_priv *vrg_priv)
+{
+	const struct vrg_part *vp;
+
+	if (vrg_priv->part == NULL ||
+	    vrg_priv->i_part + 1 >= vrg_priv->n_part)
+		return (0);
+	vp = &vrg_priv->part[++vrg_priv->i_part];
+	vrg_priv->range_low = vp->low;
+	vrg_priv->range_high = vp->high;
+	vrg_priv->hdr = vp->hdr;
+	return (1);
+}
+
+int __match_proto__(vdp_bytes)
+VDP_range(struct req *req, enum vdp_action act, void **priv,
     const void *ptr, ssize_t len)
 {
-	int retval = 0;
+	int retval = 0, done = 0;
+	enum vdp_action act2 = VDP_NULL;
 	ssize_t l;
 	const char *p = ptr;
 	struct vrg_priv *vrg_priv;
@@ -64,37 +104,145 @@ vrg_range_bytes(struct req *req, enum vdp_action act, void **priv,
 		return (0);
 	}
 
-	l = vrg_priv->range_low - vrg_priv->range_off;
-	if (l > 0) {
+	do {
+		l = vrg_priv->range_low - vrg_priv->range_off;
+		if (l > 0) {
+			if (l > len)
+				l = len;
+			vrg_priv->range_off += l;
+			p += l;
+			len -= l;
+		}
+		l = vrg_priv->range_high - vrg_priv->range_off;
 		if (l > len)
 			l = len;
-		vrg_priv->range_off += l;
-		p += l;
-		len -= l;
-	}
-	l = vrg_priv->range_high - vrg_priv->range_off;
-	if (l > len)
-		l = len;
-	if (l > 0)
-		retval = VDP_bytes(req, act, p, l);
-	else if (act > VDP_NULL)
+		if (l > 0 && vrg_priv->hdr != NULL) {
+			retval = VDP_bytes(req, VDP_NULL, vrg_priv->hdr,
+			    strlen(vrg_priv->hdr));
+			vrg_priv->hdr = NULL;
+		}
+		if (l > 0 && !retval) {
+			act2 = (l == len || vrg_priv->part == NULL) ?
+			    act : VDP_NULL;
+			retval = VDP_bytes(req, act2, p, l);
+			vrg_priv->range_off += l;
+			p += l;
+			len -= l;
+		}
+		if (vrg_priv->range_off < vrg_priv->range_high)
+			break;
+		if (!vrg_next_part(vrg_priv)) {
+			done = 1;
+			if (vrg_priv->closing != NULL && !retval)
+				retval = VDP_bytes(req, VDP_NULL,
+				    vrg_priv->closing,
+				    strlen(vrg_priv->closing));
+		}
+	} while (len > 0 && !done && !retval);
+
+	if (act > VDP_NULL && act2 != act && !retval)
 		retval = VDP_bytes(req, act, p, 0);
-	vrg_priv->range_off += len;
-	return (retval ||
-	    vrg_priv->range_off >= vrg_priv->range_high ? 1 : 0);
+	return (retval || done ? 1 : 0);
 }
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * When we are the first VDP, the bytes before each range need not be
+ * read at all, the stevedore can skip straight to where it starts.
+ */
 
-static const char *
-vrg_dorange(struct req *req, const char *r)
+static int __match_proto__(objiterate_f)
+vrg_objiterator(void *priv, int flush, const void *ptr, ssize_t len)
 {
-	ssize_t low, high, has_low, has_high, t;
 	struct vrg_priv *vrg_priv;
+	unsigned i;
+	int r;
 
-	if (strncasecmp(r, "bytes=", 6))
-		return ("Not Bytes");
-	r += 6;
+	CAST_OBJ_NOTNULL(vrg_priv, priv, VRG_PRIV_MAGIC);
+	i = vrg_priv->i_part;
+	r = VDP_bytes(vrg_priv->req, flush ? VDP_FLUSH : VDP_NULL, ptr, len);
+	if (r)
+		return (r);
+	/* Go look for the next part rather than read our way to it */
+	return (vrg_priv->i_part != i ? 1 : 0);
+}
+
+int
+VRG_DeliverObj(struct req *req, void *priv, int final)
+{
+	struct vrg_priv *vrg_priv;
+	int r;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CAST_OBJ_NOTNULL(vrg_priv, priv, VRG_PRIV_MAGIC);
+	assert(vrg_priv->req == req);
+
+	/* Private objects can only free their storage in a single pass */
+	if (vrg_priv->n_part > 1)
+		final = 0;
+	do {
+		if (vrg_priv->range_off < vrg_priv->range_low)
+			vrg_priv->range_off = vrg_priv->range_low;
+		r = ObjIterateFrom(req->wrk, req->objcore,
+		    vrg_priv->range_off, vrg_priv, vrg_objiterator, final);
+	} while (r > 0 && req->vdp_retval == 0);
+	return (r);
+}
+
+/*--------------------------------------------------------------------
+ * Without a length, a bounded range can be served once the fetch has got
+ * past its end, so we wait for that before the headers go out.  If the
+ * fetch finishes first, we know the length after all, and the range is
+ * cut short or unsatisfiable (r01777).
+ *
+ * This only works if nothing but us sits between the stored bytes and
+ * the client, and not with a transit buffer, where the fetch would be
+ * waiting for us.  Returns -1 if the range cannot be served this way.
+ */
+
+static int
+vrg_wait(struct req *req, ssize_t high)
+{
+	struct boc *boc;
+	enum boc_state_e state;
+	uint64_t l, tb;
+
+	if (!VTAILQ_EMPTY(&req->vdp))
+		return (-1);
+	boc = req->objcore->boc;
+	if (boc == NULL)
+		return (-1);
+	CHECK_OBJ(boc, BOC_MAGIC);
+	Lck_Lock(&boc->mtx);
+	l = boc->len_so_far;
+	state = boc->state;
+	tb = boc->transit_buffer;
+	Lck_Unlock(&boc->mtx);
+	if (tb > 0)
+		return (-1);
+	while (l <= (uint64_t)high && state < BOS_FINISHED) {
+		l = ObjWaitExtend(req->wrk, req->objcore, l);
+		Lck_Lock(&boc->mtx);
+		state = boc->state;
+		Lck_Unlock(&boc->mtx);
+	}
+	if (state == BOS_FAILED)
+		return (-1);
+	if (state == BOS_FINISHED)
+		req->resp_len = ObjGetLen(req->wrk, req->objcore);
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Parse one byte-range-spec, leaving *pp at the ',' or NUL after it.
+ * A *plow of -1 means we should deliver the entire object.
+ */
+
+static const char *
+vrg_parse(struct req *req, const char **pp, ssize_t *plow,
+    ssize_t *phigh)
+{
+	ssize_t low, high, has_low, has_high, t;
+	const char *r = *pp;
 
 	/* The low end of range */
 	has_low = low = 0;
@@ -121,12 +269,16 @@ vrg_dorange(struct req *req, const char *r)
 			return ("High number too big");
 	}
 
-	if (*r != '\0')
+	while (*r == ' ' || *r == '\t')
+		r++;
+	if (*r != '\0' && *r != ',')
 		return ("Trailing stuff");
+	*pp = r;
 
 	if (has_high + has_low == 0)
 		return ("Neither high nor low");
 
+	*plow = -1;
 	if (!has_low) {
 		if (req->resp_len < 0)
 			return (NULL);		// Allow 200 response
@@ -138,8 +290,15 @@ vrg_dorange(struct req *req, const char *r)
 		high = req->resp_len - 1;
 	} else if (req->resp_len >= 0 && (high >= req->resp_len || !has_high))
 		high = req->resp_len - 1;
-	else if (!has_high || req->resp_len < 0)
+	else if (!has_high)
 		return (NULL);			// Allow 200 response
+	else if (req->resp_len < 0) {
+		if (vrg_wait(req, high))
+			return (NULL);		// Allow 200 response
+		/* The object may have ended short of the range */
+		if (req->resp_len >= 0 && high >= req->resp_len)
+			high = req->resp_len - 1;
+	}
 	/*
 	 * else (bo != NULL) {
 	 *    We assume that the client knows what it's doing and trust
@@ -147,19 +306,156 @@ vrg_dorange(struct req *req, const char *r)
 	 * }
 	 */
 
+	if (req->resp_len >= 0 && low >= req->resp_len) {
+		/* Unsatisfiable */
+		*plow = low;
+		*phigh = low;
+		return (NULL);
+	}
+
 	if (high < low)
 		return ("high smaller than low");
 
-	if (req->resp_len >= 0 && low >= req->resp_len)
-		return ("low range beyond object");
+	*plow = low;
+	*phigh = high + 1;
+	return (NULL);
+}
+
+static int
+vrg_cmp(const void *a, const void *b)
+{
+	const struct vrg_part *pa = a, *pb = b;
+
+	if (pa->low != pb->low)
+		return (pa->low < pb->low ? -1 : 1);
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * RFC7233 4.1: We may coalesce overlapping ranges, and we send the parts
+ * in ascending order, so the object can be delivered in a single pass.
+ */
+
+static unsigned
+vrg_coalesce(struct vrg_part *part, unsigned n)
+{
+	unsigned u, v;
+
+	qsort(part, n, sizeof *part, vrg_cmp);
+	for (u = 0, v = 1; v < n; v++) {
+		if (part[v].low <= part[u].high) {
+			if (part[v].high > part[u].high)
+				part[u].high = part[v].high;
+		} else
+			part[++u] = part[v];
+	}
+	return (u + 1);
+}
+
+/*--------------------------------------------------------------------*/
+
+/*
+ * While the object is still being fetched without a Content-Length, we
+ * only get here with bounded ranges, and the parts give "*" as the
+ * length the way a single range does.
+ */
+
+static const char *
+vrg_multipart(struct req *req, struct vrg_part *part, unsigned n,
+    struct vrg_priv *vrg_priv)
+{
+	const char *boundary, *ct, *cth;
+	char tot[24];
+	ssize_t len = 0;
+	unsigned u;
 
 	if (req->resp_len >= 0)
-		http_PrintfHeader(req->resp, "Content-Range: bytes %jd-%jd/%jd",
-		    (intmax_t)low, (intmax_t)high, (intmax_t)req->resp_len);
+		bprintf(tot, "%jd", (intmax_t)req->resp_len);
+	else
+		bprintf(tot, "%s", "*");
+	boundary = WS_Printf(req->ws, "%08lx%08lx",
+	    VRND_RandomTestable(), VRND_RandomTestable());
+	if (boundary == NULL)
+		return ("WS too small");
+	if (http_GetHdr(req->resp, H_Content_Type, &ct))
+		cth = WS_Printf(req->ws, "Content-Type: %s\r\n", ct);
 	else
-		http_PrintfHeader(req->resp, "Content-Range: bytes %jd-%jd/*",
-		    (intmax_t)low, (intmax_t)high);
-	req->resp_len = (intmax_t)(1 + high - low);
+		cth = "";
+	if (cth == NULL)
+		return ("WS too small");
+
+	for (u = 0; u < n; u++) {
+		part[u].hdr = WS_Printf(req->ws,
+		    "\r\n--%s\r\n%sContent-Range: bytes %jd-%jd/%s\r\n\r\n",
+		    boundary, cth, (intmax_t)part[u].low,
+		    (intmax_t)part[u].high - 1, tot);
+		if (part[u].hdr == NULL)
+			return ("WS too small");
+		len += strlen(part[u].hdr) + part[u].high - part[u].low;
+	}
+	vrg_priv->closing = WS_Printf(req->ws, "\r\n--%s--\r\n", boundary);
+	if (vrg_priv->closing == NULL)
+		return ("WS too small");
+	len += strlen(vrg_priv->closing);
+
+	vrg_priv->part = part;
+	vrg_priv->n_part = n;
+	vrg_priv->hdr = part[0].hdr;
+
+	http_Unset(req->resp, H_Content_Type);
+	http_PrintfHeader(req->resp,
+	    "Content-Type: multipart/byteranges; boundary=%s", boundary);
+	req->resp_len = len;
+	return (NULL);
+}
+
+static const char *
+vrg_dorange(struct req *req, const char *r)
+{
+	ssize_t low, high;
+	struct vrg_priv *vrg_priv;
+	struct vrg_part *part;
+	const char *err, *q;
+	unsigned n, u, np;
+
+	if (strncasecmp(r, "bytes=", 6))
+		return ("Not Bytes");
+	r += 6;
+
+	for (n = 1, q = r; *q != '\0'; q++)
+		if (*q == ',')
+			n++;
+	if (n > cache_param->http_max_ranges)
+		return (NULL);			// Allow 200 response
+
+	part = WS_Alloc(req->ws, n * sizeof *part);
+	if (part == NULL)
+		return ("WS too small");
+
+	for (u = np = 0; u < n; u++) {
+		while (*r == ' ' || *r == '\t')
+			r++;
+		err = vrg_parse(req, &r, &low, &high);
+		if (err != NULL)
+			return (err);
+		if (*r == ',')
+			r++;
+		if (low < 0)
+			return (NULL);		// Allow 200 response
+		/* RFC7233 4.4: Ignore the unsatisfiable ones */
+		if (req->resp_len >= 0 && low >= req->resp_len)
+			continue;
+		part[np].low = low;
+		part[np].high = high;
+		part[np].hdr = NULL;
+		np++;
+	}
+	AZ(*r);
+
+	if (np == 0)
+		return ("low range beyond object");
+	if (np > 1)
+		np = vrg_coalesce(part, np);
 
 	vrg_priv = WS_Alloc(req->ws, sizeof *vrg_priv);
 	if (vrg_priv == NULL)
@@ -167,10 +463,29 @@ vrg_dorange(struct req *req, const char *r)
 
 	XXXAN(vrg_priv);
 	INIT_OBJ(vrg_priv, VRG_PRIV_MAGIC);
+	vrg_priv->req = req;
 	vrg_priv->range_off = 0;
-	vrg_priv->range_low = low;
-	vrg_priv->range_high = high + 1;
-	VDP_push(req, vrg_range_bytes, vrg_priv, 1, "RNG");
+	vrg_priv->range_low = part[0].low;
+	vrg_priv->range_high = part[0].high;
+
+	if (np > 1) {
+		err = vrg_multipart(req, part, np, vrg_priv);
+		if (err != NULL)
+			return (err);
+	} else {
+		if (req->resp_len >= 0)
+			http_PrintfHeader(req->resp,
+			    "Content-Range: bytes %jd-%jd/%jd",
+			    (intmax_t)part[0].low, (intmax_t)part[0].high - 1,
+			    (intmax_t)req->resp_len);
+		else
+			http_PrintfHeader(req->resp,
+			    "Content-Range: bytes %jd-%jd/*",
+			    (intmax_t)part[0].low, (intmax_t)part[0].high - 1);
+		req->resp_len = (intmax_t)(part[0].high - part[0].low);
+	}
+
+	VDP_push(req, VDP_range, vrg_priv, 1, "RNG");
 	http_PutResponse(req->resp, "HTTP/1.1", 206, NULL);
 	return (NULL);
 }
@@ -184,7 +499,12 @@ VRG_dorange(struct req *req, const char *r)
 	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
 	assert(http_IsStatus(req->resp, 200));
 
-	/* We must snapshot the length if we're streaming from the backend */
+	/*
+	 * We must snapshot the length if we're streaming from the backend.
+	 * Without a length, bounded ranges are served once the fetch has
+	 * got to their end, see vrg_wait().  Delivery ends when the last
+	 * one has been sent, not when the fetch does.
+	 */
 
 	err = vrg_dorange(req, r);
 	if (err != NULL) {
@@ -43,6 +43,22 @@
 
 #include "vtim.h"
 
+/*--------------------------------------------------------------------
+ * The client queue for the req.priority class of a request
+ */
+
+enum task_prio
+Req_Prio(const struct req *req)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	if (req->priority > 0)
+		return (TASK_QUEUE_HIGH);
+	if (req->priority < 0)
+		return (TASK_QUEUE_BULK);
+	return (TASK_QUEUE_REQ);
+}
+
 /*--------------------------------------------------------------------
  * Alloc/Free a request
  */
@@ -118,6 +134,7 @@ Req_Release(struct req *req)
 {
 	struct sess *sp;
 	struct pool *pp;
+	uint64_t *c;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 
@@ -137,7 +154,15 @@ Req_Release(struct req *req)
 	MPL_AssertSane(req);
 	VSL_Flush(req->vsl, 0);
 	req->sp = NULL;
-	MPL_Free(pp->mpl_req, req);
+	switch (WS_Quartile(req->ws)) {
+	case 0:	c = &VSC_C_main->ws_client_25; break;
+	case 1:	c = &VSC_C_main->ws_client_50; break;
+	case 2:	c = &VSC_C_main->ws_client_75; break;
+	default: c = &VSC_C_main->ws_client_100; break;
+	}
+	(void)__sync_add_and_fetch(c, 1);
+	MPL_FreeUsed(pp->mpl_req, req,
+	    pdiff(req, req->ws->s) + WS_HighWater(req->ws));
 }
 
 /*----------------------------------------------------------------------
@@ -165,8 +190,10 @@ Req_Cleanup(struct sess *sp, struct worker *wrk, struct req *req)
 		req->vcl = NULL;
 	}
 
+	Lck_Lock(&sp->mtx);
 	VRTPRIV_dynamic_kill(sp->privs, (uintptr_t)req);
 	VRTPRIV_dynamic_kill(sp->privs, (uintptr_t)&req->top);
+	Lck_Unlock(&sp->mtx);
 
 	/* Charge and log byte counters */
 	if (req->vsl->wid) {
@@ -185,6 +212,7 @@ Req_Cleanup(struct sess *sp, struct worker *wrk, struct req *req)
 	req->t_prev = NAN;
 	req->t_req = NAN;
 	req->req_body_status = REQ_BODY_INIT;
+	req->req_body_tee = 0;
 
 	req->hash_always_miss = 0;
 	req->hash_ignore_busy = 0;
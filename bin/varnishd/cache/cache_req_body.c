@@ -38,11 +38,52 @@
 #include "hash/hash_slinger.h"
 #include "storage/storage.h"
 
+/*----------------------------------------------------------------------
+ * Pick the storage for the req.body.  With req_body_spill, bodies which
+ * may grow larger than that go to req.storage, smaller ones to Transient.
+ */
+
+static const struct stevedore *
+vrb_storage(const struct req *req, ssize_t maxsize)
+{
+	ssize_t l;
+
+	if (req->storage == NULL)
+		return (stv_transient);
+	if (cache_param->req_body_spill == 0)
+		return (req->storage);
+	l = req->htc->content_length;
+	if (l < 0)
+		l = maxsize;
+	if (l >= 0 && l <= cache_param->req_body_spill)
+		return (stv_transient);
+	return (req->storage);
+}
+
+/*----------------------------------------------------------------------
+ * The req.body is all in, close the object and make it the cached one.
+ */
+
+static ssize_t
+vrb_cached(struct req *req)
+{
+
+	ObjTrimStore(req->wrk, req->body_oc);
+	AZ(ObjSetU64(req->wrk, req->body_oc, OA_LEN, req->req_bodybytes));
+	HSH_DerefBoc(req->wrk, req->body_oc);
+	assert(req->req_bodybytes >= 0);
+	req->req_body_status = REQ_BODY_CACHED;
+	return (req->req_bodybytes);
+}
+
 /*----------------------------------------------------------------------
  * Pull the req.body in via/into a objcore
  *
  * This can be called only once per request
  *
+ * With a func and req->req_body_tee, what func is handed is also kept,
+ * and if the body turns out to be no larger than req_body_tee, it ends
+ * up cached as if VRB_Cache() had been called.
  */
 
 static ssize_t
@@ -53,6 +94,7 @@ vrb_pull(struct req *req, ssize_t maxsize, objiterate_f *func, void *priv)
 	uint8_t *ptr;
 	enum vfp_status vfps = VFP_ERROR;
 	const struct stevedore *stv;
+	int tee;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 
@@ -63,14 +105,17 @@ vrb_pull(struct req *req, ssize_t maxsize, objiterate_f *func, void *priv)
 	req->body_oc = HSH_Private(req->wrk);
 	AN(req->body_oc);
 
-	if (req->storage != NULL)
-		stv = req->storage;
-	else
-		stv = stv_transient;
-
+	tee = func != NULL && req->req_body_tee > 0;
+	stv = vrb_storage(req, tee ? req->req_body_tee : maxsize);
 	req->storage = NULL;
 
-	XXXAN(STV_NewObject(req->wrk, req->body_oc, stv, 8));
+	req->body_oc->stobj->transient = TRANSIENT_REQBODY;
+	if (!STV_NewObject(req->wrk, req->body_oc, stv, 8)) {
+		req->req_body_status = REQ_BODY_FAIL;
+		HSH_DerefBoc(req->wrk, req->body_oc);
+		AZ(HSH_DerefObjCore(req->wrk, &req->body_oc, 0));
+		return (-1);
+	}
 
 	vfc->oc = req->body_oc;
 
@@ -108,6 +153,14 @@ vrb_pull(struct req *req, ssize_t maxsize, objiterate_f *func, void *priv)
 				r = func(priv, 1, ptr, l);
 				if (r)
 					break;
+				if (tee &&
+				    req->req_bodybytes > req->req_body_tee) {
+					VSLb(req->vsl, SLT_Debug,
+					    "Request body too big to keep");
+					tee = 0;
+				}
+				if (tee)
+					ObjExtend(req->wrk, req->body_oc, l);
 			} else {
 				ObjExtend(req->wrk, req->body_oc, l);
 			}
@@ -116,7 +169,12 @@ vrb_pull(struct req *req, ssize_t maxsize, objiterate_f *func, void *priv)
 	} while (vfps == VFP_OK);
 	VFP_Close(vfc);
 	VSLb_ts_req(req, "ReqBody", VTIM_real());
+	if (tee && vfps == VFP_END) {
+		(void)vrb_cached(req);
+		return (r);
+	}
 	if (func != NULL) {
+		req->req_body_tee = 0;
 		HSH_DerefBoc(req->wrk, req->body_oc);
 		AZ(HSH_DerefObjCore(req->wrk, &req->body_oc, 0));
 		if (vfps != VFP_END) {
@@ -127,17 +185,15 @@ vrb_pull(struct req *req, ssize_t maxsize, objiterate_f *func, void *priv)
 		return (r);
 	}
 
-	ObjTrimStore(req->wrk, req->body_oc);
-	AZ(ObjSetU64(req->wrk, req->body_oc, OA_LEN, req->req_bodybytes));
-	HSH_DerefBoc(req->wrk, req->body_oc);
-
 	if (vfps != VFP_END) {
+		ObjTrimStore(req->wrk, req->body_oc);
+		HSH_DerefBoc(req->wrk, req->body_oc);
 		req->req_body_status = REQ_BODY_FAIL;
 		AZ(HSH_DerefObjCore(req->wrk, &req->body_oc, 0));
 		return (-1);
 	}
 
-	assert(req->req_bodybytes >= 0);
+	(void)vrb_cached(req);
 	if (req->req_bodybytes != req->htc->content_length) {
 		/* We must update also the "pristine" req.* copy */
 		http_Unset(req->http0, H_Content_Length);
@@ -150,8 +206,6 @@ vrb_pull(struct req *req, ssize_t maxsize, objiterate_f *func, void *priv)
 		http_PrintfHeader(req->http, "Content-Length: %ju",
 		    (uintmax_t)req->req_bodybytes);
 	}
-
-	req->req_body_status = REQ_BODY_CACHED;
 	return (req->req_bodybytes);
 }
 
@@ -297,3 +351,44 @@ VRB_Cache(struct req *req, ssize_t maxsize)
 
 	return (vrb_pull(req, maxsize, NULL, NULL));
 }
+
+/*----------------------------------------------------------------------
+ * Like VRB_Cache(), but without waiting for the req.body: it is kept as
+ * it is sent to the backend, and becomes the cached req.body only when
+ * all of it has been sent.  Retries and restarts after that have it, a
+ * backend failure in the middle of it still fails the fetch.
+ *
+ * Returns zero if the body will be kept, -1 if it is known to be too big.
+ */
+
+int
+VRB_Tee(struct req *req, ssize_t maxsize)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	assert(maxsize >= 0);
+
+	if (req->restarts > 0 && req->req_body_status != REQ_BODY_CACHED)
+		return (-1);
+
+	assert (req->req_step == R_STP_RECV);
+	switch(req->req_body_status) {
+	case REQ_BODY_CACHED:
+	case REQ_BODY_NONE:
+		return (0);
+	case REQ_BODY_FAIL:
+		return (-1);
+	case REQ_BODY_WITHOUT_LEN:
+	case REQ_BODY_WITH_LEN:
+		break;
+	default:
+		WRONG("Wrong req_body_status in VRB_Tee()");
+	}
+
+	if (req->htc->content_length > maxsize)
+		return (-1);
+	if (maxsize == 0)
+		return (VRB_Cache(req, maxsize) < 0 ? -1 : 0);
+	req->req_body_tee = maxsize;
+	return (0);
+}
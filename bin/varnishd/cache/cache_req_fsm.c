@@ -49,6 +49,41 @@
 #include "vsha256.h"
 #include "vtim.h"
 
+/*--------------------------------------------------------------------
+ * Hits on objects fetched with beresp.do_static go out with the stored
+ * header block, without vcl_deliver{}, if nothing about the request
+ * asks for a different response than the stored one.
+ */
+
+static int
+cnt_deliver_static(struct worker *wrk, struct req *req)
+{
+	struct objcore *oc;
+	const char *hdr;
+	unsigned len;
+
+	oc = req->objcore;
+	if (req->transport->deliver_static == NULL || !req->is_hit ||
+	    req->esi_level > 0 || req->doclose || req->http->protover < 11 ||
+	    oc->boc != NULL || (oc->flags & (OC_F_PASS | OC_F_PRIVATE)) ||
+	    req->http->conds || http_GetHdr(req->http, H_Range, NULL) ||
+	    strcmp(req->http0->hd[HTTP_HDR_METHOD].b, "GET"))
+		return (0);
+	hdr = HTTP_GetStatic(wrk, oc, &len);
+	if (hdr == NULL || ObjCheckFlag(wrk, oc, OF_GZIPED) ||
+	    ObjCheckFlag(wrk, oc, OF_BROTLI) ||
+	    ObjHasAttr(wrk, oc, OA_ESIDATA))
+		return (0);
+
+	VSLb_ts_req(req, "Process", W_TIM_real(wrk));
+	if (req->transport->deliver_static(req, hdr, len))
+		return (0);
+	wrk->stats->cache_hit_static++;
+	VSLb_ts_req(req, "Resp", W_TIM_real(wrk));
+	(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
+	return (1);
+}
+
 /*--------------------------------------------------------------------
  * Deliver an object to client
  */
@@ -67,6 +102,9 @@ cnt_deliver(struct worker *wrk, struct req *req)
 
 	ObjTouch(req->wrk, req->objcore, req->t_prev);
 
+	if (cnt_deliver_static(wrk, req))
+		return (REQ_FSM_DONE);
+
 	HTTP_Setup(req->resp, req->ws, req->vsl, SLT_RespMethod);
 	if (HTTP_Decode(req->resp,
 	    ObjGetAttr(req->wrk, req->objcore, OA_HEADERS, NULL))) {
@@ -102,6 +140,11 @@ cnt_deliver(struct worker *wrk, struct req *req)
 	    !RFC2616_Req_Gzip(req->http))
 		RFC2616_Weaken_Etag(req->resp);
 
+	if (cache_param->http_gzip_support &&
+	    ObjCheckFlag(req->wrk, req->objcore, OF_BROTLI) &&
+	    !RFC2616_Req_Brotli(req->http))
+		RFC2616_Weaken_Etag(req->resp);
+
 	VCL_deliver_method(req->vcl, wrk, req, NULL, NULL);
 	VSLb_ts_req(req, "Process", W_TIM_real(wrk));
 
@@ -162,6 +205,42 @@ cnt_vclfail(const struct worker *wrk, struct req *req)
 	return (REQ_FSM_MORE);
 }
 
+/*--------------------------------------------------------------------
+ * Reuse a synthetic response kept from an earlier vcl_synth{}
+ */
+
+static int
+cnt_synth_hit(struct worker *wrk, struct req *req, double now)
+{
+	struct objcore *oc;
+	struct http *h;
+
+	oc = SYN_Lookup(wrk, req, now);
+	if (oc == NULL)
+		return (0);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	HTTP_Setup(req->resp, req->ws, req->vsl, SLT_RespMethod);
+	h = req->resp;
+	if (HTTP_Decode(h, ObjGetAttr(wrk, oc, OA_HEADERS, NULL))) {
+		(void)HSH_DerefObjCore(wrk, &oc, 0);
+		http_Teardown(h);
+		return (0);
+	}
+	http_Unset(h, H_Date);
+	http_TimeHeader(h, "Date: ", now);
+	http_Unset(h, "\012X-Varnish:");
+	http_PrintfHeader(h, "X-Varnish: %u", VXID(req->vsl->wid));
+
+	/* Discard any lingering request body before delivery */
+	(void)VRB_Ignore(req);
+
+	wrk->stats->s_synth_hit++;
+	req->objcore = oc;
+	req->synth_cached = 1;
+	return (1);
+}
+
 /*--------------------------------------------------------------------
  * Emit a synthetic response
  */
@@ -174,6 +253,7 @@ cnt_synth(struct worker *wrk, struct req *req)
 	struct vsb *synth_body;
 	ssize_t sz, szl;
 	uint8_t *ptr;
+	unsigned hl = 0;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -186,6 +266,11 @@ cnt_synth(struct worker *wrk, struct req *req)
 	if (req->err_code < 100)
 		req->err_code = 501;
 
+	if (cnt_synth_hit(wrk, req, now)) {
+		req->req_step = R_STP_TRANSMIT;
+		return (REQ_FSM_MORE);
+	}
+
 	HTTP_Setup(req->resp, req->ws, req->vsl, SLT_RespMethod);
 	h = req->resp;
 	http_TimeHeader(h, "Date: ", now);
@@ -196,6 +281,7 @@ cnt_synth(struct worker *wrk, struct req *req)
 	synth_body = VSB_new_auto();
 	AN(synth_body);
 
+	req->synth_ttl = 0;
 	VCL_synth_method(req->vcl, wrk, req, NULL, synth_body);
 
 	AZ(VSB_finish(synth_body));
@@ -230,7 +316,20 @@ cnt_synth(struct worker *wrk, struct req *req)
 	req->objcore = HSH_Private(wrk);
 	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
 	szl = -1;
-	if (STV_NewObject(wrk, req->objcore, stv_transient, 1024)) {
+	req->objcore->stobj->transient = TRANSIENT_SYNTH;
+	if (req->synth_ttl > 0 && cache_param->synth_cache > 0)
+		hl = http_EstimateWS(h, 0);
+	if (STV_NewObject(wrk, req->objcore, stv_transient, 1024 + hl)) {
+		/* Before the body, which may go in the same storage */
+		if (hl > 0) {
+			ptr = ObjSetAttr(wrk, req->objcore, OA_HEADERS, hl,
+			    NULL);
+			AN(ptr);
+			/* for HTTP_Encode() VSLH call */
+			h->logtag = SLT_ObjMethod;
+			(void)HTTP_Encode(h, ptr, hl, 0, 0);
+			h->logtag = SLT_RespMethod;
+		}
 		szl = VSB_len(synth_body);
 		assert(szl >= 0);
 		sz = szl;
@@ -257,10 +356,51 @@ cnt_synth(struct worker *wrk, struct req *req)
 		return (REQ_FSM_DONE);
 	}
 
+	if (hl > 0) {
+		SYN_Insert(wrk, req, now, req->synth_ttl);
+		req->synth_cached = 1;
+	}
+
 	req->req_step = R_STP_TRANSMIT;
 	return (REQ_FSM_MORE);
 }
 
+/*--------------------------------------------------------------------
+ * After the transport delivered the response, or parked the delivery.
+ * A parked delivery comes back to STP_TRANSMIT to carry on.
+ */
+
+static enum req_fsm_nxt
+cnt_transmit_done(struct worker *wrk, struct req *req, struct boc *boc)
+{
+
+	if (req->deliver_parked) {
+		AZ(boc);
+		return (REQ_FSM_PARK);
+	}
+
+	VSLb_ts_req(req, "Resp", W_TIM_real(wrk));
+
+	if (req->synth_cached) {
+		AZ(boc);
+		req->synth_cached = 0;
+	} else if (req->objcore->flags & (OC_F_PRIVATE | OC_F_PASS)) {
+		if (boc != NULL) {
+			HSH_Abandon(req->objcore);
+			ObjWaitState(req->objcore, BOS_FINISHED);
+		}
+		ObjSlim(wrk, req->objcore);
+	}
+
+	if (boc != NULL)
+		HSH_DerefBoc(wrk, req->objcore);
+
+	(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
+	http_Teardown(req->resp);
+
+	return (REQ_FSM_DONE);
+}
+
 /*--------------------------------------------------------------------
  * The mechanics of sending a response (from deliver or synth)
  */
@@ -278,6 +418,11 @@ cnt_transmit(struct worker *wrk, struct req *req)
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(req->transport, TRANSPORT_MAGIC);
 
+	if (req->deliver_parked) {
+		req->transport->deliver(req, NULL, 1);
+		return (cnt_transmit_done(wrk, req, NULL));
+	}
+
 	/* Grab a ref to the bo if there is one */
 	boc = HSH_RefBoc(req->objcore);
 
@@ -312,6 +457,14 @@ cnt_transmit(struct worker *wrk, struct req *req)
 		    !RFC2616_Req_Gzip(req->http))
 			VDP_push(req, VDP_gunzip, NULL, 1, "GUZ");
 
+#if defined(HAVE_BROTLI)
+		/* ESI includes must always be plain */
+		if (cache_param->http_gzip_support &&
+		    ObjCheckFlag(req->wrk, req->objcore, OF_BROTLI) &&
+		    (req->esi_level > 0 || !RFC2616_Req_Brotli(req->http)))
+			VDP_push(req, VDP_unbrotli, NULL, 1, "UBR");
+#endif
+
 		if (cache_param->http_range_support &&
 		    http_IsStatus(req->resp, 200)) {
 			http_ForceHeader(req->resp, H_Accept_Ranges, "bytes");
@@ -333,24 +486,7 @@ cnt_transmit(struct worker *wrk, struct req *req)
 	}
 
 	req->transport->deliver(req, boc, sendbody);
-
-	VSLb_ts_req(req, "Resp", W_TIM_real(wrk));
-
-	if (req->objcore->flags & (OC_F_PRIVATE | OC_F_PASS)) {
-		if (boc != NULL) {
-			HSH_Abandon(req->objcore);
-			ObjWaitState(req->objcore, BOS_FINISHED);
-		}
-		ObjSlim(wrk, req->objcore);
-	}
-
-	if (boc != NULL)
-		HSH_DerefBoc(wrk, req->objcore);
-
-	(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
-	http_Teardown(req->resp);
-
-	return (REQ_FSM_DONE);
+	return (cnt_transmit_done(wrk, req, boc));
 }
 
 /*--------------------------------------------------------------------
@@ -380,6 +516,62 @@ cnt_fetch(struct worker *wrk, struct req *req)
 	return (REQ_FSM_MORE);
 }
 
+/*--------------------------------------------------------------------
+ * Should this hit make an identity variant of a gzip'ed object?
+ */
+
+static int
+cnt_want_variant(struct worker *wrk, const struct req *req,
+    struct objcore *oc)
+{
+
+	if (!cache_param->http_gzip_support ||
+	    !cache_param->http_gzip_variants)
+		return (0);
+	if ((oc->flags & OC_F_VARIANT) ||
+	    req->req_body_status != REQ_BODY_NONE)
+		return (0);
+	if (!ObjCheckFlag(wrk, oc, OF_GZIPED) ||
+	    ObjCheckFlag(wrk, oc, OF_ESIPROC))
+		return (0);
+	return (!RFC2616_Req_Gzip(req->http));
+}
+
+/*--------------------------------------------------------------------
+ * Should this hit start making the gzip'ed copy of an object which was
+ * stored with gzip_deferred ?
+ */
+
+static int
+cnt_want_gzip(struct worker *wrk, const struct req *req, struct objcore *oc)
+{
+
+	if (!cache_param->http_gzip_support ||
+	    req->req_body_status != REQ_BODY_NONE)
+		return (0);
+	return (ObjCheckFlag(wrk, oc, OF_DEFERGZIP));
+}
+
+/*--------------------------------------------------------------------
+ * A popular object close to the end of its TTL gets refreshed ahead
+ * of time, see the refresh_ahead parameter.
+ */
+
+static int
+cnt_want_refresh(const struct req *req, const struct objcore *oc)
+{
+	double left;
+
+	if (cache_param->refresh_ahead == 0 ||
+	    req->req_body_status != REQ_BODY_NONE ||
+	    (oc->flags & OC_F_VARIANT) || oc->ttl <= 0. ||
+	    oc->hits < (long)cache_param->refresh_ahead_hits)
+		return (0);
+	left = EXP_Ttl(req, oc) - req->t_req;
+	return (left > 0. &&
+	    left * 100. < oc->ttl * cache_param->refresh_ahead);
+}
+
 /*--------------------------------------------------------------------
  * Attempt to lookup objhdr from hash.  We disembark and reenter
  * this state if we get suspended on a busy objhdr.
@@ -391,6 +583,7 @@ cnt_lookup(struct worker *wrk, struct req *req)
 	struct objcore *oc, *busy;
 	enum lookup_e lr;
 	int had_objhead = 0;
+	double t, now;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -403,8 +596,13 @@ cnt_lookup(struct worker *wrk, struct req *req)
 	AZ(req->objcore);
 	if (req->hash_objhead)
 		had_objhead = 1;
+	t = VTIM_real();
 	lr = HSH_Lookup(req, &oc, &busy, req->hash_always_miss ? 1 : 0);
+	now = W_TIM_real(wrk);
+	WRK_Latency(wrk, LAT_lookup, now - t);
+	VSL_Span(req->vsl, VSL_SPAN_LOOKUP, t, now);
 	if (lr == HSH_BUSY) {
+		VSL_Span(req->vsl, VSL_SPAN_WAITINGLIST, now, NAN);
 		/*
 		 * We lost the session to a busy object, disembark the
 		 * worker thread.   We return to STP_LOOKUP when the busy
@@ -413,8 +611,11 @@ cnt_lookup(struct worker *wrk, struct req *req)
 		 */
 		return (REQ_FSM_DISEMBARK);
 	}
-	if (had_objhead)
-		VSLb_ts_req(req, "Waitinglist", W_TIM_real(wrk));
+	if (had_objhead) {
+		VSLb_ts_req(req, "Waitinglist", now);
+		VSL_SpanEnd(req->vsl, VSL_SPAN_WAITINGLIST, t);
+	}
+	ADM_Touch(req->digest);
 
 	if (busy == NULL) {
 		VRY_Finish(req, DISCARD);
@@ -452,6 +653,16 @@ cnt_lookup(struct worker *wrk, struct req *req)
 			AZ(oc->flags & OC_F_PASS);
 			CHECK_OBJ_NOTNULL(busy->boc, BOC_MAGIC);
 			VBF_Fetch(wrk, req, busy, oc, VBF_BACKGROUND);
+		} else if (cnt_want_variant(wrk, req, oc) &&
+		    (busy = HSH_Variant(wrk, oc)) != NULL) {
+			VBF_Fetch(wrk, req, busy, oc, VBF_VARIANT);
+		} else if (cnt_want_gzip(wrk, req, oc) &&
+		    (busy = HSH_Replace(wrk, oc)) != NULL) {
+			VBF_Fetch(wrk, req, busy, oc, VBF_GZIP);
+		} else if (cnt_want_refresh(req, oc) &&
+		    (busy = HSH_Replace(wrk, oc)) != NULL) {
+			wrk->stats->cache_refresh_ahead++;
+			VBF_Fetch(wrk, req, busy, oc, VBF_BACKGROUND);
 		} else {
 			(void)VRB_Ignore(req);// XXX: handle err
 		}
@@ -563,6 +774,12 @@ cnt_pass(struct worker *wrk, struct req *req)
 	AN(req->vcl);
 	AZ(req->objcore);
 
+	if (req->is_prefetch) {
+		/* Only fetches for the cache are done ahead, see
+		 * ved_prefetch() and cache_warm.c */
+		return (REQ_FSM_DONE);
+	}
+
 	VCL_pass_method(req->vcl, wrk, req, NULL, NULL);
 	switch (wrk->handling) {
 	case VCL_RET_FAIL:
@@ -679,7 +896,7 @@ static enum req_fsm_nxt
 cnt_recv(struct worker *wrk, struct req *req)
 {
 	unsigned recv_handling;
-	struct SHA256Context sha256ctx;
+	struct VSHA256Context sha256ctx;
 	const char *xff;
 	const char *ci, *cp;
 
@@ -721,6 +938,8 @@ cnt_recv(struct worker *wrk, struct req *req)
 
 	req->vdp_retval = 0;
 	req->d_ttl = -1;
+	if (req->restarts == 0)
+		req->priority = req->esi_level > 0 ? req->top->priority : 0;
 	req->disable_esi = 0;
 	req->hash_always_miss = 0;
 	req->hash_ignore_busy = 0;
@@ -759,20 +978,23 @@ cnt_recv(struct worker *wrk, struct req *req)
 	if (cache_param->http_gzip_support &&
 	     (recv_handling != VCL_RET_PIPE) &&
 	     (recv_handling != VCL_RET_PASS)) {
-		if (RFC2616_Req_Gzip(req->http)) {
+		if (RFC2616_Req_Brotli(req->http)) {
+			http_ForceHeader(req->http, H_Accept_Encoding,
+			    RFC2616_Req_Gzip(req->http) ? "br, gzip" : "br");
+		} else if (RFC2616_Req_Gzip(req->http)) {
 			http_ForceHeader(req->http, H_Accept_Encoding, "gzip");
 		} else {
 			http_Unset(req->http, H_Accept_Encoding);
 		}
 	}
 
-	SHA256_Init(&sha256ctx);
+	VSHA256_Init(&sha256ctx);
 	VCL_hash_method(req->vcl, wrk, req, NULL, &sha256ctx);
 	if (wrk->handling == VCL_RET_FAIL)
 		recv_handling = wrk->handling;
 	else
 		assert(wrk->handling == VCL_RET_LOOKUP);
-	SHA256_Final(req->digest, &sha256ctx);
+	VSHA256_Final(req->digest, &sha256ctx);
 
 	switch(recv_handling) {
 	case VCL_RET_VCL:
@@ -790,6 +1012,8 @@ cnt_recv(struct worker *wrk, struct req *req)
 		req->req_step = R_STP_LOOKUP;
 		return (REQ_FSM_MORE);
 	case VCL_RET_PIPE:
+		if (req->is_prefetch)
+			return (REQ_FSM_DONE);
 		if (req->esi_level == 0) {
 			req->req_step = R_STP_PIPE;
 			return (REQ_FSM_MORE);
@@ -892,7 +1116,9 @@ CNT_Request(struct worker *wrk, struct req *req)
 	 */
 	assert(
 	    req->req_step == R_STP_LOOKUP ||
-	    req->req_step == R_STP_RECV);
+	    req->req_step == R_STP_RECV ||
+	    (req->req_step == R_STP_TRANSMIT &&
+	    (req->deliver_parked || req->esi_memo)));
 
 	AN(req->vsl->wid & VSL_CLIENTMARKER);
 
@@ -937,6 +1163,9 @@ CNT_Request(struct worker *wrk, struct req *req)
 	wrk->vsl = NULL;
 	if (nxt == REQ_FSM_DONE) {
 		AN(req->vsl->wid);
+		if (req->t_first > 0.)
+			WRK_Latency(wrk, req->esi_level ? LAT_esi : LAT_resp,
+			    req->t_prev - req->t_first);
 		VRB_Free(req);
 		req->wrk = NULL;
 	}
@@ -947,6 +1176,7 @@ void
 CNT_AcctLogCharge(struct dstat *ds, struct req *req)
 {
 	struct acct_req *a;
+	uint64_t v[6];
 
 	AN(ds);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -954,13 +1184,13 @@ CNT_AcctLogCharge(struct dstat *ds, struct req *req)
 	a = &req->acct;
 
 	if (req->vsl->wid && !(req->res_mode & RES_PIPE)) {
-		VSLb(req->vsl, SLT_ReqAcct, "%ju %ju %ju %ju %ju %ju",
-		    (uintmax_t)a->req_hdrbytes,
-		    (uintmax_t)a->req_bodybytes,
-		    (uintmax_t)(a->req_hdrbytes + a->req_bodybytes),
-		    (uintmax_t)a->resp_hdrbytes,
-		    (uintmax_t)a->resp_bodybytes,
-		    (uintmax_t)(a->resp_hdrbytes + a->resp_bodybytes));
+		v[0] = a->req_hdrbytes;
+		v[1] = a->req_bodybytes;
+		v[2] = a->req_hdrbytes + a->req_bodybytes;
+		v[3] = a->resp_hdrbytes;
+		v[4] = a->resp_bodybytes;
+		v[5] = a->resp_hdrbytes + a->resp_bodybytes;
+		VSLb_u64(req->vsl, SLT_ReqAcct, v, 6);
 	}
 
 #define ACCT(foo)			\
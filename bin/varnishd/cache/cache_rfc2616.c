@@ -204,32 +204,90 @@ RFC2616_Ttl(struct busyobj *bo, double now, double *t_origin,
 }
 
 /*--------------------------------------------------------------------
- * Find out if the request can receive a gzip'ed response
+ * Find out if the request can receive a gzip'ed or brotli'ed response
+ *
+ * This is asked again and again for the same request, for every variant
+ * object in HSH_Lookup() among others, so the answer is kept in the
+ * struct http along with the header it came from.  Changing the header
+ * gives it a new value pointer, and HTTP_Copy() takes the answer along
+ * with the headers when the workspace is rolled back.
  */
 
-unsigned
-RFC2616_Req_Gzip(const struct http *hp)
+#define RFC2616_AE_GZIP		(1 << 0)
+#define RFC2616_AE_BR		(1 << 1)
+
+static int
+rfc2616_ae_is(const struct http_qval *qv, const char *tok)
 {
+	size_t l = strlen(tok);
 
+	return (qv->e - qv->b == l && !strncasecmp(qv->b, tok, l));
+}
 
-	/*
-	 * "x-gzip" is for http/1.0 backwards compat, final note in 14.3
-	 * p104 says to not do q values for x-gzip, so we just test
-	 * for its existence.
-	 */
-	if (http_GetHdrToken(hp, H_Accept_Encoding, "x-gzip", NULL, NULL))
-		return (1);
+static unsigned
+rfc2616_req_ae(struct http *hp)
+{
+	struct http_qval qv[32];
+	const char *h;
+	unsigned n, u, seen, bits;
 
-	/*
-	 * "gzip" is the real thing, but the 'q' value must be nonzero.
-	 * We do not care a hoot if the client prefers some other
-	 * compression more than gzip: Varnish only does gzip.
-	 */
-	if (http_GetHdrQ(hp, H_Accept_Encoding, "gzip") > 0.)
-		return (1);
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	if (!http_GetHdr(hp, H_Accept_Encoding, &h))
+		return (0);
+	if (h == hp->ae_hdr)
+		return (hp->ae_bits);
+
+	n = http_QList(h, qv, 32);
+	seen = bits = 0;
+	for (u = 0; u < n; u++) {
+		/*
+		 * "x-gzip" is for http/1.0 backwards compat, final note
+		 * in 14.3 p104 says to not do q values for x-gzip, so we
+		 * just test for its existence.
+		 */
+		if (rfc2616_ae_is(&qv[u], "x-gzip"))
+			bits |= RFC2616_AE_GZIP;
+
+		/*
+		 * "gzip" is the real thing, but the 'q' value must be
+		 * nonzero.  We do not care a hoot if the client prefers
+		 * some other compression more than gzip.  Only the first
+		 * mention of a token counts.
+		 */
+		if (rfc2616_ae_is(&qv[u], "gzip") &&
+		    !(seen & RFC2616_AE_GZIP)) {
+			seen |= RFC2616_AE_GZIP;
+			if (qv[u].q > 0.)
+				bits |= RFC2616_AE_GZIP;
+		}
+		if (rfc2616_ae_is(&qv[u], "br") && !(seen & RFC2616_AE_BR)) {
+			seen |= RFC2616_AE_BR;
+			if (qv[u].q > 0.)
+				bits |= RFC2616_AE_BR;
+		}
+	}
+	hp->ae_hdr = h;
+	hp->ae_bits = bits;
+	return (bits);
+}
+
+unsigned
+RFC2616_Req_Gzip(struct http *hp)
+{
+
+	return (rfc2616_req_ae(hp) & RFC2616_AE_GZIP ? 1 : 0);
+}
+
+unsigned
+RFC2616_Req_Brotli(struct http *hp)
+{
 
-	/* Bad client, no gzip. */
+#if defined(HAVE_BROTLI)
+	return (rfc2616_req_ae(hp) & RFC2616_AE_BR ? 1 : 0);
+#else
+	(void)hp;
 	return (0);
+#endif
 }
 
 /*--------------------------------------------------------------------*/
@@ -103,7 +103,7 @@ ses_set_attr(const struct sess *sp, enum sess_attr a, const void *src, int sz)
 	return (0);
 }
 
-static void
+static int
 ses_reserve_attr(struct sess *sp, enum sess_attr a, void **dst, int sz)
 {
 	ssize_t o;
@@ -113,12 +113,17 @@ ses_reserve_attr(struct sess *sp, enum sess_attr a, void **dst, int sz)
 	assert(sz >= 0);
 	AN(dst);
 	o = WS_Reserve(sp->ws, sz);
-	assert(o >= sz);
+	if (o < sz) {
+		if (o > 0)
+			WS_Release(sp->ws, 0);
+		return (-1);
+	}
 	*dst = sp->ws->f;
 	o = sp->ws->f - sp->ws->s;
 	WS_Release(sp->ws, sz);
 	assert(o >= 0 && o <= 0xffff);
 	sp->sattr[a] = (uint16_t)o;
+	return (0);
 }
 
 #define SESS_ATTR(UP, low, typ, len)					\
@@ -138,7 +143,7 @@ ses_reserve_attr(struct sess *sp, enum sess_attr a, void **dst, int sz)
 	SES_Reserve_##low(struct sess *sp, typ **dst)			\
 	{								\
 		assert(len >= 0);					\
-		ses_reserve_attr(sp, SA_##UP, (void**)dst, len);	\
+		AZ(ses_reserve_attr(sp, SA_##UP, (void**)dst, len));	\
 	}
 
 #include "tbl/sess_attr.h"
@@ -157,10 +162,37 @@ SES_Set_String_Attr(struct sess *sp, enum sess_attr a, const char *src)
 	default:  WRONG("wrong sess_attr");
 	}
 
-	ses_reserve_attr(sp, a, &q, strlen(src) + 1);
+	AZ(ses_reserve_attr(sp, a, &q, strlen(src) + 1));
 	strcpy(q, src);
 }
 
+/*
+ * For strings which come off the wire without a NUL, and which may not
+ * fit, such as PROXY TLVs.
+ */
+
+int
+SES_Set_String_Attr_Len(struct sess *sp, enum sess_attr a, const char *src,
+    unsigned len)
+{
+	void *q;
+
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	AN(src);
+
+	switch (a) {
+#define SESS_ATTR(UP, low, typ, len)	case SA_##UP: assert(len < 0); break;
+#include "tbl/sess_attr.h"
+	default:  WRONG("wrong sess_attr");
+	}
+
+	if (ses_reserve_attr(sp, a, &q, len + 1))
+		return (-1);
+	memcpy(q, src, len);
+	((char *)q)[len] = '\0';
+	return (0);
+}
+
 const char *
 SES_Get_String_Attr(const struct sess *sp, enum sess_attr a)
 {
@@ -335,6 +367,7 @@ SES_New(struct pool *pp)
 	sp->magic = SESS_MAGIC;
 	sp->pool = pp;
 	sp->refcnt = 1;
+	sp->shrunk = 0;
 	memset(sp->sattr, 0xff, sizeof sp->sattr);
 
 	e = (char*)sp + sz;
@@ -351,6 +384,40 @@ SES_New(struct pool *pp)
 	return (sp);
 }
 
+/*--------------------------------------------------------------------
+ * The key client work of this session is fair queued under, see
+ * thread_queue_fair.  It is a hash of the client IP, or of the
+ * client.identity VCL set for the request.  It is worked out when the
+ * task is queued rather than kept in struct sess, which we want small.
+ */
+
+static uint32_t
+ses_fnv(const char *s)
+{
+	uint32_t h = 0x811c9dc5;
+
+	AN(s);
+	for (; *s != '\0'; s++) {
+		h ^= (uint8_t)*s;
+		h *= 0x01000193;
+	}
+	return (h | 1);
+}
+
+uint32_t
+SES_FairKey(const struct sess *sp, const char *identity)
+{
+
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	if (cache_param->wthread_queue_fair == 0)
+		return (0);
+	if (identity == NULL)
+		identity = SES_Get_String_Attr(sp, SA_CLIENT_IP);
+	if (identity == NULL)
+		return (0);
+	return (ses_fnv(identity));
+}
+
 /*--------------------------------------------------------------------
  * Reschedule a request on a work-thread from its sessions pool
  *
@@ -370,8 +437,85 @@ SES_Reschedule_Req(struct req *req)
 	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 
 	AN(req->task.func);
+	req->task.fq_key = SES_FairKey(sp, req->client_identity);
+
+	return (Pool_Task(pp, &req->task, Req_Prio(req)));
+}
+
+/*--------------------------------------------------------------------
+ * With the idle_shrink feature, a waiting session nobody else holds on
+ * to moves out of its pool_sess allocation into one which only has room
+ * for what is already on its workspace and the struct waited.  It moves
+ * back into a pool_sess allocation once there is something to read.
+ * A shrunk session has ->shrunk set, which shares a word with ->refcnt
+ * so struct sess does not grow.
+ */
+
+static struct sess *
+ses_shrink(struct sess *sp)
+{
+	struct sess *sp2;
+	unsigned u, l;
+	char *p;
+
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	AZ(sp->shrunk);
+	AZ(sp->ws->r);
+	if (!FEATURE(FEATURE_IDLE_SHRINK) ||
+	    !VTAILQ_EMPTY(&sp->privs->privs))
+		return (sp);
+	Lck_Lock(&sp->mtx);
+	l = sp->refcnt;
+	Lck_Unlock(&sp->mtx);
+	if (l != 1)
+		return (sp);
+
+	u = sp->ws->f - sp->ws->s;
+	l = PRNDUP(u + PRNDUP(sizeof(struct waited)) + 1);
+	if (PRNDUP(sizeof *sp) + l >= cache_param->workspace_session)
+		return (sp);
+	sp2 = malloc(PRNDUP(sizeof *sp) + l);
+	if (sp2 == NULL)
+		return (sp);
+	memcpy(sp2, sp, sizeof *sp);
+	p = (char*)sp2 + PRNDUP(sizeof *sp);
+	WS_Init(sp2->ws, "ses", p, l);
+	sp2->shrunk = 1;
+	memcpy(WS_Alloc(sp2->ws, u), sp->ws->s, u);
+	VRTPRIV_init(sp2->privs);
+	MPL_Free(sp->pool->mpl_sess, sp);
+	return (sp2);
+}
+
+static struct sess *
+ses_grow(struct sess *sp)
+{
+	struct sess *sp2;
+	unsigned u, sz;
+	char *p, *e;
 
-	return (Pool_Task(pp, &req->task, TASK_QUEUE_REQ));
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	if (!sp->shrunk)
+		return (sp);
+	AZ(sp->ws->r);
+	u = sp->ws->f - sp->ws->s;
+
+	sp2 = MPL_Get(sp->pool->mpl_sess, &sz);
+	e = (char*)sp2 + sz;
+	p = (char*)(sp2 + 1);
+	p = (void*)PRNDUP(p);
+	if (p + u + sizeof(struct pool_task) >= e) {
+		/* workspace_session was reduced under us */
+		MPL_Free(sp->pool->mpl_sess, sp2);
+		return (sp);
+	}
+	memcpy(sp2, sp, sizeof *sp);
+	WS_Init(sp2->ws, "ses", p, e - p);
+	sp2->shrunk = 0;
+	memcpy(WS_Alloc(sp2->ws, u), sp->ws->s, u);
+	VRTPRIV_init(sp2->privs);
+	free(sp);
+	return (sp2);
 }
 
 /*--------------------------------------------------------------------
@@ -404,12 +548,18 @@ ses_handle(struct waited *wp, enum wait_event ev, double now)
 		SES_Delete(sp, SC_REM_CLOSE, now);
 		break;
 	case WAITER_ACTION:
+		sp = ses_grow(sp);
+		if (sp->shrunk) {
+			SES_Delete(sp, SC_OVERLOAD, now);
+			break;
+		}
 		pp = sp->pool;
 		CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 		assert(sizeof *tp <= WS_Reserve(sp->ws, sizeof *tp));
 		tp = (void*)sp->ws->f;
 		tp->func = xp->unwait;
 		tp->priv = sp;
+		tp->fq_key = SES_FairKey(sp, NULL);
 		if (Pool_Task(pp, tp, TASK_QUEUE_REQ))
 			SES_Delete(sp, SC_OVERLOAD, now);
 		break;
@@ -443,6 +593,7 @@ SES_Wait(struct sess *sp, const struct transport *xp)
 		SES_Delete(sp, SC_REM_CLOSE, NAN);
 		return;
 	}
+	sp = ses_shrink(sp);
 
 	/*
 	 * put struct waited on the workspace
@@ -578,13 +729,24 @@ SES_Rel(struct sess *sp)
 	if (i)
 		return;
 	Lck_Delete(&sp->mtx);
-	MPL_Free(sp->pool->mpl_sess, sp);
+	if (sp->shrunk)
+		free(sp);
+	else
+		MPL_Free(sp->pool->mpl_sess, sp);
 }
 
 /*--------------------------------------------------------------------
  * Create and delete pools
  */
 
+static unsigned __match_proto__(mpl_extra_f)
+ses_req_extra(void)
+{
+
+	/* req->http, req->http0 and req->resp, see Req_New() */
+	return (3 * HTTP_IndexSize(cache_param->http_max_hdr));
+}
+
 void
 SES_NewPool(struct pool *pp, unsigned pool_no)
 {
@@ -594,6 +756,7 @@ SES_NewPool(struct pool *pp, unsigned pool_no)
 	bprintf(nb, "req%u", pool_no);
 	pp->mpl_req = MPL_New(nb, &cache_param->req_pool,
 	    &cache_param->workspace_client);
+	MPL_Extra(pp->mpl_req, ses_req_extra);
 	bprintf(nb, "sess%u", pool_no);
 	pp->mpl_sess = MPL_New(nb, &cache_param->sess_pool,
 	    &cache_param->workspace_session);
@@ -31,9 +31,14 @@
 
 #include "cache.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "common/heritage.h"
 
@@ -47,9 +52,11 @@ static pthread_mutex_t vsm_mtx;
 
 static struct VSL_head		*vsl_head;
 static const uint32_t		*vsl_end;
-static uint32_t			*vsl_ptr;
+static uint32_t * volatile	vsl_ptr;
 static unsigned			vsl_segment_n;
+static unsigned			vsl_clean_n;
 static ssize_t			vsl_segsize;
+static volatile uint32_t	vsl_demand[SLT__MAX / 32];
 
 struct VSC_C_main       *VSC_C_main;
 
@@ -77,7 +84,21 @@ vsl_tag_is_masked(enum VSL_tag_e tag)
 	assert(tag < SLT__Reserved);
 	bm += ((unsigned)tag >> 3);
 	b = (0x80 >> ((unsigned)tag & 7));
-	return (*bm & b);
+	if (*bm & b)
+		return (1);
+	return (cache_param->vsl_demand &&
+	    !(vsl_demand[(unsigned)tag >> 5] & (1U << ((unsigned)tag & 31))));
+}
+
+/*
+ * For callers who can skip the work of formatting a record nobody will see
+ */
+
+int
+VSL_Masked(enum VSL_tag_e tag)
+{
+
+	return (vsl_tag_is_masked(tag));
 }
 
 /*--------------------------------------------------------------------
@@ -99,36 +120,68 @@ vsl_hdr(enum VSL_tag_e tag, uint32_t *p, unsigned len, uint32_t vxid)
 }
 
 /*--------------------------------------------------------------------
- * Wrap the VSL buffer
+ * Space is reserved in the log by moving vsl_ptr with compare-and-swap,
+ * the mutex is only taken when a reservation crosses into another
+ * segment or wraps the buffer.
+ *
+ * Since records are then completed in any order, the writer can no
+ * longer lay down the ENDMARKER after its record.  Instead entire
+ * segments are wiped to ENDMARKER before vsl_ptr is allowed into them,
+ * one segment ahead of vsl_ptr, so a reader always stops at the first
+ * record not yet written and never sees stale data from the last lap.
  */
 
-static void
-vsl_wrap(void)
+#define VSL_SEG(p)	(((p) - vsl_head->log) / vsl_segsize)
+#define VSL_TAGW	(SLT__MAX / 32)
+
+static inline void
+vsl_tagbit(uint32_t *m, enum VSL_tag_e tag)
 {
 
-	assert(vsl_ptr >= vsl_head->log);
-	assert(vsl_ptr < vsl_end);
-	vsl_segment_n += VSL_SEGMENTS - (vsl_segment_n % VSL_SEGMENTS);
-	assert(vsl_segment_n % VSL_SEGMENTS == 0);
-	vsl_head->offset[0] = 0;
-	vsl_head->log[0] = VSL_ENDMARKER;
-	VWMB();
-	if (vsl_ptr != vsl_head->log) {
-		*vsl_ptr = VSL_WRAPMARKER;
-		vsl_ptr = vsl_head->log;
-	}
-	vsl_head->segment_n = vsl_segment_n;
-	VSC_C_main->shm_cycles++;
+	m[(unsigned)tag >> 5] |= 1U << ((unsigned)tag & 31);
 }
 
-/*--------------------------------------------------------------------
- * Reserve bytes for a record, wrap if necessary
+/*
+ * Publish the tags of a record we are about to reserve at p.  This
+ * must happen before the compare-and-swap, so the bits are visible by
+ * the time anybody can move segment_n past this segment.
  */
 
+static void
+vsl_mark(const uint32_t *p, const uint32_t *m)
+{
+	uint32_t *t;
+	unsigned u;
+
+	t = vsl_head->tags[VSL_SEG(p)];
+	VRMB();
+	for (u = 0; u < VSL_TAGW; u++)
+		if ((t[u] & m[u]) != m[u])
+			(void)__sync_fetch_and_or(&t[u], m[u]);
+}
+
+static void
+vsl_clean(unsigned n)
+{
+	uint32_t *p, *e;
+
+	/* Wipe everything up to and including segment number n */
+	while ((int)(n - vsl_clean_n) > 0) {
+		vsl_clean_n++;
+		memset(vsl_head->tags[vsl_clean_n % VSL_SEGMENTS], 0,
+		    sizeof vsl_head->tags[0]);
+		p = vsl_head->log + (vsl_clean_n % VSL_SEGMENTS) * vsl_segsize;
+		for (e = p + vsl_segsize; p < e; p++)
+			*p = VSL_ENDMARKER;
+	}
+	VWMB();
+}
+
 static uint32_t *
-vsl_get(unsigned len, unsigned records, unsigned flushes)
+vsl_get_slow(unsigned len, const uint32_t *m)
 {
-	uint32_t *p;
+	uint32_t *p, *q, *e;
+	unsigned n;
 	int err;
 
 	err = pthread_mutex_trylock(&vsl_mtx);
@@ -138,36 +191,75 @@ vsl_get(unsigned len, unsigned records, unsigned flushes)
 	} else {
 		AZ(err);
 	}
-	assert(vsl_ptr < vsl_end);
-	AZ((uintptr_t)vsl_ptr & 0x3);
-
-	VSC_C_main->shm_writes++;
-	VSC_C_main->shm_flushes += flushes;
-	VSC_C_main->shm_records += records;
-
-	/* Wrap if necessary */
-	if (VSL_END(vsl_ptr, len) >= vsl_end)
-		vsl_wrap();
 
-	p = vsl_ptr;
-	vsl_ptr = VSL_END(vsl_ptr, len);
-	assert(vsl_ptr < vsl_end);
-	AZ((uintptr_t)vsl_ptr & 0x3);
-
-	*vsl_ptr = VSL_ENDMARKER;
+	do {
+		p = vsl_ptr;
+		assert(p < vsl_end);
+		AZ((uintptr_t)p & 0x3);
+		assert(VSL_SEG(p) == vsl_segment_n % VSL_SEGMENTS);
+
+		/* Wrap if necessary */
+		if (VSL_END(p, len) >= vsl_end) {
+			q = vsl_head->log;
+			n = vsl_segment_n +
+			    VSL_SEGMENTS - (vsl_segment_n % VSL_SEGMENTS);
+		} else {
+			q = p;
+			n = vsl_segment_n - (unsigned)VSL_SEG(p);
+		}
+		e = VSL_END(q, len);
+		assert(e < vsl_end);
+		n += (unsigned)VSL_SEG(e);
+		vsl_clean(n);
+		vsl_mark(q, m);
+	} while (!__sync_bool_compare_and_swap(&vsl_ptr, p, e));
+
+	if (q != p) {
+		vsl_segment_n = n - (unsigned)VSL_SEG(e);
+		vsl_head->offset[0] = 0;
+		VWMB();
+		*p = VSL_WRAPMARKER;
+		vsl_head->segment_n = vsl_segment_n;
+		VSC_C_main->shm_cycles++;
+	}
 
-	while ((vsl_ptr - vsl_head->log) / vsl_segsize >
-	    vsl_segment_n % VSL_SEGMENTS) {
+	while (VSL_SEG(e) > vsl_segment_n % VSL_SEGMENTS) {
 		vsl_segment_n++;
 		vsl_head->offset[vsl_segment_n % VSL_SEGMENTS] =
-		    vsl_ptr - vsl_head->log;
+		    e - vsl_head->log;
 	}
+	VWMB();
+	vsl_head->segment_n = vsl_segment_n;
+
+	/* Clean the next segment while the others write into this one */
+	vsl_clean(vsl_segment_n + 1);
 
 	AZ(pthread_mutex_unlock(&vsl_mtx));
-	/* Implicit VWMB() in mutex op ensures ENDMARKER and new table
-	   values are seen before new segment number */
-	vsl_head->segment_n = vsl_segment_n;
+	return (q);
+}
+
+/*--------------------------------------------------------------------
+ * Reserve bytes for a record, wrap if necessary
+ */
 
+static uint32_t *
+vsl_get(unsigned len, unsigned records, unsigned flushes, const uint32_t *m)
+{
+	uint32_t *p, *e;
+
+	(void)__sync_add_and_fetch(&VSC_C_main->shm_writes, 1);
+	if (flushes)
+		(void)__sync_add_and_fetch(&VSC_C_main->shm_flushes, flushes);
+	(void)__sync_add_and_fetch(&VSC_C_main->shm_records, records);
+
+	do {
+		p = vsl_ptr;
+		e = VSL_END(p, len);
+		if (e >= vsl_end || VSL_SEG(e) != VSL_SEG(p))
+			return (vsl_get_slow(len, m));
+		vsl_mark(p, m);
+	} while (!__sync_bool_compare_and_swap(&vsl_ptr, p, e));
+	AZ((uintptr_t)p & 0x3);
 	return (p);
 }
 
@@ -179,6 +271,7 @@ static void
 vslr(enum VSL_tag_e tag, uint32_t vxid, const char *b, unsigned len)
 {
 	uint32_t *p;
+	uint32_t m[VSL_TAGW];
 	unsigned mlen;
 
 	mlen = cache_param->vsl_reclen;
@@ -187,7 +280,9 @@ vslr(enum VSL_tag_e tag, uint32_t vxid, const char *b, unsigned len)
 	if (len > mlen)
 		len = mlen;
 
-	p = vsl_get(len, 1, 0);
+	memset(m, 0, sizeof m);
+	vsl_tagbit(m, tag);
+	p = vsl_get(len, 1, 0, m);
 
 	memcpy(p + 2, b, len);
 
@@ -204,7 +299,7 @@ vslr(enum VSL_tag_e tag, uint32_t vxid, const char *b, unsigned len)
  * Add a unbuffered record to VSL
  *
  * NB: This variant should be used sparingly and only for low volume
- * NB: since it significantly adds to the mutex load on the VSL.
+ * NB: since every record contends for the VSL write pointer.
  */
 
 void
@@ -239,22 +334,118 @@ VSL(enum VSL_tag_e tag, uint32_t vxid, const char *fmt, ...)
 	va_end(ap);
 }
 
+/*--------------------------------------------------------------------
+ * Transaction sampling, see the vsl_sample parameter.
+ *
+ * A transaction which is not sampled stays in its VSL buffer until
+ * VSL_End(), which either flushes it all if it turned out to be of
+ * interest, or cuts it down to a summary.  Any earlier flush commits
+ * the transaction to being logged in full.
+ */
+
+static inline int
+vsl_held(const struct vsl_log *vsl)
+{
+
+	return (vsl->wid != 0 && !vsl->full && cache_param->vsl_sample > 1 &&
+	    VXID(vsl->wid) % cache_param->vsl_sample != 0);
+}
+
+static int
+vsl_interesting(const struct vsl_log *vsl)
+{
+	const uint32_t *p;
+
+	for (p = vsl->wlb; p < vsl->wlp; p = VSL_NEXT(p)) {
+		switch (VSL_TAG(p)) {
+		case SLT_Error:
+		case SLT_FetchError:
+		case SLT_VCL_Error:
+		case SLT_HttpGarbage:
+			return (1);
+		case SLT_RespStatus:
+		case SLT_BerespStatus:
+			if (VSL_CDATA(p)[0] >= '5')
+				return (1);
+			break;
+		default:
+			break;
+		}
+	}
+	return (0);
+}
+
+static inline int
+vsl_summary_tag(enum VSL_tag_e tag)
+{
+
+	switch (tag) {
+	case SLT_Begin:
+	case SLT_End:
+	case SLT_Link:
+	case SLT_ReqStart:
+	case SLT_ReqMethod:
+	case SLT_ReqURL:
+	case SLT_RespStatus:
+	case SLT_BereqMethod:
+	case SLT_BereqURL:
+	case SLT_BerespStatus:
+	case SLT_Timestamp:
+	case SLT_ReqAcct:
+	case SLT_BereqAcct:
+	case SLT_PipeAcct:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+static void
+vsl_summarize(struct vsl_log *vsl)
+{
+	uint32_t *p, *q, *n;
+	unsigned l;
+
+	q = vsl->wlb;
+	for (p = vsl->wlb; p < vsl->wlp; p = n) {
+		n = VSL_NEXT(p);
+		if (!vsl_summary_tag((enum VSL_tag_e)VSL_TAG(p))) {
+			vsl->wlr--;
+			continue;
+		}
+		l = pdiff(p, n);
+		if (q != p)
+			memmove(q, p, l);
+		q += l / sizeof *q;
+	}
+	assert(p == vsl->wlp);
+	vsl->wlp = q;
+	(void)__sync_add_and_fetch(&VSC_C_main->shm_summaries, 1);
+}
+
 /*--------------------------------------------------------------------*/
 
 void
 VSL_Flush(struct vsl_log *vsl, int overflow)
 {
 	uint32_t *p;
+	uint32_t m[VSL_TAGW];
 	unsigned l;
 
 	vsl_sanity(vsl);
 	l = pdiff(vsl->wlb, vsl->wlp);
 	if (l == 0)
 		return;
+	vsl->full = 1;
 
 	assert(l >= 8);
 
-	p = vsl_get(l, vsl->wlr, overflow);
+	memset(m, 0, sizeof m);
+	for (p = vsl->wlb; p < vsl->wlp; p = VSL_NEXT(p))
+		vsl_tagbit(m, (enum VSL_tag_e)VSL_TAG(p));
+	assert(p == vsl->wlp);
+
+	p = vsl_get(l, vsl->wlr, overflow, m);
 
 	memcpy(p + 2, vsl->wlb, l);
 	p[1] = l;
@@ -363,10 +554,53 @@ VSLb(struct vsl_log *vsl, enum VSL_tag_e tag, const char *fmt, ...)
 	va_end(ap);
 }
 
+/*--------------------------------------------------------------------
+ * Lay down a packed record, see vsl_int.h:  l bytes of numbers and a
+ * NUL-terminated label, which may be empty.
+ * Returns non-zero if it does not fit, so the caller can log text.
+ */
+
+static int
+vslb_packed(struct vsl_log *vsl, enum VSL_tag_e tag, const void *b,
+    unsigned l, const char *label)
+{
+	unsigned n, mlen;
+	uint32_t *p;
+	char *d;
+
+	mlen = cache_param->vsl_reclen;
+	if (l + 1 > mlen)
+		return (-1);
+
+	/* Truncate the label */
+	n = label == NULL ? 0 : strlen(label);
+	if (l + n + 1 > mlen)
+		n = mlen - (l + 1);
+
+	if (VSL_END(vsl->wlp, l + n + 1) >= vsl->wle)
+		VSL_Flush(vsl, 1);
+	assert(VSL_END(vsl->wlp, l + n + 1) < vsl->wle);
+	p = vsl->wlp;
+	d = VSL_DATA(p);
+	memcpy(d, b, l);
+	if (n > 0)
+		memcpy(d + l, label, n);
+	d[l + n] = '\0';
+	vsl->wlp = vsl_hdr(tag, p, l + n + 1, vsl->wid);
+	p[0] |= VSL_PACKEDMARKER;
+	assert(vsl->wlp < vsl->wle);
+	vsl->wlr++;
+
+	if (DO_DEBUG(DBG_SYNCVSL))
+		VSL_Flush(vsl, 0);
+	return (0);
+}
+
 void
 VSLb_ts(struct vsl_log *vsl, const char *event, double first, double *pprev,
     double now)
 {
+	double t[3];
 
 	/* XXX: Make an option to turn off some unnecessary timestamp
 	   logging. This must be done carefully because some functions
@@ -374,9 +608,59 @@ VSLb_ts(struct vsl_log *vsl, const char *event, double first, double *pprev,
 	   value for timeout calculation. */
 	vsl_sanity(vsl);
 	assert(!isnan(now) && now != 0.);
-	VSLb(vsl, SLT_Timestamp, "%s: %.6f %.6f %.6f",
-	    event, now, now - first, now - *pprev);
+	t[0] = now;
+	t[1] = now - first;
+	t[2] = now - *pprev;
 	*pprev = now;
+	if (cache_param->vsl_sample_slow > 0. &&
+	    t[1] > cache_param->vsl_sample_slow)
+		vsl->full = 1;
+	if (vsl_tag_is_masked(SLT_Timestamp))
+		return;
+	if (cache_param->vsl_packed &&
+	    !vslb_packed(vsl, SLT_Timestamp, t, sizeof t, event))
+		return;
+	VSLb(vsl, SLT_Timestamp, "%s: %.6f %.6f %.6f",
+	    event, t[0], t[1], t[2]);
+}
+
+/*--------------------------------------------------------------------
+ * A record of n counts, space separated in text.
+ */
+
+void
+VSLb_u64(struct vsl_log *vsl, enum VSL_tag_e tag, const uint64_t *v,
+    unsigned n)
+{
+	char *p;
+	unsigned u, l, mlen;
+
+	vsl_sanity(vsl);
+	AN(v);
+	assert(n > 0);
+	if (vsl_tag_is_masked(tag))
+		return;
+	if (cache_param->vsl_packed &&
+	    !vslb_packed(vsl, tag, v, n * sizeof *v, NULL))
+		return;
+
+	mlen = cache_param->vsl_reclen;
+	if (VSL_END(vsl->wlp, mlen + 1) >= vsl->wle)
+		VSL_Flush(vsl, 1);
+	p = VSL_DATA(vsl->wlp);
+	l = 0;
+	for (u = 0; u < n && l < mlen - 1; u++)
+		l += snprintf(p + l, mlen - l, "%s%ju",
+		    u ? " " : "", (uintmax_t)v[u]);
+	if (l > mlen - 1)
+		l = mlen - 1;	/* we truncate long fields */
+	p[l++] = '\0';
+	vsl->wlp = vsl_hdr(tag, vsl->wlp, l, vsl->wid);
+	assert(vsl->wlp < vsl->wle);
+	vsl->wlr++;
+
+	if (DO_DEBUG(DBG_SYNCVSL))
+		VSL_Flush(vsl, 0);
 }
 
 void
@@ -413,6 +697,155 @@ VSLb_bin(struct vsl_log *vsl, enum VSL_tag_e tag, ssize_t len, const void *ptr)
 	vsl->wlr++;
 }
 
+/*--------------------------------------------------------------------
+ * Span tracing, see the vsl_trace parameters.
+ *
+ * A traced transaction keeps a few spans in its workspace, and writes
+ * them straight to the shared log when it ends.  Span records carry
+ * their vxids in the payload rather than belonging to the transaction,
+ * so tracing neither depends on the transaction being logged nor
+ * makes readers group the log.  Untraced transactions get no span
+ * buffer, and only cost a NULL check per span.
+ */
+
+#define VSL_SPANS		16
+
+static const char * const vsl_span_name[VSL_SPAN__MAX] = {
+	[VSL_SPAN_LOOKUP] =		"lookup",
+	[VSL_SPAN_WAITINGLIST] =	"waitinglist",
+	[VSL_SPAN_CONNECT] =		"connect",
+	[VSL_SPAN_TTFB] =		"ttfb",
+	[VSL_SPAN_ESI] =		"esi",
+};
+
+struct vsl_span {
+	float			t0;	/* Since vsl_trace.t0 */
+	float			dur;	/* NAN while open */
+	enum vsl_span_e		what;
+};
+
+struct vsl_trace {
+	unsigned		magic;
+#define VSL_TRACE_MAGIC		0x1d6e0b35
+	unsigned		sampled;
+	uint32_t		parent;
+	unsigned		n;
+	double			t0;
+	struct vsl_span		span[VSL_SPANS];
+};
+
+static void
+vsl_trace_init(struct vsl_trace *tr, uint32_t parent, double t0)
+{
+
+	CHECK_OBJ_NOTNULL(tr, VSL_TRACE_MAGIC);
+	tr->parent = parent;
+	tr->n = 0;
+	tr->t0 = isnan(t0) ? VTIM_real() : t0;
+}
+
+/*
+ * Start tracing a transaction with a vxid, if it is sampled or the slow
+ * ones are wanted.  A transaction started by another is sampled along
+ * with it.  A NAN t0 means now.
+ */
+
+void
+VSL_Trace(struct vsl_log *vsl, struct ws *ws, uint32_t parent,
+    const struct vsl_log *pvsl, double t0)
+{
+	struct vsl_trace *tr;
+	unsigned sampled;
+
+	vsl_sanity(vsl);
+	AN(vsl->wid);
+	AZ(vsl->trace);
+	if (pvsl != NULL)
+		sampled = pvsl->trace != NULL && pvsl->trace->sampled;
+	else
+		sampled = cache_param->vsl_trace > 0 &&
+		    VXID(vsl->wid) % cache_param->vsl_trace == 0;
+	if (!sampled && cache_param->vsl_trace_slow == 0.)
+		return;
+	tr = WS_Alloc(ws, sizeof *tr);
+	if (tr == NULL)
+		return;
+	INIT_OBJ(tr, VSL_TRACE_MAGIC);
+	tr->sampled = sampled;
+	vsl_trace_init(tr, parent, t0);
+	vsl->trace = tr;
+}
+
+/* A NAN t1 leaves the span open, for VSL_SpanEnd() */
+
+void
+VSL_Span(const struct vsl_log *vsl, enum vsl_span_e what, double t0,
+    double t1)
+{
+	struct vsl_trace *tr;
+	struct vsl_span *sp;
+
+	tr = vsl->trace;
+	if (tr == NULL)
+		return;
+	CHECK_OBJ(tr, VSL_TRACE_MAGIC);
+	assert(what < VSL_SPAN__MAX);
+	if (tr->n == VSL_SPANS)
+		return;
+	sp = &tr->span[tr->n++];
+	sp->what = what;
+	sp->t0 = (float)(t0 - tr->t0);
+	sp->dur = isnan(t1) ? NAN : (float)(t1 - t0);
+}
+
+void
+VSL_SpanEnd(const struct vsl_log *vsl, enum vsl_span_e what, double t1)
+{
+	struct vsl_trace *tr;
+	struct vsl_span *sp;
+
+	tr = vsl->trace;
+	if (tr == NULL)
+		return;
+	CHECK_OBJ(tr, VSL_TRACE_MAGIC);
+	for (sp = tr->span + tr->n; sp > tr->span; ) {
+		sp--;
+		if (sp->what == what && isnan(sp->dur)) {
+			sp->dur = (float)(t1 - tr->t0) - sp->t0;
+			return;
+		}
+	}
+}
+
+static void
+vsl_trace_end(const struct vsl_log *vsl)
+{
+	const struct vsl_trace *tr;
+	const struct vsl_span *sp;
+	uint32_t vxid;
+	double now, dur;
+	unsigned u;
+
+	tr = vsl->trace;
+	CHECK_OBJ_NOTNULL(tr, VSL_TRACE_MAGIC);
+	now = VTIM_real();
+	if (!tr->sampled && (cache_param->vsl_trace_slow == 0. ||
+	    now - tr->t0 < cache_param->vsl_trace_slow))
+		return;
+
+	vxid = VXID(vsl->wid);
+	VSL(SLT_Span, 0, "%u %u %s %.6f %.6f", vxid, VXID(tr->parent),
+	    vsl->wid & VSL_BACKENDMARKER ? "bereq" : "req",
+	    tr->t0, now - tr->t0);
+	for (u = 0; u < tr->n; u++) {
+		sp = &tr->span[u];
+		/* Spans still open end with the transaction */
+		dur = isnan(sp->dur) ? now - (tr->t0 + sp->t0) : sp->dur;
+		VSL(SLT_Span, 0, "%u %u %s %.6f %.6f", vxid, vxid,
+		    vsl_span_name[sp->what], tr->t0 + sp->t0, dur);
+	}
+}
+
 /*--------------------------------------------------------------------
  * Setup a VSL buffer, allocate space if none provided.
  */
@@ -432,6 +865,8 @@ VSL_Setup(struct vsl_log *vsl, void *ptr, size_t len)
 	vsl->wle += len / sizeof(*vsl->wle);
 	vsl->wlr = 0;
 	vsl->wid = 0;
+	vsl->full = 0;
+	vsl->trace = NULL;
 	vsl_sanity(vsl);
 }
 
@@ -440,14 +875,21 @@ VSL_Setup(struct vsl_log *vsl, void *ptr, size_t len)
 void
 VSL_ChgId(struct vsl_log *vsl, const char *typ, const char *why, uint32_t vxid)
 {
+	struct vsl_trace *tr;
 	uint32_t ovxid;
 
 	vsl_sanity(vsl);
 	ovxid = vsl->wid;
+	tr = vsl->trace;
 	VSLb(vsl, SLT_Link, "%s %u %s", typ, VXID(vxid), why);
 	VSL_End(vsl);
 	vsl->wid = vxid;
 	VSLb(vsl, SLT_Begin, "%s %u %s", typ, VXID(ovxid), why);
+	if (tr != NULL) {
+		/* The new transaction is traced as a child of the old */
+		vsl_trace_init(tr, ovxid, NAN);
+		vsl->trace = tr;
+	}
 }
 
 /*--------------------------------------------------------------------*/
@@ -463,8 +905,55 @@ VSL_End(struct vsl_log *vsl)
 	t.b = p;
 	t.e = p;
 	VSLbt(vsl, SLT_End, t);
+	if (vsl_held(vsl) && !vsl_interesting(vsl))
+		vsl_summarize(vsl);
 	VSL_Flush(vsl, 0);
+	if (vsl->trace != NULL) {
+		vsl_trace_end(vsl);
+		vsl->trace = NULL;
+	}
 	vsl->wid = 0;
+	vsl->full = 0;
+}
+
+/*--------------------------------------------------------------------
+ * Collect the tags the live readers want, see vsl_priv.h
+ */
+
+static void
+vsl_demand_scan(void)
+{
+	uint32_t want[SLT__MAX / 32], t[SLT__MAX / 32];
+	char fn[sizeof VSL_DEMANDDIR + 256];
+	struct dirent *de;
+	intmax_t pid;
+	char *p;
+	DIR *d;
+	int fd;
+	unsigned u;
+
+	memset(want, 0, sizeof want);
+	d = opendir(VSL_DEMANDDIR);
+	if (d != NULL) {
+		while ((de = readdir(d)) != NULL) {
+			pid = strtoimax(de->d_name, &p, 10);
+			if (p == de->d_name || *p != '.' || pid <= 0)
+				continue;
+			if (kill((pid_t)pid, 0) && errno == ESRCH)
+				continue;
+			bprintf(fn, "%s/%s", VSL_DEMANDDIR, de->d_name);
+			fd = open(fn, O_RDONLY);
+			if (fd < 0)
+				continue;
+			if (read(fd, t, sizeof t) == sizeof t)
+				for (u = 0; u < SLT__MAX / 32; u++)
+					want[u] |= t[u];
+			closefd(&fd);
+		}
+		AZ(closedir(d));
+	}
+	for (u = 0; u < SLT__MAX / 32; u++)
+		vsl_demand[u] = want[u];
 }
 
 /*--------------------------------------------------------------------*/
@@ -478,6 +967,7 @@ vsm_cleaner(void *priv)
 		AZ(pthread_mutex_lock(&vsm_mtx));
 		VSM_common_cleaner(heritage.vsm, VSC_C_main);
 		AZ(pthread_mutex_unlock(&vsm_mtx));
+		vsl_demand_scan();
 		VTIM_sleep(1.1);
 	}
 	NEEDLESS(return NULL);
@@ -507,7 +997,8 @@ VSM_Init(void)
 	AZ(vsl_segment_n % VSL_SEGMENTS);
 	vsl_head->segment_n = vsl_segment_n;
 	vsl_ptr = vsl_head->log;
-	*vsl_ptr = VSL_ENDMARKER;
+	vsl_clean_n = vsl_segment_n - 1;
+	vsl_clean(vsl_segment_n + 1);
 
 	memset(vsl_head, 0, sizeof *vsl_head);
 	vsl_head->segsize = vsl_segsize;
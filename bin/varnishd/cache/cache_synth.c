@@ -0,0 +1,200 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Synthetic responses kept for reuse.
+ *
+ * When vcl_synth{} sets resp.ttl, the response it made is kept in a
+ * transient object, and later synth(status, reason) from the same VCL
+ * are answered from that object without running vcl_synth{} again.
+ *
+ * The objects are private to this cache, which holds a reference on
+ * each.  The requests delivering them must not let go of the body as
+ * they go, see req->synth_cached.  There are at most synth_cache of
+ * them, the least recently used one gives way to a new one.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache/cache.h"
+
+#include "hash/hash_slinger.h"
+
+struct syn_entry {
+	unsigned			magic;
+#define SYN_ENTRY_MAGIC			0x5a73be1f
+	VTAILQ_ENTRY(syn_entry)		list;
+	const struct vcl		*vcl;	/* NULL when discarded */
+	uint16_t			status;
+	double				t_expire;
+	struct objcore			*oc;
+	char				*reason;
+};
+
+static VTAILQ_HEAD(syn_head, syn_entry) syn_list =
+    VTAILQ_HEAD_INITIALIZER(syn_list);
+static unsigned			syn_n;
+static struct lock		syn_mtx;
+
+static void
+syn_free(struct worker *wrk, struct syn_entry *se)
+{
+
+	CHECK_OBJ_NOTNULL(se, SYN_ENTRY_MAGIC);
+	(void)HSH_DerefObjCore(wrk, &se->oc, 0);
+	free(se->reason);
+	FREE_OBJ(se);
+}
+
+/*--------------------------------------------------------------------
+ * Find a live response for req->err_code and req->err_reason in this
+ * VCL, and hand the request a reference to it.
+ */
+
+struct objcore *
+SYN_Lookup(struct worker *wrk, const struct req *req, double now)
+{
+	struct syn_entry *se, *se2, *old = NULL;
+	struct objcore *oc = NULL;
+	const char *reason;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+
+	if (syn_n == 0 || cache_param->synth_cache == 0)
+		return (NULL);
+	reason = req->err_reason != NULL ? req->err_reason : "";
+
+	Lck_Lock(&syn_mtx);
+	VTAILQ_FOREACH_SAFE(se, &syn_list, list, se2) {
+		CHECK_OBJ_NOTNULL(se, SYN_ENTRY_MAGIC);
+		if (se->vcl != req->vcl || se->status != req->err_code ||
+		    strcmp(se->reason, reason))
+			continue;
+		if (se->t_expire <= now) {
+			VTAILQ_REMOVE(&syn_list, se, list);
+			syn_n--;
+			old = se;
+			break;
+		}
+		HSH_Ref(se->oc);
+		oc = se->oc;
+		VTAILQ_REMOVE(&syn_list, se, list);
+		VTAILQ_INSERT_HEAD(&syn_list, se, list);
+		break;
+	}
+	Lck_Unlock(&syn_mtx);
+	if (old != NULL)
+		syn_free(wrk, old);
+	return (oc);
+}
+
+/*--------------------------------------------------------------------
+ * Keep the response in req->objcore for ttl seconds.  It must be
+ * complete, with the headers in OA_HEADERS.
+ */
+
+void
+SYN_Insert(struct worker *wrk, const struct req *req, double now,
+    double ttl)
+{
+	struct syn_entry *se, *old, *evict = NULL;
+	const char *reason;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
+	AZ(req->objcore->boc);
+
+	if (cache_param->synth_cache == 0)
+		return;
+	reason = req->err_reason != NULL ? req->err_reason : "";
+
+	ALLOC_OBJ(se, SYN_ENTRY_MAGIC);
+	if (se == NULL)
+		return;
+	se->reason = strdup(reason);
+	if (se->reason == NULL) {
+		FREE_OBJ(se);
+		return;
+	}
+	se->vcl = req->vcl;
+	se->status = req->err_code;
+	se->t_expire = now + ttl;
+	HSH_Ref(req->objcore);
+	se->oc = req->objcore;
+
+	Lck_Lock(&syn_mtx);
+	VTAILQ_FOREACH(old, &syn_list, list) {
+		if (old->vcl == se->vcl && old->status == se->status &&
+		    !strcmp(old->reason, se->reason))
+			break;
+	}
+	if (old != NULL)
+		VTAILQ_REMOVE(&syn_list, old, list);
+	else if (++syn_n > cache_param->synth_cache) {
+		evict = VTAILQ_LAST(&syn_list, syn_head);
+		AN(evict);
+		VTAILQ_REMOVE(&syn_list, evict, list);
+		syn_n--;
+	}
+	VTAILQ_INSERT_HEAD(&syn_list, se, list);
+	Lck_Unlock(&syn_mtx);
+
+	if (old != NULL)
+		syn_free(wrk, old);
+	if (evict != NULL)
+		syn_free(wrk, evict);
+}
+
+/*--------------------------------------------------------------------
+ * A VCL is going away.  Its entries can no longer match, and make way
+ * for new ones first.  The objects are left for a worker to free.
+ */
+
+void
+SYN_Flush(const struct vcl *vcl)
+{
+	struct syn_entry *se, *se2;
+
+	Lck_Lock(&syn_mtx);
+	VTAILQ_FOREACH_SAFE(se, &syn_list, list, se2) {
+		if (se->vcl != vcl)
+			continue;
+		se->vcl = NULL;
+		se->t_expire = 0.;
+		VTAILQ_REMOVE(&syn_list, se, list);
+		VTAILQ_INSERT_TAIL(&syn_list, se, list);
+	}
+	Lck_Unlock(&syn_mtx);
+}
+
+void
+SYN_Init(void)
+{
+
+	Lck_New(&syn_mtx, lck_synth);
+}
@@ -0,0 +1,380 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Surrogate keys, or tags.
+ *
+ * Objects get keys from the tag_header of the backend response when they
+ * are fetched, and all objects under a key can be purged at once, which
+ * costs in proportion to the number of objects hit, rather than a ban
+ * which every object in the cache has to be tested against.
+ *
+ * The keys live in trees, sharded on a hash of the key, each under its
+ * own lock.  Each key has the list of references to its objects, and each
+ * objcore has the chain of its references, so that they can be taken
+ * out when it goes away.  That happens in HSH_DerefObjCore() when the
+ * last reference is dropped, which means that an objcore found from a
+ * key with the shard locked is still there, but if its refcount is
+ * already zero it is on its way out and must be left alone.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "cache.h"
+#include "cache_priv.h"
+
+#include "hash/hash_slinger.h"
+#include "vcli_serve.h"
+#include "vtim.h"
+#include "vtree.h"
+
+#define TAG_NSHARD		64
+#define TAG_SEP			" \t,"
+
+struct tag_ref;
+
+struct tag_key {
+	unsigned			magic;
+#define TAG_KEY_MAGIC			0x2d8e47c1
+	uint32_t			hash;
+	VRB_ENTRY(tag_key)		tree;
+	VTAILQ_HEAD(, tag_ref)		refs;
+	char				name[];
+};
+
+struct tag_ref {
+	unsigned			magic;
+#define TAG_REF_MAGIC			0x61f0c5da
+	struct objcore			*oc;
+	struct tag_key			*key;
+	VTAILQ_ENTRY(tag_ref)		list;	/* on the key */
+	struct tag_ref			*next;	/* on the objcore */
+};
+
+VRB_HEAD(tag_tree, tag_key);
+
+static struct tag_shard {
+	struct lock			mtx;
+	struct tag_tree			keys;
+} tag_shards[TAG_NSHARD];
+
+static inline int
+tag_cmp(const struct tag_key *a, const struct tag_key *b)
+{
+
+	if (a->hash != b->hash)
+		return (a->hash < b->hash ? -1 : 1);
+	return (strcmp(a->name, b->name));
+}
+
+VRB_PROTOTYPE_STATIC(tag_tree, tag_key, tree, tag_cmp)
+VRB_GENERATE_STATIC(tag_tree, tag_key, tree, tag_cmp)
+
+/* FNV-1a, of the l first characters of s */
+
+static uint32_t
+tag_hash(const char *s, size_t l)
+{
+	uint32_t h = 2166136261U;
+
+	for (; l > 0; l--, s++)
+		h = (h ^ (uint8_t)*s) * 16777619U;
+	return (h);
+}
+
+static struct tag_shard *
+tag_shard(uint32_t hash)
+{
+
+	return (&tag_shards[(hash >> 16) % TAG_NSHARD]);
+}
+
+/*--------------------------------------------------------------------
+ * Find the key with the l first characters of s, the shard must be
+ * locked.
+ */
+
+static struct tag_key *
+tag_find(struct tag_shard *sh, uint32_t hash, const char *s, size_t l)
+{
+	struct tag_key *k;
+	int i;
+
+	Lck_AssertHeld(&sh->mtx);
+	k = VRB_ROOT(&sh->keys);
+	while (k != NULL) {
+		CHECK_OBJ(k, TAG_KEY_MAGIC);
+		if (hash != k->hash)
+			i = hash < k->hash ? -1 : 1;
+		else {
+			i = strncmp(s, k->name, l);
+			if (i == 0 && k->name[l] == '\0')
+				return (k);
+			if (i == 0)
+				i = -1;		/* a prefix of k->name */
+		}
+		k = i < 0 ? VRB_LEFT(k, tree) : VRB_RIGHT(k, tree);
+	}
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Give a fresh objcore the keys from the tag_header of the response.
+ */
+
+void
+TAG_Insert(struct worker *wrk, struct objcore *oc, const struct http *hp)
+{
+	struct tag_shard *sh;
+	struct tag_key *k;
+	struct tag_ref *r, *r2;
+	struct hdrparam hdr;
+	const char *p;
+	uint32_t hash;
+	size_t l;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (oc->tags != NULL)		/* from an earlier vbf_beresp2obj() */
+		return;
+
+	hdr = cache_param->tag_header;
+	if (*hdr.hdr == '\0' || !http_GetHdr(hp, hdr.hdr, &p))
+		return;
+
+	for (; *p != '\0'; p += l) {
+		p += strspn(p, TAG_SEP);
+		l = strcspn(p, TAG_SEP);
+		if (l == 0)
+			break;
+		for (r2 = oc->tags; r2 != NULL; r2 = r2->next)
+			if (!strncmp(r2->key->name, p, l) &&
+			    r2->key->name[l] == '\0')
+				break;
+		if (r2 != NULL)
+			continue;
+		ALLOC_OBJ(r, TAG_REF_MAGIC);
+		if (r == NULL)
+			break;
+		r->oc = oc;
+		hash = tag_hash(p, l);
+		sh = tag_shard(hash);
+		Lck_Lock(&sh->mtx);
+		k = tag_find(sh, hash, p, l);
+		if (k == NULL) {
+			k = malloc(sizeof *k + l + 1);
+			if (k == NULL) {
+				Lck_Unlock(&sh->mtx);
+				FREE_OBJ(r);
+				break;
+			}
+			INIT_OBJ(k, TAG_KEY_MAGIC);
+			k->hash = hash;
+			VTAILQ_INIT(&k->refs);
+			memcpy(k->name, p, l);
+			k->name[l] = '\0';
+			AZ(VRB_INSERT(tag_tree, &sh->keys, k));
+			wrk->stats->n_tag_key++;
+		}
+		r->key = k;
+		VTAILQ_INSERT_TAIL(&k->refs, r, list);
+		Lck_Unlock(&sh->mtx);
+		r->next = oc->tags;
+		oc->tags = r;
+		wrk->stats->n_tag_ref++;
+	}
+}
+
+/*--------------------------------------------------------------------
+ * The objcore is going away, take it out of its keys.
+ */
+
+void
+TAG_DestroyObj(struct worker *wrk, struct objcore *oc)
+{
+	struct tag_shard *sh;
+	struct tag_key *k;
+	struct tag_ref *r;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(oc->refcnt);
+	while (oc->tags != NULL) {
+		r = oc->tags;
+		CHECK_OBJ(r, TAG_REF_MAGIC);
+		oc->tags = r->next;
+		k = r->key;
+		CHECK_OBJ_NOTNULL(k, TAG_KEY_MAGIC);
+		sh = tag_shard(k->hash);
+		Lck_Lock(&sh->mtx);
+		VTAILQ_REMOVE(&k->refs, r, list);
+		if (VTAILQ_EMPTY(&k->refs)) {
+			VRB_REMOVE(tag_tree, &sh->keys, k);
+			wrk->stats->n_tag_key--;
+		} else
+			k = NULL;
+		Lck_Unlock(&sh->mtx);
+		free(k);
+		FREE_OBJ(r);
+		wrk->stats->n_tag_ref--;
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Purge the objects under one key.  They are collected with a reference
+ * held, unless they are already on their way out, and dealt with once
+ * the shard lock has been dropped.  Soft purges leave grace and keep
+ * alone.  Busy objects are skipped, as HSH_Purge() does.
+ */
+
+static unsigned
+tag_purge1(struct worker *wrk, const char *p, size_t l, int soft,
+    double now)
+{
+	struct tag_shard *sh;
+	struct tag_key *k;
+	struct tag_ref *r;
+	struct objcore *oc, **ocs = NULL;
+	struct objhead *oh;
+	unsigned n = 0, space = 0, u, purged = 0;
+	uint32_t hash;
+	int rc, skip;
+
+	hash = tag_hash(p, l);
+	sh = tag_shard(hash);
+	Lck_Lock(&sh->mtx);
+	k = tag_find(sh, hash, p, l);
+	if (k != NULL) {
+		VTAILQ_FOREACH(r, &k->refs, list) {
+			CHECK_OBJ(r, TAG_REF_MAGIC);
+			oc = r->oc;
+			do {
+				rc = oc->refcnt;
+			} while (rc > 0 && !__sync_bool_compare_and_swap(
+			    &oc->refcnt, rc, rc + 1));
+			if (rc <= 0)
+				continue;
+			if (n == space) {
+				space = space ? 2 * space : 64;
+				ocs = realloc(ocs, space * sizeof *ocs);
+				AN(ocs);
+			}
+			ocs[n++] = oc;
+		}
+	}
+	Lck_Unlock(&sh->mtx);
+
+	for (u = 0; u < n; u++) {
+		oc = ocs[u];
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		oh = oc->objhead;
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		Lck_Lock(&oh->mtx);
+		skip = oc->flags & (OC_F_BUSY | OC_F_DYING);
+		Lck_Unlock(&oh->mtx);
+		if (!skip) {
+			if (soft)
+				EXP_RearmBatch(wrk, oc, now, 0, NAN, NAN);
+			else
+				HSH_Kill(oc);
+			purged++;
+		}
+	}
+	EXP_Flush(wrk);
+	for (u = 0; u < n; u++)
+		(void)HSH_DerefObjCore(wrk, &ocs[u], 0);
+	free(ocs);
+	return (purged);
+}
+
+unsigned
+TAG_Purge(struct worker *wrk, const char *keys, int soft)
+{
+	const char *p;
+	unsigned n = 0;
+	double now;
+	size_t l;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(keys);
+	now = VTIM_real();
+	for (p = keys; *p != '\0'; p += l) {
+		p += strspn(p, TAG_SEP);
+		l = strcspn(p, TAG_SEP);
+		if (l == 0)
+			break;
+		n += tag_purge1(wrk, p, l, soft, now);
+		wrk->stats->tag_purge++;
+	}
+	wrk->stats->tag_purged += n;
+	return (n);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void __match_proto__(cli_func_t)
+tag_cli_purge(struct cli *cli, const char * const *av, void *priv)
+{
+	struct worker *wrk;
+	unsigned n = 0;
+	int i = 2, soft = 0;
+
+	(void)priv;
+	if (av[i] != NULL && !strcmp(av[i], "-s")) {
+		soft = 1;
+		i++;
+	}
+	if (av[i] == NULL) {
+		VCLI_Out(cli, "No keys given");
+		VCLI_SetResult(cli, CLIS_PARAM);
+		return;
+	}
+	ALLOC_OBJ(wrk, WORKER_MAGIC);
+	AN(wrk);
+	for (; av[i] != NULL; i++)
+		n += TAG_Purge(wrk, av[i], soft);
+	Pool_Sumstat(wrk);
+	FREE_OBJ(wrk);
+	VCLI_Out(cli, "%u objects %spurged", n, soft ? "soft " : "");
+}
+
+static struct cli_proto tag_cmds[] = {
+	{ CLICMD_TAG_PURGE,			"", tag_cli_purge },
+	{ NULL }
+};
+
+void
+TAG_Init(void)
+{
+	unsigned u;
+
+	for (u = 0; u < TAG_NSHARD; u++) {
+		Lck_New(&tag_shards[u].mtx, lck_tag);
+		VRB_INIT(&tag_shards[u].keys);
+	}
+	CLI_AddFuncs(tag_cmds);
+}
@@ -37,6 +37,7 @@ struct req;
 struct boc;
 
 typedef void vtr_deliver_f (struct req *, struct boc *, int sendbody);
+typedef int vtr_deliver_static_f (struct req *, const char *, unsigned);
 typedef void vtr_req_body_f (struct req *);
 typedef void vtr_sess_panic_f (struct vsb *, const struct sess *);
 typedef void vtr_req_panic_f (struct vsb *, const struct req *);
@@ -57,6 +58,7 @@ struct transport {
 	vtr_req_fail_f			*req_fail;
 	vtr_req_body_f			*req_body;
 	vtr_deliver_f			*deliver;
+	vtr_deliver_static_f		*deliver_static;
 	vtr_sess_panic_f		*sess_panic;
 	vtr_req_panic_f			*req_panic;
 	vtr_reembark_f			*reembark;
@@ -67,6 +69,9 @@ struct transport {
 extern struct transport PROXY_transport;
 extern struct transport HTTP1_transport;
 extern struct transport H2_transport;
+#if defined(HAVE_OPENSSL)
+extern struct transport TLS_transport;
+#endif
 htc_complete_f H2_prism_complete;
 
 const struct transport *XPORT_ByNumber(uint16_t no);
@@ -0,0 +1,198 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Minimal io_uring(7) ring handling, shared by the io_uring waiter and
+ * the io_uring HTTP/1 delivery path.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <errno.h>
+
+#include "cache.h"
+#include "cache_uring.h"
+
+#include "vmb.h"
+
+/*--------------------------------------------------------------------*/
+
+static void *
+vur_mmap(int fd, size_t sz, off_t off)
+{
+	void *p;
+
+	p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	    fd, off);
+	if (p == MAP_FAILED)
+		return (NULL);
+	return (p);
+}
+
+#define VUR_PTR(vur, ring, off)	((void *)((char *)(vur)->ring + (off)))
+
+int
+VUR_Init(struct vur *vur, unsigned entries)
+{
+	struct io_uring_params p;
+	unsigned u, *array;
+
+	AN(vur);
+	INIT_OBJ(vur, VUR_MAGIC);
+
+	memset(&p, 0, sizeof p);
+	vur->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (vur->fd < 0)
+		return (-1);
+	vur->features = p.features;
+
+	vur->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	vur->cq_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (vur->cq_size > vur->sq_size)
+			vur->sq_size = vur->cq_size;
+		vur->sq_ring = vur_mmap(vur->fd, vur->sq_size,
+		    IORING_OFF_SQ_RING);
+		vur->cq_ring = vur->sq_ring;
+	} else {
+		vur->sq_ring = vur_mmap(vur->fd, vur->sq_size,
+		    IORING_OFF_SQ_RING);
+		vur->cq_ring = vur_mmap(vur->fd, vur->cq_size,
+		    IORING_OFF_CQ_RING);
+	}
+	vur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	vur->sqes = vur_mmap(vur->fd, vur->sqes_size, IORING_OFF_SQES);
+	if (vur->sq_ring == NULL || vur->cq_ring == NULL || vur->sqes == NULL) {
+		VUR_Fini(vur);
+		return (-1);
+	}
+
+	vur->sq_head = VUR_PTR(vur, sq_ring, p.sq_off.head);
+	vur->sq_tail = VUR_PTR(vur, sq_ring, p.sq_off.tail);
+	vur->sq_mask = *(unsigned *)VUR_PTR(vur, sq_ring, p.sq_off.ring_mask);
+	vur->sq_entries = p.sq_entries;
+	/* The index array is the identity, the sqes are used in order */
+	array = VUR_PTR(vur, sq_ring, p.sq_off.array);
+	for (u = 0; u < p.sq_entries; u++)
+		array[u] = u;
+
+	vur->cq_head = VUR_PTR(vur, cq_ring, p.cq_off.head);
+	vur->cq_tail = VUR_PTR(vur, cq_ring, p.cq_off.tail);
+	vur->cq_mask = *(unsigned *)VUR_PTR(vur, cq_ring, p.cq_off.ring_mask);
+	vur->cqes = VUR_PTR(vur, cq_ring, p.cq_off.cqes);
+	return (0);
+}
+
+void
+VUR_Fini(struct vur *vur)
+{
+
+	CHECK_OBJ_NOTNULL(vur, VUR_MAGIC);
+	if (vur->sqes != NULL)
+		AZ(munmap(vur->sqes, vur->sqes_size));
+	if (vur->cq_ring != NULL && vur->cq_ring != vur->sq_ring)
+		AZ(munmap(vur->cq_ring, vur->cq_size));
+	if (vur->sq_ring != NULL)
+		AZ(munmap(vur->sq_ring, vur->sq_size));
+	closefd(&vur->fd);
+	memset(vur, 0, sizeof *vur);
+}
+
+/*--------------------------------------------------------------------*/
+
+int
+VUR_Enter(const struct vur *vur, unsigned to_submit, unsigned min_complete,
+    unsigned flags, const void *arg, size_t argsz)
+{
+	int i;
+
+	CHECK_OBJ_NOTNULL(vur, VUR_MAGIC);
+	do {
+		i = syscall(__NR_io_uring_enter, vur->fd, to_submit,
+		    min_complete, flags, arg, argsz);
+	} while (i < 0 && errno == EINTR);
+	return (i);
+}
+
+/*--------------------------------------------------------------------
+ * Return a cleared sqe at the tail of the submission queue, or NULL if
+ * the queue is full.  It is not visible to the kernel until VUR_Commit().
+ */
+
+struct io_uring_sqe *
+VUR_Sqe(const struct vur *vur)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail;
+
+	CHECK_OBJ_NOTNULL(vur, VUR_MAGIC);
+	tail = *vur->sq_tail;
+	VRMB();
+	if (tail - *vur->sq_head == vur->sq_entries)
+		return (NULL);
+	sqe = &vur->sqes[tail & vur->sq_mask];
+	memset(sqe, 0, sizeof *sqe);
+	return (sqe);
+}
+
+void
+VUR_Commit(const struct vur *vur)
+{
+
+	CHECK_OBJ_NOTNULL(vur, VUR_MAGIC);
+	VWMB();
+	*vur->sq_tail = *vur->sq_tail + 1;
+}
+
+/*--------------------------------------------------------------------*/
+
+const struct io_uring_cqe *
+VUR_Peek(const struct vur *vur)
+{
+	unsigned head;
+
+	CHECK_OBJ_NOTNULL(vur, VUR_MAGIC);
+	head = *vur->cq_head;
+	if (head == *vur->cq_tail)
+		return (NULL);
+	VRMB();
+	return (&vur->cqes[head & vur->cq_mask]);
+}
+
+void
+VUR_Advance(const struct vur *vur)
+{
+
+	CHECK_OBJ_NOTNULL(vur, VUR_MAGIC);
+	VMB();
+	*vur->cq_head = *vur->cq_head + 1;
+}
+
+#endif /* defined(HAVE_IO_URING) */
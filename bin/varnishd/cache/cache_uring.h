@@ -0,0 +1,69 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Minimal io_uring(7) ring handling, without liburing.
+ *
+ * The submission queue is single producer, callers must serialize
+ * VUR_Sqe()/VUR_Commit(), and likewise VUR_Peek()/VUR_Advance().
+ */
+
+#if defined(HAVE_IO_URING)
+
+#include <linux/io_uring.h>
+
+struct vur {
+	unsigned		magic;
+#define VUR_MAGIC		0x7c0e59a1
+	int			fd;
+	unsigned		features;
+
+	void			*sq_ring;
+	size_t			sq_size;
+	void			*cq_ring;
+	size_t			cq_size;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_size;
+
+	volatile unsigned	*sq_head;
+	volatile unsigned	*sq_tail;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+
+	volatile unsigned	*cq_head;
+	volatile unsigned	*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+};
+
+int VUR_Init(struct vur *, unsigned entries);
+void VUR_Fini(struct vur *);
+int VUR_Enter(const struct vur *, unsigned to_submit, unsigned min_complete,
+    unsigned flags, const void *arg, size_t argsz);
+struct io_uring_sqe *VUR_Sqe(const struct vur *);
+void VUR_Commit(const struct vur *);
+const struct io_uring_cqe *VUR_Peek(const struct vur *);
+void VUR_Advance(const struct vur *);
+
+#endif /* defined(HAVE_IO_URING) */
@@ -52,6 +52,13 @@
  *	0xff,			\   Length field
  *	0xff,			/
  *      '\0'			>   Terminator
+ *
+ * To spare lookups the walk through the objects of a objhead with many
+ * variants, each objcore also carries a hash of its vary string: The
+ * top 16 bits hash the header names, the bottom 16 bits their values.
+ * A request hashes its own values the first time it meets a set of
+ * header names, after which objects with the same names but other
+ * values are rejected without looking at them.
  */
 
 #include "config.h"
@@ -68,6 +75,9 @@ static unsigned VRY_Validate(const uint8_t *vary);
 /**********************************************************************
  * Create a Vary matching string from a Vary header
  *
+ * The string is built in the busyobj workspace, and only lands in the
+ * heap if it does not fit there.  VSB_destroy() *psb when done with it.
+ *
  * Return value:
  * <0: Parse error
  *  0: No Vary header on object
@@ -78,7 +88,8 @@ int
 VRY_Create(struct busyobj *bo, struct vsb **psb)
 {
 	const char *v, *p, *q, *h, *e;
-	struct vsb *sb, *sbh;
+	struct vsb *sb, sbh[1];
+	char hbuf[1 + INT8_MAX + 3];	/* len, name, ":", NUL, NUL */
 	unsigned l;
 	int error = 0;
 
@@ -93,12 +104,15 @@ VRY_Create(struct busyobj *bo, struct vsb **psb)
 		return (0);
 
 	/* For vary matching string */
-	sb = VSB_new_auto();
+	sb = WS_Alloc(bo->ws, sizeof *sb);
+	if (sb != NULL)
+		AN(WS_VSB_new(sb, bo->ws));
+	else
+		sb = VSB_new_auto();
 	AN(sb);
 
-	/* For header matching strings */
-	sbh = VSB_new_auto();
-	AN(sbh);
+	/* For header matching strings, see the length check below */
+	AN(VSB_new(sbh, hbuf, sizeof hbuf, VSB_FIXEDLEN));
 
 	for (p = v; *p; p++) {
 
@@ -157,8 +171,9 @@ VRY_Create(struct busyobj *bo, struct vsb **psb)
 		p = q;
 	}
 
+	VSB_delete(sbh);
 	if (error) {
-		VSB_destroy(&sbh);
+		(void)WS_VSB_finish(sb, bo->ws, NULL);
 		VSB_destroy(&sb);
 		return (-1);
 	}
@@ -166,8 +181,7 @@ VRY_Create(struct busyobj *bo, struct vsb **psb)
 	/* Terminate vary matching string */
 	VSB_printf(sb, "%c%c%c", 0xff, 0xff, 0);
 
-	VSB_destroy(&sbh);
-	AZ(VSB_finish(sb));
+	AN(WS_VSB_finish(sb, bo->ws, NULL));
 	*psb = sb;
 	return (VSB_len(sb));
 }
@@ -215,6 +229,110 @@ vry_cmp(const uint8_t *v1, const uint8_t *v2)
 	return (retval);
 }
 
+/**********************************************************************
+ * Vary hashes
+ *
+ * Accept-Encoding is left out of the values, so that the hash stays a
+ * necessary condition for a match whatever http_gzip_support says.
+ * Zero means no hash, objects from before a restart of a persistent
+ * stevedore have none.
+ */
+
+static uint32_t
+vry_fnv(uint32_t h, const void *ptr, size_t len)
+{
+	const uint8_t *p = ptr;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x01000193;
+	}
+	return (h);
+}
+
+static uint32_t
+vry_value(uint32_t h, const uint8_t *name, const char *v, unsigned l)
+{
+	uint8_t b[2];
+
+	if (!strcasecmp(H_Accept_Encoding, (const char *)name))
+		return (h);
+	vbe16enc(b, (uint16_t)l);
+	h = vry_fnv(h, b, sizeof b);
+	if (l != 0xffff)
+		h = vry_fnv(h, v, l);
+	return (h);
+}
+
+static uint32_t
+vry_hash_fin(uint32_t nh, uint32_t vh)
+{
+	uint32_t h;
+
+	h = ((nh ^ (nh >> 16)) << 16) | ((vh ^ (vh >> 16)) & 0xffff);
+	return (h == 0 ? 1 : h);
+}
+
+uint32_t
+VRY_Hash(const uint8_t *vary)
+{
+	uint32_t nh = 0x811c9dc5, vh = 0x811c9dc5;
+	unsigned l;
+
+	AN(vary);
+	while (vary[2]) {
+		l = vbe16dec(vary);
+		nh = vry_fnv(nh, vary + 2, vary[2] + 2);
+		vh = vry_value(vh, vary + 2,
+		    (const char *)vary + 2 + vary[2] + 2, l);
+		vary += VRY_Len(vary);
+	}
+	return (vry_hash_fin(nh, vh));
+}
+
+/*
+ * Hash the values of this request for the header names in vary
+ */
+static uint32_t
+vry_hash_req(const struct req *req, const uint8_t *vary)
+{
+	uint32_t nh = 0x811c9dc5, vh = 0x811c9dc5;
+	const char *h, *e;
+	unsigned l;
+
+	while (vary[2]) {
+		nh = vry_fnv(nh, vary + 2, vary[2] + 2);
+		if (http_GetHdr(req->http, (const char *)(vary + 2), &h)) {
+			e = strchr(h, '\0');
+			while (e > h && vct_issp(e[-1]))
+				e--;
+			l = e - h;
+		} else {
+			h = NULL;
+			l = 0xffff;
+		}
+		vh = vry_value(vh, vary + 2, h, l);
+		vary += VRY_Len(vary);
+	}
+	return (vry_hash_fin(nh, vh));
+}
+
+/*
+ * Return zero if the hash of an objects vary string rules out a match.
+ */
+
+int
+VRY_HashMatch(const struct req *req, uint32_t hash)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	if (hash == 0 || req->vary_hash == 0)
+		return (1);
+	if ((hash >> 16) != (req->vary_hash >> 16))
+		return (1);		/* Other header names */
+	return (hash == req->vary_hash);
+}
+
 /**********************************************************************
  * Prepare predictive vary string
  *
@@ -236,6 +354,7 @@ VRY_Prep(struct req *req)
 	}
 	req->vary_b = (void*)req->ws->f;
 	req->vary_e = (void*)req->ws->r;
+	req->vary_hash = 0;
 	if (req->vary_b + 2 < req->vary_e)
 		req->vary_b[2] = '\0';
 }
@@ -280,10 +399,13 @@ VRY_Finish(struct req *req, enum vry_finish_flag flg)
  *
  * Return zero if there is certainly no match.
  * Return non-zero if there could be a match or if we couldn't tell.
+ *
+ * If the object has a vary hash, which VRY_HashMatch() could not
+ * judge, learn the request's hash for these header names.
  */
 
 int
-VRY_Match(struct req *req, const uint8_t *vary)
+VRY_Match(struct req *req, const uint8_t *vary, uint32_t hash)
 {
 	uint8_t *vsp = req->vary_b;
 	const char *h, *e;
@@ -292,6 +414,8 @@ VRY_Match(struct req *req, const uint8_t *vary)
 
 	AN(vsp);
 	AN(vary);
+	if (hash != 0 && (req->vary_hash >> 16) != (hash >> 16))
+		req->vary_hash = vry_hash_req(req, vary);
 	while (vary[2]) {
 		if (vsp + 2 >= req->vary_e) {
 			/*
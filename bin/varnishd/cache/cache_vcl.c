@@ -43,6 +43,7 @@
 #include "cache_director.h"
 #include "cache_backend.h"
 #include "vcli_serve.h"
+#include "vtim.h"
 
 static const char * const VCL_TEMP_INIT = "init";
 static const char * const VCL_TEMP_COLD = "cold";
@@ -526,6 +527,37 @@ VRT_count(VRT_CTX, unsigned u)
 		    ctx->vcl->conf->ref[u].line, ctx->vcl->conf->ref[u].pos);
 }
 
+/*--------------------------------------------------------------------
+ * Profiling, only called from VCL compiled with vcc_profile
+ */
+
+void
+VRT_prof_count(VRT_CTX, unsigned u)
+{
+
+	VRT_count(ctx, u);
+	(void)__sync_add_and_fetch(&ctx->vcl->conf->ref[u].count, 1);
+}
+
+void
+VRT_prof_call(VRT_CTX, unsigned u, void (*func)(VRT_CTX))
+{
+	struct vrt_ref *ref;
+	double t0;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->vcl, VCL_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->vcl->conf, VCL_CONF_MAGIC);
+	assert(u < ctx->vcl->conf->nref);
+	AN(func);
+	ref = &ctx->vcl->conf->ref[u];
+	t0 = VTIM_mono();
+	func(ctx);
+	(void)__sync_add_and_fetch(&ref->ns,
+	    (unsigned long long)((VTIM_mono() - t0) * 1e9));
+	(void)__sync_add_and_fetch(&ref->count, 1);
+}
+
 VCL_VCL
 VRT_vcl_get(VRT_CTX, const char *name)
 {
@@ -804,6 +836,7 @@ VCL_Poll(void)
 			ctx->vcl = vcl;
 			AZ(vcl_send_event(ctx, VCL_EVENT_DISCARD));
 			vcl_KillBackends(vcl);
+			SYN_Flush(vcl);
 			free(vcl->loaded_name);
 			VCL_Close(&vcl);
 			VSC_C_main->n_vcl--;
@@ -1000,6 +1033,44 @@ vcl_cli_show(struct cli *cli, const char * const *av, void *priv)
 	}
 }
 
+static void __match_proto__(cli_func_t)
+vcl_cli_profile(struct cli *cli, const char * const *av, void *priv)
+{
+	const struct VCL_conf *conf;
+	const struct vrt_ref *ref;
+	struct vcl *vcl;
+	unsigned u, n = 0;
+
+	ASSERT_CLI();
+	AZ(priv);
+	vcl = vcl_find(av[2]);
+	if (vcl == NULL) {
+		VCLI_Out(cli, "No VCL named '%s'", av[2]);
+		VCLI_SetResult(cli, CLIS_PARAM);
+		return;
+	}
+	CHECK_OBJ_NOTNULL(vcl, VCL_MAGIC);
+	conf = vcl->conf;
+	CHECK_OBJ_NOTNULL(conf, VCL_CONF_MAGIC);
+	for (u = 1; u < conf->nref; u++) {
+		ref = &conf->ref[u];
+		if (ref->count == 0)
+			continue;
+		if (n++ == 0)
+			VCLI_Out(cli, "%12s %14s  %s\n",
+			    "count", "ns", "location");
+		VCLI_Out(cli, "%12ju ", (uintmax_t)ref->count);
+		if (ref->ns > 0)
+			VCLI_Out(cli, "%14ju", (uintmax_t)ref->ns);
+		else
+			VCLI_Out(cli, "%14s", "-");
+		VCLI_Out(cli, "  %s:%u.%u %s\n", conf->srcname[ref->source],
+		    ref->line, ref->pos, ref->token);
+	}
+	if (n == 0)
+		VCLI_Out(cli, "No profile for VCL '%s'", av[2]);
+}
+
 /*--------------------------------------------------------------------
  * Method functions to call into VCL programs.
  *
@@ -1092,6 +1163,7 @@ static struct cli_proto vcl_cmds[] = {
 	{ CLICMD_VCL_DISCARD,		"", vcl_cli_discard },
 	{ CLICMD_VCL_USE,		"", vcl_cli_use },
 	{ CLICMD_VCL_SHOW,		"", vcl_cli_show },
+	{ CLICMD_VCL_PROFILE,		"", vcl_cli_profile },
 	{ CLICMD_VCL_LABEL,		"", vcl_cli_label },
 	{ NULL }
 };
@@ -147,7 +147,10 @@ VRT_GetHdr(VRT_CTX, const struct gethdr_s *hs)
 	}
 	hp = VRT_selecthttp(ctx, hs->where);
 	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
-	if (!http_GetHdr(hp, hs->what, &p))
+	if (hs->id != 0) {
+		if (!http_GetHdrId(hp, hs->id, &p))
+			return (NULL);
+	} else if (!http_GetHdr(hp, hs->what, &p))
 		return (NULL);
 	return (p);
 }
@@ -230,6 +233,91 @@ VRT_CollectString(VRT_CTX, const char *p, ...)
 	return (b);
 }
 
+/*--------------------------------------------------------------------
+ * Copy and merge STRANDS into a workspace, with an optional header
+ * name in front like VRT_String().
+ */
+
+const char *
+VRT_StrandsWS(struct ws *ws, const char *h, VCL_STRANDS s)
+{
+	char *b, *e;
+	unsigned u, x;
+	int i;
+
+	AN(s);
+	u = WS_Reserve(ws, 0);
+	e = b = ws->f;
+	e += u;
+	if (h != NULL) {
+		x = strlen(h);
+		if (b + x < e)
+			memcpy(b, h, x);
+		b += x;
+		if (b < e)
+			*b = ' ';
+		b++;
+	}
+	for (i = 0; i < s->n && b < e; i++) {
+		if (s->p[i] == NULL)
+			continue;
+		x = strlen(s->p[i]);
+		if (b + x < e)
+			memcpy(b, s->p[i], x);
+		b += x;
+	}
+	if (b >= e) {
+		WS_Release(ws, 0);
+		return (NULL);
+	}
+	*b++ = '\0';
+	e = b;
+	b = ws->f;
+	WS_Release(ws, e - b);
+	return (b);
+}
+
+VCL_STRING
+VRT_CollectStrands(VRT_CTX, VCL_STRANDS s)
+{
+	const char *b;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->ws, WS_MAGIC);
+	b = VRT_StrandsWS(ctx->ws, NULL, s);
+	return (b);
+}
+
+/*--------------------------------------------------------------------
+ * Compare two STRANDS piece by piece, without assembling them.
+ * Returns zero if they are equal.  A lone NULL piece is an unset
+ * STRING, which like in VRT_strcmp() is not equal to anything.
+ */
+
+int
+VRT_CompareStrands(VCL_STRANDS a, VCL_STRANDS b)
+{
+	const char *pa = "", *pb = "";
+	int ia = 0, ib = 0;
+
+	AN(a);
+	AN(b);
+	if ((a->n == 1 && a->p[0] == NULL) || (b->n == 1 && b->p[0] == NULL))
+		return (1);
+	while (1) {
+		while (*pa == '\0' && ia < a->n)
+			if ((pa = a->p[ia++]) == NULL)
+				pa = "";
+		while (*pb == '\0' && ib < b->n)
+			if ((pb = b->p[ib++]) == NULL)
+				pb = "";
+		if (*pa == '\0' || *pb == '\0')
+			return (*pa != *pb);
+		if (*pa++ != *pb++)
+			return (1);
+	}
+}
+
 /*--------------------------------------------------------------------*/
 
 void
@@ -322,6 +410,59 @@ VRT_hashdata(VRT_CTX, const char *str, ...)
 	HSH_AddString(ctx->req, ctx->specific, NULL);
 }
 
+/*--------------------------------------------------------------------
+ * Same as VRT_hashdata(), for arguments VCC found to be made only of
+ * constants and the Host header.  The bytes are gathered up, so that
+ * when they start the hash HSH_AddPrefix() can reuse the hash state
+ * from an earlier request with the same prefix.
+ */
+
+void
+VRT_hashprefix(VRT_CTX, const char *str, ...)
+{
+	va_list ap;
+	const char *p;
+	char buf[HSH_PFX_MAX];
+	size_t l, n = 0;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->req, REQ_MAGIC);
+	AN(ctx->specific);
+	va_start(ap, str);
+	for (p = str; p != vrt_magic_string_end; p = va_arg(ap, const char *)) {
+		/* NULL hashes as a single NUL, see HSH_AddString() */
+		l = p != NULL ? strlen(p) : 1;
+		if (n + l + 1 > sizeof buf) {
+			n = sizeof buf + 1;
+			break;
+		}
+		if (p != NULL)
+			memcpy(buf + n, p, l);
+		else
+			buf[n] = '\0';
+		n += l;
+	}
+	va_end(ap);
+
+	if (n > sizeof buf) {
+		va_start(ap, str);
+		for (p = str; p != vrt_magic_string_end;
+		    p = va_arg(ap, const char *))
+			HSH_AddString(ctx->req, ctx->specific, p);
+		va_end(ap);
+		HSH_AddString(ctx->req, ctx->specific, NULL);
+		return;
+	}
+
+	va_start(ap, str);
+	for (p = str; p != vrt_magic_string_end; p = va_arg(ap, const char *))
+		if (p != NULL)
+			VSLb(ctx->req->vsl, SLT_Hash, "%s", p);
+	va_end(ap);
+	buf[n++] = '\0';	/* The field-separator */
+	HSH_AddPrefix(ctx->req, ctx->specific, buf, n);
+}
+
 /*--------------------------------------------------------------------*/
 
 double
@@ -511,6 +652,49 @@ VRT_ban_string(VRT_CTX, const char *str)
 	VAV_Free(av);
 }
 
+/*--------------------------------------------------------------------
+ * Commit the bans a peer sent in the request body, see ban_replicate
+ */
+
+static int __match_proto__(objiterate_f)
+vrt_ban_replay_iter(void *priv, int flush, const void *ptr, ssize_t len)
+{
+
+	(void)flush;
+	return (VSB_bcat(priv, ptr, len));
+}
+
+long
+VRT_ban_replay(VRT_CTX)
+{
+	struct vsb *vsb;
+	const char *err;
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->req, REQ_MAGIC);
+	if (ctx->method != VCL_MET_RECV) {
+		VSLb(ctx->vsl, SLT_VCL_Error,
+		    "Bans can only be replayed in vcl_recv{}");
+		return (-1);
+	}
+	vsb = VSB_new_auto();
+	AN(vsb);
+	if (VRB_Iterate(ctx->req, vrt_ban_replay_iter, vsb) < 0 ||
+	    VSB_finish(vsb)) {
+		VSLb(ctx->vsl, SLT_VCL_Error, "ban_replay(): No bans read");
+		VSB_destroy(&vsb);
+		return (-1);
+	}
+	err = BAN_Replay((const uint8_t *)VSB_data(vsb), VSB_len(vsb), &n);
+	VSB_destroy(&vsb);
+	if (err != NULL) {
+		VSLb(ctx->vsl, SLT_VCL_Error, "ban_replay(): %s", err);
+		return (-1);
+	}
+	return (n);
+}
+
 VCL_BYTES
 VRT_CacheReqBody(VRT_CTX, VCL_BYTES maxsize)
 {
@@ -525,6 +709,20 @@ VRT_CacheReqBody(VRT_CTX, VCL_BYTES maxsize)
 	return (VRB_Cache(ctx->req, maxsize));
 }
 
+int
+VRT_StreamReqBody(VRT_CTX, VCL_BYTES maxsize)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->req, REQ_MAGIC);
+	if (ctx->method != VCL_MET_RECV) {
+		VSLb(ctx->vsl, SLT_VCL_Error,
+		    "req.body can only be cached in vcl_recv{}");
+		return (-1);
+	}
+	return (VRB_Tee(ctx->req, maxsize));
+}
+
 /*--------------------------------------------------------------------
  * purges
  */
@@ -541,6 +739,26 @@ VRT_purge(VRT_CTX, double ttl, double grace, double keep)
 		    ttl, grace, keep);
 }
 
+long
+VRT_purge_tags(VRT_CTX, const char *keys, unsigned soft)
+{
+	struct worker *wrk;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	if (ctx->req != NULL) {
+		CHECK_OBJ(ctx->req, REQ_MAGIC);
+		wrk = ctx->req->wrk;
+	} else if (ctx->bo != NULL) {
+		CHECK_OBJ(ctx->bo, BUSYOBJ_MAGIC);
+		wrk = ctx->bo->wrk;
+	} else
+		return (0);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	if (keys == NULL)
+		return (0);
+	return (TAG_Purge(wrk, keys, soft));
+}
+
 /*--------------------------------------------------------------------
  * Simple stuff
  */
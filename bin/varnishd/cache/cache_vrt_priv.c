@@ -66,6 +66,7 @@ vrt_priv_dynamic(VRT_CTX, uintptr_t id, uintptr_t vmod_id)
 {
 	struct vrt_privs *vps;
 	struct vrt_priv *vp;
+	struct lock *mtx = NULL;
 
 	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 	AN(vmod_id);
@@ -73,23 +74,31 @@ vrt_priv_dynamic(VRT_CTX, uintptr_t id, uintptr_t vmod_id)
 		CHECK_OBJ_NOTNULL(ctx->req, REQ_MAGIC);
 		CHECK_OBJ_NOTNULL(ctx->req->sp, SESS_MAGIC);
 		CAST_OBJ_NOTNULL(vps, ctx->req->sp->privs, VRT_PRIVS_MAGIC);
+		/* ESI prefetches share the session with their parent */
+		mtx = &ctx->req->sp->mtx;
 	} else {
 		CHECK_OBJ_NOTNULL(ctx->bo, BUSYOBJ_MAGIC);
 		CAST_OBJ_NOTNULL(vps, ctx->bo->privs, VRT_PRIVS_MAGIC);
 	}
 
+	if (mtx != NULL)
+		Lck_Lock(mtx);
 	VTAILQ_FOREACH(vp, &vps->privs, list) {
 		CHECK_OBJ_NOTNULL(vp, VRT_PRIV_MAGIC);
 		if (vp->vcl == ctx->vcl && vp->id == id
 		    && vp->vmod_id == vmod_id)
-			return (vp->priv);
+			break;
 	}
-	ALLOC_OBJ(vp, VRT_PRIV_MAGIC);
-	AN(vp);
-	vp->vcl = ctx->vcl;
-	vp->id = id;
-	vp->vmod_id = vmod_id;
-	VTAILQ_INSERT_TAIL(&vps->privs, vp, list);
+	if (vp == NULL) {
+		ALLOC_OBJ(vp, VRT_PRIV_MAGIC);
+		AN(vp);
+		vp->vcl = ctx->vcl;
+		vp->id = id;
+		vp->vmod_id = vmod_id;
+		VTAILQ_INSERT_TAIL(&vps->privs, vp, list);
+	}
+	if (mtx != NULL)
+		Lck_Unlock(mtx);
 	return (vp->priv);
 }
 
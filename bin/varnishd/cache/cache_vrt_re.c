@@ -51,6 +51,47 @@ Tadd(char **b, char *e, const char *p, int l)
 	}
 }
 
+/*
+ * Count the regexps which hit the stack or match limits.  Outside of a
+ * task (ie: vcl_init{}) there are no worker stats to count them in.
+ */
+
+static void
+vrt_re_count(VRT_CTX, int i)
+{
+	struct worker *wrk = NULL;
+
+	if (ctx->req != NULL)
+		wrk = ctx->req->wrk;
+	else if (ctx->bo != NULL)
+		wrk = ctx->bo->wrk;
+	if (wrk == NULL)
+		return;
+	CHECK_OBJ(wrk, WORKER_MAGIC);
+	if (i == VRE_ERROR_JIT_STACKLIMIT)
+		wrk->stats->regex_jit_fallback++;
+	else if (i == VRE_ERROR_MATCHLIMIT || i == VRE_ERROR_RECURSIONLIMIT)
+		wrk->stats->regex_limit++;
+}
+
+static int
+vrt_re_exec(VRT_CTX, const vre_t *t, const char *s, int len, int offset,
+    int options, int *ovector, int ovecsize)
+{
+	int i;
+
+	i = VRE_exec(t, s, len, offset, options, ovector, ovecsize,
+	    &cache_param->vre_limits);
+	if (i == VRE_ERROR_JIT_STACKLIMIT) {
+		vrt_re_count(ctx, i);
+		i = VRE_exec(t, s, len, offset, options | VRE_NO_JIT,
+		    ovector, ovecsize, &cache_param->vre_limits);
+	}
+	if (i < VRE_ERROR_NOMATCH)
+		vrt_re_count(ctx, i);
+	return (i);
+}
+
 void
 VRT_re_init(void **rep, const char *re)
 {
@@ -85,7 +126,7 @@ VRT_re_match(VRT_CTX, const char *s, void *re)
 		s = "";
 	AN(re);
 	t = re;
-	i = VRE_exec(t, s, strlen(s), 0, 0, NULL, 0, &cache_param->vre_limits);
+	i = vrt_re_exec(ctx, t, s, strlen(s), 0, 0, NULL, 0);
 	if (i >= 0)
 		return (1);
 	if (i < VRE_ERROR_NOMATCH )
@@ -93,6 +134,42 @@ VRT_re_match(VRT_CTX, const char *s, void *re)
 	return (0);
 }
 
+/*
+ * A bundle of regexps combined by VCC, see vcc_expr_rebundle().  The
+ * branches carry their number as (*MARK), which we log.
+ */
+
+int
+VRT_re_bundle(VRT_CTX, const char *s, void *re)
+{
+	vre_t *t;
+	const char *mark;
+	int i;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	if (s == NULL)
+		s = "";
+	AN(re);
+	t = re;
+	i = VRE_exec_mark(t, s, strlen(s), 0, &mark,
+	    &cache_param->vre_limits);
+	if (i == VRE_ERROR_JIT_STACKLIMIT) {
+		vrt_re_count(ctx, i);
+		i = VRE_exec_mark(t, s, strlen(s), VRE_NO_JIT, &mark,
+		    &cache_param->vre_limits);
+	}
+	if (i < VRE_ERROR_NOMATCH)
+		vrt_re_count(ctx, i);
+	if (i >= 0) {
+		VSLb(ctx->vsl, SLT_VCL_regex, "%s",
+		    mark != NULL ? mark : "-");
+		return (1);
+	}
+	if (i < VRE_ERROR_NOMATCH )
+		VSLb(ctx->vsl, SLT_VCL_Error, "Regexp matching returned %d", i);
+	return (0);
+}
+
 const char *
 VRT_regsub(VRT_CTX, int all, const char *str, void *re,
     const char *sub)
@@ -118,8 +195,7 @@ VRT_regsub(VRT_CTX, int all, const char *str, void *re,
 	t = re;
 	memset(ovector, 0, sizeof(ovector));
 	len = strlen(str);
-	i = VRE_exec(t, str, len, 0, options, ovector, 30,
-	    &cache_param->vre_limits);
+	i = vrt_re_exec(ctx, t, str, len, 0, options, ovector, 30);
 
 	/* If it didn't match, we can return the original string */
 	if (i == VRE_ERROR_NOMATCH)
@@ -158,8 +234,7 @@ VRT_regsub(VRT_CTX, int all, const char *str, void *re,
 			break;
 		memset(ovector, 0, sizeof(ovector));
 		options |= VRE_NOTEMPTY;
-		i = VRE_exec(t, str, len, offset, options, ovector, 30,
-		    &cache_param->vre_limits);
+		i = vrt_re_exec(ctx, t, str, len, offset, options, ovector, 30);
 		if (i < VRE_ERROR_NOMATCH ) {
 			WS_Release(ctx->ws, 0);
 			VSLb(ctx->vsl, SLT_VCL_Error,
@@ -179,3 +254,93 @@ VRT_regsub(VRT_CTX, int all, const char *str, void *re,
 	WS_ReleaseP(ctx->ws, res_b);
 	return (b0);
 }
+
+/*
+ * regsub() with a regexp which VCC found to be a literal string,
+ * possibly anchored, see vcc_regexp_fixed().  This is the same as
+ * VRT_regsub() would do, including $ matching before a trailing
+ * newline, but with string compares, and where the result is the tail
+ * of the input string, that is what we return.
+ */
+
+static void
+vrt_regsub_sub(char **b, char *e, const char *sub, const char *lit, int l)
+{
+	const char *s;
+
+	for (s = sub; *s != '\0'; s++) {
+		if (*s != '\\' || s[1] == '\0') {
+			if (*b < e)
+				*(*b)++ = *s;
+			continue;
+		}
+		s++;
+		if (*s == '0')
+			Tadd(b, e, lit, l);
+		else if (!isdigit(*s) && *b < e)
+			*(*b)++ = *s;
+	}
+}
+
+const char *
+VRT_regsub_fixed(VRT_CTX, int all, const char *str, unsigned anchor,
+    const char *lit, const char *sub)
+{
+	const char *m, *p;
+	char *res_b, *res_e, *b0;
+	size_t len, l;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(lit);
+	if (str == NULL)
+		str = "";
+	if (sub == NULL)
+		sub = "";
+	l = strlen(lit);
+	assert(l > 0);
+
+	m = NULL;
+	if (anchor & VRT_RE_END) {
+		len = strlen(str);
+		if (len > l && str[len - 1] == '\n' &&
+		    !memcmp(str + len - 1 - l, lit, l))
+			m = str + len - 1 - l;
+		else if (len >= l && !memcmp(str + len - l, lit, l))
+			m = str + len - l;
+		if (m != NULL && (anchor & VRT_RE_BEGIN) && m != str)
+			m = NULL;
+	} else if (anchor & VRT_RE_BEGIN) {
+		if (!strncmp(str, lit, l))
+			m = str;
+		if (m != NULL && *sub == '\0')
+			return (str + l);
+	} else
+		m = strstr(str, lit);
+	if (m == NULL)
+		return (str);
+
+	u = WS_Reserve(ctx->ws, 0);
+	res_e = res_b = b0 = ctx->ws->f;
+	res_e += u;
+
+	p = str;
+	do {
+		Tadd(&res_b, res_e, p, m - p);
+		vrt_regsub_sub(&res_b, res_e, sub, lit, l);
+		p = m + l;
+		if (!all || anchor != 0)
+			break;
+		m = strstr(p, lit);
+	} while (m != NULL);
+
+	Tadd(&res_b, res_e, p, strlen(p) + 1);
+	if (res_b >= res_e) {
+		WS_MarkOverflow(ctx->ws);
+		WS_Release(ctx->ws, 0);
+		return (str);
+	}
+	assert(res_b <= res_e);
+	WS_ReleaseP(ctx->ws, res_b);
+	return (b0);
+}
@@ -417,6 +417,8 @@ REQ_VAR_L(backend_hint, director_hint, const struct director *,)
 REQ_VAR_R(backend_hint, director_hint, const struct director *)
 REQ_VAR_L(ttl, d_ttl, double, if (!(arg>0.0)) arg = 0;)
 REQ_VAR_R(ttl, d_ttl, double)
+REQ_VAR_L(priority, priority, long,)
+REQ_VAR_R(priority, priority, long)
 
 /*--------------------------------------------------------------------*/
 
@@ -670,6 +672,26 @@ GIP(client)
 GIP(server)
 #undef GIP
 
+/*--------------------------------------------------------------------
+ * PROXY protocol TLVs, parsed by the PROXY transport.
+ */
+
+#define GPX(fld, attr)						\
+	VCL_STRING						\
+	VRT_r_proxy_##fld(VRT_CTX)				\
+	{							\
+								\
+		CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);		\
+		CHECK_OBJ_NOTNULL(ctx->sp, SESS_MAGIC);		\
+		return (SES_Get_String_Attr(ctx->sp, attr));	\
+	}
+
+GPX(alpn, SA_PROXY_ALPN)
+GPX(authority, SA_PROXY_AUTHORITY)
+GPX(tls_version, SA_PROXY_TLS_VERSION)
+GPX(tls_cipher, SA_PROXY_TLS_CIPHER)
+#undef GPX
+
 /*--------------------------------------------------------------------*/
 
 const char*
@@ -727,6 +749,24 @@ VRT_r_resp_is_streaming(VRT_CTX)
 	return (ctx->req->objcore->boc == NULL ? 0 : 1);
 }
 
+void
+VRT_l_resp_ttl(VRT_CTX, double arg)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->req, REQ_MAGIC);
+	if (!(arg > 0.0))
+		arg = 0;
+	ctx->req->synth_ttl = arg;
+}
+
+double
+VRT_r_resp_ttl(VRT_CTX)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->req, REQ_MAGIC);
+	return (ctx->req->synth_ttl);
+}
+
 /*--------------------------------------------------------------------*/
 
 #define VRT_BODY_L(which)					\
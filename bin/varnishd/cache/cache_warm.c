@@ -0,0 +1,448 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Warming the cache from a list of URLs.
+ *
+ * The cache.warm command hands a file to a background thread, which
+ * runs each URL in it through VCL as a GET of its own, on a session
+ * of its own, at no more than the given rate.  Like the prefetching
+ * of ESI includes, these requests are only there to get the fetch
+ * going, and their delivery goes nowhere:  A hit costs a lookup, and
+ * a URL which is being fetched already joins the waiting list.
+ * Passes and pipes are not fetched at all.
+ *
+ * The thread holds off while client requests are queued, and keeps no
+ * more requests on their way than it starts in a second.
+ *
+ * Each line of the file is one of
+ *
+ *	/url
+ *	host /url		as from varnishncsa -F '%{Host}i %U%q'
+ *	http://host/url
+ *
+ * and empty lines and lines starting with '#' are skipped.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+
+#include "cache.h"
+#include "cache_filter.h"
+#include "cache_priv.h"
+#include "cache_transport.h"
+
+#include "vcli_serve.h"
+#include "vct.h"
+#include "vsa.h"
+#include "vtim.h"
+
+#define WRM_RATE		100	/* default requests per second */
+
+struct wrm_req {
+	unsigned		magic;
+#define WRM_REQ_MAGIC		0x3ec1a6b5
+	struct pool_task	task;
+	char			*host;
+	char			*url;
+};
+
+static struct lock		wrm_mtx;
+static pthread_cond_t		wrm_cond;
+static FILE			*wrm_fp;	/* file to do */
+static unsigned			wrm_rate;
+static unsigned			wrm_busy;	/* file being done */
+static unsigned			wrm_running;	/* background thread */
+static unsigned			wrm_inflight;
+
+static vtr_deliver_f wrm_deliver;
+static vtr_reembark_f wrm_reembark;
+
+static const struct transport WRM_transport = {
+	.magic =	TRANSPORT_MAGIC,
+	.name =		"WARM",
+	.deliver =	wrm_deliver,
+	.reembark =	wrm_reembark,
+};
+
+/*--------------------------------------------------------------------*/
+
+static void
+wrm_fini(struct worker *wrk, struct req *req)
+{
+	struct sess *sp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	sp = req->sp;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+
+	/* The session has no fd, so this ends it too */
+	AN(Req_Cleanup(sp, wrk, req));
+	Lck_Lock(&wrm_mtx);
+	AN(wrm_inflight);
+	wrm_inflight--;
+	Lck_Unlock(&wrm_mtx);
+}
+
+static void __match_proto__(task_func_t)
+wrm_req_task(struct worker *wrk, void *priv)
+{
+	struct req *req;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(req, priv, REQ_MAGIC);
+	AN(req->is_prefetch);
+
+	THR_SetRequest(req);
+	if (CNT_Request(wrk, req) == REQ_FSM_DONE)
+		wrm_fini(wrk, req);
+	/* else we are on a waiting list, see wrm_reembark() */
+	THR_SetRequest(NULL);
+}
+
+static void __match_proto__(vtr_reembark_f)
+wrm_reembark(struct worker *wrk, struct req *req)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	AN(req->is_prefetch);
+	if (!SES_Reschedule_Req(req))
+		return;
+	wrk->stats->busy_wakeup--;
+	wrk->stats->busy_killed++;
+	wrm_fini(wrk, req);
+}
+
+static void __match_proto__(vtr_deliver_f)
+wrm_deliver(struct req *req, struct boc *boc, int wantbody)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
+	(void)wantbody;
+	if (req->is_hit)
+		req->wrk->stats->cache_warm_hit++;
+	VDP_close(req);
+}
+
+/*--------------------------------------------------------------------
+ * A session for the request, which looks like it came from the
+ * loopback address.
+ */
+
+static struct sess *
+wrm_sess(struct worker *wrk)
+{
+	struct sess *sp;
+	struct suckaddr *sa;
+	struct sockaddr_in sin;
+
+	sp = SES_New(wrk->pool);
+	if (sp == NULL)
+		return (NULL);
+	sp->t_open = VTIM_real();
+	sp->t_idle = sp->t_open;
+	sp->vxid = VXID_Get(wrk, VSL_CLIENTMARKER);
+	sp->fd = -(int)SC_REQ_CLOSE;
+
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	SES_Reserve_remote_addr(sp, &sa);
+	AN(VSA_Build(sa, &sin, sizeof sin));
+	sp->sattr[SA_CLIENT_ADDR] = sp->sattr[SA_REMOTE_ADDR];
+	SES_Reserve_local_addr(sp, &sa);
+	AN(VSA_Build(sa, &sin, sizeof sin));
+	sp->sattr[SA_SERVER_ADDR] = sp->sattr[SA_LOCAL_ADDR];
+	SES_Set_String_Attr(sp, SA_CLIENT_IP, "127.0.0.1");
+	SES_Set_String_Attr(sp, SA_CLIENT_PORT, "0");
+
+	VSL(SLT_Begin, sp->vxid, "sess 0 %s", WRM_transport.name);
+	return (sp);
+}
+
+static void __match_proto__(task_func_t)
+wrm_task(struct worker *wrk, void *priv)
+{
+	struct wrm_req *wr;
+	struct sess *sp;
+	struct req *req;
+	const char *url, *host = NULL;
+	int ok;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(wr, priv, WRM_REQ_MAGIC);
+
+	wrk->stats->cache_warm++;
+	sp = wrm_sess(wrk);
+	if (sp == NULL) {
+		Lck_Lock(&wrm_mtx);
+		wrm_inflight--;
+		Lck_Unlock(&wrm_mtx);
+		free(wr->host);
+		free(wr->url);
+		FREE_OBJ(wr);
+		return;
+	}
+
+	req = Req_New(wrk, sp);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	req->req_body_status = REQ_BODY_NONE;
+	req->vsl->wid = VXID_Get(wrk, VSL_CLIENTMARKER);
+	VSLb(req->vsl, SLT_Begin, "req %u warm", VXID(sp->vxid));
+	VSL(SLT_Link, sp->vxid, "req %u warm", VXID(req->vsl->wid));
+	req->is_prefetch = 1;
+	req->transport = &WRM_transport;
+	VSLb_ts_req(req, "Start", W_TIM_real(wrk));
+	req->t_req = req->t_first;
+	VSL_Trace(req->vsl, req->ws, sp->vxid, NULL, req->t_first);
+
+	/* cnt_recv() logs the request once it is complete */
+	HTTP_Setup(req->http, req->ws, NULL, SLT_ReqMethod);
+	url = WS_Copy(req->ws, wr->url, -1);
+	ok = url != NULL;
+	if (wr->host != NULL) {
+		host = WS_Printf(req->ws, "Host: %s", wr->host);
+		ok = ok && host != NULL;
+	}
+	free(wr->host);
+	free(wr->url);
+	FREE_OBJ(wr);
+	if (!ok) {
+		VSLb(req->vsl, SLT_Error, "Out of workspace for the URL");
+		wrm_fini(wrk, req);
+		return;
+	}
+	http_SetH(req->http, HTTP_HDR_METHOD, "GET");
+	http_SetH(req->http, HTTP_HDR_URL, url);
+	http_SetH(req->http, HTTP_HDR_PROTO, "HTTP/1.1");
+	if (host != NULL)
+		http_SetHeader(req->http, host);
+	req->http->vsl = req->vsl;
+	HTTP_Copy(req->http0, req->http);
+	req->ws_req = WS_Snapshot(req->ws);
+
+	VCL_Refresh(&wrk->vcl);
+	req->vcl = wrk->vcl;
+	wrk->vcl = NULL;
+
+	req->req_step = R_STP_RECV;
+	req->task.func = wrm_req_task;
+	req->task.priv = req;
+	wrm_req_task(wrk, req);
+}
+
+/*--------------------------------------------------------------------
+ * Split a line of the file in host and URL.
+ */
+
+static int
+wrm_parse(char *p, char **host, char **url)
+{
+	char *q;
+
+	while (vct_islws(*p))
+		p++;
+	q = strchr(p, '\0');
+	while (q > p && vct_islws(q[-1]))
+		*--q = '\0';
+	if (*p == '\0' || *p == '#')
+		return (0);
+
+	*host = NULL;
+	if (!strncmp(p, "http://", 7) || !strncmp(p, "https://", 8)) {
+		p = strchr(p, '/') + 2;
+		q = strchr(p, '/');
+		if (q == NULL || q == p)
+			return (-1);
+		*host = strndup(p, q - p);
+		AN(*host);
+		p = q;
+	} else if (*p != '/') {
+		q = p;
+		while (*q != '\0' && !vct_islws(*q))
+			q++;
+		*host = strndup(p, q - p);
+		AN(*host);
+		p = q;
+		while (vct_islws(*p))
+			p++;
+	}
+	if (*p != '/' || strpbrk(p, " \t") != NULL) {
+		free(*host);
+		*host = NULL;
+		return (-1);
+	}
+	*url = strdup(p);
+	AN(*url);
+	return (1);
+}
+
+static void
+wrm_file(FILE *fp, unsigned rate)
+{
+	struct wrm_req *wr;
+	char *line = NULL, *host, *url;
+	size_t sz = 0;
+	unsigned lineno = 0, n = 0;
+	double t, t_next;
+	int i;
+
+	t_next = VTIM_mono();
+	while (getline(&line, &sz, fp) >= 0) {
+		lineno++;
+		i = wrm_parse(line, &host, &url);
+		if (i == 0)
+			continue;
+		if (i < 0) {
+			VSL(SLT_Error, 0, "cache.warm: line %u: not a URL",
+			    lineno);
+			continue;
+		}
+		ALLOC_OBJ(wr, WRM_REQ_MAGIC);
+		AN(wr);
+		wr->host = host;
+		wr->url = url;
+		wr->task.func = wrm_task;
+		wr->task.priv = wr;
+
+		while (1) {
+			t = VTIM_mono();
+			if (t < t_next) {
+				VTIM_sleep(t_next - t);
+				continue;
+			}
+			if (VSC_C_main->thread_queue_len > 0 ||
+			    wrm_inflight >= rate) {
+				VTIM_sleep(0.01);
+				continue;
+			}
+			Lck_Lock(&wrm_mtx);
+			wrm_inflight++;
+			Lck_Unlock(&wrm_mtx);
+			if (!Pool_Task_Any(&wr->task, TASK_QUEUE_REQ))
+				break;
+			Lck_Lock(&wrm_mtx);
+			wrm_inflight--;
+			Lck_Unlock(&wrm_mtx);
+			t_next = t + 1.;
+		}
+		t_next += 1. / rate;
+		if (t_next < t)
+			t_next = t;
+		n++;
+	}
+	free(line);
+	AZ(fclose(fp));
+	VSL(SLT_Debug, 0, "cache.warm: %u URLs", n);
+}
+
+static void * __match_proto__(bgthread_t)
+wrm_thread(struct worker *wrk, void *priv)
+{
+	FILE *fp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+	Lck_Lock(&wrm_mtx);
+	while (1) {
+		if (wrm_fp == NULL) {
+			(void)Lck_CondWait(&wrm_cond, &wrm_mtx, 0);
+			continue;
+		}
+		fp = wrm_fp;
+		wrm_fp = NULL;
+		Lck_Unlock(&wrm_mtx);
+		wrm_file(fp, wrm_rate);
+		Lck_Lock(&wrm_mtx);
+		wrm_busy = 0;
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------*/
+
+static void __match_proto__(cli_func_t)
+wrm_cli_warm(struct cli *cli, const char * const *av, void *priv)
+{
+	pthread_t thr;
+	unsigned rate = WRM_RATE;
+	char *e;
+	FILE *fp;
+
+	(void)priv;
+	if (av[3] != NULL) {
+		errno = 0;
+		rate = strtoul(av[3], &e, 10);
+		if (errno || *e != '\0' || rate == 0 || rate > 100000) {
+			VCLI_Out(cli, "Rate must be 1 to 100000 per second");
+			VCLI_SetResult(cli, CLIS_PARAM);
+			return;
+		}
+	}
+	Lck_Lock(&wrm_mtx);
+	if (wrm_busy) {
+		Lck_Unlock(&wrm_mtx);
+		VCLI_Out(cli, "The cache is being warmed already");
+		VCLI_SetResult(cli, CLIS_CANT);
+		return;
+	}
+	Lck_Unlock(&wrm_mtx);
+	fp = fopen(av[2], "r");
+	if (fp == NULL) {
+		VCLI_Out(cli, "Cannot open %s: %s", av[2], strerror(errno));
+		VCLI_SetResult(cli, CLIS_CANT);
+		return;
+	}
+	if (!wrm_running) {
+		WRK_BgThread(&thr, "cache-warm", wrm_thread, NULL);
+		wrm_running = 1;
+	}
+	Lck_Lock(&wrm_mtx);
+	wrm_fp = fp;
+	wrm_rate = rate;
+	wrm_busy = 1;
+	AZ(pthread_cond_signal(&wrm_cond));
+	Lck_Unlock(&wrm_mtx);
+	VCLI_Out(cli, "Warming from %s at %u/s", av[2], rate);
+}
+
+static struct cli_proto wrm_cmds[] = {
+	{ CLICMD_CACHE_WARM,			"", wrm_cli_warm },
+	{ NULL }
+};
+
+void
+WRM_Init(void)
+{
+
+	Lck_New(&wrm_mtx, lck_warm);
+	AZ(pthread_cond_init(&wrm_cond, NULL));
+	CLI_AddFuncs(wrm_cmds);
+}
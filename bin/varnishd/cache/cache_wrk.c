@@ -32,10 +32,12 @@
 #include "config.h"
 
 #include <errno.h>
+#include <math.h>
 #include <stdlib.h>
 
 #include "cache.h"
 #include "cache_pool.h"
+#include "cache_priv.h"
 
 #include "vtim.h"
 
@@ -116,10 +118,18 @@ WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 	/* XXX: assuming stack grows down. */
 	w->stack_end = w->stack_start - stacksize;
 
+	if (VRE_jit_stack(cache_param->pcre_jit_stack))
+		VSL(SLT_Debug, 0, "Could not allocate PCRE JIT stack");
+
 	VSL(SLT_WorkThread, 0, "%p start", w);
 
+	MPL_Magazine(qp->mpl_req);
+	MPL_Magazine(qp->mpl_sess);
+	VBO_Magazine();
+
 	Pool_Work_Thread(qp, w);
 	AZ(w->pool);
+	MPL_Drain();
 
 	VSL(SLT_WorkThread, 0, "%p end", w);
 	if (w->vcl != NULL)
@@ -127,6 +137,7 @@ WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 	AZ(pthread_cond_destroy(&w->cond));
 	HSH_Cleanup(w);
 	Pool_Sumstat(w);
+	AZ(VRE_jit_stack(0));
 }
 
 /*--------------------------------------------------------------------
@@ -136,6 +147,7 @@ WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 static void
 pool_addstat(struct dstat *dst, struct dstat *src)
 {
+	unsigned u, b;
 
 	dst->summs++;
 #define L0(n)
@@ -144,9 +156,45 @@ pool_addstat(struct dstat *dst, struct dstat *src)
 #include "tbl/vsc_f_main.h"
 #undef L0
 #undef L1
+	for (u = 0; u < LAT__MAX; u++)
+		for (b = 0; b < VSC_LAT_NBUCKET; b++)
+			dst->lat[u][b] += src->lat[u][b];
 	memset(src, 0, sizeof *src);
 }
 
+/*--------------------------------------------------------------------
+ * Count an event in a latency histogram.  Like the other worker stats
+ * this only touches wrk->stats, the pool sums it into the shared
+ * counters.
+ */
+
+static const double lat_bound[VSC_LAT_NBUCKET] = {
+#define LAT_BOUND(n, d, i, b, s)	s,
+	VSC_LAT_BUCKETS(LAT_BOUND, , )
+#undef LAT_BOUND
+};
+
+void
+WRK_Latency(struct worker *wrk, enum lat_e lat, double dt)
+{
+	unsigned lo, hi, mid;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	assert(lat < LAT__MAX);
+	if (isnan(dt))
+		return;
+	lo = 0;
+	hi = VSC_LAT_NBUCKET - 1;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (dt <= lat_bound[mid])
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	wrk->stats->lat[lat][lo]++;
+}
+
 static inline int
 pool_reserve(void)
 {
@@ -232,21 +280,202 @@ Pool_Task_Arg(struct worker *wrk, enum task_prio prio, task_func_t *func,
 	return (retval);
 }
 
+/*--------------------------------------------------------------------
+ * Queue delay control for client work, after CoDel.
+ *
+ * As client tasks come off the queue we look at how long they waited.
+ * Once that has been over thread_queue_target for thread_queue_interval
+ * the queue is in trouble, and new work for it is dropped rather than
+ * making everybody wait longer, until a task gets through in time.
+ * Work of lower priority is dropped when any client queue above it is
+ * in trouble too.
+ */
+
+static void
+pool_sojourn(struct worker *wrk, struct pool *pp, int prio,
+    const struct pool_task *tp)
+{
+	double now, d;
+
+	if (!TASK_QUEUE_CLIENT(prio) || tp->t_queued == 0.)
+		return;
+	now = VTIM_mono();
+	d = now - tp->t_queued;
+	switch (prio) {
+	case TASK_QUEUE_HIGH:
+		wrk->stats->queued_high++;
+		wrk->stats->queue_wait_high += (uint64_t)(d * 1e6);
+		break;
+	case TASK_QUEUE_REQ:
+		wrk->stats->queued_normal++;
+		wrk->stats->queue_wait_normal += (uint64_t)(d * 1e6);
+		break;
+	default:
+		wrk->stats->queued_low++;
+		wrk->stats->queue_wait_low += (uint64_t)(d * 1e6);
+		break;
+	}
+	if (cache_param->wthread_queue_target == 0.)
+		return;
+	if (d < cache_param->wthread_queue_target) {
+		pp->t_above[prio] = 0.;
+		pp->shed &= ~(1U << prio);
+	} else if (pp->t_above[prio] == 0.)
+		pp->t_above[prio] = now + cache_param->wthread_queue_interval;
+	else if (now >= pp->t_above[prio])
+		pp->shed |= 1U << prio;
+}
+
+static int
+pool_shed(struct pool *pp, enum task_prio prio)
+{
+	int i;
+
+	if (pp->shed == 0)
+		return (0);
+	for (i = TASK_QUEUE_HIGH; i <= TASK_QUEUE_BULK; i++) {
+		/* Nothing waiting, no delay */
+		if (cache_param->wthread_queue_target == 0. ||
+		    VTAILQ_EMPTY(&pp->queues[i])) {
+			pp->t_above[i] = 0.;
+			pp->shed &= ~(1U << i);
+		}
+	}
+	return ((pp->shed & ((2U << prio) - (1U << TASK_QUEUE_HIGH))) != 0);
+}
+
+/*--------------------------------------------------------------------
+ * Fair queuing of client work across clients
+ *
+ * With thread_queue_fair set, queued client tasks are also put in one of
+ * a fixed number of buckets by their SES_FairKey(), and the buckets with
+ * work take turns deficit round robin style, up to thread_queue_fair
+ * tasks each, so one client with many connections cannot crowd out the
+ * rest.  Clients hashing to the same bucket share its turns.
+ */
+
+void
+pool_unqueue(struct pool *pp, int prio, struct pool_task *tp)
+{
+	struct pool_fq *fq;
+
+	Lck_AssertHeld(&pp->mtx);
+	assert(pp->lqueue > 0);
+	pp->lqueue--;
+	VTAILQ_REMOVE(&pp->queues[prio], tp, list);
+	fq = tp->fq;
+	if (fq == NULL)
+		return;
+	tp->fq = NULL;
+	VTAILQ_REMOVE(&fq->tasks, tp, fq_list);
+	if (VTAILQ_EMPTY(&fq->tasks)) {
+		VTAILQ_REMOVE(&pp->fq_active[prio - TASK_QUEUE_HIGH], fq, list);
+		fq->deficit = 0;
+	}
+}
+
+static void
+pool_fq_enqueue(struct pool *pp, int prio, struct pool_task *tp)
+{
+	struct pool_fq *fq;
+
+	tp->fq = NULL;
+	if (!TASK_QUEUE_CLIENT(prio) || cache_param->wthread_queue_fair == 0)
+		return;
+	fq = &pp->fq[prio - TASK_QUEUE_HIGH][tp->fq_key % POOL_FQ_BUCKETS];
+	if (VTAILQ_EMPTY(&fq->tasks))
+		VTAILQ_INSERT_TAIL(&pp->fq_active[prio - TASK_QUEUE_HIGH],
+		    fq, list);
+	VTAILQ_INSERT_TAIL(&fq->tasks, tp, fq_list);
+	tp->fq = fq;
+}
+
+static struct pool_task *
+pool_fq_next(struct worker *wrk, struct pool *pp, int prio)
+{
+	struct pool_fqhead *fh;
+	struct pool_fq *fq;
+	struct pool_task *tp;
+
+	tp = VTAILQ_FIRST(&pp->queues[prio]);
+	/* Tasks queued before thread_queue_fair was set go first */
+	if (tp == NULL || tp->fq == NULL ||
+	    cache_param->wthread_queue_fair == 0)
+		return (tp);
+	fh = &pp->fq_active[prio - TASK_QUEUE_HIGH];
+	fq = VTAILQ_FIRST(fh);
+	AN(fq);
+	if (fq->deficit == 0)
+		fq->deficit = cache_param->wthread_queue_fair;
+	if (--fq->deficit == 0) {
+		VTAILQ_REMOVE(fh, fq, list);
+		VTAILQ_INSERT_TAIL(fh, fq, list);
+	}
+	if (VTAILQ_FIRST(&fq->tasks) != tp) {
+		wrk->stats->queued_fair++;
+		tp = VTAILQ_FIRST(&fq->tasks);
+	}
+	AN(tp);
+	return (tp);
+}
+
+/*--------------------------------------------------------------------
+ * Take the next task off the queues of a pool.
+ *
+ * The client queues share the workers by weight rather than strictly by
+ * priority, so none of them starves: when all three have work, of every
+ * seven tasks four are high, two normal and one low priority.
+ */
+
+static const uint8_t pool_wfq[] = {
+	TASK_QUEUE_HIGH, TASK_QUEUE_REQ, TASK_QUEUE_HIGH, TASK_QUEUE_BULK,
+	TASK_QUEUE_HIGH, TASK_QUEUE_REQ, TASK_QUEUE_HIGH,
+};
+
+static struct pool_task *
+pool_dequeue(struct worker *wrk, struct pool *pp, int prio_lim)
+{
+	struct pool_task *tp;
+	int i, j;
+
+	Lck_AssertHeld(&pp->mtx);
+	for (i = 0; i < prio_lim; i++) {
+		if (i == TASK_QUEUE_HIGH) {
+			j = pool_wfq[pp->wfq++ % sizeof pool_wfq];
+			if (j < prio_lim && !VTAILQ_EMPTY(&pp->queues[j]))
+				i = j;
+		}
+		if (TASK_QUEUE_CLIENT(i))
+			tp = pool_fq_next(wrk, pp, i);
+		else
+			tp = VTAILQ_FIRST(&pp->queues[i]);
+		if (tp != NULL) {
+			pool_unqueue(pp, i, tp);
+			pool_sojourn(wrk, pp, i, tp);
+			return (tp);
+		}
+	}
+	return (NULL);
+}
+
 /*--------------------------------------------------------------------
  * Enter a new task to be done
+ *
+ * Must hold the pool mutex.  Returns the worker to be signalled, if an
+ * idle one took the task.
  */
 
-int
-Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
+static struct worker *
+pool_task(struct pool *pp, struct pool_task *task, enum task_prio prio,
+    int *retval)
 {
 	struct worker *wrk;
-	int retval = 0;
+
 	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 	AN(task);
 	AN(task->func);
 	assert(prio < TASK_QUEUE_END);
-
-	Lck_Lock(&pp->mtx);
+	Lck_AssertHeld(&pp->mtx);
 
 	/* The common case first:  Take an idle thread, do it. */
 
@@ -258,24 +487,73 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 		AZ(wrk->task.func);
 		wrk->task.func = task->func;
 		wrk->task.priv = task->priv;
-		Lck_Unlock(&pp->mtx);
-		AZ(pthread_cond_signal(&wrk->cond));
-		return (0);
+		return (wrk);
 	}
 
 	/*
 	 * queue limits only apply to client threads - all other
 	 * work is vital and needs do be done at the earliest
 	 */
-	if (prio != TASK_QUEUE_REQ ||
-	    pp->lqueue < cache_param->wthread_max +
-	    cache_param->wthread_queue_limit + pp->nthr) {
-		pp->nqueued++;
-		pp->lqueue++;
-		VTAILQ_INSERT_TAIL(&pp->queues[prio], task, list);
-	} else {
-		pp->ndropped++;
-		retval = -1;
+	if (TASK_QUEUE_CLIENT(prio)) {
+		if (pp->lqueue >= cache_param->wthread_max +
+		    cache_param->wthread_queue_limit + pp->nthr) {
+			pp->ndropped++;
+			*retval = -1;
+			return (NULL);
+		}
+		if (pool_shed(pp, prio)) {
+			pp->nshed++;
+			*retval = -1;
+			return (NULL);
+		}
+	}
+	task->t_queued = VTIM_mono();
+	pp->nqueued++;
+	pp->lqueue++;
+	VTAILQ_INSERT_TAIL(&pp->queues[prio], task, list);
+	pool_fq_enqueue(pp, prio, task);
+	return (NULL);
+}
+
+int
+Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
+{
+	struct worker *wrk;
+	int retval = 0;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	Lck_Lock(&pp->mtx);
+	wrk = pool_task(pp, task, prio, &retval);
+	Lck_Unlock(&pp->mtx);
+	if (wrk != NULL)
+		AZ(pthread_cond_signal(&wrk->cond));
+	return (retval);
+}
+
+/*--------------------------------------------------------------------
+ * Enter a list of tasks under a single hold of the pool mutex.
+ *
+ * The list is emptied.  Returns -1 if any task was dropped, like
+ * Pool_Task() does for one.
+ */
+
+int
+Pool_Task_List(struct pool *pp, struct taskhead *th, enum task_prio prio)
+{
+	struct pool_task *task;
+	struct worker *wrk;
+	int retval = 0;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	AN(th);
+	if (VTAILQ_EMPTY(th))
+		return (0);
+	Lck_Lock(&pp->mtx);
+	while ((task = VTAILQ_FIRST(th)) != NULL) {
+		VTAILQ_REMOVE(th, task, list);
+		wrk = pool_task(pp, task, prio, &retval);
+		if (wrk != NULL)
+			AZ(pthread_cond_signal(&wrk->cond));
 	}
 	Lck_Unlock(&pp->mtx);
 	return (retval);
@@ -319,13 +597,12 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 		else
 			prio_lim = TASK_QUEUE_END;
 
-		for (i = 0; i < prio_lim; i++) {
-			tp = VTAILQ_FIRST(&pp->queues[i]);
-			if (tp != NULL) {
-				pp->lqueue--;
-				VTAILQ_REMOVE(&pp->queues[i], tp, list);
-				break;
-			}
+		tp = pool_dequeue(wrk, pp, prio_lim);
+
+		if (tp == NULL && cache_param->wthread_steal) {
+			tp = pool_steal(pp, prio_lim);
+			if (tp != NULL)
+				wrk->stats->thread_steal++;
 		}
 
 		if ((tp == NULL && wrk->stats->summs > 0) ||
@@ -343,8 +620,9 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 			tp = &tps;
 		} else {
 			/* Nothing to do: To sleep, perchance to dream ... */
+			MPL_SyncStats();
 			if (isnan(wrk->lastused))
-				wrk->lastused = VTIM_real();
+				wrk->lastused = VTIM_real_coarse();
 			wrk->task.func = NULL;
 			wrk->task.priv = wrk;
 			VTAILQ_INSERT_HEAD(&pp->idle_queue, &wrk->task, list);
@@ -368,6 +646,7 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 			memset(&wrk->task, 0, sizeof wrk->task);
 			assert(wrk->pool == pp);
 			tp->func(wrk, tp->priv);
+			AZ(wrk->exp_nbatch);
 			if (DO_DEBUG(DBG_VCLREL) && wrk->vcl != NULL)
 				VCL_Rel(&wrk->vcl);
 			tpx = wrk->task;
@@ -403,11 +682,12 @@ pool_thread(void *priv)
 }
 
 static void
-pool_breed(struct pool *qp)
+pool_breed(struct pool *qp, unsigned n)
 {
 	pthread_t tp;
 	pthread_attr_t tp_attr;
 	struct pool_info *pi;
+	unsigned u;
 
 	AZ(pthread_attr_init(&tp_attr));
 	AZ(pthread_attr_setdetachstate(&tp_attr, PTHREAD_CREATE_DETACHED));
@@ -417,31 +697,75 @@ pool_breed(struct pool *qp)
 		AZ(pthread_attr_setstacksize(&tp_attr,
 		    cache_param->wthread_stacksize));
 
-	ALLOC_OBJ(pi, POOL_INFO_MAGIC);
-	AN(pi);
-	AZ(pthread_attr_getstacksize(&tp_attr, &pi->stacksize));
-	pi->qp = qp;
-
-	if (pthread_create(&tp, &tp_attr, pool_thread, pi)) {
-		VSL(SLT_Debug, 0, "Create worker thread failed %d %s",
-		    errno, strerror(errno));
-		Lck_Lock(&pool_mtx);
-		VSC_C_main->threads_failed++;
-		Lck_Unlock(&pool_mtx);
-		VTIM_sleep(cache_param->wthread_fail_delay);
-	} else {
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP)
+	/* Keep the pool's threads on its NUMA node */
+	if (qp->numa != NULL)
+		AZ(pthread_attr_setaffinity_np(&tp_attr,
+		    sizeof qp->numa->cpus, &qp->numa->cpus));
+#endif
+
+	for (u = 0; u < n; u++) {
+		ALLOC_OBJ(pi, POOL_INFO_MAGIC);
+		AN(pi);
+		AZ(pthread_attr_getstacksize(&tp_attr, &pi->stacksize));
+		pi->qp = qp;
+
+		if (pthread_create(&tp, &tp_attr, pool_thread, pi)) {
+			VSL(SLT_Debug, 0, "Create worker thread failed %d %s",
+			    errno, strerror(errno));
+			FREE_OBJ(pi);
+			Lck_Lock(&pool_mtx);
+			VSC_C_main->threads_failed++;
+			Lck_Unlock(&pool_mtx);
+			VTIM_sleep(cache_param->wthread_fail_delay);
+			break;
+		}
 		qp->dry = 0;
 		qp->nthr++;
 		Lck_Lock(&pool_mtx);
 		VSC_C_main->threads++;
 		VSC_C_main->threads_created++;
+		if (u > 0)
+			VSC_C_main->threads_batched++;
 		Lck_Unlock(&pool_mtx);
-		VTIM_sleep(cache_param->wthread_add_delay);
 	}
+	if (u > 0)
+		VTIM_sleep(cache_param->wthread_add_delay);
 
 	AZ(pthread_attr_destroy(&tp_attr));
 }
 
+/*--------------------------------------------------------------------
+ * How many threads to breed.  Without thread_pool_predict it is one at
+ * a time.  With it, one for every task waiting for a thread and one for
+ * every task the queue grew by since we last looked, on the guess that
+ * it keeps growing at that rate for a while yet.
+ */
+
+static unsigned
+pool_want(struct pool *pp, unsigned wthread_min)
+{
+	unsigned n, lq;
+
+	if (!cache_param->wthread_predict)
+		return (1);
+	Lck_Lock(&pp->mtx);
+	lq = pp->lqueue;
+	Lck_Unlock(&pp->mtx);
+	n = lq;
+	if (lq > pp->h_lqueue)
+		n += lq - pp->h_lqueue;
+	pp->h_lqueue = lq;
+	if (pp->nthr < wthread_min && n < wthread_min - pp->nthr)
+		n = wthread_min - pp->nthr;
+	if (pp->nthr + n > cache_param->wthread_max)
+		n = cache_param->wthread_max > pp->nthr ?
+		    cache_param->wthread_max - pp->nthr : 0;
+	if (n == 0)
+		n = 1;
+	return (n);
+}
+
 /*--------------------------------------------------------------------
  * Herd a single pool
  *
@@ -480,7 +804,7 @@ pool_herder(void *priv)
 		/* Make more threads if needed and allowed */
 		if (pp->nthr < wthread_min ||
 		    (pp->dry && pp->nthr < cache_param->wthread_max)) {
-			pool_breed(pp);
+			pool_breed(pp, pool_want(pp, wthread_min));
 			continue;
 		}
 
@@ -495,7 +819,10 @@ pool_herder(void *priv)
 			/* XXX: unsafe counters */
 			VSC_C_main->sess_queued += pp->nqueued;
 			VSC_C_main->sess_dropped += pp->ndropped;
-			pp->nqueued = pp->ndropped = 0;
+			VSC_C_main->sess_shed += pp->nshed;
+			pp->nqueued = pp->ndropped = pp->nshed = 0;
+
+			pp->h_idle += (pp->nidle - pp->h_idle) * .125;
 
 			wrk = NULL;
 			pt = VTAILQ_LAST(&pp->idle_queue, taskhead);
@@ -504,7 +831,14 @@ pool_herder(void *priv)
 				AZ(pt->func);
 				CAST_OBJ_NOTNULL(wrk, pt->priv, WORKER_MAGIC);
 
-				if (pp->die || wrk->lastused < t_idle ||
+				if (!pp->die && wrk->lastused < t_idle &&
+				    pp->nthr <= cache_param->wthread_max &&
+				    cache_param->wthread_predict &&
+				    pp->h_idle < pool_reserve() + 1.) {
+					/* Busy lately, hang on to it */
+					VSC_C_main->threads_kept++;
+					wrk = NULL;
+				} else if (pp->die || wrk->lastused < t_idle ||
 				    pp->nthr > cache_param->wthread_max) {
 					/* Give it a kiss on the cheek... */
 					VTAILQ_REMOVE(&pp->idle_queue,
@@ -103,6 +103,7 @@ WS_Init(struct ws *ws, const char *id, void *space, unsigned len)
 	ws->e = ws->s + len;
 	*ws->e = 0x15;
 	ws->f = ws->s;
+	ws->h = ws->s;
 	assert(id[0] & 0x20);
 	assert(strlen(id) < sizeof ws->id);
 	strcpy(ws->id, id);
@@ -138,6 +139,8 @@ WS_Reset(struct ws *ws, uintptr_t pp)
 	p = (char *)pp;
 	DSL(DBG_WORKSPACE, 0, "WS_Reset(%p, %p)", ws, p);
 	assert(ws->r == NULL);
+	if (ws->f > ws->h)
+		ws->h = ws->f;
 	if (p == NULL)
 		ws->f = ws->s;
 	else {
@@ -217,6 +220,53 @@ WS_Printf(struct ws *ws, const char *fmt, ...)
 	return (p);
 }
 
+/*
+ * Build a string in the free part of the workspace with the VSB API.
+ * If the string outgrows the workspace it moves to the heap, so this
+ * never fails for lack of workspace.  Nothing else may allocate from
+ * the workspace until WS_VSB_finish().
+ */
+
+struct vsb *
+WS_VSB_new(struct vsb *vsb, struct ws *ws)
+{
+	unsigned u;
+
+	AN(vsb);
+	WS_Assert(ws);
+	u = WS_Reserve(ws, 0);
+	if (u < 2)
+		return (VSB_new(vsb, NULL, 0, VSB_AUTOEXTEND));
+	return (VSB_new(vsb, ws->f, u, VSB_AUTOEXTEND));
+}
+
+/*
+ * Finish a VSB from WS_VSB_new().  A string which stayed in the workspace
+ * is allocated there, one which moved to the heap stays there until
+ * VSB_delete().  Returns the string, or NULL if the VSB failed.
+ */
+
+char *
+WS_VSB_finish(struct vsb *vsb, struct ws *ws, size_t *szp)
+{
+	char *p = NULL;
+
+	AN(vsb);
+	WS_Assert(ws);
+	if (!VSB_finish(vsb)) {
+		p = VSB_data(vsb);
+		if (szp != NULL)
+			*szp = VSB_len(vsb);
+	}
+	if (ws->r != NULL) {
+		if (p == ws->f)
+			WS_Release(ws, VSB_len(vsb) + 1);
+		else
+			WS_Release(ws, 0);
+	}
+	return (p);
+}
+
 uintptr_t
 WS_Snapshot(struct ws *ws)
 {
@@ -287,6 +337,40 @@ WS_ReleaseP(struct ws *ws, char *ptr)
 	WS_Assert(ws);
 }
 
+/*
+ * How much of the workspace was ever allocated, across WS_Reset()s.
+ * Reservations only count for what was released to the allocation.
+ */
+
+unsigned
+WS_HighWater(const struct ws *ws)
+{
+
+	CHECK_OBJ_NOTNULL(ws, WS_MAGIC);
+	if (ws->f > ws->h)
+		return (pdiff(ws->s, ws->f));
+	return (pdiff(ws->s, ws->h));
+}
+
+/*
+ * Which quarter of the workspace the high water mark ended up in,
+ * 0 to 3.  An overflowed workspace is in the last.
+ */
+
+unsigned
+WS_Quartile(const struct ws *ws)
+{
+	uint64_t u;
+
+	if (WS_Overflowed(ws))
+		return (3);
+	u = WS_HighWater(ws);
+	if (u == 0)
+		return (0);
+	u = (u * 4 - 1) / pdiff(ws->s, ws->e);
+	return (u > 3 ? 3 : (unsigned)u);
+}
+
 int
 WS_Overflowed(const struct ws *ws)
 {
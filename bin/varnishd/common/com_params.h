@@ -56,12 +56,22 @@ struct poolparam {
 	double			max_age;
 };
 
+struct hdrparam {
+	char			hdr[64];	/* http_GetHdr() format */
+};
+
+struct addrparam {
+	char			list[512];	/* addresses, space separated */
+};
+
 struct params {
 
+#define	ptyp_addrlist	struct addrparam
 #define	ptyp_bool	unsigned
 #define	ptyp_bytes	ssize_t
 #define	ptyp_bytes_u	unsigned
 #define	ptyp_double	double
+#define	ptyp_header	struct hdrparam
 #define	ptyp_poolparam	struct poolparam
 #define	ptyp_timeout	double
 #define	ptyp_uint	unsigned
@@ -69,10 +79,12 @@ struct params {
 #define	ptyp_vsl_reclen	unsigned
 #define PARAM(nm, ty, mi, ma, de, un, fl, st, lt, fn) ptyp_##ty nm;
 #include <tbl/params.h>
+#undef ptyp_addrlist
 #undef ptyp_bool
 #undef ptyp_bytes
 #undef ptyp_bytes_u
 #undef ptyp_double
+#undef ptyp_header
 #undef ptyp_poolparam
 #undef ptyp_timeout
 #undef ptyp_uint
@@ -89,12 +101,18 @@ struct params {
 	unsigned		wthread_reserve;
 	double			wthread_timeout;
 	unsigned		wthread_pools;
+	unsigned		wthread_numa;
+	unsigned		wthread_steal;
+	unsigned		wthread_predict;
 	double			wthread_add_delay;
 	double			wthread_fail_delay;
 	double			wthread_destroy_delay;
 	unsigned		wthread_stats_rate;
 	ssize_t			wthread_stacksize;
 	unsigned		wthread_queue_limit;
+	double			wthread_queue_target;
+	double			wthread_queue_interval;
+	unsigned		wthread_queue_fair;
 
 	struct vre_limits	vre_limits;
 
@@ -45,6 +45,7 @@
 #include "vsm_priv.h"
 #include "vmb.h"
 #include "vtim.h"
+#include "vtree.h"
 
 extern volatile struct params * cache_param;
 
@@ -54,6 +55,7 @@ struct vsm_range {
 	unsigned			magic;
 #define VSM_RANGE_MAGIC			0x8d30f14
 	VTAILQ_ENTRY(vsm_range)		list;
+	VRB_ENTRY(vsm_range)		tree;
 	ssize_t				off;
 	ssize_t				len;
 	double				cool;
@@ -70,8 +72,10 @@ struct vsm_sc {
 	double				t0;
 	VTAILQ_HEAD(,vsm_range)		r_used;
 	VTAILQ_HEAD(,vsm_range)		r_cooling;
+	VTAILQ_HEAD(,vsm_range)		r_spare;
 	VTAILQ_HEAD(,vsm_range)		r_free;
 	VTAILQ_HEAD(,vsm_range)		r_bogus;
+	VRB_HEAD(vsm_used_tree, vsm_range) t_used;
 	uint64_t			g_free;
 	uint64_t			g_used;
 	uint64_t			g_cooling;
@@ -79,6 +83,27 @@ struct vsm_sc {
 	uint64_t			c_overflow;
 };
 
+/*--------------------------------------------------------------------
+ * Chunks come and go with dynamic backends and such, by the thousands.
+ * The used ranges are also kept in a tree by their pointer, so freeing
+ * does not walk them all, and ranges which cooled off are kept as they
+ * are on the spare list, for the next chunk of the same size, which is
+ * usually another one of the same kind.  Only when nothing else fits
+ * are the spares collapsed into the free list.
+ */
+
+static int
+vsm_range_cmp(const struct vsm_range *a, const struct vsm_range *b)
+{
+
+	if ((uintptr_t)a->ptr < (uintptr_t)b->ptr)
+		return (-1);
+	return ((uintptr_t)a->ptr > (uintptr_t)b->ptr);
+}
+
+VRB_PROTOTYPE_STATIC(vsm_used_tree, vsm_range, tree, vsm_range_cmp)
+VRB_GENERATE_STATIC(vsm_used_tree, vsm_range, tree, vsm_range_cmp)
+
 /*--------------------------------------------------------------------
  * The free list is sorted by size, which means that collapsing ranges
  * on free becomes a multi-pass operation.
@@ -137,8 +162,10 @@ VSM_common_new(void *p, ssize_t l)
 	AN(sc);
 	VTAILQ_INIT(&sc->r_used);
 	VTAILQ_INIT(&sc->r_cooling);
+	VTAILQ_INIT(&sc->r_spare);
 	VTAILQ_INIT(&sc->r_free);
 	VTAILQ_INIT(&sc->r_bogus);
+	VRB_INIT(&sc->t_used);
 	sc->b = p;
 	sc->len = l;
 	sc->t0 = VTIM_mono();
@@ -162,7 +189,7 @@ VSM_common_new(void *p, ssize_t l)
 }
 
 /*--------------------------------------------------------------------
- * Move from cooling list to free list
+ * Move from cooling list to spare list
  */
 
 void
@@ -180,7 +207,7 @@ VSM_common_cleaner(struct vsm_sc *sc, struct VSC_C_main *stats)
 		VTAILQ_REMOVE(&sc->r_cooling, vr, list);
 		sc->g_cooling -= vr->len;
 		sc->g_free += vr->len;
-		vsm_common_insert_free(sc, vr);
+		VTAILQ_INSERT_TAIL(&sc->r_spare, vr, list);
 	}
 	stats->vsm_free = sc->g_free;
 	stats->vsm_used = sc->g_used;
@@ -214,6 +241,16 @@ VSM_common_alloc(struct vsm_sc *sc, ssize_t size,
 	l1 = RUP2(size + sizeof(struct VSM_chunk), 16);
 	l2 = RUP2(size + 2 * sizeof(struct VSM_chunk), 16);
 
+	/* A spare which fits like a range from the free-list would */
+	VTAILQ_FOREACH(vr, &sc->r_spare, list)
+		if (vr->len >= l1 && vr->len <= l2)
+			break;
+	if (vr != NULL) {
+		VTAILQ_REMOVE(&sc->r_spare, vr, list);
+		goto found;
+	}
+
+  again:
 	/* Find space in free-list */
 	VTAILQ_FOREACH_SAFE(vr, &sc->r_free, list, vr2) {
 		if (vr->len < l1)
@@ -234,6 +271,14 @@ VSM_common_alloc(struct vsm_sc *sc, ssize_t size,
 		break;
 	}
 
+	if (vr == NULL && !VTAILQ_EMPTY(&sc->r_spare)) {
+		VTAILQ_FOREACH_SAFE(vr, &sc->r_spare, list, vr2) {
+			VTAILQ_REMOVE(&sc->r_spare, vr, list);
+			vsm_common_insert_free(sc, vr);
+		}
+		goto again;
+	}
+
 	if (vr == NULL) {
 		/*
 		 * No space in VSM, return malloc'd space
@@ -250,6 +295,7 @@ VSM_common_alloc(struct vsm_sc *sc, ssize_t size,
 		return (vr->ptr);
 	}
 
+  found:
 	sc->g_free -= vr->len;
 	sc->g_used += vr->len;
 
@@ -268,6 +314,7 @@ VSM_common_alloc(struct vsm_sc *sc, ssize_t size,
 
 	vr3 = VTAILQ_FIRST(&sc->r_used);
 	VTAILQ_INSERT_HEAD(&sc->r_used, vr, list);
+	AZ(VRB_INSERT(vsm_used_tree, &sc->t_used, vr));
 
 	if (vr3 != NULL) {
 		AZ(vr3->chunk->next);
@@ -287,15 +334,17 @@ VSM_common_alloc(struct vsm_sc *sc, ssize_t size,
 void
 VSM_common_free(struct vsm_sc *sc, void *ptr)
 {
-	struct vsm_range *vr, *vr2;
+	struct vsm_range *vr, *vr2, key;
 
 	CHECK_OBJ_NOTNULL(sc, VSM_SC_MAGIC);
 	AN(ptr);
 
-	/* Look in used list, move to cooling list */
-	VTAILQ_FOREACH(vr, &sc->r_used, list) {
-		if (vr->ptr != ptr)
-			continue;
+	/* Look in used tree, move to cooling list */
+	key.ptr = ptr;
+	vr = VRB_FIND(vsm_used_tree, &sc->t_used, &key);
+	if (vr != NULL) {
+		CHECK_OBJ(vr, VSM_RANGE_MAGIC);
+		VRB_REMOVE(vsm_used_tree, &sc->t_used, vr);
 
 		sc->g_used -= vr->len;
 		sc->g_cooling += vr->len;
@@ -348,6 +397,8 @@ VSM_common_delete(struct vsm_sc **scp)
 		FREE_OBJ(vr);
 	VTAILQ_FOREACH_SAFE(vr, &sc->r_cooling, list, vr2)
 		FREE_OBJ(vr);
+	VTAILQ_FOREACH_SAFE(vr, &sc->r_spare, list, vr2)
+		FREE_OBJ(vr);
 	VTAILQ_FOREACH_SAFE(vr, &sc->r_bogus, list, vr2) {
 		free(vr->ptr);
 		FREE_OBJ(vr);
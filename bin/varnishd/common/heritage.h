@@ -30,6 +30,7 @@
  */
 
 struct vsm_sc;
+struct sockaddr_un;
 struct suckaddr;
 struct transport;
 
@@ -51,7 +52,12 @@ struct listen_sock {
 	const struct listen_arg		*arg;
 	char				*name;
 	struct suckaddr			*addr;
+	/* Unix domain socket, addr is then the bogo-address 0.0.0.0:0 */
+	struct sockaddr_un		*uds;
 	const struct transport		*transport;
+	/* SO_REUSEPORT group, one socket per thread pool */
+	unsigned			nreuse;
+	unsigned			reuse_idx;
 };
 
 VTAILQ_HEAD(listen_sock_head, listen_sock);
@@ -80,6 +86,13 @@ struct heritage {
 
 	char				*panic_str;
 	ssize_t				panic_str_len;
+
+	/* PEM certificate and key for TLS listeners, see tls_certificate */
+	char				*tls_pem;
+	ssize_t				tls_pem_len;
+
+	/* VTIM_mono() when the child was forked */
+	double				t_launch;
 };
 
 extern struct heritage heritage;
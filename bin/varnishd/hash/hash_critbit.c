@@ -40,7 +40,6 @@
 #include "vmb.h"
 #include "vtim.h"
 
-static struct lock hcb_mtx;
 
 /*---------------------------------------------------------------------
  * Table for finding out how many bits two bytes have in common,
@@ -99,16 +98,36 @@ struct hcb_y {
 #define HCB_BIT_NODE		(1<<0)
 #define HCB_BIT_Y		(1<<1)
 
+/*---------------------------------------------------------------------
+ * The tree is split into HCB_NROOT subtrees by the top bits of the
+ * digest, each with its own lock and cooling lists, so inserts and
+ * deletes in different subtrees do not contend.
+ */
+
+#define HCB_ROOT_BITS		4
+#define HCB_NROOT		(1 << HCB_ROOT_BITS)
+
+VSTAILQ_HEAD(hcb_y_head, hcb_y);
+VTAILQ_HEAD(hcb_oh_head, objhead);
+
 struct hcb_root {
 	volatile uintptr_t	origo;
+	struct lock		mtx;
+	struct hcb_y_head	cool_y;
+	struct hcb_oh_head	cool_h;
 };
 
-static struct hcb_root	hcb_root;
+static struct hcb_root	hcb_root[HCB_NROOT];
+
+static struct hcb_y_head	dead_y = VSTAILQ_HEAD_INITIALIZER(dead_y);
+static struct hcb_oh_head	dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
+
+static struct hcb_root *
+hcb_get_root(const uint8_t *digest)
+{
 
-static VSTAILQ_HEAD(, hcb_y)	cool_y = VSTAILQ_HEAD_INITIALIZER(cool_y);
-static VSTAILQ_HEAD(, hcb_y)	dead_y = VSTAILQ_HEAD_INITIALIZER(dead_y);
-static VTAILQ_HEAD(, objhead)	cool_h = VTAILQ_HEAD_INITIALIZER(cool_h);
-static VTAILQ_HEAD(, objhead)	dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
+	return (&hcb_root[digest[0] >> (8 - HCB_ROOT_BITS)]);
+}
 
 /*---------------------------------------------------------------------
  * Pointer accessor functions
@@ -295,7 +314,7 @@ hcb_delete(struct hcb_root *r, struct objhead *oh)
 		assert(s < 2);
 		if (y->leaf[s] == hcb_r_node(oh)) {
 			*p = y->leaf[1 - s];
-			VSTAILQ_INSERT_TAIL(&cool_y, y, list);
+			VSTAILQ_INSERT_TAIL(&r->cool_y, y, list);
 			return;
 		}
 		p = &y->leaf[s];
@@ -309,6 +328,7 @@ hcb_cleaner(struct worker *wrk, void *priv)
 {
 	struct hcb_y *y, *y2;
 	struct objhead *oh, *oh2;
+	struct hcb_root *r;
 
 	(void)priv;
 	while (1) {
@@ -320,10 +340,12 @@ hcb_cleaner(struct worker *wrk, void *priv)
 			VTAILQ_REMOVE(&dead_h, oh, hoh_list);
 			HSH_DeleteObjHead(wrk, oh);
 		}
-		Lck_Lock(&hcb_mtx);
-		VSTAILQ_CONCAT(&dead_y, &cool_y);
-		VTAILQ_CONCAT(&dead_h, &cool_h, hoh_list);
-		Lck_Unlock(&hcb_mtx);
+		for (r = hcb_root; r < hcb_root + HCB_NROOT; r++) {
+			Lck_Lock(&r->mtx);
+			VSTAILQ_CONCAT(&dead_y, &r->cool_y);
+			VTAILQ_CONCAT(&dead_h, &r->cool_h, hoh_list);
+			Lck_Unlock(&r->mtx);
+		}
 		Pool_Sumstat(wrk);
 		VTIM_sleep(cache_param->critbit_cooloff);
 	}
@@ -336,28 +358,35 @@ static void __match_proto__(hash_start_f)
 hcb_start(void)
 {
 	struct objhead *oh = NULL;
+	struct hcb_root *r;
 	pthread_t tp;
 
 	(void)oh;
-	Lck_New(&hcb_mtx, lck_hcb);
-	WRK_BgThread(&tp, "hcb-cleaner", hcb_cleaner, NULL);
 	memset(&hcb_root, 0, sizeof hcb_root);
+	for (r = hcb_root; r < hcb_root + HCB_NROOT; r++) {
+		Lck_New(&r->mtx, lck_hcb);
+		VSTAILQ_INIT(&r->cool_y);
+		VTAILQ_INIT(&r->cool_h);
+	}
+	WRK_BgThread(&tp, "hcb-cleaner", hcb_cleaner, NULL);
 	hcb_build_bittbl();
 }
 
 static int __match_proto__(hash_deref_f)
 hcb_deref(struct objhead *oh)
 {
+	struct hcb_root *r;
 
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 	Lck_Lock(&oh->mtx);
 	assert(oh->refcnt > 0);
 	oh->refcnt--;
 	if (oh->refcnt == 0) {
-		Lck_Lock(&hcb_mtx);
-		hcb_delete(&hcb_root, oh);
-		VTAILQ_INSERT_TAIL(&cool_h, oh, hoh_list);
-		Lck_Unlock(&hcb_mtx);
+		r = hcb_get_root(oh->digest);
+		Lck_Lock(&r->mtx);
+		hcb_delete(r, oh);
+		VTAILQ_INSERT_TAIL(&r->cool_h, oh, hoh_list);
+		Lck_Unlock(&r->mtx);
 	}
 	Lck_Unlock(&oh->mtx);
 #ifdef PHK
@@ -370,11 +399,13 @@ static struct objhead * __match_proto__(hash_lookup_f)
 hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 {
 	struct objhead *oh;
+	struct hcb_root *r;
 	struct hcb_y *y;
 	unsigned u;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	AN(digest);
+	r = hcb_get_root(digest);
 	if (noh != NULL) {
 		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
 		assert((*noh)->refcnt == 1);
@@ -383,7 +414,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 	/* First try in read-only mode without holding a lock */
 
 	wrk->stats->hcb_nolock++;
-	oh = hcb_insert(wrk, &hcb_root, digest, NULL);
+	oh = hcb_insert(wrk, r, digest, NULL);
 	if (oh != NULL) {
 		Lck_Lock(&oh->mtx);
 		/*
@@ -396,15 +427,19 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 			return (oh);
 		}
 		Lck_Unlock(&oh->mtx);
+		wrk->stats->hcb_retry++;
 	}
 
 	while (1) {
 		/* No luck, try with lock held, so we can modify tree */
 		CAST_OBJ_NOTNULL(y, wrk->nhashpriv, HCB_Y_MAGIC);
-		Lck_Lock(&hcb_mtx);
-		VSC_C_main->hcb_lock++;
-		oh = hcb_insert(wrk, &hcb_root, digest, noh);
-		Lck_Unlock(&hcb_mtx);
+		if (Lck_Trylock(&r->mtx)) {
+			wrk->stats->hcb_contended++;
+			Lck_Lock(&r->mtx);
+		}
+		wrk->stats->hcb_lock++;
+		oh = hcb_insert(wrk, r, digest, noh);
+		Lck_Unlock(&r->mtx);
 
 		if (oh == NULL)
 			return (NULL);
@@ -414,7 +449,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 		if (noh != NULL && *noh == NULL) {
 			assert(oh->refcnt > 0);
-			VSC_C_main->hcb_insert++;
+			wrk->stats->hcb_insert++;
 			return (oh);
 		}
 		/*
@@ -427,6 +462,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 			return (oh);
 		}
 		Lck_Unlock(&oh->mtx);
+		wrk->stats->hcb_retry++;
 	}
 }
 
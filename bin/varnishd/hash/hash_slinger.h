@@ -67,6 +67,8 @@ enum lookup_e HSH_Lookup(struct req *, struct objcore **, struct objcore **,
 void HSH_Ref(struct objcore *o);
 void HSH_Init(const struct hash_slinger *slinger);
 void HSH_AddString(struct req *, void *ctx, const char *str);
+#define HSH_PFX_MAX	192
+void HSH_AddPrefix(struct req *, void *ctx, const void *, size_t);
 void HSH_Insert(struct worker *, const void *hash, struct objcore *,
     struct ban *);
 void HSH_Purge(struct worker *, struct objhead *, double ttl, double grace,
@@ -78,6 +80,8 @@ struct objcore *HSH_Private(struct worker *wrk);
 void HSH_Abandon(struct objcore *oc);
 int HSH_Snipe(const struct worker *, struct objcore *);
 void HSH_Kill(struct objcore *);
+struct objcore *HSH_Variant(struct worker *, struct objcore *);
+struct objcore *HSH_Replace(struct worker *, struct objcore *);
 
 #ifdef VARNISH_CACHE_CHILD
 
@@ -107,6 +111,7 @@ struct objhead {
 
 void HSH_Fail(struct objcore *);
 void HSH_Unbusy(struct worker *, struct objcore *);
+struct objhead *HSH_NewObjHead(void);
 void HSH_DeleteObjHead(struct worker *, struct objhead *);
 int HSH_DerefObjHead(struct worker *, struct objhead **);
 int HSH_DerefObjCore(struct worker *, struct objcore **, int);
@@ -117,3 +122,4 @@ int HSH_DerefObjCore(struct worker *, struct objcore **, int);
 extern const struct hash_slinger hsl_slinger;
 extern const struct hash_slinger hcl_slinger;
 extern const struct hash_slinger hcb_slinger;
+extern const struct hash_slinger htb_slinger;
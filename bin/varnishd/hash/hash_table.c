@@ -0,0 +1,397 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * A resizable open-addressing hash table.
+ *
+ * The table is split into up to HTB_NSEG segments, selected by the first byte
+ * of the digest, and each segment is an independently locked and
+ * independently sized table.  Growing a segment never stops the others.
+ *
+ * A segment is an array of buckets, each bucket is one cache line holding
+ * HTB_SLOTS entries.  An entry is a 32 bit tag, taken from the digest, and
+ * the objhead pointer.  The tag also selects the home bucket, so probing
+ * and rehashing only dereference an objhead when the tags match.
+ *
+ * Collisions are resolved by linear probing, removal uses backward
+ * shifting so no tombstones accumulate in the live table.
+ *
+ * When a segment passes 3/4 load, a table of twice the size is allocated
+ * and the old table is migrated a few buckets at a time by subsequent
+ * operations on the segment.  While migrating, lookups consult both
+ * tables and removals from the old table leave tombstones, which go
+ * away with the old table.
+ */
+
+#include "config.h"
+
+#include "cache/cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hash/hash_slinger.h"
+
+static struct VSC_C_lck *lck_htb;
+
+/*--------------------------------------------------------------------*/
+
+#define HTB_NSEG		256
+#define HTB_SLOTS		5
+#define HTB_MIGRATE		4	/* Old buckets moved per operation */
+#define HTB_MIN_BUCKETS		1
+
+/* 5 * 4 + 4 + 5 * 8 = 64 bytes (on LP64) */
+struct htb_bucket {
+	uint32_t		tag[HTB_SLOTS];
+	uint32_t		pad;
+	struct objhead		*oh[HTB_SLOTS];
+};
+
+struct htb_tbl {
+	struct htb_bucket	*b;
+	unsigned		nbucket;	/* power of two */
+	unsigned		nslot;
+	unsigned		used;
+};
+
+struct htb_seg {
+	unsigned		magic;
+#define HTB_SEG_MAGIC		0x5c0b6a1d
+	struct lock		mtx;
+	struct htb_tbl		cur;
+	struct htb_tbl		old;
+	unsigned		mig;		/* next old bucket to migrate */
+};
+
+static unsigned			htb_nbucket = HTB_NSEG * 16;
+static unsigned			htb_nseg;
+static struct htb_seg		*htb_seg;
+
+/* Marks a removed entry in a table being migrated */
+static struct objhead		htb_tomb[1];
+
+#define HTB_OH(t, p)	((t)->b[(p) / HTB_SLOTS].oh[(p) % HTB_SLOTS])
+#define HTB_TAG(t, p)	((t)->b[(p) / HTB_SLOTS].tag[(p) % HTB_SLOTS])
+#define HTB_HOME(t, g)	(((g) & ((t)->nbucket - 1)) * HTB_SLOTS)
+#define HTB_NEXT(t, p)	((p) + 1 == (t)->nslot ? 0 : (p) + 1)
+
+/*--------------------------------------------------------------------
+ * The ->init method allows the management process to pass arguments
+ */
+
+static void __match_proto__(hash_init_f)
+htb_init(int ac, char * const *av)
+{
+	int i;
+	unsigned u;
+
+	if (ac == 0)
+		return;
+	if (ac > 1)
+		ARGV_ERR("(-htable) too many arguments\n");
+	i = sscanf(av[0], "%u", &u);
+	if (i <= 0 || u == 0)
+		ARGV_ERR("(-htable) invalid number of buckets \"%s\"\n", av[0]);
+	htb_nbucket = u;
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+htb_tbl_new(struct htb_tbl *t, unsigned nbucket)
+{
+
+	assert(nbucket >= HTB_MIN_BUCKETS);
+	assert(!(nbucket & (nbucket - 1)));
+	t->b = calloc(nbucket, sizeof *t->b);
+	XXXAN(t->b);
+	t->nbucket = nbucket;
+	t->nslot = nbucket * HTB_SLOTS;
+	t->used = 0;
+}
+
+static void
+htb_tbl_free(struct htb_tbl *t)
+{
+
+	AZ(t->used);
+	free(t->b);
+	memset(t, 0, sizeof *t);
+}
+
+static uint32_t
+htb_tag(const void *digest)
+{
+	uint32_t g;
+
+	memcpy(&g, (const uint8_t *)digest + 4, sizeof g);
+	return (g);
+}
+
+/*--------------------------------------------------------------------
+ * Table primitives, all called with the segment lock held.
+ */
+
+static struct objhead *
+htb_tbl_find(const struct htb_tbl *t, uint32_t g, const void *digest)
+{
+	struct objhead *oh;
+	unsigned p, n;
+
+	if (t->b == NULL)
+		return (NULL);
+	p = HTB_HOME(t, g);
+	for (n = 0; n < t->nslot; n++, p = HTB_NEXT(t, p)) {
+		oh = HTB_OH(t, p);
+		if (oh == NULL)
+			return (NULL);
+		if (oh == htb_tomb || HTB_TAG(t, p) != g)
+			continue;
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		if (!memcmp(oh->digest, digest, sizeof oh->digest))
+			return (oh);
+	}
+	return (NULL);
+}
+
+static void
+htb_tbl_put(struct htb_tbl *t, uint32_t g, struct objhead *oh)
+{
+	unsigned p;
+
+	assert(t->used < t->nslot);
+	p = HTB_HOME(t, g);
+	while (HTB_OH(t, p) != NULL && HTB_OH(t, p) != htb_tomb)
+		p = HTB_NEXT(t, p);
+	HTB_OH(t, p) = oh;
+	HTB_TAG(t, p) = g;
+	t->used++;
+}
+
+static int
+htb_tbl_slot(const struct htb_tbl *t, uint32_t g, const struct objhead *oh)
+{
+	unsigned p, n;
+
+	if (t->b == NULL)
+		return (-1);
+	p = HTB_HOME(t, g);
+	for (n = 0; n < t->nslot; n++, p = HTB_NEXT(t, p)) {
+		if (HTB_OH(t, p) == oh)
+			return (p);
+		if (HTB_OH(t, p) == NULL)
+			return (-1);
+	}
+	return (-1);
+}
+
+/* Remove by shifting the rest of the probe sequence back */
+
+static void
+htb_tbl_shift(struct htb_tbl *t, unsigned hole)
+{
+	unsigned p, h;
+
+	HTB_OH(t, hole) = NULL;
+	t->used--;
+	for (p = HTB_NEXT(t, hole); HTB_OH(t, p) != NULL; p = HTB_NEXT(t, p)) {
+		h = HTB_HOME(t, HTB_TAG(t, p));
+		/* Move p if the hole lies on its probe path from h */
+		if ((hole + t->nslot - h) % t->nslot >=
+		    (p + t->nslot - h) % t->nslot)
+			continue;
+		HTB_OH(t, hole) = HTB_OH(t, p);
+		HTB_TAG(t, hole) = HTB_TAG(t, p);
+		HTB_OH(t, p) = NULL;
+		hole = p;
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Incremental growth
+ */
+
+static void
+htb_migrate(struct htb_seg *sp, unsigned nbucket)
+{
+	struct htb_bucket *bp;
+	unsigned u;
+
+	Lck_AssertHeld(&sp->mtx);
+	for (; nbucket > 0 && sp->old.b != NULL; nbucket--) {
+		bp = &sp->old.b[sp->mig];
+		for (u = 0; u < HTB_SLOTS; u++) {
+			if (bp->oh[u] == NULL || bp->oh[u] == htb_tomb)
+				continue;
+			htb_tbl_put(&sp->cur, bp->tag[u], bp->oh[u]);
+			bp->oh[u] = htb_tomb;
+			sp->old.used--;
+		}
+		if (++sp->mig == sp->old.nbucket) {
+			htb_tbl_free(&sp->old);
+			sp->mig = 0;
+		}
+	}
+}
+
+static void
+htb_grow(struct htb_seg *sp)
+{
+
+	Lck_AssertHeld(&sp->mtx);
+	if (sp->old.b != NULL)
+		htb_migrate(sp, sp->old.nbucket);
+	AZ(sp->old.b);
+	sp->old = sp->cur;
+	sp->mig = 0;
+	htb_tbl_new(&sp->cur, sp->old.nbucket * 2);
+	htb_migrate(sp, HTB_MIGRATE);
+}
+
+/*--------------------------------------------------------------------
+ * The ->start method is called during cache process start and allows
+ * initialization to happen before the first lookup.
+ */
+
+static void __match_proto__(hash_start_f)
+htb_start(void)
+{
+	unsigned u, n;
+
+	/* Small tables get fewer segments, so they still get to grow */
+	for (htb_nseg = HTB_NSEG; htb_nseg > htb_nbucket; htb_nseg >>= 1)
+		continue;
+
+	lck_htb = Lck_CreateClass("htb");
+	htb_seg = calloc(htb_nseg, sizeof *htb_seg);
+	XXXAN(htb_seg);
+
+	for (n = HTB_MIN_BUCKETS; n * htb_nseg < htb_nbucket; n <<= 1)
+		continue;
+	for (u = 0; u < htb_nseg; u++) {
+		htb_seg[u].magic = HTB_SEG_MAGIC;
+		Lck_New(&htb_seg[u].mtx, lck_htb);
+		htb_tbl_new(&htb_seg[u].cur, n);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Lookup and possibly insert element.
+ * If nobj != NULL and the lookup does not find key, nobj is inserted.
+ * If nobj == NULL and the lookup does not find key, NULL is returned.
+ * A reference to the returned object is held.
+ */
+
+static struct objhead * __match_proto__(hash_lookup_f)
+htb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
+{
+	struct objhead *oh;
+	struct htb_seg *sp;
+	uint32_t g;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	if (noh != NULL)
+		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
+
+	sp = &htb_seg[((const uint8_t *)digest)[0] % htb_nseg];
+	CHECK_OBJ(sp, HTB_SEG_MAGIC);
+	g = htb_tag(digest);
+
+	Lck_Lock(&sp->mtx);
+	htb_migrate(sp, HTB_MIGRATE);
+	oh = htb_tbl_find(&sp->cur, g, digest);
+	if (oh == NULL)
+		oh = htb_tbl_find(&sp->old, g, digest);
+	if (oh != NULL) {
+		oh->refcnt++;
+		Lck_Unlock(&sp->mtx);
+		Lck_Lock(&oh->mtx);
+		return (oh);
+	}
+
+	if (noh == NULL) {
+		Lck_Unlock(&sp->mtx);
+		return (NULL);
+	}
+
+	if ((sp->cur.used + 1) * 4 > sp->cur.nslot * 3)
+		htb_grow(sp);
+
+	oh = *noh;
+	*noh = NULL;
+	memcpy(oh->digest, digest, sizeof oh->digest);
+	oh->hoh_head = sp;
+	htb_tbl_put(&sp->cur, g, oh);
+
+	Lck_Unlock(&sp->mtx);
+	Lck_Lock(&oh->mtx);
+	return (oh);
+}
+
+/*--------------------------------------------------------------------
+ * Dereference and if no references are left, free.
+ */
+
+static int __match_proto__(hash_deref_f)
+htb_deref(struct objhead *oh)
+{
+	struct htb_seg *sp;
+	uint32_t g;
+	int p, ret;
+
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	CAST_OBJ_NOTNULL(sp, oh->hoh_head, HTB_SEG_MAGIC);
+	assert(oh->refcnt > 0);
+	g = htb_tag(oh->digest);
+	Lck_Lock(&sp->mtx);
+	if (--oh->refcnt == 0) {
+		p = htb_tbl_slot(&sp->cur, g, oh);
+		if (p >= 0) {
+			htb_tbl_shift(&sp->cur, p);
+		} else {
+			p = htb_tbl_slot(&sp->old, g, oh);
+			assert(p >= 0);
+			HTB_OH(&sp->old, p) = htb_tomb;
+			sp->old.used--;
+		}
+		ret = 0;
+	} else
+		ret = 1;
+	htb_migrate(sp, HTB_MIGRATE);
+	Lck_Unlock(&sp->mtx);
+	return (ret);
+}
+
+/*--------------------------------------------------------------------*/
+
+const struct hash_slinger htb_slinger = {
+	.magic	=	SLINGER_MAGIC,
+	.name	=	"table",
+	.init	=	htb_init,
+	.start	=	htb_start,
+	.lookup =	htb_lookup,
+	.deref	=	htb_deref,
+};
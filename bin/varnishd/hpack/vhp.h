@@ -60,6 +60,8 @@ int VHT_SetMaxTableSize(struct vht_table *, size_t);
 int VHT_SetProtoMax(struct vht_table *, size_t);
 const char *VHT_LookupName(const struct vht_table *, unsigned, size_t *);
 const char *VHT_LookupValue(const struct vht_table *, unsigned, size_t *);
+unsigned VHT_Find(const struct vht_table *, const char *, size_t,
+    const char *, size_t, int *);
 int VHT_Init(struct vht_table *, size_t);
 void VHT_Fini(struct vht_table *);
 
@@ -92,8 +94,8 @@ struct vhd_huffman {
 #define VHD_HUFFMAN_MAGIC	0x56
 
 	uint8_t			blen;
-	uint16_t		bits;
 	uint16_t		pos;
+	uint32_t		bits;
 	unsigned		len;
 };
 
@@ -126,3 +128,21 @@ enum vhd_ret_e  VHD_Decode(struct vhd_decode *, struct vht_table *,
     const uint8_t *in, size_t inlen, size_t *p_inused,
     char *out, size_t outlen, size_t *p_outused);
 const char *VHD_Error(enum vhd_ret_e);
+
+/* VHE - Varnish HPACK Encoder */
+
+enum vhe_index_e {
+	VHE_INDEX,		/* Incremental indexing */
+	VHE_NOINDEX,		/* Without indexing */
+	VHE_NEVER,		/* Never indexed */
+};
+
+size_t VHE_Integer(uint8_t *buf, size_t buflen, uint8_t flags, unsigned pfx,
+    size_t v);
+size_t VHE_String(uint8_t *buf, size_t buflen, const char *s, size_t len,
+    int lower);
+size_t VHE_TableSize(struct vht_table *, uint8_t *buf, size_t buflen,
+    size_t maxsize);
+size_t VHE_Header(struct vht_table *, uint8_t *buf, size_t buflen,
+    const char *name, size_t namelen, const char *value, size_t valuelen,
+    enum vhe_index_e);
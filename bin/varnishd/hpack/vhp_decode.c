@@ -420,6 +420,33 @@ vhd_huffman(struct vhd_ctx *ctx, unsigned first)
 	r = VHD_OK;
 	l = 0;
 	while (1) {
+		/*
+		 * Fast path: between codes, look up a full window and
+		 * emit all the symbols it holds in one go.  Anything the
+		 * fast table can't resolve, including the sign-off at the
+		 * end of the string, is left to the bit-by-table code below.
+		 */
+		while (huf->pos == 0) {
+			while (huf->blen < HUFFAST_BITS && huf->len > 0 &&
+			    ctx->in < ctx->in_e) {
+				huf->bits = (huf->bits << 8) | *ctx->in;
+				huf->blen += 8;
+				huf->len--;
+				ctx->in++;
+			}
+			if (huf->blen < HUFFAST_BITS)
+				break;
+			u = (huf->bits >> (huf->blen - HUFFAST_BITS)) &
+			    ((1U << HUFFAST_BITS) - 1U);
+			if (huffast[u].n == 0 ||
+			    ctx->out_e - (ctx->out + l) < huffast[u].n)
+				break;
+			memcpy(ctx->out + l, huffast[u].chr, huffast[u].n);
+			l += huffast[u].n;
+			huf->blen -= huffast[u].len;
+			huf->bits &= (1U << huf->blen) - 1U;
+		}
+
 		assert(huf->pos < HUFDEC_LEN);
 		assert(hufdec[huf->pos].mask > 0);
 		assert(hufdec[huf->pos].mask <= 8);
@@ -838,6 +865,16 @@ test_huffman(unsigned mode)
 	CHECK_RET(r, VHD_OK);
 	AZ(match(out, sizeof out, "A", "www.example.com", NULL));
 
+	/* Decode a mix of short and long codes */
+	VHD_Init(d);
+	in_l = hexbuf(in, sizeof in,
+	    "0141 98 f2b4 f58c 9d6e 29ff dfff dff3 ffdf ffe1 ffe7 ffcf"
+	    "fb18 c00f");
+	vhd_set_state(d, VHD_S_TEST_LITERAL);
+	r = decode(d, NULL, in, in_l, out, sizeof out, mode);
+	CHECK_RET(r, VHD_OK);
+	AZ(match(out, sizeof out, "A", "x-hpack: ~{|}\\^<>aa00", NULL));
+
 	/* Decode an incomplete input buffer */
 	VHD_Init(d);
 	in_l = hexbuf(in, sizeof in,
@@ -0,0 +1,458 @@
+/*-
+ * Copyright (c) 2017 Varnish Software
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HPACK encoder (RFC 7541)
+ *
+ * The encoder keeps its own copy of the peer's dynamic table in a
+ * struct vht_table, and every function here either writes the complete
+ * representation and updates the table, or returns zero and leaves the
+ * table untouched, so running out of buffer never costs us the
+ * compression state.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "miniobj.h"
+
+#include "hpack/vhp.h"
+
+static const struct {
+	uint32_t	code;
+	uint8_t		blen;
+} vhe_huffman[256] = {
+#define HPH(c, h, l) [c] = { h, l },
+#include "tbl/vhp_huffman.h"
+};
+
+/**********************************************************************/
+
+size_t
+VHE_Integer(uint8_t *buf, size_t buflen, uint8_t flags, unsigned pfx,
+    size_t v)
+{
+	size_t l, m;
+
+	AN(buf);
+	assert(pfx >= 1 && pfx <= 8);
+	m = (1U << pfx) - 1;
+	assert((flags & m) == 0);
+
+	if (buflen < 1)
+		return (0);
+	if (v < m) {
+		buf[0] = flags | (uint8_t)v;
+		return (1);
+	}
+	buf[0] = flags | (uint8_t)m;
+	v -= m;
+	for (l = 1; v >= 0x80; l++, v >>= 7) {
+		if (l == buflen)
+			return (0);
+		buf[l] = 0x80 | (v & 0x7f);
+	}
+	if (l == buflen)
+		return (0);
+	buf[l++] = (uint8_t)v;
+	return (l);
+}
+
+/*
+ * String literal, Huffman coded if that comes out shorter.  Header
+ * names must be sent in lower case, so 'lower' folds case on the fly.
+ */
+
+size_t
+VHE_String(uint8_t *buf, size_t buflen, const char *s, size_t len, int lower)
+{
+	size_t u, l, hlen;
+	uint64_t acc;
+	unsigned n;
+	uint8_t c;
+
+	AN(buf);
+	AN(s);
+
+	hlen = 0;
+	for (u = 0; u < len; u++) {
+		c = (uint8_t)s[u];
+		if (lower)
+			c = (uint8_t)tolower(c);
+		hlen += vhe_huffman[c].blen;
+	}
+	hlen = (hlen + 7) >> 3;
+
+	if (hlen >= len) {
+		l = VHE_Integer(buf, buflen, 0x00, 7, len);
+		if (l == 0 || buflen - l < len)
+			return (0);
+		for (u = 0; u < len; u++)
+			buf[l + u] = (uint8_t)(lower ? tolower(s[u]) : s[u]);
+		return (l + len);
+	}
+
+	l = VHE_Integer(buf, buflen, 0x80, 7, hlen);
+	if (l == 0 || buflen - l < hlen)
+		return (0);
+	buf += l;
+	acc = 0;
+	n = 0;
+	for (u = 0; u < len; u++) {
+		c = (uint8_t)s[u];
+		if (lower)
+			c = (uint8_t)tolower(c);
+		/* Codes are at most 30 bits, so 'acc' never overflows */
+		acc = (acc << vhe_huffman[c].blen) | vhe_huffman[c].code;
+		n += vhe_huffman[c].blen;
+		while (n >= 8) {
+			n -= 8;
+			*buf++ = (uint8_t)(acc >> n);
+		}
+	}
+	if (n > 0)	/* Pad with the most significant bits of EOS */
+		*buf++ = (uint8_t)((acc << (8 - n)) | (0xff >> n));
+	return (l + hlen);
+}
+
+/*
+ * Dynamic table size update.  This must come first in a header block.
+ */
+
+size_t
+VHE_TableSize(struct vht_table *tbl, uint8_t *buf, size_t buflen,
+    size_t maxsize)
+{
+	size_t l;
+
+	CHECK_OBJ_NOTNULL(tbl, VHT_TABLE_MAGIC);
+	assert(maxsize <= tbl->protomax);
+	l = VHE_Integer(buf, buflen, 0x20, 5, maxsize);
+	if (l > 0)
+		AZ(VHT_SetMaxTableSize(tbl, maxsize));
+	return (l);
+}
+
+size_t
+VHE_Header(struct vht_table *tbl, uint8_t *buf, size_t buflen,
+    const char *name, size_t namelen, const char *value, size_t valuelen,
+    enum vhe_index_e mode)
+{
+	unsigned idx;
+	uint8_t flags;
+	unsigned pfx;
+	size_t l, l2;
+	int full;
+
+	CHECK_OBJ_NOTNULL(tbl, VHT_TABLE_MAGIC);
+	AN(buf);
+	AN(name);
+	AN(value);
+	assert(namelen > 0);
+
+	idx = VHT_Find(tbl, name, namelen, value, valuelen, &full);
+	if (full)
+		return (VHE_Integer(buf, buflen, 0x80, 7, idx));
+
+	/* An entry larger than the table would only flush it */
+	if (mode == VHE_INDEX &&
+	    namelen + valuelen + VHT_ENTRY_SIZE > tbl->maxsize)
+		mode = VHE_NOINDEX;
+
+	switch (mode) {
+	case VHE_INDEX:		flags = 0x40; pfx = 6; break;
+	case VHE_NOINDEX:	flags = 0x00; pfx = 4; break;
+	case VHE_NEVER:		flags = 0x10; pfx = 4; break;
+	default:
+		WRONG("Wrong vhe_index_e");
+	}
+
+	l = VHE_Integer(buf, buflen, flags, pfx, idx);
+	if (l == 0)
+		return (0);
+	if (idx == 0) {
+		l2 = VHE_String(buf + l, buflen - l, name, namelen, 1);
+		if (l2 == 0)
+			return (0);
+		l += l2;
+	}
+	l2 = VHE_String(buf + l, buflen - l, value, valuelen, 0);
+	if (l2 == 0)
+		return (0);
+	l += l2;
+
+	if (mode == VHE_INDEX) {
+		VHT_NewEntry(tbl);
+		VHT_AppendName(tbl, name, namelen);
+		VHT_AppendValue(tbl, value, valuelen);
+	}
+	return (l);
+}
+
+/**********************************************************************/
+
+#ifdef ENCODE_TEST_DRIVER
+
+#include <stdarg.h>
+#include <strings.h>
+
+static int verbose = 0;
+
+static size_t
+hexbuf(uint8_t *buf, size_t buflen, const char *h)
+{
+	size_t l;
+	uint8_t u;
+
+	AN(h);
+	AN(buf);
+
+	l = 0;
+	for (; *h != '\0'; h++) {
+		if (l == buflen * 2)
+			WRONG("Too small buffer");
+		if (isspace(*h))
+			continue;
+		if (*h >= '0' && *h <= '9')
+			u = *h - '0';
+		else if (*h >= 'a' && *h <= 'f')
+			u = 0xa + *h - 'a';
+		else
+			WRONG("Bad input character");
+		if (l % 2 == 0)
+			buf[l / 2] = u << 4;
+		else
+			buf[l / 2] |= u;
+		l++;
+	}
+	AZ(l % 2);
+	return (l / 2);
+}
+
+static int
+cmpbuf(const uint8_t *a, size_t al, const uint8_t *b, size_t bl)
+{
+	size_t u;
+
+	if (verbose || al != bl || memcmp(a, b, al)) {
+		for (u = 0; u < al; u++)
+			printf("%02x", a[u]);
+		printf(" %s ", al == bl && !memcmp(a, b, al) ? "==" : "!=");
+		for (u = 0; u < bl; u++)
+			printf("%02x", b[u]);
+		printf("\n");
+	}
+	return (al != bl || memcmp(a, b, al));
+}
+
+/*
+ * Encode a header list of name/value pairs, check it against the
+ * expected wire format, and decode it again with a second table.
+ */
+
+static void
+encode(struct vht_table *enc, struct vht_table *dec, const char *hex, ...)
+{
+	struct vhd_decode d[1];
+	uint8_t buf[512], exp[512];
+	char out[512];
+	size_t l, u, w, in_u, out_u;
+	unsigned tn, ts;
+	const char *n, *v;
+	enum vhd_ret_e r;
+	va_list ap;
+
+	l = 0;
+	va_start(ap, hex);
+	while ((n = va_arg(ap, const char *)) != NULL) {
+		v = va_arg(ap, const char *);
+		AN(v);
+		/* No room must mean no harm to the table */
+		tn = enc->n;
+		ts = enc->size;
+		for (u = 0; u < sizeof buf - l; u++) {
+			w = VHE_Header(enc, buf + l, u, n, strlen(n),
+			    v, strlen(v), VHE_INDEX);
+			if (w > 0)
+				break;
+			assert(enc->n == tn);
+			assert(enc->size == ts);
+		}
+		assert(w == u);
+		l += u;
+	}
+	va_end(ap);
+	AZ(cmpbuf(buf, l, exp, hexbuf(exp, sizeof exp, hex)));
+
+	VHD_Init(d);
+	in_u = 0;
+	out_u = 0;
+	va_start(ap, hex);
+	while ((n = va_arg(ap, const char *)) != NULL) {
+		v = va_arg(ap, const char *);
+		r = VHD_Decode(d, dec, buf, l, &in_u, out, sizeof out, &out_u);
+		assert(r == VHD_NAME);
+		assert(out_u == strlen(n));
+		AZ(strncasecmp(out, n, out_u));
+		out_u = 0;
+		r = VHD_Decode(d, dec, buf, l, &in_u, out, sizeof out, &out_u);
+		assert(r == VHD_VALUE);
+		assert(out_u == strlen(v));
+		AZ(memcmp(out, v, out_u));
+		out_u = 0;
+	}
+	va_end(ap);
+	assert(in_u == l);
+
+	/* Both sides must agree on the dynamic table */
+	assert(enc->n == dec->n);
+	assert(enc->size == dec->size);
+	assert(enc->maxsize == dec->maxsize);
+}
+
+static void
+test_integer(void)
+{
+	uint8_t buf[8], exp[8];
+
+	/* RFC 7541 C.1 */
+	assert(VHE_Integer(buf, sizeof buf, 0x00, 5, 10) == 1);
+	AZ(cmpbuf(buf, 1, exp, hexbuf(exp, sizeof exp, "0a")));
+	assert(VHE_Integer(buf, sizeof buf, 0xe0, 5, 1337) == 3);
+	AZ(cmpbuf(buf, 3, exp, hexbuf(exp, sizeof exp, "ff9a0a")));
+	assert(VHE_Integer(buf, sizeof buf, 0x00, 8, 42) == 1);
+	AZ(cmpbuf(buf, 1, exp, hexbuf(exp, sizeof exp, "2a")));
+	AZ(VHE_Integer(buf, 2, 0x00, 5, 1337));
+	AZ(VHE_Integer(buf, 0, 0x00, 5, 1));
+}
+
+static void
+test_c6(void)
+{
+	struct vht_table enc[1], dec[1];
+
+	/* See RFC 7541 Appendix C.6, except that "307" is sent as-is,
+	   since Huffman coding does not make it any shorter. */
+
+	AZ(VHT_Init(enc, 256));
+	AZ(VHT_Init(dec, 256));
+
+	encode(enc, dec,
+	    "4882 6402 5885 aec3 771a 4b61 96d0 7abe"
+	    "9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+	    "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8"
+	    "e9ae 82ae 43d3",
+	    ":status", "302",
+	    "Cache-Control", "private",
+	    "date", "Mon, 21 Oct 2013 20:13:21 GMT",
+	    "location", "https://www.example.com",
+	    NULL);
+
+	encode(enc, dec,
+	    "4803 3330 37c1 c0bf",
+	    ":status", "307",
+	    "cache-control", "private",
+	    "date", "Mon, 21 Oct 2013 20:13:21 GMT",
+	    "location", "https://www.example.com",
+	    NULL);
+
+	encode(enc, dec,
+	    "88c1 6196 d07a be94 1054 d444 a820 0595"
+	    "040b 8166 e084 a62d 1bff c05a 839b d9ab"
+	    "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+	    "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+	    "9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+	    ":status", "200",
+	    "cache-control", "private",
+	    "date", "Mon, 21 Oct 2013 20:13:22 GMT",
+	    "location", "https://www.example.com",
+	    "content-encoding", "gzip",
+	    "set-cookie",
+	    "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1",
+	    NULL);
+
+	VHT_Fini(enc);
+	VHT_Fini(dec);
+}
+
+static void
+test_tablesize(void)
+{
+	struct vht_table enc[1], dec[1];
+	struct vhd_decode d[1];
+	uint8_t buf[64];
+	char out[64];
+	size_t l, in_u, out_u;
+
+	AZ(VHT_Init(enc, 4096));
+	AZ(VHT_Init(dec, 4096));
+
+	encode(enc, dec, "4089 f2b2 0b67 72c8 b47e bf89 ee3b 2a32 2758 8324 e5",
+	    "x-served-by", "varnish-cache",
+	    NULL);
+	encode(enc, dec, "be",
+	    "x-served-by", "varnish-cache",
+	    NULL);
+
+	/* Shrinking the table to nothing evicts everything */
+	l = VHE_TableSize(enc, buf, sizeof buf, 0);
+	assert(l == 1);
+	AZ(enc->n);
+	VHD_Init(d);
+	in_u = out_u = 0;
+	assert(VHD_Decode(d, dec, buf, l, &in_u, out, sizeof out, &out_u) ==
+	    VHD_OK);
+	AZ(dec->n);
+
+	/* ...and then nothing gets indexed */
+	encode(enc, dec, "0089 f2b2 0b67 72c8 b47e bf89 ee3b 2a32 2758 8324 e5",
+	    "x-served-by", "varnish-cache",
+	    NULL);
+
+	VHT_Fini(enc);
+	VHT_Fini(dec);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc == 2 && !strcmp(argv[1], "-v"))
+		verbose = 1;
+	else if (argc != 1) {
+		fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+		return (1);
+	}
+
+	test_integer();
+	test_c6();
+	test_tablesize();
+	printf("OK\n");
+	return (0);
+}
+
+#endif	/* ENCODE_TEST_DRIVER */
@@ -36,6 +36,15 @@
 #include "vdef.h"
 #include "vas.h"
 
+/*
+ * The fast table is indexed by the next HUFFAST_BITS bits of input and
+ * yields every complete code in that window, so that the common short
+ * codes are decoded several at a time.  Windows starting with a code
+ * longer than HUFFAST_BITS fall through to the hufdec[] tables.
+ */
+#define HUFFAST_BITS	12
+#define HUFFAST_NSYM	(HUFFAST_BITS / 5)	/* Shortest code is 5 bits */
+
 static unsigned minlen = UINT_MAX;
 static unsigned maxlen = 0;
 static unsigned idx = 0;
@@ -210,6 +219,49 @@ tbl_print(const struct tbl *tbl)
 			tbl_print(tbl->e[u].next);
 }
 
+static void
+fast_print(void)
+{
+	unsigned u, v, o, n;
+	char chr[HUFFAST_NSYM];
+
+	assert(minlen * HUFFAST_NSYM <= HUFFAST_BITS);
+	assert(minlen * (HUFFAST_NSYM + 1) > HUFFAST_BITS);
+
+	printf("#define HUFFAST_BITS %u\n", HUFFAST_BITS);
+	printf("#define HUFFAST_NSYM %u\n\n", HUFFAST_NSYM);
+
+	printf("static const struct {\n");
+	printf("\tuint8_t\tlen;\n");
+	printf("\tuint8_t\tn;\n");
+	printf("\tchar\tchr[HUFFAST_NSYM];\n");
+	printf("} huffast[1U << HUFFAST_BITS] = {\n");
+	for (u = 0; u < (1U << HUFFAST_BITS); u++) {
+		o = 0;
+		n = 0;
+		while (n < HUFFAST_NSYM) {
+			for (v = 0; v < HUF_LEN; v++) {
+				if (o + huf[v].blen > HUFFAST_BITS)
+					continue;
+				if (((u >> (HUFFAST_BITS - o - huf[v].blen)) &
+				    ((1U << huf[v].blen) - 1)) == huf[v].code)
+					break;
+			}
+			if (v == HUF_LEN)
+				break;
+			chr[n++] = huf[v].chr;
+			o += huf[v].blen;
+		}
+		printf("/* ");
+		print_lsb(u, HUFFAST_BITS);
+		printf(" */ { %2u, %u, {", o, n);
+		for (v = 0; v < HUFFAST_NSYM; v++)
+			printf(" (char)0x%02x,", v < n ? (uint8_t)chr[v] : 0);
+		printf(" } },\n");
+	}
+	printf("};\n");
+}
+
 int
 main(int argc, const char **argv)
 {
@@ -248,7 +300,9 @@ main(int argc, const char **argv)
 	printf("\tchar\tchr;\n");
 	printf("} hufdec[HUFDEC_LEN] = {\n");
 	tbl_print(top);
-	printf("};\n");
+	printf("};\n\n");
+
+	fast_print();
 
 	return (0);
 }
@@ -50,6 +50,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
 #include <limits.h>
 
@@ -452,6 +453,56 @@ VHT_LookupValue(const struct vht_table *tbl, unsigned idx, size_t *plen)
 	return (tbl->buf + e->offset + e->namelen);
 }
 
+/*
+ * Find the best index for a header, for the encoder.  Returns 0 if
+ * neither the name nor the pair is in the tables, and sets *pfull if
+ * the returned index matches the value too.  Names are compared case
+ * insensitively, since the tables only hold lower case names.
+ */
+
+unsigned
+VHT_Find(const struct vht_table *tbl, const char *name, size_t namelen,
+    const char *value, size_t valuelen, int *pfull)
+{
+	const struct vht_entry *e;
+	unsigned u, idx;
+
+	CHECK_OBJ_NOTNULL(tbl, VHT_TABLE_MAGIC);
+	AN(name);
+	AN(pfull);
+	*pfull = 0;
+	idx = 0;
+
+	for (u = 0; u < VHT_STATIC_MAX; u++) {
+		if (static_table[u].namelen != namelen ||
+		    strncasecmp(static_table[u].name, name, namelen))
+			continue;
+		if (static_table[u].valuelen == valuelen &&
+		    !memcmp(static_table[u].value, value, valuelen)) {
+			*pfull = 1;
+			return (u + 1);
+		}
+		if (idx == 0)
+			idx = u + 1;
+	}
+
+	for (u = 0; u < tbl->n; u++) {
+		e = TBLENTRY(tbl, u);
+		CHECK_OBJ_NOTNULL(e, VHT_ENTRY_MAGIC);
+		if (e->namelen != namelen ||
+		    strncasecmp(tbl->buf + e->offset, name, namelen))
+			continue;
+		if (e->valuelen == valuelen && !memcmp(tbl->buf +
+		    e->offset + e->namelen, value, valuelen)) {
+			*pfull = 1;
+			return (u + VHT_STATIC_MAX + 1);
+		}
+		if (idx == 0)
+			idx = u + VHT_STATIC_MAX + 1;
+	}
+	return (idx);
+}
+
 int
 VHT_Init(struct vht_table *tbl, size_t protomax)
 {
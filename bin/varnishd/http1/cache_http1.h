@@ -40,6 +40,8 @@ extern const int HTTP1_Resp[3];
 
 /* cache_http1_deliver.c */
 void V1D_Deliver(struct req *, struct boc *, int sendbody);
+void V1D_Park(struct worker *, struct req *);
+int V1D_DeliverStatic(struct req *, const char *hdr, unsigned len);
 
 /* cache_http1_pipe.c */
 struct v1p_acct {
@@ -59,4 +61,9 @@ void V1L_Reserve(struct worker *, struct ws *, int *fd, struct vsl_log *,
     double t0);
 unsigned V1L_Flush(const struct worker *w);
 unsigned V1L_FlushRelease(struct worker *w);
+void V1L_Cork(const struct worker *w);
+int V1L_CorkFd(int fd, int on);
 size_t V1L_Write(const struct worker *w, const void *ptr, ssize_t len);
+#if defined(HAVE_SYS_SENDFILE_H)
+size_t V1L_SendFile(const struct worker *w, int fd, off_t off, ssize_t len);
+#endif
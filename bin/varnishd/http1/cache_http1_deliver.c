@@ -29,10 +29,21 @@
 
 #include "config.h"
 
+#if defined(HAVE_SYS_SENDFILE_H)
+#  include <sys/sendfile.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+
 #include "cache/cache.h"
 #include "cache/cache_filter.h"
+#include "cache/cache_pool.h"
 #include "cache_http1.h"
 
+#include "vtcp.h"
+#include "vtim.h"
+
 /*--------------------------------------------------------------------*/
 
 static int __match_proto__(vdp_bytes)
@@ -58,6 +69,39 @@ v1d_bytes(struct req *req, enum vdp_action act, void **priv,
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Bottom of the pile for unprocessed, unchunked bodies: storage which
+ * the stevedore mapped from a file goes out with sendfile(2), without
+ * faulting in and copying the pages through userland.
+ */
+
+#if defined(HAVE_SYS_SENDFILE_H)
+
+static int __match_proto__(vdp_bytes)
+v1d_sendfile(struct req *req, enum vdp_action act, void **priv,
+    const void *ptr, ssize_t len)
+{
+	ssize_t wl = 0;
+	off_t off;
+	int fd;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	if (act == VDP_INIT || act == VDP_FINI)
+		return (0);
+	if (len == 0 || !STV_FileRange(ptr, len, &fd, &off))
+		return (v1d_bytes(req, act, priv, ptr, len));
+
+	AZ(req->vdp_nxt);		/* always at the bottom of the pile */
+
+	wl = V1L_SendFile(req->wrk, fd, off, len);
+	req->acct.resp_bodybytes += len;
+	if (len != wl)
+		return (-1);
+	return (0);
+}
+
+#endif
+
 static void
 v1d_error(struct req *req, const char *msg)
 {
@@ -75,15 +119,155 @@ v1d_error(struct req *req, const char *msg)
 	req->doclose = SC_TX_EOF;
 }
 
+/*--------------------------------------------------------------------
+ * Parking a delivery
+ *
+ * A complete object which goes out as stored can be sent on from any
+ * offset.  Rather than wait in write(2) for a slow client, we write to
+ * the socket without blocking for as long as it takes data, and then
+ * park on the waiter until it takes more.  The request continues at
+ * STP_TRANSMIT on whatever thread is available, and we send the rest.
+ * The struct waited lives on the workspace, in req->transport_priv.
+ */
+
+static int __match_proto__(objiterate_f)
+v1d_park_bytes(void *priv, int flush, const void *ptr, ssize_t len)
+{
+	struct req *req;
+	const char *p = ptr;
+	ssize_t i;
+#if defined(HAVE_SYS_SENDFILE_H)
+	off_t off;
+	int fd;
+#endif
+
+	CAST_OBJ_NOTNULL(req, priv, REQ_MAGIC);
+	(void)flush;
+	while (len > 0) {
+#if defined(HAVE_SYS_SENDFILE_H)
+		if (STV_FileRange(p, len, &fd, &off))
+			i = sendfile(req->sp->fd, fd, &off, len);
+		else
+#endif
+			i = write(req->sp->fd, p, len);
+		if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return (1);
+		if (i <= 0) {
+			VSLb(req->vsl, SLT_Debug,
+			    "Write error, retval = %zd, len = %zd, errno = %s",
+			    i, len, strerror(errno));
+			return (-1);
+		}
+		req->acct.resp_bodybytes += i;
+		p += i;
+		len -= i;
+	}
+	return (0);
+}
+
+static void
+v1d_park_body(struct req *req)
+{
+	int r = -1;
+
+	if (req->sp->fd >= 0 && !VTCP_nonblocking(req->sp->fd))
+		r = ObjIterateFrom(req->wrk, req->objcore,
+		    req->acct.resp_bodybytes, req, v1d_park_bytes, 0);
+	if (r > 0) {
+		req->deliver_parked = 1;
+		return;
+	}
+	req->deliver_parked = 0;
+	req->transport_priv = NULL;
+	if (req->sp->fd >= 0 && (r < 0 || VTCP_blocking(req->sp->fd)))
+		SES_Close(req->sp, SC_REM_CLOSE);
+}
+
+static void
+v1d_unparked(struct req *req)
+{
+	struct waited *wp;
+
+	CAST_OBJ_NOTNULL(wp, req->transport_priv, WAITED_MAGIC);
+	if (wp->priv2 == WAITER_TIMEOUT) {
+		VSLb(req->vsl, SLT_Debug,
+		    "Hit idle send timeout, wrote = %ju/%jd; not retrying",
+		    (uintmax_t)req->acct.resp_bodybytes,
+		    (intmax_t)req->resp_len);
+		wp->priv2 = WAITER_REMCLOSE;
+	} else if (VTIM_real_coarse() - req->t_prev >
+	    cache_param->send_timeout) {
+		VSLb(req->vsl, SLT_Debug,
+		    "Hit total send timeout, wrote = %ju/%jd; not retrying",
+		    (uintmax_t)req->acct.resp_bodybytes,
+		    (intmax_t)req->resp_len);
+		wp->priv2 = WAITER_REMCLOSE;
+	}
+	if (wp->priv2 == WAITER_ACTION) {
+		v1d_park_body(req);
+		return;
+	}
+	req->deliver_parked = 0;
+	req->transport_priv = NULL;
+	if (req->sp->fd >= 0)
+		SES_Close(req->sp, SC_REM_CLOSE);
+}
+
+static void __match_proto__(waiter_handle_f)
+v1d_unpark(struct waited *wp, enum wait_event ev, double now)
+{
+	struct req *req;
+
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	CAST_OBJ_NOTNULL(req, wp->priv1, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(req->sp, SESS_MAGIC);
+	(void)now;
+	assert(req->transport_priv == wp);
+	AN(req->deliver_parked);
+	wp->priv2 = ev;
+	/* Like a parked fetch, this is work under way, not to be dropped */
+	AZ(Pool_Task(req->sp->pool, &req->task, TASK_QUEUE_BO));
+}
+
+void
+V1D_Park(struct worker *wrk, struct req *req)
+{
+	struct waited *wp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CAST_OBJ_NOTNULL(wp, req->transport_priv, WAITED_MAGIC);
+	AN(req->deliver_parked);
+	AN(req->task.func);
+
+	wrk->stats->deliver_parked++;
+	wp->fd = req->sp->fd;
+	wp->priv1 = req;
+	wp->priv2 = 0;
+	wp->func = v1d_unpark;
+	wp->tmo = &cache_param->idle_send_timeout;
+	wp->idle = VTIM_real_coarse();
+	wp->want_write = 1;
+	req->wrk = NULL;
+	if (Wait_Enter(wrk->pool->waiter, wp))
+		v1d_unpark(wp, WAITER_ACTION, 0.);
+}
+
 /*--------------------------------------------------------------------
  */
 
 void __match_proto__(vtr_deliver_f)
 V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 {
+	struct waited *wp = NULL;
 	int err = 0;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	if (req->deliver_parked) {
+		AZ(boc);
+		v1d_unparked(req);
+		return;
+	}
 	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
 	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
 
@@ -111,8 +295,24 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 	} else if (!http_GetHdr(req->resp, H_Connection, NULL))
 		http_SetHeader(req->resp, "Connection: keep-alive");
 
-	if (sendbody && req->resp_len != 0)
-		VDP_push(req, v1d_bytes, NULL, 1, "V1B");
+	if (sendbody && req->resp_len != 0 && cache_param->deliver_park &&
+	    boc == NULL && req->esi_level == 0 && VTAILQ_EMPTY(&req->vdp) &&
+	    (req->res_mode & RES_LEN)) {
+		wp = WS_Alloc(req->ws, sizeof *wp);
+		if (wp != NULL) {
+			INIT_OBJ(wp, WAITED_MAGIC);
+			req->transport_priv = wp;
+		}
+	}
+
+	if (sendbody && req->resp_len != 0 && wp == NULL) {
+#if defined(HAVE_SYS_SENDFILE_H)
+		if (VTAILQ_EMPTY(&req->vdp) && !(req->res_mode & RES_CHUNKED))
+			VDP_push(req, v1d_sendfile, NULL, 1, "V1S");
+		else
+#endif
+			VDP_push(req, v1d_bytes, NULL, 1, "V1B");
+	}
 
 	AZ(req->wrk->v1l);
 	V1L_Reserve(req->wrk, req->ws, &req->sp->fd, req->vsl, req->t_prev);
@@ -120,14 +320,27 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 	if (WS_Overflowed(req->ws)) {
 		v1d_error(req, "workspace_client overflow");
 		AZ(req->wrk->v1l);
+		req->transport_priv = NULL;
 		return;
 	}
 
+	/*
+	 * If the next request is already here, cork the connection until
+	 * HTTP1_Session() runs out of pipelined requests.
+	 */
+	if (FEATURE(FEATURE_PIPELINE_CORK) && !req->htc->corked &&
+	    !req->doclose && req->htc->pipeline_b != NULL)
+		req->htc->corked = V1L_CorkFd(req->sp->fd, 1);
+
+	if (FEATURE(FEATURE_TCP_CORK) && sendbody && !req->htc->corked &&
+	    (req->res_mode & (RES_CHUNKED | RES_ESI)))
+		V1L_Cork(req->wrk);
+
 	req->acct.resp_hdrbytes += HTTP1_Write(req->wrk, req->resp, HTTP1_Resp);
 	if (DO_DEBUG(DBG_FLUSH_HEAD))
 		(void)V1L_Flush(req->wrk);
 
-	if (sendbody && req->resp_len != 0) {
+	if (sendbody && req->resp_len != 0 && wp == NULL) {
 		if (req->res_mode & RES_CHUNKED)
 			V1L_Chunked(req->wrk);
 		err = VDP_DeliverObj(req);
@@ -135,8 +348,93 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 			V1L_EndChunk(req->wrk);
 	}
 
+	if ((V1L_FlushRelease(req->wrk) || err) && req->sp->fd >= 0)
+		SES_Close(req->sp, SC_REM_CLOSE);
+	AZ(req->wrk->v1l);
+	if (wp != NULL)
+		v1d_park_body(req);
+	VDP_close(req);
+}
+
+/*--------------------------------------------------------------------
+ * Deliver a cache hit on an object with a ready made header block from
+ * HTTP_EncodeStatic(), only adding the headers which vary per request.
+ * The caller has checked that the response is a plain 200 with a body
+ * of known length.
+ */
+
+int __match_proto__(vtr_deliver_static_f)
+V1D_DeliverStatic(struct req *req, const char *hdr, unsigned len)
+{
+	char buf[256];
+	const char *p, *q;
+	int l, err = 0;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
+	AZ(req->objcore->boc);
+	AN(hdr);
+	assert(len > 13 && !memcmp(hdr, "HTTP/1.1 200 ", 13));
+
+	if (req->sp->fd < 0 || WS_Overflowed(req->ws))
+		return (-1);
+
+	req->res_mode = RES_LEN;
+	req->resp_len = ObjGetLen(req->wrk, req->objcore);
+
+	l = snprintf(buf, sizeof buf,
+	    "X-Varnish: %u %u\r\n"
+	    "Age: %.0f\r\n"
+	    "Via: 1.1 varnish (Varnish/5.0)\r\n"
+	    "%s"
+	    "Content-Length: %jd\r\n"
+	    "Connection: keep-alive\r\n\r\n",
+	    VXID(req->vsl->wid), ObjGetXID(req->wrk, req->objcore),
+	    fmax(0., req->t_prev - req->objcore->t_origin),
+	    cache_param->http_range_support ? "Accept-Ranges: bytes\r\n" : "",
+	    (intmax_t)req->resp_len);
+	assert(l > 0 && l < sizeof buf);
+
+	VSLb(req->vsl, SLT_RespProtocol, "HTTP/1.1");
+	VSLb(req->vsl, SLT_RespStatus, "200");
+	p = memchr(hdr, '\r', len);
+	AN(p);
+	VSLb(req->vsl, SLT_RespReason, "%.*s", (int)(p - (hdr + 13)),
+	    hdr + 13);
+	for (p = buf; (q = strchr(p, '\r')) != NULL && q > p; p = q + 2)
+		VSLb(req->vsl, SLT_RespHeader, "%.*s", (int)(q - p), p);
+
+	if (req->resp_len != 0) {
+#if defined(HAVE_SYS_SENDFILE_H)
+		VDP_push(req, v1d_sendfile, NULL, 1, "V1S");
+#else
+		VDP_push(req, v1d_bytes, NULL, 1, "V1B");
+#endif
+	}
+
+	AZ(req->wrk->v1l);
+	V1L_Reserve(req->wrk, req->ws, &req->sp->fd, req->vsl, req->t_prev);
+	if (req->wrk->v1l == NULL) {
+		v1d_error(req, "workspace_client overflow");
+		VDP_close(req);
+		return (0);
+	}
+
+	if (FEATURE(FEATURE_PIPELINE_CORK) && !req->htc->corked &&
+	    req->htc->pipeline_b != NULL)
+		req->htc->corked = V1L_CorkFd(req->sp->fd, 1);
+
+	req->acct.resp_hdrbytes += V1L_Write(req->wrk, hdr, len);
+	req->acct.resp_hdrbytes += V1L_Write(req->wrk, buf, l);
+	if (DO_DEBUG(DBG_FLUSH_HEAD))
+		(void)V1L_Flush(req->wrk);
+
+	if (req->resp_len != 0)
+		err = VDP_DeliverObj(req);
+
 	if ((V1L_FlushRelease(req->wrk) || err) && req->sp->fd >= 0)
 		SES_Close(req->sp, SC_REM_CLOSE);
 	AZ(req->wrk->v1l);
 	VDP_close(req);
+	return (0);
 }
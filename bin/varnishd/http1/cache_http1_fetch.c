@@ -95,6 +95,13 @@ V1F_SendReq(struct worker *wrk, struct busyobj *bo, uint64_t *ctr,
 	    bo->req->req_body_status == REQ_BODY_WITHOUT_LEN) {
 		http_PrintfHeader(hp, "Transfer-Encoding: chunked");
 		do_chunked = 1;
+	} else if (bo->req != NULL && bo->req->req_body_tee > 0 &&
+	    bo->req->req_body_status == REQ_BODY_CACHED &&
+	    !http_GetHdr(hp, H_Content_Length, NULL)) {
+		/* Kept by VRB_Tee(), was sent chunked the first time */
+		http_Unset(hp, H_Transfer_Encoding);
+		http_PrintfHeader(hp, "Content-Length: %jd",
+		    (intmax_t)bo->req->req_bodybytes);
 	}
 
 	VTCP_hisname(*htc->rfd, abuf, sizeof abuf, pbuf, sizeof pbuf);
@@ -206,6 +206,7 @@ struct transport HTTP1_transport = {
 	.name =			"HTTP/1",
 	.magic =		TRANSPORT_MAGIC,
 	.deliver =		V1D_Deliver,
+	.deliver_static =	V1D_DeliverStatic,
 	.unwait =		http1_unwait,
 	.req_body =		http1_req_body,
 	.req_fail =		http1_req_fail,
@@ -241,6 +242,7 @@ http1_dissect(struct worker *wrk, struct req *req)
 	req->t_prev = req->t_first;
 	VSLb_ts_req(req, "Start", req->t_first);
 	VSLb_ts_req(req, "Req", req->t_req);
+	VSL_Trace(req->vsl, req->ws, req->sp->vxid, NULL, req->t_first);
 
 	/* Borrow VCL reference from worker thread */
 	VCL_Refresh(&wrk->vcl);
@@ -323,6 +325,21 @@ http1_dissect(struct worker *wrk, struct req *req)
 	return (0);
 }
 
+/*----------------------------------------------------------------------
+ * Is there a complete request in the receive buffer already?
+ */
+
+static int
+http1_pipelined(struct http_conn *htc)
+{
+
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	if (htc->rxbuf_e == htc->rxbuf_b || htc->rxbuf_e == htc->ws->r)
+		return (0);
+	*htc->rxbuf_e = '\0';
+	return (HTTP1_Complete(htc) == HTC_S_COMPLETE);
+}
+
 /*----------------------------------------------------------------------
  */
 
@@ -330,6 +347,7 @@ void
 HTTP1_Session(struct worker *wrk, struct req *req)
 {
 	enum htc_status_e hs;
+	enum req_fsm_nxt nxt;
 	struct sess *sp;
 	const char *st;
 	int i;
@@ -409,6 +427,9 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 				    "H2 Prior Knowledge Upgrade");
 				http1_setstate(sp, NULL);
 				req->err_code = 1;
+				if (req->htc->corked)
+					req->htc->corked =
+					    V1L_CorkFd(sp->fd, 0);
 				SES_SetTransport(wrk, sp, req, &H2_transport);
 				return;
 			}
@@ -434,6 +455,9 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 					    "H2 Upgrade");
 					http1_setstate(sp, NULL);
 					req->err_code = 2;
+					if (req->htc->corked)
+						req->htc->corked =
+						    V1L_CorkFd(sp->fd, 0);
 					SES_SetTransport(wrk, sp, req,
 					    &H2_transport);
 					return;
@@ -447,6 +471,9 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 			 * Check to see if the remote has left.
 			 */
 			if (VTCP_check_hup(sp->fd)) {
+				if (req->hash_oc != NULL)
+					(void)HSH_DerefObjCore(wrk,
+					    &req->hash_oc, 0);
 				AN(req->hash_objhead);
 				(void)HSH_DerefObjHead(wrk,
 				    &req->hash_objhead);
@@ -460,7 +487,10 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 			req->transport = &HTTP1_transport;
 			req->task.func = http1_req;
 			req->task.priv = req;
-			if (CNT_Request(wrk, req) == REQ_FSM_DISEMBARK)
+			nxt = CNT_Request(wrk, req);
+			if (nxt == REQ_FSM_PARK)
+				V1D_Park(wrk, req);
+			if (nxt == REQ_FSM_DISEMBARK || nxt == REQ_FSM_PARK)
 				return;
 			req->transport = NULL;
 			req->task.func = NULL;
@@ -472,6 +502,8 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 			HTC_RxInit(req->htc, req->ws);
 			if (req->htc->rxbuf_e != req->htc->rxbuf_b)
 				wrk->stats->sess_readahead++;
+			if (req->htc->corked && !http1_pipelined(req->htc))
+				req->htc->corked = V1L_CorkFd(sp->fd, 0);
 			http1_setstate(sp, H1NEWREQ);
 		} else {
 			WRONG("Wrong H1 session state");
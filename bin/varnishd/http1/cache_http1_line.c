@@ -30,15 +30,42 @@
  * We try to use writev() if possible in order to minimize number of
  * syscalls made and packets sent.  It also just might allow the worker
  * thread to complete the request without holding stuff locked.
+ *
+ * With the io_uring_send feature, the writes go through a per-thread
+ * io_uring(7) instead, with a linked timeout standing in for the socket
+ * send timeout, and large writes use IORING_OP_SENDMSG_ZC to avoid
+ * copying the body into the kernel.  The caller may reuse the buffers
+ * as soon as V1L_Flush() returns, so we still wait for the send to
+ * complete, and for a zero-copy send also for the kernel to release the
+ * pages.
+ *
+ * Responses which are written in many small pieces, chunked or ESI, can
+ * be corked, so that the kernel holds back partial segments until the
+ * response is complete and V1L_FlushRelease() pulls the cork.
+ *
+ * Small writes to chunked output are copied into a staging buffer taken
+ * from the end of the iovec reservation, so that they share one iovec
+ * and the chunks only get cut when it is full, at http_chunk_min bytes,
+ * or when the caller flushes.
  */
 
 #include "config.h"
 
+#if defined(HAVE_SYS_SENDFILE_H)
+#  include <sys/sendfile.h>
+#endif
+#include <sys/socket.h>
 #include <sys/uio.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
 #include "cache/cache.h"
+#include "cache/cache_uring.h"
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "cache_http1.h"
 #include "vtim.h"
@@ -48,14 +75,17 @@
 struct v1l {
 	unsigned		magic;
 #define V1L_MAGIC		0x2f2142e5
+	unsigned		ssz;	/* Chunked staging buffer size */
 	int			*wfd;
 	unsigned		werr;	/* valid after V1L_Flush() */
+	int			corked;
 	struct iovec		*iov;
 	unsigned		siov;
 	unsigned		niov;
 	ssize_t			liov;
 	ssize_t			cliov;
 	unsigned		ciov;	/* Chunked header marker */
+	unsigned		sused;
 	double			t0;
 	struct vsl_log		*vsl;
 	ssize_t			cnt;	/* Flushed byte count */
@@ -63,6 +93,18 @@ struct v1l {
 	uintptr_t		res;
 };
 
+/* Fewest iovecs left after taking the chunked staging buffer */
+#define V1L_MIN_IOV		16
+
+/* The staging buffer is what V1L_Chunked() took off the end of iov */
+#define V1L_SBUF(v1l)		((char *)((v1l)->iov + (v1l)->siov))
+
+#if defined(TCP_CORK)
+#  define V1L_CORK	TCP_CORK
+#elif defined(TCP_NOPUSH)
+#  define V1L_CORK	TCP_NOPUSH
+#endif
+
 /*--------------------------------------------------------------------
  */
 
@@ -119,11 +161,61 @@ V1L_FlushRelease(struct worker *wrk)
 	v1l = wrk->v1l;
 	wrk->v1l = NULL;
 	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+#if defined(V1L_CORK)
+	if (v1l->corked && *v1l->wfd >= 0) {
+		v1l->corked = 0;
+		(void)setsockopt(*v1l->wfd, IPPROTO_TCP, V1L_CORK,
+		    &v1l->corked, sizeof v1l->corked);
+	}
+#endif
 	WS_Release(v1l->ws, 0);
 	WS_Reset(v1l->ws, v1l->res);
 	return (u);
 }
 
+/*--------------------------------------------------------------------
+ * Cork the connection until V1L_FlushRelease()
+ */
+
+void
+V1L_Cork(const struct worker *wrk)
+{
+	struct v1l *v1l;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	v1l = wrk->v1l;
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(v1l->wfd);
+#if defined(V1L_CORK)
+	if (v1l->corked || *v1l->wfd < 0)
+		return;
+	v1l->corked = 1;
+	if (setsockopt(*v1l->wfd, IPPROTO_TCP, V1L_CORK,
+	    &v1l->corked, sizeof v1l->corked))
+		v1l->corked = 0;
+#endif
+}
+
+/*--------------------------------------------------------------------
+ * Cork or uncork a connection across several responses, returns the
+ * new state.  Used for a batch of pipelined requests, so that their
+ * responses leave in as few segments as possible.
+ */
+
+int
+V1L_CorkFd(int fd, int on)
+{
+
+#if defined(V1L_CORK)
+	if (fd >= 0 &&
+	    setsockopt(fd, IPPROTO_TCP, V1L_CORK, &on, sizeof on) == 0)
+		return (on);
+#else
+	(void)fd;
+#endif
+	return (0);
+}
+
 static void
 v1l_prune(struct v1l *v1l, ssize_t bytes)
 {
@@ -148,6 +240,217 @@ v1l_prune(struct v1l *v1l, ssize_t bytes)
 	AZ(v1l->liov);
 }
 
+/*--------------------------------------------------------------------
+ * io_uring delivery
+ */
+
+#if defined(HAVE_IO_URING)
+
+#define V1L_URING_ENTRIES	4
+#define V1L_ZC_MIN		(64 * 1024)
+
+#define V1L_UD_SEND		1
+#define V1L_UD_TIMEOUT		2
+
+static pthread_once_t v1l_uring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t v1l_uring_key;
+static volatile int v1l_uring_broken;
+static volatile int v1l_zc_broken;
+
+static void
+v1l_uring_free(void *priv)
+{
+	struct vur *vur;
+
+	CAST_OBJ_NOTNULL(vur, priv, VUR_MAGIC);
+	VUR_Fini(vur);
+	free(vur);
+}
+
+static void
+v1l_uring_key_init(void)
+{
+
+	AZ(pthread_key_create(&v1l_uring_key, v1l_uring_free));
+}
+
+static struct vur *
+v1l_uring_get(void)
+{
+	struct vur *vur;
+
+	AZ(pthread_once(&v1l_uring_once, v1l_uring_key_init));
+	vur = pthread_getspecific(v1l_uring_key);
+	if (vur != NULL)
+		return (vur);
+	vur = malloc(sizeof *vur);
+	AN(vur);
+	if (VUR_Init(vur, V1L_URING_ENTRIES)) {
+		free(vur);
+		v1l_uring_broken = 1;
+		return (NULL);
+	}
+	AZ(pthread_setspecific(v1l_uring_key, vur));
+	return (vur);
+}
+
+static void
+v1l_uring_drop(struct vur *vur)
+{
+
+	AZ(pthread_setspecific(v1l_uring_key, NULL));
+	v1l_uring_free(vur);
+}
+
+/*
+ * Send the iovec and wait for every completion belonging to it.
+ * Returns like writev(2), with -2 if the operation is unsupported and
+ * -3 if it could not be submitted this time.
+ *
+ * Submissions can fail for want of kernel memory and the like.  The
+ * ring is dropped then, as sqes left on it point into this stack frame,
+ * and the thread gets a new one on its next write.
+ */
+
+static ssize_t
+v1l_uring_send(struct vur *vur, const struct v1l *v1l, int zc)
+{
+	const struct io_uring_cqe *cqe;
+	struct io_uring_sqe *sqe;
+	struct __kernel_timespec ts;
+	struct msghdr msg;
+	unsigned want;
+	ssize_t res;
+	double t;
+	int i, drop = 0;
+
+	CHECK_OBJ_NOTNULL(vur, VUR_MAGIC);
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = v1l->iov;
+	msg.msg_iovlen = v1l->niov;
+
+	t = cache_param->idle_send_timeout;
+	ts.tv_sec = (long long)t;
+	ts.tv_nsec = (long long)((t - ts.tv_sec) * 1e9);
+
+	sqe = VUR_Sqe(vur);
+	AN(sqe);
+#if defined(IORING_CQE_F_NOTIF)
+	sqe->opcode = zc ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+#else
+	AZ(zc);
+	sqe->opcode = IORING_OP_SENDMSG;
+#endif
+	sqe->fd = *v1l->wfd;
+	sqe->addr = (uintptr_t)&msg;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = V1L_UD_SEND;
+	VUR_Commit(vur);
+
+	sqe = VUR_Sqe(vur);
+	AN(sqe);
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)&ts;
+	sqe->len = 1;
+	sqe->user_data = V1L_UD_TIMEOUT;
+	VUR_Commit(vur);
+
+	/* The send and the timeout, and the notification of a zc send */
+	res = -1;
+	errno = EIO;
+	want = 2;
+	i = VUR_Enter(vur, 2, 0, 0, NULL, 0);
+	if (i <= 0) {
+		v1l_uring_drop(vur);
+		return (-3);
+	}
+	if (i < 2) {
+		/* The send went in without its timeout */
+		want = i;
+		drop = 1;
+	}
+	while (want > 0) {
+		cqe = VUR_Peek(vur);
+		if (cqe == NULL) {
+			i = VUR_Enter(vur, 0, 1, IORING_ENTER_GETEVENTS,
+			    NULL, 0);
+			/* The kernel still has our msg, so keep waiting */
+			assert(i >= 0 || errno == EAGAIN || errno == EBUSY);
+			continue;
+		}
+		want--;
+#if defined(IORING_CQE_F_NOTIF)
+		if (cqe->flags & IORING_CQE_F_NOTIF) {
+			VUR_Advance(vur);
+			continue;
+		}
+		if (cqe->flags & IORING_CQE_F_MORE)
+			want++;
+#endif
+		if (cqe->user_data == V1L_UD_SEND) {
+			if (cqe->res >= 0) {
+				res = cqe->res;
+			} else if (cqe->res == -ECANCELED) {
+				errno = EAGAIN;
+			} else if (cqe->res == -EINVAL ||
+			    cqe->res == -EOPNOTSUPP) {
+				res = -2;
+			} else {
+				errno = -cqe->res;
+			}
+		}
+		VUR_Advance(vur);
+	}
+	if (drop)
+		v1l_uring_drop(vur);
+	return (res);
+}
+
+static ssize_t
+v1l_writev(const struct v1l *v1l)
+{
+	struct vur *vur;
+	ssize_t i;
+
+	if (!FEATURE(FEATURE_IO_URING_SEND) || v1l_uring_broken)
+		return (writev(*v1l->wfd, v1l->iov, v1l->niov));
+	vur = v1l_uring_get();
+	if (vur == NULL)
+		return (writev(*v1l->wfd, v1l->iov, v1l->niov));
+#if defined(IORING_CQE_F_NOTIF)
+	if (v1l->liov >= V1L_ZC_MIN && !v1l_zc_broken) {
+		i = v1l_uring_send(vur, v1l, 1);
+		if (i == -3)
+			return (writev(*v1l->wfd, v1l->iov, v1l->niov));
+		if (i != -2)
+			return (i);
+		v1l_zc_broken = 1;
+	}
+#endif
+	i = v1l_uring_send(vur, v1l, 0);
+	if (i == -3)
+		return (writev(*v1l->wfd, v1l->iov, v1l->niov));
+	if (i != -2)
+		return (i);
+	v1l_uring_broken = 1;
+	return (writev(*v1l->wfd, v1l->iov, v1l->niov));
+}
+
+#else
+
+static ssize_t
+v1l_writev(const struct v1l *v1l)
+{
+
+	return (writev(*v1l->wfd, v1l->iov, v1l->niov));
+}
+
+#endif /* defined(HAVE_IO_URING) */
+
+/*--------------------------------------------------------------------*/
+
 unsigned
 V1L_Flush(const struct worker *wrk)
 {
@@ -181,7 +484,7 @@ V1L_Flush(const struct worker *wrk)
 			v1l->iov[v1l->ciov].iov_len = 0;
 		}
 
-		i = writev(*v1l->wfd, v1l->iov, v1l->niov);
+		i = v1l_writev(v1l);
 		if (i > 0)
 			v1l->cnt += i;
 		while (i != v1l->liov && i > 0) {
@@ -193,7 +496,8 @@ V1L_Flush(const struct worker *wrk)
 			 * counter to prevent slowlaris attacks
 			*/
 
-			if (VTIM_real() - v1l->t0 > cache_param->send_timeout) {
+			if (VTIM_real_coarse() - v1l->t0 >
+			    cache_param->send_timeout) {
 				VSLb(v1l->vsl, SLT_Debug,
 				    "Hit total send timeout, "
 				    "wrote = %zd/%zd; not retrying",
@@ -207,7 +511,7 @@ V1L_Flush(const struct worker *wrk)
 			    i, v1l->liov);
 
 			v1l_prune(v1l, i);
-			i = writev(*v1l->wfd, v1l->iov, v1l->niov);
+			i = v1l_writev(v1l);
 			if (i > 0)
 				v1l->cnt += i;
 		}
@@ -221,6 +525,7 @@ V1L_Flush(const struct worker *wrk)
 	v1l->liov = 0;
 	v1l->cliov = 0;
 	v1l->niov = 0;
+	v1l->sused = 0;
 	if (v1l->ciov < v1l->siov)
 		v1l->ciov = v1l->niov++;
 	return (v1l->werr);
@@ -230,6 +535,8 @@ size_t
 V1L_Write(const struct worker *wrk, const void *ptr, ssize_t len)
 {
 	struct v1l *v1l;
+	struct iovec *iov;
+	char *p;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	v1l = wrk->v1l;
@@ -241,6 +548,23 @@ V1L_Write(const struct worker *wrk, const void *ptr, ssize_t len)
 		len = strlen(ptr);
 	if (v1l->niov >= v1l->siov - (v1l->ciov < v1l->siov ? 2 : 0))
 		(void)V1L_Flush(wrk);
+	if (v1l->ciov < v1l->siov && len < v1l->ssz) {
+		if (v1l->sused + len > v1l->ssz)
+			(void)V1L_Flush(wrk);
+		p = V1L_SBUF(v1l) + v1l->sused;
+		memcpy(p, ptr, len);
+		v1l->sused += len;
+		iov = &v1l->iov[v1l->niov - 1];
+		if (v1l->niov > v1l->ciov + 1 &&
+		    (char *)iov->iov_base + iov->iov_len == p) {
+			/* Extend the previous staged write */
+			iov->iov_len += len;
+			v1l->liov += len;
+			v1l->cliov += len;
+			return (len);
+		}
+		ptr = p;
+	}
 	v1l->iov[v1l->niov].iov_base = TRUST_ME(ptr);
 	v1l->iov[v1l->niov].iov_len = len;
 	v1l->liov += len;
@@ -252,16 +576,85 @@ V1L_Write(const struct worker *wrk, const void *ptr, ssize_t len)
 	return (len);
 }
 
+/*--------------------------------------------------------------------
+ * Send len bytes from offset off of the file fd, after what has been
+ * queued with V1L_Write().  Only unchunked output can be sent this way.
+ */
+
+#if defined(HAVE_SYS_SENDFILE_H)
+
+size_t
+V1L_SendFile(const struct worker *wrk, int fd, off_t off, ssize_t len)
+{
+	struct v1l *v1l;
+	ssize_t i, l;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	v1l = wrk->v1l;
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(v1l->wfd);
+	assert(v1l->ciov == v1l->siov);
+	assert(len > 0);
+
+	if (v1l->niov > 0)
+		(void)V1L_Flush(wrk);
+	if (*v1l->wfd < 0 || v1l->werr)
+		return (0);
+
+	for (l = len; l > 0; l -= i) {
+		i = sendfile(*v1l->wfd, fd, &off, l);
+		if (i <= 0) {
+			v1l->werr++;
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Write error, retval = %zd, len = %zd, errno = %s",
+			    i, l, strerror(errno));
+			break;
+		}
+		v1l->cnt += i;
+		if (i == l)
+			continue;
+		/* Same as for writev() in V1L_Flush() */
+		if (VTIM_real_coarse() - v1l->t0 >
+		    cache_param->send_timeout) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit total send timeout, "
+			    "wrote = %zd/%zd; not retrying", i, l);
+			v1l->werr++;
+			l -= i;
+			break;
+		}
+		VSLb(v1l->vsl, SLT_Debug,
+		    "Hit idle send timeout, wrote = %zd/%zd; retrying", i, l);
+	}
+	return (len - l);
+}
+
+#endif /* defined(HAVE_SYS_SENDFILE_H) */
+
 void
 V1L_Chunked(const struct worker *wrk)
 {
 	struct v1l *v1l;
+	unsigned u;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	v1l = wrk->v1l;
 	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
 
 	assert(v1l->ciov == v1l->siov);
+	if (v1l->ssz == 0 && cache_param->http_chunk_min > 0) {
+		/* Take the staging buffer, if that leaves enough iovecs */
+		u = (cache_param->http_chunk_min + sizeof *v1l->iov - 1) /
+		    sizeof *v1l->iov;
+		if (u + V1L_MIN_IOV <= v1l->siov) {
+			if (v1l->niov + 3 >= v1l->siov - u)
+				(void)V1L_Flush(wrk);
+			v1l->siov -= u;
+			v1l->ciov = v1l->siov;
+			v1l->ssz = u * sizeof *v1l->iov;
+			v1l->sused = 0;
+		}
+	}
 	/*
 	 * If there are not space for chunked header, a chunk of data and
 	 * a chunk tail, we might as well flush right away.
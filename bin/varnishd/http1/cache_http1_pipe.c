@@ -33,6 +33,8 @@
 
 #include "cache/cache.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
 
@@ -62,16 +64,80 @@ rdf(int fd0, int fd1, uint64_t *pcnt)
 	return (0);
 }
 
+#if defined(HAVE_SPLICE)
+/*--------------------------------------------------------------------
+ * Same as rdf(), but through a pipe(2) with splice(2), so the data is
+ * never copied into userland.  The pipe is drained before we return,
+ * one pipe per direction keeps a half-closed side from confusing the
+ * other.
+ */
+
+#define V1P_SPLICE_MAX	(64 * 1024)
+
+static int
+rdf_splice(int fd0, int fd1, const int *pfd, uint64_t *pcnt)
+{
+	ssize_t i, j;
+
+	i = splice(fd0, NULL, pfd[1], NULL, V1P_SPLICE_MAX,
+	    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (i < 0 && (errno == EAGAIN || errno == EINTR))
+		return (0);
+	if (i <= 0)
+		return (1);
+	for (; i > 0; i -= j) {
+		j = splice(pfd[0], NULL, fd1, NULL, i, SPLICE_F_MOVE);
+		if (j <= 0)
+			return (1);
+		*pcnt += j;
+	}
+	return (0);
+}
+#endif
+
+static int
+v1p_rdf(int fd0, int fd1, const int *pfd, uint64_t *pcnt)
+{
+
+#if defined(HAVE_SPLICE)
+	if (pfd[0] >= 0)
+		return (rdf_splice(fd0, fd1, pfd, pcnt));
+#else
+	(void)pfd;
+#endif
+	return (rdf(fd0, fd1, pcnt));
+}
+
+static void
+v1p_pipes(int pfd[2][2])
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		pfd[i / 2][i % 2] = -1;
+#if defined(HAVE_SPLICE)
+	if (!cache_param->pipe_splice)
+		return;
+	if (pipe2(pfd[0], O_CLOEXEC) == 0 && pipe2(pfd[1], O_CLOEXEC) == 0)
+		return;
+	/* Fall back to rdf() */
+	for (i = 0; i < 4; i++)
+		if (pfd[i / 2][i % 2] >= 0)
+			closefd(&pfd[i / 2][i % 2]);
+#endif
+}
+
 void
 V1P_Charge(struct req *req, const struct v1p_acct *a, struct VSC_C_vbe *b)
 {
+	uint64_t v[4];
 
 	AN(b);
-	VSLb(req->vsl, SLT_PipeAcct, "%ju %ju %ju %ju",
-	    (uintmax_t)a->req,
-	    (uintmax_t)a->bereq,
-	    (uintmax_t)a->in,
-	    (uintmax_t)a->out);
+	v[0] = a->req;
+	v[1] = a->bereq;
+	v[2] = a->in;
+	v[3] = a->out;
+	VSLb_u64(req->vsl, SLT_PipeAcct, v, 4);
 
 	Lck_Lock(&pipestat_mtx);
 	VSC_C_main->s_pipe_hdrbytes += a->req;
@@ -87,6 +153,7 @@ void
 V1P_Process(struct req *req, int fd, struct v1p_acct *v1a)
 {
 	struct pollfd fds[2];
+	int pfd[2][2];
 	int i, j;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -102,6 +169,7 @@ V1P_Process(struct req *req, int fd, struct v1p_acct *v1a)
 		req->htc->pipeline_e = NULL;
 		v1a->in += j;
 	}
+	v1p_pipes(pfd);
 	memset(fds, 0, sizeof fds);
 	fds[0].fd = fd;
 	fds[0].events = POLLIN | POLLERR;
@@ -116,7 +184,7 @@ V1P_Process(struct req *req, int fd, struct v1p_acct *v1a)
 		if (i < 1)
 			break;
 		if (fds[0].revents &&
-		    rdf(fd, req->sp->fd, &v1a->out)) {
+		    v1p_rdf(fd, req->sp->fd, pfd[0], &v1a->out)) {
 			if (fds[1].fd == -1)
 				break;
 			(void)shutdown(fd, SHUT_RD);
@@ -125,7 +193,7 @@ V1P_Process(struct req *req, int fd, struct v1p_acct *v1a)
 			fds[0].fd = -1;
 		}
 		if (fds[1].revents &&
-		    rdf(req->sp->fd, fd, &v1a->in)) {
+		    v1p_rdf(req->sp->fd, fd, pfd[1], &v1a->in)) {
 			if (fds[0].fd == -1)
 				break;
 			(void)shutdown(req->sp->fd, SHUT_RD);
@@ -134,6 +202,9 @@ V1P_Process(struct req *req, int fd, struct v1p_acct *v1a)
 			fds[1].fd = -1;
 		}
 	}
+	for (i = 0; i < 4; i++)
+		if (pfd[i / 2][i % 2] >= 0)
+			closefd(&pfd[i / 2][i % 2]);
 }
 
 /*--------------------------------------------------------------------*/
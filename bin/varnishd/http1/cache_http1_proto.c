@@ -126,10 +126,9 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 		if (vct_iscrlf(p))
 			break;
 		while (r < htc->rxbuf_e) {
-			if (!vct_isctl(*r) || vct_issp(*r)) {
-				r++;
-				continue;
-			}
+			r = TRUST_ME(VCT_Scan(r, htc->rxbuf_e, VCT_SCAN_CTL));
+			if (r == htc->rxbuf_e)
+				break;
 			if (!vct_iscrlf(r)) {
 				VSLb(hp->vsl, SLT_BogoHeader,
 				    "Header has ctrl char 0x%02x", *r);
@@ -239,10 +238,9 @@ http1_splitline(struct http *hp, struct http_conn *htc, const int *hf,
 	hp->hd[hf[0]].b = p;
 
 	/* First field cannot contain SP or CTL */
-	for (; !vct_issp(*p); p++) {
-		if (vct_isctl(*p))
-			return (400);
-	}
+	p = TRUST_ME(VCT_Scan(p, htc->rxbuf_e, VCT_SCAN_SP));
+	if (!vct_issp(*p))
+		return (400);
 	hp->hd[hf[0]].e = p;
 	assert(Tlen(hp->hd[hf[0]]));
 	*p++ = '\0';
@@ -255,10 +253,9 @@ http1_splitline(struct http *hp, struct http_conn *htc, const int *hf,
 	hp->hd[hf[1]].b = p;
 
 	/* Second field cannot contain LWS or CTL */
-	for (; !vct_islws(*p); p++) {
-		if (vct_isctl(*p))
-			return (400);
-	}
+	p = TRUST_ME(VCT_Scan(p, htc->rxbuf_e, VCT_SCAN_SP));
+	if (!vct_islws(*p))
+		return (400);
 	hp->hd[hf[1]].e = p;
 	if (!Tlen(hp->hd[hf[1]]))
 		return (400);
@@ -272,11 +269,10 @@ http1_splitline(struct http *hp, struct http_conn *htc, const int *hf,
 	hp->hd[hf[2]].b = p;
 
 	/* Third field is optional and cannot contain CTL except TAB */
-	for (; !vct_iscrlf(p); p++) {
-		if (vct_isctl(*p) && !vct_issp(*p)) {
-			hp->hd[hf[2]].b = NULL;
-			return (400);
-		}
+	p = TRUST_ME(VCT_Scan(p, htc->rxbuf_e, VCT_SCAN_CTL));
+	if (!vct_iscrlf(p)) {
+		hp->hd[hf[2]].b = NULL;
+		return (400);
 	}
 	hp->hd[hf[2]].e = p;
 
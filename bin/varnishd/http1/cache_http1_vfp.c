@@ -35,6 +35,8 @@
 
 #include "config.h"
 
+#include <sys/uio.h>
+
 #include <errno.h>
 #include <inttypes.h>
 
@@ -44,6 +46,37 @@
 
 #include "vct.h"
 
+#define V1F_READAHEAD		4096
+
+struct v1f_chunked {
+	unsigned		magic;
+#define V1F_CHUNKED_MAGIC	0x0b5c4e1d
+	struct http_conn	*htc;
+	char			*buf;	/* read-ahead, NULL if none */
+};
+
+/*--------------------------------------------------------------------
+ * Take up to len bytes of pipelined data
+ */
+
+static ssize_t
+v1f_pipeline(struct http_conn *htc, void *d, ssize_t len)
+{
+	ssize_t l;
+
+	if (htc->pipeline_b == NULL)
+		return (0);
+	l = htc->pipeline_e - htc->pipeline_b;
+	assert(l > 0);
+	if (l > len)
+		l = len;
+	memcpy(d, htc->pipeline_b, l);
+	htc->pipeline_b += l;
+	if (htc->pipeline_b == htc->pipeline_e)
+		htc->pipeline_b = htc->pipeline_e = NULL;
+	return (l);
+}
+
 /*--------------------------------------------------------------------
  * Read up to len bytes, returning pipelined data first.
  */
@@ -58,20 +91,10 @@ v1f_read(const struct vfp_ctx *vc, struct http_conn *htc, void *d, ssize_t len)
 	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
 	assert(len > 0);
-	l = 0;
 	p = d;
-	if (htc->pipeline_b) {
-		l = htc->pipeline_e - htc->pipeline_b;
-		assert(l > 0);
-		if (l > len)
-			l = len;
-		memcpy(p, htc->pipeline_b, l);
-		p += l;
-		len -= l;
-		htc->pipeline_b += l;
-		if (htc->pipeline_b == htc->pipeline_e)
-			htc->pipeline_b = htc->pipeline_e = NULL;
-	}
+	l = v1f_pipeline(htc, p, len);
+	p += l;
+	len -= l;
 	if (len > 0) {
 		i = read(*htc->rfd, p, len);
 		if (i < 0) {
@@ -84,18 +107,60 @@ v1f_read(const struct vfp_ctx *vc, struct http_conn *htc, void *d, ssize_t len)
 	return (i + l);
 }
 
+/*--------------------------------------------------------------------
+ * Read up to len bytes for the chunked filter.  With a read-ahead
+ * buffer, what the socket has beyond len goes into it as pipelined
+ * data, so the chunk headers and small chunks do not take a system
+ * call each.
+ */
+
+static ssize_t
+v1f_read_chunked(const struct vfp_ctx *vc, const struct v1f_chunked *vch,
+    void *d, ssize_t len)
+{
+	struct http_conn *htc;
+	struct iovec iov[2];
+	ssize_t i;
+
+	CHECK_OBJ_NOTNULL(vch, V1F_CHUNKED_MAGIC);
+	htc = vch->htc;
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	if (vch->buf == NULL)
+		return (v1f_read(vc, htc, d, len));
+	assert(len > 0);
+	i = v1f_pipeline(htc, d, len);
+	if (i > 0)
+		return (i);
+	iov[0].iov_base = d;
+	iov[0].iov_len = len;
+	iov[1].iov_base = vch->buf;
+	iov[1].iov_len = V1F_READAHEAD;
+	i = readv(*htc->rfd, iov, 2);
+	if (i < 0) {
+		VSLb(vc->wrk->vsl, SLT_FetchError, "%s", strerror(errno));
+		return (i);
+	}
+	if (i > len) {
+		htc->pipeline_b = vch->buf;
+		htc->pipeline_e = vch->buf + (i - len);
+		i = len;
+	}
+	return (i);
+}
+
 
 /*--------------------------------------------------------------------
  * Read a chunked HTTP object.
  *
- * XXX: Reading one byte at a time is pretty pessimal.
+ * The headers are parsed one byte at a time, which is only cheap when
+ * there is a read-ahead buffer to take them from.
  */
 
 static enum vfp_status __match_proto__(vfp_pull_f)
 v1f_pull_chunked(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr,
     ssize_t *lp)
 {
-	struct http_conn *htc;
+	struct v1f_chunked *vch;
 	int i;
 	char buf[20];		/* XXX: 20 is arbitrary */
 	char *q;
@@ -105,10 +170,7 @@ v1f_pull_chunked(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr,
 
 	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
-	CAST_OBJ_NOTNULL(htc, vfe->priv1, HTTP_CONN_MAGIC);
-	AN(ptr);
-	AN(lp);
-
+	CAST_OBJ_NOTNULL(vch, vfe->priv1, V1F_CHUNKED_MAGIC);
 	AN(ptr);
 	AN(lp);
 	l = *lp;
@@ -116,7 +178,7 @@ v1f_pull_chunked(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr,
 	if (vfe->priv2 == -1) {
 		/* Skip leading whitespace */
 		do {
-			lr = v1f_read(vc, htc, buf, 1);
+			lr = v1f_read_chunked(vc, vch, buf, 1);
 			if (lr <= 0)
 				return (VFP_Error(vc, "chunked read err"));
 		} while (vct_islws(buf[0]));
@@ -127,7 +189,7 @@ v1f_pull_chunked(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr,
 		/* Collect hex digits, skipping leading zeros */
 		for (u = 1; u < sizeof buf; u++) {
 			do {
-				lr = v1f_read(vc, htc, buf + u, 1);
+				lr = v1f_read_chunked(vc, vch, buf + u, 1);
 				if (lr <= 0)
 					return (VFP_Error(vc,
 					    "chunked read err"));
@@ -141,7 +203,7 @@ v1f_pull_chunked(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr,
 
 		/* Skip trailing white space */
 		while(vct_islws(buf[u]) && buf[u] != '\n') {
-			lr = v1f_read(vc, htc, buf + u, 1);
+			lr = v1f_read_chunked(vc, vch, buf + u, 1);
 			if (lr <= 0)
 				return (VFP_Error(vc, "chunked read err"));
 		}
@@ -163,7 +225,7 @@ v1f_pull_chunked(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr,
 	if (vfe->priv2 > 0) {
 		if (vfe->priv2 < l)
 			l = vfe->priv2;
-		lr = v1f_read(vc, htc, ptr, l);
+		lr = v1f_read_chunked(vc, vch, ptr, l);
 		if (lr <= 0)
 			return (VFP_Error(vc, "straight insufficient bytes"));
 		*lp = lr;
@@ -173,13 +235,18 @@ v1f_pull_chunked(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr,
 		return (VFP_OK);
 	}
 	AZ(vfe->priv2);
-	i = v1f_read(vc, htc, buf, 1);
+	i = v1f_read_chunked(vc, vch, buf, 1);
 	if (i <= 0)
 		return (VFP_Error(vc, "chunked read err"));
-	if (buf[0] == '\r' && v1f_read(vc, htc, buf, 1) <= 0)
+	if (buf[0] == '\r' && v1f_read_chunked(vc, vch, buf, 1) <= 0)
 		return (VFP_Error(vc, "chunked read err"));
 	if (buf[0] != '\n')
 		return (VFP_Error(vc, "chunked tail no NL"));
+	if (vch->buf != NULL && vch->htc->pipeline_b != NULL) {
+		/* Nothing must follow, do not reuse the connection */
+		vch->htc->pipeline_b = vch->htc->pipeline_e = NULL;
+		vch->htc->doclose = SC_RX_JUNK;
+	}
 	return (VFP_END);
 }
 
@@ -264,6 +331,7 @@ int
 V1F_Setup_Fetch(struct vfp_ctx *vfc, struct http_conn *htc)
 {
 	struct vfp_entry *vfe;
+	struct v1f_chunked *vch;
 
 	CHECK_OBJ_NOTNULL(vfc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
@@ -288,8 +356,26 @@ V1F_Setup_Fetch(struct vfp_ctx *vfc, struct http_conn *htc)
 		vfe = VFP_Push(vfc, &v1f_chunked, 0);
 		if (vfe == NULL)
 			return (ENOSPC);
+		vch = WS_Alloc(htc->ws, sizeof *vch);
+		if (vch == NULL)
+			return (ENOSPC);
+		INIT_OBJ(vch, V1F_CHUNKED_MAGIC);
+		vch->htc = htc;
+		/*
+		 * Only backend connections get a read-ahead, on the client
+		 * side it could take the start of the next request.
+		 * Without the workspace for it, we do without.
+		 */
+		if (vfc->bo != NULL) {
+			if (WS_Reserve(htc->ws, 0) >= V1F_READAHEAD) {
+				vch->buf = htc->ws->f;
+				WS_Release(htc->ws, V1F_READAHEAD);
+			} else
+				WS_Release(htc->ws, 0);
+		}
+		vfe->priv1 = vch;
 		vfe->priv2 = -1;
-		break;
+		return (0);
 	default:
 		WRONG("Wrong body_status");
 		break;
@@ -83,10 +83,31 @@ struct h2_req {
 	struct req			*req;
 	VTAILQ_ENTRY(h2_req)		list;
 	int64_t				window;
+	int				reset;
+	unsigned			urgency;	/* See below */
+
+	/* Request body, see cache_http2_proto.c */
+	uint8_t				*rxbuf;
+	unsigned			rxbuf_len;
+	unsigned			rxbuf_h;
+	unsigned			rxbuf_t;
+	int64_t				rx_window;
+	unsigned			rx_credit;
+	int				rx_eof;
 };
 
 VTAILQ_HEAD(h2_req_s, h2_req);
 
+/*
+ * Stream priority as an RFC 9218 urgency, 0 is the most urgent.  See
+ * h2_rx_priority() for how RFC 7540 PRIORITY is mapped onto it.
+ */
+#define H2_URGENCY_DEFAULT		3
+#define H2_URGENCY_MAX			7
+
+struct h2_txf;
+VTAILQ_HEAD(h2_txf_s, h2_txf);
+
 struct h2_sess {
 	unsigned			magic;
 #define H2_SESS_MAGIC			0xa16f7e4b
@@ -97,24 +118,45 @@ struct h2_sess {
 	int				bogosity;
 
 	struct h2_req_s			streams;
+	struct h2_req			*req0;		/* Stream #0 */
 
 	struct req			*srq;
 	struct ws			*ws;
 	struct http_conn		*htc;
 	struct vsl_log			*vsl;
 	struct vht_table		dectbl[1];
+	struct vht_table		enctbl[1];
+	uint32_t			enc_tblsize;	/* As the peer sees it */
+	uint32_t			enc_tblmin;	/* Lowest since then */
 
 	unsigned			rxf_len;
 	unsigned			rxf_flags;
 	unsigned			rxf_stream;
 	uint8_t				*rxf_data;
+	uint8_t				*rxf_buf;	/* DATA payload */
+	int64_t				rx_window;
+	unsigned			rx_credit;
 
 	uint32_t			their_settings[H2_SETTINGS_N];
 	uint32_t			our_settings[H2_SETTINGS_N];
 
 	struct req			*new_req;
+	struct taskhead			rx_req;		/* New streams */
+	struct taskhead			rx_bulk;	/* ... less urgent */
+
+	/* Idle on the waiter, see h2_park() */
+	struct waited			*park;
+	struct pool_task		rx_task;
 	int				go_away;
 	uint32_t			go_away_last_stream;
+
+	/* Output, see cache_http2_send.c */
+	pthread_cond_t			cond;
+	struct h2_txf_s			txq;
+	unsigned			tx_nwait;
+	int				tx_busy;
+	int				tx_error;
+	int				rx_closed;
 };
 
 /* http2/cache_http2_panic.c */
@@ -146,13 +188,17 @@ void h2h_decode_init(const struct h2_sess *h2, struct h2h_decode *d);
 h2_error h2h_decode_fini(const struct h2_sess *h2, struct h2h_decode *d);
 h2_error h2h_decode_bytes(struct h2_sess *h2, struct h2h_decode *d,
     const uint8_t *ptr, size_t len);
+size_t h2h_encode(struct h2_sess *h2, const struct http *hp, uint8_t *buf,
+    size_t len);
 
-int H2_Send_Frame(struct worker *, const struct h2_sess *,
+int H2_Send_Frame(struct worker *, struct h2_sess *,
     enum h2_frame_e type, uint8_t flags, uint32_t len, uint32_t stream,
     const void *);
 
 int H2_Send(struct worker *, struct h2_req *, int flush,
     enum h2_frame_e type, uint8_t flags, uint32_t len, const void *);
+int H2_Send_Headers(struct worker *, struct h2_req *, uint8_t flags,
+    const struct http *, uint8_t *, size_t);
 
 typedef h2_error h2_frame_f(struct worker *, struct h2_sess *,
     struct h2_req *);
@@ -31,44 +31,12 @@
 
 #include "cache/cache.h"
 
-#include <netinet/in.h>
-
-#include <ctype.h>
-#include <stdio.h>
-
 #include "cache/cache_filter.h"
 #include "cache/cache_transport.h"
 
 #include "http2/cache_http2.h"
 
-#include "vct.h"
-
-/**********************************************************************/
-
-struct hpack_static {
-	uint8_t			idx;
-	const char *		name;
-	const char *		val;
-};
-
-static const struct hpack_static hp_static[] = {
-#define HPS(I,N,V) [I] = { I, N ":", V },
-#include "tbl/vhp_static.h"
-	{ 0, "\377:", ""}		// Terminator
-};
-
-static const struct hpack_static *hp_idx[256];
-
-void
-V2D_Init(void)
-{
-	int i;
-#define HPS(I,N,V)						\
-	i = hp_static[I].name[0];				\
-	if (hp_idx[i] == NULL) hp_idx[i] = &hp_static[I];
-#include "tbl/vhp_static.h"
-#undef HPS
-}
+#include "vend.h"
 
 /**********************************************************************/
 
@@ -85,9 +53,10 @@ h2_bytes(struct req *req, enum vdp_action act, void **priv,
 		return (0);
 	AZ(req->vdp_nxt);	       /* always at the bottom of the pile */
 
-	H2_Send(req->wrk, r2,
+	if (H2_Send(req->wrk, r2,
 	    act == VDP_FLUSH ? 1 : 0,
-	    H2_FRAME_DATA, H2FF_NONE, len, ptr);
+	    H2_FRAME_DATA, H2FF_NONE, len, ptr))
+		return (-1);
 
 	return (0);
 }
@@ -95,15 +64,10 @@ h2_bytes(struct req *req, enum vdp_action act, void **priv,
 void __match_proto__(vtr_deliver_f)
 h2_deliver(struct req *req, struct boc *boc, int sendbody)
 {
-	ssize_t sz, sz1;
-	uint8_t *p;
-	unsigned u;
-	const char *r;
-	struct http *hp;
 	struct sess *sp;
 	struct h2_req *r2;
-	int i, err;
-	const struct hpack_static *hps;
+	uint8_t b[4];
+	int err;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
@@ -111,98 +75,20 @@ h2_deliver(struct req *req, struct boc *boc, int sendbody)
 	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
 	sp = req->sp;
 	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
-	(void)sendbody;
 
 	VSLb(req->vsl, SLT_Debug, "H2: Deliver");
 
 	(void)WS_Reserve(req->ws, 0);
-	p = (void*)req->ws->f;
-
-	switch (req->resp->status) {
-	case 200: *p++ = 0x80 |  8; break;
-	case 204: *p++ = 0x80 |  9; break;
-	case 206: *p++ = 0x80 | 10; break;
-	case 304: *p++ = 0x80 | 11; break;
-	case 400: *p++ = 0x80 | 12; break;
-	case 404: *p++ = 0x80 | 13; break;
-	case 500: *p++ = 0x80 | 14; break;
-	default:
-		*p++ = 0x18;
-		*p++ = 0x03;
-
-		assert(snprintf((char*)p, 4, "%03d", req->resp->status) == 3);
-		p += 3;
-		break;
-	}
-
-	hp = req->resp;
-	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
-		assert(WS_Inside(req->ws, p, NULL));
-
-		r = strchr(hp->hd[u].b, ':');
-		AN(r);
-
-		hps = hp_idx[tolower(*hp->hd[u].b)];
-		sz = 1 + r - hp->hd[u].b;
-		assert(sz > 0);
-		while (hps != NULL && hps->idx > 0) {
-			i = strncasecmp(hps->name, hp->hd[u].b, sz);
-			if (i < 0) {
-				hps++;
-				continue;
-			}
-			if (i > 0)
-				hps = NULL;
-			break;
-		}
-		if (hps != NULL) {
-			VSLb(req->vsl, SLT_Debug,
-			    "HP {%d, \"%s\", \"%s\"} <%s>",
-			    hps->idx, hps->name, hps->val, hp->hd[u].b);
-			if (hps->idx < 15) {
-				*p++ = 0x10 | hps->idx;
-			} else {
-				*p++ = 0x1f;
-				*p++ = hps->idx - 0x0f;
-			}
-		} else {
-
-			*p++ = 0x10;
-			sz--;
-			if (sz < 127) {
-				*p++ = (uint8_t)sz;
-			} else {
-				*p++ = 0x7f;
-				*p++ = (uint8_t)sz - 0x7f;
-			}
-
-			for(sz1 = 0; sz1 < sz; sz1++)
-				*p++ = (uint8_t)tolower(hp->hd[u].b[sz1]);
-
-		}
-
-		while(vct_islws(*++r))
-			continue;
-		sz = hp->hd[u].e - r;
-		assert(sz <= 254);
-		if (sz < 127) {
-			*p++ = (uint8_t)sz;
-		} else if (sz < 127 * 2) {
-			*p++ = 0x7f;
-			*p++ = (uint8_t)sz - 0x7f;
-		}
-
-		memcpy(p, r, sz);
-		p += sz;
-		assert(WS_Inside(req->ws, p, NULL));
-	}
-	sz = (char*)p - req->ws->f;
-
 	/* XXX: Optimize !sendbody case */
-	H2_Send(req->wrk, r2, 1, H2_FRAME_HEADERS, H2FF_HEADERS_END_HEADERS,
-	    sz, req->ws->f);
-
+	err = H2_Send_Headers(req->wrk, r2, 0, req->resp,
+	    (void*)req->ws->f, pdiff(req->ws->f, req->ws->e));
 	WS_Release(req->ws, 0);
+	if (err) {
+		vbe32enc(b, H2SE_INTERNAL_ERROR->val);
+		(void)H2_Send(req->wrk, r2, 1, H2_FRAME_RST_STREAM, 0,
+		    sizeof b, b);
+		return;
+	}
 
 	if (sendbody && req->resp_len != 0)
 		VDP_push(req, h2_bytes, NULL, 1, "H2");
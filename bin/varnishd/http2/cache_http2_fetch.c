@@ -0,0 +1,1526 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * HTTP/2 to backends.
+ *
+ * A backend with .http2 = true has a pool of h2 connections, and each
+ * fetch is a stream on one of them, so many fetches share a few
+ * connections.  Each connection has a reader task of its own, which
+ * takes the frames in and queues them on their streams, and the fetch
+ * threads write their own frames, one at a time under the txmtx of the
+ * session, which also keeps the HPACK encoder in step with the wire.
+ *
+ * A stream gets no more of the body from the backend than its window,
+ * and the window is only opened again as the VFP stack consumes what
+ * came, so a slow fetch does not make the others on the connection
+ * wait, nor hoard memory.
+ *
+ * The txmtx is taken before the pool mtx, and the reader never holds
+ * the pool mtx while it writes.
+ */
+
+#include "config.h"
+
+#include "cache/cache.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+
+#include "vct.h"
+#include "vend.h"
+#include "vrt.h"
+#include "vtcp.h"
+#include "vtim.h"
+
+#include "cache/cache_director.h"
+#include "cache/cache_backend.h"
+#include "cache/cache_filter.h"
+#include "http2/cache_http2.h"
+
+#define H2F_FRAME_MAX		16384	/* Our SETTINGS_MAX_FRAME_SIZE */
+#define H2F_TABLE_SIZE		4096	/* HPACK tables, both ways */
+#define H2F_STREAM_MAX		0x7ffffffdU
+
+static const char h2f_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+struct h2f_data {
+	unsigned			magic;
+#define H2F_DATA_MAGIC			0x3c0d8e51
+	VTAILQ_ENTRY(h2f_data)		list;
+	unsigned			len;
+	unsigned			off;
+};
+
+struct h2f_stream {
+	unsigned			magic;
+#define H2F_STREAM_MAGIC		0x7a61c02e
+	uint32_t			id;
+	struct h2f_sess			*sess;
+	VTAILQ_ENTRY(h2f_stream)	list;
+	pthread_cond_t			cond;
+
+	int64_t				tx_window;
+
+	/* From the reader, under the pool mtx */
+	char				*hdrs;	/* "name: value\0" ... */
+	unsigned			hdrs_len;
+	int				resp;
+	int				end_stream;
+	int				reset;
+	uint32_t			reset_code;
+	const char			*error;
+	VTAILQ_HEAD(,h2f_data)		rxq;
+	unsigned			rx_buffered;
+	unsigned			rx_credit;
+};
+
+struct h2f_sess {
+	unsigned			magic;
+#define H2F_SESS_MAGIC			0x51e9b0d4
+	struct h2f_pool			*pool;
+	VTAILQ_ENTRY(h2f_sess)		list;
+	int				fd;
+	const struct suckaddr		*addr;
+	struct pool_task		task;
+
+	/* Under the pool mtx */
+	int				refcnt;
+	unsigned			nstreams;
+	VTAILQ_HEAD(,h2f_stream)	streams;
+	uint32_t			next_id;
+	int				dead;
+	int				go_away;
+	double				idle;
+	uint32_t			their_settings[H2_SETTINGS_N];
+	int64_t				tx_window;
+	unsigned			rx_window;
+	unsigned			rx_credit;
+	unsigned			st_window;
+
+	/* Under the txmtx */
+	struct lock			txmtx;
+	int				tx_error;
+	struct vht_table		enctbl[1];
+	uint32_t			enc_want;
+	uint32_t			enc_min;
+
+	/* The reader's own */
+	struct vht_table		dectbl[1];
+	uint8_t				*rxbuf;
+	uint8_t				*hblk;
+	size_t				hblk_len;
+	size_t				hblk_size;
+	uint32_t			hblk_stream;
+	uint8_t				hblk_flags;
+	int				hblk_cont;
+};
+
+struct h2f_pool {
+	unsigned			magic;
+#define H2F_POOL_MAGIC			0x0f2b6d93
+	struct lock			mtx;
+	int				refcnt;
+	int				dying;
+	VTAILQ_HEAD(,h2f_sess)		sess;
+};
+
+/*--------------------------------------------------------------------
+ * Write a frame, with the txmtx held.  A failed write is the end of
+ * the connection, and the reader is woken up to clean up after it.
+ */
+
+static int
+h2f_send(struct h2f_sess *s, enum h2_frame_e type, uint8_t flags,
+    uint32_t len, uint32_t stream, const void *ptr)
+{
+	uint8_t hdr[9];
+	struct iovec iov[2], *io = iov;
+	int niov = 1;
+	ssize_t l;
+
+	CHECK_OBJ_NOTNULL(s, H2F_SESS_MAGIC);
+	Lck_AssertHeld(&s->txmtx);
+	if (s->tx_error)
+		return (-1);
+
+	assert(len < (1U << 24));
+	vbe32enc(hdr, len << 8);
+	hdr[3] = (uint8_t)type;
+	hdr[4] = flags;
+	vbe32enc(hdr + 5, stream);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof hdr;
+	if (len > 0) {
+		AN(ptr);
+		iov[1].iov_base = TRUST_ME(ptr);
+		iov[1].iov_len = len;
+		niov++;
+	}
+
+	while (niov > 0) {
+		l = writev(s->fd, io, niov);
+		if (l <= 0) {
+			s->tx_error = 1;
+			(void)shutdown(s->fd, SHUT_RDWR);
+			return (-1);
+		}
+		for (; niov > 0 && l >= (ssize_t)io->iov_len; io++, niov--)
+			l -= io->iov_len;
+		if (niov > 0) {
+			io->iov_base = (char *)io->iov_base + l;
+			io->iov_len -= l;
+		}
+	}
+	return (0);
+}
+
+static void
+h2f_send_u32(struct h2f_sess *s, enum h2_frame_e type, uint32_t stream,
+    uint32_t val)
+{
+	uint8_t buf[4];
+
+	vbe32enc(buf, val);
+	(void)h2f_send(s, type, 0, sizeof buf, stream, buf);
+}
+
+/*--------------------------------------------------------------------
+ * Open the windows again for what was consumed, once it is worth a
+ * frame.  Called with the pool mtx held, which is dropped for the
+ * writes.
+ */
+
+static void
+h2f_window_update(struct h2f_sess *s, struct h2f_stream *st)
+{
+	unsigned c0 = 0, c1 = 0;
+	uint32_t id = 0;
+
+	CHECK_OBJ_NOTNULL(s, H2F_SESS_MAGIC);
+	Lck_AssertHeld(&s->pool->mtx);
+
+	if (s->dead)
+		return;
+	if (s->rx_credit >= s->rx_window / 2) {
+		c0 = s->rx_credit;
+		s->rx_credit = 0;
+	}
+	if (st != NULL && !st->end_stream && !st->reset &&
+	    st->rx_credit >= s->st_window / 2) {
+		id = st->id;
+		c1 = st->rx_credit;
+		st->rx_credit = 0;
+	}
+	if (c0 == 0 && c1 == 0)
+		return;
+	Lck_Unlock(&s->pool->mtx);
+	Lck_Lock(&s->txmtx);
+	if (c1 > 0)
+		h2f_send_u32(s, H2_FRAME_WINDOW_UPDATE, id, c1);
+	if (c0 > 0)
+		h2f_send_u32(s, H2_FRAME_WINDOW_UPDATE, 0, c0);
+	Lck_Unlock(&s->txmtx);
+	Lck_Lock(&s->pool->mtx);
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct h2f_stream *
+h2f_find(const struct h2f_sess *s, uint32_t id)
+{
+	struct h2f_stream *st;
+
+	Lck_AssertHeld(&s->pool->mtx);
+	VTAILQ_FOREACH(st, &s->streams, list)
+		if (st->id == id)
+			return (st);
+	return (NULL);
+}
+
+static void
+h2f_broadcast(const struct h2f_sess *s)
+{
+	struct h2f_stream *st;
+
+	Lck_AssertHeld(&s->pool->mtx);
+	VTAILQ_FOREACH(st, &s->streams, list)
+		AZ(pthread_cond_broadcast(&st->cond));
+}
+
+/*--------------------------------------------------------------------
+ * Decode the header block with the connection's decoder table.  Even
+ * a block nobody wants must be decoded, to keep the table in step.
+ *
+ * Returns -1 on compression errors, which take the connection down,
+ * 1 if the headers are bad, or too large for http_resp_size, and 0
+ * with the length of the "name: value\0" list in *lp.
+ */
+
+static int
+h2f_decode(struct h2f_sess *s, char *out, size_t out_l, size_t *lp)
+{
+	struct vhd_decode vhd[1];
+	enum vhd_ret_e ret;
+	size_t in_u = 0, out_u = 0, b = 0, namelen = 0, u;
+	int bad = 0;
+
+	VHD_Init(vhd);
+	while (1) {
+		ret = VHD_Decode(vhd, s->dectbl, s->hblk, s->hblk_len, &in_u,
+		    out + b, out_l - b, &out_u);
+		if (ret < 0)
+			return (-1);
+		if (ret == VHD_OK || ret == VHD_MORE)
+			break;
+		switch (ret) {
+		case VHD_NAME_SEC:
+		case VHD_NAME:
+			if (out_l - b - out_u < 2) {
+				bad = 1;
+				break;
+			}
+			out[b + out_u++] = ':';
+			out[b + out_u++] = ' ';
+			namelen = out_u;
+			break;
+		case VHD_VALUE_SEC:
+		case VHD_VALUE:
+			if (out_l - b - out_u < 1) {
+				bad = 1;
+				break;
+			}
+			/* Nothing must sneak into the HTTP/1 side */
+			for (u = 0; u < out_u; u++) {
+				if (u < namelen - 2 && !vct_istchar(out[b + u])
+				    && !(u == 0 && out[b] == ':'))
+					bad = 1;
+				else if (u >= namelen &&
+				    vct_isctl(out[b + u]) &&
+				    !vct_issp(out[b + u]))
+					bad = 1;
+			}
+			if (namelen <= 2)
+				bad = 1;
+			out[b + out_u++] = '\0';
+			b += out_u;
+			out_u = 0;
+			namelen = 0;
+			break;
+		case VHD_BUF:
+			bad = 1;
+			break;
+		default:
+			WRONG("Unhandled return value");
+		}
+		if (bad) {
+			/* Keep decoding, but throw it away */
+			b = 0;
+			out_u = 0;
+		}
+	}
+	if (ret != VHD_OK)
+		return (-1);
+	*lp = b;
+	return (bad);
+}
+
+/*--------------------------------------------------------------------
+ * Frames from the backend, all in the reader.
+ */
+
+static h2_error
+h2f_rx_headers_done(struct h2f_sess *s)
+{
+	struct h2f_stream *st;
+	char *out;
+	size_t l = 0;
+	int i;
+
+	out = malloc(cache_param->http_resp_size);
+	AN(out);
+	i = h2f_decode(s, out, cache_param->http_resp_size, &l);
+	s->hblk_len = 0;
+	s->hblk_cont = 0;
+	if (i < 0) {
+		free(out);
+		return (H2CE_COMPRESSION_ERROR);
+	}
+
+	Lck_Lock(&s->pool->mtx);
+	st = h2f_find(s, s->hblk_stream);
+	if (st != NULL && !st->reset && st->error == NULL) {
+		if (i > 0)
+			st->error = "bad response headers";
+		else if (!st->resp && l >= 10 && !strncmp(out, ":status: 1", 10))
+			/* 1xx, the real response follows */ ;
+		else if (!st->resp) {
+			st->hdrs = out;
+			st->hdrs_len = l;
+			st->resp = 1;
+			out = NULL;
+		}
+		/* Trailers are not kept */
+		if (s->hblk_flags & H2FF_HEADERS_END_STREAM)
+			st->end_stream = 1;
+		AZ(pthread_cond_broadcast(&st->cond));
+	}
+	Lck_Unlock(&s->pool->mtx);
+	free(out);
+	return (0);
+}
+
+static h2_error
+h2f_rx_hblk(struct h2f_sess *s, const uint8_t *p, size_t l)
+{
+
+	if (s->hblk_len + l > 2 * cache_param->http_resp_size)
+		return (H2CE_ENHANCE_YOUR_CALM);
+	if (s->hblk_len + l > s->hblk_size) {
+		s->hblk_size = s->hblk_len + l;
+		s->hblk = realloc(s->hblk, s->hblk_size);
+		AN(s->hblk);
+	}
+	memcpy(s->hblk + s->hblk_len, p, l);
+	s->hblk_len += l;
+	return (0);
+}
+
+static h2_error
+h2f_rx_headers(struct h2f_sess *s, uint8_t flags, uint32_t stream,
+    const uint8_t *p, size_t l)
+{
+	h2_error h2e;
+	size_t pad = 0;
+
+	if (stream == 0 || !(stream & 1))
+		return (H2CE_PROTOCOL_ERROR);
+	if (flags & H2FF_HEADERS_PADDED) {
+		if (l < 1)
+			return (H2CE_PROTOCOL_ERROR);
+		pad = *p++;
+		l--;
+	}
+	if (flags & H2FF_HEADERS_PRIORITY) {
+		if (l < 5)
+			return (H2CE_PROTOCOL_ERROR);
+		p += 5;
+		l -= 5;
+	}
+	if (pad > l)
+		return (H2CE_PROTOCOL_ERROR);
+	l -= pad;
+
+	s->hblk_stream = stream;
+	s->hblk_flags = flags;
+	h2e = h2f_rx_hblk(s, p, l);
+	if (h2e != NULL)
+		return (h2e);
+	if (flags & H2FF_HEADERS_END_HEADERS)
+		return (h2f_rx_headers_done(s));
+	s->hblk_cont = 1;
+	return (0);
+}
+
+static h2_error
+h2f_rx_data(struct h2f_sess *s, uint8_t flags, uint32_t stream,
+    const uint8_t *p, size_t len)
+{
+	struct h2f_stream *st;
+	struct h2f_data *d;
+	size_t l = len;
+
+	if (stream == 0)
+		return (H2CE_PROTOCOL_ERROR);
+	if (flags & H2FF_DATA_PADDED) {
+		if (l < 1 || *p >= l)
+			return (H2CE_PROTOCOL_ERROR);
+		l -= 1 + *p++;
+	}
+
+	Lck_Lock(&s->pool->mtx);
+	st = h2f_find(s, stream);
+	if (st == NULL || st->reset || st->error != NULL || st->end_stream) {
+		s->rx_credit += len;
+	} else {
+		/* The padding is not anybody's to consume */
+		s->rx_credit += len - l;
+		st->rx_credit += len - l;
+		if (st->rx_buffered + l > s->st_window) {
+			st->error = "flow control window exceeded";
+			s->rx_credit += l;
+		} else if (l > 0) {
+			d = malloc(sizeof *d + l);
+			AN(d);
+			INIT_OBJ(d, H2F_DATA_MAGIC);
+			d->len = l;
+			memcpy(d + 1, p, l);
+			VTAILQ_INSERT_TAIL(&st->rxq, d, list);
+			st->rx_buffered += l;
+		}
+		if (flags & H2FF_DATA_END_STREAM)
+			st->end_stream = 1;
+		AZ(pthread_cond_broadcast(&st->cond));
+	}
+	h2f_window_update(s, NULL);
+	Lck_Unlock(&s->pool->mtx);
+	return (0);
+}
+
+static h2_error
+h2f_rx_settings(struct h2f_sess *s, uint8_t flags, const uint8_t *p,
+    size_t l)
+{
+	struct h2f_stream *st;
+	h2_error h2e = NULL;
+	uint16_t x;
+	uint32_t y;
+	int64_t d;
+
+	if (flags & H2FF_SETTINGS_ACK)
+		return (l == 0 ? NULL : H2CE_FRAME_SIZE_ERROR);
+	if (l % 6)
+		return (H2CE_FRAME_SIZE_ERROR);
+
+	Lck_Lock(&s->txmtx);
+	Lck_Lock(&s->pool->mtx);
+	for (; l > 0 && h2e == NULL; p += 6, l -= 6) {
+		x = vbe16dec(p);
+		y = vbe32dec(p + 2);
+		if (x == 0 || x >= H2_SETTINGS_N)
+			continue;	/* Unknown settings are ignored */
+		switch (x) {
+		case H2S_HEADER_TABLE_SIZE:
+			if (y > s->enctbl->protomax)
+				y = s->enctbl->protomax;
+			s->enc_want = y;
+			if (y < s->enc_min)
+				s->enc_min = y;
+			break;
+		case H2S_INITIAL_WINDOW_SIZE:
+			if (y > 0x7fffffff) {
+				h2e = H2CE_FLOW_CONTROL_ERROR;
+				break;
+			}
+			d = (int64_t)y - s->their_settings[x];
+			VTAILQ_FOREACH(st, &s->streams, list)
+				st->tx_window += d;
+			h2f_broadcast(s);
+			break;
+		case H2S_MAX_FRAME_SIZE:
+			if (y < 16384 || y > 16777215)
+				h2e = H2CE_PROTOCOL_ERROR;
+			break;
+		default:
+			break;
+		}
+		if (h2e == NULL)
+			s->their_settings[x] = y;
+	}
+	Lck_Unlock(&s->pool->mtx);
+	if (h2e == NULL)
+		(void)h2f_send(s, H2_FRAME_SETTINGS, H2FF_SETTINGS_ACK, 0, 0,
+		    NULL);
+	Lck_Unlock(&s->txmtx);
+	return (h2e);
+}
+
+static h2_error
+h2f_rx_frame(struct h2f_sess *s, enum h2_frame_e type, uint8_t flags,
+    uint32_t stream, const uint8_t *p, size_t l)
+{
+	struct h2f_stream *st;
+	uint32_t u;
+
+	if (s->hblk_cont) {
+		if (type != H2_FRAME_CONTINUATION || stream != s->hblk_stream)
+			return (H2CE_PROTOCOL_ERROR);
+		if (h2f_rx_hblk(s, p, l) != NULL)
+			return (H2CE_ENHANCE_YOUR_CALM);
+		if (flags & H2FF_CONTINUATION_END_HEADERS)
+			return (h2f_rx_headers_done(s));
+		return (0);
+	}
+
+	switch (type) {
+	case H2_FRAME_DATA:
+		return (h2f_rx_data(s, flags, stream, p, l));
+	case H2_FRAME_HEADERS:
+		return (h2f_rx_headers(s, flags, stream, p, l));
+	case H2_FRAME_SETTINGS:
+		if (stream != 0)
+			return (H2CE_PROTOCOL_ERROR);
+		return (h2f_rx_settings(s, flags, p, l));
+	case H2_FRAME_RST_STREAM:
+		if (l != 4)
+			return (H2CE_FRAME_SIZE_ERROR);
+		Lck_Lock(&s->pool->mtx);
+		st = h2f_find(s, stream);
+		if (st != NULL) {
+			st->reset = 1;
+			st->reset_code = vbe32dec(p);
+			AZ(pthread_cond_broadcast(&st->cond));
+		}
+		Lck_Unlock(&s->pool->mtx);
+		return (0);
+	case H2_FRAME_PING:
+		if (l != 8)
+			return (H2CE_FRAME_SIZE_ERROR);
+		if (flags & H2FF_PING_ACK)
+			return (0);
+		Lck_Lock(&s->txmtx);
+		(void)h2f_send(s, H2_FRAME_PING, H2FF_PING_ACK, l, 0, p);
+		Lck_Unlock(&s->txmtx);
+		return (0);
+	case H2_FRAME_GOAWAY:
+		if (l < 8)
+			return (H2CE_FRAME_SIZE_ERROR);
+		u = vbe32dec(p) & ~(1U << 31);
+		Lck_Lock(&s->pool->mtx);
+		s->go_away = 1;
+		VTAILQ_FOREACH(st, &s->streams, list) {
+			if (st->id <= u)
+				continue;
+			st->reset = 1;
+			st->reset_code = H2SE_REFUSED_STREAM->val;
+			AZ(pthread_cond_broadcast(&st->cond));
+		}
+		Lck_Unlock(&s->pool->mtx);
+		return (0);
+	case H2_FRAME_WINDOW_UPDATE:
+		if (l != 4)
+			return (H2CE_FRAME_SIZE_ERROR);
+		u = vbe32dec(p) & ~(1U << 31);
+		Lck_Lock(&s->pool->mtx);
+		if (stream == 0) {
+			s->tx_window += u;
+			h2f_broadcast(s);
+		} else if ((st = h2f_find(s, stream)) != NULL) {
+			st->tx_window += u;
+			AZ(pthread_cond_broadcast(&st->cond));
+		}
+		u = (s->tx_window > 0x7fffffff);
+		Lck_Unlock(&s->pool->mtx);
+		return (u ? H2CE_FLOW_CONTROL_ERROR : NULL);
+	case H2_FRAME_PUSH_PROMISE:
+		/* We said SETTINGS_ENABLE_PUSH = 0 */
+		return (H2CE_PROTOCOL_ERROR);
+	case H2_FRAME_CONTINUATION:
+		return (H2CE_PROTOCOL_ERROR);
+	default:
+		/* PRIORITY, and unknown frames, are ignored */
+		return (0);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * The connection reader
+ */
+
+static int
+h2f_rx_full(int fd, uint8_t *p, size_t l)
+{
+	ssize_t i;
+
+	while (l > 0) {
+		i = VTCP_read(fd, p, l, cache_param->between_bytes_timeout);
+		if (i <= 0)
+			return (-1);
+		p += i;
+		l -= i;
+	}
+	return (0);
+}
+
+/*
+ * Wait for the next frame, and notice when the connection has been
+ * idle for backend_idle_timeout, or the backend went away.
+ */
+
+static int
+h2f_rx_wait(struct h2f_sess *s)
+{
+	struct pollfd pfd[1];
+	int i;
+
+	while (1) {
+		pfd->fd = s->fd;
+		pfd->events = POLLIN;
+		pfd->revents = 0;
+		if (poll(pfd, 1, 1000) != 0)
+			return (0);
+		Lck_Lock(&s->pool->mtx);
+		if (s->nstreams == 0 && (s->pool->dying ||
+		    VTIM_real() - s->idle > cache_param->backend_idle_timeout))
+			s->dead = 1;
+		i = s->dead;
+		Lck_Unlock(&s->pool->mtx);
+		if (i)
+			return (1);
+	}
+}
+
+static void h2f_sess_rel(struct h2f_sess *s);
+
+static void __match_proto__(task_func_t)
+h2f_reader(struct worker *wrk, void *priv)
+{
+	struct h2f_sess *s;
+	h2_error h2e = NULL;
+	uint8_t hdr[9], buf[8];
+	uint32_t len, stream;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(s, priv, H2F_SESS_MAGIC);
+
+	while (!h2f_rx_wait(s)) {
+		if (h2f_rx_full(s->fd, hdr, sizeof hdr))
+			break;
+		len = vbe32dec(hdr) >> 8;
+		stream = vbe32dec(hdr + 5) & ~(1U << 31);
+		if (len > H2F_FRAME_MAX) {
+			h2e = H2CE_FRAME_SIZE_ERROR;
+			break;
+		}
+		if (h2f_rx_full(s->fd, s->rxbuf, len))
+			break;
+		h2e = h2f_rx_frame(s, (enum h2_frame_e)hdr[3], hdr[4],
+		    stream, s->rxbuf, len);
+		if (h2e != NULL)
+			break;
+	}
+
+	Lck_Lock(&s->txmtx);
+	vbe32enc(buf, 0);		/* The backend opens no streams */
+	vbe32enc(buf + 4, h2e != NULL ? h2e->val : H2CE_NO_ERROR->val);
+	(void)h2f_send(s, H2_FRAME_GOAWAY, 0, sizeof buf, 0, buf);
+	Lck_Unlock(&s->txmtx);
+
+	Lck_Lock(&s->pool->mtx);
+	s->dead = 1;
+	h2f_broadcast(s);
+	Lck_Unlock(&s->pool->mtx);
+	h2f_sess_rel(s);
+}
+
+/*--------------------------------------------------------------------
+ * Connections
+ */
+
+static void
+h2f_pool_rel(struct h2f_pool *pool)
+{
+
+	CHECK_OBJ_NOTNULL(pool, H2F_POOL_MAGIC);
+	Lck_Lock(&pool->mtx);
+	assert(pool->refcnt > 0);
+	if (--pool->refcnt > 0) {
+		Lck_Unlock(&pool->mtx);
+		return;
+	}
+	AN(pool->dying);
+	assert(VTAILQ_EMPTY(&pool->sess));
+	Lck_Unlock(&pool->mtx);
+	Lck_Delete(&pool->mtx);
+	FREE_OBJ(pool);
+}
+
+static void
+h2f_sess_rel(struct h2f_sess *s)
+{
+	struct h2f_pool *pool;
+
+	CHECK_OBJ_NOTNULL(s, H2F_SESS_MAGIC);
+	pool = s->pool;
+	Lck_Lock(&pool->mtx);
+	assert(s->refcnt > 0);
+	if (--s->refcnt > 0) {
+		Lck_Unlock(&pool->mtx);
+		return;
+	}
+	AZ(s->nstreams);
+	VTAILQ_REMOVE(&pool->sess, s, list);
+	Lck_Unlock(&pool->mtx);
+
+	VTCP_close(&s->fd);
+	VHT_Fini(s->dectbl);
+	VHT_Fini(s->enctbl);
+	Lck_Delete(&s->txmtx);
+	free(s->rxbuf);
+	free(s->hblk);
+	FREE_OBJ(s);
+	h2f_pool_rel(pool);
+}
+
+static struct h2f_sess *
+h2f_sess_new(struct h2f_pool *pool, const struct backend *bp, double tmo)
+{
+	struct h2f_sess *s;
+	uint8_t buf[12];
+	uint64_t w;
+	int fd, i;
+	const struct suckaddr *sa;
+
+	fd = VBT_Open(bp->tcp_pool, tmo, &sa);
+	if (fd < 0)
+		return (NULL);
+
+	ALLOC_OBJ(s, H2F_SESS_MAGIC);
+	AN(s);
+	s->pool = pool;
+	s->fd = fd;
+	s->addr = sa;
+	s->refcnt = 1;		/* The reader */
+	s->next_id = 1;
+	VTAILQ_INIT(&s->streams);
+#define H2_SETTINGS(n,v,d)					\
+	do {							\
+		assert(v < H2_SETTINGS_N);			\
+		s->their_settings[v] = d;			\
+	} while (0);
+#include "tbl/h2_settings.h"
+#undef H2_SETTINGS
+	s->tx_window = 65535;
+	s->st_window = cache_param->h2_backend_window;
+	w = (uint64_t)s->st_window * cache_param->h2_backend_streams;
+	s->rx_window = w > 0x7fffffff ? 0x7fffffff : (unsigned)w;
+	Lck_New(&s->txmtx, lck_h2fetch);
+	AZ(VHT_Init(s->dectbl, H2F_TABLE_SIZE));
+	AZ(VHT_Init(s->enctbl, H2F_TABLE_SIZE));
+	s->enc_want = H2F_TABLE_SIZE;
+	s->enc_min = UINT32_MAX;
+	s->rxbuf = malloc(H2F_FRAME_MAX);
+	AN(s->rxbuf);
+
+	/* No PUSH_PROMISE, and our window, for streams and in all */
+	vbe16enc(buf, H2S_ENABLE_PUSH);
+	vbe32enc(buf + 2, 0);
+	vbe16enc(buf + 6, H2S_INITIAL_WINDOW_SIZE);
+	vbe32enc(buf + 8, s->st_window);
+	Lck_Lock(&s->txmtx);
+	i = write(fd, h2f_preface, sizeof h2f_preface - 1);
+	if (i != sizeof h2f_preface - 1)
+		s->tx_error = 1;
+	(void)h2f_send(s, H2_FRAME_SETTINGS, 0, sizeof buf, 0, buf);
+	if (s->rx_window > 65535)
+		h2f_send_u32(s, H2_FRAME_WINDOW_UPDATE, 0,
+		    s->rx_window - 65535);
+	i = s->tx_error;
+	Lck_Unlock(&s->txmtx);
+	if (i) {
+		VTCP_close(&s->fd);
+		VHT_Fini(s->dectbl);
+		VHT_Fini(s->enctbl);
+		Lck_Delete(&s->txmtx);
+		free(s->rxbuf);
+		FREE_OBJ(s);
+		return (NULL);
+	}
+	return (s);
+}
+
+/*
+ * Find a connection with room for one more stream, or make one.
+ * Returns with a reference to it for the stream.
+ */
+
+static struct h2f_sess *
+h2f_sess_get(struct busyobj *bo, const struct backend *bp, double tmo)
+{
+	struct h2f_pool *pool;
+	struct h2f_sess *s;
+	unsigned max;
+	char abuf1[VTCP_ADDRBUFSIZE], abuf2[VTCP_ADDRBUFSIZE];
+	char pbuf1[VTCP_PORTBUFSIZE], pbuf2[VTCP_PORTBUFSIZE];
+
+	pool = bp->h2f_pool;
+	CHECK_OBJ_NOTNULL(pool, H2F_POOL_MAGIC);
+
+	Lck_Lock(&pool->mtx);
+	VTAILQ_FOREACH(s, &pool->sess, list) {
+		max = s->their_settings[H2S_MAX_CONCURRENT_STREAMS];
+		if (max > cache_param->h2_backend_streams)
+			max = cache_param->h2_backend_streams;
+		if (!s->dead && !s->go_away && s->nstreams < max &&
+		    s->next_id <= H2F_STREAM_MAX)
+			break;
+	}
+	if (s != NULL) {
+		s->nstreams++;
+		s->refcnt++;
+		Lck_Unlock(&pool->mtx);
+		VSLb(bo->vsl, SLT_BackendReuse, "%d %s", s->fd,
+		    bp->display_name);
+		return (s);
+	}
+	Lck_Unlock(&pool->mtx);
+
+	s = h2f_sess_new(pool, bp, tmo);
+	if (s == NULL)
+		return (NULL);
+
+	VTCP_myname(s->fd, abuf1, sizeof abuf1, pbuf1, sizeof pbuf1);
+	VTCP_hisname(s->fd, abuf2, sizeof abuf2, pbuf2, sizeof pbuf2);
+	VSLb(bo->vsl, SLT_BackendOpen, "%d %s %s %s %s %s",
+	    s->fd, bp->display_name, abuf2, pbuf2, abuf1, pbuf1);
+
+	Lck_Lock(&pool->mtx);
+	VTAILQ_INSERT_HEAD(&pool->sess, s, list);
+	pool->refcnt++;
+	s->nstreams++;
+	s->refcnt++;
+	Lck_Unlock(&pool->mtx);
+
+	s->task.func = h2f_reader;
+	s->task.priv = s;
+	if (Pool_Task_Any(&s->task, TASK_QUEUE_BO)) {
+		/* No reader, no connection */
+		Lck_Lock(&pool->mtx);
+		s->dead = 1;
+		s->nstreams--;
+		s->refcnt--;
+		Lck_Unlock(&pool->mtx);
+		h2f_sess_rel(s);
+		return (NULL);
+	}
+	return (s);
+}
+
+/*--------------------------------------------------------------------
+ * The request
+ */
+
+static enum vhe_index_e
+h2f_index(const char *name, size_t namelen)
+{
+	static const struct {
+		const char		*name;
+		enum vhe_index_e	mode;
+	} *p, noidx[] = {
+		/* Different on (nearly) every request */
+		{ "content-length",	VHE_NOINDEX },
+		{ "if-modified-since",	VHE_NOINDEX },
+		{ "if-none-match",	VHE_NOINDEX },
+		{ "x-varnish",		VHE_NOINDEX },
+		/* Keep it away from any compressing intermediaries */
+		{ "authorization",	VHE_NEVER },
+		{ "cookie",		VHE_NEVER },
+		{ NULL,			VHE_INDEX }
+	};
+
+	for (p = noidx; p->name != NULL; p++)
+		if (strlen(p->name) == namelen &&
+		    !strncasecmp(p->name, name, namelen))
+			break;
+	return (p->mode);
+}
+
+/* The connection specific headers of HTTP/1 have no place in h2 */
+static const char * const h2f_hopbyhop[] = {
+	"\013Connection:",
+	"\013Keep-Alive:",
+	"\021Proxy-Connection:",
+	"\003TE:",
+	"\022Transfer-Encoding:",
+	"\010Upgrade:",
+	H_Host,
+	NULL
+};
+
+static size_t
+h2f_encode(struct h2f_sess *s, const struct http *hp, uint8_t *buf,
+    size_t len)
+{
+	const char *b, *r, *e, * const *hh;
+	size_t l = 0, sz, nl;
+	unsigned u;
+
+	Lck_AssertHeld(&s->txmtx);
+
+	if (s->enc_min < s->enctbl->maxsize && s->enc_min < s->enc_want)
+		l += VHE_TableSize(s->enctbl, buf + l, len - l, s->enc_min);
+	if (s->enc_want != s->enctbl->maxsize)
+		l += VHE_TableSize(s->enctbl, buf + l, len - l, s->enc_want);
+	s->enc_min = UINT32_MAX;
+
+#define H2F_PSEUDO(n, v, m)						\
+	do {								\
+		sz = VHE_Header(s->enctbl, buf + l, len - l,		\
+		    n, sizeof n - 1, v, strlen(v), m);			\
+		AN(sz);							\
+		l += sz;						\
+	} while (0)
+
+	H2F_PSEUDO(":method", hp->hd[HTTP_HDR_METHOD].b, VHE_INDEX);
+	H2F_PSEUDO(":scheme", "http", VHE_INDEX);
+	if (http_GetHdr(hp, H_Host, &b))
+		H2F_PSEUDO(":authority", b, VHE_INDEX);
+	H2F_PSEUDO(":path", hp->hd[HTTP_HDR_URL].b, VHE_NOINDEX);
+#undef H2F_PSEUDO
+
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		b = hp->hd[u].b;
+		e = hp->hd[u].e;
+		if (b == NULL)
+			continue;
+		for (hh = h2f_hopbyhop; *hh != NULL; hh++)
+			if (Tlen(hp->hd[u]) > (unsigned)**hh &&
+			    !strncasecmp(b, *hh + 1, **hh))
+				break;
+		if (*hh != NULL)
+			continue;
+		r = strchr(b, ':');
+		AN(r);
+		assert(r < e);
+		nl = r - b;
+		while (++r < e && vct_islws(*r))
+			continue;
+		sz = VHE_Header(s->enctbl, buf + l, len - l, b, nl,
+		    r, e - r, h2f_index(b, nl));
+		AN(sz);
+		l += sz;
+	}
+	return (l);
+}
+
+/*
+ * Open the stream, and send the headers, in one go under the txmtx,
+ * since the stream ids must go out in order.
+ */
+
+static int
+h2f_tx_headers(struct h2f_sess *s, struct h2f_stream *st,
+    struct busyobj *bo, int eos)
+{
+	const struct http *hp;
+	uint8_t *buf, flags;
+	size_t max, l, o, n;
+	unsigned u;
+	int i = 0;
+
+	hp = bo->bereq;
+	Lck_AssertHeld(&s->txmtx);
+
+	Lck_Lock(&s->pool->mtx);
+	if (s->dead || s->go_away || s->next_id > H2F_STREAM_MAX) {
+		Lck_Unlock(&s->pool->mtx);
+		return (1);
+	}
+	st->id = s->next_id;
+	s->next_id += 2;
+	st->tx_window = s->their_settings[H2S_INITIAL_WINDOW_SIZE];
+	VTAILQ_INSERT_TAIL(&s->streams, st, list);
+	Lck_Unlock(&s->pool->mtx);
+
+	/* Nothing encodes to more than the text plus a few length bytes */
+	max = 64 + Tlen(hp->hd[HTTP_HDR_METHOD]) + Tlen(hp->hd[HTTP_HDR_URL]);
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++)
+		max += Tlen(hp->hd[u]) + 15;
+	buf = malloc(max);
+	AN(buf);
+	l = h2f_encode(s, hp, buf, max);
+
+	/* HEADERS, and then CONTINUATION if it takes more frames */
+	for (o = 0; o == 0 || o < l; o += n) {
+		n = l - o;
+		if (n > s->their_settings[H2S_MAX_FRAME_SIZE])
+			n = s->their_settings[H2S_MAX_FRAME_SIZE];
+		flags = 0;
+		if (o == 0 && eos)
+			flags |= H2FF_HEADERS_END_STREAM;
+		if (o + n == l)
+			flags |= H2FF_HEADERS_END_HEADERS;
+		i = h2f_send(s, o == 0 ? H2_FRAME_HEADERS :
+		    H2_FRAME_CONTINUATION, flags, n, st->id, buf + o);
+		bo->acct.bereq_hdrbytes += 9 + n;
+		if (i || n == 0)
+			break;
+	}
+	free(buf);
+	return (i ? -1 : 0);
+}
+
+/*
+ * Take what the windows allow of the next DATA frame.
+ */
+
+static ssize_t
+h2f_tx_window(struct h2f_stream *st, ssize_t l, double tmo)
+{
+	struct h2f_sess *s;
+	double t;
+
+	s = st->sess;
+	t = VTIM_real() + tmo;
+	Lck_Lock(&s->pool->mtx);
+	while ((st->tx_window <= 0 || s->tx_window <= 0) && !s->dead &&
+	    !st->reset && st->error == NULL) {
+		if (Lck_CondWait(&st->cond, &s->pool->mtx, t) == ETIMEDOUT)
+			break;
+	}
+	if (s->dead || st->reset || st->error != NULL)
+		l = -1;
+	else if (st->tx_window <= 0 || s->tx_window <= 0)
+		l = 0;
+	else {
+		if (l > st->tx_window)
+			l = st->tx_window;
+		if (l > s->tx_window)
+			l = s->tx_window;
+		if (l > s->their_settings[H2S_MAX_FRAME_SIZE])
+			l = s->their_settings[H2S_MAX_FRAME_SIZE];
+		st->tx_window -= l;
+		s->tx_window -= l;
+	}
+	Lck_Unlock(&s->pool->mtx);
+	return (l);
+}
+
+static int __match_proto__(objiterate_f)
+h2f_iter_req_body(void *priv, int flush, const void *ptr, ssize_t l)
+{
+	struct busyobj *bo;
+	struct h2f_stream *st;
+	const uint8_t *p = ptr;
+	ssize_t n;
+	int i;
+
+	CAST_OBJ_NOTNULL(bo, priv, BUSYOBJ_MAGIC);
+	CAST_OBJ_NOTNULL(st, bo->htc->priv, H2F_STREAM_MAGIC);
+	(void)flush;
+
+	while (l > 0) {
+		n = h2f_tx_window(st, l, bo->htc->between_bytes_timeout);
+		if (n <= 0)
+			return (-1);
+		Lck_Lock(&st->sess->txmtx);
+		i = h2f_send(st->sess, H2_FRAME_DATA, 0, n, st->id, p);
+		Lck_Unlock(&st->sess->txmtx);
+		if (i)
+			return (-1);
+		bo->acct.bereq_bodybytes += n;
+		p += n;
+		l -= n;
+	}
+	return (0);
+}
+
+/*
+ * Returns 0 when the request is out, 1 if the stream was refused and
+ * can go elsewhere, -1 otherwise.
+ */
+
+static int
+h2f_sendreq(struct worker *wrk, struct busyobj *bo, const struct backend *bp,
+    double tmo)
+{
+	struct h2f_sess *s;
+	struct h2f_stream *st;
+	struct http_conn *htc;
+	char abuf[VTCP_ADDRBUFSIZE];
+	char pbuf[VTCP_PORTBUFSIZE];
+	int i, body;
+
+	htc = bo->htc;
+	AZ(htc->priv);
+
+	s = h2f_sess_get(bo, bp, tmo);
+	if (s == NULL) {
+		VSLb(bo->vsl, SLT_FetchError, "no backend connection");
+		return (-1);
+	}
+	ALLOC_OBJ(st, H2F_STREAM_MAGIC);
+	AN(st);
+	st->sess = s;
+	AZ(pthread_cond_init(&st->cond, NULL));
+	VTAILQ_INIT(&st->rxq);
+	htc->priv = st;
+	htc->rfd = &s->fd;
+
+	VTCP_hisname(s->fd, abuf, sizeof abuf, pbuf, sizeof pbuf);
+	VSLb(bo->vsl, SLT_BackendStart, "%s %s", abuf, pbuf);
+
+	body = bo->req != NULL && bo->req->req_body_status != REQ_BODY_NONE;
+	Lck_Lock(&s->txmtx);
+	i = h2f_tx_headers(s, st, bo, !body);
+	Lck_Unlock(&s->txmtx);
+	if (i > 0)
+		return (1);
+
+	if (i == 0 && body) {
+		i = VRB_Iterate(bo->req, h2f_iter_req_body, bo);
+		if (bo->req->req_body_status == REQ_BODY_FAIL) {
+			assert(i < 0);
+			VSLb(bo->vsl, SLT_FetchError,
+			    "req.body read error: %d (%s)",
+			    errno, strerror(errno));
+			bo->req->doclose = SC_RX_BODY;
+		}
+		if (i == 0) {
+			Lck_Lock(&s->txmtx);
+			i = h2f_send(s, H2_FRAME_DATA, H2FF_DATA_END_STREAM,
+			    0, st->id, NULL);
+			Lck_Unlock(&s->txmtx);
+		}
+	}
+	VSLb_ts_busyobj(bo, "Bereq", W_TIM_real(wrk));
+	if (i != 0) {
+		VSLb(bo->vsl, SLT_FetchError, "backend write error: %d (%s)",
+		    errno, strerror(errno));
+		htc->doclose = SC_TX_ERROR;
+		return (-1);
+	}
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * The response
+ */
+
+static int
+h2f_resphdrs(struct busyobj *bo)
+{
+	struct http_conn *htc;
+	struct h2f_stream *st;
+	struct h2f_sess *s;
+	struct http *hp;
+	char *p, *b, *e;
+	unsigned status = 0;
+	double t;
+	ssize_t cl;
+
+	htc = bo->htc;
+	CAST_OBJ_NOTNULL(st, htc->priv, H2F_STREAM_MAGIC);
+	s = st->sess;
+
+	t = VTIM_real() + htc->first_byte_timeout;
+	Lck_Lock(&s->pool->mtx);
+	while (!st->resp && !st->reset && st->error == NULL && !s->dead) {
+		if (Lck_CondWait(&st->cond, &s->pool->mtx, t) == ETIMEDOUT)
+			break;
+	}
+	Lck_Unlock(&s->pool->mtx);
+
+	if (!st->resp) {
+		if (st->reset && st->reset_code == H2SE_REFUSED_STREAM->val)
+			return (1);
+		if (st->reset)
+			VSLb(bo->vsl, SLT_FetchError,
+			    "backend reset the stream (%u)", st->reset_code);
+		else if (st->error != NULL)
+			VSLb(bo->vsl, SLT_FetchError, "%s", st->error);
+		else if (s->dead)
+			VSLb(bo->vsl, SLT_FetchError, "backend closed");
+		else
+			VSLb(bo->vsl, SLT_FetchError, "first byte timeout");
+		htc->doclose = s->dead ? SC_RESP_CLOSE : SC_RX_TIMEOUT;
+		return (-1);
+	}
+
+	/* The headers go on the workspace, like they would from HTC */
+	bo->acct.beresp_hdrbytes += st->hdrs_len;
+	p = WS_Copy(bo->ws, st->hdrs, st->hdrs_len);
+	if (p == NULL) {
+		VSLb(bo->vsl, SLT_FetchError, "overflow");
+		htc->doclose = SC_RX_OVERFLOW;
+		return (-1);
+	}
+	hp = bo->beresp;
+	e = p + st->hdrs_len;
+	for (b = p; b < e; b += strlen(b) + 1) {
+		if (*b != ':')
+			http_SetHeader(hp, b);
+		else if (!strncmp(b, ":status: ", 9) && status == 0 &&
+		    vct_isdigit(b[9]) && vct_isdigit(b[10]) &&
+		    vct_isdigit(b[11]) && b[12] == '\0')
+			status = (b[9] - '0') * 100 + (b[10] - '0') * 10 +
+			    (b[11] - '0');
+		else {
+			status = 0;
+			break;
+		}
+	}
+	if (status < 100) {
+		VSLb(bo->vsl, SLT_FetchError, "http format error");
+		htc->doclose = SC_RX_JUNK;
+		return (-1);
+	}
+	http_PutResponse(hp, "HTTP/2.0", status, NULL);
+
+	/*
+	 * The framing says where the body ends, Content-Length is only
+	 * here to be checked against it.
+	 */
+	cl = http_GetContentLength(hp);
+	htc->content_length = cl < 0 ? -1 : cl;
+	if (cl == -2)
+		htc->body_status = BS_ERROR;
+	else if (cl == 0 || (st->end_stream && VTAILQ_EMPTY(&st->rxq)))
+		htc->body_status = BS_NONE;
+	else if (cl > 0)
+		htc->body_status = BS_LENGTH;
+	else
+		htc->body_status = BS_EOF;
+	htc->doclose = SC_NULL;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * The body, as it comes off the stream.  priv2 is what Content-Length
+ * says remains, if it says anything.
+ */
+
+static enum vfp_status __match_proto__(vfp_pull_f)
+h2f_pull(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr, ssize_t *lp)
+{
+	struct http_conn *htc;
+	struct h2f_stream *st;
+	struct h2f_sess *s;
+	struct h2f_data *d;
+	uint8_t *p = ptr;
+	const char *err = NULL;
+	size_t l = 0, n;
+	int end;
+	double t;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
+	CAST_OBJ_NOTNULL(htc, vfe->priv1, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(st, htc->priv, H2F_STREAM_MAGIC);
+	AN(ptr);
+	AN(lp);
+	s = st->sess;
+
+	t = VTIM_real() + htc->between_bytes_timeout;
+	Lck_Lock(&s->pool->mtx);
+	while (VTAILQ_EMPTY(&st->rxq) && !st->end_stream && !st->reset &&
+	    st->error == NULL && !s->dead) {
+		if (Lck_CondWait(&st->cond, &s->pool->mtx, t) == ETIMEDOUT)
+			break;
+	}
+	while (l < (size_t)*lp && (d = VTAILQ_FIRST(&st->rxq)) != NULL) {
+		CHECK_OBJ_NOTNULL(d, H2F_DATA_MAGIC);
+		n = d->len - d->off;
+		if (n > (size_t)*lp - l)
+			n = (size_t)*lp - l;
+		memcpy(p + l, (uint8_t *)(d + 1) + d->off, n);
+		d->off += n;
+		l += n;
+		if (d->off == d->len) {
+			VTAILQ_REMOVE(&st->rxq, d, list);
+			FREE_OBJ(d);
+		}
+	}
+	st->rx_buffered -= l;
+	st->rx_credit += l;
+	s->rx_credit += l;
+	end = st->end_stream && VTAILQ_EMPTY(&st->rxq);
+	if (l == 0 && !end) {
+		if (st->reset)
+			err = "backend reset the stream";
+		else if (st->error != NULL)
+			err = st->error;
+		else if (s->dead)
+			err = "backend closed";
+		else
+			err = "timeout";
+	} else if (!end)
+		h2f_window_update(s, st);
+	Lck_Unlock(&s->pool->mtx);
+
+	*lp = l;
+	if (err != NULL)
+		return (VFP_Error(vc, "%s", err));
+	if (vfe->priv2 >= 0) {
+		if ((intptr_t)l > vfe->priv2)
+			return (VFP_Error(vc, "body longer than Content-Length"));
+		vfe->priv2 -= l;
+		if (end && vfe->priv2 > 0)
+			return (VFP_Error(vc, "body shorter than Content-Length"));
+	}
+	return (end ? VFP_END : VFP_OK);
+}
+
+static const struct vfp h2f_vfp = {
+	.name = "H2F",
+	.pull = h2f_pull,
+};
+
+/*--------------------------------------------------------------------*/
+
+int
+H2F_GetHdrs(struct worker *wrk, struct busyobj *bo, const struct backend *bp,
+    double tmo)
+{
+	int i, retry = 1;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+	CHECK_OBJ_ORNULL(bo->req, REQ_MAGIC);
+
+	VSC_C_main->backend_req++;
+	while (1) {
+		i = h2f_sendreq(wrk, bo, bp, tmo);
+		if (i == 0)
+			i = h2f_resphdrs(bo);
+		if (i <= 0)
+			return (i);
+
+		/*
+		 * A refused stream was never seen by the backend, so it
+		 * can go again, if req.body allows.
+		 */
+		H2F_Finish(bo);
+		if (!retry || (bo->req != NULL &&
+		    bo->req->req_body_status != REQ_BODY_NONE &&
+		    bo->req->req_body_status != REQ_BODY_CACHED)) {
+			VSLb(bo->vsl, SLT_FetchError, "stream refused");
+			return (-1);
+		}
+		retry = 0;
+		VSC_C_main->backend_retry++;
+	}
+}
+
+int
+H2F_Setup_Fetch(struct vfp_ctx *vfc, struct http_conn *htc)
+{
+	struct vfp_entry *vfe;
+
+	CHECK_OBJ_NOTNULL(vfc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	assert(htc->body_status == BS_LENGTH || htc->body_status == BS_EOF);
+
+	vfe = VFP_Push(vfc, &h2f_vfp, 0);
+	if (vfe == NULL)
+		return (ENOSPC);
+	vfe->priv1 = htc;
+	vfe->priv2 = htc->content_length;
+	return (0);
+}
+
+const struct suckaddr *
+H2F_GetIP(const struct busyobj *bo)
+{
+	struct h2f_stream *st;
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(st, bo->htc->priv, H2F_STREAM_MAGIC);
+	return (st->sess->addr);
+}
+
+/*
+ * Close the stream.  Whatever the backend has yet to send of it is
+ * cancelled, and what came and was not consumed is credited to the
+ * connection window.
+ */
+
+void
+H2F_Finish(struct busyobj *bo)
+{
+	struct h2f_stream *st;
+	struct h2f_sess *s;
+	struct h2f_data *d, *d2;
+	int cancel;
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	if (bo->htc->priv == NULL)
+		return;
+	CAST_OBJ_NOTNULL(st, bo->htc->priv, H2F_STREAM_MAGIC);
+	bo->htc->priv = NULL;
+	bo->htc->rfd = NULL;
+	s = st->sess;
+
+	Lck_Lock(&s->pool->mtx);
+	if (st->id != 0)
+		VTAILQ_REMOVE(&s->streams, st, list);
+	assert(s->nstreams > 0);
+	if (--s->nstreams == 0)
+		s->idle = VTIM_real();
+	cancel = st->id != 0 && !st->end_stream && !st->reset && !s->dead;
+	VTAILQ_FOREACH_SAFE(d, &st->rxq, list, d2) {
+		VTAILQ_REMOVE(&st->rxq, d, list);
+		s->rx_credit += d->len - d->off;
+		FREE_OBJ(d);
+	}
+	h2f_window_update(s, NULL);
+	Lck_Unlock(&s->pool->mtx);
+
+	if (cancel) {
+		Lck_Lock(&s->txmtx);
+		h2f_send_u32(s, H2_FRAME_RST_STREAM, st->id,
+		    H2SE_CANCEL->val);
+		Lck_Unlock(&s->txmtx);
+	}
+
+	free(st->hdrs);
+	AZ(pthread_cond_destroy(&st->cond));
+	FREE_OBJ(st);
+	h2f_sess_rel(s);
+}
+
+/*--------------------------------------------------------------------*/
+
+struct h2f_pool *
+H2F_New(void)
+{
+	struct h2f_pool *pool;
+
+	ALLOC_OBJ(pool, H2F_POOL_MAGIC);
+	AN(pool);
+	Lck_New(&pool->mtx, lck_h2fetch);
+	pool->refcnt = 1;
+	VTAILQ_INIT(&pool->sess);
+	return (pool);
+}
+
+/*
+ * The connections stay around until their readers see them idle,
+ * or hung up on, and the last of them takes the pool along.
+ */
+
+void
+H2F_Delete(struct h2f_pool **poolp)
+{
+	struct h2f_pool *pool;
+	struct h2f_sess *s;
+
+	TAKE_OBJ_NOTNULL(pool, poolp, H2F_POOL_MAGIC);
+	Lck_Lock(&pool->mtx);
+	pool->dying = 1;
+	VTAILQ_FOREACH(s, &pool->sess, list)
+		if (s->nstreams == 0)
+			(void)shutdown(s->fd, SHUT_RDWR);
+	Lck_Unlock(&pool->mtx);
+	h2f_pool_rel(pool);
+}
@@ -313,3 +313,105 @@ h2h_decode_bytes(struct h2_sess *h2, struct h2h_decode *d,
 			       complete header block */
 	return (d->error);
 }
+
+/**********************************************************************
+ * Response header encoding
+ */
+
+static enum vhe_index_e
+h2h_index(const char *name, size_t namelen)
+{
+	static const struct {
+		const char		*name;
+		enum vhe_index_e	mode;
+	} *p, noidx[] = {
+		/* Different on (nearly) every response */
+		{ "age",		VHE_NOINDEX },
+		{ "content-length",	VHE_NOINDEX },
+		{ "content-range",	VHE_NOINDEX },
+		{ "date",		VHE_NOINDEX },
+		{ "etag",		VHE_NOINDEX },
+		{ "expires",		VHE_NOINDEX },
+		{ "last-modified",	VHE_NOINDEX },
+		{ "x-varnish",		VHE_NOINDEX },
+		/* Keep it away from any compressing intermediaries */
+		{ "set-cookie",		VHE_NEVER },
+		{ NULL,			VHE_INDEX }
+	};
+
+	for (p = noidx; p->name != NULL; p++)
+		if (strlen(p->name) == namelen &&
+		    !strncasecmp(p->name, name, namelen))
+			break;
+	return (p->mode);
+}
+
+/*
+ * Encode the response headers of hp into buf, updating the session
+ * encoder table.  Must be called with the session mtx held, and the
+ * block must be sent before it is released.  Returns zero, with the
+ * table untouched, if the block will not fit in buf.
+ */
+
+size_t
+h2h_encode(struct h2_sess *h2, const struct http *hp, uint8_t *buf,
+    size_t len)
+{
+	const char *b, *r, *e;
+	char status[4];
+	size_t l, sz, nl, max, want;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	Lck_AssertHeld(&h2->sess->mtx);
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	AN(buf);
+
+	/* Nothing encodes to more than the text plus a few length bytes */
+	max = 2 * 6 + 1 + sizeof status;
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++)
+		max += Tlen(hp->hd[u]) + 15;
+	if (max > len) {
+		VSLb(hp->vsl, SLT_Error, "H2: No room for response headers");
+		return (0);
+	}
+
+	l = 0;
+	want = h2->their_settings[H2S_HEADER_TABLE_SIZE];
+	if (want > h2->enctbl->protomax)
+		want = h2->enctbl->protomax;
+	if (h2->enc_tblmin < h2->enc_tblsize && h2->enc_tblmin < want) {
+		/* The peer went lower in the meantime, tell it we did too */
+		l += VHE_TableSize(h2->enctbl, buf + l, len - l,
+		    h2->enc_tblmin);
+		h2->enc_tblsize = h2->enc_tblmin;
+	}
+	if (want != h2->enc_tblsize || want != h2->enctbl->maxsize) {
+		l += VHE_TableSize(h2->enctbl, buf + l, len - l, want);
+		h2->enc_tblsize = want;
+	}
+	h2->enc_tblmin = UINT32_MAX;
+
+	assert(hp->status >= 100 && hp->status <= 999);
+	bprintf(status, "%03u", hp->status);
+	sz = VHE_Header(h2->enctbl, buf + l, len - l, ":status", 7,
+	    status, 3, VHE_INDEX);
+	AN(sz);
+	l += sz;
+
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		b = hp->hd[u].b;
+		e = hp->hd[u].e;
+		r = strchr(b, ':');
+		AN(r);
+		assert(r < e);
+		nl = r - b;
+		while (++r < e && vct_islws(*r))
+			continue;
+		sz = VHE_Header(h2->enctbl, buf + l, len - l, b, nl,
+		    r, e - r, h2h_index(b, nl));
+		AN(sz);
+		l += sz;
+	}
+	return (l);
+}
@@ -31,11 +31,17 @@
 
 #include "cache/cache.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "cache/cache_filter.h"
+#include "cache/cache_pool.h"
 #include "cache/cache_transport.h"
+#include "hash/hash_slinger.h"
 #include "http2/cache_http2.h"
 
+#include "vct.h"
 #include "vend.h"
 #include "vtcp.h"
 #include "vtim.h"
@@ -99,7 +105,7 @@ static const uint8_t H2_settings[] = {
 	0x00, 0x03,
 	0x00, 0x00, 0x00, 0x64,
 	0x00, 0x04,
-	0x00, 0x00, 0xff, 0xff
+	0x00, 0x00, 0xff, 0xff		/* h2_rx_window goes here */
 };
 
 /**********************************************************************/
@@ -109,8 +115,6 @@ static const uint8_t H2_settings[] = {
 	__match_proto__(h2_frame_f) \
 	{ (void)wrk; (void)r2; VSLb(h2->vsl, SLT_Debug, "XXX implement " #l); INCOMPL(); }
 
-DUMMY_FRAME(data)
-DUMMY_FRAME(rst_stream)
 DUMMY_FRAME(push_promise)
 DUMMY_FRAME(continuation)
 
@@ -149,6 +153,10 @@ h2_new_sess(const struct worker *wrk, struct sess *sp, struct req *srq)
 		h2->htc->rfd = &sp->fd;
 		h2->sess = sp;
 		VTAILQ_INIT(&h2->streams);
+		VTAILQ_INIT(&h2->txq);
+		VTAILQ_INIT(&h2->rx_req);
+		VTAILQ_INIT(&h2->rx_bulk);
+		AZ(pthread_cond_init(&h2->cond, NULL));
 #define H2_SETTINGS(n,v,d)					\
 		do {						\
 			assert(v < H2_SETTINGS_N);		\
@@ -158,9 +166,17 @@ h2_new_sess(const struct worker *wrk, struct sess *sp, struct req *srq)
 #include "tbl/h2_settings.h"
 #undef H2_SETTINGS
 
-		/* XXX: Lacks a VHT_Fini counterpart. Will leak memory. */
+		h2->our_settings[H2S_INITIAL_WINDOW_SIZE] =
+		    cache_param->h2_rx_window;
+		h2->rx_window = 65535;
+		h2->rxf_buf = malloc(h2->our_settings[H2S_MAX_FRAME_SIZE]);
+		AN(h2->rxf_buf);
+
 		AZ(VHT_Init(h2->dectbl,
 			h2->our_settings[H2S_HEADER_TABLE_SIZE]));
+		AZ(VHT_Init(h2->enctbl, cache_param->h2_header_table_size));
+		h2->enc_tblsize = h2->their_settings[H2S_HEADER_TABLE_SIZE];
+		h2->enc_tblmin = UINT32_MAX;
 
 		SES_Reserve_xport_priv(sp, &up);
 		*up = (uintptr_t)h2;
@@ -191,6 +207,15 @@ h2_new_req(const struct worker *wrk, struct h2_sess *h2,
 	r2->h2sess = h2;
 	r2->stream = stream;
 	r2->req = req;
+	r2->urgency = H2_URGENCY_DEFAULT;
+	if (stream == 0) {
+		/* The connection window is not subject to SETTINGS */
+		r2->window = 65535;
+		h2->req0 = r2;
+	} else {
+		r2->window = h2->their_settings[H2S_INITIAL_WINDOW_SIZE];
+	}
+	r2->rx_window = h2->our_settings[H2S_INITIAL_WINDOW_SIZE];
 	req->transport_priv = r2;
 	// XXX: ordering ?
 	VTAILQ_INSERT_TAIL(&h2->streams, r2, list);
@@ -214,12 +239,19 @@ h2_del_req(struct worker *wrk, struct h2_req *r2)
 	/* XXX: PRIORITY reshuffle */
 	VTAILQ_REMOVE(&h2->streams, r2, list);
 	Lck_Unlock(&sp->mtx);
+	free(r2->rxbuf);
 	Req_Cleanup(sp, wrk, r2->req);
 	Req_Release(r2->req);
 	if (r)
 		return;
 
 	/* All streams gone, including stream #0, clean up */
+	AZ(h2->tx_busy);
+	assert(VTAILQ_EMPTY(&h2->txq));
+	AZ(pthread_cond_destroy(&h2->cond));
+	free(h2->rxf_buf);
+	VHT_Fini(h2->dectbl);
+	VHT_Fini(h2->enctbl);
 	req = h2->srq;
 	Req_Cleanup(sp, wrk, req);
 	Req_Release(req);
@@ -231,13 +263,15 @@ h2_del_req(struct worker *wrk, struct h2_req *r2)
  * 'd' must point to six bytes.
  */
 
-static void
+static h2_error
 h2_setting(struct h2_sess *h2, const uint8_t *d)
 {
+	struct h2_req *r2;
 	uint16_t x;
 	uint32_t y;
 	const char *n;
 	char nb[8];
+	int64_t delta;
 
 	x = vbe16dec(d);
 	y = vbe32dec(d + 2);
@@ -247,27 +281,41 @@ h2_setting(struct h2_sess *h2, const uint8_t *d)
 		n = nb;
 	}
 	VSLb(h2->vsl, SLT_Debug, "H2SETTING %s 0x%08x", n, y);
+	if (x == H2S_INITIAL_WINDOW_SIZE) {
+		if (y >= (1LU << 31))
+			return (H2CE_FLOW_CONTROL_ERROR);	// rfc7540 6.5.2
+		/* Applies to the windows of all open streams, 6.9.2 */
+		delta = (int64_t)y - h2->their_settings[x];
+		VTAILQ_FOREACH(r2, &h2->streams, list)
+			if (r2->stream != 0)
+				r2->window += delta;
+		AZ(pthread_cond_broadcast(&h2->cond));
+	}
+	if (x == H2S_HEADER_TABLE_SIZE && y < h2->enc_tblmin)
+		h2->enc_tblmin = y;	/* Acted on with the next HEADERS */
 	if (x > 0 && x < H2_SETTINGS_N)
 		h2->their_settings[x] = y;
+	return (0);
 }
 
 /**********************************************************************/
 
 static void
-h2_vsl_frame(const struct h2_sess *h2, const void *ptr, size_t len)
+h2_vsl_frame(const struct h2_sess *h2, const void *hdr, const void *body)
 {
 	const uint8_t *b;
 	struct vsb *vsb;
 	const char *p;
 	unsigned u;
 
-	AN(ptr);
-	assert(len >= 9);
-	b = ptr;
+	AN(hdr);
+	AN(body);
+	b = hdr;
+	u = vbe32dec(b) >> 8;
 
 	VSLb_bin(h2->vsl, SLT_H2RxHdr, 9, b);
-	if (len > 9)
-		VSLb_bin(h2->vsl, SLT_H2RxBody, len - 9, b + 9);
+	if (u > 0)
+		VSLb_bin(h2->vsl, SLT_H2RxBody, u, body);
 
 	vsb = VSB_new_auto();
 	AN(vsb);
@@ -277,14 +325,13 @@ h2_vsl_frame(const struct h2_sess *h2, const void *ptr, size_t len)
 	else
 		VSB_quote(vsb, b + 3, 1, VSB_QUOTE_HEX);
 
-	u = vbe32dec(b) >> 8;
 	VSB_printf(vsb, "[%u] ", u);
 	VSB_quote(vsb, b + 4, 1, VSB_QUOTE_HEX);
 	VSB_putc(vsb, ' ');
 	VSB_quote(vsb, b + 5, 4, VSB_QUOTE_HEX);
 	if (u > 0) {
 		VSB_putc(vsb, ' ');
-		VSB_quote(vsb, b + 9, len - 9, VSB_QUOTE_HEX);
+		VSB_quote(vsb, body, u, VSB_QUOTE_HEX);
 	}
 	AZ(VSB_finish(vsb));
 	VSLb(h2->vsl, SLT_Debug, "H2RXF %s", VSB_data(vsb));
@@ -342,21 +389,285 @@ h2_rx_window_update(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	r2->window += wu;
 	if (r2->window >= (1LLU << 31))
 		return (H2SE_FLOW_CONTROL_ERROR);
+	AZ(pthread_cond_broadcast(&h2->cond));
 	return (0);
 }
 
+/**********************************************************************
+ * Incoming RST_STREAM, the stream's worker finds out on its next
+ * attempt to receive or send.
+ */
+
+h2_error __match_proto__(h2_frame_f)
+h2_rx_rst_stream(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
+{
+
+	(void)wrk;
+	Lck_AssertHeld(&h2->sess->mtx);
+	if (h2->rxf_len != 4)
+		return (H2CE_FRAME_SIZE_ERROR);
+	if (h2->rxf_stream == 0 || r2->state == H2_S_IDLE)
+		return (H2CE_PROTOCOL_ERROR);		// rfc7540 6.4
+	VSLb(h2->vsl, SLT_Debug, "H2: stream %u reset (0x%x)",
+	    r2->stream, vbe32dec(h2->rxf_data));
+	r2->reset = 1;
+	AZ(pthread_cond_broadcast(&h2->cond));
+	return (0);
+}
+
+/**********************************************************************
+ * Incoming DATA
+ *
+ * The payload is copied into the stream's request body buffer, which
+ * holds all of our receive window, so a peer which respects the
+ * window cannot overrun it.  The window is handed back when the
+ * request body VFP has consumed the data.
+ *
+ * The connection window is handed back on receipt, the stream windows
+ * are what limits how much we buffer.
+ */
+
+static h2_error
+h2_rx_conn_window(struct worker *wrk, struct h2_sess *h2)
+{
+	uint8_t b[4];
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	if (h2->rxf_len > h2->rx_window)
+		return (H2CE_FLOW_CONTROL_ERROR);
+	h2->rx_window -= h2->rxf_len;
+	h2->rx_credit += h2->rxf_len;
+	if (h2->rx_credit >= 32768) {
+		vbe32enc(b, h2->rx_credit);
+		h2->rx_window += h2->rx_credit;
+		h2->rx_credit = 0;
+		(void)H2_Send_Frame(wrk, h2, H2_FRAME_WINDOW_UPDATE,
+		    0, sizeof b, 0, b);
+	}
+	return (0);
+}
+
+h2_error __match_proto__(h2_frame_f)
+h2_rx_data(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
+{
+	const uint8_t *p;
+	unsigned l, pad = 0;
+	h2_error h2e;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	if (h2->rxf_stream == 0 || r2->state == H2_S_IDLE)
+		return (H2CE_PROTOCOL_ERROR);		// rfc7540 6.1
+	h2e = h2_rx_conn_window(wrk, h2);
+	if (h2e)
+		return (h2e);
+	if (r2->state != H2_S_OPEN || r2->rxbuf == NULL || r2->rx_eof)
+		return (H2SE_STREAM_CLOSED);
+
+	p = h2->rxf_data;
+	l = h2->rxf_len;
+	if (l > r2->rx_window)
+		return (H2SE_FLOW_CONTROL_ERROR);
+	r2->rx_window -= l;
+	if (h2->rxf_flags & H2FF_DATA_PADDED) {
+		if (l < 1 || 1U + *p > l)
+			return (H2CE_PROTOCOL_ERROR);
+		pad = 1U + *p;
+		p++;
+		/* Padding counts against the window, give it back now */
+		r2->rx_credit += pad;
+	}
+	l -= pad;
+
+	if (r2->rxbuf_t + l > r2->rxbuf_len) {
+		memmove(r2->rxbuf, r2->rxbuf + r2->rxbuf_h,
+		    r2->rxbuf_t - r2->rxbuf_h);
+		r2->rxbuf_t -= r2->rxbuf_h;
+		r2->rxbuf_h = 0;
+	}
+	assert(r2->rxbuf_t + l <= r2->rxbuf_len);
+	memcpy(r2->rxbuf + r2->rxbuf_t, p, l);
+	r2->rxbuf_t += l;
+	if (h2->rxf_flags & H2FF_DATA_END_STREAM) {
+		r2->rx_eof = 1;
+		r2->state = H2_S_CLOS_REM;
+	}
+	AZ(pthread_cond_broadcast(&h2->cond));
+	return (0);
+}
+
+/**********************************************************************
+ * The req.body VFP, it takes the DATA out of the stream buffer and
+ * hands the window back to the peer as it goes.
+ */
+
+static enum vfp_status __match_proto__(vfp_pull_f)
+h2_vfp_body(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr, ssize_t *lp)
+{
+	struct h2_req *r2;
+	struct h2_sess *h2;
+	enum vfp_status retval;
+	uint8_t b[4];
+	unsigned u = 0;
+	ssize_t l;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
+	CAST_OBJ_NOTNULL(r2, vfe->priv1, H2_REQ_MAGIC);
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	AN(ptr);
+	AN(lp);
+
+	l = *lp;
+	*lp = 0;
+	Lck_Lock(&h2->sess->mtx);
+	while (r2->rxbuf_h == r2->rxbuf_t && !r2->rx_eof &&
+	    !r2->reset && !h2->rx_closed) {
+		if (Lck_CondWait(&h2->cond, &h2->sess->mtx,
+		    VTIM_real() + cache_param->timeout_idle) == ETIMEDOUT)
+			break;
+	}
+	if (r2->rxbuf_h < r2->rxbuf_t && !r2->reset) {
+		if (l > r2->rxbuf_t - r2->rxbuf_h)
+			l = r2->rxbuf_t - r2->rxbuf_h;
+		memcpy(ptr, r2->rxbuf + r2->rxbuf_h, l);
+		r2->rxbuf_h += l;
+		if (r2->rxbuf_h == r2->rxbuf_t)
+			r2->rxbuf_h = r2->rxbuf_t = 0;
+		*lp = l;
+		r2->rx_credit += l;
+		if (!r2->rx_eof && r2->rx_credit >= r2->rxbuf_len / 2) {
+			u = r2->rx_credit;
+			r2->rx_window += u;
+			r2->rx_credit = 0;
+		}
+		retval = VFP_OK;
+		if (r2->rx_eof && r2->rxbuf_h == r2->rxbuf_t)
+			retval = VFP_END;
+	} else if (r2->rx_eof && !r2->reset) {
+		retval = VFP_END;
+	} else {
+		retval = VFP_ERROR;
+	}
+	Lck_Unlock(&h2->sess->mtx);
+
+	if (u > 0) {
+		vbe32enc(b, u);
+		(void)H2_Send(vc->wrk, r2, 1, H2_FRAME_WINDOW_UPDATE, 0,
+		    sizeof b, b);
+	}
+	if (retval == VFP_ERROR)
+		return (VFP_Error(vc, "H2: no more request body"));
+	return (retval);
+}
+
+static const struct vfp h2_body = {
+	.name = "H2_BODY",
+	.pull = h2_vfp_body,
+};
+
+static void __match_proto__(vtr_req_body_f)
+h2_req_body(struct req *req)
+{
+	struct h2_req *r2;
+	struct vfp_entry *vfe;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
+	if (req->req_body_status == REQ_BODY_NONE)
+		return;
+	if (r2->rxbuf == NULL) {
+		/* The H1 request of a h2c upgrade */
+		req->req_body_status = REQ_BODY_FAIL;
+		return;
+	}
+	vfe = VFP_Push(req->vfc, &h2_body, 0);
+	if (vfe == NULL) {
+		req->req_body_status = REQ_BODY_FAIL;
+		return;
+	}
+	vfe->priv1 = r2;
+}
+
 /**********************************************************************
  * Incoming PRIORITY, possibly an ACK of one we sent.
+ *
+ * We do not keep the RFC 7540 dependency tree, browsers disagree too
+ * much on how to build it, but reduce it to an RFC 9218 urgency,
+ * which decides which worker queue a request goes on and the order
+ * the session writer sends DATA frames in.
+ *
+ * The weight maps linearly onto the urgency, 256 is 0 and 1 is 7,
+ * which fits the fixed weights Chrome and Safari send.  A stream that
+ * depends on a stream which never carried a request, the grouping
+ * nodes Firefox makes with PRIORITY frames, takes the urgency of that
+ * node instead, so what the browser puts in the same group goes out
+ * at the same urgency.
  */
 
+static h2_error
+h2_set_priority(const struct h2_sess *h2, struct h2_req *r2,
+    const uint8_t *p)
+{
+	const struct h2_req *r2p;
+	uint32_t dep;
+	unsigned weight;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	dep = vbe32dec(p) & ~(1U << 31);
+	weight = p[4] + 1U;
+	if (dep == r2->stream)
+		return (H2SE_PROTOCOL_ERROR);		// rfc7540 5.3.1
+	r2->urgency = (256 - weight) / 32;
+	assert(r2->urgency <= H2_URGENCY_MAX);
+	if (dep == 0)
+		return (0);
+	VTAILQ_FOREACH(r2p, &h2->streams, list)
+		if (r2p->stream == dep)
+			break;
+	if (r2p != NULL && r2p != r2 && r2p->state == H2_S_IDLE)
+		r2->urgency = r2p->urgency;
+	return (0);
+}
+
+/*
+ * The RFC 9218 priority request header trumps the frames, we only
+ * care for the urgency, "u=N", streams are always interleaved.
+ */
+
+static void
+h2_priority_hdr(struct h2_req *r2, const struct http *hp)
+{
+	const char *p;
+
+	if (!http_GetHdr(hp, "\011priority:", &p))
+		return;
+	for (; *p != '\0'; p++) {
+		if ((p[0] == 'u' && p[1] == '=') &&
+		    (p[2] >= '0' && p[2] <= '7') &&
+		    (p[3] == '\0' || p[3] == ',' || p[3] == ';' ||
+		    vct_issp(p[3]))) {
+			r2->urgency = p[2] - '0';
+			return;
+		}
+		/* Skip to the next dictionary member */
+		p = strchr(p, ',');
+		if (p == NULL)
+			return;
+		while (vct_issp(p[1]))
+			p++;
+	}
+}
+
 h2_error __match_proto__(h2_frame_f)
 h2_rx_priority(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
 
 	(void)wrk;
-	(void)h2;
 	xxxassert(r2->stream & 1);
-	return (0);
+	if (h2->rxf_len != 5)
+		return (H2SE_FRAME_SIZE_ERROR);		// rfc7540 6.3
+	return (h2_set_priority(h2, r2, h2->rxf_data));
 }
 
 /**********************************************************************
@@ -368,6 +679,7 @@ h2_rx_settings(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
 	const uint8_t *p = h2->rxf_data;
 	unsigned l = h2->rxf_len;
+	h2_error h2e;
 
 	(void)wrk;
 	(void)r2;
@@ -375,8 +687,11 @@ h2_rx_settings(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	if (h2->rxf_flags == H2FF_SETTINGS_ACK) {
 		XXXAZ(h2->rxf_len);
 	} else if (h2->rxf_flags == 0) {
-		for (;l >= 6; l -= 6, p += 6)
-			h2_setting(h2, p);
+		for (;l >= 6; l -= 6, p += 6) {
+			h2e = h2_setting(h2, p);
+			if (h2e)
+				return (h2e);
+		}
 		if (l > 0)
 			VSLb(h2->vsl, SLT_Debug,
 			    "NB: SETTINGS had %u dribble-bytes", l);
@@ -401,7 +716,11 @@ h2_do_req(struct worker *wrk, void *priv)
 	CAST_OBJ_NOTNULL(req, priv, REQ_MAGIC);
 	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
 	THR_SetRequest(req);
-	assert(CNT_Request(wrk, req) != REQ_FSM_DISEMBARK);
+	if (CNT_Request(wrk, req) == REQ_FSM_DISEMBARK) {
+		/* On a waiting list, see h2_reembark() */
+		THR_SetRequest(NULL);
+		return;
+	}
 	THR_SetRequest(NULL);
 	VSL(SLT_Debug, 0, "H2REQ CNT done");
 	/* XXX clean up req */
@@ -409,6 +728,38 @@ h2_do_req(struct worker *wrk, void *priv)
 	h2_del_req(wrk, r2);
 }
 
+static void __match_proto__(vtr_reembark_f)
+h2_reembark(struct worker *wrk, struct req *req)
+{
+	struct h2_req *r2;
+	struct h2_sess *h2;
+	char b[4];
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	assert(req->task.func == h2_do_req);
+
+	if (!SES_Reschedule_Req(req))
+		return;
+
+	/* Couldn't schedule, refuse the stream */
+	wrk->stats->busy_wakeup--;
+	wrk->stats->busy_killed++;
+	DSL(DBG_WAITINGLIST, req->vsl->wid, "kill from waiting list");
+	if (req->hash_objhead != NULL)
+		(void)HSH_DerefObjHead(wrk, &req->hash_objhead);
+	Lck_Lock(&h2->sess->mtx);
+	vbe32enc(b, H2SE_REFUSED_STREAM->val);
+	(void)H2_Send_Frame(wrk, h2, H2_FRAME_RST_STREAM,
+	    0, sizeof b, r2->stream, b);
+	Lck_Unlock(&h2->sess->mtx);
+	r2->state = H2_S_CLOSED;
+	h2_del_req(wrk, r2);
+}
+
 h2_error __match_proto__(h2_frame_f)
 h2_rx_headers(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
@@ -440,6 +791,7 @@ h2_rx_headers(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	req->t_req = VTIM_real();
 	req->t_prev = req->t_first;
 	VSLb_ts_req(req, "Start", req->t_first);
+	VSL_Trace(req->vsl, req->ws, req->sp->vxid, NULL, req->t_first);
 	VCL_Refresh(&wrk->vcl);
 	req->vcl = wrk->vcl;
 	wrk->vcl = NULL;
@@ -454,15 +806,29 @@ h2_rx_headers(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 		p += 1;
 	}
 	if (h2->rxf_flags & H2FF_HEADERS_PRIORITY) {
+		(void)h2_set_priority(h2, r2, p);
 		p += 5;
 		l -= 5;
 	}
 	XXXAZ(h2h_decode_bytes(h2, d, p, l));
 	XXXAZ(h2h_decode_fini(h2, d));
+	h2_priority_hdr(r2, req->http);
 	VSLb_ts_req(req, "Req", req->t_req);
 	http_SetH(req->http, HTTP_HDR_PROTO, "HTTP/2.0");
 
-	req->req_body_status = REQ_BODY_NONE;
+	if (h2->rxf_flags & H2FF_HEADERS_END_STREAM) {
+		req->req_body_status = REQ_BODY_NONE;
+		r2->state = H2_S_CLOS_REM;
+	} else {
+		r2->rxbuf_len = h2->our_settings[H2S_INITIAL_WINDOW_SIZE];
+		r2->rxbuf = malloc(r2->rxbuf_len);
+		AN(r2->rxbuf);
+		req->htc->content_length = http_GetContentLength(req->http);
+		if (req->htc->content_length >= 0)
+			req->req_body_status = REQ_BODY_WITH_LEN;
+		else
+			req->req_body_status = REQ_BODY_WITHOUT_LEN;
+	}
 	wrk->stats->client_req++;
 	wrk->stats->s_req++;
 	req->ws_req = WS_Snapshot(req->ws);
@@ -470,7 +836,12 @@ h2_rx_headers(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 
 	req->task.func = h2_do_req;
 	req->task.priv = req;
-	XXXAZ(Pool_Task(wrk->pool, &req->task, TASK_QUEUE_REQ));
+	req->task.fq_key = SES_FairKey(h2->sess, NULL);
+	/* Dispatched at the end of the batch, see h2_rxframe() */
+	if (r2->urgency > H2_URGENCY_DEFAULT)
+		VTAILQ_INSERT_TAIL(&h2->rx_bulk, &req->task, list);
+	else
+		VTAILQ_INSERT_TAIL(&h2->rx_req, &req->task, list);
 	return (0);
 }
 
@@ -502,8 +873,8 @@ h2_frame_complete(struct http_conn *htc)
 	if (l < 9)
 		return (HTC_S_MORE);
 	u = vbe32dec(htc->rxbuf_b) >> 8;
-	VSL(SLT_Debug, 0, "RX %p %d %u", htc->rxbuf_b, l, u);
-	if (l < u + 9)	// XXX: Only for !DATA frames
+	/* The DATA payload is read separately, see h2_rxframe() */
+	if (l < u + 9 && htc->rxbuf_b[3] != H2_FRAME_DATA)
 		return (HTC_S_MORE);
 	return (HTC_S_COMPLETE);
 }
@@ -539,6 +910,17 @@ h2_procframe(struct worker *wrk, struct h2_sess *h2)
 	VTAILQ_FOREACH(r2, &h2->streams, list)
 		if (r2->stream == h2->rxf_stream)
 			break;
+	if (r2 == NULL && h2->rxf_stream <= h2->highest_stream &&
+	    h2->htc->rxbuf_b[3] == H2_FRAME_DATA) {
+		/* Request body for a stream we are done with */
+		h2e = h2_rx_conn_window(wrk, h2);
+		if (h2e)
+			return (h2e);
+		vbe32enc(b, H2SE_STREAM_CLOSED->val);
+		(void)H2_Send_Frame(wrk, h2, H2_FRAME_RST_STREAM,
+		    0, sizeof b, h2->rxf_stream, b);
+		return (0);
+	}
 	if (r2 == NULL) {
 		if (h2->rxf_stream <= h2->highest_stream)
 			return (H2CE_PROTOCOL_ERROR);	// rfc7540 5.1.1
@@ -577,25 +959,53 @@ h2_procframe(struct worker *wrk, struct h2_sess *h2)
 	vbe32enc(b, h2e->val);
 	(void)H2_Send_Frame(wrk, h2, H2_FRAME_RST_STREAM,
 	    0, sizeof b, h2->rxf_stream, b);
+	if (r2->state != H2_S_IDLE) {
+		/* A worker has the stream, let it clean up */
+		r2->reset = 1;
+		AZ(pthread_cond_broadcast(&h2->cond));
+		return (0);
+	}
 	Lck_Unlock(&h2->sess->mtx);
 	h2_del_req(wrk, r2);
 	Lck_Lock(&h2->sess->mtx);
 	return (0);
 }
 
+/**********************************************************************
+ * Hand the streams which got their headers in this batch to the pool,
+ * taking the pool lock once per priority rather than once per stream.
+ */
+
+static void
+h2_rx_dispatch(struct worker *wrk, struct h2_sess *h2)
+{
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	XXXAZ(Pool_Task_List(wrk->pool, &h2->rx_req, TASK_QUEUE_REQ));
+	XXXAZ(Pool_Task_List(wrk->pool, &h2->rx_bulk, TASK_QUEUE_BULK));
+}
+
+/**********************************************************************
+ * Read as much as the workspace holds and process all the complete
+ * frames in it under one hold of the session mutex.  A partial frame
+ * at the end is left in the pipeline for the next read.
+ */
+
 static int
 h2_rxframe(struct worker *wrk, struct h2_sess *h2)
 {
 	enum htc_status_e hs;
 	h2_error h2e;
 	char b[8];
+	uint8_t *next;
+	ssize_t l, i;
 
 	(void)VTCP_blocking(*h2->htc->rfd);
 	h2->sess->t_idle = VTIM_real();
 	hs = HTC_RxStuff(h2->htc, h2_frame_complete,
 	    NULL, NULL, NAN,
 	    h2->sess->t_idle + cache_param->timeout_idle + 100,
-	    1024);
+	    INT_MAX);
 	if (hs != HTC_S_COMPLETE) {
 		Lck_Lock(&h2->sess->mtx);
 		VSLb(h2->vsl, SLT_Debug, "H2: No frame (hs=%d)", hs);
@@ -603,17 +1013,56 @@ h2_rxframe(struct worker *wrk, struct h2_sess *h2)
 		return (0);
 	}
 
-	h2->rxf_len =  vbe32dec(h2->htc->rxbuf_b) >> 8;
-	h2->rxf_flags = h2->htc->rxbuf_b[4];
-	h2->rxf_stream = vbe32dec(h2->htc->rxbuf_b + 5);
-	h2->rxf_data = (void*)(h2->htc->rxbuf_b + 9);
-	/* XXX: later full DATA will not be rx'ed yet. */
-	HTC_RxPipeline(h2->htc, h2->htc->rxbuf_b + h2->rxf_len + 9);
+	h2e = NULL;
+	Lck_Lock(&h2->sess->mtx);
+	do {
+		h2->rxf_len =  vbe32dec(h2->htc->rxbuf_b) >> 8;
+		h2->rxf_flags = h2->htc->rxbuf_b[4];
+		h2->rxf_stream = vbe32dec(h2->htc->rxbuf_b + 5);
+		h2->rxf_data = (void*)(h2->htc->rxbuf_b + 9);
+		next = h2->rxf_data + h2->rxf_len;
+
+		if (h2->rxf_len > h2->our_settings[H2S_MAX_FRAME_SIZE]) {
+			h2e = H2CE_FRAME_SIZE_ERROR;	// rfc7540 4.2
+			h2_vsl_frame(h2, h2->htc->rxbuf_b, h2->rxf_data);
+			break;
+		}
 
-	h2_vsl_frame(h2, h2->htc->rxbuf_b, 9L + h2->rxf_len);
+		l = h2->htc->rxbuf_e - (h2->htc->rxbuf_b + 9);
+		if (l < h2->rxf_len) {
+			/*
+			 * A DATA payload larger than what we have, it may be
+			 * larger than our rx buffer too.  Read the rest of
+			 * it on the side, which ends this batch.
+			 */
+			assert(h2->htc->rxbuf_b[3] == H2_FRAME_DATA);
+			h2_rx_dispatch(wrk, h2);
+			Lck_Unlock(&h2->sess->mtx);
+			memcpy(h2->rxf_buf, h2->rxf_data, l);
+			h2->rxf_data = h2->rxf_buf;
+			next = (void*)h2->htc->rxbuf_e;
+			while (l < h2->rxf_len) {
+				i = VTCP_read(*h2->htc->rfd, h2->rxf_buf + l,
+				    h2->rxf_len - l, cache_param->timeout_idle);
+				if (i <= 0) {
+					Lck_Lock(&h2->sess->mtx);
+					VSLb(h2->vsl, SLT_Debug,
+					    "H2: Short DATA frame (%zd)", l);
+					Lck_Unlock(&h2->sess->mtx);
+					return (0);
+				}
+				l += i;
+			}
+			Lck_Lock(&h2->sess->mtx);
+		}
 
-	Lck_Lock(&h2->sess->mtx);
-	h2e = h2_procframe(wrk, h2);
+		h2_vsl_frame(h2, h2->htc->rxbuf_b, h2->rxf_data);
+		h2e = h2_procframe(wrk, h2);
+		h2->htc->rxbuf_b = (void*)next;
+	} while (h2e == NULL &&
+	    h2_frame_complete(h2->htc) == HTC_S_COMPLETE);
+
+	h2_rx_dispatch(wrk, h2);
 	if (h2e) {
 		VSLb(h2->vsl, SLT_Debug, "H2: stream 0: %s", h2e->txt);
 		vbe32enc(b, h2->highest_stream);
@@ -622,7 +1071,10 @@ h2_rxframe(struct worker *wrk, struct h2_sess *h2)
 		    0, sizeof b, 0, b);
 	}
 	Lck_Unlock(&h2->sess->mtx);
-	return (h2e ? 0 : 1);
+	if (h2e)
+		return (0);
+	HTC_RxPipeline(h2->htc, h2->htc->rxbuf_b);
+	return (1);
 }
 
 
@@ -671,7 +1123,8 @@ h2_b64url_settings(struct h2_sess *h2, struct req *req)
 		n -= 8;
 		if (up == u + sizeof u) {
 			AZ(n);
-			h2_setting(h2, (void*)u);
+			if (h2_setting(h2, (void*)u))
+				return (-1);
 			up = u;
 		}
 	}
@@ -705,6 +1158,154 @@ h2_new_pu_session(struct worker *wrk, const struct h2_sess *h2)
 	return (1);
 }
 
+/**********************************************************************
+ * The receive side of a session ends, one way or another.
+ */
+
+static void
+h2_rx_fini(struct worker *wrk, struct h2_sess *h2)
+{
+	struct h2_req *r2, *r22;
+
+	/* Nobody will see WINDOW_UPDATEs now, wake any stream waiting */
+	Lck_Lock(&h2->sess->mtx);
+	h2->rx_closed = 1;
+	AZ(pthread_cond_broadcast(&h2->cond));
+	Lck_Unlock(&h2->sess->mtx);
+
+	/* Delete all idle streams */
+	VTAILQ_FOREACH_SAFE(r2, &h2->streams, list, r22) {
+		if (r2->state == H2_S_IDLE)
+			h2_del_req(wrk, r2);
+	}
+}
+
+/**********************************************************************
+ * With h2_park, a session with no streams but #0 and nothing in the
+ * pipeline gives its thread back and waits on the waiter, like HTTP/1
+ * does between requests.  The session mutex is not held while parked:
+ * without streams nobody else touches the session.
+ *
+ * The waiter may call back before the parking thread is done, so we
+ * enter it last.
+ */
+
+static task_func_t h2_unparked;
+static void h2_rx_loop(struct worker *, struct h2_sess *, uintptr_t);
+
+static void __match_proto__(waiter_handle_f)
+h2_unpark(struct waited *wp, enum wait_event ev, double now)
+{
+	struct h2_sess *h2;
+
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	CAST_OBJ_NOTNULL(h2, wp->priv1, H2_SESS_MAGIC);
+	(void)now;
+	assert(wp == h2->park);
+	wp->priv2 = ev;
+	h2->rx_task.func = h2_unparked;
+	h2->rx_task.priv = h2;
+	h2->rx_task.fq_key = SES_FairKey(h2->sess, NULL);
+	if (!Pool_Task(h2->sess->pool, &h2->rx_task, TASK_QUEUE_REQ))
+		return;
+	/* Overloaded, the VCA queue never drops to tear it down */
+	wp->priv2 = WAITER_CLOSE;
+	AZ(Pool_Task(h2->sess->pool, &h2->rx_task, TASK_QUEUE_VCA));
+}
+
+static int
+h2_park(struct worker *wrk, struct h2_sess *h2)
+{
+	struct waited *wp;
+	const struct h2_req *r2;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+
+	if (!cache_param->h2_park || h2->htc->pipeline_b != NULL)
+		return (0);
+	Lck_Lock(&h2->sess->mtx);
+	VTAILQ_FOREACH(r2, &h2->streams, list)
+		if (r2 != h2->req0)
+			break;
+	if (r2 != NULL || h2->go_away || h2->tx_busy ||
+	    !VTAILQ_EMPTY(&h2->txq)) {
+		Lck_Unlock(&h2->sess->mtx);
+		return (0);
+	}
+	Lck_Unlock(&h2->sess->mtx);
+
+	if (h2->park == NULL)
+		h2->park = WS_Alloc(h2->ws, sizeof *h2->park);
+	if (h2->park == NULL || VTCP_nonblocking(h2->sess->fd))
+		return (0);
+
+	wrk->stats->h2_parked++;
+	h2->sess->t_idle = VTIM_real();
+	wp = h2->park;
+	INIT_OBJ(wp, WAITED_MAGIC);
+	wp->fd = h2->sess->fd;
+	wp->priv1 = h2;
+	wp->idle = h2->sess->t_idle;
+	wp->func = h2_unpark;
+	wp->tmo = &cache_param->timeout_idle;
+	THR_SetRequest(NULL);
+	if (Wait_Enter(wrk->pool->waiter, wp))
+		h2_unpark(wp, WAITER_ACTION, 0.);
+	return (1);
+}
+
+static void __match_proto__(task_func_t)
+h2_unparked(struct worker *wrk, void *priv)
+{
+	struct h2_sess *h2;
+	enum wait_event ev;
+	uintptr_t wsp;
+	char b[8];
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(h2, priv, H2_SESS_MAGIC);
+	CHECK_OBJ_NOTNULL(h2->park, WAITED_MAGIC);
+	ev = (enum wait_event)h2->park->priv2;
+	h2->park->magic = 0;
+
+	THR_SetRequest(h2->srq);
+	if (ev == WAITER_ACTION) {
+		wsp = WS_Snapshot(wrk->aws);
+		HTC_RxInit(h2->htc, wrk->aws);
+		h2_rx_loop(wrk, h2, wsp);
+		return;
+	}
+
+	Lck_Lock(&h2->sess->mtx);
+	VSLb(h2->vsl, SLT_Debug, "H2: parked session ends (ev=%d)", ev);
+	if (ev != WAITER_REMCLOSE) {
+		vbe32enc(b, h2->highest_stream);
+		vbe32enc(b + 4, H2CE_NO_ERROR->val);
+		(void)H2_Send_Frame(wrk, h2, H2_FRAME_GOAWAY,
+		    0, sizeof b, 0, b);
+	}
+	Lck_Unlock(&h2->sess->mtx);
+	h2_rx_fini(wrk, h2);
+}
+
+/**********************************************************************
+ * Receive frames until the session ends or parks.
+ */
+
+static void
+h2_rx_loop(struct worker *wrk, struct h2_sess *h2, uintptr_t wsp)
+{
+
+	while (h2_rxframe(wrk, h2)) {
+		WS_Reset(wrk->aws, wsp);
+		if (h2_park(wrk, h2))
+			return;
+		HTC_RxInit(h2->htc, wrk->aws);
+	}
+	h2_rx_fini(wrk, h2);
+}
+
 /**********************************************************************/
 
 static int
@@ -737,6 +1338,7 @@ h2_new_ou_session(struct worker *wrk, struct h2_sess *h2,
 	req->transport = &H2_transport;
 	req->task.func = h2_do_req;
 	req->task.priv = req;
+	req->task.fq_key = SES_FairKey(h2->sess, NULL);
 	req->err_code = 0;
 	http_SetH(req->http, HTTP_HDR_PROTO, "HTTP/2.0");
 	XXXAZ(Pool_Task(wrk->pool, &req->task, TASK_QUEUE_REQ));
@@ -764,8 +1366,8 @@ h2_new_session(struct worker *wrk, void *arg)
 	struct req *req;
 	struct sess *sp;
 	struct h2_sess *h2;
-	struct h2_req *r2, *r22;
 	uintptr_t wsp;
+	uint8_t settings[sizeof H2_settings];
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CAST_OBJ_NOTNULL(req, arg, REQ_MAGIC);
@@ -807,22 +1409,15 @@ h2_new_session(struct worker *wrk, void *arg)
 
 	THR_SetRequest(h2->srq);
 
+	memcpy(settings, H2_settings, sizeof settings);
+	vbe32enc(settings + 8, h2->our_settings[H2S_INITIAL_WINDOW_SIZE]);
 	H2_Send_Frame(wrk, h2,
-	    H2_FRAME_SETTINGS, H2FF_NONE, sizeof H2_settings, 0, H2_settings);
+	    H2_FRAME_SETTINGS, H2FF_NONE, sizeof settings, 0, settings);
 
 	/* and off we go... */
 	Lck_Unlock(&h2->sess->mtx);
 
-	while (h2_rxframe(wrk, h2)) {
-		WS_Reset(wrk->aws, wsp);
-		HTC_RxInit(h2->htc, wrk->aws);
-	}
-
-	/* Delete all idle streams */
-	VTAILQ_FOREACH_SAFE(r2, &h2->streams, list, r22) {
-		if (r2->state == H2_S_IDLE)
-			h2_del_req(wrk, r2);
-	}
+	h2_rx_loop(wrk, h2, wsp);
 }
 
 struct transport H2_transport = {
@@ -830,5 +1425,7 @@ struct transport H2_transport = {
 	.magic =		TRANSPORT_MAGIC,
 	.new_session =		h2_new_session,
 	.sess_panic =		h2_sess_panic,
+	.req_body =		h2_req_body,
 	.deliver =		h2_deliver,
+	.reembark =		h2_reembark,
 };
@@ -31,10 +31,53 @@
 
 #include "cache/cache.h"
 
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <stdlib.h>
+
 #include "cache/cache_transport.h"
 #include "http2/cache_http2.h"
 
 #include "vend.h"
+#include "vtim.h"
+
+/*
+ * Frames are not written by whoever produces them, but put on the
+ * session transmit queue.  The first sender to find nobody writing
+ * becomes the writer for the session, and takes everything queued
+ * by then out in a single writev(2), without holding the session mtx.
+ *
+ * A stream has at most one frame on the queue at a time, and waits
+ * for it to be written before it gets to queue the next, so the
+ * streams on a session take turns frame by frame, and a large body
+ * cannot hold back the small ones behind it.
+ *
+ * Once its own frame is out, a writer hands the job to one of the
+ * waiting streams, but queued control frames, which nobody waits
+ * for, are written before it leaves.
+ *
+ * The queue is kept in priority order: everything but DATA first, in
+ * the order it was queued, so HEADERS and their CONTINUATIONs stay
+ * together, then DATA by stream urgency.  Streams of equal urgency
+ * still take turns, a stream goes to the back of its urgency when it
+ * queues its next frame.
+ */
+
+#define H2_TX_NIOV	64
+
+struct h2_txf {
+	unsigned			magic;
+#define H2_TXF_MAGIC			0x5d4a3b18
+	VTAILQ_ENTRY(h2_txf)		list;
+	uint8_t				hdr[9];
+	int				owned;	/* Nobody waits, free it */
+	unsigned			prio;	/* Lower goes first */
+	int				done;
+	int				error;
+	uint32_t			len;
+	const void			*ptr;
+};
 
 static void
 h2_mk_hdr(uint8_t *hdr, enum h2_frame_e type, uint8_t flags,
@@ -49,37 +92,233 @@ h2_mk_hdr(uint8_t *hdr, enum h2_frame_e type, uint8_t flags,
 	vbe32enc(hdr + 5, stream);
 }
 
+static void
+h2_tx_enqueue(struct h2_sess *h2, struct h2_txf *txf, enum h2_frame_e type,
+    uint8_t flags, uint32_t len, uint32_t stream, const void *ptr)
+{
+	struct h2_txf *txf2;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	h2_mk_hdr(txf->hdr, type, flags, len, stream);
+	txf->len = len;
+	txf->ptr = ptr;
+	VSLb_bin(h2->vsl, SLT_H2TxHdr, 9, txf->hdr);
+	if (len > 0)
+		VSLb_bin(h2->vsl, SLT_H2TxBody, len, ptr);
+	if (type != H2_FRAME_DATA)
+		txf->prio = 0;
+	VTAILQ_FOREACH(txf2, &h2->txq, list)
+		if (txf2->prio > txf->prio)
+			break;
+	if (txf2 != NULL)
+		VTAILQ_INSERT_BEFORE(txf2, txf, list);
+	else
+		VTAILQ_INSERT_TAIL(&h2->txq, txf, list);
+	if (!txf->owned)
+		h2->tx_nwait++;
+}
+
+static int
+h2_tx_writev(int fd, struct iovec *iov, int niov)
+{
+	ssize_t l;
+
+	while (niov > 0) {
+		l = writev(fd, iov, niov);
+		if (l <= 0)
+			return (-1);
+		/* Prune what was sent, and retry with the rest */
+		for (; niov > 0 && l >= (ssize_t)iov->iov_len; iov++, niov--)
+			l -= iov->iov_len;
+		if (niov > 0) {
+			iov->iov_base = (char *)iov->iov_base + l;
+			iov->iov_len -= l;
+		}
+	}
+	return (0);
+}
+
+/*
+ * Write out the queue, until our own frame (if any) is written and
+ * someone else can take over.  With unlock == 0 the session mtx is
+ * held across the writes, this is for the session thread itself.
+ */
+
+static void
+h2_tx_run(struct h2_sess *h2, const struct h2_txf *mine, int unlock)
+{
+	struct h2_txf_s batch;
+	struct h2_txf *txf, *txf2;
+	struct iovec iov[H2_TX_NIOV];
+	int niov, err;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	AZ(h2->tx_busy);
+	h2->tx_busy = 1;
+	while (!VTAILQ_EMPTY(&h2->txq) &&
+	    (mine == NULL || !mine->done || h2->tx_nwait == 0)) {
+		VTAILQ_INIT(&batch);
+		niov = 0;
+		VTAILQ_FOREACH_SAFE(txf, &h2->txq, list, txf2) {
+			if (niov + 2 > H2_TX_NIOV)
+				break;
+			VTAILQ_REMOVE(&h2->txq, txf, list);
+			VTAILQ_INSERT_TAIL(&batch, txf, list);
+			if (!txf->owned)
+				h2->tx_nwait--;
+			iov[niov].iov_base = txf->hdr;
+			iov[niov++].iov_len = sizeof txf->hdr;
+			if (txf->len > 0) {
+				iov[niov].iov_base = TRUST_ME(txf->ptr);
+				iov[niov++].iov_len = txf->len;
+			}
+		}
+
+		err = h2->tx_error;
+		if (!err) {
+			if (unlock)
+				Lck_Unlock(&h2->sess->mtx);
+			err = h2_tx_writev(h2->sess->fd, iov, niov);
+			if (unlock)
+				Lck_Lock(&h2->sess->mtx);
+			if (err) {
+				VSLb(h2->vsl, SLT_Debug,
+				    "H2: Write error: %s", strerror(errno));
+				h2->tx_error = 1;
+			}
+		}
+
+		VTAILQ_FOREACH_SAFE(txf, &batch, list, txf2) {
+			CHECK_OBJ_NOTNULL(txf, H2_TXF_MAGIC);
+			if (txf->owned) {
+				FREE_OBJ(txf);
+				continue;
+			}
+			txf->error = err;
+			txf->done = 1;
+		}
+		AZ(pthread_cond_broadcast(&h2->cond));
+	}
+	h2->tx_busy = 0;
+	AZ(pthread_cond_broadcast(&h2->cond));
+}
+
 /*
  * This is the "raw" frame sender, all per stream accounting and
  * prioritization must have happened before this is called, and
  * the session mtx must be held.
+ *
+ * The frame is copied, so the caller does not have to wait for it.
  */
 
+static void
+h2_tx_copy(struct h2_sess *h2, enum h2_frame_e type, uint8_t flags,
+    uint32_t len, uint32_t stream, const void *ptr)
+{
+	struct h2_txf *txf;
+	void *p;
+
+	p = malloc(sizeof *txf + len);
+	AN(p);
+	txf = p;
+	INIT_OBJ(txf, H2_TXF_MAGIC);
+	txf->owned = 1;
+	if (len > 0)
+		memcpy(txf + 1, ptr, len);
+	h2_tx_enqueue(h2, txf, type, flags, len, stream, txf + 1);
+}
+
 int
-H2_Send_Frame(struct worker *wrk, const struct h2_sess *h2,
+H2_Send_Frame(struct worker *wrk, struct h2_sess *h2,
     enum h2_frame_e type, uint8_t flags,
     uint32_t len, uint32_t stream, const void *ptr)
 {
-	uint8_t hdr[9];
 
 	Lck_AssertHeld(&h2->sess->mtx);
 	(void)wrk;
 
-	h2_mk_hdr(hdr, type, flags, len, stream);
-	VSLb_bin(h2->vsl, SLT_H2TxHdr, 9, hdr);
+	h2_tx_copy(h2, type, flags, len, stream, ptr);
+	if (!h2->tx_busy)
+		h2_tx_run(h2, NULL, 0);
+	return (h2->tx_error ? -1 : 0);
+}
 
-	/*XXX*/(void)write(h2->sess->fd, hdr, sizeof hdr);
-	if (len > 0) {
-		/*XXX*/(void)write(h2->sess->fd, ptr, len);
-		VSLb_bin(h2->vsl, SLT_H2TxBody, len, ptr);
+/*
+ * Wait for a queued frame to be written.
+ */
+
+static int
+h2_tx_wait(struct h2_sess *h2, struct h2_txf *txf)
+{
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	while (!txf->done) {
+		if (!h2->tx_busy)
+			h2_tx_run(h2, txf, 1);
+		else
+			AZ(Lck_CondWait(&h2->cond, &h2->sess->mtx, 0));
 	}
-	return (0);
+	return (txf->error ? -1 : 0);
+}
+
+/*
+ * Queue a frame, and wait for it to be written.  prio is the urgency
+ * of the stream, it only matters for DATA.
+ */
+
+static int
+h2_send_frame(struct h2_sess *h2, enum h2_frame_e type, uint8_t flags,
+    uint32_t len, uint32_t stream, unsigned prio, const void *ptr)
+{
+	struct h2_txf txf[1];
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	INIT_OBJ(txf, H2_TXF_MAGIC);
+	txf->prio = 1 + prio;
+	h2_tx_enqueue(h2, txf, type, flags, len, stream, ptr);
+	return (h2_tx_wait(h2, txf));
+}
+
+/*
+ * Wait for send window in both the stream and the connection, and
+ * take up to len bytes of it.  Returns zero if no window opened up
+ * within idle_send_timeout.
+ */
+
+static uint32_t
+h2_tx_window(struct h2_sess *h2, struct h2_req *r2, uint32_t len)
+{
+	struct h2_req *r0;
+	int64_t w;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	r0 = h2->req0;
+	CHECK_OBJ_NOTNULL(r0, H2_REQ_MAGIC);
+	while (r2->window <= 0 || r0->window <= 0) {
+		if (h2->tx_error || h2->rx_closed)
+			return (0);
+		if (Lck_CondWait(&h2->cond, &h2->sess->mtx,
+		    VTIM_real() + cache_param->idle_send_timeout) ==
+		    ETIMEDOUT) {
+			VSLb(h2->vsl, SLT_Debug,
+			    "H2: stream %u: send window timeout", r2->stream);
+			return (0);
+		}
+	}
+	w = len;
+	if (w > r2->window)
+		w = r2->window;
+	if (w > r0->window)
+		w = r0->window;
+	r2->window -= w;
+	r0->window -= w;
+	return ((uint32_t)w);
 }
 
 /*
  * This is the per-stream frame sender.
- * XXX: windows
- * XXX: priority
+ *
+ * Frames are always written when we return, so flush is implied.
  */
 
 int
@@ -91,6 +330,7 @@ H2_Send(struct worker *wrk, struct h2_req *r2, int flush,
 	uint32_t mfs, tf;
 	const char *p;
 
+	(void)wrk;
 	(void)flush;
 
 	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
@@ -100,26 +340,77 @@ H2_Send(struct worker *wrk, struct h2_req *r2, int flush,
 
 	Lck_Lock(&h2->sess->mtx);
 	mfs = h2->their_settings[H2S_MAX_FRAME_SIZE];
-	if (len < mfs) {
-		retval = H2_Send_Frame(wrk, h2,
-		    type, flags, len, r2->stream, ptr);
-	} else if (type == H2_FRAME_DATA) {
-		AN(ptr);
-		AN(len);
+	if (type != H2_FRAME_DATA) {
+		if (len > mfs)
+			INCOMPL();
+		retval = h2_send_frame(h2, type, flags, len, r2->stream,
+		    r2->urgency, ptr);
+	} else if (len == 0) {
+		retval = h2_send_frame(h2, type, flags, 0, r2->stream,
+		    r2->urgency, NULL);
+	} else {
 		p = ptr;
 		do {
-			tf = mfs;
-			if (tf > len)
-				tf = len;
-			retval = H2_Send_Frame(wrk, h2, type,
-			    tf == len ? flags : 0,
-			    tf, r2->stream, p);
+			tf = h2_tx_window(h2, r2, len < mfs ? len : mfs);
+			if (tf == 0) {
+				retval = -1;
+				break;
+			}
+			retval = h2_send_frame(h2, type,
+			    tf == len ? flags : 0, tf, r2->stream,
+			    r2->urgency, p);
 			p += tf;
 			len -= tf;
-		} while (len > 0);
-	} else {
-		INCOMPL();
+		} while (retval == 0 && len > 0);
+	}
+	Lck_Unlock(&h2->sess->mtx);
+	return (retval);
+}
+
+/*
+ * Send response headers.
+ *
+ * The HPACK dynamic table is shared by all streams on the session, so
+ * the header block is encoded under the session mtx and queued before
+ * it is released, as HEADERS and any CONTINUATION frames back to back,
+ * and the peer gets to decode the blocks in the order we encoded them.
+ */
+
+int
+H2_Send_Headers(struct worker *wrk, struct h2_req *r2, uint8_t flags,
+    const struct http *hp, uint8_t *buf, size_t buflen)
+{
+	struct h2_sess *h2;
+	struct h2_txf txf[1];
+	enum h2_frame_e type;
+	uint32_t mfs;
+	size_t sz;
+	int retval;
+
+	(void)wrk;
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	AZ(flags & H2FF_HEADERS_END_HEADERS);
+
+	Lck_Lock(&h2->sess->mtx);
+	sz = h2h_encode(h2, hp, buf, buflen);
+	if (sz == 0) {
+		Lck_Unlock(&h2->sess->mtx);
+		return (-1);
+	}
+	mfs = h2->their_settings[H2S_MAX_FRAME_SIZE];
+	type = H2_FRAME_HEADERS;
+	for (; sz > mfs; sz -= mfs, buf += mfs) {
+		h2_tx_copy(h2, type, flags, mfs, r2->stream, buf);
+		type = H2_FRAME_CONTINUATION;
+		flags = 0;
 	}
+	flags |= type == H2_FRAME_HEADERS ?
+	    H2FF_HEADERS_END_HEADERS : H2FF_CONTINUATION_END_HEADERS;
+	INIT_OBJ(txf, H2_TXF_MAGIC);
+	h2_tx_enqueue(h2, txf, type, flags, sz, r2->stream, buf);
+	retval = h2_tx_wait(h2, txf);
 	Lck_Unlock(&h2->sess->mtx);
 	return (retval);
 }
@@ -51,6 +51,9 @@ extern int		exit_status;
 
 void MAC_Arg(const char *);
 void MAC_reopen_sockets(struct cli *);
+void MAC_reuseport_sockets(void);
+int MAC_tls_load(struct cli *);
+extern const char *mgt_tls_certificate;
 
 /* mgt_child.c */
 int MCH_Init(int launch);
@@ -194,6 +197,8 @@ extern const char *mgt_vmod_path;
 extern unsigned mgt_vcc_err_unref;
 extern unsigned mgt_vcc_allow_inline_c;
 extern unsigned mgt_vcc_unsafe_path;
+extern unsigned mgt_vcc_cache;
+extern unsigned mgt_vcc_profile;
 
 #if defined(PTHREAD_CANCELED) || defined(PTHREAD_MUTEX_DEFAULT)
 #error "Keep pthreads out of in manager process"
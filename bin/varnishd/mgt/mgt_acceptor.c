@@ -33,6 +33,8 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -44,13 +46,17 @@
 
 #include "vav.h"
 #include "vcli_serve.h"
+#include "vfil.h"
 #include "vsa.h"
 #include "vss.h"
 #include "vtcp.h"
+#include "vus.h"
 
 static VTAILQ_HEAD(,listen_arg) listen_args =
     VTAILQ_HEAD_INITIALIZER(listen_args);
 
+const char *mgt_tls_certificate;
+
 static int
 mac_opensocket(struct listen_sock *ls)
 {
@@ -61,7 +67,12 @@ mac_opensocket(struct listen_sock *ls)
 		MCH_Fd_Inherit(ls->sock, NULL);
 		closefd(&ls->sock);
 	}
-	ls->sock = VTCP_bind(ls->addr, NULL);
+	if (ls->uds != NULL)
+		ls->sock = VUS_bind(ls->uds, NULL);
+	else if (ls->nreuse > 0)
+		ls->sock = VTCP_bind_reuseport(ls->addr, NULL);
+	else
+		ls->sock = VTCP_bind(ls->addr, NULL);
 	fail = errno;
 	if (ls->sock < 0) {
 		AN(fail);
@@ -98,6 +109,172 @@ MAC_reopen_sockets(struct cli *cli)
 	}
 }
 
+/*=====================================================================
+ * With listen_reuseport, give every listen address one SO_REUSEPORT
+ * socket per thread pool.  The first socket of each group is the one
+ * from -a, the others are added after it on heritage.socks.  We redo
+ * this before every child start, thread_pools may have changed.
+ */
+
+static void
+mac_reuse_fail(const struct listen_sock *ls, int fail)
+{
+
+	MGT_Complain(C_ERR,
+	    "Could not open SO_REUSEPORT socket %s: %s",
+	    ls->name, strerror(fail));
+}
+
+static void
+mac_reuseport(struct listen_sock *ls, unsigned n)
+{
+	struct listen_sock *ls2, *lsl;
+	unsigned u;
+	int fail;
+
+	assert(n > 1);
+	ls->nreuse = n;
+	VJ_master(JAIL_MASTER_PRIVPORT);
+	fail = mac_opensocket(ls);
+	if (fail) {
+		mac_reuse_fail(ls, fail);
+		ls->nreuse = 0;
+		fail = mac_opensocket(ls);
+		VJ_master(JAIL_MASTER_LOW);
+		if (fail)
+			MGT_Complain(C_ERR,
+			    "Could not reopen listen socket %s: %s",
+			    ls->name, strerror(fail));
+		return;
+	}
+	lsl = ls;
+	for (u = 1; u < n; u++) {
+		ALLOC_OBJ(ls2, LISTEN_SOCK_MAGIC);
+		AN(ls2);
+		ls2->arg = ls->arg;
+		ls2->sock = -1;
+		ls2->addr = VSA_Clone(ls->addr);
+		AN(ls2->addr);
+		ls2->name = strdup(ls->name);
+		AN(ls2->name);
+		ls2->transport = ls->transport;
+		ls2->nreuse = n;
+		ls2->reuse_idx = u;
+		fail = mac_opensocket(ls2);
+		if (fail) {
+			mac_reuse_fail(ls2, fail);
+			free(ls2->addr);
+			free(ls2->name);
+			FREE_OBJ(ls2);
+			break;
+		}
+		VTAILQ_INSERT_AFTER(&heritage.socks, lsl, ls2, list);
+		lsl = ls2;
+	}
+	VJ_master(JAIL_MASTER_LOW);
+
+	if (u == n)
+		return;
+
+	/* Shrink the group to what we got */
+	for (ls2 = ls; ; ls2 = VTAILQ_NEXT(ls2, list)) {
+		ls2->nreuse = u;
+		if (ls2 == lsl)
+			break;
+	}
+}
+
+void
+MAC_reuseport_sockets(void)
+{
+	struct listen_sock *ls, *ls2;
+	unsigned n;
+	int fail;
+
+	n = mgt_param.listen_reuseport ? mgt_param.wthread_pools : 0;
+	if (n < 2)
+		n = 0;
+
+	VTAILQ_FOREACH_SAFE(ls, &heritage.socks, list, ls2) {
+		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+		if (ls->reuse_idx == 0)
+			continue;
+		VTAILQ_REMOVE(&heritage.socks, ls, list);
+		MCH_Fd_Inherit(ls->sock, NULL);
+		closefd(&ls->sock);
+		free(ls->addr);
+		free(ls->name);
+		FREE_OBJ(ls);
+	}
+
+	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		if (ls->reuse_idx > 0) {
+			/* One we just added */
+			continue;
+		} else if (ls->uds != NULL) {
+			/* SO_REUSEPORT does not apply */
+			continue;
+		} else if (n > 0) {
+			mac_reuseport(ls, n);
+		} else if (ls->nreuse > 0) {
+			ls->nreuse = 0;
+			VJ_master(JAIL_MASTER_PRIVPORT);
+			fail = mac_opensocket(ls);
+			VJ_master(JAIL_MASTER_LOW);
+			if (fail)
+				MGT_Complain(C_ERR,
+				    "Could not reopen listen socket %s: %s",
+				    ls->name, strerror(fail));
+		}
+	}
+}
+
+/*=====================================================================
+ * Read the tls_certificate file for the child, if there are any TLS
+ * listeners.  We do this before every child start, so a restart picks
+ * up a renewed certificate, and the child never needs to be able to
+ * read the key file itself.
+ */
+
+int
+MAC_tls_load(struct cli *cli)
+{
+	const struct transport *xp;
+	const struct listen_sock *ls;
+
+	if (heritage.tls_pem != NULL) {
+		memset(heritage.tls_pem, 0, heritage.tls_pem_len);
+		free(heritage.tls_pem);
+	}
+	heritage.tls_pem = NULL;
+	heritage.tls_pem_len = 0;
+
+	xp = XPORT_Find("TLS");
+	if (xp == NULL)
+		return (0);
+	VTAILQ_FOREACH(ls, &heritage.socks, list)
+		if (ls->transport == xp)
+			break;
+	if (ls == NULL)
+		return (0);
+
+	if (mgt_tls_certificate == NULL || *mgt_tls_certificate == '\0') {
+		VCLI_Out(cli, "TLS listener %s needs the tls_certificate"
+		    " parameter\n", ls->name);
+		return (-1);
+	}
+	VJ_master(JAIL_MASTER_FILE);
+	heritage.tls_pem = VFIL_readfile(NULL, mgt_tls_certificate,
+	    &heritage.tls_pem_len);
+	VJ_master(JAIL_MASTER_LOW);
+	if (heritage.tls_pem == NULL) {
+		VCLI_Out(cli, "Cannot read tls_certificate %s: %s\n",
+		    mgt_tls_certificate, strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
 /*--------------------------------------------------------------------*/
 
 static int __match_proto__(vss_resolved_f)
@@ -112,7 +289,7 @@ mac_callback(void *priv, const struct suckaddr *sa)
 	CAST_OBJ_NOTNULL(la, priv, LISTEN_ARG_MAGIC);
 
 	VTAILQ_FOREACH(ls, &heritage.socks, list) {
-		if (!VSA_Compare(sa, ls->addr))
+		if (ls->uds == NULL && !VSA_Compare(sa, ls->addr))
 			ARGV_ERR("-a arguments %s and %s have same address\n",
 			    ls->arg->name, la->name);
 	}
@@ -155,6 +332,53 @@ mac_callback(void *priv, const struct suckaddr *sa)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * A Unix domain socket listener.  Sessions on it have no IP addresses,
+ * they get the bogo-address 0.0.0.0:0 for client.ip and server.ip.
+ */
+
+static int __match_proto__(vus_resolved_f)
+mac_uds_callback(void *priv, const struct sockaddr_un *uds)
+{
+	struct listen_arg *la;
+	struct listen_sock *ls;
+	struct sockaddr_in bogo;
+	int fail;
+
+	CAST_OBJ_NOTNULL(la, priv, LISTEN_ARG_MAGIC);
+	AN(uds);
+
+	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		if (ls->uds != NULL &&
+		    !strcmp(ls->uds->sun_path, uds->sun_path))
+			ARGV_ERR("-a arguments %s and %s have same path\n",
+			    ls->arg->name, la->name);
+	}
+	ALLOC_OBJ(ls, LISTEN_SOCK_MAGIC);
+	AN(ls);
+	ls->arg = la;
+	ls->sock = -1;
+	memset(&bogo, 0, sizeof bogo);
+	bogo.sin_family = AF_INET;
+	ls->addr = VSA_Malloc(&bogo, sizeof bogo);
+	AN(ls->addr);
+	ls->uds = malloc(sizeof *ls->uds);
+	AN(ls->uds);
+	memcpy(ls->uds, uds, sizeof *ls->uds);
+	ls->name = strdup(la->name);
+	AN(ls->name);
+	ls->transport = la->transport;
+	VJ_master(JAIL_MASTER_PRIVPORT);
+	fail = mac_opensocket(ls);
+	VJ_master(JAIL_MASTER_LOW);
+	if (fail)
+		ARGV_ERR("Could not get socket %s: %s\n",
+		    la->name, strerror(fail));
+	VTAILQ_INSERT_TAIL(&la->socks, ls, arglist);
+	VTAILQ_INSERT_TAIL(&heritage.socks, ls, list);
+	return (0);
+}
+
 void
 MAC_Arg(const char *arg)
 {
@@ -188,7 +412,12 @@ MAC_Arg(const char *arg)
 	AN(xp);
 	la->transport = xp;
 
-	error = VSS_resolver(av[1], "80", mac_callback, la, &err);
+	if (VUS_IS(av[1])) {
+		error = VUS_resolver(av[1], mac_uds_callback, la, &err);
+		if (error && err != NULL)
+			ARGV_ERR("%s: %s\n", av[1], err);
+	} else
+		error = VSS_resolver(av[1], "80", mac_callback, la, &err);
 	if (VTAILQ_EMPTY(&la->socks) || error)
 		ARGV_ERR("Got no socket(s) for %s\n", av[1]);
 	VAV_Free(av);
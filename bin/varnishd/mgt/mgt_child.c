@@ -298,6 +298,12 @@ mgt_launch_child(struct cli *cli)
 		return;
 	}
 
+	if (MAC_tls_load(cli)) {
+		VCLI_SetResult(cli, CLIS_CANT);
+		child_state = CH_STOPPED;
+		return;
+	}
+
 	/* Open pipe for mgr->child CLI */
 	AZ(pipe(cp));
 	heritage.cli_in = cp[0];
@@ -318,10 +324,13 @@ mgt_launch_child(struct cli *cli)
 	heritage.std_fd = cp[1];
 	child_output = cp[0];
 
+	MAC_reuseport_sockets();
+
 	AN(heritage.vsm);
 	mgt_SHM_Size_Adjust();
 	AN(heritage.vsm);
 	AN(heritage.param);
+	heritage.t_launch = VTIM_mono();
 	if ((pid = fork()) < 0) {
 		/* XXX */
 		perror("Could not fork child");
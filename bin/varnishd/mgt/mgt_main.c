@@ -83,7 +83,8 @@ usage(void)
 	    "HTTP listen address and port (default: *:80)");
 	fprintf(stderr, FMT, "", "  address: defaults to loopback");
 	fprintf(stderr, FMT, "", "  port: port or service (default: 80)");
-	fprintf(stderr, FMT, "", "  proto: HTTP/1 (default), PROXY");
+	fprintf(stderr, FMT, "", "  address: or absolute path of a UDS");
+	fprintf(stderr, FMT, "", "  proto: HTTP/1 (default), PROXY, TLS");
 	fprintf(stderr, FMT, "-b address[:port]", "backend address and port");
 	fprintf(stderr, FMT, "", "  address: hostname or IP");
 	fprintf(stderr, FMT, "", "  port: port or service (default: 80)");
@@ -96,6 +97,8 @@ usage(void)
 	fprintf(stderr, FMT, "", "  -h simple_list");
 	fprintf(stderr, FMT, "", "  -h classic");
 	fprintf(stderr, FMT, "", "  -h classic,<buckets>");
+	fprintf(stderr, FMT, "", "  -h table");
+	fprintf(stderr, FMT, "", "  -h table,<buckets>");
 	fprintf(stderr, FMT, "-i identity", "Identity of varnish instance");
 	fprintf(stderr, FMT, "-j jail[,jailoptions]", "Jail specification");
 #ifdef HAVE_SETPPRIV
@@ -294,7 +297,7 @@ mgt_tests(void)
 	assert(VTIM_parse("Sun Nov  6 08:49:37 1994") == 784111777);
 
 	/* Check that our SHA256 works */
-	SHA256_Test();
+	VSHA256_Test();
 }
 
 static void
@@ -54,10 +54,12 @@ struct parspec {
 	const char	*units;
 };
 
+tweak_t tweak_addrlist;
 tweak_t tweak_bool;
 tweak_t tweak_bytes;
 tweak_t tweak_bytes_u;
 tweak_t tweak_double;
+tweak_t tweak_header;
 tweak_t tweak_poolparam;
 tweak_t tweak_string;
 tweak_t tweak_timeout;
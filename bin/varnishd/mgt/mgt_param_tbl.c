@@ -71,6 +71,17 @@ struct parspec mgt_parspec[] = {
 		0,
 		VARNISH_VCL_DIR,
 		NULL },
+	{ "tls_certificate", tweak_string, &mgt_tls_certificate,
+		NULL, NULL,
+		"PEM file with the certificate, any intermediate "
+		"certificates and the private key for TLS listeners "
+		"(-a ...,TLS).  The manager reads it every time the child "
+		"is started, the child itself needs no access to it.  "
+		"TLS listeners are only available when varnishd is built "
+		"with OpenSSL 3.0 or later, and need kernel TLS.",
+		MUST_RESTART,
+		"",
+		NULL },
 	{ "vmod_dir", tweak_string, &mgt_vmod_path,
 		NULL, NULL,
 		"Old name for vmod_path, use that instead.",
@@ -100,6 +111,23 @@ struct parspec mgt_parspec[] = {
 		"Allow 'import ... from ...'.",
 		0,
 		"on", "bool" },
+	{ "vcc_cache", tweak_uint, &mgt_vcc_cache,
+		"0", NULL,
+		"How many compiled VCL programs to keep, so that loading a "
+		"VCL program which compiles to the same C source as one of "
+		"them does not run the C-compiler again.\n"
+		"Zero disables the cache.",
+		0,
+		"10", "programs" },
+	{ "vcc_profile", tweak_bool, &mgt_vcc_profile,
+		NULL, NULL,
+		"Compile VCL with counters for every subroutine and block "
+		"of statements, and timers for every subroutine, see "
+		"vcl.profile.  Takes effect for VCL loaded afterwards.\n\n"
+		"The VCC compiler also reports the time it spent lexing, "
+		"parsing and emitting code in its messages.",
+		0,
+		"off", "bool" },
 	{ "pcre_match_limit", tweak_uint,
 		&mgt_param.vre_limits.match,
 		"1", NULL,
@@ -42,6 +42,7 @@
 
 #include "mgt/mgt_param.h"
 #include "vav.h"
+#include "vct.h"
 #include "vnum.h"
 
 /*--------------------------------------------------------------------
@@ -371,6 +372,93 @@ tweak_string(struct vsb *vsb, const struct parspec *par, const char *arg)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * A header name, kept ready for http_GetHdr() so the child can use it
+ * as is.  The length goes in last, so a reader never sees a name which
+ * is not terminated.
+ */
+
+int
+tweak_header(struct vsb *vsb, const struct parspec *par, const char *arg)
+{
+	volatile struct hdrparam *hp;
+	struct hdrparam h;
+	const char *p;
+	size_t l;
+
+	hp = par->priv;
+	h = *hp;
+	if (arg == NULL) {
+		if (h.hdr[0] != '\0')
+			VSB_bcat(vsb, h.hdr + 1, h.hdr[0] - 1);
+		return (0);
+	}
+	l = strlen(arg);
+	if (l + 3 > sizeof h.hdr) {
+		VSB_printf(vsb, "Header name too long.\n");
+		return (-1);
+	}
+	for (p = arg; *p != '\0'; p++) {
+		if (!vct_istchar(*p)) {
+			VSB_printf(vsb, "Invalid header name.\n");
+			return (-1);
+		}
+	}
+	memset(&h, 0, sizeof h);
+	if (l > 0) {
+		h.hdr[0] = (char)(l + 1);
+		memcpy(h.hdr + 1, arg, l);
+		h.hdr[l + 1] = ':';
+	}
+	*hp = h;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * A list of addresses, separated by white space or commas, which is
+ * kept with single spaces between them.  The addresses are resolved
+ * by the child when it uses them.
+ */
+
+int
+tweak_addrlist(struct vsb *vsb, const struct parspec *par, const char *arg)
+{
+	volatile struct addrparam *ap;
+	struct addrparam a;
+	const char *p, *q;
+	size_t l = 0;
+
+	ap = par->priv;
+	a = *ap;
+	if (arg == NULL) {
+		VSB_cat(vsb, a.list);
+		return (0);
+	}
+	memset(&a, 0, sizeof a);
+	for (p = arg; *p != '\0'; p = q) {
+		while (vct_islws(*p) || *p == ',')
+			p++;
+		for (q = p; *q != '\0' && !vct_islws(*q) && *q != ','; q++) {
+			if (vct_isctl(*q)) {
+				VSB_printf(vsb, "Invalid address.\n");
+				return (-1);
+			}
+		}
+		if (q == p)
+			continue;
+		if (l + (l > 0) + (q - p) + 1 > sizeof a.list) {
+			VSB_printf(vsb, "Address list too long.\n");
+			return (-1);
+		}
+		if (l > 0)
+			a.list[l++] = ' ';
+		memcpy(a.list + l, p, q - p);
+		l += q - p;
+	}
+	*ap = a;
+	return (0);
+}
+
 /*--------------------------------------------------------------------*/
 
 int
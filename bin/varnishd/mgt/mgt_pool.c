@@ -97,6 +97,44 @@ struct parspec WRK_parspec[] = {
 		"restart to take effect.",
 		EXPERIMENTAL | DELAYED_EFFECT,
 		"2", "pools" },
+	{ "thread_pool_numa", tweak_bool, &mgt_param.wthread_numa,
+		NULL, NULL,
+		"Bind the thread pools to the NUMA nodes, round robin by "
+		"pool number.\n"
+		"\n"
+		"The worker threads of a pool only run on the CPUs of its "
+		"node, so the memory they first touch, such as the objects "
+		"they fetch into malloc storage, is allocated on that node "
+		"too.  With listen_reuseport each pool also accepts on its "
+		"own socket.\n"
+		"\n"
+		"Needs at least as many pools as there are nodes.  Ignored "
+		"where CPU affinity is not supported.",
+		EXPERIMENTAL | MUST_RESTART,
+		"off", "bool" },
+	{ "thread_pool_steal", tweak_bool, &mgt_param.wthread_steal,
+		NULL, NULL,
+		"Let a worker thread which runs out of work take queued "
+		"tasks from the other pools before it goes to sleep.\n"
+		"\n"
+		"Only backend fetches and client requests are taken, and "
+		"only fetches when the pool is down to its reserve.  "
+		"Acceptor tasks always stay in their own pool.",
+		EXPERIMENTAL,
+		"on", "bool" },
+	{ "thread_pool_predict", tweak_bool, &mgt_param.wthread_predict,
+		NULL, NULL,
+		"Let the herder breed threads in batches when a pool runs "
+		"dry, sized by the tasks waiting for a thread plus how much "
+		"the queue grew since it last looked, and only wait "
+		"thread_pool_add_delay once per batch.\n"
+		"\n"
+		"It also keeps a moving average of the idle threads in the "
+		"pool, and does not reap idle threads unless that is above "
+		"thread_pool_reserve, so threads are not destroyed between "
+		"bursts only to be bred again.",
+		EXPERIMENTAL,
+		"off", "bool" },
 	{ "thread_pool_max", tweak_thread_pool_max, &mgt_param.wthread_max,
 		NULL, NULL,
 		"The maximum number of worker threads in each pool.\n"
@@ -188,8 +226,8 @@ struct parspec WRK_parspec[] = {
 		tweak_uint, &mgt_param.wthread_stats_rate,
 		"0", NULL,
 		"Worker threads accumulate statistics, and dump these into "
-		"the global stats counters if the lock is free when they "
-		"finish a job (request/fetch etc.)\n"
+		"the global stats counters when they run out of work, "
+		"without taking any locks.\n"
 		"This parameters defines the maximum number of jobs "
 		"a worker thread may handle, before it is forced to dump "
 		"its accumulated stats into the global counters.",
@@ -204,6 +242,46 @@ struct parspec WRK_parspec[] = {
 		"be dropped instead of queued.",
 		EXPERIMENTAL,
 		"20", "" },
+	{ "thread_queue_target", tweak_timeout,
+		&mgt_param.wthread_queue_target,
+		"0", NULL,
+		"Acceptable time for client work to wait in a thread-pool "
+		"queue.\n"
+		"\n"
+		"When everything taken off the queue has waited longer than "
+		"this for a whole thread_queue_interval, the pool stops "
+		"queueing new client work and drops it, like it does above "
+		"thread_queue_limit, until the queue delay is back under "
+		"target.  Lower priority work, see req.priority, is dropped "
+		"as soon as any queue above it is over target.\n"
+		"\n"
+		"Zero disables this.",
+		EXPERIMENTAL,
+		"0", "seconds" },
+	{ "thread_queue_interval", tweak_timeout,
+		&mgt_param.wthread_queue_interval,
+		"0.001", NULL,
+		"How long the queue delay must stay over thread_queue_target "
+		"before client work is dropped.\n"
+		"\n"
+		"This should be a few times the time a typical request takes, "
+		"so short bursts are queued rather than dropped.",
+		EXPERIMENTAL,
+		"0.1", "seconds" },
+	{ "thread_queue_fair", tweak_uint, &mgt_param.wthread_queue_fair,
+		"0", NULL,
+		"Share the threads of a pool fairly between clients when "
+		"client work has to queue for them.\n"
+		"\n"
+		"Queued work is sorted by client, its IP or client.identity "
+		"once VCL sets that, into a fixed set of buckets, and the "
+		"buckets with work take turns, up to this many tasks at a "
+		"time.  One client with many connections then only delays "
+		"itself, and those sharing its bucket.\n"
+		"\n"
+		"Zero queues client work in arrival order.",
+		EXPERIMENTAL,
+		"0", "tasks" },
 	{ "thread_pool_stack",
 		tweak_bytes, &mgt_param.wthread_stacksize,
 		NULL, NULL,
@@ -43,6 +43,7 @@
 #include "common/heritage.h"
 
 #include "vfl.h"
+#include "vsl_priv.h"
 #include "vsm_priv.h"
 #include "vfil.h"
 
@@ -58,6 +59,8 @@
 
 static void *mgt_vsm_p;
 static ssize_t mgt_vsm_l;
+static size_t mgt_vsm_want;
+static unsigned mgt_vsm_hugepage;
 
 /*--------------------------------------------------------------------
  * Use a bogo-VSM to hold master-copies of the VSM chunks the master
@@ -138,14 +141,16 @@ vsm_n_check(void)
 }
 
 /*--------------------------------------------------------------------
- * Build a zeroed file
+ * Build a zeroed file.  On a hugetlbfs, the size is rounded up to the
+ * huge page size, and the pages come zeroed.
  */
 
 static int
-vsm_zerofile(const char *fn, ssize_t size)
+vsm_zerofile(const char *fn, size_t *size)
 {
 	int fd;
 	int flags;
+	size_t hps;
 
 	fd = VFL_Open(fn, O_RDWR | O_CREAT | O_EXCL | O_NONBLOCK, 0640);
 	if (fd < 0) {
@@ -158,7 +163,16 @@ vsm_zerofile(const char *fn, ssize_t size)
 	assert(flags != -1);
 	flags &= ~O_NONBLOCK;
 	AZ(fcntl(fd, F_SETFL, flags));
-	if (VFIL_allocate(fd, (off_t)size, 1)) {
+	hps = VFIL_hugetlbfs(fd);
+	if (hps > 0) {
+		*size = RUP2(*size, hps);
+		if (!ftruncate(fd, (off_t)*size))
+			return (fd);
+		MGT_Complain(C_ERR, "File allocation error %s: %s",
+		    fn, strerror(errno));
+		return (-1);
+	}
+	if (VFIL_allocate(fd, (off_t)*size, 1)) {
 		MGT_Complain(C_ERR, "File allocation error %s: %s",
 		    fn, strerror(errno));
 		return (-1);
@@ -192,6 +206,29 @@ mgt_shm_cleanup(void)
 	VJ_master(JAIL_MASTER_LOW);
 }
 
+/*--------------------------------------------------------------------
+ * Readers register in here, see vsl_priv.h.  Anybody who can read the
+ * VSM may, and the sticky bit keeps them away from each others files.
+ * Called under JAIL_MASTER_FILE.
+ */
+
+static void
+mgt_shm_demanddir(void)
+{
+	struct stat st;
+
+	if (mkdir(VSL_DEMANDDIR, 0755) < 0 && errno != EEXIST) {
+		MGT_Complain(C_INFO, "Cannot create %s: %s",
+		    VSL_DEMANDDIR, strerror(errno));
+		return;
+	}
+	AZ(stat(VSM_FILENAME, &st));
+	if (chown(VSL_DEMANDDIR, (uid_t)-1, st.st_gid) ||
+	    chmod(VSL_DEMANDDIR, 01775))
+		MGT_Complain(C_INFO, "Cannot set permissions on %s: %s",
+		    VSL_DEMANDDIR, strerror(errno));
+}
+
 void
 mgt_SHM_Create(void)
 {
@@ -202,11 +239,13 @@ mgt_SHM_Create(void)
 
 	AZ(heritage.vsm);
 	size = mgt_shm_size();
+	mgt_vsm_want = size;
+	mgt_vsm_hugepage = mgt_param.vsm_hugepage;
 
 	bprintf(fnbuf, "%s.%jd", VSM_FILENAME, (intmax_t)getpid());
 
 	VJ_master(JAIL_MASTER_FILE);
-	vsm_fd = vsm_zerofile(fnbuf, size);
+	vsm_fd = vsm_zerofile(fnbuf, &size);
 	VJ_master(JAIL_MASTER_LOW);
 	if (vsm_fd < 0) {
 		mgt_shm_cleanup();
@@ -233,7 +272,13 @@ mgt_SHM_Create(void)
 	/* This may or may not work */
 	(void)mlock(p, size);
 
+#ifdef MADV_HUGEPAGE
+	if (mgt_vsm_hugepage)
+		(void)madvise(p, size, MADV_HUGEPAGE);
+#endif
+
 	heritage.vsm = VSM_common_new(p, size);
+	((struct VSM_head *)p)->hugepage = mgt_vsm_hugepage;
 
 	VSM_common_copy(heritage.vsm, static_vsm);
 
@@ -264,6 +309,7 @@ mgt_SHM_Create(void)
 		(void)unlink(fnbuf);
 		exit(1);
 	}
+	mgt_shm_demanddir();
 	VJ_master(JAIL_MASTER_LOW);
 }
 
@@ -299,7 +345,8 @@ mgt_SHM_Size_Adjust(void)
 {
 
 	AN(heritage.vsm);
-	if (mgt_vsm_l == mgt_shm_size())
+	if (mgt_vsm_want == mgt_shm_size() &&
+	    mgt_vsm_hugepage == mgt_param.vsm_hugepage)
 		return;
 	mgt_SHM_Destroy(0);
 	mgt_SHM_Create();
@@ -31,13 +31,16 @@
 
 #include "config.h"
 
+#include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include "mgt/mgt.h"
 #include "storage/storage.h"
@@ -45,10 +48,16 @@
 #include "libvcc.h"
 #include "vcli_serve.h"
 #include "vfil.h"
+#include "vmod_abi.h"
+#include "vsha256.h"
 #include "vsub.h"
 #include "vav.h"
 #include "vtim.h"
 
+#define VGC_SRC		"vgc.c"
+#define VGC_LIB		"vgc.so"
+#define VGC_CACHE	"vgc_cache"
+
 struct vcc_priv {
 	unsigned	magic;
 #define VCC_PRIV_MAGIC	0x70080cb8
@@ -57,6 +66,7 @@ struct vcc_priv {
 	const char	*vclsrcfile;
 	char		*csrcfile;
 	char		*libfile;
+	char		cachefile[sizeof VGC_CACHE + 2 * VSHA256_LEN + 4];
 };
 
 char *mgt_cc_cmd;
@@ -65,10 +75,8 @@ const char *mgt_vmod_path;
 unsigned mgt_vcc_err_unref;
 unsigned mgt_vcc_allow_inline_c;
 unsigned mgt_vcc_unsafe_path;
-
-
-#define VGC_SRC		"vgc.c"
-#define VGC_LIB		"vgc.so"
+unsigned mgt_vcc_cache;
+unsigned mgt_vcc_profile;
 
 /*--------------------------------------------------------------------*/
 
@@ -109,6 +117,7 @@ run_vcc(void *priv)
 	VCC_Err_Unref(vcc, mgt_vcc_err_unref);
 	VCC_Allow_InlineC(vcc, mgt_vcc_allow_inline_c);
 	VCC_Unsafe_Path(vcc, mgt_vcc_unsafe_path);
+	VCC_Profile(vcc, mgt_vcc_profile);
 	STV_Foreach(stv)
 		VCC_Predef(vcc, "VCL_STEVEDORE", stv->ident);
 	mgt_vcl_export_labels(vcc);
@@ -226,6 +235,130 @@ mgt_vcc_touchfile(const char *fn, struct vsb *sb)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Cache of compiled VCL programs.
+ *
+ * What comes out of the C-compiler only depends on the C source,
+ * cc_command and the VMOD ABI of this varnishd, so the shared objects
+ * are kept under a hash of those, and a VCL program which compiles to
+ * the same C source as one before it skips the C-compiler.  The least
+ * recently used ones go when there are more than vcc_cache.
+ *
+ * The cached shared objects are copied to the VCL directory, never
+ * linked.  dlopen(3) hands out the existing handle for a file it has
+ * already loaded, and the compiled VCL keeps its backends, VMOD
+ * instances and so on in static variables, so two VCLs sharing one
+ * mapping would share all of that too.  VCL_Load() asserts that it
+ * never happens.
+ */
+
+static int
+mgt_vcc_copy(const char *from, const char *to, int flags)
+{
+	char buf[BUFSIZ];
+	ssize_t i;
+	int fi, fo, r = 0;
+
+	fi = open(from, O_RDONLY);
+	if (fi < 0)
+		return (-1);
+	fo = open(to, O_WRONLY|O_TRUNC|flags, 0640);
+	if (fo < 0) {
+		closefd(&fi);
+		return (-1);
+	}
+	while ((i = read(fi, buf, sizeof buf)) > 0)
+		if (write(fo, buf, i) != i)
+			break;
+	if (i != 0)
+		r = -1;
+	closefd(&fi);
+	closefd(&fo);
+	return (r);
+}
+
+static void
+mgt_vcc_cache_name(struct vcc_priv *vp)
+{
+	VSHA256_CTX ctx;
+	unsigned char digest[VSHA256_LEN];
+	char *csrc, *p;
+	int i;
+
+	csrc = VFIL_readfile(NULL, vp->csrcfile, NULL);
+	AN(csrc);
+	VSHA256_Init(&ctx);
+	VSHA256_Update(&ctx, mgt_cc_cmd, strlen(mgt_cc_cmd) + 1);
+	VSHA256_Update(&ctx, VMOD_ABI_Version, sizeof VMOD_ABI_Version);
+	VSHA256_Update(&ctx, csrc, strlen(csrc));
+	VSHA256_Final(digest, &ctx);
+	free(csrc);
+
+	p = vp->cachefile;
+	p += sprintf(p, "%s/", VGC_CACHE);
+	for (i = 0; i < VSHA256_LEN; i++)
+		p += sprintf(p, "%02x", digest[i]);
+	assert(p < vp->cachefile + sizeof vp->cachefile);
+}
+
+static int
+mgt_vcc_cache_get(const struct vcc_priv *vp)
+{
+
+	if (mgt_vcc_copy(vp->cachefile, vp->libfile, 0))
+		return (-1);
+	(void)utimes(vp->cachefile, NULL);
+	return (0);
+}
+
+static void
+mgt_vcc_cache_put(const struct vcc_priv *vp)
+{
+	char tmp[sizeof vp->cachefile + 4];
+	char old[sizeof vp->cachefile];
+	struct dirent *de;
+	struct stat st;
+	time_t t_old;
+	unsigned n;
+	DIR *d;
+
+	if (mkdir(VGC_CACHE, 0755) < 0 && errno != EEXIST)
+		return;
+	bprintf(tmp, "%s.tmp", vp->cachefile);
+	if (mgt_vcc_copy(vp->libfile, tmp, O_CREAT) ||
+	    rename(tmp, vp->cachefile)) {
+		(void)unlink(tmp);
+		return;
+	}
+
+	while (1) {
+		d = opendir(VGC_CACHE);
+		if (d == NULL)
+			return;
+		n = 0;
+		t_old = 0;
+		*old = '\0';
+		while ((de = readdir(d)) != NULL) {
+			if (strlen(de->d_name) != 2 * VSHA256_LEN)
+				continue;
+			bprintf(tmp, "%s/%s", VGC_CACHE, de->d_name);
+			if (stat(tmp, &st))
+				continue;
+			n++;
+			if (!strcmp(tmp, vp->cachefile))
+				continue;
+			if (*old == '\0' || st.st_mtime < t_old) {
+				t_old = st.st_mtime;
+				bprintf(old, "%s", tmp);
+			}
+		}
+		AZ(closedir(d));
+		if (n <= mgt_vcc_cache || *old == '\0')
+			return;
+		(void)unlink(old);
+	}
+}
+
 /*--------------------------------------------------------------------
  * Compile a VCL program, return shared object, errors in sb.
  */
@@ -252,11 +385,25 @@ mgt_vcc_compile(struct vcc_priv *vp, struct vsb *sb, int C_flag)
 		free(csrc);
 	}
 
+	if (mgt_vcc_cache > 0 && !C_flag) {
+		mgt_vcc_cache_name(vp);
+		if (!mgt_vcc_cache_get(vp)) {
+			subs = VSUB_run(sb, run_dlopen, vp, "dlopen", 10);
+			if (!subs) {
+				VSB_printf(sb, "Using cached C-compiler output.\n");
+				return (0);
+			}
+			VSB_clear(sb);
+		}
+	}
+
 	subs = VSUB_run(sb, run_cc, vp, "C-compiler", 10);
 	if (subs)
 		return (subs);
 
 	subs = VSUB_run(sb, run_dlopen, vp, "dlopen", 10);
+	if (!subs && mgt_vcc_cache > 0 && !C_flag)
+		mgt_vcc_cache_put(vp);
 	return (subs);
 }
 
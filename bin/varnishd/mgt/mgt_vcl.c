@@ -399,14 +399,48 @@ mgt_vcl_export_labels(struct vcc *vcc)
 	}
 }
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Load a VCL into the child, after the VCLs it depends on.
+ */
+
+static int
+mgt_push_vcl(struct vclprog *vp, unsigned *status, char **p)
+{
+	struct vcldep *vd;
+
+	if (vp->loaded)
+		return (0);
+	VTAILQ_FOREACH(vd, &vp->dfrom, lfrom)
+		if (mgt_push_vcl(vd->to, status, p))
+			return (1);
+	if (mcf_is_label(vp)) {
+		vd = VTAILQ_FIRST(&vp->dfrom);
+		AN(vd);
+		if (mgt_cli_askchild(status, p, "vcl.label %s %s\n",
+		    vp->name, vd->to->name))
+			return (1);
+	} else {
+		if (mgt_cli_askchild(status, p, "vcl.load \"%s\" %s %d%s\n",
+		    vp->name, vp->fname, vp->warm, vp->state))
+			return (1);
+	}
+	vp->loaded = 1;
+	free(*p);
+	*p = NULL;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Only the active VCL, and what it depends on, is loaded before the
+ * child is started.  The rest follow while it is already serving,
+ * and those which are idle and in the auto state are loaded cold,
+ * they get warmed by vcl.use, should it come to that.
+ */
 
 int
 mgt_push_vcls_and_start(struct cli *cli, unsigned *status, char **p)
 {
 	struct vclprog *vp;
-	struct vcldep *vd;
-	int done;
 
 	AN(active_vcl);
 
@@ -416,37 +450,8 @@ mgt_push_vcls_and_start(struct cli *cli, unsigned *status, char **p)
 	VTAILQ_FOREACH(vp, &vclhead, list)
 		vp->loaded = 0;
 
-	do {
-		done = 1;
-		VTAILQ_FOREACH(vp, &vclhead, list) {
-			if (vp->loaded)
-				continue;
-			VTAILQ_FOREACH(vd, &vp->dfrom, lfrom)
-				if (!vd->to->loaded)
-					break;
-			if (vd != NULL) {
-				done = 0;
-				continue;
-			}
-			if (mcf_is_label(vp)) {
-				vd = VTAILQ_FIRST(&vp->dfrom);
-				AN(vd);
-				if (mgt_cli_askchild(status, p,
-				    "vcl.label %s %s\n",
-				    vp->name, vd->to->name))
-					return (1);
-			} else {
-				if (mgt_cli_askchild(status, p,
-				    "vcl.load \"%s\" %s %d%s\n",
-				    vp->name, vp->fname, vp->warm, vp->state))
-					return (1);
-			}
-			vp->loaded = 1;
-			free(*p);
-			*p = NULL;
-		}
-	} while(!done);
-
+	if (mgt_push_vcl(active_vcl, status, p))
+		return (1);
 	if (mgt_cli_askchild(status, p, "vcl.use \"%s\"\n", active_vcl->name))
 		return (1);
 	free(*p);
@@ -455,6 +460,17 @@ mgt_push_vcls_and_start(struct cli *cli, unsigned *status, char **p)
 		return (1);
 	free(*p);
 	*p = NULL;
+
+	VTAILQ_FOREACH(vp, &vclhead, list) {
+		if (vp->loaded)
+			continue;
+		if (vp->state == VCL_STATE_AUTO && vp->nto == 0) {
+			vp->warm = 0;
+			vp->go_cold = 0;
+		}
+		if (mgt_push_vcl(vp, status, p))
+			return (1);
+	}
 	return (0);
 }
 
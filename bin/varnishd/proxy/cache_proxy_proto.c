@@ -160,10 +160,78 @@ static const char vpx2_sig[] = {
 	'Q', 'U', 'I', 'T', '\n',
 };
 
+#define PP2_TYPE_ALPN		0x01
+#define PP2_TYPE_AUTHORITY	0x02
+#define PP2_TYPE_SSL		0x20
+#define PP2_SUBTYPE_SSL_VERSION	0x21
+#define PP2_SUBTYPE_SSL_CIPHER	0x23
+
+/*
+ * Walk the TLVs after the addresses once, and keep the ones we know
+ * about as session attributes, so VCL can get at them without looking
+ * at the PROXY header again.  The sub-TLVs of PP2_TYPE_SSL come after
+ * a client flags byte and a verify result.
+ *
+ * Trouble with the TLVs is logged, but does not fail the session: the
+ * addresses are what the PROXY header is for.
+ */
+
+static void
+vpx_tlv(struct sess *sp, const uint8_t *p, int l, int ssl)
+{
+	enum sess_attr a;
+	int tl;
+
+	while (l > 0) {
+		if (l < 3) {
+			VSL(SLT_ProxyGarbage, sp->vxid,
+			    "PROXY2: Truncated TLV");
+			return;
+		}
+		tl = vbe16dec(p + 1);
+		if (tl > l - 3) {
+			VSL(SLT_ProxyGarbage, sp->vxid,
+			    "PROXY2: TLV 0x%02x too long (%d)", p[0], tl);
+			return;
+		}
+		a = SA_LAST;
+		switch (p[0]) {
+		case PP2_TYPE_ALPN:
+			if (!ssl)
+				a = SA_PROXY_ALPN;
+			break;
+		case PP2_TYPE_AUTHORITY:
+			if (!ssl)
+				a = SA_PROXY_AUTHORITY;
+			break;
+		case PP2_TYPE_SSL:
+			if (!ssl && tl >= 5)
+				vpx_tlv(sp, p + 3 + 5, tl - 5, 1);
+			break;
+		case PP2_SUBTYPE_SSL_VERSION:
+			if (ssl)
+				a = SA_PROXY_TLS_VERSION;
+			break;
+		case PP2_SUBTYPE_SSL_CIPHER:
+			if (ssl)
+				a = SA_PROXY_TLS_CIPHER;
+			break;
+		default:
+			break;
+		}
+		if (a != SA_LAST && SES_Set_String_Attr_Len(sp, a,
+		    (const char *)p + 3, tl))
+			VSL(SLT_ProxyGarbage, sp->vxid,
+			    "PROXY2: No space for TLV 0x%02x (%d)", p[0], tl);
+		p += 3 + tl;
+		l -= 3 + tl;
+	}
+}
+
 static int
 vpx_proto2(const struct worker *wrk, struct req *req)
 {
-	int l;
+	int l, al = 0;
 	const uint8_t *p;
 	sa_family_t pfam = 0xff;
 	struct sockaddr_in sin4;
@@ -215,7 +283,8 @@ vpx_proto2(const struct worker *wrk, struct req *req)
 	case 0x11:
 		/* IPv4|TCP */
 		pfam = AF_INET;
-		if (l < 12) {
+		al = 12;
+		if (l < al) {
 			VSL(SLT_ProxyGarbage, req->sp->vxid,
 			    "PROXY2: Ignoring short IPv4 addresses (%d)", l);
 			return (0);
@@ -224,7 +293,8 @@ vpx_proto2(const struct worker *wrk, struct req *req)
 	case 0x21:
 		/* IPv6|TCP */
 		pfam = AF_INET6;
-		if (l < 36) {
+		al = 36;
+		if (l < al) {
 			VSL(SLT_ProxyGarbage, req->sp->vxid,
 			    "PROXY2: Ignoring short IPv6 addresses (%d)", l);
 			return (0);
@@ -282,6 +352,7 @@ vpx_proto2(const struct worker *wrk, struct req *req)
 	SES_Set_String_Attr(req->sp, SA_CLIENT_PORT, pb);
 
 	VSL(SLT_Proxy, req->sp->vxid, "2 %s %s %s %s", hb, pb, ha, pa);
+	vpx_tlv(req->sp, p + 16 + al, l - al, 0);
 	return (0);
 }
 
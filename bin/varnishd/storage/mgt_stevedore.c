@@ -115,12 +115,75 @@ static const struct stevedore smp_fake_stevedore = {
 	.init = smp_fake_init,
 };
 
+/*--------------------------------------------------------------------
+ * Parse the generic "lru=" stevedore argument on the form:
+ *	( "strict" | "clock" | "size" ) [ ':' shards ]
+ */
+
+#define STV_LRU_NSHARD_MAX	64
+
+static void
+stv_lru_config(struct stevedore *stv, const char *arg)
+{
+	const char *p;
+	char *q;
+	unsigned long ul;
+	size_t l;
+
+	p = strchr(arg, ':');
+	l = p == NULL ? strlen(arg) : (size_t)(p - arg);
+	if (l == 6 && !strncmp(arg, "strict", l))
+		stv->lru_mode = LRU_STRICT;
+	else if (l == 5 && !strncmp(arg, "clock", l))
+		stv->lru_mode = LRU_CLOCK;
+	else if (l == 4 && !strncmp(arg, "size", l))
+		stv->lru_mode = LRU_SIZE;
+	else
+		ARGV_ERR("(-s%s) unknown lru mode \"%.*s\", "
+		    "use \"strict\", \"clock\" or \"size\"\n",
+		    stv->name, (int)l, arg);
+	stv->lru_nshard = 1;
+	if (p == NULL)
+		return;
+	ul = strtoul(p + 1, &q, 10);
+	if (p[1] == '\0' || *q != '\0' || ul < 1 || ul > STV_LRU_NSHARD_MAX)
+		ARGV_ERR("(-s%s) lru shards \"%s\": "
+		    "must be a number from 1 to %d\n",
+		    stv->name, p + 1, STV_LRU_NSHARD_MAX);
+	stv->lru_nshard = (unsigned)ul;
+}
+
+/*--------------------------------------------------------------------
+ * Parse the generic "readahead=" stevedore argument, the number of body
+ * segments to hint ahead when delivering an object.
+ */
+
+#define STV_READAHEAD_MAX	64
+
+static void
+stv_readahead_config(struct stevedore *stv, const char *arg)
+{
+	char *q;
+	unsigned long ul;
+
+	ul = strtoul(arg, &q, 10);
+	if (*arg == '\0' || *q != '\0' || ul > STV_READAHEAD_MAX)
+		ARGV_ERR("(-s%s) readahead \"%s\": "
+		    "must be a number from 0 to %d\n",
+		    stv->name, arg, STV_READAHEAD_MAX);
+	stv->readahead = (unsigned)ul;
+}
+
 /*--------------------------------------------------------------------
  * Parse a stevedore argument on the form:
  *	[ name '=' ] strategy [ ',' arg ] *
+ *
+ * The "lru=..." and "readahead=..." arguments are handled here for all
+ * stevedores, and removed before the rest are passed to the stevedore.
  */
 
 static const struct choice STV_choice[] = {
+	{ "disk",			&smd_stevedore },
 	{ "file",			&smf_stevedore },
 	{ "malloc",			&sma_stevedore },
 	{ "deprecated_persistent",	&smp_stevedore },
@@ -136,7 +199,7 @@ STV_Config(const char *spec)
 	struct stevedore *stv;
 	const struct stevedore *stv2;
 	struct stevedore *stv3;
-	int ac, l;
+	int ac, i, l;
 	static unsigned seq = 0;
 
 	ASSERT_MGT();
@@ -188,6 +251,20 @@ STV_Config(const char *spec)
 			ARGV_ERR("(-s%s=%s) already defined once\n",
 			    stv->ident, stv->name);
 
+	stv->lru_nshard = 1;
+	for (i = 0; i < ac; ) {
+		if (!strncmp(av[i], "lru=", 4))
+			stv_lru_config(stv, av[i] + 4);
+		else if (!strncmp(av[i], "readahead=", 10))
+			stv_readahead_config(stv, av[i] + 10);
+		else {
+			i++;
+			continue;
+		}
+		memmove(av + i, av + i + 1, (ac - i) * sizeof *av);
+		ac--;
+	}
+
 	if (stv->init != NULL)
 		stv->init(stv, ac, av);
 	else if (ac != 0)
@@ -41,6 +41,7 @@
 #include "hash/hash_slinger.h"
 
 #include "storage/storage.h"
+#include "vmb.h"
 #include "vrt.h"
 #include "vrt_obj.h"
 
@@ -94,12 +95,94 @@ STV_NewObject(struct worker *wrk, struct objcore *oc,
 	return (1);
 }
 
-/*-------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Registry of the memory ranges which stevedores have mmap'ed from a
+ * file, so delivery can hand them to sendfile(2) instead of copying
+ * them through userland.
+ *
+ * It is only written while the stevedores are opened, before any
+ * deliveries can look at it, but they may be opened in parallel.
+ */
+
+#define STV_NFMAP	64
+
+static struct stv_fmap {
+	const uint8_t		*ptr;
+	size_t			len;
+	int			fd;
+	off_t			off;
+} stv_fmap[STV_NFMAP];
+static unsigned stv_nfmap;
+static pthread_mutex_t stv_fmap_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+void
+STV_FileMap(const void *ptr, size_t len, int fd, off_t off)
+{
+	struct stv_fmap *fm;
+
+	AN(ptr);
+	assert(fd >= 0);
+	AZ(pthread_mutex_lock(&stv_fmap_mtx));
+	if (stv_nfmap < STV_NFMAP) {
+		/* Beyond that, such ranges are just copied */
+		fm = &stv_fmap[stv_nfmap];
+		fm->ptr = ptr;
+		fm->len = len;
+		fm->fd = fd;
+		fm->off = off;
+		VWMB();
+		stv_nfmap++;
+	}
+	AZ(pthread_mutex_unlock(&stv_fmap_mtx));
+}
+
+/*
+ * Find the file and offset backing [ptr, ptr+len), returns zero if the
+ * range is not entirely inside one mapped file range.
+ */
+
+int
+STV_FileRange(const void *ptr, size_t len, int *fd, off_t *off)
+{
+	const struct stv_fmap *fm;
+	const uint8_t *p = ptr;
+	unsigned u;
+
+	AN(fd);
+	AN(off);
+	for (u = 0; u < stv_nfmap; u++) {
+		fm = &stv_fmap[u];
+		if (p < fm->ptr || p + len > fm->ptr + fm->len)
+			continue;
+		*fd = fm->fd;
+		*off = fm->off + (p - fm->ptr);
+		return (1);
+	}
+	return (0);
+}
+
+/*-------------------------------------------------------------------
+ * Open the stevedores.  Those which need the CLI thread are opened
+ * first in order, the rest each get a thread of their own, so that
+ * big file and disk stevedores do not hold each other up.
+ */
+
+static void *
+stv_open_thread(void *priv)
+{
+	struct stevedore *stv;
+
+	CAST_OBJ_NOTNULL(stv, priv, STEVEDORE_MAGIC);
+	stv->open(stv);
+	return (NULL);
+}
 
 void
 STV_open(void)
 {
 	struct stevedore *stv;
+	pthread_t *thr;
+	unsigned n = 0, u;
 	char buf[1024];
 
 	ASSERT_CLI();
@@ -107,9 +190,26 @@ STV_open(void)
 		bprintf(buf, "storage.%s", stv->ident);
 		stv->vclname = strdup(buf);
 		AN(stv->vclname);
-		if (stv->open != NULL)
+		if (stv->open == NULL)
+			continue;
+		if (stv->parallel_open)
+			n++;
+		else
 			stv->open(stv);
 	}
+	if (n == 0)
+		return;
+	thr = calloc(n, sizeof *thr);
+	AN(thr);
+	u = 0;
+	STV_Foreach(stv)
+		if (stv->open != NULL && stv->parallel_open)
+			AZ(pthread_create(&thr[u++], NULL,
+			    stv_open_thread, stv));
+	assert(u == n);
+	while (u > 0)
+		AZ(pthread_join(thr[--u], NULL));
+	free(thr);
 }
 
 void
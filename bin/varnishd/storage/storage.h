@@ -77,6 +77,10 @@ typedef void storage_panic_f(struct vsb *vsb, const struct objcore *oc);
 typedef struct object *sml_getobj_f(struct worker *, struct objcore *);
 typedef struct storage *sml_alloc_f(const struct stevedore *, size_t size);
 typedef void sml_free_f(struct storage *);
+typedef int sml_pin_f(struct worker *, struct storage *, struct storage *next);
+typedef void sml_unpin_f(struct storage *);
+typedef void sml_done_f(const struct objcore *, struct storage *);
+typedef void sml_prefetch_f(const struct storage *);
 
 /* Prototypes for VCL variable responders */
 #define VRTSTVVAR(nm,vt,ct,def) \
@@ -101,16 +105,39 @@ struct stevedore {
 	storage_banexport_f	*banexport;
 	storage_panic_f		*panic;
 
+	/* Objects survive a restart */
+	unsigned		persistent;
+
+	/* open() needs not the CLI thread and may run alongside others */
+	unsigned		parallel_open;
+
 	/* Only if SML is used */
 	sml_alloc_f		*sml_alloc;
 	sml_free_f		*sml_free;
 	sml_getobj_f		*sml_getobj;
 
+	/* Only if SML body segments may leave memory */
+	sml_pin_f		*sml_pin;
+	sml_unpin_f		*sml_unpin;
+	sml_done_f		*sml_done;
+
+	/* Segments sml_iterator() hints ahead of delivery, see "readahead=" */
+	unsigned		readahead;
+	sml_prefetch_f		*sml_prefetch;
+
 	const struct obj_methods
 				*methods;
 
 	/* Only if LRU is used */
 	struct lru		*lru;
+	unsigned		lru_nshard;
+	unsigned		lru_mode;
+#define LRU_STRICT		0
+#define LRU_CLOCK		1
+#define LRU_SIZE		2
+
+	/* Objects are written there by storage.snapshot */
+	char			*snapshot;
 
 #define VRTSTVVAR(nm, vtype, ctype, dval) stv_var_##nm *var_##nm;
 #include "tbl/vrt_stv_var.h"
@@ -131,20 +158,28 @@ extern struct stevedore *stv_transient;
 
 int STV__iter(struct stevedore ** const );
 
+/*--------------------------------------------------------------------*/
+void STV_FileMap(const void *ptr, size_t len, int fd, off_t off);
+
 /*--------------------------------------------------------------------*/
 int STV_GetFile(const char *fn, int *fdp, const char **fnp, const char *ctx);
 uintmax_t STV_FileSize(int fd, const char *size, unsigned *granularity,
     const char *ctx);
 
 /*--------------------------------------------------------------------*/
-struct lru *LRU_Alloc(void);
+struct lru *LRU_Alloc(unsigned nshard, unsigned mode);
 void LRU_Free(struct lru **);
 void LRU_Add(struct objcore *, double now);
 void LRU_Remove(struct objcore *);
 int LRU_NukeOne(struct worker *, struct lru *);
+double LRU_LastNuke(const struct lru *);
+int LRU_Victim(struct lru *, uint8_t *digest);
+struct objcore *LRU_Cold(struct lru *, double before);
+struct objcore **LRU_Hot(struct lru *, unsigned u, unsigned *np);
 void LRU_Touch(struct worker *, struct objcore *, double now);
 
 /*--------------------------------------------------------------------*/
 extern const struct stevedore sma_stevedore;
+extern const struct stevedore smd_stevedore;
 extern const struct stevedore smf_stevedore;
 extern const struct stevedore smp_stevedore;
@@ -0,0 +1,751 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Disk storage with explicit I/O and a bounded in-memory hot tier.
+ *
+ * Every storage segment has an extent in the file and, while it is
+ * resident, a buffer in memory.  Once an object is complete its body
+ * segments are written out by the I/O threads, after which their
+ * buffers may be evicted whenever the hot tier is above its size.
+ * Delivery pins each segment while it is being sent, which reads it
+ * back in if need be, and starts reading the following segment, so
+ * the next read overlaps the send.
+ *
+ * The hot tier is two LRU lists: segments of objects which have been
+ * hit SMD_HOT_HITS times are promoted to the protected list, which may
+ * hold up to SMD_HOT_PROTECT percent of the tier, the rest start out
+ * on probation.  Eviction takes from probation first, and when the
+ * protected list is too long its oldest segments are demoted back to
+ * probation, so a burst of one-off objects does not flush the
+ * popular ones from memory.
+ *
+ * The object structure and attributes never leave memory.
+ *
+ * The file is opened O_DIRECT where the filesystem allows it, so the
+ * kernel page cache does not keep a second copy of the hot tier.
+ */
+
+#include "config.h"
+
+#include "cache/cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "storage/storage.h"
+#include "storage/storage_simple.h"
+
+#include "vnum.h"
+#include "vfil.h"
+#include "vtree.h"
+
+/* Alignment of file offsets, lengths and buffers for O_DIRECT */
+#define SMD_ALIGN		4096
+
+#define SMD_HOT_DEFAULT		(100 * 1024 * 1024)
+#define SMD_THREADS_DEFAULT	4
+#define SMD_THREADS_MAX		64
+
+#define SMD_HOT_HITS		2
+#define SMD_HOT_PROTECT		75
+
+static struct VSC_C_lck *lck_smd;
+static pthread_once_t smd_once = PTHREAD_ONCE_INIT;
+
+/*--------------------------------------------------------------------*/
+
+enum smd_state {
+	SMD_S_MEM = 1,		/* Only in memory */
+	SMD_S_WRITE,		/* In memory, being written */
+	SMD_S_CLEAN,		/* In memory and on disk */
+	SMD_S_COLD,		/* Only on disk */
+	SMD_S_READ,		/* Being read */
+};
+
+struct smd {
+	unsigned		magic;
+#define SMD_MAGIC		0x6fb3c2cd
+	struct storage		s;
+	struct smd_sc		*sc;
+
+	enum smd_state		state;
+	unsigned		pins;
+	unsigned		flags;
+#define SMD_F_QUEUED		(1U << 0)	/* on ioq */
+#define SMD_F_BUSY		(1U << 1)	/* I/O thread has it */
+#define SMD_F_GONE		(1U << 2)	/* freed while busy */
+#define SMD_F_HOT		(1U << 3)	/* on hot list */
+#define SMD_F_PROTECT		(1U << 4)	/* ... the protected one */
+
+	off_t			offset;
+	size_t			size;
+	const struct objcore	*oc;		/* body segments only */
+
+	VTAILQ_ENTRY(smd)	list;		/* ioq or hot */
+};
+
+VTAILQ_HEAD(smdhead, smd);
+
+/* Free extents, by offset for merging and by size for best fit */
+struct smd_ext {
+	unsigned		magic;
+#define SMD_EXT_MAGIC		0x1e03a9d4
+	off_t			offset;
+	off_t			size;
+	VRB_ENTRY(smd_ext)	e_off;
+	VRB_ENTRY(smd_ext)	e_size;
+};
+
+VRB_HEAD(smd_off, smd_ext);
+VRB_HEAD(smd_size, smd_ext);
+
+struct smd_sc {
+	unsigned		magic;
+#define SMD_SC_MAGIC		0x3c8c0f56
+	struct lock		mtx;
+	struct VSC_C_smd	*stats;
+
+	const char		*filename;
+	int			fd;
+	unsigned		granularity;
+	uintmax_t		filesize;
+	uintmax_t		hot_max;
+	unsigned		nthreads;
+	int			direct;
+
+	struct smd_off		free_off;
+	struct smd_size		free_size;
+
+	struct smdhead		hot[2];		/* clean, unpinned */
+	struct smdhead		ioq;
+	pthread_cond_t		io_cond;	/* ioq not empty */
+	pthread_cond_t		done_cond;	/* a read finished */
+};
+
+static inline int
+smd_off_cmp(const struct smd_ext *a, const struct smd_ext *b)
+{
+
+	if (a->offset != b->offset)
+		return (a->offset < b->offset ? -1 : 1);
+	return (0);
+}
+
+static inline int
+smd_size_cmp(const struct smd_ext *a, const struct smd_ext *b)
+{
+
+	if (a->size != b->size)
+		return (a->size < b->size ? -1 : 1);
+	return (smd_off_cmp(a, b));
+}
+
+VRB_PROTOTYPE_STATIC(smd_off, smd_ext, e_off, smd_off_cmp)
+VRB_GENERATE_STATIC(smd_off, smd_ext, e_off, smd_off_cmp)
+VRB_PROTOTYPE_STATIC(smd_size, smd_ext, e_size, smd_size_cmp)
+VRB_GENERATE_STATIC(smd_size, smd_ext, e_size, smd_size_cmp)
+
+/*--------------------------------------------------------------------*/
+
+static void
+smd_init(struct stevedore *parent, int ac, char * const *av)
+{
+	const char *size = NULL, *fn, *r;
+	struct smd_sc *sc;
+	uintmax_t u;
+
+	AZ(av[ac]);
+
+	if (ac > 4)
+		ARGV_ERR("(-sdisk) too many arguments\n");
+	if (ac < 1 || *av[0] == '\0')
+		ARGV_ERR("(-sdisk) path is mandatory\n");
+	fn = av[0];
+	if (ac > 1 && *av[1] != '\0')
+		size = av[1];
+
+	ALLOC_OBJ(sc, SMD_SC_MAGIC);
+	XXXAN(sc);
+	VRB_INIT(&sc->free_off);
+	VRB_INIT(&sc->free_size);
+	VTAILQ_INIT(&sc->hot[0]);
+	VTAILQ_INIT(&sc->hot[1]);
+	VTAILQ_INIT(&sc->ioq);
+	sc->hot_max = SMD_HOT_DEFAULT;
+	sc->nthreads = SMD_THREADS_DEFAULT;
+
+	if (ac > 2 && *av[2] != '\0') {
+		r = VNUM_2bytes(av[2], &sc->hot_max, 0);
+		if (r != NULL)
+			ARGV_ERR("(-sdisk) hot size \"%s\": %s\n", av[2], r);
+	}
+	if (ac > 3 && *av[3] != '\0') {
+		u = strtoumax(av[3], NULL, 0);
+		if (u < 1 || u > SMD_THREADS_MAX)
+			ARGV_ERR("(-sdisk) threads \"%s\": "
+			    "must be a number from 1 to %d\n",
+			    av[3], SMD_THREADS_MAX);
+		sc->nthreads = (unsigned)u;
+	}
+	parent->priv = sc;
+
+	(void)STV_GetFile(fn, &sc->fd, &sc->filename, "-sdisk");
+	MCH_Fd_Inherit(sc->fd, "storage_disk");
+	sc->granularity = SMD_ALIGN;
+	sc->filesize = STV_FileSize(sc->fd, size, &sc->granularity, "-sdisk");
+	if (sc->granularity % SMD_ALIGN)
+		ARGV_ERR("(-sdisk) filesystem block size %u"
+		    " is not a multiple of %d\n", sc->granularity, SMD_ALIGN);
+	if (VFIL_allocate(sc->fd, (off_t)sc->filesize, 0))
+		ARGV_ERR("(-sdisk) allocation error: %s\n", strerror(errno));
+}
+
+/*--------------------------------------------------------------------
+ * File space
+ */
+
+static void
+smd_ext_insert(struct smd_sc *sc, struct smd_ext *e)
+{
+
+	AZ(VRB_INSERT(smd_off, &sc->free_off, e));
+	AZ(VRB_INSERT(smd_size, &sc->free_size, e));
+}
+
+static void
+smd_ext_remove(struct smd_sc *sc, struct smd_ext *e)
+{
+
+	VRB_REMOVE(smd_off, &sc->free_off, e);
+	VRB_REMOVE(smd_size, &sc->free_size, e);
+}
+
+static int
+smd_ext_alloc(struct smd_sc *sc, size_t size, off_t *off)
+{
+	struct smd_ext *e, key;
+
+	Lck_AssertHeld(&sc->mtx);
+	key.size = size;
+	key.offset = 0;
+	e = VRB_NFIND(smd_size, &sc->free_size, &key);
+	if (e == NULL)
+		return (-1);
+	CHECK_OBJ(e, SMD_EXT_MAGIC);
+	smd_ext_remove(sc, e);
+	*off = e->offset;
+	if (e->size == (off_t)size) {
+		FREE_OBJ(e);
+		return (0);
+	}
+	e->offset += size;
+	e->size -= size;
+	smd_ext_insert(sc, e);
+	return (0);
+}
+
+static void
+smd_ext_free(struct smd_sc *sc, off_t off, size_t size)
+{
+	struct smd_ext *e, *e2, key;
+
+	Lck_AssertHeld(&sc->mtx);
+	key.offset = off;
+	e = VRB_NFIND(smd_off, &sc->free_off, &key);
+	if (e != NULL && e->offset == off + (off_t)size) {
+		/* Merge with the one after */
+		smd_ext_remove(sc, e);
+		e->offset = off;
+		e->size += size;
+		e2 = VRB_PREV(smd_off, &sc->free_off, e);
+	} else {
+		e2 = e != NULL ? VRB_PREV(smd_off, &sc->free_off, e) :
+		    VRB_MAX(smd_off, &sc->free_off);
+		ALLOC_OBJ(e, SMD_EXT_MAGIC);
+		XXXAN(e);
+		e->offset = off;
+		e->size = size;
+	}
+	if (e2 != NULL && e2->offset + e2->size == e->offset) {
+		/* Merge with the one before */
+		smd_ext_remove(sc, e2);
+		e->offset = e2->offset;
+		e->size += e2->size;
+		FREE_OBJ(e2);
+	}
+	smd_ext_insert(sc, e);
+}
+
+/*--------------------------------------------------------------------
+ * Memory for the hot tier
+ */
+
+static void
+smd_unhot(struct smd_sc *sc, struct smd *sd)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	if (!(sd->flags & SMD_F_HOT))
+		return;
+	if (sd->flags & SMD_F_PROTECT) {
+		VTAILQ_REMOVE(&sc->hot[1], sd, list);
+		sc->stats->g_hot_protected -= sd->size;
+	} else
+		VTAILQ_REMOVE(&sc->hot[0], sd, list);
+	sd->flags &= ~(SMD_F_HOT | SMD_F_PROTECT);
+}
+
+static void
+smd_evict(struct smd_sc *sc)
+{
+	struct smd *sd;
+
+	Lck_AssertHeld(&sc->mtx);
+	while (sc->stats->g_hot > sc->hot_max) {
+		sd = VTAILQ_FIRST(&sc->hot[0]);
+		if (sd == NULL)
+			sd = VTAILQ_FIRST(&sc->hot[1]);
+		if (sd == NULL)
+			break;
+		CHECK_OBJ(sd, SMD_MAGIC);
+		assert(sd->state == SMD_S_CLEAN);
+		AZ(sd->pins);
+		smd_unhot(sc, sd);
+		free(sd->s.ptr);
+		sd->s.ptr = NULL;
+		sd->state = SMD_S_COLD;
+		sc->stats->g_hot -= sd->size;
+		sc->stats->c_evict++;
+	}
+}
+
+static int
+smd_buffer(struct smd_sc *sc, struct smd *sd)
+{
+	void *p;
+
+	Lck_AssertHeld(&sc->mtx);
+	AZ(sd->s.ptr);
+	sc->stats->g_hot += sd->size;
+	smd_evict(sc);
+	if (posix_memalign(&p, SMD_ALIGN, sd->size)) {
+		sc->stats->g_hot -= sd->size;
+		return (-1);
+	}
+	sd->s.ptr = p;
+	return (0);
+}
+
+/*
+ * A segment nobody uses goes on the hot lists.  The hit counter of the
+ * object is kept by the lookup already, so this is all it costs to
+ * know what is popular.
+ */
+
+static void
+smd_cool(struct smd_sc *sc, struct smd *sd)
+{
+	struct smd *sd2;
+
+	Lck_AssertHeld(&sc->mtx);
+	assert(sd->state == SMD_S_CLEAN);
+	if (sd->pins > 0 || (sd->flags & SMD_F_HOT))
+		return;
+	if (sd->oc == NULL || sd->oc->hits < SMD_HOT_HITS) {
+		sd->flags |= SMD_F_HOT;
+		VTAILQ_INSERT_TAIL(&sc->hot[0], sd, list);
+		smd_evict(sc);
+		return;
+	}
+	sd->flags |= SMD_F_HOT | SMD_F_PROTECT;
+	VTAILQ_INSERT_TAIL(&sc->hot[1], sd, list);
+	sc->stats->g_hot_protected += sd->size;
+	sc->stats->c_promote++;
+	while (sc->stats->g_hot_protected >
+	    sc->hot_max / 100 * SMD_HOT_PROTECT) {
+		sd2 = VTAILQ_FIRST(&sc->hot[1]);
+		CHECK_OBJ_NOTNULL(sd2, SMD_MAGIC);
+		smd_unhot(sc, sd2);
+		sd2->flags |= SMD_F_HOT;
+		VTAILQ_INSERT_TAIL(&sc->hot[0], sd2, list);
+		sc->stats->c_demote++;
+	}
+	smd_evict(sc);
+}
+
+static void
+smd_queue(struct smd_sc *sc, struct smd *sd)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	AZ(sd->flags & (SMD_F_QUEUED | SMD_F_BUSY | SMD_F_HOT));
+	sd->flags |= SMD_F_QUEUED;
+	VTAILQ_INSERT_TAIL(&sc->ioq, sd, list);
+	AZ(pthread_cond_signal(&sc->io_cond));
+}
+
+static void
+smd_destroy(struct smd_sc *sc, struct smd *sd)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	AZ(sd->flags & SMD_F_BUSY);
+	if (sd->flags & SMD_F_QUEUED)
+		VTAILQ_REMOVE(&sc->ioq, sd, list);
+	smd_unhot(sc, sd);
+	if (sd->s.ptr != NULL) {
+		free(sd->s.ptr);
+		sc->stats->g_hot -= sd->size;
+	}
+	smd_ext_free(sc, sd->offset, sd->size);
+	FREE_OBJ(sd);
+}
+
+/*--------------------------------------------------------------------
+ * The I/O threads
+ */
+
+static int
+smd_io(const struct smd_sc *sc, const struct smd *sd, int wr)
+{
+	unsigned char *p = sd->s.ptr;
+	off_t off = sd->offset;
+	size_t l;
+	ssize_t i;
+
+	l = RUP2(sd->s.len, SMD_ALIGN);
+	assert(l <= sd->size);
+	while (l > 0) {
+		if (wr)
+			i = pwrite(sc->fd, p, l, off);
+		else
+			i = pread(sc->fd, p, l, off);
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i <= 0)
+			return (-1);
+		p += i;
+		off += i;
+		l -= i;
+	}
+	return (0);
+}
+
+static void * __match_proto__(bgthread_t)
+smd_io_thread(struct worker *wrk, void *priv)
+{
+	struct smd_sc *sc;
+	struct smd *sd;
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(sc, priv, SMD_SC_MAGIC);
+	Lck_Lock(&sc->mtx);
+	while (1) {
+		sd = VTAILQ_FIRST(&sc->ioq);
+		if (sd == NULL) {
+			(void)Lck_CondWait(&sc->io_cond, &sc->mtx, 0);
+			continue;
+		}
+		CHECK_OBJ(sd, SMD_MAGIC);
+		VTAILQ_REMOVE(&sc->ioq, sd, list);
+		sd->flags &= ~SMD_F_QUEUED;
+		sd->flags |= SMD_F_BUSY;
+		Lck_Unlock(&sc->mtx);
+
+		i = smd_io(sc, sd, sd->state == SMD_S_WRITE);
+
+		Lck_Lock(&sc->mtx);
+		sd->flags &= ~SMD_F_BUSY;
+		if (sd->flags & SMD_F_GONE) {
+			smd_destroy(sc, sd);
+			continue;
+		}
+		if (sd->state == SMD_S_WRITE) {
+			if (i) {
+				/* Stays in memory for good */
+				sc->stats->c_write_fail++;
+				sd->state = SMD_S_MEM;
+				continue;
+			}
+			sc->stats->c_write++;
+			sd->state = SMD_S_CLEAN;
+			smd_cool(sc, sd);
+			continue;
+		}
+		assert(sd->state == SMD_S_READ);
+		if (i) {
+			sc->stats->c_read_fail++;
+			free(sd->s.ptr);
+			sd->s.ptr = NULL;
+			sc->stats->g_hot -= sd->size;
+			sd->state = SMD_S_COLD;
+		} else {
+			sc->stats->c_read++;
+			sd->state = SMD_S_CLEAN;
+			smd_cool(sc, sd);
+		}
+		AZ(pthread_cond_broadcast(&sc->done_cond));
+	}
+	NEEDLESS(Lck_Unlock(&sc->mtx));
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+smd_open_once(void)
+{
+
+	lck_smd = Lck_CreateClass("smd");
+}
+
+static void __match_proto__(storage_open_f)
+smd_open(struct stevedore *st)
+{
+	struct smd_sc *sc;
+	struct smd_ext *e;
+	pthread_t thr;
+	unsigned u;
+	int i;
+
+	st->lru = LRU_Alloc(st->lru_nshard, st->lru_mode);
+	AZ(pthread_once(&smd_once, smd_open_once));
+	CAST_OBJ_NOTNULL(sc, st->priv, SMD_SC_MAGIC);
+	sc->stats = VSM_Alloc(sizeof *sc->stats,
+	    VSC_CLASS, VSC_type_smd, st->ident);
+	Lck_New(&sc->mtx, lck_smd);
+	AZ(pthread_cond_init(&sc->io_cond, NULL));
+	AZ(pthread_cond_init(&sc->done_cond, NULL));
+
+#ifdef O_DIRECT
+	i = fcntl(sc->fd, F_GETFL);
+	if (i >= 0 && fcntl(sc->fd, F_SETFL, i | O_DIRECT) == 0)
+		sc->direct = 1;
+#else
+	(void)i;
+#endif
+
+	ALLOC_OBJ(e, SMD_EXT_MAGIC);
+	XXXAN(e);
+	e->size = sc->filesize - (sc->filesize % SMD_ALIGN);
+	Lck_Lock(&sc->mtx);
+	smd_ext_insert(sc, e);
+	Lck_Unlock(&sc->mtx);
+	sc->stats->g_space = e->size;
+
+	printf("SMD.%s %ju bytes, %ju bytes hot, %u I/O threads%s\n",
+	    st->ident, (uintmax_t)e->size, sc->hot_max, sc->nthreads,
+	    sc->direct ? ", O_DIRECT" : "");
+
+	for (u = 0; u < sc->nthreads; u++)
+		WRK_BgThread(&thr, "smd-io", smd_io_thread, sc);
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct storage * __match_proto__(sml_alloc_f)
+smd_alloc(const struct stevedore *st, size_t size)
+{
+	struct smd_sc *sc;
+	struct smd *sd;
+	off_t off;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMD_SC_MAGIC);
+	assert(size > 0);
+	size = RUP2(size, SMD_ALIGN);
+	ALLOC_OBJ(sd, SMD_MAGIC);
+	XXXAN(sd);
+	sd->s.magic = STORAGE_MAGIC;
+	sd->sc = sc;
+	sd->size = size;
+	sd->state = SMD_S_MEM;
+
+	Lck_Lock(&sc->mtx);
+	sc->stats->c_req++;
+	if (smd_ext_alloc(sc, size, &off)) {
+		sc->stats->c_fail++;
+		Lck_Unlock(&sc->mtx);
+		FREE_OBJ(sd);
+		return (NULL);
+	}
+	sd->offset = off;
+	if (smd_buffer(sc, sd)) {
+		smd_ext_free(sc, off, size);
+		sc->stats->c_fail++;
+		Lck_Unlock(&sc->mtx);
+		FREE_OBJ(sd);
+		return (NULL);
+	}
+	sc->stats->g_alloc++;
+	sc->stats->c_bytes += size;
+	sc->stats->g_bytes += size;
+	sc->stats->g_space -= size;
+	Lck_Unlock(&sc->mtx);
+
+	sd->s.space = size;
+	sd->s.priv = sd;
+	sd->s.len = 0;
+	return (&sd->s);
+}
+
+static void __match_proto__(sml_free_f)
+smd_free(struct storage *s)
+{
+	struct smd *sd;
+	struct smd_sc *sc;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(sd, s->priv, SMD_MAGIC);
+	sc = sd->sc;
+	AZ(sd->pins);
+	Lck_Lock(&sc->mtx);
+	sc->stats->g_alloc--;
+	sc->stats->c_freed += sd->size;
+	sc->stats->g_bytes -= sd->size;
+	sc->stats->g_space += sd->size;
+	if (sd->flags & SMD_F_BUSY)
+		sd->flags |= SMD_F_GONE;
+	else
+		smd_destroy(sc, sd);
+	Lck_Unlock(&sc->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Body segments are written once the object is complete, and brought
+ * back in when they are delivered.
+ */
+
+static void __match_proto__(sml_done_f)
+smd_done(const struct objcore *oc, struct storage *s)
+{
+	struct smd *sd;
+	struct smd_sc *sc;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(sd, s->priv, SMD_MAGIC);
+	sc = sd->sc;
+	if (s->len == 0)
+		return;
+	Lck_Lock(&sc->mtx);
+	sd->oc = oc;
+	if (sd->state == SMD_S_MEM) {
+		sd->state = SMD_S_WRITE;
+		smd_queue(sc, sd);
+	}
+	Lck_Unlock(&sc->mtx);
+}
+
+static void
+smd_read(struct smd_sc *sc, struct smd *sd)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	assert(sd->state == SMD_S_COLD);
+	if (smd_buffer(sc, sd))
+		return;
+	sd->state = SMD_S_READ;
+	smd_queue(sc, sd);
+}
+
+static int __match_proto__(sml_pin_f)
+smd_pin(struct worker *wrk, struct storage *s, struct storage *next)
+{
+	struct smd *sd, *sdn = NULL;
+	struct smd_sc *sc;
+	int tried = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(sd, s->priv, SMD_MAGIC);
+	if (next != NULL)
+		CAST_OBJ_NOTNULL(sdn, next->priv, SMD_MAGIC);
+	sc = sd->sc;
+
+	Lck_Lock(&sc->mtx);
+	sd->pins++;
+	smd_unhot(sc, sd);
+	if (sdn != NULL && sdn->state == SMD_S_COLD) {
+		sc->stats->c_readahead++;
+		smd_read(sc, sdn);
+	}
+	while (sd->state == SMD_S_COLD || sd->state == SMD_S_READ) {
+		if (sd->state == SMD_S_COLD) {
+			if (tried) {
+				sd->pins--;
+				Lck_Unlock(&sc->mtx);
+				return (-1);
+			}
+			tried = 1;
+			smd_read(sc, sd);
+			if (sd->state == SMD_S_COLD)
+				continue;
+		}
+		sc->stats->c_wait++;
+		(void)Lck_CondWait(&sc->done_cond, &sc->mtx, 0);
+	}
+	Lck_Unlock(&sc->mtx);
+	AN(s->ptr);
+	return (0);
+}
+
+static void __match_proto__(sml_unpin_f)
+smd_unpin(struct storage *s)
+{
+	struct smd *sd;
+	struct smd_sc *sc;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(sd, s->priv, SMD_MAGIC);
+	sc = sd->sc;
+	Lck_Lock(&sc->mtx);
+	assert(sd->pins > 0);
+	if (--sd->pins == 0 && sd->state == SMD_S_CLEAN)
+		smd_cool(sc, sd);
+	Lck_Unlock(&sc->mtx);
+}
+
+/*--------------------------------------------------------------------*/
+
+const struct stevedore smd_stevedore = {
+	.magic		=	STEVEDORE_MAGIC,
+	.name		=	"disk",
+	.init		=	smd_init,
+	.open		=	smd_open,
+	.parallel_open	=	1,
+	.sml_alloc	=	smd_alloc,
+	.sml_free	=	smd_free,
+	.sml_pin	=	smd_pin,
+	.sml_unpin	=	smd_unpin,
+	.sml_done	=	smd_done,
+	.allocobj	=	SML_allocobj,
+	.panic		=	SML_panic,
+	.methods	=	&SML_methods,
+};
@@ -44,6 +44,7 @@
 
 #include "vnum.h"
 #include "vfil.h"
+#include "vtree.h"
 
 #ifndef MAP_NOCORE
 #define MAP_NOCORE 0 /* XXX Linux */
@@ -56,15 +57,20 @@
 #define MINPAGES		128
 
 /*
- * Number of buckets on free-list.
+ * Free ranges smaller than NBUCKET pages are kept on a list per size,
+ * with a bitmap of the non-empty lists, larger ones in a tree ordered
+ * by size and offset.  Allocation is best fit, either way.
  *
- * Last bucket is "larger than" so choose number so that the second
- * to last bucket matches the 128k CHUNKSIZE in cache_fetch.c when
- * using the a 4K minimal page size
+ * Choose the number so that the last list matches the 128k CHUNKSIZE
+ * in cache_fetch.c when using the a 4K minimal page size
  */
 #define NBUCKET			(128 / 4 + 1)
 
+/* struct smf are allocated this many at a time, and never freed */
+#define SMF_SLAB		256
+
 static struct VSC_C_lck *lck_smf;
+static pthread_once_t smf_once = PTHREAD_ONCE_INIT;
 
 /*--------------------------------------------------------------------*/
 
@@ -84,9 +90,12 @@ struct smf {
 
 	VTAILQ_ENTRY(smf)	order;
 	VTAILQ_ENTRY(smf)	status;
-	struct smfhead		*flist;
+	VRB_ENTRY(smf)		tree;
+	struct smfhead		*flist;		/* NULL if in tree */
 };
 
+VRB_HEAD(smf_tree, smf);
+
 struct smf_sc {
 	unsigned		magic;
 #define SMF_SC_MAGIC		0x52962ee7
@@ -98,11 +107,30 @@ struct smf_sc {
 	unsigned		pagesize;
 	uintmax_t		filesize;
 	int			advice;
+	int			mapflags;
+	unsigned		hugepage;
 	struct smfhead		order;
 	struct smfhead		free[NBUCKET];
+	uint64_t		free_map;	/* non-empty free[] */
+	struct smf_tree		large;
 	struct smfhead		used;
+	struct smfhead		spare;		/* unused struct smf */
 };
 
+static inline int
+smf_cmp(const struct smf *a, const struct smf *b)
+{
+
+	if (a->size != b->size)
+		return (a->size < b->size ? -1 : 1);
+	if (a->offset != b->offset)
+		return (a->offset < b->offset ? -1 : 1);
+	return (0);
+}
+
+VRB_PROTOTYPE_STATIC(smf_tree, smf, tree, smf_cmp)
+VRB_GENERATE_STATIC(smf_tree, smf, tree, smf_cmp)
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -113,13 +141,16 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 	unsigned u;
 	uintmax_t page_size;
 	int advice = MADV_RANDOM;
+	int mapflags = 0;
+	unsigned hugepage = 0;
+	size_t l;
 
 	AZ(av[ac]);
 
 	size = NULL;
 	page_size = getpagesize();
 
-	if (ac > 4)
+	if (ac > 5)
 		ARGV_ERR("(-sfile) too many arguments\n");
 	if (ac < 1 || *av[0] == '\0')
 		ARGV_ERR("(-sfile) path is mandatory\n");
@@ -132,7 +163,7 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 		if (r != NULL)
 			ARGV_ERR("(-sfile) granularity \"%s\": %s\n", av[2], r);
 	}
-	if (ac > 3) {
+	if (ac > 3 && *av[3] != '\0') {
 		if (!strcmp(av[3], "normal"))
 			advice = MADV_NORMAL;
 		else if (!strcmp(av[3], "random"))
@@ -142,6 +173,25 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 		else
 			ARGV_ERR("(-s file) invalid advice: \"%s\"", av[3]);
 	}
+	for (r = ac > 4 ? av[4] : ""; *r != '\0'; r += l) {
+		if (*r == ':')
+			r++;
+		l = strcspn(r, ":");
+#ifdef MAP_POPULATE
+		if (l == 8 && !strncmp(r, "prefault", l)) {
+			mapflags |= MAP_POPULATE;
+			continue;
+		}
+#endif
+#ifdef MADV_HUGEPAGE
+		if (l == 8 && !strncmp(r, "hugepage", l)) {
+			hugepage = 1;
+			continue;
+		}
+#endif
+		ARGV_ERR("(-sfile) invalid or unsupported map option: "
+		    "\"%.*s\"\n", (int)l, r);
+	}
 
 	AN(fn);
 
@@ -150,9 +200,13 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 	VTAILQ_INIT(&sc->order);
 	for (u = 0; u < NBUCKET; u++)
 		VTAILQ_INIT(&sc->free[u]);
+	VRB_INIT(&sc->large);
 	VTAILQ_INIT(&sc->used);
+	VTAILQ_INIT(&sc->spare);
 	sc->pagesize = page_size;
 	sc->advice = advice;
+	sc->mapflags = mapflags;
+	sc->hugepage = hugepage;
 	parent->priv = sc;
 
 	(void)STV_GetFile(fn, &sc->fd, &sc->filename, "-sfile");
@@ -162,6 +216,40 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 		ARGV_ERR("(-sfile) allocation error: %s\n", strerror(errno));
 }
 
+/*--------------------------------------------------------------------
+ * Get and put struct smf, which are carved from slabs under the lock.
+ */
+
+static struct smf *
+get_smf(struct smf_sc *sc)
+{
+	struct smf *sp;
+	unsigned u;
+
+	Lck_AssertHeld(&sc->mtx);
+	sp = VTAILQ_FIRST(&sc->spare);
+	if (sp == NULL) {
+		sp = calloc(SMF_SLAB, sizeof *sp);
+		XXXAN(sp);
+		for (u = 0; u < SMF_SLAB; u++)
+			VTAILQ_INSERT_TAIL(&sc->spare, &sp[u], status);
+		sp = VTAILQ_FIRST(&sc->spare);
+	}
+	VTAILQ_REMOVE(&sc->spare, sp, status);
+	sc->stats->g_smf++;
+	return (sp);
+}
+
+static void
+put_smf(struct smf_sc *sc, struct smf *sp)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	memset(sp, 0, sizeof *sp);
+	VTAILQ_INSERT_HEAD(&sc->spare, sp, status);
+	sc->stats->g_smf--;
+}
+
 /*--------------------------------------------------------------------
  * Insert/Remove from correct freelist
  */
@@ -170,78 +258,87 @@ static void
 insfree(struct smf_sc *sc, struct smf *sp)
 {
 	size_t b;
-	struct smf *sp2;
-	size_t ns;
 
 	AZ(sp->alloc);
 	assert(sp->flist == NULL);
 	Lck_AssertHeld(&sc->mtx);
 	b = sp->size / sc->pagesize;
 	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
 		sc->stats->g_smf_large++;
-	} else {
-		sc->stats->g_smf_frag++;
+		AZ(VRB_INSERT(smf_tree, &sc->large, sp));
+		return;
 	}
+	sc->stats->g_smf_frag++;
 	sp->flist = &sc->free[b];
-	ns = b * sc->pagesize;
-	VTAILQ_FOREACH(sp2, sp->flist, status) {
-		assert(sp2->size >= ns);
-		AZ(sp2->alloc);
-		assert(sp2->flist == sp->flist);
-		if (sp->offset < sp2->offset)
-			break;
-	}
-	if (sp2 == NULL)
-		VTAILQ_INSERT_TAIL(sp->flist, sp, status);
-	else
-		VTAILQ_INSERT_BEFORE(sp2, sp, status);
+	VTAILQ_INSERT_TAIL(sp->flist, sp, status);
+	sc->free_map |= (uint64_t)1 << b;
 }
 
 static void
-remfree(const struct smf_sc *sc, struct smf *sp)
+remfree(struct smf_sc *sc, struct smf *sp)
 {
 	size_t b;
 
 	AZ(sp->alloc);
-	assert(sp->flist != NULL);
 	Lck_AssertHeld(&sc->mtx);
 	b = sp->size / sc->pagesize;
 	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
+		AZ(sp->flist);
 		sc->stats->g_smf_large--;
-	} else {
-		sc->stats->g_smf_frag--;
+		VRB_REMOVE(smf_tree, &sc->large, sp);
+		return;
 	}
+	sc->stats->g_smf_frag--;
 	assert(sp->flist == &sc->free[b]);
 	VTAILQ_REMOVE(sp->flist, sp, status);
+	if (VTAILQ_EMPTY(sp->flist))
+		sc->free_map &= ~((uint64_t)1 << b);
 	sp->flist = NULL;
 }
 
 /*--------------------------------------------------------------------
- * Allocate a range from the first free range that is large enough.
+ * The largest free range tells how fragmented the free space is.
+ */
+
+static void
+smf_largest(struct smf_sc *sc)
+{
+	struct smf *sp;
+
+	sp = VRB_MAX(smf_tree, &sc->large);
+	if (sp != NULL)
+		sc->stats->g_smf_largest = sp->size;
+	else if (sc->free_map != 0)
+		sc->stats->g_smf_largest =
+		    (63 - __builtin_clzll(sc->free_map)) *
+		    (uint64_t)sc->pagesize;
+	else
+		sc->stats->g_smf_largest = 0;
+}
+
+/*--------------------------------------------------------------------
+ * Allocate a range from the smallest free range that is large enough.
  */
 
 static struct smf *
 alloc_smf(struct smf_sc *sc, size_t bytes)
 {
-	struct smf *sp, *sp2;
+	struct smf *sp, *sp2, key;
+	uint64_t m;
 	size_t b;
 
 	AZ(bytes % sc->pagesize);
 	b = bytes / sc->pagesize;
-	if (b >= NBUCKET)
-		b = NBUCKET - 1;
 	sp = NULL;
-	for (; b < NBUCKET - 1; b++) {
-		sp = VTAILQ_FIRST(&sc->free[b]);
-		if (sp != NULL)
-			break;
+	if (b < NBUCKET) {
+		m = sc->free_map & ~(((uint64_t)1 << b) - 1);
+		if (m != 0)
+			sp = VTAILQ_FIRST(&sc->free[__builtin_ctzll(m)]);
 	}
 	if (sp == NULL) {
-		VTAILQ_FOREACH(sp, &sc->free[NBUCKET -1], status)
-			if (sp->size >= bytes)
-				break;
+		key.size = bytes;
+		key.offset = 0;
+		sp = VRB_NFIND(smf_tree, &sc->large, &key);
 	}
 	if (sp == NULL)
 		return (sp);
@@ -252,13 +349,12 @@ alloc_smf(struct smf_sc *sc, size_t bytes)
 	if (sp->size == bytes) {
 		sp->alloc = 1;
 		VTAILQ_INSERT_TAIL(&sc->used, sp, status);
+		smf_largest(sc);
 		return (sp);
 	}
 
 	/* Split from front */
-	sp2 = malloc(sizeof *sp2);
-	XXXAN(sp2);
-	sc->stats->g_smf++;
+	sp2 = get_smf(sc);
 	*sp2 = *sp;
 
 	sp->offset += bytes;
@@ -270,6 +366,7 @@ alloc_smf(struct smf_sc *sc, size_t bytes)
 	VTAILQ_INSERT_BEFORE(sp, sp2, order);
 	VTAILQ_INSERT_TAIL(&sc->used, sp2, status);
 	insfree(sc, sp);
+	smf_largest(sc);
 	return (sp2);
 }
 
@@ -299,8 +396,7 @@ free_smf(struct smf *sp)
 		sp->size += sp2->size;
 		VTAILQ_REMOVE(&sc->order, sp2, order);
 		remfree(sc, sp2);
-		free(sp2);
-		sc->stats->g_smf--;
+		put_smf(sc, sp2);
 	}
 
 	sp2 = VTAILQ_PREV(sp, smfhead, order);
@@ -311,12 +407,12 @@ free_smf(struct smf *sp)
 		remfree(sc, sp2);
 		sp2->size += sp->size;
 		VTAILQ_REMOVE(&sc->order, sp, order);
-		free(sp);
-		sc->stats->g_smf--;
+		put_smf(sc, sp);
 		sp = sp2;
 	}
 
 	insfree(sc, sp);
+	smf_largest(sc);
 }
 
 /*--------------------------------------------------------------------
@@ -329,10 +425,9 @@ new_smf(struct smf_sc *sc, unsigned char *ptr, off_t off, size_t len)
 	struct smf *sp, *sp2;
 
 	AZ(len % sc->pagesize);
-	ALLOC_OBJ(sp, SMF_MAGIC);
-	XXXAN(sp);
+	sp = get_smf(sc);
+	INIT_OBJ(sp, SMF_MAGIC);
 	sp->s.magic = STORAGE_MAGIC;
-	sc->stats->g_smf++;
 
 	sp->sc = sc;
 	sp->size = len;
@@ -377,11 +472,17 @@ smf_open_chunk(struct smf_sc *sc, off_t sz, off_t off, off_t *fail, off_t *sum)
 
 	if (sz > 0 && sz < *fail && sz < SSIZE_MAX) {
 		p = mmap(NULL, sz, PROT_READ|PROT_WRITE,
-		    MAP_NOCORE | MAP_NOSYNC | MAP_SHARED, sc->fd, off);
+		    MAP_NOCORE | MAP_NOSYNC | MAP_SHARED | sc->mapflags,
+		    sc->fd, off);
 		if (p != MAP_FAILED) {
 			(void) madvise(p, sz, sc->advice);
+#ifdef MADV_HUGEPAGE
+			if (sc->hugepage)
+				(void) madvise(p, sz, MADV_HUGEPAGE);
+#endif
 			(*sum) += sz;
 			new_smf(sc, p, off, sz);
+			STV_FileMap(p, sz, sc->fd, off);
 			return;
 		}
 	}
@@ -398,6 +499,13 @@ smf_open_chunk(struct smf_sc *sc, off_t sz, off_t off, off_t *fail, off_t *sum)
 	smf_open_chunk(sc, sz - h, off + h, fail, sum);
 }
 
+static void
+smf_open_once(void)
+{
+
+	lck_smf = Lck_CreateClass("smf");
+}
+
 static void __match_proto__(storage_open_f)
 smf_open(struct stevedore *st)
 {
@@ -405,10 +513,8 @@ smf_open(struct stevedore *st)
 	off_t fail = 1 << 30;	/* XXX: where is OFF_T_MAX ? */
 	off_t sum = 0;
 
-	ASSERT_CLI();
-	st->lru = LRU_Alloc();
-	if (lck_smf == NULL)
-		lck_smf = Lck_CreateClass("smf");
+	st->lru = LRU_Alloc(st->lru_nshard, st->lru_mode);
+	AZ(pthread_once(&smf_once, smf_open_once));
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
 	sc->stats = VSM_Alloc(sizeof *sc->stats,
 	    VSC_CLASS, VSC_type_smf, st->ident);
@@ -482,6 +588,24 @@ smf_free(struct storage *s)
 	Lck_Unlock(&sc->mtx);
 }
 
+/*--------------------------------------------------------------------
+ * Have the kernel start reading in a segment we are about to deliver.
+ */
+
+static void __match_proto__(sml_prefetch_f)
+smf_prefetch(const struct storage *s)
+{
+	uintptr_t p, pg;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	if (s->len == 0)
+		return;
+	pg = getpagesize();
+	p = (uintptr_t)s->ptr & ~(pg - 1);
+	(void)madvise((void *)p, (uintptr_t)s->ptr + s->len - p,
+	    MADV_WILLNEED);
+}
+
 /*--------------------------------------------------------------------*/
 
 const struct stevedore smf_stevedore = {
@@ -489,8 +613,10 @@ const struct stevedore smf_stevedore = {
 	.name		=	"file",
 	.init		=	smf_init,
 	.open		=	smf_open,
+	.parallel_open	=	1,
 	.sml_alloc	=	smf_alloc,
 	.sml_free	=	smf_free,
+	.sml_prefetch	=	smf_prefetch,
 	.allocobj	=	SML_allocobj,
 	.panic		=	SML_panic,
 	.methods	=	&SML_methods,
@@ -37,12 +37,45 @@
 #include "hash/hash_slinger.h"
 
 #include "storage/storage.h"
+#include "vtim.h"
+
+/*--------------------------------------------------------------------
+ * The LRU can be split into a number of shards, each with its own list
+ * and lock, an objcore is assigned to a shard by its address.
+ *
+ * In clock mode a hit only sets the objcore's reference bit, without
+ * taking any lock, and LRU_NukeOne() gives referenced objects a second
+ * chance by moving them to the tail of their shard.
+ *
+ * In size mode the list is kept as in strict mode, but LRU_NukeOne()
+ * looks at the lru_size_window first unused objects, and nukes the one
+ * with the fewest hits per byte, in the style of GDSF.  Large cold
+ * objects go before small popular ones, and a large insert frees more
+ * space with each nuke.
+ *
+ * Each shard also has a cursor for LRU_Cold(), at the first object it
+ * has not looked at.  Objects only join the list at the tail, so all
+ * after the cursor are yet to be looked at, and an object leaving from
+ * under the cursor hands it on to the next one.
+ */
+
+struct lru_shard {
+	VTAILQ_HEAD(,objcore)	lru_head;
+	struct lock		mtx;
+	unsigned		n_oc;
+	struct objcore		*cold;
+};
 
 struct lru {
 	unsigned		magic;
 #define LRU_MAGIC		0x3fec7bb0
-	VTAILQ_HEAD(,objcore)	lru_head;
-	struct lock		mtx;
+	unsigned		nshard;
+	unsigned		clock;
+	unsigned		size;
+	unsigned		nuke_next;
+	unsigned		cold_next;
+	double			t_nuke;		/* last LRU_NukeOne() */
+	struct lru_shard	*shard;
 };
 
 static struct lru *
@@ -54,15 +87,54 @@ lru_get(const struct objcore *oc)
 	return (oc->stobj->stevedore->lru);
 }
 
+static struct lru_shard *
+lru_shard(const struct lru *lru, const struct objcore *oc)
+{
+
+	if (lru->nshard == 1)
+		return (lru->shard);
+	return (&lru->shard[((uintptr_t)oc >> 4) % lru->nshard]);
+}
+
+static void
+lru_unlink(struct lru_shard *ls, struct objcore *oc)
+{
+
+	Lck_AssertHeld(&ls->mtx);
+	if (ls->cold == oc)
+		ls->cold = VTAILQ_NEXT(oc, lru_list);
+	VTAILQ_REMOVE(&ls->lru_head, oc, lru_list);
+}
+
+static void
+lru_append(struct lru_shard *ls, struct objcore *oc)
+{
+
+	Lck_AssertHeld(&ls->mtx);
+	VTAILQ_INSERT_TAIL(&ls->lru_head, oc, lru_list);
+	if (ls->cold == NULL)
+		ls->cold = oc;
+}
+
 struct lru *
-LRU_Alloc(void)
+LRU_Alloc(unsigned nshard, unsigned mode)
 {
 	struct lru *lru;
+	unsigned u;
 
+	if (nshard == 0)
+		nshard = 1;
 	ALLOC_OBJ(lru, LRU_MAGIC);
 	AN(lru);
-	VTAILQ_INIT(&lru->lru_head);
-	Lck_New(&lru->mtx, lck_lru);
+	lru->nshard = nshard;
+	lru->clock = mode == LRU_CLOCK;
+	lru->size = mode == LRU_SIZE;
+	lru->shard = calloc(nshard, sizeof *lru->shard);
+	AN(lru->shard);
+	for (u = 0; u < nshard; u++) {
+		VTAILQ_INIT(&lru->shard[u].lru_head);
+		Lck_New(&lru->shard[u].mtx, lck_lru);
+	}
 	return (lru);
 }
 
@@ -70,12 +142,20 @@ void
 LRU_Free(struct lru **pp)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
+	unsigned u;
 
 	TAKE_OBJ_NOTNULL(lru, pp, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	AN(VTAILQ_EMPTY(&lru->lru_head));
-	Lck_Unlock(&lru->mtx);
-	Lck_Delete(&lru->mtx);
+	for (u = 0; u < lru->nshard; u++) {
+		ls = &lru->shard[u];
+		Lck_Lock(&ls->mtx);
+		AN(VTAILQ_EMPTY(&ls->lru_head));
+		AZ(ls->n_oc);
+		AZ(ls->cold);
+		Lck_Unlock(&ls->mtx);
+		Lck_Delete(&ls->mtx);
+	}
+	free(lru->shard);
 	FREE_OBJ(lru);
 }
 
@@ -83,6 +163,7 @@ void
 LRU_Add(struct objcore *oc, double now)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -94,17 +175,21 @@ LRU_Add(struct objcore *oc, double now)
 	AZ(isnan(now));
 	lru = lru_get(oc);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	ls = lru_shard(lru, oc);
+	Lck_Lock(&ls->mtx);
+	lru_append(ls, oc);
+	ls->n_oc++;
 	oc->last_lru = now;
+	oc->lru_ref = 0;
 	AZ(isnan(oc->last_lru));
-	Lck_Unlock(&lru->mtx);
+	Lck_Unlock(&ls->mtx);
 }
 
 void
 LRU_Remove(struct objcore *oc)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -114,17 +199,21 @@ LRU_Remove(struct objcore *oc)
 	AZ(oc->boc);
 	lru = lru_get(oc);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
+	ls = lru_shard(lru, oc);
+	Lck_Lock(&ls->mtx);
 	AZ(isnan(oc->last_lru));
-	VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
+	lru_unlink(ls, oc);
+	AN(ls->n_oc);
+	ls->n_oc--;
 	oc->last_lru = NAN;
-	Lck_Unlock(&lru->mtx);
+	Lck_Unlock(&ls->mtx);
 }
 
 void __match_proto__(objtouch_f)
 LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 {
 	struct lru *lru;
+	struct lru_shard *ls;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -132,6 +221,24 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 	if (oc->flags & OC_F_PRIVATE || isnan(oc->last_lru))
 		return;
 
+	lru = lru_get(oc);
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+
+	/*
+	 * In clock mode, we only set the reference bit.  It is only
+	 * looked at under the shard lock, so a racing hit on an object
+	 * going away is harmless.  Avoid dirtying the cacheline if the
+	 * bit is already set.
+	 *
+	 * The delivery of the miss which created the object may come
+	 * before or after LRU_Add(), so only hits count as references.
+	 */
+	if (lru->clock) {
+		if (!oc->lru_ref && oc->hits > 0)
+			oc->lru_ref = 1;
+		return;
+	}
+
 	/*
 	 * To avoid the exphdl->mtx becoming a hotspot, we only
 	 * attempt to move objects if they have not been moved
@@ -142,19 +249,18 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 	if (now - oc->last_lru < cache_param->lru_interval)
 		return;
 
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	ls = lru_shard(lru, oc);
 
-	if (Lck_Trylock(&lru->mtx))
+	if (Lck_Trylock(&ls->mtx))
 		return;
 
 	if (!isnan(oc->last_lru)) {
-		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-		VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+		lru_unlink(ls, oc);
+		lru_append(ls, oc);
 		VSC_C_main->n_lru_moved++;
 		oc->last_lru = now;
 	}
-	Lck_Unlock(&lru->mtx);
+	Lck_Unlock(&ls->mtx);
 }
 
 /*--------------------------------------------------------------------
@@ -163,31 +269,105 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
  * Returns: 1: did, 0: didn't;
  */
 
-int
-LRU_NukeOne(struct worker *wrk, struct lru *lru)
+/*
+ * Find the unused object with the fewest hits per byte among the first
+ * lru_size_window of them.  Objects can only leave the list under the
+ * shard lock, so their length can be looked at.
+ */
+
+static struct objcore *
+lru_size_cand(struct worker *wrk, const struct lru_shard *ls)
 {
-	struct objcore *oc, *oc2;
+	struct objcore *oc, *best = NULL;
+	double cost, bcost = 0.;
+	unsigned n = 0;
 
-	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	Lck_AssertHeld(&ls->mtx);
+	VTAILQ_FOREACH(oc, &ls->lru_head, lru_list) {
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		if (oc->refcnt != 1 || oc->boc != NULL ||
+		    (oc->flags & OC_F_DYING))
+			continue;
+		cost = (oc->hits + 1.) / (ObjGetLen(wrk, oc) + 1.);
+		if (best == NULL || cost < bcost) {
+			best = oc;
+			bcost = cost;
+		}
+		if (++n >= cache_param->lru_size_window)
+			break;
+	}
+	return (best);
+}
 
-	/* Find the first currently unused object on the LRU.  */
-	Lck_Lock(&lru->mtx);
-	VTAILQ_FOREACH_SAFE(oc, &lru->lru_head, lru_list, oc2) {
+static struct objcore *
+lru_nuke_shard(struct worker *wrk, const struct lru *lru, struct lru_shard *ls)
+{
+	struct objcore *oc, *oc2;
+	unsigned n = 0;
+
+	Lck_Lock(&ls->mtx);
+	if (lru->size) {
+		oc = lru_size_cand(wrk, ls);
+		if (oc != NULL && HSH_Snipe(wrk, oc)) {
+			VSC_C_main->n_lru_nuked++;
+			lru_unlink(ls, oc);
+			lru_append(ls, oc);
+			Lck_Unlock(&ls->mtx);
+			return (oc);
+		}
+	}
+	VTAILQ_FOREACH_SAFE(oc, &ls->lru_head, lru_list, oc2) {
 		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 		AZ(isnan(oc->last_lru));
 
+		/*
+		 * Give recently referenced objects a second chance, but
+		 * do not keep going around if we are hit hard enough to
+		 * set the bits again while we walk the list.
+		 */
+		if (lru->clock && oc->lru_ref && ++n <= ls->n_oc) {
+			oc->lru_ref = 0;
+			lru_unlink(ls, oc);
+			lru_append(ls, oc);
+			VSC_C_main->n_lru_moved++;
+			if (oc2 == NULL)
+				oc2 = oc;
+			continue;
+		}
+
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
 		    oc, oc->flags, oc->refcnt);
 
 		if (HSH_Snipe(wrk, oc)) {
 			VSC_C_main->n_lru_nuked++; // XXX per lru ?
-			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-			VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+			lru_unlink(ls, oc);
+			lru_append(ls, oc);
 			break;
 		}
 	}
-	Lck_Unlock(&lru->mtx);
+	Lck_Unlock(&ls->mtx);
+	return (oc);
+}
+
+int
+LRU_NukeOne(struct worker *wrk, struct lru *lru)
+{
+	struct objcore *oc = NULL;
+	unsigned u, n;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+
+	/*
+	 * Find the first currently unused object on the LRU, starting
+	 * with a different shard every time.  The unlocked increment of
+	 * nuke_next may lose updates, but it only needs to spread us out.
+	 */
+	lru->t_nuke = VTIM_real();
+	n = lru->nuke_next++;
+	for (u = 0; u < lru->nshard && oc == NULL; u++)
+		oc = lru_nuke_shard(wrk, lru,
+		    &lru->shard[(n + u) % lru->nshard]);
 
 	if (oc == NULL) {
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Fail");
@@ -201,3 +381,135 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 	(void)HSH_DerefObjCore(wrk, &oc, 0);	// Ref from HSH_Snipe
 	return (1);
 }
+
+double
+LRU_LastNuke(const struct lru *lru)
+{
+
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	return (lru->t_nuke);
+}
+
+/*--------------------------------------------------------------------
+ * Get the digest of the object which is likely to be nuked next, for
+ * ADM_Admit().
+ * Returns: 1: did, 0: didn't;
+ */
+
+int
+LRU_Victim(struct lru *lru, uint8_t *digest)
+{
+	struct lru_shard *ls;
+	struct objcore *oc, *first = NULL;
+
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	AN(digest);
+
+	ls = &lru->shard[lru->nuke_next % lru->nshard];
+	Lck_Lock(&ls->mtx);
+	VTAILQ_FOREACH(oc, &ls->lru_head, lru_list) {
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		if (first == NULL)
+			first = oc;
+		if (!lru->clock || !oc->lru_ref)
+			break;
+	}
+	if (oc == NULL)
+		oc = first;
+	if (oc != NULL) {
+		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+		memcpy(digest, oc->objhead->digest, DIGEST_LEN);
+	}
+	Lck_Unlock(&ls->mtx);
+	return (oc != NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Get a reference to the next object not used since 'before' and not
+ * in use now, for the stevedore to do things to while it is idle.
+ * Every object is handed out once, until it is used again.
+ */
+
+struct objcore *
+LRU_Cold(struct lru *lru, double before)
+{
+	struct lru_shard *ls;
+	struct objcore *oc = NULL;
+	unsigned u, n;
+
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+
+	n = lru->cold_next++;
+	for (u = 0; u < lru->nshard && oc == NULL; u++) {
+		ls = &lru->shard[(n + u) % lru->nshard];
+		Lck_Lock(&ls->mtx);
+		while ((oc = ls->cold) != NULL) {
+			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+			if (oc->last_lru >= before)
+				break;
+			ls->cold = VTAILQ_NEXT(oc, lru_list);
+			if (oc->refcnt != 1 || oc->boc != NULL ||
+			    (lru->clock && oc->lru_ref) ||
+			    Lck_Trylock(&oc->objhead->mtx))
+				continue;
+			if (oc->refcnt == 1 && !(oc->flags & OC_F_DYING)) {
+				(void)__sync_add_and_fetch(&oc->refcnt, 1);
+				Lck_Unlock(&oc->objhead->mtx);
+				break;
+			}
+			Lck_Unlock(&oc->objhead->mtx);
+		}
+		if (oc != NULL && oc->last_lru >= before)
+			oc = NULL;
+		Lck_Unlock(&ls->mtx);
+	}
+	return (oc);
+}
+
+/*--------------------------------------------------------------------
+ * Get references to the objects in shard 'u', the most recently used
+ * first.  Objects whose objhead is busy are left out.  Returns NULL
+ * past the last shard, or when out of memory.
+ */
+
+struct objcore **
+LRU_Hot(struct lru *lru, unsigned u, unsigned *np)
+{
+	struct lru_shard *ls;
+	struct objcore *oc, **ocp;
+	unsigned n = 0, i;
+
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	AN(np);
+	*np = 0;
+	if (u >= lru->nshard)
+		return (NULL);
+	ls = &lru->shard[u];
+	Lck_Lock(&ls->mtx);
+	ocp = calloc(ls->n_oc + 1L, sizeof *ocp);
+	if (ocp == NULL) {
+		Lck_Unlock(&ls->mtx);
+		return (NULL);
+	}
+	VTAILQ_FOREACH(oc, &ls->lru_head, lru_list) {
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		if (n == ls->n_oc)
+			break;
+		if (oc->refcnt == 0 || oc->boc != NULL ||
+		    Lck_Trylock(&oc->objhead->mtx))
+			continue;
+		if (oc->refcnt > 0 && !(oc->flags & OC_F_DYING)) {
+			(void)__sync_add_and_fetch(&oc->refcnt, 1);
+			ocp[n++] = oc;
+		}
+		Lck_Unlock(&oc->objhead->mtx);
+	}
+	Lck_Unlock(&ls->mtx);
+	for (i = 0; i < n / 2; i++) {
+		oc = ocp[i];
+		ocp[i] = ocp[n - 1 - i];
+		ocp[n - 1 - i] = oc;
+	}
+	*np = n;
+	return (ocp);
+}
@@ -33,14 +33,82 @@
 
 #include "cache/cache.h"
 
+#include <sys/mman.h>
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "storage/storage.h"
 #include "storage/storage_simple.h"
 
 #include "vrt.h"
 #include "vnum.h"
+#include "vtree.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/*--------------------------------------------------------------------
+ * With more than one shard, allocations are accounted against a shard
+ * picked by the calling thread.  Each shard holds a slice of the global
+ * space budget (sh_space) so the common case only takes the shard lock,
+ * and it keeps a few recently freed segments per power-of-two size class
+ * for reuse without going through malloc(3).  The shard counters are
+ * folded into the VSC fields whenever the global lock is taken, and at
+ * least every SMA_FOLD_OPS operations, so they may lag slightly.
+ */
+
+#define SMA_NSHARD_MAX		64
+#define SMA_CLASS_MIN		12	/* 4k */
+#define SMA_CLASS_MAX		20	/* 1M */
+#define SMA_NCLASS		(SMA_CLASS_MAX - SMA_CLASS_MIN + 1)
+#define SMA_CLASS_DEPTH		8
+#define SMA_FOLD_OPS		64
+
+/*--------------------------------------------------------------------
+ * With an arena, all of the space is mapped and faulted in when the
+ * stevedore is opened, optionally on huge pages, and segments are
+ * carved out of it rather than malloc(3)'ed.  Every piece of the arena
+ * has a struct sma, kept in address order so that freed pieces can be
+ * joined with their free neighbours, and the free ones are also in a
+ * tree by size, for best fit allocation.
+ */
+
+#define SMA_ARENA_ALIGN		64
+
+enum sma_arena_e {
+	SMA_ARENA_NONE = 0,
+	SMA_ARENA_PREFAULT,
+	SMA_ARENA_HUGETLB,
+	SMA_ARENA_HUGETLB1G,
+};
+
+VTAILQ_HEAD(sma_freelist, storage);
+VTAILQ_HEAD(sma_order, sma);
+VRB_HEAD(sma_tree, sma);
+
+struct sma_shard {
+	unsigned		magic;
+#define SMA_SHARD_MAGIC		0x4b0d1e25
+	struct lock		mtx;
+	struct sma_sc		*sc;
+
+	size_t			sh_space;
+	struct sma_freelist	freelist[SMA_NCLASS];
+	unsigned		nfree[SMA_NCLASS];
+
+	/* Not yet folded into sc->stats */
+	unsigned		ops;
+	uint64_t		c_req;
+	uint64_t		c_fail;
+	uint64_t		c_bytes;
+	uint64_t		c_freed;
+	int64_t			g_alloc;
+	int64_t			g_bytes;
+};
 
 struct sma_sc {
 	unsigned		magic;
@@ -49,6 +117,17 @@ struct sma_sc {
 	size_t			sma_max;
 	size_t			sma_alloc;
 	struct VSC_C_sma	*stats;
+
+	unsigned		nshard;
+	size_t			sh_refill;
+	struct sma_shard	*shards;
+
+	enum sma_arena_e	arena;
+	struct lock		arena_mtx;
+	uint8_t			*arena_base;
+	size_t			arena_len;
+	struct sma_order	arena_order;
+	struct sma_tree		arena_free;
 };
 
 struct sma {
@@ -57,18 +136,391 @@ struct sma {
 	struct storage		s;
 	size_t			sz;
 	struct sma_sc		*sc;
+	struct sma_shard	*sh;
+
+	/* Only with an arena */
+	size_t			a_len;
+	unsigned		a_isfree;
+	VTAILQ_ENTRY(sma)	a_order;
+	VRB_ENTRY(sma)		a_tree;
 };
 
+static inline int
+sma_cmp(const struct sma *a, const struct sma *b)
+{
+
+	if (a->a_len != b->a_len)
+		return (a->a_len < b->a_len ? -1 : 1);
+	if (a->s.ptr != b->s.ptr)
+		return (a->s.ptr < b->s.ptr ? -1 : 1);
+	return (0);
+}
+
+VRB_PROTOTYPE_STATIC(sma_tree, sma, a_tree, sma_cmp)
+VRB_GENERATE_STATIC(sma_tree, sma, a_tree, sma_cmp)
+
 static struct VSC_C_lck *lck_sma;
+static struct lock sma_thr_mtx;
+static pthread_key_t sma_thr_key;
+static pthread_once_t sma_once = PTHREAD_ONCE_INIT;
+static unsigned sma_nthr;
+
+/*--------------------------------------------------------------------*/
+
+static struct sma *
+sma_arena_get(struct sma_sc *sc, size_t size)
+{
+	struct sma *sma, *sp, key;
+
+	ALLOC_OBJ(sma, SMA_MAGIC);
+	if (sma == NULL)
+		return (NULL);
+	sma->a_len = RUP2(size, SMA_ARENA_ALIGN);
+	key.a_len = sma->a_len;
+	key.s.ptr = NULL;
+
+	Lck_Lock(&sc->arena_mtx);
+	sp = VRB_NFIND(sma_tree, &sc->arena_free, &key);
+	if (sp == NULL) {
+		Lck_Unlock(&sc->arena_mtx);
+		FREE_OBJ(sma);
+		return (NULL);
+	}
+	AN(sp->a_isfree);
+	assert(sp->a_len >= sma->a_len);
+	VRB_REMOVE(sma_tree, &sc->arena_free, sp);
+	sma->s.ptr = sp->s.ptr;
+	VTAILQ_INSERT_BEFORE(sp, sma, a_order);
+	sp->a_len -= sma->a_len;
+	if (sp->a_len > 0) {
+		sp->s.ptr = (uint8_t *)sp->s.ptr + sma->a_len;
+		AZ(VRB_INSERT(sma_tree, &sc->arena_free, sp));
+		sp = NULL;
+	} else
+		VTAILQ_REMOVE(&sc->arena_order, sp, a_order);
+	Lck_Unlock(&sc->arena_mtx);
+	if (sp != NULL)
+		FREE_OBJ(sp);
+	return (sma);
+}
+
+static void
+sma_arena_put(struct sma_sc *sc, struct sma *sma)
+{
+	struct sma *prev, *next;
+
+	Lck_Lock(&sc->arena_mtx);
+	AZ(sma->a_isfree);
+	next = VTAILQ_NEXT(sma, a_order);
+	if (next != NULL && next->a_isfree) {
+		VRB_REMOVE(sma_tree, &sc->arena_free, next);
+		VTAILQ_REMOVE(&sc->arena_order, next, a_order);
+		sma->a_len += next->a_len;
+	} else
+		next = NULL;
+	prev = VTAILQ_PREV(sma, sma_order, a_order);
+	if (prev != NULL && prev->a_isfree) {
+		VRB_REMOVE(sma_tree, &sc->arena_free, prev);
+		VTAILQ_REMOVE(&sc->arena_order, sma, a_order);
+		prev->a_len += sma->a_len;
+		FREE_OBJ(sma);
+		sma = prev;
+	}
+	sma->a_isfree = 1;
+	AZ(VRB_INSERT(sma_tree, &sc->arena_free, sma));
+	Lck_Unlock(&sc->arena_mtx);
+	if (next != NULL)
+		FREE_OBJ(next);
+}
+
+/*
+ * Get the memory for a segment, and its struct sma, which the caller
+ * fills in, and give them back.
+ */
+
+static struct sma *
+sma_new(struct sma_sc *sc, size_t size)
+{
+	struct sma *sma;
+	void *p;
+
+	if (sc->arena_base != NULL)
+		return (sma_arena_get(sc, size));
+	p = malloc(size);
+	if (p == NULL)
+		return (NULL);
+	ALLOC_OBJ(sma, SMA_MAGIC);
+	if (sma == NULL) {
+		free(p);
+		return (NULL);
+	}
+	sma->s.ptr = p;
+	return (sma);
+}
+
+static void
+sma_del(struct sma_sc *sc, struct sma *sma)
+{
+
+	if (sc->arena_base != NULL) {
+		sma_arena_put(sc, sma);
+		return;
+	}
+	free(sma->s.ptr);
+	free(sma);
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct sma_shard *
+sma_shard_get(const struct sma_sc *sc)
+{
+	uintptr_t u;
+
+	u = (uintptr_t)pthread_getspecific(sma_thr_key);
+	if (u == 0) {
+		Lck_Lock(&sma_thr_mtx);
+		u = ++sma_nthr;
+		Lck_Unlock(&sma_thr_mtx);
+		AZ(pthread_setspecific(sma_thr_key, (void*)u));
+	}
+	return (&sc->shards[(u - 1) % sc->nshard]);
+}
+
+static int
+sma_class(size_t size)
+{
+	int i;
+
+	for (i = SMA_CLASS_MIN; i <= SMA_CLASS_MAX; i++)
+		if (size == (size_t)1 << i)
+			return (i - SMA_CLASS_MIN);
+	return (-1);
+}
+
+static void
+sma_shard_fold(struct sma_shard *sh)
+{
+	struct sma_sc *sc;
+
+	sc = sh->sc;
+	Lck_AssertHeld(&sh->mtx);
+	Lck_AssertHeld(&sc->sma_mtx);
+	sc->stats->c_req += sh->c_req;
+	sc->stats->c_fail += sh->c_fail;
+	sc->stats->c_bytes += sh->c_bytes;
+	sc->stats->c_freed += sh->c_freed;
+	sc->stats->g_alloc += sh->g_alloc;
+	sc->stats->g_bytes += sh->g_bytes;
+	if (sc->sma_max != SIZE_MAX)
+		sc->stats->g_space -= sh->g_bytes;
+	sh->ops = 0;
+	sh->c_req = 0;
+	sh->c_fail = 0;
+	sh->c_bytes = 0;
+	sh->c_freed = 0;
+	sh->g_alloc = 0;
+	sh->g_bytes = 0;
+}
+
+static void
+sma_shard_maybe_fold(struct sma_shard *sh)
+{
+
+	Lck_AssertHeld(&sh->mtx);
+	if (++sh->ops < SMA_FOLD_OPS || Lck_Trylock(&sh->sc->sma_mtx))
+		return;
+	sma_shard_fold(sh);
+	Lck_Unlock(&sh->sc->sma_mtx);
+}
+
+/* Grab at least size bytes of space for the shard from the global pool */
+
+static int
+sma_shard_reserve(struct sma_shard *sh, size_t size)
+{
+	struct sma_sc *sc;
+	size_t need, want;
+	int retval = 0;
+
+	sc = sh->sc;
+	Lck_AssertHeld(&sh->mtx);
+	assert(sh->sh_space < size);
+	need = size - sh->sh_space;
+	want = need + sc->sh_refill;
+	Lck_Lock(&sc->sma_mtx);
+	if (sc->sma_alloc + want > sc->sma_max)
+		want = need;
+	if (sc->sma_alloc + want <= sc->sma_max) {
+		sc->sma_alloc += want;
+		sh->sh_space += want;
+		retval = 1;
+	}
+	sma_shard_fold(sh);
+	Lck_Unlock(&sc->sma_mtx);
+	return (retval);
+}
+
+/* Hand back shard space in excess of keep to the global pool */
+
+static void
+sma_shard_release(struct sma_shard *sh, size_t keep)
+{
+	struct sma_sc *sc;
+
+	sc = sh->sc;
+	Lck_AssertHeld(&sh->mtx);
+	Lck_Lock(&sc->sma_mtx);
+	if (sh->sh_space > keep) {
+		assert(sc->sma_alloc >= sh->sh_space - keep);
+		sc->sma_alloc -= sh->sh_space - keep;
+		sh->sh_space = keep;
+	}
+	sma_shard_fold(sh);
+	Lck_Unlock(&sc->sma_mtx);
+}
+
+/* Free all cached segments and hand back all space held by the shard */
+
+static void
+sma_shard_drain(struct sma_shard *sh)
+{
+	struct storage *st;
+	struct sma *sma;
+	int i;
+
+	Lck_AssertHeld(&sh->mtx);
+	for (i = 0; i < SMA_NCLASS; i++) {
+		while (!VTAILQ_EMPTY(&sh->freelist[i])) {
+			st = VTAILQ_FIRST(&sh->freelist[i]);
+			VTAILQ_REMOVE(&sh->freelist[i], st, list);
+			sh->nfree[i]--;
+			CAST_OBJ_NOTNULL(sma, st->priv, SMA_MAGIC);
+			sh->sh_space += sma->sz;
+			sma_del(sh->sc, sma);
+		}
+		AZ(sh->nfree[i]);
+	}
+	sma_shard_release(sh, 0);
+}
+
+static struct storage *
+sma_shard_alloc(struct sma_sc *sc, size_t size)
+{
+	struct sma_shard *sh;
+	struct storage *st;
+	struct sma *sma = NULL;
+	unsigned u;
+	int cl;
+
+	sh = sma_shard_get(sc);
+	cl = sma_class(size);
+
+	Lck_Lock(&sh->mtx);
+	sh->c_req++;
+	if (cl >= 0 && sh->nfree[cl] > 0) {
+		st = VTAILQ_FIRST(&sh->freelist[cl]);
+		VTAILQ_REMOVE(&sh->freelist[cl], st, list);
+		sh->nfree[cl]--;
+		sh->c_bytes += size;
+		sh->g_alloc++;
+		sh->g_bytes += size;
+		sma_shard_maybe_fold(sh);
+		Lck_Unlock(&sh->mtx);
+		CAST_OBJ_NOTNULL(sma, st->priv, SMA_MAGIC);
+		assert(sma->sz == size);
+		sma->s.len = 0;
+		return (&sma->s);
+	}
+	if (sh->sh_space < size && !sma_shard_reserve(sh, size)) {
+		Lck_Unlock(&sh->mtx);
+		/* Reclaim what the other shards are sitting on and retry */
+		for (u = 0; u < sc->nshard; u++) {
+			Lck_Lock(&sc->shards[u].mtx);
+			sma_shard_drain(&sc->shards[u]);
+			Lck_Unlock(&sc->shards[u].mtx);
+		}
+		Lck_Lock(&sh->mtx);
+		if (sh->sh_space < size && !sma_shard_reserve(sh, size)) {
+			sh->c_fail++;
+			sma_shard_maybe_fold(sh);
+			Lck_Unlock(&sh->mtx);
+			return (NULL);
+		}
+	}
+	sh->sh_space -= size;
+	sh->c_bytes += size;
+	sh->g_alloc++;
+	sh->g_bytes += size;
+	sma_shard_maybe_fold(sh);
+	Lck_Unlock(&sh->mtx);
+
+	sma = sma_new(sc, size);
+	if (sma == NULL) {
+		Lck_Lock(&sh->mtx);
+		sh->c_fail++;
+		sh->sh_space += size;
+		sh->c_bytes -= size;
+		sh->g_alloc--;
+		sh->g_bytes -= size;
+		Lck_Unlock(&sh->mtx);
+		return (NULL);
+	}
+	sma->sc = sc;
+	sma->sh = sh;
+	sma->sz = size;
+	sma->s.priv = sma;
+	sma->s.len = 0;
+	sma->s.space = size;
+	sma->s.magic = STORAGE_MAGIC;
+	return (&sma->s);
+}
+
+static void
+sma_shard_free(struct sma *sma)
+{
+	struct sma_shard *sh;
+	size_t sz;
+	int cl;
+
+	CHECK_OBJ_NOTNULL(sma, SMA_MAGIC);
+	CHECK_OBJ_NOTNULL(sma->sh, SMA_SHARD_MAGIC);
+	sh = sma->sh;
+	sz = sma->sz;
+	cl = sma_class(sz);
+
+	Lck_Lock(&sh->mtx);
+	sh->g_alloc--;
+	sh->g_bytes -= sz;
+	sh->c_freed += sz;
+	if (cl >= 0 && sh->nfree[cl] < SMA_CLASS_DEPTH) {
+		VTAILQ_INSERT_HEAD(&sh->freelist[cl], &sma->s, list);
+		sh->nfree[cl]++;
+		sma_shard_maybe_fold(sh);
+		Lck_Unlock(&sh->mtx);
+		return;
+	}
+	sh->sh_space += sz;
+	if (sh->sh_space > 2 * sh->sc->sh_refill)
+		sma_shard_release(sh, sh->sc->sh_refill);
+	else
+		sma_shard_maybe_fold(sh);
+	Lck_Unlock(&sh->mtx);
+	sma_del(sh->sc, sma);
+}
+
+/*--------------------------------------------------------------------*/
 
 static struct storage * __match_proto__(sml_alloc_f)
 sma_alloc(const struct stevedore *st, size_t size)
 {
 	struct sma_sc *sma_sc;
 	struct sma *sma = NULL;
-	void *p;
 
 	CAST_OBJ_NOTNULL(sma_sc, st->priv, SMA_SC_MAGIC);
+	if (sma_sc->nshard > 1)
+		return (sma_shard_alloc(sma_sc, size));
+
 	Lck_Lock(&sma_sc->sma_mtx);
 	sma_sc->stats->c_req++;
 	if (sma_sc->sma_alloc + size > sma_sc->sma_max) {
@@ -94,14 +546,7 @@ sma_alloc(const struct stevedore *st, size_t size)
 	 * allocations growing another full page, just to accommodate the sma.
 	 */
 
-	p = malloc(size);
-	if (p != NULL) {
-		ALLOC_OBJ(sma, SMA_MAGIC);
-		if (sma != NULL)
-			sma->s.ptr = p;
-		else
-			free(p);
-	}
+	sma = sma_new(sma_sc, size);
 	if (sma == NULL) {
 		Lck_Lock(&sma_sc->sma_mtx);
 		/*
@@ -135,8 +580,12 @@ sma_free(struct storage *s)
 
 	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
 	CAST_OBJ_NOTNULL(sma, s->priv, SMA_MAGIC);
-	sma_sc = sma->sc;
 	assert(sma->sz == sma->s.space);
+	if (sma->sh != NULL) {
+		sma_shard_free(sma);
+		return;
+	}
+	sma_sc = sma->sc;
 	Lck_Lock(&sma_sc->sma_mtx);
 	sma_sc->sma_alloc -= sma->sz;
 	sma_sc->stats->g_alloc--;
@@ -145,8 +594,7 @@ sma_free(struct storage *s)
 	if (sma_sc->sma_max != SIZE_MAX)
 		sma_sc->stats->g_space += sma->sz;
 	Lck_Unlock(&sma_sc->sma_mtx);
-	free(sma->s.ptr);
-	free(sma);
+	sma_del(sma_sc, sma);
 }
 
 static VCL_BYTES __match_proto__(stv_var_used_space)
@@ -171,7 +619,9 @@ static void
 sma_init(struct stevedore *parent, int ac, char * const *av)
 {
 	const char *e;
+	char *p;
 	uintmax_t u;
+	unsigned long ul;
 	struct sma_sc *sc;
 
 	ASSERT_MGT();
@@ -179,12 +629,51 @@ sma_init(struct stevedore *parent, int ac, char * const *av)
 	AN(sc);
 	sc->sma_max = SIZE_MAX;
 	assert(sc->sma_max == SIZE_MAX);
+	sc->nshard = 1;
 	parent->priv = sc;
 
 	AZ(av[ac]);
-	if (ac > 1)
+	if (ac > 4)
 		ARGV_ERR("(-smalloc) too many arguments\n");
 
+	if (ac > 3 && *av[3] != '\0') {
+		if (*av[3] != '/')
+			ARGV_ERR("(-smalloc) snapshot file \"%s\": "
+			    "must be an absolute path\n", av[3]);
+		parent->snapshot = strdup(av[3]);
+		AN(parent->snapshot);
+	}
+
+	if (ac > 2 && *av[2] != '\0') {
+		if (!strcmp(av[2], "prefault"))
+			sc->arena = SMA_ARENA_PREFAULT;
+		else if (!strcmp(av[2], "hugetlb"))
+			sc->arena = SMA_ARENA_HUGETLB;
+		else if (!strcmp(av[2], "hugetlb1g"))
+			sc->arena = SMA_ARENA_HUGETLB1G;
+		else
+			ARGV_ERR("(-smalloc) invalid arena: \"%s\"\n", av[2]);
+#ifndef MAP_HUGETLB
+		if (sc->arena == SMA_ARENA_HUGETLB)
+			ARGV_ERR("(-smalloc) hugetlb not supported here\n");
+#endif
+#ifndef MAP_HUGE_1GB
+		if (sc->arena == SMA_ARENA_HUGETLB1G)
+			ARGV_ERR("(-smalloc) hugetlb1g not supported here\n");
+#endif
+		if (ac == 0 || *av[0] == '\0')
+			ARGV_ERR("(-smalloc) an arena needs a size\n");
+	}
+
+	if (ac > 1 && *av[1] != '\0') {
+		ul = strtoul(av[1], &p, 0);
+		if (*p != '\0' || ul < 1 || ul > SMA_NSHARD_MAX)
+			ARGV_ERR("(-smalloc) shards \"%s\": "
+			    "must be a number from 1 to %d\n",
+			    av[1], SMA_NSHARD_MAX);
+		sc->nshard = (unsigned)ul;
+	}
+
 	if (ac == 0 || *av[0] == '\0')
 		 return;
 
@@ -200,15 +689,104 @@ sma_init(struct stevedore *parent, int ac, char * const *av)
 	sc->sma_max = u;
 }
 
+/*
+ * Map the arena and fault it in.  When huge pages were asked for, but
+ * none are to be had, it is made of normal pages, with a hint that the
+ * kernel use transparent huge pages for it.
+ */
+
+static void
+sma_arena_open(const struct stevedore *st, struct sma_sc *sc)
+{
+	struct sma *sma;
+	size_t pg;
+	int flags;
+	void *p = MAP_FAILED;
+
+	AN(sc->arena);
+	flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+	pg = getpagesize();
+#ifdef MAP_HUGETLB
+	if (sc->arena == SMA_ARENA_HUGETLB)
+		pg = 2 * 1024 * 1024;
+#ifdef MAP_HUGE_1GB
+	if (sc->arena == SMA_ARENA_HUGETLB1G)
+		pg = 1024 * 1024 * 1024;
+#endif
+	sc->arena_len = RUP2(sc->sma_max, pg);
+	if (sc->arena == SMA_ARENA_HUGETLB)
+		p = mmap(NULL, sc->arena_len, PROT_READ | PROT_WRITE,
+		    flags | MAP_HUGETLB, -1, 0);
+#ifdef MAP_HUGE_1GB
+	if (sc->arena == SMA_ARENA_HUGETLB1G)
+		p = mmap(NULL, sc->arena_len, PROT_READ | PROT_WRITE,
+		    flags | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+#endif
+	if (p == MAP_FAILED && sc->arena != SMA_ARENA_PREFAULT) {
+		printf("SMA.%s no huge pages (%s), using normal pages\n",
+		    st->ident, strerror(errno));
+		pg = getpagesize();
+	}
+#endif
+	if (p == MAP_FAILED) {
+		sc->arena_len = RUP2(sc->sma_max, pg);
+		p = mmap(NULL, sc->arena_len, PROT_READ | PROT_WRITE,
+		    flags, -1, 0);
+		if (p == MAP_FAILED) {
+			fprintf(stderr, "SMA.%s arena mmap failed: %s\n",
+			    st->ident, strerror(errno));
+			exit(1);
+		}
+#ifdef MADV_HUGEPAGE
+		(void)madvise(p, sc->arena_len, MADV_HUGEPAGE);
+#endif
+#ifndef MAP_POPULATE
+		{
+			size_t u;
+
+			for (u = 0; u < sc->arena_len; u += pg)
+				((volatile uint8_t *)p)[u] = 0;
+		}
+#endif
+	}
+	sc->arena_base = p;
+
+	Lck_New(&sc->arena_mtx, lck_sma);
+	VTAILQ_INIT(&sc->arena_order);
+	VRB_INIT(&sc->arena_free);
+	ALLOC_OBJ(sma, SMA_MAGIC);
+	AN(sma);
+	sma->s.ptr = sc->arena_base;
+	sma->a_len = sc->arena_len;
+	sma->a_isfree = 1;
+	VTAILQ_INSERT_HEAD(&sc->arena_order, sma, a_order);
+	AZ(VRB_INSERT(sma_tree, &sc->arena_free, sma));
+	printf("SMA.%s arena of %zu bytes, %zu byte pages\n",
+	    st->ident, sc->arena_len, pg);
+}
+
+static void
+sma_open_once(void)
+{
+
+	lck_sma = Lck_CreateClass("sma");
+	Lck_New(&sma_thr_mtx, lck_sma);
+	AZ(pthread_key_create(&sma_thr_key, NULL));
+}
+
 static void __match_proto__(storage_open_f)
 sma_open(struct stevedore *st)
 {
 	struct sma_sc *sma_sc;
+	struct sma_shard *sh;
+	unsigned u;
+	int i;
 
-	ASSERT_CLI();
-	st->lru = LRU_Alloc();
-	if (lck_sma == NULL)
-		lck_sma = Lck_CreateClass("sma");
+	st->lru = LRU_Alloc(st->lru_nshard, st->lru_mode);
+	AZ(pthread_once(&sma_once, sma_open_once));
 	CAST_OBJ_NOTNULL(sma_sc, st->priv, SMA_SC_MAGIC);
 	Lck_New(&sma_sc->sma_mtx, lck_sma);
 	sma_sc->stats = VSM_Alloc(sizeof *sma_sc->stats,
@@ -216,6 +794,30 @@ sma_open(struct stevedore *st)
 	memset(sma_sc->stats, 0, sizeof *sma_sc->stats);
 	if (sma_sc->sma_max != SIZE_MAX)
 		sma_sc->stats->g_space = sma_sc->sma_max;
+	if (sma_sc->arena != SMA_ARENA_NONE)
+		sma_arena_open(st, sma_sc);
+	if (st != stv_transient)
+		SML_Pack(st);
+
+	if (sma_sc->nshard == 1)
+		return;
+
+	if (sma_sc->sma_max == SIZE_MAX)
+		sma_sc->sh_refill = 1024 * 1024;
+	else
+		sma_sc->sh_refill = sma_sc->sma_max / (32 * sma_sc->nshard);
+	if (sma_sc->sh_refill > 16 * 1024 * 1024)
+		sma_sc->sh_refill = 16 * 1024 * 1024;
+	sma_sc->shards = calloc(sma_sc->nshard, sizeof *sma_sc->shards);
+	AN(sma_sc->shards);
+	for (u = 0; u < sma_sc->nshard; u++) {
+		sh = &sma_sc->shards[u];
+		sh->magic = SMA_SHARD_MAGIC;
+		sh->sc = sma_sc;
+		Lck_New(&sh->mtx, lck_sma);
+		for (i = 0; i < SMA_NCLASS; i++)
+			VTAILQ_INIT(&sh->freelist[i]);
+	}
 }
 
 const struct stevedore sma_stevedore = {
@@ -223,6 +825,7 @@ const struct stevedore sma_stevedore = {
 	.name		=	"malloc",
 	.init		=	sma_init,
 	.open		=	sma_open,
+	.parallel_open	=	1,
 	.sml_alloc	=	sma_alloc,
 	.sml_free	=	sma_free,
 	.allocobj	=	SML_allocobj,
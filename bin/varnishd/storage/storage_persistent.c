@@ -273,6 +273,126 @@ smp_open_segs(struct smp_sc *sc, struct smp_signspace *spc)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Load the segments of a silo.
+ *
+ * The segments do not share anything but the hash and the ban list,
+ * which have their own locking, so up to persistent_load_threads - 1
+ * helper tasks borrowed from the worker pools load them alongside the
+ * silo thread, each picking the next segment off the list.
+ */
+
+struct smp_loader {
+	unsigned		magic;
+#define SMP_LOADER_MAGIC	0x4b2d91e7
+	struct smp_sc		*sc;
+	struct smp_seg		*next;
+	unsigned		nhelper;
+	pthread_cond_t		cond;
+};
+
+struct smp_load_helper {
+	unsigned		magic;
+#define SMP_LOAD_HELPER_MAGIC	0x6a3e5c08
+	struct pool_task	task;
+	struct smp_loader	*ld;
+};
+
+static void
+smp_load_segs(struct worker *wrk, struct smp_loader *ld)
+{
+	struct smp_sc *sc;
+	struct smp_seg *sg;
+
+	CHECK_OBJ_NOTNULL(ld, SMP_LOADER_MAGIC);
+	sc = ld->sc;
+	Lck_Lock(&sc->mtx);
+	while (1) {
+		sg = ld->next;
+		while (sg != NULL && !(sg->flags & SMP_SEG_MUSTLOAD))
+			sg = VTAILQ_NEXT(sg, list);
+		if (sg == NULL)
+			break;
+		ld->next = VTAILQ_NEXT(sg, list);
+		Lck_Unlock(&sc->mtx);
+		smp_load_seg(wrk, sc, sg);
+		Lck_Lock(&sc->mtx);
+	}
+	ld->next = NULL;
+	Lck_Unlock(&sc->mtx);
+}
+
+static void __match_proto__(task_func_t)
+smp_load_helper(struct worker *wrk, void *priv)
+{
+	struct smp_load_helper *lh;
+	struct smp_loader *ld;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(lh, priv, SMP_LOAD_HELPER_MAGIC);
+	ld = lh->ld;
+	smp_load_segs(wrk, ld);
+	Lck_Lock(&ld->sc->mtx);
+	assert(ld->nhelper > 0);
+	if (--ld->nhelper == 0)
+		AZ(pthread_cond_signal(&ld->cond));
+	Lck_Unlock(&ld->sc->mtx);
+}
+
+static void
+smp_load(struct worker *wrk, struct smp_sc *sc)
+{
+	struct smp_loader ld;
+	struct smp_load_helper *lh = NULL;
+	struct smp_seg *sg;
+	unsigned u, n = 0;
+
+	INIT_OBJ(&ld, SMP_LOADER_MAGIC);
+	ld.sc = sc;
+	ld.next = VTAILQ_FIRST(&sc->segments);
+	AZ(pthread_cond_init(&ld.cond, NULL));
+
+	VTAILQ_FOREACH(sg, &sc->segments, list)
+		if (sg->flags & SMP_SEG_MUSTLOAD)
+			n++;
+	wrk->stats->silo_seg_pending += n;
+	Pool_Sumstat(wrk);
+
+	if (n > cache_param->persistent_load_threads)
+		n = cache_param->persistent_load_threads;
+	if (n > 1) {
+		n--;
+		lh = calloc(n, sizeof *lh);
+		if (lh == NULL)
+			n = 0;
+	} else
+		n = 0;
+	for (u = 0; u < n; u++) {
+		lh[u].magic = SMP_LOAD_HELPER_MAGIC;
+		lh[u].ld = &ld;
+		lh[u].task.func = smp_load_helper;
+		lh[u].task.priv = &lh[u];
+		Lck_Lock(&sc->mtx);
+		ld.nhelper++;
+		Lck_Unlock(&sc->mtx);
+		if (Pool_Task_Any(&lh[u].task, TASK_QUEUE_REQ)) {
+			Lck_Lock(&sc->mtx);
+			ld.nhelper--;
+			Lck_Unlock(&sc->mtx);
+			break;
+		}
+	}
+
+	smp_load_segs(wrk, &ld);
+
+	Lck_Lock(&sc->mtx);
+	while (ld.nhelper > 0)
+		(void)Lck_CondWait(&ld.cond, &sc->mtx, 0);
+	Lck_Unlock(&sc->mtx);
+	AZ(pthread_cond_destroy(&ld.cond));
+	free(lh);
+}
+
 /*--------------------------------------------------------------------
  * Silo worker thread
  */
@@ -288,9 +408,7 @@ smp_thread(struct worker *wrk, void *priv)
 	sc->thread = pthread_self();
 
 	/* First, load all the objects from all segments */
-	VTAILQ_FOREACH(sg, &sc->segments, list)
-		if (sg->flags & SMP_SEG_MUSTLOAD)
-			smp_load_seg(wrk, sc, sg);
+	smp_load(wrk, sc);
 
 	sc->flags |= SMP_SC_LOADED;
 	BAN_Release();
@@ -341,6 +459,7 @@ smp_open(struct stevedore *st)
 	AZ(smp_valid_silo(sc));
 
 	AZ(mprotect((void*)sc->base, 4096, PROT_READ));
+	STV_FileMap(sc->base, sc->mediasize, sc->fd, 0);
 
 	sc->ident = SIGN_DATA(&sc->idn);
 
@@ -601,6 +720,7 @@ const struct stevedore smp_stevedore = {
 	.baninfo	= smp_baninfo,
 	.banexport	= smp_banexport,
 	.methods	= &smp_oc_realmethods,
+	.persistent	= 1,
 
 	.sml_alloc	= smp_alloc,
 	.sml_free	= NULL,
@@ -138,17 +138,23 @@ smp_load_seg(struct worker *wrk, const struct smp_sc *sc,
 	double t_now = VTIM_real();
 	struct smp_signctx ctx[1];
 
-	ASSERT_SILO_THREAD(sc);
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(sg, SMP_SEG_MAGIC);
+	AZ(sc->flags & SMP_SC_LOADED);
 	assert(sg->flags & SMP_SEG_MUSTLOAD);
 	sg->flags &= ~SMP_SEG_MUSTLOAD;
 	AN(sg->p.offset);
-	if (sg->p.objlist == 0)
+	wrk->stats->silo_seg_pending--;
+	wrk->stats->silo_seg_loaded++;
+	if (sg->p.objlist == 0) {
+		Pool_Sumstat(wrk);
 		return;
+	}
 	smp_def_sign(sc, ctx, sg->p.offset, "SEGHEAD");
-	if (smp_chk_sign(ctx))
+	if (smp_chk_sign(ctx)) {
+		Pool_Sumstat(wrk);
 		return;
+	}
 
 	/* test SEGTAIL */
 	/* test OBJIDX */
@@ -40,26 +40,205 @@
 #include "storage/storage.h"
 #include "storage/storage_simple.h"
 
+#include "vgz.h"
+#include "vsha256.h"
 #include "vtim.h"
+#include "vtree.h"
 
 /* Flags for allocating memory in sml_stv_alloc */
 #define LESS_MEM_ALLOCED_IS_OK	1
 
+/* Objects with fewer storage segments than this are not indexed */
+#define SML_INDEX_MIN		16
+
+/* Bodies smaller than this are not packed, see sml_pack() */
+#define SML_PACK_MIN		4096
+#define SML_PACK_BUF		(64 * 1024)
+
+/* Bodies smaller than this are not deduplicated, see sml_dedup() */
+#define SML_DEDUP_MIN		4096
+
+/*
+ * Bodies up to SML_INLINE_MAX bytes are given room behind the object
+ * itself, and any slack of at least SML_INLINE_MIN bytes left there is
+ * used for the body, see sml_getinline().
+ */
+#define SML_INLINE_MAX		1024
+#define SML_INLINE_MIN		64
+
+static int sml_inline;
+#define SML_ISINLINE(st)	((st)->priv == &sml_inline)
+
+/* Segments of a deduplicated body, pointing into another object's */
+static int sml_view;
+#define SML_ISVIEW(st)		((st)->priv == &sml_view)
+
+struct sml_index {
+	ssize_t			off;
+	struct storage		*st;
+};
+
+/*
+ * A body deduplicated against others, see sml_dedup(), is found by
+ * its hash in a tree of these.  The object holding the body keeps its
+ * index here.
+ */
+
+struct sml_dedup {
+	unsigned		magic;
+#define SML_DEDUP_MAGIC		0x4d1f6c3b
+	VRB_ENTRY(sml_dedup)	tree;
+	VTAILQ_ENTRY(sml_dedup)	list;
+	unsigned char		digest[VSHA256_LEN];
+	uint64_t		len;
+	const struct stevedore	*stv;
+	struct objcore		*oc;
+	struct storage		*index;
+};
+
+VRB_HEAD(sml_dedup_tree, sml_dedup);
+
+static struct lock		sml_dedup_mtx;
+static pthread_cond_t		sml_dedup_cond;
+static pthread_once_t		sml_dedup_once = PTHREAD_ONCE_INIT;
+static struct sml_dedup_tree	sml_dedup_bodies;
+static VTAILQ_HEAD(, sml_dedup)	sml_dedup_queue =
+    VTAILQ_HEAD_INITIALIZER(sml_dedup_queue);
+
+static inline int
+sml_dedup_cmp(const struct sml_dedup *a, const struct sml_dedup *b)
+{
+
+	if (a->len != b->len)
+		return (a->len < b->len ? -1 : 1);
+	if (a->stv != b->stv)
+		return ((uintptr_t)a->stv < (uintptr_t)b->stv ? -1 : 1);
+	return (memcmp(a->digest, b->digest, sizeof a->digest));
+}
+
+VRB_PROTOTYPE_STATIC(sml_dedup_tree, sml_dedup, tree, sml_dedup_cmp)
+VRB_GENERATE_STATIC(sml_dedup_tree, sml_dedup, tree, sml_dedup_cmp)
+
+/*
+ * The index hangs off oc->stobj->priv2, which only stevedores with their
+ * own object layout use, and those do not get an index.  A packed body
+ * has no index, and SML_PACKED there instead.  The object holding a
+ * deduplicated body has its struct sml_dedup there, tagged SML_OWNER,
+ * and the objects sharing it have that object's objcore, tagged
+ * SML_VIEW.
+ */
+
+#define SML_PACKED		((uintptr_t)1)
+#define SML_OWNER		((uintptr_t)2)
+#define SML_VIEW		((uintptr_t)4)
+#define SML_FLAGS		((uintptr_t)7)
+
+static uintptr_t
+sml_flags(const struct objcore *oc)
+{
+
+	if (oc->stobj->stevedore->sml_getobj != NULL)
+		return (0);
+	return (oc->stobj->priv2 & SML_FLAGS);
+}
+
+static int
+sml_ispacked(const struct objcore *oc)
+{
+
+	return (sml_flags(oc) == SML_PACKED);
+}
+
+static struct storage *
+sml_getindex(const struct objcore *oc)
+{
+	struct sml_dedup *sd;
+
+	if (oc->stobj->stevedore->sml_getobj != NULL)
+		return (NULL);
+	switch (sml_flags(oc)) {
+	case 0:
+		return ((struct storage *)oc->stobj->priv2);
+	case SML_OWNER:
+		CAST_OBJ_NOTNULL(sd, (void *)(oc->stobj->priv2 & ~SML_FLAGS),
+		    SML_DEDUP_MAGIC);
+		return (sd->index);
+	default:
+		return (NULL);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Account the space an object holds on Transient by what it is for.
+ * Storage is released by both the fetch and the delivery side, so the
+ * gauges are updated atomically.
+ */
+
+static void
+sml_transient(const struct objcore *oc, const struct storage *st, int add)
+{
+	uint64_t *g;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (st == NULL || oc->stobj->stevedore != stv_transient ||
+	    SML_ISINLINE(st))
+		return;
+	switch (oc->stobj->transient) {
+	case TRANSIENT_PASS:		g = &VSC_C_main->transient_pass; break;
+	case TRANSIENT_SHORTLIVED:	g = &VSC_C_main->transient_shortlived; break;
+	case TRANSIENT_SYNTH:		g = &VSC_C_main->transient_synth; break;
+	case TRANSIENT_REQBODY:		g = &VSC_C_main->transient_reqbody; break;
+	default:			return;
+	}
+	if (add)
+		(void)__sync_add_and_fetch(g, st->space);
+	else
+		(void)__sync_sub_and_fetch(g, st->space);
+}
+
+/*--------------------------------------------------------------------
+ * Only shortlived objects on Transient can be nuked, but passes and
+ * synths release their space as soon as they are delivered, so when
+ * nuking does not make room we poll for a while before failing the
+ * allocation.
+ */
+
+static int
+sml_transient_wait(double *t)
+{
+	double now;
+
+	if (cache_param->transient_wait <= 0.)
+		return (0);
+	now = VTIM_real_coarse();
+	if (isnan(*t)) {
+		*t = now + cache_param->transient_wait;
+		(void)__sync_add_and_fetch(&VSC_C_main->transient_waits, 1);
+	} else if (now >= *t)
+		return (0);
+	VTIM_sleep(0.01);
+	return (1);
+}
+
 /*-------------------------------------------------------------------*/
 
 static struct storage *
-sml_stv_alloc(const struct stevedore *stv, size_t size, int flags)
+sml_stv_alloc(const struct objcore *oc, size_t size, int flags)
 {
+	const struct stevedore *stv;
 	struct storage *st;
 
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
 	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
 	AN(stv->sml_alloc);
 
 	if (!(flags & LESS_MEM_ALLOCED_IS_OK)) {
 		if (size > cache_param->fetch_maxchunksize)
 			return (NULL);
-		else
-			return (stv->sml_alloc(stv, size));
+		st = stv->sml_alloc(stv, size);
+		sml_transient(oc, st, 1);
+		return (st);
 	}
 
 	if (size > cache_param->fetch_maxchunksize)
@@ -80,15 +259,26 @@ sml_stv_alloc(const struct stevedore *stv, size_t size, int flags)
 		size >>= 1;
 	}
 	CHECK_OBJ_ORNULL(st, STORAGE_MAGIC);
+	sml_transient(oc, st, 1);
 	return (st);
 }
 
 static void
-sml_stv_free(const struct stevedore *stv, struct storage *st)
+sml_stv_free(const struct objcore *oc, struct storage *st)
 {
+	const struct stevedore *stv;
 
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
 	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
 	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	if (SML_ISINLINE(st))
+		return;
+	if (SML_ISVIEW(st)) {
+		FREE_OBJ(st);
+		return;
+	}
+	sml_transient(oc, st, 0);
 	if (stv->sml_free != NULL)
 		stv->sml_free(st);
 }
@@ -135,6 +325,7 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
 	struct object *o;
 	struct storage *st = NULL;
 	unsigned ltot;
+	double t = NAN;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
@@ -144,7 +335,10 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
 	assert(nuke_limit >= 0);
 
 	ltot = sizeof(struct object) + PRNDUP(wsl);
-	for (; nuke_limit >= 0; nuke_limit--) {
+	if (oc->boc != NULL && oc->boc->len_hint > 0 &&
+	    oc->boc->len_hint <= SML_INLINE_MAX && stv->sml_pin == NULL)
+		ltot += sizeof *st + PRNDUP(oc->boc->len_hint);
+	while (1) {
 		st = stv->sml_alloc(stv, ltot);
 		if (st != NULL && st->space < ltot) {
 			stv->sml_free(st);
@@ -152,7 +346,11 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
 		}
 		if (st != NULL)
 			break;
-		if (!nuke_limit || !LRU_NukeOne(wrk, stv->lru))
+		if (nuke_limit > 0 && LRU_NukeOne(wrk, stv->lru)) {
+			nuke_limit--;
+			continue;
+		}
+		if (stv != stv_transient || !sml_transient_wait(&t))
 			return (0);
 	}
 	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
@@ -160,6 +358,7 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
 	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
 	st->len = sizeof(*o);
 	o->objstore = st;
+	sml_transient(oc, st, 1);
 	return (1);
 }
 
@@ -184,10 +383,35 @@ sml_getobj(struct worker *wrk, struct objcore *oc)
 	return (o);
 }
 
+/*--------------------------------------------------------------------
+ * The object holding a deduplicated body is going, take the body out
+ * of the tree and hand back the index.
+ */
+
+static struct storage *
+sml_dedup_forget(struct objcore *oc)
+{
+	struct sml_dedup *sd;
+	struct storage *sti;
+
+	assert(sml_flags(oc) == SML_OWNER);
+	CAST_OBJ_NOTNULL(sd, (void *)(oc->stobj->priv2 & ~SML_FLAGS),
+	    SML_DEDUP_MAGIC);
+	assert(sd->oc == oc);
+	Lck_Lock(&sml_dedup_mtx);
+	VRB_REMOVE(sml_dedup_tree, &sml_dedup_bodies, sd);
+	Lck_Unlock(&sml_dedup_mtx);
+	oc->stobj->priv2 = 0;
+	sti = sd->index;
+	FREE_OBJ(sd);
+	return (sti);
+}
+
 static void __match_proto__(objslim_f)
 sml_slim(struct worker *wrk, struct objcore *oc)
 {
 	const struct stevedore *stv;
+	struct objcore *owner = NULL;
 	struct object *o;
 	struct storage *st, *stn;
 
@@ -198,9 +422,38 @@ sml_slim(struct worker *wrk, struct objcore *oc)
 	o = sml_getobj(wrk, oc);
 	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
 
+	switch (sml_flags(oc)) {
+	case SML_PACKED:
+		oc->stobj->priv2 = 0;
+		st = VTAILQ_FIRST(&o->list);
+		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+		(void)__sync_sub_and_fetch(&VSC_C_main->sml_pack_saved,
+		    ObjGetLen(wrk, oc) - st->space);
+		break;
+	case SML_OWNER:
+		st = sml_dedup_forget(oc);
+		if (st != NULL)
+			sml_stv_free(oc, st);
+		break;
+	case SML_VIEW:
+		CAST_OBJ_NOTNULL(owner,
+		    (void *)(oc->stobj->priv2 & ~SML_FLAGS), OBJCORE_MAGIC);
+		oc->stobj->priv2 = 0;
+		(void)__sync_sub_and_fetch(&VSC_C_main->sml_dedup_saved,
+		    ObjGetLen(wrk, oc));
+		break;
+	default:
+		st = sml_getindex(oc);
+		if (st != NULL) {
+			oc->stobj->priv2 = 0;
+			sml_stv_free(oc, st);
+		}
+		break;
+	}
+
 #define OBJ_AUXATTR(U, l)						\
 	if (o->aa_##l != NULL) {					\
-		sml_stv_free(stv, o->aa_##l);				\
+		sml_stv_free(oc, o->aa_##l);				\
 		o->aa_##l = NULL;					\
 	}
 #include "tbl/obj_attr.h"
@@ -208,8 +461,12 @@ sml_slim(struct worker *wrk, struct objcore *oc)
 	VTAILQ_FOREACH_SAFE(st, &o->list, list, stn) {
 		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
 		VTAILQ_REMOVE(&o->list, st, list);
-		sml_stv_free(stv, st);
+		sml_stv_free(oc, st);
 	}
+
+	/* The body we shared is no longer looked at */
+	if (owner != NULL)
+		(void)HSH_DerefObjCore(wrk, &owner, 0);
 }
 
 static void __match_proto__(objfree_f)
@@ -226,20 +483,152 @@ sml_objfree(struct worker *wrk, struct objcore *oc)
 	if (oc->boc == NULL && oc->stobj->stevedore->lru != NULL)
 		LRU_Remove(oc);
 
-	sml_stv_free(oc->stobj->stevedore, o->objstore);
+	sml_stv_free(oc, o->objstore);
 
 	memset(oc->stobj, 0, sizeof oc->stobj);
 
 	wrk->stats->n_object--;
 }
 
+/*--------------------------------------------------------------------
+ * Find the storage segment holding byte 'off' of a finished object, and
+ * make 'off' relative to it.
+ */
+
+static struct storage *
+sml_seek(const struct objcore *oc, struct object *o, ssize_t *off)
+{
+	const struct storage *sti;
+	const struct sml_index *idx;
+	size_t lo, hi, mid;
+
+	sti = sml_getindex(oc);
+	if (sti == NULL || *off == 0)
+		return (VTAILQ_FIRST(&o->list));
+	CHECK_OBJ_NOTNULL(sti, STORAGE_MAGIC);
+	idx = (const void *)sti->ptr;
+	lo = 0;
+	hi = sti->len / sizeof *idx;
+	assert(hi > 0);
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (idx[mid].off <= *off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	*off -= idx[lo].off;
+	return (idx[lo].st);
+}
+
+/*--------------------------------------------------------------------
+ * Hand bytes of a storage segment to the iterator function.
+ *
+ * Stevedores which page body segments out of memory get to bring the
+ * segment in first, and may start reading the next one meanwhile.
+ * They are flushed every time, the function must be done with the
+ * memory when it returns.
+ */
+
+static int
+sml_func(struct worker *wrk, const struct stevedore *stv, struct storage *st,
+    struct storage *next, ssize_t off, ssize_t l, objiterate_f *func,
+    void *priv, int flush)
+{
+	int ret;
+
+	if (stv->sml_pin == NULL)
+		return (func(priv, flush, st->ptr + off, l));
+	if (stv->sml_pin(wrk, st, next))
+		return (-1);
+	ret = func(priv, 1, st->ptr + off, l);
+	stv->sml_unpin(st);
+	return (ret);
+}
+
+/*--------------------------------------------------------------------
+ * Hint the stevedore about the segments from st on, up to readahead past
+ * it.  *n counts those already hinted from st on, ra is the last of them.
+ * Without a stevedore method we prefetch the start of the segment and
+ * the header of the one after into the CPU cache.
+ */
+
+static struct storage *
+sml_readahead(const struct stevedore *stv, struct storage *st,
+    struct storage *ra, unsigned *n)
+{
+	struct storage *nx;
+
+	while (*n <= stv->readahead) {
+		nx = ra == NULL ? st : VTAILQ_NEXT(ra, list);
+		if (nx == NULL)
+			break;
+		if (stv->sml_prefetch != NULL)
+			stv->sml_prefetch(nx);
+		else {
+			__builtin_prefetch(nx->ptr);
+			__builtin_prefetch(VTAILQ_NEXT(nx, list));
+		}
+		ra = nx;
+		(*n)++;
+	}
+	return (ra);
+}
+
+/*--------------------------------------------------------------------
+ * Inflate a packed body into a buffer a piece at a time for the
+ * iterator function.  Packed objects are never private, so they are
+ * not freed as we go.
+ */
+
+static int
+sml_iterate_packed(struct worker *wrk, const struct object *o,
+    void *priv, objiterate_f *func, ssize_t off)
+{
+	const struct storage *st;
+	z_stream vz;
+	uint8_t *buf;
+	ssize_t l;
+	int i, ret = 0;
+
+	st = VTAILQ_FIRST(&o->list);
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	buf = malloc(SML_PACK_BUF);
+	if (buf == NULL)
+		return (-1);
+	memset(&vz, 0, sizeof vz);
+	assert(Z_OK == inflateInit2(&vz, -15));
+	vz.next_in = st->ptr;
+	vz.avail_in = st->len;
+	wrk->stats->sml_unpacked++;
+	do {
+		vz.next_out = buf;
+		vz.avail_out = SML_PACK_BUF;
+		i = inflate(&vz, Z_NO_FLUSH);
+		if (i != Z_OK && i != Z_STREAM_END) {
+			ret = -1;
+			break;
+		}
+		l = SML_PACK_BUF - vz.avail_out;
+		if (off >= l) {
+			off -= l;
+			continue;
+		}
+		ret = func(priv, 1, buf + off, l - off);
+		off = 0;
+	} while (ret == 0 && i != Z_STREAM_END);
+	(void)inflateEnd(&vz);
+	free(buf);
+	return (ret);
+}
+
 static int __match_proto__(objiterate_f)
 sml_iterator(struct worker *wrk, struct objcore *oc,
-    void *priv, objiterate_f *func, int final)
+    void *priv, objiterate_f *func, int final, ssize_t off)
 {
 	struct boc *boc;
 	struct object *obj;
-	struct storage *st;
+	struct storage *st, *stc = NULL;
 	struct storage *checkpoint = NULL;
 	const struct stevedore *stv;
 	ssize_t checkpoint_len = 0;
@@ -248,8 +637,10 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 	ssize_t ol;
 	ssize_t nl;
 	ssize_t sl;
-	void *p;
+	ssize_t po = 0;
 	ssize_t l;
+	struct storage *ra = NULL;
+	unsigned n = 0;
 
 	obj = sml_getobj(wrk, oc);
 	CHECK_OBJ_NOTNULL(obj, OBJECT_MAGIC);
@@ -258,22 +649,50 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 
 	boc = HSH_RefBoc(oc);
 
+	if (boc == NULL && sml_ispacked(oc))
+		return (sml_iterate_packed(wrk, obj, priv, func, off));
+
 	if (boc == NULL) {
-		VTAILQ_FOREACH_SAFE(st, &obj->list, list, checkpoint) {
-			if (ret == 0 && st->len > 0)
-				ret = func(priv, 1, st->ptr, st->len);
+		/* Freeing as we go leaves nothing to index */
+		st = final ? VTAILQ_FIRST(&obj->list) : sml_seek(oc, obj, &off);
+		for (; st != NULL; st = checkpoint) {
+			checkpoint = VTAILQ_NEXT(st, list);
+			if (stv->readahead > 0 && stv->sml_pin == NULL &&
+			    off < st->len && ret == 0)
+				ra = sml_readahead(stv, st, ra, &n);
+			if (off >= st->len) {
+				/* Only look at the length of what we skip */
+				off -= st->len;
+			} else if (ret == 0) {
+				ret = sml_func(wrk, stv, st, checkpoint, off,
+				    st->len - off, func, priv, 1);
+				off = 0;
+			}
+			if (n > 0 && --n == 0)
+				ra = NULL;
 			if (final) {
 				VTAILQ_REMOVE(&obj->list, st, list);
-				sml_stv_free(stv, st);
+				sml_stv_free(oc, st);
 			} else if (ret)
 				break;
 		}
 		return (ret);
 	}
 
-	p = NULL;
 	l = 0;
 
+	/* The body may not have got as far as off yet */
+	while (len < off) {
+		nl = ObjWaitExtend(wrk, oc, len);
+		if (boc->state == BOS_FAILED) {
+			HSH_DerefBoc(wrk, oc);
+			return (-1);
+		}
+		if (nl == len && boc->state == BOS_FINISHED)
+			break;
+		len = nl < off ? nl : off;
+	}
+
 	while (1) {
 		ol = len;
 		nl = ObjWaitExtend(wrk, oc, ol);
@@ -298,7 +717,8 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 		}
 		while (st != NULL) {
 			if (st->len > ol) {
-				p = st->ptr + ol;
+				stc = st;
+				po = ol;
 				l = st->len - ol;
 				len += l;
 				break;
@@ -313,7 +733,7 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 				if (final && checkpoint != NULL) {
 					VTAILQ_REMOVE(&obj->list,
 					    checkpoint, list);
-					sml_stv_free(stv, checkpoint);
+					sml_stv_free(oc, checkpoint);
 				}
 				checkpoint = st;
 				checkpoint_len = sl;
@@ -326,7 +746,8 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 			st = NULL;
 		Lck_Unlock(&boc->mtx);
 		assert(l > 0 || boc->state == BOS_FINISHED);
-		ret = func(priv, st != NULL ? final : 1, p, l);
+		ret = sml_func(wrk, stv, stc, st, po, l, func, priv,
+		    st != NULL ? final : 1);
 		if (ret)
 			break;
 	}
@@ -338,13 +759,17 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
  */
 
 static struct storage *
-objallocwithnuke(struct worker *wrk, const struct stevedore *stv, size_t size,
+objallocwithnuke(struct worker *wrk, const struct objcore *oc, size_t size,
     int flags)
 {
+	const struct stevedore *stv;
 	struct storage *st = NULL;
 	unsigned fail;
+	double t;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
 	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
 
 	if (size > cache_param->fetch_maxchunksize) {
@@ -357,7 +782,7 @@ objallocwithnuke(struct worker *wrk, const struct stevedore *stv, size_t size,
 
 	for (fail = 0; fail <= cache_param->nuke_limit; fail++) {
 		/* try to allocate from it */
-		st = sml_stv_alloc(stv, size, flags);
+		st = sml_stv_alloc(oc, size, flags);
 		if (st != NULL)
 			break;
 
@@ -368,10 +793,45 @@ objallocwithnuke(struct worker *wrk, const struct stevedore *stv, size_t size,
 		    !LRU_NukeOne(wrk, stv->lru))
 			break;
 	}
+
+	t = NAN;
+	while (st == NULL && stv == stv_transient && sml_transient_wait(&t))
+		st = sml_stv_alloc(oc, size, flags);
 	CHECK_OBJ_ORNULL(st, STORAGE_MAGIC);
 	return (st);
 }
 
+/*--------------------------------------------------------------------
+ * Give the first body segment a storage header of its own behind the
+ * attributes in the object's allocation.  It goes with the object and
+ * never back to the stevedore by itself, so the attributes are closed
+ * for good.  Stevedores which keep the objects themselves, or move the
+ * body segments about, do not get this.
+ */
+
+static struct storage *
+sml_getinline(const struct stevedore *stv, struct object *o)
+{
+	struct storage *sto, *st;
+	size_t l;
+
+	if (stv->sml_getobj != NULL || stv->sml_pin != NULL)
+		return (NULL);
+	sto = o->objstore;
+	CHECK_OBJ_NOTNULL(sto, STORAGE_MAGIC);
+	l = PRNDUP(sto->len);
+	if (l + sizeof *st + SML_INLINE_MIN > sto->space)
+		return (NULL);
+	st = (void *)(sto->ptr + l);
+	INIT_OBJ(st, STORAGE_MAGIC);
+	st->priv = &sml_inline;
+	st->ptr = (void *)(st + 1);
+	assert(PAOK(st->ptr));
+	st->space = sto->space - (l + sizeof *st);
+	sto->len = sto->space;
+	return (st);
+}
+
 static int __match_proto__(objgetspace_f)
 sml_getspace(struct worker *wrk, struct objcore *oc, ssize_t *sz,
     uint8_t **ptr)
@@ -396,8 +856,15 @@ sml_getspace(struct worker *wrk, struct objcore *oc, ssize_t *sz,
 		return (1);
 	}
 
-	st = objallocwithnuke(wrk, oc->stobj->stevedore, *sz,
-	    LESS_MEM_ALLOCED_IS_OK);
+	st = NULL;
+	if (VTAILQ_EMPTY(&o->list)) {
+		st = sml_getinline(oc->stobj->stevedore, o);
+		if (st != NULL)
+			wrk->stats->obj_inline++;
+	}
+	if (st == NULL)
+		st = objallocwithnuke(wrk, oc, *sz,
+		    LESS_MEM_ALLOCED_IS_OK);
 	if (st == NULL)
 		return (0);
 
@@ -457,17 +924,30 @@ sml_trimstore(struct worker *wrk, struct objcore *oc)
 		Lck_Lock(&oc->boc->mtx);
 		VTAILQ_REMOVE(&o->list, st, list);
 		Lck_Unlock(&oc->boc->mtx);
-		sml_stv_free(stv, st);
+		sml_stv_free(oc, st);
 		return;
 	}
 
-	if (st->space - st->len < 512)
+	if (SML_ISINLINE(st) || st->space - st->len < 512)
 		return;
 
-	st1 = sml_stv_alloc(stv, st->len, 0);
+	/*
+	 * The fetch asks for what is left of the Content-Length, so a
+	 * body of that length got segments of the size it needed, and
+	 * what space is left over is the stevedore's rounding, which
+	 * another allocation would round the same way.
+	 */
+	if (oc->boc->len_hint > 0 && oc->boc->len_so_far == oc->boc->len_hint)
+		return;
+
+	st1 = sml_stv_alloc(oc, st->len, 0);
 	if (st1 == NULL)
 		return;
 	assert(st1->space >= st->len);
+	if (st1->space >= st->space) {
+		sml_stv_free(oc, st1);
+		return;
+	}
 
 	memcpy(st1->ptr, st->ptr, st->len);
 	st1->len = st->len;
@@ -480,11 +960,278 @@ sml_trimstore(struct worker *wrk, struct objcore *oc)
 	oc->boc->stevedore_priv = st;
 }
 
+/*--------------------------------------------------------------------
+ * Once an object is complete, index where each storage segment starts,
+ * so ObjIterateFrom() can find its way into large objects without
+ * walking the list.
+ *
+ * Private objects are left out, they free their storage as it is
+ * delivered.  So are stevedores with their own objects, those may
+ * outlive the index.
+ */
+
+static void
+sml_mkindex(struct objcore *oc, const struct object *o)
+{
+	struct storage *st, *sti;
+	struct sml_index *idx;
+	ssize_t off = 0;
+	unsigned n = 0;
+
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	AZ(sml_getindex(oc));
+	VTAILQ_FOREACH(st, &o->list, list)
+		n++;
+	if (n < SML_INDEX_MIN)
+		return;
+	sti = sml_stv_alloc(oc, n * sizeof *idx, 0);
+	if (sti == NULL)
+		return;
+	assert(sti->space >= n * sizeof *idx);
+	idx = (void *)sti->ptr;
+	VTAILQ_FOREACH(st, &o->list, list) {
+		idx->off = off;
+		idx->st = st;
+		off += st->len;
+		idx++;
+	}
+	sti->len = n * sizeof *idx;
+	/* Iterators may be looking at the index already */
+	__sync_synchronize();
+	oc->stobj->priv2 = (uintptr_t)sti;
+}
+
+/*--------------------------------------------------------------------
+ * Deduplication of bodies
+ *
+ * When an object is complete, its body is hashed.  The first object
+ * with a body becomes its owner, and is found by the hash in a tree.
+ * Later objects with the same body are queued for the sml-dedup
+ * thread, which replaces their segments with views into the owner's,
+ * and has them hold a reference to the owner for as long as they do.
+ *
+ * The segments can only be swapped while no one else is iterating
+ * over the object, that is when the cache and the queue hold the
+ * only references, which is seldom the case when the object was just
+ * finished, so objects which are busy are tried again later.
+ */
+
+static void
+sml_dedup_init(void)
+{
+
+	Lck_New(&sml_dedup_mtx, lck_dedup);
+	AZ(pthread_cond_init(&sml_dedup_cond, NULL));
+	VRB_INIT(&sml_dedup_bodies);
+}
+
+/* Make the object the owner of its body, priv2 must be free */
+
+static void
+sml_dedup_own(struct objcore *oc, struct sml_dedup *sd)
+{
+
+	Lck_AssertHeld(&sml_dedup_mtx);
+	AZ(VRB_INSERT(sml_dedup_tree, &sml_dedup_bodies, sd));
+	sd->index = sml_getindex(oc);
+	/* Iterators may be looking at the index */
+	__sync_synchronize();
+	oc->stobj->priv2 = (uintptr_t)sd | SML_OWNER;
+}
+
+/*
+ * Share the owner's body with the queued object.  Returns non-zero if
+ * it should be tried again later, otherwise the entry and the queue's
+ * reference are gone.
+ */
+
+static int
+sml_dedup_share(struct worker *wrk, struct sml_dedup *sd)
+{
+	struct storagehead views, old;
+	struct storage *st, *st1, *sti = NULL;
+	struct objcore *oc, *owner;
+	struct sml_dedup *sd2;
+	struct object *o;
+	int retry = 1;
+
+	CHECK_OBJ_NOTNULL(sd, SML_DEDUP_MAGIC);
+	oc = sd->oc;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	Lck_Lock(&sml_dedup_mtx);
+	sd2 = VRB_FIND(sml_dedup_tree, &sml_dedup_bodies, sd);
+	if (sd2 == NULL) {
+		/* The owner went away, this one takes over */
+		Lck_Lock(&oc->objhead->mtx);
+		if (!(oc->flags & OC_F_DYING) && sml_flags(oc) == 0) {
+			sml_dedup_own(oc, sd);
+			sd = NULL;
+		}
+		Lck_Unlock(&oc->objhead->mtx);
+		Lck_Unlock(&sml_dedup_mtx);
+		if (sd != NULL)
+			FREE_OBJ(sd);
+		(void)HSH_DerefObjCore(wrk, &oc, 0);
+		return (0);
+	}
+	owner = sd2->oc;
+	CHECK_OBJ_NOTNULL(owner, OBJCORE_MAGIC);
+	Lck_Lock(&owner->objhead->mtx);
+	if (owner->refcnt > 0 && !(owner->flags & OC_F_DYING))
+		HSH_Ref(owner);
+	else
+		owner = NULL;
+	Lck_Unlock(&sd2->oc->objhead->mtx);
+	Lck_Unlock(&sml_dedup_mtx);
+	if (owner == NULL) {
+		/* Its body may be on its way out already */
+		FREE_OBJ(sd);
+		(void)HSH_DerefObjCore(wrk, &oc, 0);
+		return (0);
+	}
+
+	VTAILQ_INIT(&views);
+	VTAILQ_INIT(&old);
+	o = sml_getobj(wrk, owner);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	VTAILQ_FOREACH(st, &o->list, list) {
+		ALLOC_OBJ(st1, STORAGE_MAGIC);
+		if (st1 == NULL)
+			break;
+		st1->priv = &sml_view;
+		st1->ptr = st->ptr;
+		st1->len = st1->space = st->len;
+		VTAILQ_INSERT_TAIL(&views, st1, list);
+	}
+
+	if (st == NULL) {
+		o = sml_getobj(wrk, oc);
+		CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+		Lck_Lock(&oc->objhead->mtx);
+		if (oc->flags & OC_F_DYING || sml_flags(oc) != 0) {
+			retry = 0;
+		} else if (oc->refcnt == 2) {
+			VTAILQ_CONCAT(&old, &o->list, list);
+			VTAILQ_CONCAT(&o->list, &views, list);
+			sti = sml_getindex(oc);
+			oc->stobj->priv2 = (uintptr_t)owner | SML_VIEW;
+			owner = NULL;
+			retry = 0;
+		}
+		Lck_Unlock(&oc->objhead->mtx);
+	}
+
+	while ((st = VTAILQ_FIRST(&views)) != NULL) {
+		VTAILQ_REMOVE(&views, st, list);
+		FREE_OBJ(st);
+	}
+	if (owner != NULL) {
+		(void)HSH_DerefObjCore(wrk, &owner, 0);
+		if (retry)
+			return (1);
+	} else {
+		if (sti != NULL)
+			sml_stv_free(oc, sti);
+		while ((st = VTAILQ_FIRST(&old)) != NULL) {
+			VTAILQ_REMOVE(&old, st, list);
+			sml_stv_free(oc, st);
+		}
+		wrk->stats->sml_dedup++;
+		(void)__sync_add_and_fetch(&VSC_C_main->sml_dedup_saved,
+		    sd->len);
+	}
+	FREE_OBJ(sd);
+	(void)HSH_DerefObjCore(wrk, &oc, 0);
+	return (0);
+}
+
+static void * __match_proto__(bgthread_t)
+sml_dedup_thread(struct worker *wrk, void *priv)
+{
+	VTAILQ_HEAD(, sml_dedup) later = VTAILQ_HEAD_INITIALIZER(later);
+	struct sml_dedup *sd;
+	double t;
+
+	AZ(priv);
+	Lck_Lock(&sml_dedup_mtx);
+	while (1) {
+		sd = VTAILQ_FIRST(&sml_dedup_queue);
+		if (sd == NULL) {
+			Lck_Unlock(&sml_dedup_mtx);
+			Pool_Sumstat(wrk);
+			Lck_Lock(&sml_dedup_mtx);
+			t = VTAILQ_EMPTY(&later) ? 0. : VTIM_real() + 1.;
+			(void)Lck_CondWait(&sml_dedup_cond, &sml_dedup_mtx, t);
+			VTAILQ_CONCAT(&sml_dedup_queue, &later, list);
+			continue;
+		}
+		VTAILQ_REMOVE(&sml_dedup_queue, sd, list);
+		Lck_Unlock(&sml_dedup_mtx);
+		if (sml_dedup_share(wrk, sd)) {
+			Lck_Lock(&sml_dedup_mtx);
+			VTAILQ_INSERT_TAIL(&later, sd, list);
+		} else
+			Lck_Lock(&sml_dedup_mtx);
+	}
+	NEEDLESS(return (NULL));
+}
+
+static void
+sml_dedup_start(void)
+{
+	pthread_t thr;
+
+	sml_dedup_init();
+	WRK_BgThread(&thr, "sml-dedup", sml_dedup_thread, NULL);
+}
+
+/*
+ * Hash the body of the object which was just finished, and either make
+ * it the owner of the body or queue it to share the owner's.
+ */
+
+static void
+sml_dedup(struct worker *wrk, struct objcore *oc, const struct object *o)
+{
+	struct sml_dedup *sd;
+	struct storage *st;
+	VSHA256_CTX sha;
+
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	ALLOC_OBJ(sd, SML_DEDUP_MAGIC);
+	if (sd == NULL)
+		return;
+	sd->len = ObjGetLen(wrk, oc);
+	if (sd->len < SML_DEDUP_MIN) {
+		FREE_OBJ(sd);
+		return;
+	}
+	VSHA256_Init(&sha);
+	VTAILQ_FOREACH(st, &o->list, list)
+		VSHA256_Update(&sha, st->ptr, st->len);
+	VSHA256_Final(sd->digest, &sha);
+	sd->stv = oc->stobj->stevedore;
+	sd->oc = oc;
+
+	AZ(pthread_once(&sml_dedup_once, sml_dedup_start));
+	Lck_Lock(&sml_dedup_mtx);
+	if (VRB_FIND(sml_dedup_tree, &sml_dedup_bodies, sd) == NULL) {
+		sml_dedup_own(oc, sd);
+	} else {
+		HSH_Ref(oc);
+		VTAILQ_INSERT_TAIL(&sml_dedup_queue, sd, list);
+		AZ(pthread_cond_signal(&sml_dedup_cond));
+	}
+	Lck_Unlock(&sml_dedup_mtx);
+}
+
 static void __match_proto__(objbocdone_f)
 sml_bocdone(struct worker *wrk, struct objcore *oc, struct boc *boc)
 {
 	const struct stevedore *stv;
 	struct storage *st;
+	struct object *o;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -497,12 +1244,32 @@ sml_bocdone(struct worker *wrk, struct objcore *oc, struct boc *boc)
 		CAST_OBJ_NOTNULL(st, boc->stevedore_priv, STORAGE_MAGIC);
 		boc->stevedore_priv = 0;
 		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
-		sml_stv_free(stv, st);
+		sml_stv_free(oc, st);
+	}
+
+	if (!(oc->flags & (OC_F_PRIVATE | OC_F_FAILED)) &&
+	    stv->sml_getobj == NULL)
+		sml_mkindex(oc, sml_getobj(wrk, oc));
+
+	if (cache_param->body_dedup &&
+	    !(oc->flags & (OC_F_PRIVATE | OC_F_FAILED | OC_F_PASS |
+	    OC_F_HFP)) && stv->sml_getobj == NULL && stv->sml_pin == NULL &&
+	    stv->lru != NULL && stv != stv_transient)
+		sml_dedup(wrk, oc, sml_getobj(wrk, oc));
+
+	/* The body will not change anymore, it may leave memory */
+	if (!(oc->flags & (OC_F_PRIVATE | OC_F_FAILED)) &&
+	    stv->sml_done != NULL) {
+		o = sml_getobj(wrk, oc);
+		CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+		VTAILQ_FOREACH(st, &o->list, list)
+			if (!SML_ISINLINE(st))
+				stv->sml_done(oc, st);
 	}
 
 	if (stv->lru != NULL) {
 		if (isnan(wrk->lastused))
-			wrk->lastused = VTIM_real();
+			wrk->lastused = VTIM_real_coarse();
 		LRU_Add(oc, wrk->lastused);	// approx timestamp is OK
 	}
 }
@@ -589,6 +1356,7 @@ sml_setattr(struct worker *wrk, struct objcore *oc, enum obj_attr attr,
 			assert(st->len + len <= st->space);		\
 			o->va_##l = st->ptr + st->len;			\
 			st->len += len;					\
+			o->va_##l##_len = len;				\
 			retval = o->va_##l;				\
 		}							\
 		break;
@@ -605,8 +1373,7 @@ sml_setattr(struct worker *wrk, struct objcore *oc, enum obj_attr attr,
 		}							\
 		if (len == 0)						\
 			break;						\
-		o->aa_##l = objallocwithnuke(wrk, oc->stobj->stevedore,	\
-		    len, 0);						\
+		o->aa_##l = objallocwithnuke(wrk, oc, len, 0);		\
 		if (o->aa_##l == NULL)					\
 			break;						\
 		CHECK_OBJ_NOTNULL(o->aa_##l, STORAGE_MAGIC);		\
@@ -639,6 +1406,151 @@ const struct obj_methods SML_methods = {
 	.objtouch	= LRU_Touch,
 };
 
+/*--------------------------------------------------------------------
+ * Pack the body of an idle object: deflate it into a segment of its
+ * own, and if that makes it small enough, swap it in for the body.
+ *
+ * We hold a reference, and the swap is made under the objhead lock
+ * only if ours and the cache's are the only ones, so no one can be
+ * iterating over the body, and everyone to come will see the packed
+ * one.  Bodies which are already compressed are left alone.
+ */
+
+static void
+sml_pack(struct worker *wrk, struct objcore *oc)
+{
+	struct storagehead old;
+	struct storage *st, *st1, *sti;
+	struct object *o;
+	z_stream vz;
+	uint8_t *buf;
+	uint64_t len;
+	size_t l;
+	int i = Z_OK;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	o = sml_getobj(wrk, oc);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	if (sml_flags(oc) != 0 || ObjCheckFlag(wrk, oc, OF_GZIPED) ||
+	    ObjCheckFlag(wrk, oc, OF_BROTLI))
+		return;
+	len = ObjGetLen(wrk, oc);
+	if (len < SML_PACK_MIN)
+		return;
+
+	memset(&vz, 0, sizeof vz);
+	if (deflateInit2(&vz, Z_BEST_SPEED, Z_DEFLATED, -15, 8,
+	    Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+	l = deflateBound(&vz, len);
+	buf = NULL;
+	if (l <= cache_param->fetch_maxchunksize)
+		buf = malloc(l);
+	if (buf == NULL) {
+		(void)deflateEnd(&vz);
+		return;
+	}
+	vz.next_out = buf;
+	vz.avail_out = l;
+	VTAILQ_FOREACH(st, &o->list, list) {
+		vz.next_in = st->ptr;
+		vz.avail_in = st->len;
+		i = deflate(&vz,
+		    VTAILQ_NEXT(st, list) == NULL ? Z_FINISH : Z_NO_FLUSH);
+		if ((i != Z_OK && i != Z_STREAM_END) || vz.avail_in > 0)
+			break;
+	}
+	l = vz.total_out;
+	(void)deflateEnd(&vz);
+
+	st1 = NULL;
+	if (i == Z_STREAM_END && l * 100 <= len * cache_param->pack_ratio)
+		st1 = sml_stv_alloc(oc, l, 0);
+	if (st1 != NULL && st1->space * 100 > len * cache_param->pack_ratio) {
+		sml_stv_free(oc, st1);
+		st1 = NULL;
+	}
+	if (st1 == NULL) {
+		free(buf);
+		return;
+	}
+	memcpy(st1->ptr, buf, l);
+	st1->len = l;
+	free(buf);
+
+	VTAILQ_INIT(&old);
+	Lck_Lock(&oc->objhead->mtx);
+	if (oc->refcnt == 2 && !(oc->flags & OC_F_DYING) &&
+	    sml_flags(oc) == 0) {
+		VTAILQ_CONCAT(&old, &o->list, list);
+		VTAILQ_INSERT_TAIL(&o->list, st1, list);
+		sti = sml_getindex(oc);
+		oc->stobj->priv2 = SML_PACKED;
+		st1 = NULL;
+	} else
+		sti = NULL;
+	Lck_Unlock(&oc->objhead->mtx);
+
+	if (st1 != NULL) {
+		sml_stv_free(oc, st1);
+		return;
+	}
+	if (sti != NULL)
+		sml_stv_free(oc, sti);
+	while ((st = VTAILQ_FIRST(&old)) != NULL) {
+		VTAILQ_REMOVE(&old, st, list);
+		sml_stv_free(oc, st);
+	}
+	wrk->stats->sml_packed++;
+	(void)__sync_add_and_fetch(&VSC_C_main->sml_pack_saved,
+	    len - l);
+}
+
+static void * __match_proto__(bgthread_t)
+sml_pack_thread(struct worker *wrk, void *priv)
+{
+	const struct stevedore *stv;
+	struct objcore *oc;
+	double idle;
+
+	CAST_OBJ_NOTNULL(stv, priv, STEVEDORE_MAGIC);
+	AN(stv->lru);
+	while (1) {
+		idle = cache_param->pack_idle;
+		oc = NULL;
+		if (idle > 0.)
+			oc = LRU_Cold(stv->lru, VTIM_real() - idle);
+		if (oc == NULL) {
+			Pool_Sumstat(wrk);
+			VTIM_sleep(1.);
+			continue;
+		}
+		sml_pack(wrk, oc);
+		(void)HSH_DerefObjCore(wrk, &oc, 0);
+		if (wrk->stats->sml_packed >= cache_param->wthread_stats_rate)
+			Pool_Sumstat(wrk);
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------
+ * Start packing idle objects of a stevedore whose body segments stay
+ * where they are, see the pack_idle parameter.
+ */
+
+void
+SML_Pack(struct stevedore *stv)
+{
+	pthread_t thr;
+
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	AN(stv->lru);
+	AZ(stv->sml_getobj);
+	AZ(stv->sml_pin);
+	AN(stv->sml_free);
+	WRK_BgThread(&thr, "sml-pack", sml_pack_thread, stv);
+}
+
 static void
 sml_panic_st(struct vsb *vsb, const char *hd, const struct storage *st)
 {
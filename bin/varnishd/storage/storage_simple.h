@@ -69,3 +69,4 @@ struct object *SML_MkObject(const struct stevedore *, struct objcore *,
 
 storage_allocobj_f SML_allocobj;
 storage_panic_f SML_panic;
+void SML_Pack(struct stevedore *);
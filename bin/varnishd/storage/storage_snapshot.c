@@ -0,0 +1,614 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Snapshots of storage, for warm restarts.
+ *
+ * The storage.snapshot command writes the objects of each stevedore
+ * which was given a snapshot file there, the most recently used first,
+ * and when the child starts again they are read back in.  The file is
+ * written next to itself and renamed into place when complete.
+ *
+ * The file starts with the ban list, which is reloaded before the
+ * objects, so each can be put on the ban it was last tested against.
+ * A record for each object follows, starting with the length of its
+ * attributes and of its body, so the loaders can each claim the next
+ * record and read it on their own.  Objects which are past their keep
+ * by now are skipped.
+ *
+ * The loading happens in the background, while the child takes
+ * traffic, so an object may be fetched again before it has been
+ * loaded.  The ban lurker waits until all is loaded.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache/cache.h"
+#include "cache/cache_priv.h"
+
+#include "hash/hash_slinger.h"
+#include "storage/storage.h"
+#include "vcli_serve.h"
+#include "vsha256.h"
+#include "vtim.h"
+
+#define SNP_NLOADER		4
+#define SNP_BUF			(256 * 1024)
+
+static const char snp_magic[8] = "VSNAP01";
+
+struct snp_head {
+	char			magic[8];
+	uint64_t		banlen;
+	unsigned char		bansum[VSHA256_LEN];
+};
+
+struct snp_rec {
+	uint32_t		magic;
+#define SNP_REC_MAGIC		0x534e5052
+	uint32_t		attrlen;
+	uint64_t		len;
+	double			t_origin;
+	double			ttl;
+	double			grace;
+	double			keep;
+	double			ban;
+	uint8_t			digest[DIGEST_LEN];
+};
+
+struct snp_attr {
+	uint32_t		attr;
+	uint32_t		len;
+};
+
+struct snp {
+	unsigned		magic;
+#define SNP_MAGIC		0x1d6e0a37
+	VTAILQ_ENTRY(snp)	list;
+	struct stevedore	*stv;
+
+	/* Loading, under snp_mtx */
+	int			fd;
+	off_t			off;
+	off_t			end;
+	unsigned		nloader;
+};
+
+struct snp_loader {
+	unsigned		magic;
+#define SNP_LOADER_MAGIC	0x5b1c77e4
+	struct snp		*snp;
+	struct pool_task	task;
+};
+
+static VTAILQ_HEAD(, snp)	snp_list = VTAILQ_HEAD_INITIALIZER(snp_list);
+static struct lock		snp_mtx;
+static pthread_cond_t		snp_cond;
+static unsigned			snp_want;
+static unsigned			snp_busy;
+
+/*--------------------------------------------------------------------
+ * Writing
+ */
+
+struct snp_out {
+	FILE			*f;
+	uint64_t		len;
+};
+
+static int __match_proto__(objiterate_f)
+snp_write_body(void *priv, int flush, const void *ptr, ssize_t len)
+{
+	struct snp_out *so;
+
+	(void)flush;
+	so = priv;
+	if (len > 0 && fwrite(ptr, len, 1, so->f) != 1)
+		return (-1);
+	so->len += len;
+	return (0);
+}
+
+static int
+snp_write_obj(struct worker *wrk, struct snp_out *so, struct objcore *oc)
+{
+	struct snp_rec rec;
+	struct snp_attr sa;
+	const void *p;
+	ssize_t l;
+	unsigned u;
+
+	memset(&rec, 0, sizeof rec);
+	rec.magic = SNP_REC_MAGIC;
+	EXP_COPY(&rec, oc);
+	rec.ban = BAN_Time(oc->ban);
+	memcpy(rec.digest, oc->objhead->digest, sizeof rec.digest);
+	rec.len = ObjGetLen(wrk, oc);
+	for (u = 0; u < OA__MAX; u++) {
+		if (u == OA_LEN || !ObjHasAttr(wrk, oc, (enum obj_attr)u))
+			continue;
+		(void)ObjGetAttr(wrk, oc, (enum obj_attr)u, &l);
+		rec.attrlen += sizeof sa + l;
+	}
+	if (fwrite(&rec, sizeof rec, 1, so->f) != 1)
+		return (-1);
+	for (u = 0; u < OA__MAX; u++) {
+		if (u == OA_LEN || !ObjHasAttr(wrk, oc, (enum obj_attr)u))
+			continue;
+		p = ObjGetAttr(wrk, oc, (enum obj_attr)u, &l);
+		sa.attr = u;
+		sa.len = l;
+		if (fwrite(&sa, sizeof sa, 1, so->f) != 1 ||
+		    (l > 0 && fwrite(p, l, 1, so->f) != 1))
+			return (-1);
+	}
+	so->len = 0;
+	if (ObjIterate(wrk, oc, so, snp_write_body, 0) || so->len != rec.len)
+		return (-1);
+	return (0);
+}
+
+static void
+snp_write(struct worker *wrk, const struct snp *sp)
+{
+	struct snp_head head;
+	struct snp_out so;
+	struct objcore **ocp, *oc;
+	struct vsb *vsb;
+	VSHA256_CTX sha;
+	char tmp[PATH_MAX];
+	unsigned u, i, n;
+	double now;
+	int fd, err = 0;
+
+	CHECK_OBJ_NOTNULL(sp, SNP_MAGIC);
+	bprintf(tmp, "%s.tmp", sp->stv->snapshot);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		VSL(SLT_Error, 0, "Snapshot %s: %s", tmp, strerror(errno));
+		return;
+	}
+	memset(&so, 0, sizeof so);
+	so.f = fdopen(fd, "w");
+	AN(so.f);
+	AZ(setvbuf(so.f, NULL, _IOFBF, SNP_BUF));
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	BAN_Dump(vsb);
+	AZ(VSB_finish(vsb));
+	memset(&head, 0, sizeof head);
+	memcpy(head.magic, snp_magic, sizeof head.magic);
+	head.banlen = VSB_len(vsb);
+	VSHA256_Init(&sha);
+	VSHA256_Update(&sha, VSB_data(vsb), VSB_len(vsb));
+	VSHA256_Final(head.bansum, &sha);
+	if (fwrite(&head, sizeof head, 1, so.f) != 1 ||
+	    fwrite(VSB_data(vsb), VSB_len(vsb), 1, so.f) != 1)
+		err = 1;
+	VSB_destroy(&vsb);
+
+	now = VTIM_real();
+	for (u = 0; !err; u++) {
+		ocp = LRU_Hot(sp->stv->lru, u, &n);
+		if (ocp == NULL)
+			break;
+		for (i = 0; i < n; i++) {
+			oc = ocp[i];
+			if (!err && !(oc->flags & (OC_F_PRIVATE | OC_F_PASS |
+			    OC_F_HFP | OC_F_FAILED)) && oc->ban != NULL &&
+			    EXP_WHEN(oc) > now) {
+				if (snp_write_obj(wrk, &so, oc))
+					err = 1;
+				else
+					wrk->stats->snapshot_written++;
+			}
+			(void)HSH_DerefObjCore(wrk, &ocp[i], 0);
+		}
+		free(ocp);
+	}
+
+	if (fflush(so.f) || fsync(fd))
+		err = 1;
+	AZ(fclose(so.f));
+	if (!err && rename(tmp, sp->stv->snapshot))
+		err = 1;
+	if (err) {
+		VSL(SLT_Error, 0, "Snapshot %s: %s", tmp, strerror(errno));
+		(void)unlink(tmp);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Loading
+ */
+
+static int
+snp_attr_ok(unsigned attr, uint32_t len, unsigned *wsl)
+{
+
+	switch (attr) {
+#define OBJ_FIXATTR(U, l, s)						\
+	case OA_##U:							\
+		return (attr != OA_LEN && len == s);
+#include "tbl/obj_attr.h"
+#define OBJ_VARATTR(U, l)						\
+	case OA_##U:							\
+		*wsl += len;						\
+		return (1);
+#include "tbl/obj_attr.h"
+#define OBJ_AUXATTR(U, l)						\
+	case OA_##U:							\
+		return (1);
+#include "tbl/obj_attr.h"
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Returns non-zero if the file is no good from here on, objects which
+ * cannot be had are just skipped.
+ */
+
+static int
+snp_load_obj(struct worker *wrk, const struct snp *sp,
+    const struct snp_rec *rec, off_t off)
+{
+	struct objcore *oc;
+	struct snp_attr sa;
+	struct ban *ban;
+	uint8_t *buf, *p, *e, *ptr;
+	uint64_t left;
+	unsigned wsl = 0;
+	ssize_t sz, l;
+	int ok, retval = 0;
+
+	if (EXP_WHEN(rec) <= VTIM_real())
+		return (0);
+	ban = BAN_FindBan(rec->ban);
+	if (ban == NULL)
+		return (0);
+
+	buf = malloc(rec->attrlen + 1L);
+	if (buf == NULL)
+		return (0);
+	if (pread(sp->fd, buf, rec->attrlen, off) != rec->attrlen) {
+		free(buf);
+		return (1);
+	}
+	off += rec->attrlen;
+	e = buf + rec->attrlen;
+	for (p = buf; p < e; p += sa.len) {
+		if (e - p < sizeof sa) {
+			free(buf);
+			return (1);
+		}
+		memcpy(&sa, p, sizeof sa);
+		p += sizeof sa;
+		if (sa.len > e - p || !snp_attr_ok(sa.attr, sa.len, &wsl)) {
+			free(buf);
+			return (1);
+		}
+	}
+	if (wsl == 0) {
+		free(buf);
+		return (1);
+	}
+
+	oc = ObjNew(wrk);
+	oc->boc->len_hint = rec->len;
+	EXP_COPY(oc, rec);
+	if (!STV_NewObject(wrk, oc, sp->stv, wsl)) {
+		free(buf);
+		ObjDestroy(wrk, &oc);
+		return (0);
+	}
+	ok = 1;
+	for (p = buf; ok && p < e; p += sa.len) {
+		memcpy(&sa, p, sizeof sa);
+		p += sizeof sa;
+		ok = ObjSetAttr(wrk, oc, (enum obj_attr)sa.attr, sa.len,
+		    p) != NULL;
+	}
+	free(buf);
+	for (left = rec->len; ok && left > 0; left -= l) {
+		sz = left;
+		ok = ObjGetSpace(wrk, oc, &sz, &ptr);
+		if (!ok)
+			break;
+		if (sz > left)
+			sz = left;
+		l = pread(sp->fd, ptr, sz, off);
+		if (l <= 0) {
+			ok = 0;
+			retval = 1;
+			break;
+		}
+		ObjExtend(wrk, oc, l);
+		off += l;
+	}
+	if (!ok) {
+		ObjFreeObj(wrk, oc);
+		ObjDestroy(wrk, &oc);
+		return (retval);
+	}
+	AZ(ObjSetU64(wrk, oc, OA_LEN, rec->len));
+
+	oc->refcnt = 1;
+	HSH_Insert(wrk, rec->digest, oc, ban);
+	AN(oc->ban);
+	HSH_DerefBoc(wrk, oc);
+	(void)HSH_DerefObjCore(wrk, &oc, HSH_RUSH_POLICY);
+	wrk->stats->snapshot_loaded++;
+	return (0);
+}
+
+static void
+snp_load(struct worker *wrk, struct snp *sp)
+{
+	struct snp_rec rec;
+	struct vsl_log vsl;
+	off_t off;
+	int bad;
+
+	CHECK_OBJ_NOTNULL(sp, SNP_MAGIC);
+	VSL_Setup(&vsl, NULL, 0);
+	wrk->vsl = &vsl;
+	while (1) {
+		Lck_Lock(&snp_mtx);
+		bad = 0;
+		off = sp->off;
+		if (sp->end - off < (off_t)sizeof rec) {
+			Lck_Unlock(&snp_mtx);
+			break;
+		}
+		if (pread(sp->fd, &rec, sizeof rec, off) != sizeof rec ||
+		    rec.magic != SNP_REC_MAGIC ||
+		    rec.len > sp->end - off - sizeof rec ||
+		    rec.attrlen > sp->end - off - sizeof rec - rec.len)
+			bad = 1;
+		off += sizeof rec;
+		sp->off = bad ? sp->end : off + rec.attrlen + rec.len;
+		Lck_Unlock(&snp_mtx);
+		if (!bad)
+			bad = snp_load_obj(wrk, sp, &rec, off);
+		if (bad) {
+			VSL(SLT_Error, 0, "Snapshot %s: bad record at %jd",
+			    sp->stv->snapshot, (intmax_t)off - sizeof rec);
+			Lck_Lock(&snp_mtx);
+			sp->off = sp->end;
+			Lck_Unlock(&snp_mtx);
+			break;
+		}
+		if (wrk->stats->snapshot_loaded >=
+		    cache_param->wthread_stats_rate)
+			Pool_Sumstat(wrk);
+	}
+	VSL_Flush(&vsl, 0);
+	wrk->vsl = NULL;
+	free(vsl.wlb);
+}
+
+static void __match_proto__(task_func_t)
+snp_load_task(struct worker *wrk, void *priv)
+{
+	struct snp_loader *sl;
+	struct snp *sp;
+
+	CAST_OBJ_NOTNULL(sl, priv, SNP_LOADER_MAGIC);
+	sp = sl->snp;
+	snp_load(wrk, sp);
+	Lck_Lock(&snp_mtx);
+	assert(sp->nloader > 0);
+	if (--sp->nloader == 0)
+		AZ(pthread_cond_broadcast(&snp_cond));
+	Lck_Unlock(&snp_mtx);
+}
+
+/* Load with helpers from the worker pools, if they can be had */
+
+static void
+snp_load_all(struct worker *wrk, struct snp *sp)
+{
+	struct snp_loader sl[SNP_NLOADER - 1];
+	unsigned u;
+
+	for (u = 0; u < SNP_NLOADER - 1; u++) {
+		INIT_OBJ(&sl[u], SNP_LOADER_MAGIC);
+		sl[u].snp = sp;
+		sl[u].task.func = snp_load_task;
+		sl[u].task.priv = &sl[u];
+		Lck_Lock(&snp_mtx);
+		sp->nloader++;
+		Lck_Unlock(&snp_mtx);
+		if (Pool_Task_Any(&sl[u].task, TASK_QUEUE_REQ)) {
+			Lck_Lock(&snp_mtx);
+			sp->nloader--;
+			Lck_Unlock(&snp_mtx);
+			break;
+		}
+	}
+	snp_load(wrk, sp);
+	Lck_Lock(&snp_mtx);
+	while (sp->nloader > 0)
+		(void)Lck_CondWait(&snp_cond, &snp_mtx, 0);
+	Lck_Unlock(&snp_mtx);
+	closefd(&sp->fd);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void * __match_proto__(bgthread_t)
+snp_thread(struct worker *wrk, void *priv)
+{
+	struct snp *sp;
+	unsigned held = 0;
+
+	AZ(priv);
+	VTAILQ_FOREACH(sp, &snp_list, list) {
+		if (sp->fd < 0)
+			continue;
+		snp_load_all(wrk, sp);
+		held = 1;
+	}
+	Pool_Sumstat(wrk);
+	if (held)
+		BAN_Release();
+
+	Lck_Lock(&snp_mtx);
+	while (1) {
+		if (!snp_want) {
+			(void)Lck_CondWait(&snp_cond, &snp_mtx, 0);
+			continue;
+		}
+		snp_want = 0;
+		snp_busy = 1;
+		Lck_Unlock(&snp_mtx);
+		VTAILQ_FOREACH(sp, &snp_list, list)
+			snp_write(wrk, sp);
+		Pool_Sumstat(wrk);
+		Lck_Lock(&snp_mtx);
+		snp_busy = 0;
+	}
+	NEEDLESS(return (NULL));
+}
+
+static void __match_proto__(cli_func_t)
+snp_cli_snapshot(struct cli *cli, const char * const *av, void *priv)
+{
+	struct snp *sp;
+
+	(void)av;
+	(void)priv;
+	if (VTAILQ_EMPTY(&snp_list)) {
+		VCLI_Out(cli, "No storage has a snapshot file");
+		VCLI_SetResult(cli, CLIS_CANT);
+		return;
+	}
+	Lck_Lock(&snp_mtx);
+	if (snp_want || snp_busy) {
+		Lck_Unlock(&snp_mtx);
+		VCLI_Out(cli, "A snapshot is being written already");
+		VCLI_SetResult(cli, CLIS_CANT);
+		return;
+	}
+	snp_want = 1;
+	AZ(pthread_cond_broadcast(&snp_cond));
+	Lck_Unlock(&snp_mtx);
+	VTAILQ_FOREACH(sp, &snp_list, list)
+		VCLI_Out(cli, "Writing %s to %s\n", sp->stv->ident,
+		    sp->stv->snapshot);
+}
+
+static struct cli_proto snp_cmds[] = {
+	{ CLICMD_STORAGE_SNAPSHOT,		"", snp_cli_snapshot },
+	{ NULL }
+};
+
+/*--------------------------------------------------------------------
+ * Reload the bans of a snapshot file, and leave it open for loading.
+ */
+
+static void
+snp_open(struct snp *sp)
+{
+	struct snp_head head;
+	struct stat st;
+	unsigned char sum[VSHA256_LEN];
+	VSHA256_CTX sha;
+	uint8_t *bans;
+
+	sp->fd = open(sp->stv->snapshot, O_RDONLY);
+	if (sp->fd < 0)
+		return;
+	if (fstat(sp->fd, &st) || read(sp->fd, &head, sizeof head) !=
+	    sizeof head || memcmp(head.magic, snp_magic, sizeof head.magic) ||
+	    head.banlen == 0 || head.banlen > st.st_size - sizeof head) {
+		VSL(SLT_Error, 0, "Snapshot %s: not a snapshot",
+		    sp->stv->snapshot);
+		closefd(&sp->fd);
+		return;
+	}
+	bans = malloc(head.banlen);
+	AN(bans);
+	if (read(sp->fd, bans, head.banlen) != head.banlen) {
+		free(bans);
+		closefd(&sp->fd);
+		return;
+	}
+	VSHA256_Init(&sha);
+	VSHA256_Update(&sha, bans, head.banlen);
+	VSHA256_Final(sum, &sha);
+	if (memcmp(sum, head.bansum, sizeof sum)) {
+		VSL(SLT_Error, 0, "Snapshot %s: bad ban list",
+		    sp->stv->snapshot);
+		free(bans);
+		closefd(&sp->fd);
+		return;
+	}
+	BAN_Reload(bans, head.banlen);
+	free(bans);
+	sp->off = sizeof head + head.banlen;
+	sp->end = st.st_size;
+}
+
+void
+SNP_Init(void)
+{
+	struct stevedore *stv;
+	struct snp *sp;
+	pthread_t thr;
+	unsigned held = 0;
+
+	ASSERT_CLI();
+	CLI_AddFuncs(snp_cmds);
+	Lck_New(&snp_mtx, lck_snapshot);
+	AZ(pthread_cond_init(&snp_cond, NULL));
+
+	STV_Foreach(stv) {
+		if (stv->snapshot == NULL || stv->lru == NULL ||
+		    stv == stv_transient)
+			continue;
+		ALLOC_OBJ(sp, SNP_MAGIC);
+		AN(sp);
+		sp->stv = stv;
+		snp_open(sp);
+		if (sp->fd >= 0 && !held) {
+			/* Until snp_thread() is done loading */
+			BAN_Hold();
+			held = 1;
+		}
+		VTAILQ_INSERT_TAIL(&snp_list, sp, list);
+	}
+	if (!VTAILQ_EMPTY(&snp_list))
+		WRK_BgThread(&thr, "snapshot", snp_thread, NULL);
+}
@@ -0,0 +1,283 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * TLS transport with kernel TLS.
+ *
+ * OpenSSL does the handshake, in the session task before the first
+ * request, the same place the PROXY transport reads its header.  With
+ * SSL_OP_ENABLE_KTLS OpenSSL hands the negotiated keys to the kernel
+ * (TCP_ULP "tls") for both directions, and from then on the socket
+ * carries plaintext as far as we are concerned: the session goes on as
+ * an ordinary HTTP/1 session, and the writev(2) and sendfile(2) paths
+ * of delivery work as they are.
+ *
+ * There is no userland record layer here, so a connection where the
+ * kernel could not take over both directions (old kernel, no "tls"
+ * module, a cipher the kernel does not do) is closed.  Non-data records
+ * from the client after the handshake (alerts, key updates) make the
+ * read fail, which closes the session.  No session tickets are issued,
+ * they would have to be written after the kernel took over.
+ *
+ * The certificate is read by the manager from the tls_certificate
+ * parameter and handed to us in the heritage, so the child does not
+ * need access to the key file.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_OPENSSL)
+
+#include "cache/cache.h"
+
+#include <poll.h>
+#include <stdlib.h>
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+
+#include "cache/cache_transport.h"
+#include "cache/cache_priv.h"
+#include "common/heritage.h"
+
+#include "vtcp.h"
+#include "vtim.h"
+
+static SSL_CTX *vtls_ctx;
+
+static const unsigned char vtls_alpn[] = "\x08http/1.1";
+
+/*--------------------------------------------------------------------*/
+
+static void
+vtls_err(unsigned vxid, const char *what)
+{
+	unsigned long e;
+	char buf[256];
+
+	e = ERR_get_error();
+	if (e == 0) {
+		VSL(SLT_Error, vxid, "TLS: %s", what);
+		return;
+	}
+	ERR_error_string_n(e, buf, sizeof buf);
+	VSL(SLT_Error, vxid, "TLS: %s: %s", what, buf);
+	ERR_clear_error();
+}
+
+static int
+vtls_alpn_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+    const unsigned char *in, unsigned inlen, void *priv)
+{
+	unsigned char *o;
+
+	(void)ssl;
+	(void)priv;
+	if (SSL_select_next_proto(&o, outlen, vtls_alpn,
+	    sizeof vtls_alpn - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+		return (SSL_TLSEXT_ERR_NOACK);
+	*out = o;
+	return (SSL_TLSEXT_ERR_OK);
+}
+
+/*--------------------------------------------------------------------
+ * Load the certificate chain and key from the PEM blob the manager
+ * read for us.  PEM_read_bio_*() skips blocks of other types, so the
+ * order of things in the file does not matter.
+ */
+
+static int
+vtls_load(SSL_CTX *ctx, const char *pem, ssize_t len)
+{
+	BIO *bio;
+	X509 *x;
+	EVP_PKEY *pk;
+	int n = 0;
+
+	bio = BIO_new_mem_buf(pem, (int)len);
+	AN(bio);
+	x = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+	if (x == NULL || SSL_CTX_use_certificate(ctx, x) != 1) {
+		X509_free(x);
+		(void)BIO_free(bio);
+		return (-1);
+	}
+	X509_free(x);
+	while ((x = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+		/* ctx takes over the reference */
+		if (SSL_CTX_add_extra_chain_cert(ctx, x) != 1) {
+			X509_free(x);
+			(void)BIO_free(bio);
+			return (-1);
+		}
+		n++;
+	}
+	ERR_clear_error();
+	(void)BIO_free(bio);
+
+	bio = BIO_new_mem_buf(pem, (int)len);
+	AN(bio);
+	pk = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+	(void)BIO_free(bio);
+	if (pk == NULL || SSL_CTX_use_PrivateKey(ctx, pk) != 1) {
+		EVP_PKEY_free(pk);
+		return (-1);
+	}
+	EVP_PKEY_free(pk);
+	if (SSL_CTX_check_private_key(ctx) != 1)
+		return (-1);
+	return (n);
+}
+
+void
+TLS_Init(void)
+{
+	SSL_CTX *ctx;
+
+	if (heritage.tls_pem == NULL)
+		return;
+
+	ctx = SSL_CTX_new(TLS_server_method());
+	AN(ctx);
+	AN(SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION));
+	/* What the kernel can take over */
+	AN(SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:"
+	    "TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"));
+	AN(SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20"));
+	(void)SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS |
+	    SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+	AN(SSL_CTX_set_num_tickets(ctx, 0));
+	(void)SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_alpn_select_cb(ctx, vtls_alpn_cb, NULL);
+
+	if (vtls_load(ctx, heritage.tls_pem, heritage.tls_pem_len) < 0) {
+		vtls_err(0, "Cannot use tls_certificate");
+		SSL_CTX_free(ctx);
+		ctx = NULL;
+	}
+
+	/* No need to keep the key around in the clear */
+	memset(heritage.tls_pem, 0, heritage.tls_pem_len);
+	free(heritage.tls_pem);
+	heritage.tls_pem = NULL;
+	heritage.tls_pem_len = 0;
+
+	vtls_ctx = ctx;
+}
+
+/*--------------------------------------------------------------------
+ * Run the handshake non-blocking, so the whole of it, and not every
+ * single read, is bounded by timeout_idle.
+ */
+
+static enum sess_close
+vtls_handshake(const struct sess *sp, SSL *ssl)
+{
+	struct pollfd pfd[1];
+	double tmo;
+	int i;
+
+	(void)VTCP_nonblocking(sp->fd);
+	while ((i = SSL_accept(ssl)) != 1) {
+		pfd->fd = sp->fd;
+		switch (SSL_get_error(ssl, i)) {
+		case SSL_ERROR_WANT_READ:
+			pfd->events = POLLIN;
+			break;
+		case SSL_ERROR_WANT_WRITE:
+			pfd->events = POLLOUT;
+			break;
+		default:
+			vtls_err(sp->vxid, "Handshake failed");
+			return (SC_RX_JUNK);
+		}
+		tmo = sp->t_idle + cache_param->timeout_idle - VTIM_real();
+		if (tmo <= 0. || poll(pfd, 1, (int)(tmo * 1e3) + 1) <= 0) {
+			VSL(SLT_Error, sp->vxid, "TLS: Handshake timeout");
+			return (SC_RX_TIMEOUT);
+		}
+	}
+	(void)VTCP_blocking(sp->fd);
+
+	if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) ||
+	    !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+		VSL(SLT_Error, sp->vxid,
+		    "TLS: Kernel TLS not available for %s",
+		    SSL_get_cipher_name(ssl));
+		return (SC_TX_ERROR);
+	}
+	if (SSL_has_pending(ssl)) {
+		/* Already decrypted by OpenSSL, we cannot put it back */
+		VSL(SLT_Error, sp->vxid, "TLS: Data buffered in userland");
+		return (SC_RX_JUNK);
+	}
+	VSL(SLT_Debug, sp->vxid, "TLS: %s %s", SSL_get_version(ssl),
+	    SSL_get_cipher_name(ssl));
+	return (SC_NULL);
+}
+
+static void __match_proto__(task_func_t)
+vtls_new_session(struct worker *wrk, void *arg)
+{
+	struct req *req;
+	struct sess *sp;
+	enum sess_close sc;
+	SSL *ssl;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(req, arg, REQ_MAGIC);
+	sp = req->sp;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+
+	if (vtls_ctx == NULL) {
+		VSL(SLT_Error, sp->vxid, "TLS: No certificate");
+		sc = SC_TX_ERROR;
+	} else {
+		ssl = SSL_new(vtls_ctx);
+		AN(ssl);
+		AN(SSL_set_fd(ssl, sp->fd));
+		sc = vtls_handshake(sp, ssl);
+		/* The kernel has the keys now, the socket stays open */
+		SSL_free(ssl);
+	}
+
+	if (sc != SC_NULL) {
+		wrk->stats->sess_tls_fail++;
+		Req_Release(req);
+		SES_Delete(sp, sc, NAN);
+		return;
+	}
+	wrk->stats->sess_tls++;
+
+	SES_SetTransport(wrk, sp, req, &HTTP1_transport);
+}
+
+struct transport TLS_transport = {
+	.name =			"TLS",
+	.magic =		TRANSPORT_MAGIC,
+	.new_session =		vtls_new_session,
+};
+
+#endif /* HAVE_OPENSSL */
@@ -73,33 +73,78 @@ Wait_Call(const struct waiter *w, struct waited *wp,
 	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
 	AN(wp->func);
 	assert(wp->idx == BINHEAP_NOIDX);
+	AZ(wp->fifo);
 	wp->func(wp, ev, now);
 }
 
-/**********************************************************************/
+/**********************************************************************
+ * Almost all waited share one of a few timeouts, timeout_idle for the
+ * sessions, backend_idle_timeout for the backend connections, and
+ * they mostly come in the order they went idle.  Those go on a FIFO
+ * list per timeout, which are in the order they are due, so entering,
+ * leaving and finding the next due are all O(1).  Whatever does not
+ * fit that pattern goes on the binheap.
+ */
+
+#define WAIT_FIFO_WALK		8	/* Out of order steps allowed */
+
+static int
+wait_fifo_insert(struct waiter *w, struct waited *wp)
+{
+	struct wait_fifo *wf, *wf2 = NULL;
+	struct waited *wp2;
+	unsigned u;
+
+	for (u = 0; u < WAIT_NFIFO; u++) {
+		wf = &w->fifo[u];
+		if (wf->tmo == wp->tmo)
+			break;
+		if (wf2 == NULL && VTAILQ_EMPTY(&wf->head))
+			wf2 = wf;
+	}
+	if (u == WAIT_NFIFO) {
+		if (wf2 == NULL)
+			return (0);
+		wf = wf2;
+		wf->tmo = wp->tmo;
+	}
+
+	wp2 = VTAILQ_LAST(&wf->head, waited_head);
+	for (u = 0; wp2 != NULL && wp2->idle > wp->idle; u++) {
+		if (u == WAIT_FIFO_WALK)
+			return (0);
+		wp2 = VTAILQ_PREV(wp2, waited_head, list);
+	}
+	if (wp2 == NULL)
+		VTAILQ_INSERT_HEAD(&wf->head, wp, list);
+	else
+		VTAILQ_INSERT_AFTER(&wf->head, wp2, wp, list);
+	wp->fifo = 1 + (wf - w->fifo);
+	return (1);
+}
 
 void
-Wait_HeapInsert(const struct waiter *w, struct waited *wp)
+Wait_HeapInsert(struct waiter *w, struct waited *wp)
 {
 	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
 	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
 	assert(wp->idx == BINHEAP_NOIDX);
-	binheap_insert(w->heap, wp);
+	AZ(wp->fifo);
+	if (!wait_fifo_insert(w, wp))
+		binheap_insert(w->heap, wp);
 }
 
-/*
- * XXX: wp is const because otherwise FlexeLint complains.  However, *wp
- * XXX: will actually change as a result of calling this function, via
- * XXX: the pointer stored in the bin-heap.  I can see how this const
- * XXX: could maybe confuse a compilers optimizer, but I do not expect
- * XXX: any harm to come from it.  Caveat Emptor.
- */
-
 int
-Wait_HeapDelete(const struct waiter *w, const struct waited *wp)
+Wait_HeapDelete(struct waiter *w, struct waited *wp)
 {
 	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
 	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	if (wp->fifo) {
+		assert(wp->fifo <= WAIT_NFIFO);
+		VTAILQ_REMOVE(&w->fifo[wp->fifo - 1].head, wp, list);
+		wp->fifo = 0;
+		return (1);
+	}
 	if (wp->idx == BINHEAP_NOIDX)
 		return (0);
 	binheap_delete(w->heap, wp->idx);
@@ -109,10 +154,18 @@ Wait_HeapDelete(const struct waiter *w, const struct waited *wp)
 double
 Wait_HeapDue(const struct waiter *w, struct waited **wpp)
 {
-	struct waited *wp;
+	struct waited *wp, *wp2;
+	unsigned u;
 
 	wp = binheap_root(w->heap);
 	CHECK_OBJ_ORNULL(wp, WAITED_MAGIC);
+	for (u = 0; u < WAIT_NFIFO; u++) {
+		wp2 = VTAILQ_FIRST(&w->fifo[u].head);
+		CHECK_OBJ_ORNULL(wp2, WAITED_MAGIC);
+		if (wp2 != NULL &&
+		    (wp == NULL || Wait_When(wp2) < Wait_When(wp)))
+			wp = wp2;
+	}
 	if (wp == NULL) {
 		if (wpp != NULL)
 			*wpp = NULL;
@@ -135,6 +188,7 @@ Wait_Enter(const struct waiter *w, struct waited *wp)
 	AN(wp->func);
 	AN(wp->tmo);
 	wp->idx = BINHEAP_NOIDX;
+	wp->fifo = 0;
 	return (w->impl->enter(w->priv, wp));
 }
 
@@ -154,6 +208,7 @@ struct waiter *
 Waiter_New(void)
 {
 	struct waiter *w;
+	unsigned u;
 
 	AN(waiter);
 	AN(waiter->name);
@@ -168,12 +223,46 @@ Waiter_New(void)
 	w->impl = waiter;
 	VTAILQ_INIT(&w->waithead);
 	w->heap = binheap_new(w, waited_cmp, waited_update);
+	for (u = 0; u < WAIT_NFIFO; u++)
+		VTAILQ_INIT(&w->fifo[u].head);
 
 	waiter->init(w);
 
 	return (w);
 }
 
+/*
+ * For waiters which run several instances of themselves, each with its
+ * own timeouts:  An extra waiter to keep those in.
+ */
+
+struct waiter *
+Wait_NewPart(const struct waiter *w)
+{
+	struct waiter *w2;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	ALLOC_OBJ(w2, WAITER_MAGIC);
+	AN(w2);
+	w2->impl = w->impl;
+	VTAILQ_INIT(&w2->waithead);
+	w2->heap = binheap_new(w2, waited_cmp, waited_update);
+	for (u = 0; u < WAIT_NFIFO; u++)
+		VTAILQ_INIT(&w2->fifo[u].head);
+	return (w2);
+}
+
+void
+Wait_DestroyPart(struct waiter **wp)
+{
+	struct waiter *w;
+
+	TAKE_OBJ_NOTNULL(w, wp, WAITER_MAGIC);
+	AZ(Wait_HeapDue(w, NULL));
+	FREE_OBJ(w);
+}
+
 void
 Waiter_Destroy(struct waiter **wp)
 {
@@ -181,7 +270,7 @@ Waiter_Destroy(struct waiter **wp)
 
 	TAKE_OBJ_NOTNULL(w, wp, WAITER_MAGIC);
 
-	AZ(binheap_root(w->heap));
+	AZ(Wait_HeapDue(w, NULL));
 	AN(w->impl->fini);
 	w->impl->fini(w);
 	FREE_OBJ(w);
@@ -51,6 +51,17 @@
 #endif
 
 #define NEEV	8192
+#define MAX_PARTS	64
+
+/*
+ * With waiter_threads above one, the waited are split by fd over that
+ * many struct vwe, each with its own epoll fd, thread and timeouts, so
+ * they never touch each others connections.
+ *
+ * Everything is EPOLLONESHOT, so an event disarms the fd without an
+ * EPOLL_CTL_DEL.  The registration stays until the fd is closed or
+ * entered again, which rearms it.
+ */
 
 struct vwe {
 	unsigned		magic;
@@ -65,6 +76,13 @@ struct vwe {
 	struct lock		mtx;
 };
 
+struct vwe_set {
+	unsigned		magic;
+#define VWE_SET_MAGIC		0x1e0c3f5b
+	unsigned		nparts;
+	struct vwe		*part[MAX_PARTS];
+};
+
 /*--------------------------------------------------------------------*/
 
 static void *
@@ -74,7 +92,7 @@ vwe_thread(void *priv)
 	struct waited *wp;
 	struct waiter *w;
 	double now, then;
-	int i, n, active;
+	int i, j, n;
 	struct vwe *vwe;
 	char c;
 
@@ -119,22 +137,28 @@ vwe_thread(void *priv)
 		assert(n >= 0);
 		assert(n <= NEEV);
 		now = VTIM_real();
-		for (ep = ev, i = 0; i < n; i++, ep++) {
+
+		/* Take the whole batch off the heap under one lock */
+		Lck_Lock(&vwe->mtx);
+		for (ep = ev, i = j = 0; i < n; i++, ep++) {
 			if (ep->data.ptr == vwe) {
 				assert(read(vwe->pipe[0], &c, 1) == 1);
 				continue;
 			}
 			CAST_OBJ_NOTNULL(wp, ep->data.ptr, WAITED_MAGIC);
-			Lck_Lock(&vwe->mtx);
-			active = Wait_HeapDelete(w, wp);
-			Lck_Unlock(&vwe->mtx);
-			if (! active) {
+			if (!Wait_HeapDelete(w, wp)) {
 				VSL(SLT_Debug, wp->fd, "epoll: spurious event");
 				continue;
 			}
-			AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_DEL, wp->fd, NULL));
-			vwe->nwaited--;
-			if (ep->events & EPOLLIN)
+			ev[j++] = *ep;
+		}
+		assert(vwe->nwaited >= (unsigned)j);
+		vwe->nwaited -= j;
+		Lck_Unlock(&vwe->mtx);
+
+		for (ep = ev, i = 0; i < j; i++, ep++) {
+			CAST_OBJ_NOTNULL(wp, ep->data.ptr, WAITED_MAGIC);
+			if (ep->events & (EPOLLIN | EPOLLOUT))
 				Wait_Call(w, wp, WAITER_ACTION, now);
 			else if (ep->events & EPOLLERR)
 				Wait_Call(w, wp, WAITER_REMCLOSE, now);
@@ -157,16 +181,24 @@ vwe_thread(void *priv)
 static int __match_proto__(waiter_enter_f)
 vwe_enter(void *priv, struct waited *wp)
 {
+	struct vwe_set *vws;
 	struct vwe *vwe;
 	struct epoll_event ee;
 
-	CAST_OBJ_NOTNULL(vwe, priv, VWE_MAGIC);
-	ee.events = EPOLLIN | EPOLLRDHUP;
+	CAST_OBJ_NOTNULL(vws, priv, VWE_SET_MAGIC);
+	vwe = vws->part[(unsigned)wp->fd % vws->nparts];
+	CHECK_OBJ_NOTNULL(vwe, VWE_MAGIC);
+	ee.events = EPOLLONESHOT |
+	    (wp->want_write ? EPOLLOUT : EPOLLIN | EPOLLRDHUP);
 	ee.data.ptr = wp;
 	Lck_Lock(&vwe->mtx);
 	vwe->nwaited++;
 	Wait_HeapInsert(vwe->waiter, wp);
-	AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, wp->fd, &ee));
+	if (epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, wp->fd, &ee)) {
+		/* Still there from last time, disarmed */
+		assert(errno == EEXIST);
+		AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_MOD, wp->fd, &ee));
+	}
 	/* If the epoll isn't due before our timeout, poke it via the pipe */
 	if (Wait_When(wp) < vwe->next)
 		assert(write(vwe->pipe[1], "X", 1) == 1);
@@ -176,14 +208,12 @@ vwe_enter(void *priv, struct waited *wp)
 
 /*--------------------------------------------------------------------*/
 
-static void __match_proto__(waiter_init_f)
-vwe_init(struct waiter *w)
+static void
+vwe_init_part(struct vwe *vwe, struct waiter *w)
 {
-	struct vwe *vwe;
 	struct epoll_event ee;
 
 	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
-	vwe = w->priv;
 	INIT_OBJ(vwe, VWE_MAGIC);
 	vwe->waiter = w;
 
@@ -198,6 +228,30 @@ vwe_init(struct waiter *w)
 	AZ(pthread_create(&vwe->thread, NULL, vwe_thread, vwe));
 }
 
+static void __match_proto__(waiter_init_f)
+vwe_init(struct waiter *w)
+{
+	struct vwe_set *vws;
+	struct vwe *vwe;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	vws = w->priv;
+	INIT_OBJ(vws, VWE_SET_MAGIC);
+	vws->nparts = cache_param->waiter_threads;
+	if (vws->nparts < 1)
+		vws->nparts = 1;
+	if (vws->nparts > MAX_PARTS)
+		vws->nparts = MAX_PARTS;
+	for (u = 0; u < vws->nparts; u++) {
+		ALLOC_OBJ(vwe, VWE_MAGIC);
+		AN(vwe);
+		/* The first one keeps its timeouts in the waiter proper */
+		vwe_init_part(vwe, u == 0 ? w : Wait_NewPart(w));
+		vws->part[u] = vwe;
+	}
+}
+
 /*--------------------------------------------------------------------
  * It is the callers responsibility to trigger all fd's waited on to
  * fail somehow.
@@ -206,17 +260,25 @@ vwe_init(struct waiter *w)
 static void __match_proto__(waiter_fini_f)
 vwe_fini(struct waiter *w)
 {
+	struct vwe_set *vws;
 	struct vwe *vwe;
 	void *vp;
+	unsigned u;
 
-	CAST_OBJ_NOTNULL(vwe, w->priv, VWE_MAGIC);
+	CAST_OBJ_NOTNULL(vws, w->priv, VWE_SET_MAGIC);
 
-	Lck_Lock(&vwe->mtx);
-	vwe->die = 1;
-	assert(write(vwe->pipe[1], "Y", 1) == 1);
-	Lck_Unlock(&vwe->mtx);
-	AZ(pthread_join(vwe->thread, &vp));
-	Lck_Delete(&vwe->mtx);
+	for (u = 0; u < vws->nparts; u++) {
+		TAKE_OBJ_NOTNULL(vwe, &vws->part[u], VWE_MAGIC);
+		Lck_Lock(&vwe->mtx);
+		vwe->die = 1;
+		assert(write(vwe->pipe[1], "Y", 1) == 1);
+		Lck_Unlock(&vwe->mtx);
+		AZ(pthread_join(vwe->thread, &vp));
+		Lck_Delete(&vwe->mtx);
+		if (vwe->waiter != w)
+			Wait_DestroyPart(&vwe->waiter);
+		FREE_OBJ(vwe);
+	}
 }
 
 /*--------------------------------------------------------------------*/
@@ -226,7 +288,7 @@ const struct waiter_impl waiter_epoll = {
 	.init =		vwe_init,
 	.fini =		vwe_fini,
 	.enter =	vwe_enter,
-	.size =		sizeof(struct vwe),
+	.size =		sizeof(struct vwe_set),
 };
 
 #endif /* defined(HAVE_EPOLL_CTL) */
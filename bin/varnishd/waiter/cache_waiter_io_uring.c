@@ -0,0 +1,291 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Linux io_uring(7) waiter.
+ *
+ * Each waited fd gets a one-shot IORING_OP_POLL_ADD, which the kernel
+ * disarms by itself when it fires, so unlike epoll there is no syscall
+ * to remove a connection which became active.
+ *
+ * Submission queue entries are queued under the lock and submitted in
+ * bulk by the waiter thread on its next io_uring_enter(2).  Only when
+ * the waiter thread is asleep in the kernel does Wait_Enter() submit
+ * the pending entries itself.
+ *
+ * A timed out fd must stay in our care until the kernel has let go of
+ * it, so we queue an IORING_OP_POLL_REMOVE and only hand the fd back
+ * when the cancelled poll completes.
+ *
+ * Requires Linux 5.11 for IORING_ENTER_EXT_ARG.
+ */
+
+//lint -e{766}
+#include "config.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cache/cache.h"
+#include "cache/cache_uring.h"
+
+#include "waiter/waiter_priv.h"
+#include "waiter/mgt_waiter.h"
+#include "vtim.h"
+
+#ifndef POLLRDHUP
+#  define POLLRDHUP 0
+#endif
+
+#define NSQE	4096
+
+struct vwu {
+	unsigned		magic;
+#define VWU_MAGIC		0x2b1a4d37
+	struct vur		vur;
+	struct waiter		*waiter;
+	pthread_t		thread;
+	double			next;
+	unsigned		nwaited;
+	unsigned		pending;
+	int			sleeping;
+	int			die;
+	struct lock		mtx;
+
+};
+
+/*--------------------------------------------------------------------*/
+
+static void
+vwu_submit(struct vwu *vwu)
+{
+	int i;
+
+	Lck_AssertHeld(&vwu->mtx);
+	if (vwu->pending == 0)
+		return;
+	i = VUR_Enter(&vwu->vur, vwu->pending, 0, 0, NULL, 0);
+	assert(i >= 0);
+	vwu->pending = 0;
+}
+
+/*--------------------------------------------------------------------
+ * Queue a submission entry, it goes out with the next io_uring_enter(2)
+ */
+
+static void
+vwu_sqe(struct vwu *vwu, uint8_t opcode, int fd, uint64_t addr,
+    unsigned events, const void *data)
+{
+	struct io_uring_sqe *sqe;
+
+	Lck_AssertHeld(&vwu->mtx);
+	sqe = VUR_Sqe(&vwu->vur);
+	if (sqe == NULL) {
+		vwu_submit(vwu);
+		sqe = VUR_Sqe(&vwu->vur);
+		AN(sqe);
+	}
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = addr;
+	sqe->poll32_events = events;
+	sqe->user_data = (uintptr_t)data;
+	VUR_Commit(&vwu->vur);
+	vwu->pending++;
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+vwu_cqe(struct vwu *vwu, const struct io_uring_cqe *cqe, double now)
+{
+	struct waited *wp;
+	struct waiter *w;
+	int active;
+
+	w = vwu->waiter;
+	if (cqe->user_data == 0)		/* NOP or POLL_REMOVE */
+		return;
+	CAST_OBJ_NOTNULL(wp, (void *)(uintptr_t)cqe->user_data, WAITED_MAGIC);
+	Lck_Lock(&vwu->mtx);
+	active = Wait_HeapDelete(w, wp);
+	vwu->nwaited--;
+	Lck_Unlock(&vwu->mtx);
+	if (!active)
+		Wait_Call(w, wp, WAITER_TIMEOUT, now);
+	else if (cqe->res > 0 && (cqe->res & (POLLIN | POLLOUT)))
+		Wait_Call(w, wp, WAITER_ACTION, now);
+	else
+		Wait_Call(w, wp, WAITER_REMCLOSE, now);
+}
+
+static void *
+vwu_thread(void *priv)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	struct waited *wp;
+	struct waiter *w;
+	const struct io_uring_cqe *cqe;
+	double now, then;
+	unsigned n;
+	struct vwu *vwu;
+	int i;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	w = vwu->waiter;
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	THR_SetName("cache-io_uring");
+
+	memset(&arg, 0, sizeof arg);
+	arg.ts = (uintptr_t)&ts;
+
+	now = VTIM_real();
+	while (1) {
+		Lck_Lock(&vwu->mtx);
+		while (1) {
+			then = Wait_HeapDue(w, &wp);
+			if (wp == NULL) {
+				vwu->next = now + 100;
+				break;
+			} else if (then > now) {
+				vwu->next = then;
+				break;
+			}
+			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+			AN(Wait_HeapDelete(w, wp));
+			/* Reported when the cancelled poll completes */
+			vwu_sqe(vwu, IORING_OP_POLL_REMOVE, -1,
+			    (uintptr_t)wp, 0, NULL);
+		}
+		then = vwu->next - now;
+		assert(then > 0);
+		ts.tv_sec = (time_t)then;
+		ts.tv_nsec = (long)((then - ts.tv_sec) * 1e9);
+		n = vwu->pending;
+		vwu->pending = 0;
+		vwu->sleeping = 1;
+		Lck_Unlock(&vwu->mtx);
+
+		i = VUR_Enter(&vwu->vur, n, 1,
+		    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+		    &arg, sizeof arg);
+		assert(i >= 0 || errno == ETIME);
+		vwu->sleeping = 0;
+
+		now = VTIM_real();
+		while ((cqe = VUR_Peek(&vwu->vur)) != NULL) {
+			vwu_cqe(vwu, cqe, now);
+			VUR_Advance(&vwu->vur);
+		}
+
+		if (vwu->nwaited == 0 && vwu->die)
+			break;
+	}
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int __match_proto__(waiter_enter_f)
+vwu_enter(void *priv, struct waited *wp)
+{
+	struct vwu *vwu;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	Lck_Lock(&vwu->mtx);
+	vwu->nwaited++;
+	Wait_HeapInsert(vwu->waiter, wp);
+	vwu_sqe(vwu, IORING_OP_POLL_ADD, wp->fd, 0,
+	    wp->want_write ? POLLOUT : POLLIN | POLLRDHUP, wp);
+	/* If the waiter isn't due before our timeout, poke it with a NOP */
+	if (Wait_When(wp) < vwu->next)
+		vwu_sqe(vwu, IORING_OP_NOP, -1, 0, 0, NULL);
+	if (vwu->sleeping)
+		vwu_submit(vwu);
+	Lck_Unlock(&vwu->mtx);
+	return(0);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void __match_proto__(waiter_init_f)
+vwu_init(struct waiter *w)
+{
+	struct vwu *vwu;
+
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	vwu = w->priv;
+	INIT_OBJ(vwu, VWU_MAGIC);
+	vwu->waiter = w;
+
+	AZ(VUR_Init(&vwu->vur, NSQE));
+	AN(vwu->vur.features & IORING_FEAT_EXT_ARG);
+	AN(vwu->vur.features & IORING_FEAT_NODROP);
+
+	Lck_New(&vwu->mtx, lck_waiter);
+
+	AZ(pthread_create(&vwu->thread, NULL, vwu_thread, vwu));
+}
+
+/*--------------------------------------------------------------------
+ * It is the callers responsibility to trigger all fd's waited on to
+ * fail somehow.
+ */
+
+static void __match_proto__(waiter_fini_f)
+vwu_fini(struct waiter *w)
+{
+	struct vwu *vwu;
+	void *vp;
+
+	CAST_OBJ_NOTNULL(vwu, w->priv, VWU_MAGIC);
+
+	Lck_Lock(&vwu->mtx);
+	vwu->die = 1;
+	vwu_sqe(vwu, IORING_OP_NOP, -1, 0, 0, NULL);
+	vwu_submit(vwu);
+	Lck_Unlock(&vwu->mtx);
+	AZ(pthread_join(vwu->thread, &vp));
+	Lck_Delete(&vwu->mtx);
+
+	VUR_Fini(&vwu->vur);
+}
+
+/*--------------------------------------------------------------------*/
+
+const struct waiter_impl waiter_io_uring = {
+	.name =		"io_uring",
+	.init =		vwu_init,
+	.fini =		vwu_fini,
+	.enter =	vwu_enter,
+	.size =		sizeof(struct vwu),
+};
+
+#endif /* defined(HAVE_IO_URING) */
@@ -26,6 +26,11 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  *
+ * Changes to the kqueue are queued on a changelist under the lock and
+ * go to the kernel with the next kevent(2) the waiter thread sleeps in,
+ * so a connection entering the waiter costs no syscall of its own while
+ * the waiter thread is busy.  If it is asleep, the first change pokes
+ * it via the pipe to come and get them.
  */
 
 //lint -e{766}
@@ -39,6 +44,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "waiter/waiter_priv.h"
 #include "waiter/mgt_waiter.h"
@@ -55,18 +61,48 @@ struct vwk {
 	double			next;
 	int			pipe[2];
 	unsigned		nwaited;
+	int			sleeping;
 	int			die;
 	struct lock		mtx;
+	int			nchg;
+	struct kevent		chg[NKEV];
 };
 
 /*--------------------------------------------------------------------*/
 
+static void
+vwk_flush(struct vwk *vwk)
+{
+
+	Lck_AssertHeld(&vwk->mtx);
+	if (vwk->nchg == 0)
+		return;
+	AZ(kevent(vwk->kq, vwk->chg, vwk->nchg, NULL, 0, NULL));
+	vwk->nchg = 0;
+}
+
+static void
+vwk_change(struct vwk *vwk, struct waited *wp, unsigned flags)
+{
+
+	Lck_AssertHeld(&vwk->mtx);
+	if (vwk->nchg == NKEV)
+		vwk_flush(vwk);
+	EV_SET(&vwk->chg[vwk->nchg], wp->fd,
+	    wp->want_write ? EVFILT_WRITE : EVFILT_READ, flags, 0, 0,
+	    flags & EV_ADD ? wp : NULL);
+	vwk->nchg++;
+}
+
+/*--------------------------------------------------------------------*/
+
 static void *
 vwk_thread(void *priv)
 {
 	struct vwk *vwk;
-	struct kevent ke[NKEV], *kp;
-	int j, n;
+	struct kevent ke[NKEV], kc[NKEV], *kp;
+	struct waited *tmo[NKEV];
+	int i, j, n, nc;
 	double now, then;
 	struct timespec ts;
 	struct waited *wp;
@@ -79,55 +115,82 @@ vwk_thread(void *priv)
 	THR_SetName("cache-kqueue");
 
 	now = VTIM_real();
+	Lck_Lock(&vwk->mtx);
 	while (1) {
 		while (1) {
-			Lck_Lock(&vwk->mtx);
 			/*
-			 * XXX: We could avoid many syscalls here if we were
-			 * XXX: allowed to just close the fd's on timeout.
+			 * Changes apply in order, so a timed out fd whose
+			 * EV_ADD never reached the kernel is fine too, and
+			 * all the EV_DELETEs of a round go in one kevent().
 			 */
-			then = Wait_HeapDue(w, &wp);
-			if (wp == NULL) {
-				vwk->next = now + 100;
-				break;
-			} else if (then > now) {
-				vwk->next = then;
-				break;
+			for (n = 0; n < NKEV; n++) {
+				then = Wait_HeapDue(w, &wp);
+				if (wp == NULL) {
+					vwk->next = now + 100;
+					break;
+				} else if (then > now) {
+					vwk->next = then;
+					break;
+				}
+				CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+				vwk_change(vwk, wp, EV_DELETE);
+				AN(Wait_HeapDelete(w, wp));
+				tmo[n] = wp;
 			}
-			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
-			EV_SET(ke, wp->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-			AZ(kevent(vwk->kq, ke, 1, NULL, 0, NULL));
-			AN(Wait_HeapDelete(w, wp));
+			if (n == 0)
+				break;
+			vwk_flush(vwk);
+			assert(vwk->nwaited >= (unsigned)n);
+			vwk->nwaited -= n;
 			Lck_Unlock(&vwk->mtx);
-			Wait_Call(w, wp, WAITER_TIMEOUT, now);
+			for (i = 0; i < n; i++)
+				Wait_Call(w, tmo[i], WAITER_TIMEOUT, now);
+			Lck_Lock(&vwk->mtx);
 		}
 		then = vwk->next - now;
 		ts.tv_sec = (time_t)floor(then);
 		ts.tv_nsec = (long)(1e9 * (then - ts.tv_sec));
+		nc = vwk->nchg;
+		memcpy(kc, vwk->chg, nc * sizeof *kc);
+		vwk->nchg = 0;
+		vwk->sleeping = 1;
 		Lck_Unlock(&vwk->mtx);
-		n = kevent(vwk->kq, NULL, 0, ke, NKEV, &ts);
+		n = kevent(vwk->kq, kc, nc, ke, NKEV, &ts);
 		assert(n >= 0);
 		assert(n <= NKEV);
 		now = VTIM_real();
-		for (kp = ke, j = 0; j < n; j++, kp++) {
-			assert(kp->filter == EVFILT_READ);
-			if (ke[j].udata == vwk) {
+
+		/* Take the whole batch off the heap under one lock */
+		Lck_Lock(&vwk->mtx);
+		vwk->sleeping = 0;
+		for (kp = ke, i = j = 0; i < n; i++, kp++) {
+			AZ(kp->flags & EV_ERROR);
+			assert(kp->filter == EVFILT_READ ||
+			    kp->filter == EVFILT_WRITE);
+			if (kp->udata == vwk) {
 				assert(read(vwk->pipe[0], &c, 1) == 1);
 				continue;
 			}
-			CAST_OBJ_NOTNULL(wp, ke[j].udata, WAITED_MAGIC);
-			Lck_Lock(&vwk->mtx);
+			CAST_OBJ_NOTNULL(wp, kp->udata, WAITED_MAGIC);
 			AN(Wait_HeapDelete(w, wp));
-			Lck_Unlock(&vwk->mtx);
-			vwk->nwaited--;
+			ke[j++] = *kp;
+		}
+		assert(vwk->nwaited >= (unsigned)j);
+		vwk->nwaited -= j;
+		Lck_Unlock(&vwk->mtx);
+
+		for (kp = ke, i = 0; i < j; i++, kp++) {
+			CAST_OBJ_NOTNULL(wp, kp->udata, WAITED_MAGIC);
 			if (kp->flags & EV_EOF)
 				Wait_Call(w, wp, WAITER_REMCLOSE, now);
 			else
 				Wait_Call(w, wp, WAITER_ACTION, now);
 		}
+		Lck_Lock(&vwk->mtx);
 		if (vwk->nwaited == 0 && vwk->die)
 			break;
 	}
+	Lck_Unlock(&vwk->mtx);
 	closefd(&vwk->pipe[0]);
 	closefd(&vwk->pipe[1]);
 	closefd(&vwk->kq);
@@ -140,18 +203,22 @@ static int __match_proto__(waiter_enter_f)
 vwk_enter(void *priv, struct waited *wp)
 {
 	struct vwk *vwk;
-	struct kevent ke;
 
 	CAST_OBJ_NOTNULL(vwk, priv, VWK_MAGIC);
-	EV_SET(&ke, wp->fd, EVFILT_READ, EV_ADD|EV_ONESHOT, 0, 0, wp);
 	Lck_Lock(&vwk->mtx);
 	vwk->nwaited++;
 	Wait_HeapInsert(vwk->waiter, wp);
-	AZ(kevent(vwk->kq, &ke, 1, NULL, 0, NULL));
+	vwk_change(vwk, wp, EV_ADD|EV_ONESHOT);
 
-	/* If the kqueue isn't due before our timeout, poke it via the pipe */
-	if (Wait_When(wp) < vwk->next)
+	/*
+	 * If the kqueue is asleep, poke it via the pipe to pick up the
+	 * change.  Once awake it also sees if we are due before its
+	 * timeout, so one poke per kevent() does it.
+	 */
+	if (vwk->sleeping) {
 		assert(write(vwk->pipe[1], "X", 1) == 1);
+		vwk->sleeping = 0;
+	}
 
 	Lck_Unlock(&vwk->mtx);
 	return(0);
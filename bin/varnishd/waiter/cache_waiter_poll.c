@@ -104,7 +104,7 @@ VSL(SLT_Debug, wp->fd, "ADD");
 	assert(vwp->pollfd[vwp->hpoll].fd == -1);
 	AZ(vwp->idx[vwp->hpoll]);
 	vwp->pollfd[vwp->hpoll].fd = wp->fd;
-	vwp->pollfd[vwp->hpoll].events = POLLIN;
+	vwp->pollfd[vwp->hpoll].events = wp->want_write ? POLLOUT : POLLIN;
 	vwp->idx[vwp->hpoll] = wp;
 	vwp->hpoll++;
 	Wait_HeapInsert(vwp->waiter, wp);
@@ -193,7 +193,8 @@ VSL(SLT_Debug, vwp->pollfd[i].fd, "POLL loop i=%d revents=0x%x", i, vwp->pollfd[
 				AN(Wait_HeapDelete(w, wp));
 				Wait_Call(w, wp, WAITER_TIMEOUT, now);
 				vwp_del(vwp, i);
-			} else if (vwp->pollfd[i].revents & POLLIN) {
+			} else if (vwp->pollfd[i].revents &
+			    (POLLIN | POLLOUT)) {
 				assert(wp->fd > 0);
 				assert(wp->fd == vwp->pollfd[i].fd);
 				AN(Wait_HeapDelete(w, wp));
@@ -28,7 +28,8 @@
  *
  * Waiters are herders of connections:  They monitor a large number of
  * connections and react if data arrives, the connection is closed or
- * if nothing happens for a specified timeout period.
+ * if nothing happens for a specified timeout period.  With want_write
+ * they wait for the connection to take more data instead.
  *
  * The "poll" waiter should be portable to just about anything, but it
  * is not very efficient because it has to setup state on each call to
@@ -64,6 +65,9 @@ struct waited {
 	waiter_handle_f		*func;
 	volatile double		*tmo;
 	double			idle;
+	unsigned		want_write;	/* not readable */
+	unsigned		fifo;		/* see Wait_HeapInsert */
+	VTAILQ_ENTRY(waited)	list;
 };
 
 /* cache_waiter.c */
@@ -32,6 +32,14 @@
 struct waited;
 struct binheap;
 
+/* The waited sharing a timeout, in the order they are due */
+struct wait_fifo {
+	volatile double			*tmo;
+	VTAILQ_HEAD(waited_head,waited)	head;
+};
+
+#define WAIT_NFIFO			4
+
 struct waiter {
 	unsigned			magic;
 #define WAITER_MAGIC			0x17c399db
@@ -41,6 +49,7 @@ struct waiter {
 
 	void				*priv;
 	struct binheap			*heap;
+	struct wait_fifo		fifo[WAIT_NFIFO];
 };
 
 typedef void waiter_init_f(struct waiter *);
@@ -76,6 +85,8 @@ Wait_When(const struct waited *wp)
 
 void Wait_Call(const struct waiter *, struct waited *,
     enum wait_event ev, double now);
-void Wait_HeapInsert(const struct waiter *, struct waited *);
-int Wait_HeapDelete(const struct waiter *, const struct waited *);
+void Wait_HeapInsert(struct waiter *, struct waited *);
+int Wait_HeapDelete(struct waiter *, struct waited *);
 double Wait_HeapDue(const struct waiter *, struct waited **);
+struct waiter *Wait_NewPart(const struct waiter *);
+void Wait_DestroyPart(struct waiter **);
@@ -52,6 +52,7 @@
 #include "vapi/vsm.h"
 #include "vapi/voptget.h"
 #include "vas.h"
+#include "miniobj.h"
 #include "vcs.h"
 #include "vut.h"
 #include "vtim.h"
@@ -133,6 +134,260 @@ static struct profile *active_profile;
 
 volatile sig_atomic_t quit = 0;
 
+/*--------------------------------------------------------------------
+ * -H: HDR histograms of Timestamp deltas, for percentiles.
+ *
+ * Values are kept in microseconds, in buckets of 128 sub-buckets per
+ * power of two, which keeps them to better than 1% precision at a
+ * fixed cost per value.  The sliding window is split in HDR_SLOTS
+ * slots by the time of the later event, the oldest slot is recycled
+ * when the window moves on.
+ */
+
+#define HDR_MAX		8
+#define HDR_SLOTS	6
+#define HDR_SUB		128
+#define HDR_SHIFT	7		/* log2(HDR_SUB) */
+#define HDR_TOP		40		/* 2^40 us, about 12 days */
+#define HDR_N		((HDR_TOP - HDR_SHIFT + 2) * HDR_SUB)
+
+struct hdr_slot {
+	uint64_t		epoch;
+	uint64_t		n;
+	uint32_t		count[HDR_N];
+};
+
+struct hdr {
+	char			*name;
+	enum VSL_transaction_e	type;
+	char			*ev_a;
+	char			*ev_b;
+	struct hdr_slot		slot[HDR_SLOTS];
+};
+
+static struct hdr *hdrs[HDR_MAX];
+static unsigned nhdr;
+static double hdr_window = 60.;
+static uint64_t hdr_epoch;		/* newest slot seen */
+
+static unsigned
+hdr_index(uint64_t v)
+{
+	unsigned e;
+
+	if (v >= (uint64_t)1 << HDR_TOP)
+		v = ((uint64_t)1 << HDR_TOP) - 1;
+	if (v < 2 * HDR_SUB)
+		return (v);
+	for (e = 0; (v >> e) >= 2 * HDR_SUB; e++)
+		continue;
+	return ((e + 1) * HDR_SUB + (v >> e) - HDR_SUB);
+}
+
+/* Highest value which ends up in bucket i */
+static uint64_t
+hdr_value(unsigned i)
+{
+	unsigned e;
+
+	if (i < 2 * HDR_SUB)
+		return (i);
+	e = i / HDR_SUB - 1;
+	return ((((uint64_t)(i % HDR_SUB + HDR_SUB + 1)) << e) - 1);
+}
+
+static void
+hdr_add(struct hdr *h, double v, double t)
+{
+	struct hdr_slot *s;
+	uint64_t epoch;
+
+	epoch = (uint64_t)(t * HDR_SLOTS / hdr_window);
+	if (epoch > hdr_epoch)
+		hdr_epoch = epoch;
+	if (epoch + HDR_SLOTS <= hdr_epoch)
+		return;			/* Already out of the window */
+	s = &h->slot[epoch % HDR_SLOTS];
+	if (s->epoch != epoch) {
+		memset(s, 0, sizeof *s);
+		s->epoch = epoch;
+	}
+	s->count[hdr_index((uint64_t)(v * 1e6))]++;
+	s->n++;
+}
+
+static double
+hdr_pct(const uint64_t *sum, uint64_t n, double pct)
+{
+	uint64_t want, c = 0;
+	unsigned i;
+
+	want = (uint64_t)ceil(n * pct / 100.);
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < HDR_N - 1; i++) {
+		c += sum[i];
+		if (c >= want)
+			break;
+	}
+	return (hdr_value(i) * 1e-6);
+}
+
+static void
+hdr_print(void)
+{
+	static const double pct[] = { 50., 90., 99., 99.9, 100. };
+	static uint64_t sum[HDR_N];
+	const struct hdr *h;
+	const struct hdr_slot *s;
+	uint64_t n;
+	unsigned u, i, j, k;
+	double now;
+
+	if (!VUT.d_opt && VUT.r_arg == NULL) {
+		/* Live: let the window move on without traffic */
+		now = VTIM_real() * HDR_SLOTS / hdr_window;
+		if ((uint64_t)now > hdr_epoch)
+			hdr_epoch = (uint64_t)now;
+	}
+
+	printf("%-24s %10s %10s %10s %10s %10s %10s\n",
+	    "Delta", "N", "p50", "p90", "p99", "p99.9", "max");
+	for (u = 0; u < nhdr; u++) {
+		h = hdrs[u];
+		memset(sum, 0, sizeof sum);
+		n = 0;
+		for (j = 0; j < HDR_SLOTS; j++) {
+			s = &h->slot[j];
+			if (s->n == 0 || s->epoch + HDR_SLOTS <= hdr_epoch)
+				continue;
+			for (i = 0; i < HDR_N; i++)
+				sum[i] += s->count[i];
+			n += s->n;
+		}
+		printf("%-24s %10ju", h->name, (uintmax_t)n);
+		for (k = 0; k < sizeof pct / sizeof pct[0]; k++) {
+			if (n == 0)
+				printf(" %10s", "-");
+			else
+				printf(" %10.6f", hdr_pct(sum, n, pct[k]));
+		}
+		printf("\n");
+	}
+	printf("\n");
+	(void)fflush(stdout);
+}
+
+static void
+hdr_arg(const char *arg)
+{
+	struct hdr *h;
+	const char *p, *q;
+
+	if (nhdr == HDR_MAX)
+		VUT_Error(1, "-H: At most %d histograms", HDR_MAX);
+	h = calloc(1, sizeof *h);
+	AN(h);
+	REPLACE(h->name, arg);
+	p = arg;
+	h->type = VSL_t_req;
+	if (p[0] != '\0' && p[1] == ':') {
+		if (p[0] == 'b')
+			h->type = VSL_t_bereq;
+		else if (p[0] != 'c')
+			VUT_Error(1, "-H: '%s' is not a valid definition",
+			    arg);
+		p += 2;
+	}
+	q = strchr(p, '-');
+	if (q == NULL) {
+		REPLACE(h->ev_a, p);
+		REPLACE(h->ev_b, "Start");
+	} else {
+		h->ev_a = strndup(p, q - p);
+		AN(h->ev_a);
+		REPLACE(h->ev_b, q + 1);
+	}
+	if (*h->ev_a == '\0' || *h->ev_b == '\0' ||
+	    strchr(h->ev_b, '-') != NULL)
+		VUT_Error(1, "-H: '%s' is not a valid definition", arg);
+	hdrs[nhdr++] = h;
+}
+
+#define HDR_EVENTS	16
+
+static int /*__match_proto__ (VSLQ_dispatch_f)*/
+accumulate_hdr(struct VSL_data *vsl, struct VSL_transaction * const pt[],
+    void *priv)
+{
+	struct {
+		const char	*name;
+		size_t		len;
+		double		t;
+	} ev[HDR_EVENTS];
+	struct VSL_transaction *tr;
+	const struct hdr *h;
+	double ta, tb, tsa[3];
+	unsigned n, u, i, l;
+
+	(void)vsl;
+	(void)priv;
+
+	for (tr = pt[0]; tr != NULL; tr = *++pt) {
+		if (tr->reason == VSL_r_esi)
+			continue;
+		if (tr->type != VSL_t_req && tr->type != VSL_t_bereq)
+			continue;
+		n = 0;
+		while (n < HDR_EVENTS && VSL_Next(tr->c) == 1) {
+			if (VSL_TAG(tr->c->rec.ptr) != SLT_Timestamp)
+				continue;
+			if (VSL_Timestamp(tr->c->rec.ptr, &ev[n].name, &l,
+			    tsa))
+				continue;
+			ev[n].len = l;
+			ev[n].t = tsa[0];
+			n++;
+		}
+
+		AZ(pthread_mutex_lock(&mtx));
+		for (u = 0; u < nhdr; u++) {
+			h = hdrs[u];
+			if (h->type != tr->type)
+				continue;
+			ta = tb = -1.;
+			/* Last one wins, like the Timestamps after restarts */
+			for (i = 0; i < n; i++) {
+				if (strlen(h->ev_a) == ev[i].len &&
+				    !strncmp(h->ev_a, ev[i].name, ev[i].len))
+					ta = ev[i].t;
+				if (strlen(h->ev_b) == ev[i].len &&
+				    !strncmp(h->ev_b, ev[i].name, ev[i].len))
+					tb = ev[i].t;
+			}
+			if (ta > 0. && tb > 0. && ta >= tb)
+				hdr_add(hdrs[u], ta - tb, ta);
+		}
+		AZ(pthread_mutex_unlock(&mtx));
+	}
+	return (0);
+}
+
+static void *
+do_hdr(void *arg)
+{
+
+	(void)arg;
+	while (!quit && !end_of_file) {
+		VTIM_sleep(delay);
+		AZ(pthread_mutex_lock(&mtx));
+		if (!end_of_file)
+			hdr_print();
+		AZ(pthread_mutex_unlock(&mtx));
+	}
+	return (NULL);
+}
+
 static void
 update(void)
 {
@@ -200,20 +455,12 @@ update(void)
 }
 
 inline static void
-upd_vsl_ts(const char *p)
+upd_vsl_ts(double t)
 {
-	double t;
 
 	if (timebend == 0)
 		return;
 
-	p = strchr(p, ' ');
-
-	if (p == NULL)
-		return;
-
-	t = strtod(p + 1, NULL);
-
 	if (t > vsl_ts)
 		vsl_ts = t;
 }
@@ -226,8 +473,9 @@ accumulate(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 	unsigned u;
 	double value;
 	struct VSL_transaction *tr;
-	double t;
-	const char *tsp;
+	double t, tsa[3], tsv;
+	const char *data;
+	char ubuf[VSL_UNPACK_MAX];
 
 	(void)vsl;
 	(void)priv;
@@ -240,7 +488,7 @@ accumulate(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 		hit = 0;
 		skip = 0;
 		match = 0;
-		tsp = NULL;
+		tsv = 0.;
 		while (skip == 0) {
 			i = VSL_Next(tr->c);
 			if (i == -3) {
@@ -256,33 +504,38 @@ accumulate(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 
 			/* get the value we want and register if it's a hit */
 			tag = VSL_TAG(tr->c->rec.ptr);
+			data = VSL_CDATA(tr->c->rec.ptr);
+			if (VSL_PACKED(tr->c->rec.ptr)) {
+				if (VSL_Unpack(tr->c->rec.ptr, ubuf,
+				    sizeof ubuf) < 0)
+					continue;
+				data = ubuf;
+			}
 
 			switch (tag) {
 			case SLT_Hit:
 				hit = 1;
 				break;
 			case SLT_VCL_return:
-				if (!strcasecmp(VSL_CDATA(tr->c->rec.ptr),
-				    "restart") ||
-				    !strcasecmp(VSL_CDATA(tr->c->rec.ptr),
-				    "retry"))
+				if (!strcasecmp(data, "restart") ||
+				    !strcasecmp(data, "retry"))
 					skip = 1;
 				break;
 			case SLT_Timestamp:
-				tsp = VSL_CDATA(tr->c->rec.ptr);
+				if (!VSL_Timestamp(tr->c->rec.ptr, NULL, NULL,
+				    tsa))
+					tsv = tsa[0];
 				/* FALLTHROUGH */
 			default:
 				if (tag != match_tag)
 					break;
 
 				if (active_profile->prefix &&
-				    strncmp(VSL_CDATA(tr->c->rec.ptr),
-				    active_profile->prefix,
+				    strncmp(data, active_profile->prefix,
 				    strlen(active_profile->prefix)) != 0)
 					break;
 
-				i = sscanf(VSL_CDATA(tr->c->rec.ptr),
-				    format, &value);
+				i = sscanf(data, format, &value);
 				if (i != 1)
 					break;
 				match = 1;
@@ -306,11 +559,11 @@ accumulate(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 		AZ(pthread_mutex_lock(&mtx));
 
 		/*
-		 * only parse the last tsp seen in this transaction -
+		 * only use the last timestamp seen in this transaction -
 		 * it should be the latest.
 		 */
-		if (tsp)
-			upd_vsl_ts(tsp);
+		if (tsv > 0.)
+			upd_vsl_ts(tsv);
 
 		/* phase out old data */
 		if (nhist == HIST_N) {
@@ -494,7 +747,7 @@ main(int argc, char **argv)
 	const char *colon, *ptag;
 	const char *profile = "responsetime";
 	pthread_t thr;
-	int fnum = -1;
+	int fnum = -1, P_opt = 0;
 	struct profile cli_p = {0};
 	cli_p.name = 0;
 
@@ -511,7 +764,16 @@ main(int argc, char **argv)
 			if (delay <= 0)
 				VUT_Error(1, "-p: invalid '%s'", optarg);
 			break;
+		case 'H':
+			hdr_arg(optarg);
+			break;
+		case 'W':
+			hdr_window = strtod(optarg, NULL);
+			if (hdr_window <= 0)
+				VUT_Error(1, "-W: invalid '%s'", optarg);
+			break;
 		case 'P':
+			P_opt = 1;
 			colon = strchr(optarg, ':');
 			/* no colon, take the profile as a name */
 			if (colon == NULL) {
@@ -576,6 +838,27 @@ main(int argc, char **argv)
 		    " (only vxid and request are supported)",
 		    VSLQ_grouping[VUT.g_arg]);
 
+	if (nhdr > 0) {
+		if (P_opt)
+			VUT_Error(1, "-H and -P can not be combined");
+		VUT_Setup();
+		if (!VUT.d_opt && VUT.r_arg == NULL &&
+		    pthread_create(&thr, NULL, do_hdr, NULL) != 0)
+			VUT_Error(1, "pthread_create(): %s", strerror(errno));
+		VUT.dispatch_f = &accumulate_hdr;
+		VUT.dispatch_priv = NULL;
+		VUT.sighup_f = sighup;
+		VUT_Main();
+		AZ(pthread_mutex_lock(&mtx));
+		end_of_file = 1;
+		AZ(pthread_mutex_unlock(&mtx));
+		if (!VUT.d_opt && VUT.r_arg == NULL)
+			AZ(pthread_join(thr, NULL));
+		hdr_print();
+		VUT_Fini();
+		exit(0);
+	}
+
 	if (profile) {
 		for (active_profile = profiles; active_profile->name;
 		     active_profile++) {
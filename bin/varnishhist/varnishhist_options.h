@@ -56,6 +56,26 @@
 	    " graph (these are power of ten)."				\
 	)
 
+#define HIS_OPT_H							\
+	VOPT("H:", "[-H <[cb:]event[-event]>]",				\
+	    "Percentiles of a Timestamp delta",				\
+	    "Instead of the graph, print a table of percentiles of"	\
+	    " the time between two Timestamp events of a (c)lient or"	\
+	    " (b)ackend transaction (defaults to client), for example"	\
+	    " ``Resp-Req`` or ``b:Beresp-Bereq``. The second event"	\
+	    " defaults to ``Start``. Values go into an HDR histogram"	\
+	    " with better than 1% precision. Can be given several"	\
+	    " times. The table is printed every -p seconds, or at"	\
+	    " the end with -d or -r."					\
+	)
+
+#define HIS_OPT_W							\
+	VOPT("W:", "[-W <seconds>]", "Percentile window",		\
+	    "The -H percentiles are over the last this many seconds"	\
+	    " of log time, in steps of a sixth of it. The default is"	\
+	    " 60 seconds."						\
+	)
+
 #define HIS_OPT_B							\
 	VOPT("B:", "[-B <factor>]",					\
 	    "Time bending",						\
@@ -71,6 +91,7 @@ VSL_OPT_C
 VUT_OPT_d
 HIS_OPT_g
 VUT_OPT_h
+HIS_OPT_H
 VSL_OPT_L
 VUT_OPT_n
 VUT_OPT_N
@@ -95,3 +116,4 @@ VUT_OPT_r
 VUT_OPT_t
 VSL_OPT_T
 VUT_OPT_V
+HIS_OPT_W
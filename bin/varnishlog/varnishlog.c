@@ -56,6 +56,8 @@ static struct log {
 	/* Options */
 	int		a_opt;
 	int		A_opt;
+	int		B_opt;
+	int		z_opt;
 	char		*w_arg;
 
 	/* State */
@@ -94,6 +96,7 @@ rotateout(void)
 
 	AN(LOG.w_arg);
 	AN(LOG.fo);
+	(void)VSL_WriteFlush(VUT.vsl, LOG.fo);
 	fclose(LOG.fo);
 	openout(1);
 	AN(LOG.fo);
@@ -105,6 +108,8 @@ flushout(void)
 {
 
 	AN(LOG.fo);
+	if (VSL_WriteFlush(VUT.vsl, LOG.fo))
+		return (-5);
 	if (fflush(LOG.fo))
 		return (-5);
 	return (0);
@@ -134,6 +139,10 @@ main(int argc, char * const *argv)
 			/* Text output */
 			LOG.A_opt = 1;
 			break;
+		case 'B':
+			/* Indexed output */
+			LOG.B_opt = 1;
+			break;
 		case 'h':
 			/* Usage help */
 			usage(0);
@@ -141,6 +150,11 @@ main(int argc, char * const *argv)
 			/* Write to file */
 			REPLACE(LOG.w_arg, optarg);
 			break;
+		case 'z':
+			/* Deflated indexed output */
+			LOG.B_opt = 1;
+			LOG.z_opt = 1;
+			break;
 		default:
 			if (!VUT_Arg(opt, optarg))
 				usage(1);
@@ -156,7 +170,11 @@ main(int argc, char * const *argv)
 	/* Setup output */
 	if (LOG.A_opt || !LOG.w_arg)
 		VUT.dispatch_f = VSL_PrintTransactions;
-	else
+	else if (LOG.B_opt) {
+		VUT.dispatch_f = VSL_WriteIndexed;
+		if (LOG.z_opt)
+			AZ(VSL_WriteDeflate(VUT.vsl, 6));
+	} else
 		VUT.dispatch_f = VSL_WriteTransactions;
 	VUT.sighup_f = sighup;
 	if (LOG.w_arg) {
@@ -170,9 +188,8 @@ main(int argc, char * const *argv)
 
 	VUT_Setup();
 	VUT_Main();
-	VUT_Fini();
-
 	(void)flushout();
+	VUT_Fini();
 
 	exit(0);
 }
@@ -42,6 +42,23 @@
 	    " data in ascii format."					\
 	)
 
+#define LOG_OPT_B							\
+	VOPT("B", "[-B]", "Indexed output",				\
+	    "When writing binary output to a file with the -w option,"	\
+	    " write it in blocks, each with an index of the tags in it."	\
+	    " Reading such a file back with the -r option skips the"	\
+	    " blocks which can not match the -q query, or in raw"	\
+	    " grouping the -i/-I/-x/-X options."			\
+	)
+
+#define LOG_OPT_z							\
+	VOPT("z", "[-z]", "Deflated output",				\
+	    "Like the -B option, but deflate each block as it is"	\
+	    " written. The -r option inflates them again, the next"	\
+	    " block in a separate thread while the current one is"	\
+	    " being read."						\
+	)
+
 #define LOG_OPT_w							\
 	VOPT("w:", "[-w <filename>]", "Output filename",		\
 	    "Redirect output to file. The file will be overwritten"	\
@@ -55,6 +72,7 @@
 
 LOG_OPT_a
 LOG_OPT_A
+LOG_OPT_B
 VSL_OPT_b
 VSL_OPT_c
 VSL_OPT_C
@@ -78,3 +96,4 @@ VUT_OPT_V
 LOG_OPT_w
 VSL_OPT_x
 VSL_OPT_X
+LOG_OPT_z
@@ -53,12 +53,15 @@
 #include <time.h>
 #include <math.h>
 
+#include <sys/stat.h>
+
 #include "base64.h"
 #include "vapi/vsm.h"
 #include "vapi/vsl.h"
 #include "vapi/voptget.h"
 #include "vas.h"
 #include "vdef.h"
+#include "vend.h"
 #include "vcs.h"
 #include "vsb.h"
 #include "vut.h"
@@ -68,6 +71,9 @@
 #define TIME_FMT "[%d/%b/%Y:%T %z]"
 #define FORMAT "%h %l %u %t \"%r\" %s %b \"%{Referer}i\" \"%{User-agent}i\""
 
+#define BIN_MAGIC "VNB1"
+#define BIN_BATCH (64 * 1024)
+
 static const char progname[] = "varnishncsa";
 
 struct format;
@@ -138,13 +144,17 @@ static struct ctx {
 	/* Options */
 	int			a_opt;
 	int			b_opt;
+	int			B_opt;
 	int			c_opt;
 	char			*w_arg;
 
 	FILE			*fo;
 	struct vsb		*vsb;
+	struct vsb		*batch;
 	unsigned		gen;
 	VTAILQ_HEAD(,format)	format;
+	char			*format_str;
+	unsigned		n_field;
 
 	/* State */
 	struct watch_head	watch_vcl_log;
@@ -156,6 +166,10 @@ static struct ctx {
 	const char		*handling;
 	const char		*side;
 	int32_t			vxid;
+
+	/* Packed records rendered as text, fragments point in here */
+	char			unpack[8 * VSL_UNPACK_MAX];
+	size_t			unpack_l;
 } CTX;
 
 static void __attribute__((__noreturn__))
@@ -170,6 +184,60 @@ usage(int status)
 	exit(status);
 }
 
+/*--------------------------------------------------------------------
+ * Binary output (-B)
+ *
+ * The stream starts with BIN_MAGIC and the length prefixed format
+ * string, unless we are appending to a non-empty file.  Each record
+ * is a length prefixed list of length prefixed fields, one per
+ * formatter in the format string.  Literal text is left out.  All
+ * lengths are 32 bit big endian.
+ *
+ * Records are collected in CTX.batch and written out in one go when
+ * it fills up, on idle and before rotating the file.
+ */
+
+static int
+bin_flush(void)
+{
+	const char *p;
+	ssize_t l, i;
+
+	if (!CTX.B_opt || VSB_len(CTX.batch) == 0)
+		return (0);
+	AZ(VSB_finish(CTX.batch));
+	p = VSB_data(CTX.batch);
+	l = VSB_len(CTX.batch);
+	while (l > 0) {
+		i = write(fileno(CTX.fo), p, l);
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i <= 0)
+			break;
+		p += i;
+		l -= i;
+	}
+	VSB_clear(CTX.batch);
+	return (l > 0 ? -5 : 0);
+}
+
+static void
+bin_header(const char *format)
+{
+	struct stat st;
+	char buf[4];
+
+	if (!CTX.B_opt)
+		return;
+	if (!fstat(fileno(CTX.fo), &st) && S_ISREG(st.st_mode) &&
+	    st.st_size > 0)
+		return;
+	AZ(VSB_cat(CTX.batch, BIN_MAGIC));
+	vbe32enc(buf, strlen(format));
+	AZ(VSB_bcat(CTX.batch, buf, sizeof buf));
+	AZ(VSB_cat(CTX.batch, format));
+}
+
 static void
 openout(int append)
 {
@@ -187,9 +255,11 @@ rotateout(void)
 
 	AN(CTX.w_arg);
 	AN(CTX.fo);
+	(void)bin_flush();
 	fclose(CTX.fo);
 	openout(1);
 	AN(CTX.fo);
+	bin_header(CTX.format_str);
 	return (0);
 }
 
@@ -198,6 +268,8 @@ flushout(void)
 {
 
 	AN(CTX.fo);
+	if (bin_flush())
+		return (-5);
 	if (fflush(CTX.fo))
 		return (-5);
 	return (0);
@@ -208,6 +280,9 @@ vsb_esc_cat(struct vsb *sb, const char *b, const char *e)
 {
 	AN(b);
 
+	if (CTX.B_opt)
+		return (VSB_bcat(sb, b, e - b));
+
 	for (; b < e; b++) {
 		if (isspace(*b)) {
 			switch (*b) {
@@ -405,12 +480,49 @@ format_auth(const struct format *format)
 	return (1);
 }
 
+static int
+print_binary(void)
+{
+	const struct format *f;
+	ssize_t off[CTX.n_field + 1];
+	unsigned u = 0;
+	char *p;
+	int i;
+
+	VSB_clear(CTX.vsb);
+	off[u++] = 0;
+	AZ(VSB_bcat(CTX.vsb, "", 4));
+	VTAILQ_FOREACH(f, &CTX.format, list) {
+		if (f->func == format_string)
+			continue;
+		assert(u <= CTX.n_field);
+		off[u++] = VSB_len(CTX.vsb);
+		AZ(VSB_bcat(CTX.vsb, "", 4));
+		i = (f->func)(f);
+		if (i < 0)
+			return (0);
+	}
+	assert(u == CTX.n_field + 1);
+	AZ(VSB_finish(CTX.vsb));
+	p = VSB_data(CTX.vsb);
+	vbe32enc(p, VSB_len(CTX.vsb) - 4);
+	while (--u > 0)
+		vbe32enc(p + off[u], (u == CTX.n_field ?
+		    VSB_len(CTX.vsb) : off[u + 1]) - off[u] - 4);
+	AZ(VSB_bcat(CTX.batch, p, VSB_len(CTX.vsb)));
+	if (VSB_len(CTX.batch) >= BIN_BATCH)
+		return (bin_flush());
+	return (0);
+}
+
 static int
 print(void)
 {
 	const struct format *f;
 	int i, r = 1;
 
+	if (CTX.B_opt)
+		return (print_binary());
 	VSB_clear(CTX.vsb);
 	VTAILQ_FOREACH(f, &CTX.format, list) {
 		i = (f->func)(f);
@@ -674,6 +786,7 @@ parse_x_format(char *buf)
 static void
 parse_format(const char *format)
 {
+	const struct format *f;
 	const char *p, *q;
 	struct vsb *vsb;
 	char buf[256];
@@ -801,6 +914,10 @@ parse_format(const char *format)
 	}
 
 	VSB_destroy(&vsb);
+
+	VTAILQ_FOREACH(f, &CTX.format, list)
+		if (f->func != format_string)
+			CTX.n_field++;
 }
 
 static int
@@ -932,11 +1049,23 @@ dispatch_f(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 		CTX.hitmiss = "-";
 		CTX.handling = "-";
 		CTX.vxid = t->vxid;
+		CTX.unpack_l = 0;
 		skip = 0;
 		while (skip == 0 && 1 == VSL_Next(t->c)) {
 			tag = VSL_TAG(t->c->rec.ptr);
 			b = VSL_CDATA(t->c->rec.ptr);
 			e = b + VSL_LEN(t->c->rec.ptr);
+			if (VSL_PACKED(t->c->rec.ptr)) {
+				p = CTX.unpack + CTX.unpack_l;
+				i = VSL_Unpack(t->c->rec.ptr, CTX.unpack +
+				    CTX.unpack_l, sizeof CTX.unpack - CTX.unpack_l);
+				if (i < 0 || CTX.unpack_l + i + 1 >=
+				    sizeof CTX.unpack)
+					continue;
+				b = p;
+				e = b + i;
+				CTX.unpack_l += i + 1;
+			}
 			while (e > b && e[-1] == '\0')
 				e--;
 
@@ -1144,6 +1273,8 @@ main(int argc, char * const *argv)
 	VTAILQ_INIT(&CTX.watch_vsl);
 	CTX.vsb = VSB_new_auto();
 	AN(CTX.vsb);
+	CTX.batch = VSB_new_auto();
+	AN(CTX.batch);
 	VB64_init();
 
 	while ((opt = getopt(argc, argv, vopt_spec.vopt_optstring)) != -1) {
@@ -1156,6 +1287,10 @@ main(int argc, char * const *argv)
 			/* backend mode */
 			CTX.b_opt = 1;
 			break;
+		case 'B':
+			/* binary output */
+			CTX.B_opt = 1;
+			break;
 		case 'c':
 			/* client mode */
 			CTX.c_opt = 1;
@@ -1206,7 +1341,7 @@ main(int argc, char * const *argv)
 	if (format == NULL)
 		format = strdup(FORMAT);
 	parse_format(format);
-	free(format);
+	CTX.format_str = format;
 	format = NULL;
 
 	/* Setup output */
@@ -1221,10 +1356,12 @@ main(int argc, char * const *argv)
 	} else
 		CTX.fo = stdout;
 	VUT.idle_f = flushout;
+	bin_header(CTX.format_str);
 
 	VUT_Setup();
 	VUT_Main();
 	VUT_Fini();
+	(void)bin_flush();
 
 	exit(0);
 }
@@ -67,6 +67,15 @@
 	    "Log backend requests. If -c is not specified, then only"	\
 	    " backend requests will trigger log lines."			\
 	)
+#define NCSA_OPT_B							\
+	VOPT("B", "[-B]", "Binary output",				\
+	    "Write length prefixed binary records instead of log lines."	\
+	    " The output starts with the magic \"VNB1\" followed by the"	\
+	    " format string. Each record is a list of fields, one per"	\
+	    " formatter in the format string, literal text is left out."	\
+	    " Records and fields are prefixed with their length as a"	\
+	    " 32 bit big endian integer, and no escaping is done."	\
+	)
 #define NCSA_OPT_c							\
 	VOPT("c", "[-c]", "Client mode",					\
 	    "Log client requests. This is the default. If -b is"	\
@@ -75,6 +84,7 @@
 
 NCSA_OPT_a
 NCSA_OPT_b
+NCSA_OPT_B
 NCSA_OPT_c
 VSL_OPT_C
 VUT_OPT_d
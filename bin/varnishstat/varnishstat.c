@@ -167,19 +167,14 @@ struct once_priv {
 	int pad;
 };
 
-static int
-do_once_cb(void *priv, const struct VSC_point * const pt)
+static void
+do_once_pt(struct once_priv *op, const struct VSC_point * const pt,
+    uint64_t val)
 {
-	struct once_priv *op;
-	uint64_t val;
 	int i;
 	const struct VSC_section *sec;
 
-	if (pt == NULL)
-		return (0);
-	op = priv;
 	AZ(strcmp(pt->desc->ctype, "uint64_t"));
-	val = *(const volatile uint64_t*)pt->ptr;
 	sec = pt->section;
 	i = 0;
 	if (strcmp(sec->fantom->type, ""))
@@ -196,20 +191,31 @@ do_once_cb(void *priv, const struct VSC_point * const pt)
 	else
 		printf("%12ju %12s %s\n",
 		    (uintmax_t)val, ".  ", pt->desc->sdesc);
-	return (0);
 }
 
 static void
 do_once(struct VSM_data *vd, const struct VSC_C_main *VSC_C_main)
 {
 	struct once_priv op;
+	struct VSC_snapshot snap;
+	unsigned u;
+	int i;
 
 	memset(&op, 0, sizeof op);
 	if (VSC_C_main != NULL)
 		op.up = VSC_C_main->uptime;
 	op.pad = 18;
 
-	(void)VSC_Iter(vd, NULL, do_once_cb, &op);
+	/* One consistent copy of all counters */
+	memset(&snap, 0, sizeof snap);
+	while ((i = VSC_Snapshot(vd, &snap)) > (int)snap.space) {
+		snap.space = i;
+		snap.val = realloc(snap.val, i * sizeof *snap.val);
+		AN(snap.val);
+	}
+	for (u = 0; i > 0 && u < snap.n; u++)
+		do_once_pt(&op, snap.val[u].point, snap.val[u].value);
+	free(snap.val);
 }
 
 /*--------------------------------------------------------------------*/
@@ -267,7 +273,8 @@ main(int argc, char * const *argv)
 {
 	struct VSM_data *vd;
 	double t_arg = 5.0, t_start = NAN;
-	int once = 0, xml = 0, json = 0, f_list = 0, curses = 0;
+	int once = 0, xml = 0, json = 0, f_list = 0, curses = 0, prom = 0;
+	const char *S_arg = NULL;
 	signed char opt;
 	int i;
 
@@ -286,6 +293,12 @@ main(int argc, char * const *argv)
 		case 'l':
 			f_list = 1;
 			break;
+		case 'p':
+			prom = 1;
+			break;
+		case 'S':
+			S_arg = optarg;
+			break;
 		case 't':
 			if (!strcasecmp(optarg, "off"))
 				t_arg = -1.;
@@ -318,7 +331,7 @@ main(int argc, char * const *argv)
 	if (optind != argc)
 		usage(1);
 
-	if (!(xml || json || once || f_list))
+	if (!(xml || json || once || f_list || prom || S_arg))
 		curses = 1;
 
 	while (1) {
@@ -348,7 +361,9 @@ main(int argc, char * const *argv)
 	if (i)
 		VUT_Error(1, "%s", VSM_Error(vd));
 
-	if (xml)
+	if (S_arg)
+		do_prometheus(vd, S_arg);
+	else if (xml)
 		do_xml(vd);
 	else if (json)
 		do_json(vd);
@@ -356,6 +371,8 @@ main(int argc, char * const *argv)
 		do_once(vd, VSC_Main(vd, NULL));
 	else if (f_list)
 		list_fields(vd);
+	else if (prom)
+		do_prometheus_once(vd);
 	else
 		assert(0);
 
@@ -36,3 +36,5 @@
 #include "vcs.h"
 
 void do_curses(struct VSM_data *vd, double delay);
+void do_prometheus_once(struct VSM_data *vd);
+void do_prometheus(struct VSM_data *vd, const char *addr);
@@ -53,6 +53,20 @@
 	    "Lists the available fields to use with the -f option",	\
 	    "Lists the available fields to use with the -f option."	\
 	)
+#define STAT_OPT_p							\
+	VOPT("p", "[-p]",						\
+	    "Print statistics to stdout in Prometheus format",		\
+	    "Print statistics to stdout in the Prometheus text"	\
+	    " exposition format."					\
+	)
+#define STAT_OPT_S							\
+	VOPT("S:", "[-S <[address]:port>]",				\
+	    "Serve statistics over HTTP in Prometheus format",		\
+	    "Listen on the given address and serve the statistics in"	\
+	    " the Prometheus text exposition format to any GET"		\
+	    " request. The metric names and labels are rendered once,"	\
+	    " each scrape only formats the values which changed."	\
+	)
 #define STAT_OPT_x							\
 	VOPT("x", "[-x]", "Print statistics to stdout as XML",		\
 	    "Print statistics to stdout as XML."			\
@@ -65,6 +79,8 @@ STAT_OPT_j
 STAT_OPT_l
 VUT_OPT_n
 VUT_OPT_N
+STAT_OPT_p
+STAT_OPT_S
 VUT_OPT_t
 VUT_OPT_V
 STAT_OPT_x
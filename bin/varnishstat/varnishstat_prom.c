@@ -0,0 +1,353 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Prometheus text format exposition of the counters.
+ *
+ * Metric names, labels and the HELP and TYPE lines are rendered once
+ * into a template, which is only rebuilt when the set of counters
+ * changes.  A scrape takes a VSC_Snapshot(), formats the values which
+ * moved since the last scrape and stitches them into the template.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vapi/vsl.h"
+#include "vdef.h"
+#include "vsb.h"
+#include "vtcp.h"
+#include "vut.h"
+
+#include "varnishstat.h"
+
+struct prom_series {
+	const struct VSC_point	*point;
+	size_t			t_off;		/* template text in front */
+	size_t			t_len;
+	uint64_t		value;
+	unsigned		v_len;
+	char			v_buf[24];
+};
+
+struct prom {
+	struct VSC_snapshot	snap;
+	struct prom_series	*series;
+	unsigned		*order;		/* output order of series */
+	unsigned		n;
+	unsigned		gen;		/* snap.gen of the template */
+	struct vsb		*tmpl;
+	struct vsb		*out;
+};
+
+/*--------------------------------------------------------------------*/
+
+static void
+prom_name(struct vsb *vsb, const struct VSC_point *pt)
+{
+	const char *p;
+
+	VSB_cat(vsb, "varnish_");
+	for (p = pt->section->fantom->type; *p != '\0'; p++)
+		VSB_putc(vsb, isalnum(*p) ? tolower(*p) : '_');
+	VSB_putc(vsb, '_');
+	for (p = pt->desc->name; *p != '\0'; p++)
+		VSB_putc(vsb, isalnum(*p) ? *p : '_');
+}
+
+static void
+prom_esc(struct vsb *vsb, const char *s, int quotes)
+{
+
+	for (; *s != '\0'; s++) {
+		if (*s == '\\')
+			VSB_cat(vsb, "\\\\");
+		else if (*s == '\n')
+			VSB_cat(vsb, "\\n");
+		else if (quotes && *s == '"')
+			VSB_cat(vsb, "\\\"");
+		else
+			VSB_putc(vsb, *s);
+	}
+}
+
+static const struct prom *prom_sort_p;
+
+static int
+prom_cmp(const void *a, const void *b)
+{
+	const struct VSC_point *pa, *pb;
+	unsigned ua, ub;
+	int i;
+
+	ua = *(const unsigned *)a;
+	ub = *(const unsigned *)b;
+	pa = prom_sort_p->series[ua].point;
+	pb = prom_sort_p->series[ub].point;
+	i = strcmp(pa->section->fantom->type, pb->section->fantom->type);
+	if (i == 0)
+		i = strcmp(pa->desc->name, pb->desc->name);
+	if (i == 0)
+		i = (ua > ub) - (ua < ub);
+	return (i);
+}
+
+/*
+ * All series of a metric have to be together in the output, but we
+ * get them section by section, so sort them by type and name first.
+ */
+
+static void
+prom_build(struct prom *p)
+{
+	const struct VSC_point *pt, *ppt = NULL;
+	struct prom_series *s;
+	unsigned u;
+
+	free(p->series);
+	free(p->order);
+	p->gen = p->snap.gen;
+	p->n = p->snap.n;
+	p->series = calloc(p->n, sizeof *p->series);
+	p->order = calloc(p->n, sizeof *p->order);
+	AN(p->n == 0 || p->series != NULL);
+	AN(p->n == 0 || p->order != NULL);
+	for (u = 0; u < p->n; u++) {
+		p->series[u].point = p->snap.val[u].point;
+		p->order[u] = u;
+	}
+	prom_sort_p = p;
+	qsort(p->order, p->n, sizeof *p->order, prom_cmp);
+
+	VSB_clear(p->tmpl);
+	for (u = 0; u < p->n; u++) {
+		s = &p->series[p->order[u]];
+		pt = s->point;
+		s->t_off = VSB_len(p->tmpl);
+		if (ppt == NULL ||
+		    strcmp(pt->section->fantom->type,
+		    ppt->section->fantom->type) ||
+		    strcmp(pt->desc->name, ppt->desc->name)) {
+			VSB_cat(p->tmpl, "# HELP ");
+			prom_name(p->tmpl, pt);
+			VSB_putc(p->tmpl, ' ');
+			prom_esc(p->tmpl, pt->desc->sdesc, 0);
+			VSB_cat(p->tmpl, "\n# TYPE ");
+			prom_name(p->tmpl, pt);
+			VSB_cat(p->tmpl,
+			    pt->desc->semantics == 'c' ? " counter\n" :
+			    " gauge\n");
+		}
+		prom_name(p->tmpl, pt);
+		if (*pt->section->fantom->ident != '\0') {
+			VSB_cat(p->tmpl, "{id=\"");
+			prom_esc(p->tmpl, pt->section->fantom->ident, 1);
+			VSB_cat(p->tmpl, "\"}");
+		}
+		VSB_putc(p->tmpl, ' ');
+		s->t_len = VSB_len(p->tmpl) - s->t_off;
+		s->v_len = 0;
+		ppt = pt;
+	}
+	AZ(VSB_finish(p->tmpl));
+}
+
+/*
+ * Render the current values into p->out, returns zero if there are
+ * no counters to be had.
+ */
+
+static int
+prom_render(struct VSM_data *vd, struct prom *p)
+{
+	struct prom_series *s;
+	const struct VSC_value *v;
+	unsigned u;
+	int i;
+
+	while ((i = VSC_Snapshot(vd, &p->snap)) > (int)p->snap.space) {
+		p->snap.space = i;
+		p->snap.val = realloc(p->snap.val, i * sizeof *p->snap.val);
+		AN(p->snap.val);
+	}
+	if (i <= 0)
+		return (0);
+
+	if (p->series == NULL || p->gen != p->snap.gen || p->n != p->snap.n)
+		prom_build(p);
+
+	VSB_clear(p->out);
+	for (u = 0; u < p->n; u++) {
+		s = &p->series[p->order[u]];
+		v = &p->snap.val[p->order[u]];
+		if (s->v_len == 0 || s->value != v->value) {
+			s->value = v->value;
+			s->v_len = snprintf(s->v_buf, sizeof s->v_buf,
+			    "%ju\n", (uintmax_t)s->value);
+		}
+		VSB_bcat(p->out, VSB_data(p->tmpl) + s->t_off, s->t_len);
+		VSB_bcat(p->out, s->v_buf, s->v_len);
+	}
+	AZ(VSB_finish(p->out));
+	return (1);
+}
+
+static void
+prom_init(struct prom *p)
+{
+
+	memset(p, 0, sizeof *p);
+	p->tmpl = VSB_new_auto();
+	AN(p->tmpl);
+	p->out = VSB_new_auto();
+	AN(p->out);
+}
+
+/*--------------------------------------------------------------------*/
+
+void
+do_prometheus_once(struct VSM_data *vd)
+{
+	struct prom p;
+
+	prom_init(&p);
+	if (prom_render(vd, &p))
+		(void)fwrite(VSB_data(p.out), 1, VSB_len(p.out), stdout);
+}
+
+/*--------------------------------------------------------------------
+ * A minimal HTTP server, one connection at a time, which serves the
+ * metrics on GET and HEAD.
+ */
+
+static int
+prom_write(int fd, const char *b, size_t l)
+{
+	ssize_t i;
+
+	while (l > 0) {
+		i = write(fd, b, l);
+		if (i <= 0)
+			return (-1);
+		b += i;
+		l -= i;
+	}
+	return (0);
+}
+
+static void
+prom_reply(int fd, const char *status, const char *body, size_t len,
+    int head)
+{
+	char hdr[256];
+	int l;
+
+	l = snprintf(hdr, sizeof hdr,
+	    "HTTP/1.1 %s\r\n"
+	    "Content-Type: text/plain; version=0.0.4\r\n"
+	    "Content-Length: %zu\r\n"
+	    "Connection: close\r\n"
+	    "\r\n", status, len);
+	assert(l > 0 && l < sizeof hdr);
+	if (prom_write(fd, hdr, l) == 0 && !head)
+		(void)prom_write(fd, body, len);
+}
+
+static void
+prom_request(struct VSM_data *vd, struct prom *p, int fd)
+{
+	char buf[4096];
+	size_t len = 0;
+	ssize_t i;
+	int head;
+
+	VTCP_set_read_timeout(fd, 5.0);
+	while (1) {
+		if (len == sizeof buf - 1) {
+			prom_reply(fd, "413 Too large", "", 0, 0);
+			return;
+		}
+		i = read(fd, buf + len, sizeof buf - 1 - len);
+		if (i <= 0)
+			return;
+		len += i;
+		buf[len] = '\0';
+		if (strstr(buf, "\r\n\r\n") != NULL ||
+		    strstr(buf, "\n\n") != NULL)
+			break;
+	}
+
+	head = !strncmp(buf, "HEAD ", 5);
+	if (!head && strncmp(buf, "GET ", 4)) {
+		prom_reply(fd, "405 Method not allowed", "", 0, 0);
+		return;
+	}
+	if (!prom_render(vd, p)) {
+		prom_reply(fd, "503 No counters", "", 0, head);
+		return;
+	}
+	prom_reply(fd, "200 OK", VSB_data(p->out), VSB_len(p->out), head);
+}
+
+void
+do_prometheus(struct VSM_data *vd, const char *addr)
+{
+	struct prom p;
+	const char *err;
+	char abuf[VTCP_ADDRBUFSIZE], pbuf[VTCP_PORTBUFSIZE];
+	int sock, fd;
+
+	(void)signal(SIGPIPE, SIG_IGN);
+	sock = VTCP_listen_on(addr, NULL, 10, &err);
+	if (sock < 0)
+		VUT_Error(1, "-S %s: %s", addr, err);
+	VTCP_myname(sock, abuf, sizeof abuf, pbuf, sizeof pbuf);
+	fprintf(stderr, "Listening on %s %s\n", abuf, pbuf);
+
+	prom_init(&p);
+	while (1) {
+		fd = accept(sock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			VUT_Error(1, "accept: %s", strerror(errno));
+		}
+		prom_request(vd, &p, fd);
+		(void)close(fd);
+		if (VSM_Abandoned(vd)) {
+			VSM_Close(vd);
+			(void)VSM_Open(vd);
+		}
+	}
+}
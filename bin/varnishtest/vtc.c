@@ -630,6 +630,10 @@ cmd_delay(CMD_ARGS)
  *        The environment is 64 bits
  * !OSX
  *        The environment is not OSX
+ * brotli
+ *        varnishd has been built with brotli
+ * tls
+ *        varnishd has been built with OpenSSL, for TLS listeners
  * dns
  *        DNS lookups are working
  * topbuild
@@ -679,6 +683,30 @@ cmd_feature(CMD_ARGS)
 #endif
 		}
 
+		if (!strcmp(*av, "io_uring")) {
+#ifdef HAVE_IO_URING
+			good = 1;
+#else
+			vtc_stop = 2;
+#endif
+		}
+
+		if (!strcmp(*av, "brotli")) {
+#ifdef HAVE_BROTLI
+			good = 1;
+#else
+			vtc_stop = 2;
+#endif
+		}
+
+		if (!strcmp(*av, "tls")) {
+#ifdef HAVE_OPENSSL
+			good = 1;
+#else
+			vtc_stop = 2;
+#endif
+		}
+
 		if (!strcmp(*av, "!OSX")) {
 #if !defined(__APPLE__) || !defined(__MACH__)
 			good = 1;
@@ -84,7 +84,9 @@ extern int feature_dns;
 void init_barrier(void);
 void init_server(void);
 
-int http_process(struct vtclog *vl, const char *spec, int sock, int *sfd);
+struct bench_conn;
+int http_process(struct vtclog *vl, const char *spec, int sock, int *sfd,
+    struct bench_conn *);
 int http2_process(struct vtclog *vl, const char *spec, int sock, int *sfd,
 		unsigned nosettings);
 
@@ -93,6 +95,7 @@ char * synth_body(const char *len, int rnd);
 void cmd_server_genvcl(struct vsb *vsb);
 
 void vtc_loginit(char *buf, unsigned buflen);
+void vtc_logquiet(int);
 struct vtclog *vtc_logopen(const char *id);
 void vtc_logclose(struct vtclog *vl);
 void vtc_log(struct vtclog *vl, int lvl, const char *fmt, ...)
@@ -125,5 +128,15 @@ void start_h2(struct http *hp);
 void stop_h2(struct http *hp);
 void b64_settings(const struct http *hp, const char *s);
 
+/* vtc_bench.c */
+struct vtc_bench;
+struct vtc_bench *bench_new(unsigned nconn, double rate);
+struct bench_conn *bench_conn_new(struct vtc_bench *, unsigned idx);
+double bench_tx(struct bench_conn *);
+void bench_rx(struct bench_conn *, double t0);
+void bench_conn_done(struct bench_conn **);
+void bench_report(struct vtc_bench **, struct vtclog *, const char *name,
+    const char *file);
+
 /* vtc_subr.c */
 struct vsb *vtc_hex_to_bin(struct vtclog *vl, const char *arg);
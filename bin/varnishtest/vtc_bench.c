@@ -0,0 +1,296 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Latency and throughput bookkeeping for clients in benchmark mode.
+ *
+ * Each connection keeps its own histogram, which is folded into the
+ * client's when the connection is done.  The histogram has 16 linear
+ * buckets per power of two microseconds, which is good for about 6%
+ * on the percentiles.
+ *
+ * With a rate, the requests are sent on a fixed schedule, and their
+ * latency counts from when they should have been sent, so a server
+ * which stalls shows up in the latency rather than as a lower rate.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vtc.h"
+
+#include "vtim.h"
+
+#define BENCH_SUB		16
+#define BENCH_NBUCKET		(64 * BENCH_SUB)
+
+struct bench_hist {
+	uint64_t		n;
+	double			sum;
+	double			max;
+	uint64_t		bucket[BENCH_NBUCKET];
+};
+
+struct vtc_bench {
+	unsigned		magic;
+#define VTC_BENCH_MAGIC		0x2c1b5d3e
+	unsigned		nconn;
+	double			rate;
+	double			t_start;
+	double			t_end;
+	pthread_mutex_t		mtx;
+	struct bench_hist	hist;
+};
+
+struct bench_conn {
+	unsigned		magic;
+#define BENCH_CONN_MAGIC	0x5fa0bd71
+	struct vtc_bench	*vb;
+	pthread_mutex_t		mtx;	/* h2 streams run in parallel */
+	double			t_next;
+	double			interval;
+	struct bench_hist	hist;
+};
+
+/**********************************************************************/
+
+static unsigned
+bench_bucket(double t)
+{
+	uint64_t v;
+	unsigned e;
+
+	v = (uint64_t)(t * 1e6);
+	if (v < BENCH_SUB)
+		return (v);
+	for (e = 4; (v >> (e + 1)) != 0; e++)
+		continue;
+	e = (e - 3) * BENCH_SUB + ((v >> (e - 4)) & (BENCH_SUB - 1));
+	return (e < BENCH_NBUCKET ? e : BENCH_NBUCKET - 1);
+}
+
+static double
+bench_value(unsigned u)
+{
+	unsigned e, m;
+
+	if (u < BENCH_SUB)
+		return ((u + .5) * 1e-6);
+	e = u / BENCH_SUB + 3;
+	m = u % BENCH_SUB;
+	return (ldexp(BENCH_SUB + m + .5, e - 4) * 1e-6);
+}
+
+static double
+bench_pct(const struct bench_hist *h, double pct)
+{
+	uint64_t want, n = 0;
+	unsigned u;
+
+	if (h->n == 0)
+		return (0.);
+	want = (uint64_t)ceil(h->n * pct / 100.);
+	if (want == 0)
+		want = 1;
+	for (u = 0; u < BENCH_NBUCKET; u++) {
+		n += h->bucket[u];
+		if (n >= want)
+			break;
+	}
+	return (fmin(bench_value(u), h->max));
+}
+
+/**********************************************************************/
+
+struct vtc_bench *
+bench_new(unsigned nconn, double rate)
+{
+	struct vtc_bench *vb;
+
+	assert(nconn > 0);
+	ALLOC_OBJ(vb, VTC_BENCH_MAGIC);
+	AN(vb);
+	vb->nconn = nconn;
+	vb->rate = rate;
+	AZ(pthread_mutex_init(&vb->mtx, NULL));
+	vb->t_start = VTIM_mono();
+	return (vb);
+}
+
+struct bench_conn *
+bench_conn_new(struct vtc_bench *vb, unsigned idx)
+{
+	struct bench_conn *bc;
+
+	CHECK_OBJ_NOTNULL(vb, VTC_BENCH_MAGIC);
+	ALLOC_OBJ(bc, BENCH_CONN_MAGIC);
+	AN(bc);
+	bc->vb = vb;
+	AZ(pthread_mutex_init(&bc->mtx, NULL));
+	if (vb->rate > 0.) {
+		bc->interval = vb->nconn / vb->rate;
+		bc->t_next = vb->t_start + idx / vb->rate;
+	}
+	return (bc);
+}
+
+/*
+ * A request is about to be sent, returns the time its latency counts
+ * from.
+ */
+
+double
+bench_tx(struct bench_conn *bc)
+{
+	double now, t;
+
+	CHECK_OBJ_NOTNULL(bc, BENCH_CONN_MAGIC);
+	now = VTIM_mono();
+	if (bc->interval == 0.)
+		return (now);
+	AZ(pthread_mutex_lock(&bc->mtx));
+	t = bc->t_next;
+	bc->t_next += bc->interval;
+	AZ(pthread_mutex_unlock(&bc->mtx));
+	if (t > now)
+		VTIM_sleep(t - now);
+	return (t);
+}
+
+void
+bench_rx(struct bench_conn *bc, double t0)
+{
+	struct bench_hist *h;
+	double t;
+
+	CHECK_OBJ_NOTNULL(bc, BENCH_CONN_MAGIC);
+	t = VTIM_mono() - t0;
+	if (t < 0.)
+		t = 0.;
+	h = &bc->hist;
+	AZ(pthread_mutex_lock(&bc->mtx));
+	h->n++;
+	h->sum += t;
+	if (t > h->max)
+		h->max = t;
+	h->bucket[bench_bucket(t)]++;
+	AZ(pthread_mutex_unlock(&bc->mtx));
+}
+
+void
+bench_conn_done(struct bench_conn **bcp)
+{
+	struct bench_conn *bc;
+	struct vtc_bench *vb;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(bc, bcp, BENCH_CONN_MAGIC);
+	vb = bc->vb;
+	CHECK_OBJ_NOTNULL(vb, VTC_BENCH_MAGIC);
+	AZ(pthread_mutex_lock(&vb->mtx));
+	vb->hist.n += bc->hist.n;
+	vb->hist.sum += bc->hist.sum;
+	if (bc->hist.max > vb->hist.max)
+		vb->hist.max = bc->hist.max;
+	for (u = 0; u < BENCH_NBUCKET; u++)
+		vb->hist.bucket[u] += bc->hist.bucket[u];
+	AZ(pthread_mutex_unlock(&vb->mtx));
+	AZ(pthread_mutex_destroy(&bc->mtx));
+	FREE_OBJ(bc);
+}
+
+/*
+ * Log the results, publish them as NAME_bench_* macros, and write
+ * them as JSON to the file, if any.
+ */
+
+void
+bench_report(struct vtc_bench **vbp, struct vtclog *vl, const char *name,
+    const char *file)
+{
+	struct vtc_bench *vb;
+	const struct bench_hist *h;
+	double d, rps, p[5];
+	FILE *f;
+
+	TAKE_OBJ_NOTNULL(vb, vbp, VTC_BENCH_MAGIC);
+	vb->t_end = VTIM_mono();
+	h = &vb->hist;
+	d = vb->t_end - vb->t_start;
+	rps = d > 0. ? h->n / d : 0.;
+	p[0] = bench_pct(h, 50.);
+	p[1] = bench_pct(h, 90.);
+	p[2] = bench_pct(h, 99.);
+	p[3] = bench_pct(h, 99.9);
+	p[4] = h->max;
+
+	vtc_log(vl, 2, "Bench: %ju requests in %.3f s, %.1f/s",
+	    (uintmax_t)h->n, d, rps);
+	vtc_log(vl, 2,
+	    "Bench: latency p50 %.6f p90 %.6f p99 %.6f p99.9 %.6f max %.6f",
+	    p[0], p[1], p[2], p[3], p[4]);
+
+	macro_def(vl, name, "bench_n", "%ju", (uintmax_t)h->n);
+	macro_def(vl, name, "bench_rps", "%.1f", rps);
+	macro_def(vl, name, "bench_p50", "%.6f", p[0]);
+	macro_def(vl, name, "bench_p90", "%.6f", p[1]);
+	macro_def(vl, name, "bench_p99", "%.6f", p[2]);
+	macro_def(vl, name, "bench_p999", "%.6f", p[3]);
+	macro_def(vl, name, "bench_max", "%.6f", p[4]);
+
+	if (file != NULL) {
+		f = fopen(file, "w");
+		if (f == NULL)
+			vtc_fatal(vl, "Cannot open %s: %s",
+			    file, strerror(errno));
+		fprintf(f, "{\n"
+		    "  \"client\": \"%s\",\n"
+		    "  \"connections\": %u,\n"
+		    "  \"rate\": %.1f,\n"
+		    "  \"requests\": %ju,\n"
+		    "  \"duration\": %.6f,\n"
+		    "  \"throughput\": %.1f,\n"
+		    "  \"latency\": {\n"
+		    "    \"mean\": %.6f,\n"
+		    "    \"p50\": %.6f,\n"
+		    "    \"p90\": %.6f,\n"
+		    "    \"p99\": %.6f,\n"
+		    "    \"p99.9\": %.6f,\n"
+		    "    \"max\": %.6f\n"
+		    "  }\n"
+		    "}\n",
+		    name, vb->nconn, vb->rate, (uintmax_t)h->n, d, rps,
+		    h->n ? h->sum / h->n : 0., p[0], p[1], p[2], p[3], p[4]);
+		if (fclose(f))
+			vtc_fatal(vl, "Cannot write %s: %s",
+			    file, strerror(errno));
+	}
+	AZ(pthread_mutex_destroy(&vb->mtx));
+	FREE_OBJ(vb);
+}
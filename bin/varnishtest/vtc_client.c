@@ -41,6 +41,7 @@
 #include "vsa.h"
 #include "vss.h"
 #include "vtcp.h"
+#include "vus.h"
 
 struct client {
 	unsigned		magic;
@@ -58,10 +59,25 @@ struct client {
 
 	unsigned		repeat;
 
+	unsigned		connections;
+	double			rate;
+	char			*stats;
+
 	unsigned		running;
 	pthread_t		tp;
 };
 
+/* One of the connections of a client in benchmark mode */
+struct client_conn {
+	unsigned		magic;
+#define CLIENT_CONN_MAGIC	0x3a5e0c47
+	struct client		*c;
+	const char		*addr;
+	struct bench_conn	*bc;
+	char			name[32];
+	pthread_t		tp;
+};
+
 static VTAILQ_HEAD(, client)	clients =
     VTAILQ_HEAD_INITIALIZER(clients);
 
@@ -110,17 +126,98 @@ client_proxy(struct vtclog *vl, int fd, int version, const char *spec)
  * Client thread
  */
 
+static void
+client_loop(const struct client *c, struct vtclog *vl, const char *addr,
+    struct bench_conn *bc)
+{
+	int fd;
+	unsigned u;
+	char mabuf[32], mpbuf[32];
+	const char *err;
+
+	for (u = 0; u < c->repeat; u++) {
+		vtc_log(vl, 3, "Connect to %s", addr);
+		if (VUS_IS(addr)) {
+			fd = VUS_connect(addr, 10000);
+			err = strerror(errno);
+		} else
+			fd = VTCP_open(addr, NULL, 10., &err);
+		if (fd < 0)
+			vtc_fatal(c->vl, "Failed to open %s: %s", addr, err);
+		assert(fd >= 0);
+		/* VTCP_blocking does its own checks, trust it */
+		(void)VTCP_blocking(fd);
+		VTCP_myname(fd, mabuf, sizeof mabuf, mpbuf, sizeof mpbuf);
+		vtc_log(vl, 3, "connected fd %d from %s %s to %s",
+		    fd, mabuf, mpbuf, addr);
+		if (c->proxy_spec != NULL)
+			client_proxy(vl, fd, c->proxy_version, c->proxy_spec);
+		fd = http_process(vl, c->spec, fd, NULL, bc);
+		vtc_log(vl, 3, "closing fd %d", fd);
+		VTCP_close(&fd);
+	}
+}
+
+static void *
+client_conn_thread(void *priv)
+{
+	struct client_conn *cc;
+	struct vtclog *vl;
+
+	CAST_OBJ_NOTNULL(cc, priv, CLIENT_CONN_MAGIC);
+	vl = vtc_logopen(cc->name);
+	client_loop(cc->c, vl, cc->addr, cc->bc);
+	bench_conn_done(&cc->bc);
+	vtc_logclose(vl);
+	return (NULL);
+}
+
+/*
+ * Run the connections in parallel, and report on the requests they
+ * sent while at it.
+ */
+
+static void
+client_bench(struct client *c, struct vtclog *vl, const char *addr)
+{
+	struct vtc_bench *vb;
+	struct client_conn *cc;
+	unsigned u, n;
+
+	n = c->connections > 0 ? c->connections : 1;
+	if (c->rate > 0.)
+		vtc_log(vl, 2,
+		    "Started bench (%u connections, %u iterations, %.1f/s)",
+		    n, c->repeat, c->rate);
+	else
+		vtc_log(vl, 2, "Started bench (%u connections, %u iterations)",
+		    n, c->repeat);
+	cc = calloc(n, sizeof *cc);
+	AN(cc);
+	vb = bench_new(n, c->rate);
+	vtc_logquiet(1);
+	for (u = 0; u < n; u++) {
+		INIT_OBJ(&cc[u], CLIENT_CONN_MAGIC);
+		cc[u].c = c;
+		cc[u].addr = addr;
+		cc[u].bc = bench_conn_new(vb, u);
+		bprintf(cc[u].name, "%s.%u", c->name, u);
+		AZ(pthread_create(&cc[u].tp, NULL, client_conn_thread, &cc[u]));
+	}
+	for (u = 0; u < n; u++)
+		AZ(pthread_join(cc[u].tp, NULL));
+	vtc_logquiet(0);
+	bench_report(&vb, vl, c->name, c->stats);
+	free(cc);
+}
+
 static void *
 client_thread(void *priv)
 {
 	struct client *c;
 	struct vtclog *vl;
-	int fd;
-	unsigned u;
 	struct vsb *vsb;
 	char *p;
-	char mabuf[32], mpbuf[32];
-	const char *err;
 
 	CAST_OBJ_NOTNULL(c, priv, CLIENT_MAGIC);
 	AN(*c->connect);
@@ -134,25 +231,12 @@ client_thread(void *priv)
 
 	if (c->repeat == 0)
 		c->repeat = 1;
-	if (c->repeat != 1)
-		vtc_log(vl, 2, "Started (%u iterations)", c->repeat);
-	for (u = 0; u < c->repeat; u++) {
-		vtc_log(vl, 3, "Connect to %s", VSB_data(vsb));
-		fd = VTCP_open(VSB_data(vsb), NULL, 10., &err);
-		if (fd < 0)
-			vtc_fatal(c->vl, "Failed to open %s: %s",
-			    VSB_data(vsb), err);
-		assert(fd >= 0);
-		/* VTCP_blocking does its own checks, trust it */
-		(void)VTCP_blocking(fd);
-		VTCP_myname(fd, mabuf, sizeof mabuf, mpbuf, sizeof mpbuf);
-		vtc_log(vl, 3, "connected fd %d from %s %s to %s",
-		    fd, mabuf, mpbuf, VSB_data(vsb));
-		if (c->proxy_spec != NULL)
-			client_proxy(vl, fd, c->proxy_version, c->proxy_spec);
-		fd = http_process(vl, c->spec, fd, NULL);
-		vtc_log(vl, 3, "closing fd %d", fd);
-		VTCP_close(&fd);
+	if (c->connections > 0 || c->rate > 0. || c->stats != NULL)
+		client_bench(c, vl, VSB_data(vsb));
+	else {
+		if (c->repeat != 1)
+			vtc_log(vl, 2, "Started (%u iterations)", c->repeat);
+		client_loop(c, vl, VSB_data(vsb), NULL);
 	}
 	vtc_log(vl, 2, "Ending");
 	VSB_destroy(&vsb);
@@ -196,6 +280,7 @@ client_delete(struct client *c)
 	free(c->spec);
 	free(c->name);
 	free(c->proxy_spec);
+	free(c->stats);
 	/* XXX: MEMLEAK (?)*/
 	FREE_OBJ(c);
 }
@@ -314,6 +399,21 @@ cmd_client(CMD_ARGS)
 			av++;
 			continue;
 		}
+		if (!strcmp(*av, "-connections")) {
+			c->connections = atoi(av[1]);
+			av++;
+			continue;
+		}
+		if (!strcmp(*av, "-rate")) {
+			c->rate = strtod(av[1], NULL);
+			av++;
+			continue;
+		}
+		if (!strcmp(*av, "-stats")) {
+			REPLACE(c->stats, av[1]);
+			av++;
+			continue;
+		}
 		if (!strcmp(*av, "-start")) {
 			client_start(c);
 			continue;
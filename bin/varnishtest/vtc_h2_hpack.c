@@ -353,9 +353,14 @@ HPK_DecHdr(struct hpk_iter *iter, struct hpk_hdr *header)
 	/* Dynamic Table Size Update */
 	/* XXX if under max allowed value */
 	else if (*iter->buf >> 5 == 1) {
-		if (hpk_done != num_decode(&num, iter, 5))
+		if (hpk_err == num_decode(&num, iter, 5))
 			return (hpk_err);
-		return HPK_ResizeTbl(iter->ctx, num);
+		if (HPK_ResizeTbl(iter->ctx, num) != hpk_done)
+			return (hpk_err);
+		if (iter->buf == iter->end)
+			return (hpk_done);
+		/* The update is not a header, decode the one after it */
+		return (HPK_DecHdr(iter, header));
 	} else {
 		return (hpk_err);
 	}
@@ -96,6 +96,23 @@ static const struct cmds http_cmds[];
  * \-repeat NUMBER
  *        Instead of processing the specification only once, do it NUMBER times.
  *
+ * \-connections NUMBER (client only)
+ *        Benchmark mode: process the specification on NUMBER connections
+ *        at the same time, each of them -repeat times.  The latency of
+ *        each txreq/rxresp pair is noted, and when all connections are
+ *        done the throughput and the latency percentiles are logged and
+ *        published as the macros cNAME_bench_n, cNAME_bench_rps and
+ *        cNAME_bench_p50, _p90, _p99, _p999 and _max, in seconds.
+ *        While a benchmark runs, nothing is logged above level 2.
+ *
+ * \-rate NUMBER (client only)
+ *        Benchmark mode: send NUMBER requests per second over all the
+ *        connections, whether the responses keep up or not.  Latencies
+ *        count from when a request was due, not from when it was sent.
+ *
+ * \-stats FILENAME (client only)
+ *        Benchmark mode: also write the results as JSON to FILENAME.
+ *
  * \-break (server only)
  *        Stop the server.
  *
@@ -689,6 +706,20 @@ http_rxhdr(struct http *hp)
 	hp->body = hp->rxbuf + hp->prxbuf;
 }
 
+/**********************************************************************
+ * A response is in, for the latency of the request in benchmark mode
+ */
+
+static void
+http_bench_rx(struct http *hp)
+{
+
+	if (hp->bc != NULL && hp->t_bench > 0.) {
+		bench_rx(hp->bc, hp->t_bench);
+		hp->t_bench = 0.;
+	}
+}
+
 /* SECTION: client-server.spec.rxresp
  *
  * rxresp [-no_obj] (client only)
@@ -719,13 +750,15 @@ cmd_http_rxresp(CMD_ARGS)
 	if (http_count_header(hp->resp, "Content-Length") > 1)
 		vtc_fatal(hp->vl,
 		    "Multiple Content-Length headers.\n");
-	if (!has_obj)
+	if (!has_obj) {
+		http_bench_rx(hp);
 		return;
-	else if (!strcmp(hp->resp[1], "200"))
+	} else if (!strcmp(hp->resp[1], "200"))
 		http_swallow_body(hp, hp->resp, 1);
 	else
 		http_swallow_body(hp, hp->resp, 0);
 	vtc_log(hp->vl, 4, "bodylen = %s", hp->bodylen);
+	http_bench_rx(hp);
 }
 
 /* SECTION: client-server.spec.rxresphdrs
@@ -784,12 +817,16 @@ cmd_http_gunzip(CMD_ARGS)
 	vz.next_in = TRUST_ME(hp->body);
 	vz.avail_in = hp->bodyl;
 
-	l = hp->bodyl * 10;
+	/*
+	 * The result goes back in place of the body, so it can use the
+	 * rest of the rx buffer, whatever the compression ratio was.
+	 */
+	l = hp->nrxbuf - (hp->body - hp->rxbuf);
 	p = calloc(l, 1);
 	AN(p);
 
 	vz.next_out = TRUST_ME(p);
-	vz.avail_out = l;
+	vz.avail_out = l - 1;
 
 	assert(Z_OK == inflateInit2(&vz, 31));
 	i = inflate(&vz, Z_FINISH);
@@ -1266,6 +1303,8 @@ cmd_http_txreq(CMD_ARGS)
 	av = http_tx_parse_args(av, vl, hp, NULL);
 	if (*av != NULL)
 		vtc_fatal(hp->vl, "Unknown http txreq spec: %s\n", *av);
+	if (hp->bc != NULL)
+		hp->t_bench = bench_tx(hp->bc);
 	http_write(hp, 4, "txreq");
 
 	if (up) {
@@ -1865,7 +1904,8 @@ static const struct cmds http_cmds[] = {
 };
 
 int
-http_process(struct vtclog *vl, const char *spec, int sock, int *sfd)
+http_process(struct vtclog *vl, const char *spec, int sock, int *sfd,
+    struct bench_conn *bc)
 {
 	struct http *hp;
 	int retval;
@@ -1884,6 +1924,7 @@ http_process(struct vtclog *vl, const char *spec, int sock, int *sfd)
 	AN(hp->vsb);
 
 	hp->sfd = sfd;
+	hp->bc = bc;
 
 	hp->rem_ip = malloc(VTCP_ADDRBUFSIZE);
 	AN(hp->rem_ip);
@@ -28,6 +28,10 @@ struct http {
 
 	int			fatal;
 
+	/* Benchmark mode */
+	struct bench_conn	*bc;
+	double			t_bench;
+
 	/* H/2 */
 	unsigned		h2;
 	int			wf;
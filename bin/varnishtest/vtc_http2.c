@@ -104,6 +104,7 @@ struct stream {
 	struct http		*hp;
 	int64_t			ws;
 	int			wf;
+	double			t_bench;
 
 	VTAILQ_HEAD(, frame)   fq;
 
@@ -1543,6 +1544,9 @@ cmd_tx11obj(CMD_ARGS)
 	if (*av != NULL)
 		vtc_fatal(vl, "Unknown %s spec: %s\n", cmd_str, *av);
 
+	if (!strcmp(cmd_str, "txreq") && s->hp->bc != NULL)
+		s->t_bench = bench_tx(s->hp->bc);
+
 	memset(&hdr, 0, sizeof(hdr));
 	hdr.t = hpk_not;
 
@@ -2268,6 +2272,10 @@ cmd_rxmsg(CMD_ARGS)
 		end_stream = f->flags & END_STREAM;
 	}
 	s->frame = f;
+	if (s->t_bench > 0. && s->hp->bc != NULL) {
+		bench_rx(s->hp->bc, s->t_bench);
+		s->t_bench = 0.;
+	}
 }
 
 /* SECTION: stream.spec.data_12 rxpush
@@ -2657,7 +2665,9 @@ stream_run(struct stream *s)
  *	stream ID [SPEC] [ACTION]
  *
  * ID is the HTTP/2 stream number, while SPEC describes what will be
- * done in that stream.
+ * done in that stream.  An ID of ``next`` makes a new stream after
+ * the highest one so far, odd for clients and even for servers, to
+ * send requests in a loop.
  *
  * Note that, when parsing a stream action, if the entity isn't operating
  * in HTTP/2 mode, these spec is ran before::
@@ -2690,6 +2700,8 @@ cmd_stream(CMD_ARGS)
 {
 	struct stream *s;
 	struct http *h;
+	uint32_t id = 0;
+	char buf[16];
 
 	(void)cmd;
 	(void)vl;
@@ -2698,11 +2710,24 @@ cmd_stream(CMD_ARGS)
 	AZ(strcmp(av[0], "stream"));
 	av++;
 
-	VTAILQ_FOREACH(s, &h->streams, list)
-		if (!strcmp(s->name, av[0]))
-			break;
-	if (s == NULL)
-		s = stream_new(av[0], h);
+	if (!strcmp(av[0], "next")) {
+		AZ(pthread_mutex_lock(&h->mtx));
+		VTAILQ_FOREACH(s, &h->streams, list)
+			if (s->id > id)
+				id = s->id;
+		AZ(pthread_mutex_unlock(&h->mtx));
+		id++;
+		if ((id & 1) != (h->sfd == NULL))
+			id++;
+		bprintf(buf, "%u", id);
+		s = stream_new(buf, h);
+	} else {
+		VTAILQ_FOREACH(s, &h->streams, list)
+			if (!strcmp(s->name, av[0]))
+				break;
+		if (s == NULL)
+			s = stream_new(av[0], h);
+	}
 	av++;
 
 	for (; *av != NULL; av++) {
@@ -40,6 +40,7 @@
 static pthread_mutex_t	vtclog_mtx;
 static char		*vtclog_buf;
 static unsigned		vtclog_left;
+static unsigned		vtclog_quiet;	/* Benchmarks running */
 
 struct vtclog {
 	unsigned	magic;
@@ -180,6 +181,8 @@ void
 vtc_log(struct vtclog *vl, int lvl, const char *fmt, ...)
 {
 
+	if (lvl > 1 && vtclog_quiet)
+		return;
 	GET_VL(vl);
 	va_list ap;
 	va_start(ap, fmt);
@@ -208,6 +211,8 @@ vtc_dump(struct vtclog *vl, int lvl, const char *pfx, const char *str, int len)
 	char buf[64];
 
 	AN(pfx);
+	if (lvl > 1 && vtclog_quiet)
+		return;
 	GET_VL(vl);
 	if (str == NULL)
 		vtc_leadin(vl, lvl, "%s(null)\n", pfx);
@@ -239,6 +244,8 @@ vtc_hexdump(struct vtclog *vl, int lvl, const char *pfx,
 	unsigned l;
 
 	AN(pfx);
+	if (lvl > 1 && vtclog_quiet)
+		return;
 	GET_VL(vl);
 	if (str == NULL)
 		vtc_leadin(vl, lvl, "%s(null)\n", pfx);
@@ -287,6 +294,25 @@ vtc_log_VAS_Fail(const char *func, const char *file, int line,
 	abort();
 }
 
+/**********************************************************************
+ * While benchmarks run, the per request chatter at levels 2 to 4 of
+ * everybody would only fill the log buffer and slow things down.
+ */
+
+void
+vtc_logquiet(int on)
+{
+
+	AZ(pthread_mutex_lock(&vtclog_mtx));
+	if (on)
+		vtclog_quiet++;
+	else {
+		assert(vtclog_quiet > 0);
+		vtclog_quiet--;
+	}
+	AZ(pthread_mutex_unlock(&vtclog_mtx));
+}
+
 /**********************************************************************/
 
 void
@@ -247,6 +247,7 @@ logexp_dispatch(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 	int ok, skip;
 	int vxid, tag, type, len;
 	const char *legend, *data;
+	char ubuf[VSL_UNPACK_MAX];
 
 	CAST_OBJ_NOTNULL(le, priv, LOGEXP_MAGIC);
 
@@ -261,6 +262,14 @@ logexp_dispatch(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 			tag = VSL_TAG(t->c->rec.ptr);
 			data = VSL_CDATA(t->c->rec.ptr);
 			len = VSL_LEN(t->c->rec.ptr) - 1;
+			if (VSL_PACKED(t->c->rec.ptr)) {
+				ok = VSL_Unpack(t->c->rec.ptr, ubuf,
+				    sizeof ubuf);
+				if (ok >= 0) {
+					data = ubuf;
+					len = ok;
+				}
+			}
 
 			if (tag == SLT__Batch)
 				continue;
@@ -39,6 +39,7 @@
 #include "vtc.h"
 
 #include "vtcp.h"
+#include "vus.h"
 
 struct server {
 	unsigned		magic;
@@ -115,6 +116,39 @@ server_delete(struct server *s)
  * Server listen
  */
 
+static int __match_proto__(vus_resolved_f)
+server_uds_callback(void *priv, const struct sockaddr_un *uds)
+{
+	struct server *s;
+	const char *err;
+
+	CAST_OBJ_NOTNULL(s, priv, SERVER_MAGIC);
+	s->sock = VUS_bind(uds, &err);
+	if (s->sock < 0)
+		vtc_fatal(s->vl, "Server listen path (%s) %s: %s",
+		    s->listen, err, strerror(errno));
+	if (listen(s->sock, s->depth) != 0)
+		vtc_fatal(s->vl, "Server listen path (%s) listen(2): %s",
+		    s->listen, strerror(errno));
+	return (0);
+}
+
+static void
+server_listen_uds(struct server *s)
+{
+	const char *err;
+
+	if (VUS_resolver(s->listen, server_uds_callback, s, &err) != 0)
+		vtc_fatal(s->vl, "Server listen path (%s) is invalid: %s",
+		    s->listen, err);
+	assert(s->sock > 0);
+	bprintf(s->aaddr, "%s", "0.0.0.0");
+	bprintf(s->aport, "%s", "0");
+	macro_def(s->vl, s->name, "addr", "%s", s->listen);
+	macro_def(s->vl, s->name, "port", "%s", "-");
+	macro_def(s->vl, s->name, "sock", "%s", s->listen);
+}
+
 static void
 server_listen(struct server *s)
 {
@@ -124,6 +158,10 @@ server_listen(struct server *s)
 
 	if (s->sock >= 0)
 		VTCP_close(&s->sock);
+	if (VUS_IS(s->listen)) {
+		server_listen_uds(s);
+		return;
+	}
 	s->sock = VTCP_listen_on(s->listen, "0", s->depth, &err);
 	if (err != NULL)
 		vtc_fatal(s->vl,
@@ -168,7 +206,7 @@ server_thread(void *priv)
 		if (fd < 0)
 			vtc_fatal(vl, "Accept failed: %s", strerror(errno));
 		vtc_log(vl, 3, "accepted fd %d", fd);
-		fd = http_process(vl, s->spec, fd, &s->sock);
+		fd = http_process(vl, s->spec, fd, &s->sock, NULL);
 		vtc_log(vl, 3, "shutting fd %d", fd);
 		j = shutdown(fd, SHUT_WR);
 		if (!VTCP_Check(j))
@@ -213,7 +251,7 @@ server_dispatch_wrk(void *priv)
 	fd = s->fd;
 
 	vtc_log(vl, 3, "start with fd %d", fd);
-	fd = http_process(vl, s->spec, fd, &s->sock);
+	fd = http_process(vl, s->spec, fd, &s->sock, NULL);
 	vtc_log(vl, 3, "shutting fd %d", fd);
 	j = shutdown(fd, SHUT_WR);
 	if (!VTCP_Check(j))
@@ -315,9 +353,14 @@ cmd_server_genvcl(struct vsb *vsb)
 
 	AZ(pthread_mutex_lock(&server_mtx));
 	VTAILQ_FOREACH(s, &servers, list) {
-		VSB_printf(vsb,
-		    "backend %s { .host = \"%s\"; .port = \"%s\"; }\n",
-		    s->name, s->aaddr, s->aport);
+		if (VUS_IS(s->listen))
+			VSB_printf(vsb,
+			    "backend %s { .path = \"%s\"; }\n",
+			    s->name, s->listen);
+		else
+			VSB_printf(vsb, "backend %s { .host = \"%s\";"
+			    " .port = \"%s\"; }\n",
+			    s->name, s->aaddr, s->aport);
 	}
 	AZ(pthread_mutex_unlock(&server_mtx));
 }
@@ -569,7 +569,10 @@ varnish_start(struct varnish *v)
 	vtc_log(v->vl, 2, "Listen on %s %s", h, p);
 	macro_def(v->vl, v->name, "addr", "%s", h);
 	macro_def(v->vl, v->name, "port", "%s", p);
-	macro_def(v->vl, v->name, "sock", "%s %s", h, p);
+	if (*h == '/')
+		macro_def(v->vl, v->name, "sock", "%s", h);
+	else
+		macro_def(v->vl, v->name, "sock", "%s %s", h, p);
 	/* Wait for vsl logging to get underway */
 	while (v->vsl_idle == 0)
 		VTIM_sleep(.1);
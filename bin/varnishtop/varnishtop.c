@@ -70,6 +70,7 @@ struct top {
 	VRB_ENTRY(top)		e_order;
 	VRB_ENTRY(top)		e_key;
 	double			count;
+	double			err;	/* -m: count may be this much high */
 };
 
 static const char progname[] = "varnishtop";
@@ -79,6 +80,7 @@ static unsigned ntop;
 static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
 static int f_flag = 0;
 static unsigned maxfieldlen = 0;
+static unsigned maxtop = 0;
 
 volatile sig_atomic_t quit = 0;
 
@@ -120,7 +122,9 @@ accumulate(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 	unsigned int u;
 	unsigned tag;
 	const char *b, *e, *p;
+	char ubuf[VSL_UNPACK_MAX];
 	unsigned len;
+	int i;
 	struct VSL_transaction *tr;
 
 	(void)priv;
@@ -132,6 +136,11 @@ accumulate(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 			tag = VSL_TAG(tr->c->rec.ptr);
 			b = VSL_CDATA(tr->c->rec.ptr);
 			e = b + VSL_LEN(tr->c->rec.ptr);
+			i = VSL_Unpack(tr->c->rec.ptr, ubuf, sizeof ubuf);
+			if (i >= 0) {
+				b = ubuf;
+				e = b + i + 1;
+			}
 			u = 0;
 			for (p = b; p <= e; p++) {
 				if (*p == '\0')
@@ -147,7 +156,7 @@ accumulate(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 			t.hash = u;
 			t.tag = tag;
 			t.clen = len;
-			t.rec_data = VSL_CDATA(tr->c->rec.ptr);
+			t.rec_data = b;
 
 			AZ(pthread_mutex_lock(&mtx));
 			tp = VRB_FIND(t_key, &h_key, &t);
@@ -156,6 +165,27 @@ accumulate(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 				tp->count += 1.0;
 				/* Reinsert to rebalance */
 				VRB_INSERT(t_order, &h_order, tp);
+			} else if (maxtop > 0 && ntop >= maxtop) {
+				/*
+				 * Space-Saving: the new entry takes over
+				 * the least counted one, and its count,
+				 * which is then the error bound.
+				 */
+				tp = VRB_MAX(t_order, &h_order);
+				AN(tp);
+				VRB_REMOVE(t_key, &h_key, tp);
+				VRB_REMOVE(t_order, &h_order, tp);
+				tp->err = tp->count;
+				tp->count += 1.0;
+				tp->hash = u;
+				tp->clen = len;
+				tp->tag = tag;
+				free(tp->rec_buf);
+				tp->rec_buf = strdup(t.rec_data);
+				tp->rec_data = tp->rec_buf;
+				AN(tp->rec_data);
+				VRB_INSERT(t_key, &h_key, tp);
+				VRB_INSERT(t_order, &h_order, tp);
 			} else {
 				ntop++;
 				tp = calloc(sizeof *tp, 1);
@@ -190,7 +220,7 @@ update(int p)
 {
 	struct top *tp, *tp2;
 	int l, len;
-	double t = 0;
+	double t = 0, c;
 	static time_t last = 0;
 	static unsigned n;
 	time_t now;
@@ -215,17 +245,27 @@ update(int p)
 
 		if (++l < LINES) {
 			len = tp->clen;
-			if (len > COLS - 20)
-				len = COLS - 20;
-			AC(mvprintw(l, 0, "%9.2f %-*.*s %*.*s\n",
-				tp->count, maxfieldlen, maxfieldlen,
-				VSL_tags[tp->tag],
-				len, len, tp->rec_data));
+			if (len > COLS - (maxtop > 0 ? 30 : 20))
+				len = COLS - (maxtop > 0 ? 30 : 20);
+			if (maxtop > 0)
+				AC(mvprintw(l, 0, "%9.2f %9.2f %-*.*s %*.*s\n",
+					tp->count, tp->err,
+					maxfieldlen, maxfieldlen,
+					VSL_tags[tp->tag],
+					len, len, tp->rec_data));
+			else
+				AC(mvprintw(l, 0, "%9.2f %-*.*s %*.*s\n",
+					tp->count, maxfieldlen, maxfieldlen,
+					VSL_tags[tp->tag],
+					len, len, tp->rec_data));
 			t = tp->count;
 		}
 		if (end_of_file)
 			continue;
+		c = tp->count;
 		tp->count += (1.0/3.0 - tp->count) / (double)n;
+		if (c > 0.)
+			tp->err *= tp->count / c;
 		if (tp->count * 10 < t || l > LINES * 10) {
 			VRB_REMOVE(t_key, &h_key, tp);
 			VRB_REMOVE(t_order, &h_order, tp);
@@ -304,9 +344,14 @@ dump(void)
 		tp2 = VRB_NEXT(t_order, &h_order, tp);
 		if (tp->count <= 1.0)
 			break;
-		printf("%9.2f %s %*.*s\n",
-			tp->count, VSL_tags[tp->tag],
-			tp->clen, tp->clen, tp->rec_data);
+		if (maxtop > 0)
+			printf("%9.2f %9.2f %s %*.*s\n",
+				tp->count, tp->err, VSL_tags[tp->tag],
+				tp->clen, tp->clen, tp->rec_data);
+		else
+			printf("%9.2f %s %*.*s\n",
+				tp->count, VSL_tags[tp->tag],
+				tp->clen, tp->clen, tp->rec_data);
 	}
 }
 
@@ -342,6 +387,16 @@ main(int argc, char **argv)
 		case 'h':
 			/* Usage help */
 			usage(0);
+		case 'm':
+			errno = 0;
+			maxtop = strtoul(optarg, NULL, 0);
+			if (errno != 0 || maxtop == 0) {
+				fprintf(stderr,
+				    "Syntax error, %s is not a positive"
+				    " number", optarg);
+				exit(1);
+			}
+			break;
 		case 'p':
 			errno = 0;
 			period = strtol(optarg, NULL, 0);
@@ -44,6 +44,17 @@
 	    " where the first field is the client IP address."		\
 	)
 
+#define TOP_OPT_m							\
+	VOPT("m:", "[-m <entries>]", "Bounded list",			\
+	    "Keep at most this many entries, for bounded memory on"	\
+	    " tags with many distinct values. A new entry replaces"	\
+	    " the least counted one and takes over its count, which"	\
+	    " is then shown as a second column: the true count lies"	\
+	    " between the first column minus the second and the first."	\
+	    " Any entry occurring more often than 1/<entries> of the"	\
+	    " time is guaranteed to be in the list."			\
+	)
+
 #define TOP_OPT_p							\
 	VOPT("p:", "[-p <period>]", "Sampling period",			\
 	    "Specified the number of seconds to measure over, the"	\
@@ -64,6 +75,7 @@ VUT_OPT_h
 VSL_OPT_i
 VSL_OPT_I
 VSL_OPT_L
+TOP_OPT_m
 VUT_OPT_n
 VUT_OPT_N
 TOP_OPT_p
@@ -56,6 +56,16 @@ struct binheap *binheap_new(void *priv, binheap_cmp_t, binheap_update_t);
 	 * 'priv' is passed to cmp and update functions.
 	 */
 
+struct binheap *binheap_new_dary(void *priv, binheap_cmp_t, binheap_update_t,
+    unsigned arity);
+	/*
+	 * Create a heap with 'arity' children per node, 2, 4 or 8.
+	 * Arity 2 is the VM-aware B-heap which binheap_new() makes,
+	 * the others are d-ary heaps with the children of a node in
+	 * one cache line, which do fewer and cheaper cache misses per
+	 * level when the heap is much larger than the CPU caches.
+	 */
+
 void binheap_insert(struct binheap *, void *);
 	/*
 	 * Insert an item
@@ -69,7 +79,8 @@ void binheap_reorder(const struct binheap *, unsigned idx);
 void binheap_delete(struct binheap *, unsigned idx);
 	/*
 	 * Delete an item
-	 * The root item has 'idx' zero
+	 * The root item has the lowest 'idx' in use, which is
+	 * arity - 1 for the d-ary heaps.
 	 */
 
 void *binheap_root(const struct binheap *);
@@ -77,4 +88,9 @@ void *binheap_root(const struct binheap *);
 	 * Return the root item
 	 */
 
+void binheap_destroy(struct binheap **);
+	/*
+	 * Free an empty heap
+	 */
+
 #define BINHEAP_NOIDX	0
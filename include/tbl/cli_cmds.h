@@ -65,6 +65,16 @@ CLI_CMD(BAN_LIST,
 	0, 0
 )
 
+CLI_CMD(TAG_PURGE,
+	"tag.purge",
+	"tag.purge [-s] <key>...",
+	"Purge all objects with any of the keys.",
+	"  The keys are the ones the objects got from the tag_header"
+	" parameter.  With ``-s`` the objects only lose their TTL and"
+	" keep their grace and keep periods, like a soft purge.",
+	1, -1
+)
+
 CLI_CMD(VCL_LOAD,
 	"vcl.load",
 	"vcl.load <configname> <filename> [auto|cold|warm]",
@@ -116,6 +126,17 @@ CLI_CMD(VCL_SHOW,
 	1, 2
 )
 
+CLI_CMD(VCL_PROFILE,
+	"vcl.profile",
+	"vcl.profile <configname>",
+	"Show the profile of the specified configuration.",
+	"  For each subroutine and block of statements, how many times it"
+	" ran, and for subroutines how many nanoseconds were spent in them,"
+	" including the subroutines they called.  Only configurations"
+	" compiled with the vcc_profile parameter on have a profile.",
+	1, 1
+)
+
 CLI_CMD(VCL_USE,
 	"vcl.use",
 	"vcl.use <configname|label>",
@@ -277,6 +298,30 @@ CLI_CMD(DEBUG_SRANDOM,
 	0, 1
 )
 
+CLI_CMD(DEBUG_LOCK_PROFILE,
+	"debug.lock_profile",
+	"debug.lock_profile [-r]",
+	"Show lock contention by call site.",
+	"  For each lock class and function which took a lock while the"
+	" lck_profile debug bit was set: contended locks, failed trylocks,"
+	" microseconds waited and microseconds held.  ``-r`` clears the"
+	" table.",
+	0, 1
+)
+
+CLI_CMD(DEBUG_BENCH,
+	"debug.bench",
+	"debug.bench [-n <ops>] [<name>...]",
+	"Run micro-benchmarks of the hot paths in the child.",
+	"  For each benchmark, or the named ones: the operations done, the"
+	" nanoseconds, workspace bytes and heap bytes per operation.  The"
+	" heap bytes are only known with jemalloc.  The benchmarks are"
+	" binheap, binheap8, sha256, vre, http1_dissect, http_encode,"
+	" http_decode, vry_match, hash_lookup, gzip, gunzip and vslb.  They"
+	" hold up the CLI while they run.",
+	0, -1
+)
+
 CLI_CMD(DEBUG_PANIC_WORKER,
 	"debug.panic.worker",
 	"debug.panic.worker",
@@ -321,6 +366,27 @@ CLI_CMD(STORAGE_LIST,
 	0, 0
 )
 
+CLI_CMD(CACHE_WARM,
+	"cache.warm",
+	"cache.warm <file> [<rate>]",
+	"Warm the cache from a list of URLs.",
+	"  The URLs in the file, one per line, are run through VCL in the\n"
+	"  background like requests from a client, at no more than 100 or\n"
+	"  the given rate per second.  A line can also have a host name\n"
+	"  before the URL, or have it as http://host/url.  The file is\n"
+	"  read by the child process.",
+	1, 2
+)
+
+CLI_CMD(STORAGE_SNAPSHOT,
+	"storage.snapshot",
+	"storage.snapshot",
+	"Write the objects of storage with a snapshot file there.",
+	"  The snapshot is written in the background, and the objects\n"
+	"  in it are loaded again when the child is restarted.",
+	0, 0
+)
+
 #undef CLI_CMD
 
 /*lint -restore */
@@ -45,6 +45,7 @@ DEBUG_BIT(VTC_MODE,		vtc_mode,	"Varnishtest Mode")
 DEBUG_BIT(WITNESS,		witness,	"Emit WITNESS lock records")
 DEBUG_BIT(VSM_KEEP,		vsm_keep,	"Keep the VSM file on restart")
 DEBUG_BIT(DROP_POOLS,		drop_pools,	"Drop thread pools (testing)")
+DEBUG_BIT(LCK_PROFILE,		lck_profile,	"Profile lock contention")
 #undef DEBUG_BIT
 
 /*lint -restore */
@@ -77,6 +77,38 @@ FEATURE_BIT(HTTP2,		http2,
     "Enable HTTP/2 protocol support."
 )
 
+FEATURE_BIT(IO_URING_SEND,	io_uring_send,
+    "Deliver with io_uring",
+    "Send HTTP/1 output through a per-thread io_uring(7) instead of"
+    " writev(2), using zero-copy sends for large bodies."
+    " Ignored where io_uring is not available."
+)
+
+FEATURE_BIT(TCP_CORK,		tcp_cork,
+    "Cork chunked and ESI deliveries",
+    "Hold back partial TCP segments while an HTTP/1 response which is"
+    " written in several pieces is delivered, so its fragments go out"
+    " in full sized packets. Uses TCP_CORK or TCP_NOPUSH."
+    " While a streamed delivery waits for the backend, the last partial"
+    " segment may be held back for as long as the kernel allows,"
+    " 200ms on Linux."
+)
+
+FEATURE_BIT(PIPELINE_CORK,	pipeline_cork,
+    "Coalesce pipelined responses",
+    "While more HTTP/1 requests wait in the receive buffer, hold back"
+    " partial TCP segments, so the responses to a batch of pipelined"
+    " requests go out together. Uses TCP_CORK or TCP_NOPUSH."
+)
+
+FEATURE_BIT(IDLE_SHRINK,	idle_shrink,
+    "Shrink idle HTTP/1 sessions",
+    "While an HTTP/1 session waits for its next request, keep it in an"
+    " allocation just big enough for what it holds, rather than one of"
+    " workspace_session bytes from the session pool. Costs a malloc(3)"
+    " and two copies per idle period."
+)
+
 #undef FEATURE_BIT
 
 /*lint -restore */
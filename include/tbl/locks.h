@@ -29,25 +29,43 @@
 
 /*lint -save -e525 -e539 */
 
+/*
+ * LOCK_SPIN() marks the classes with critical sections short enough
+ * that a contended thread had better spin a little than go to sleep,
+ * see the lock_spin parameter.
+ */
+#ifndef LOCK_SPIN
+#  define LOCK_SPIN(nam) LOCK(nam)
+#endif
+
 LOCK(backend)
 LOCK(backend_tcp)
 LOCK(ban)
-LOCK(busyobj)
+LOCK_SPIN(busyobj)
 LOCK(cli)
+LOCK(dedup)
 LOCK(exp)
+LOCK(h2fetch)
 LOCK(hcb)
-LOCK(lru)
-LOCK(mempool)
-LOCK(objhdr)
+LOCK(hdict)
+LOCK_SPIN(lru)
+LOCK_SPIN(mempool)
+LOCK_SPIN(objhdr)
 LOCK(pipestat)
 LOCK(sess)
+LOCK(snapshot)
+LOCK(synth)
+LOCK(tag)
 LOCK(vbe)
 LOCK(vcapace)
 LOCK(vcl)
+LOCK_SPIN(vgz)
 LOCK(vxid)
 LOCK(waiter)
+LOCK(warm)
 LOCK(wq)
-LOCK(wstat)
+LOCK_SPIN(wstat)
 #undef LOCK
+#undef LOCK_SPIN
 
 /*lint -restore */
@@ -58,6 +58,9 @@
   OBJ_FLAG(CHGGZIP,	chggzip,	(1<<2))
   OBJ_FLAG(IMSCAND,	imscand,	(1<<3))
   OBJ_FLAG(ESIPROC,	esiproc,	(1<<4))
+  OBJ_FLAG(BROTLI,	brotli,		(1<<5))
+  OBJ_FLAG(DEFERGZIP,	defergzip,	(1<<6))
+  OBJ_FLAG(STATIC,	static,		(1<<7))
   #undef OBJ_FLAG
 #endif
 
@@ -28,6 +28,7 @@
 
 /*lint -save -e525 -e539 */
 
+OC_FLAG(VARIANT,	variant,	(1<<0))
 OC_FLAG(BUSY,		busy,		(1<<1))
 OC_FLAG(PASS,		pass,		(1<<2))
 OC_FLAG(HFP,		hfp,		(1<<3))
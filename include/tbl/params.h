@@ -105,6 +105,27 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	admission_sketch,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"268435456",
+	/* default */	"0",
+	/* units */	"counters",
+	/* flags */	MUST_RESTART| EXPERIMENTAL,
+	/* s-text */
+	"Width of the sketch counting how often objects are looked up, "
+	"rounded up to a power of two.  While a stevedore has to nuke "
+	"objects to make room, a fetched object which has been looked up "
+	"less often than the one it would push out is not stored, but "
+	"made hit-for-miss.\n"
+	"The sketch takes a little over four bytes per counter, and "
+	"should have a few counters per object in the cache.\n"
+	"Zero disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	auto_restart,
 	/* typ */	bool,
@@ -203,6 +224,97 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	ban_lurker_threads,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* default */	"1",
+	/* units */	NULL,
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How many threads test the objects of a ban, when it has more "
+	"than ${ban_lurker_batch} of them.  "
+	"The ban lurker borrows the extra threads from the worker pools, "
+	"each of them paced by ${ban_lurker_batch} and ${ban_lurker_sleep} "
+	"on its own.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	ban_replicate,
+	/* typ */	addrlist,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"",
+	/* units */	NULL,
+	/* flags */	0,
+	/* s-text */
+	"The HTTP addresses of the peer caches which bans added here are "
+	"sent to, separated by white space or commas.  "
+	"The bans are batched, and each peer gets them in a BAN request, "
+	"which its VCL hands to std.ban_replay().  "
+	"Bans which came from a peer are not sent on.  "
+	"The peers must run on the same architecture and PCRE version.  "
+	"Empty disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	ban_replicate_delay,
+	/* typ */	timeout,
+	/* min */	"0",
+	/* max */	"10",
+	/* default */	"0.100",
+	/* units */	"seconds",
+	/* flags */	0,
+	/* s-text */
+	"How long bans are collected before they are sent to the peers in "
+	"${ban_replicate} in one batch.  "
+	"A peer which could not be reached gets its bans with the next "
+	"batch, up to 1MB of them.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	body_dedup,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Share the storage of identical object bodies.\n"
+	"When enabled, the body of each object in malloc or file storage "
+	"is hashed when it is complete, and an object whose body is "
+	"already in the same storage gives up its copy for the one there.  "
+	"The object holding that copy stays in storage for as long as "
+	"any other object uses it.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	brotli_quality,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"11",
+	/* default */	"5",
+	/* units */	NULL,
+	/* flags */	0,
+	/* s-text */
+	"Brotli compression quality for beresp.do_brotli: 0=fast, "
+	"11=best.\n"
+	"The highest qualities are far too slow to compress objects "
+	"while they are being fetched.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	first_byte_timeout,
 	/* typ */	timeout,
@@ -253,6 +365,134 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	backend_wait_timeout,
+	/* typ */	timeout,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"seconds",
+	/* flags */	0,
+	/* s-text */
+	"How long a fetch waits for a connection when the backend has "
+	"reached its .max_connections, before it fails.\n"
+	"Connections are handed to waiting fetches as they are given "
+	"back.  Zero fails such fetches straight away.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	backend_wait_limit,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"100",
+	/* units */	"fetches",
+	/* flags */	0,
+	/* s-text */
+	"How many fetches can wait for a connection to the same backend "
+	"at the same time, see ${backend_wait_timeout}.  Any more fail "
+	"straight away.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	backend_breaker_fails,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"fetches",
+	/* flags */	0,
+	/* s-text */
+	"After this many fetches in a row from a backend failed, for "
+	"want of a connection or a response, the backend is sick for "
+	"${backend_breaker_open}, regardless of what its probe says.  "
+	"Directors move on to other backends, fetches which still go "
+	"there fail at once rather than wait for their timeouts.\n"
+	"When the time is up, one fetch is let through at a time, and "
+	"the first one which gets a response makes the backend healthy "
+	"again.\n"
+	"Backends with their health set from the CLI are not affected.  "
+	"Zero disables.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	backend_breaker_open,
+	/* typ */	timeout,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"5",
+	/* units */	"seconds",
+	/* flags */	0,
+	/* s-text */
+	"How long a backend stays sick after ${backend_breaker_fails} "
+	"failed fetches, or after its trial fetch failed.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	backend_hedge_max,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"10",
+	/* units */	"fetches",
+	/* flags */	0,
+	/* s-text */
+	"How many fetches can be hedged to a second backend at the same "
+	"time, see the hedge director of vmod_directors.  When there are "
+	"this many, slow fetches just wait for their first backend.\n"
+	"Zero disables hedging.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	fetch_park,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Let a fetch which has sent its request give up its worker thread "
+	"while the backend thinks about the response, and continue on any "
+	"worker once the response starts to arrive.  This saves threads "
+	"with slow backends.\n"
+	"A fetch which has to open a new connection likewise gives up its "
+	"thread until connect(2) is done, or connect_timeout passes.\n"
+	"Fetches with a request body from the client do not park.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	backend_warm_conns,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"connections",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Open idle backend connections ahead of demand, so a burst of "
+	"fetches does not have to wait for the TCP handshakes.\n"
+	"As many connections are kept ready as the highest number of "
+	"concurrent fetches to the same backend seen within "
+	"${backend_idle_timeout}, but no more than this many per backend "
+	"and thread pool.\n"
+	"Zero disables.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	cli_buffer,
 	/* typ */	bytes_u,
@@ -275,7 +515,7 @@ PARAM(
 	/* typ */	bytes_u,
 	/* min */	"128b",
 	/* max */	"99999999b",
-	/* default */	"48k",
+	/* default */	"128k",
 	/* units */	"bytes",
 	/* flags */	0,
 	/* s-text */
@@ -443,6 +683,104 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	deliver_park,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Let a HTTP/1 delivery which cannot write to the client give up "
+	"its worker thread until the client takes more data, and continue "
+	"on any worker then.  This saves threads with slow clients.\n"
+	"Only complete objects delivered as stored park, not those which "
+	"are still being fetched or go through ESI, gunzip or ranges.  "
+	"The idle_send_timeout and send_timeout parameters still apply.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	esi_memo,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"1000",
+	/* default */	"0",
+	/* units */	"includes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How many distinct esi:include's of a page to remember, so that "
+	"when the same src and host is included again while delivering "
+	"the page, the object delivered the first time is delivered "
+	"again without a new lookup or any VCL.\n"
+	"Only cacheable 200 responses which had been fully fetched are "
+	"remembered.  Note that vcl_recv{} and vcl_deliver{} do not run "
+	"for the repeats, so this is only safe if they do not depend on "
+	"anything but the URL and Host of the include.\n"
+	"Zero disables.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	esi_prefetch,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"100",
+	/* default */	"0",
+	/* units */	"includes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How many esi:include's ahead of the one being delivered are "
+	"looked up, and fetched if they miss, in parallel.\n"
+	"The includes are still delivered one by one in document order, "
+	"but a page with many missing includes takes about as long as "
+	"the slowest fetch rather than all of them together.  Includes "
+	"which end up in vcl_pass are not fetched ahead.\n"
+	"Zero disables.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	esi_reuse,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Record the length and CRC32 of the body of uncompressed ESI "
+	"objects, and when such an object is refetched with an "
+	"identical body for the same URL, reuse the parsed ESI "
+	"instructions of the stale object rather than parsing the "
+	"body again.\n"
+	"Only refetches whose Content-Length matches are considered, "
+	"and a mismatch costs one extra pass over the new body.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	expiry_shards,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* default */	"1",
+	/* units */	"shards",
+	/* flags */	MUST_RESTART| EXPERIMENTAL,
+	/* s-text */
+	"Number of expiry shards.\n"
+	"Each shard has its own inbox, timer heap and thread, and objects "
+	"are spread over the shards.  More shards help the expiry work "
+	"keep up with mass expiry of many small objects.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 #if 0
 /* actual location mgt_param_bits.c*/
 /* See tbl/feature_bits.h */
@@ -521,6 +859,65 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	gzip_deferred,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Take the gzip'ing of beresp.do_gzip off the fetch.\n"
+	"The object is stored and streamed as it comes from the backend, "
+	"and the first hit on it gzip's a copy on a worker thread queued "
+	"behind the backend fetches.  When the copy is complete it "
+	"replaces the original.  ESI and uncacheable objects are gzip'ed "
+	"during the fetch as usual.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	gzip_parallel,
+	/* typ */	bytes,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Gzip bodies with a Content-Length of at least this many bytes "
+	"in 1MB blocks, up to four at a time on helper threads, instead "
+	"of in one go on the fetch thread.\n"
+	"The result is a single gzip member, compressed slightly worse "
+	"as each block only sees 32k of the one before it.  ESI "
+	"processed bodies are always gzip'ed on the fetch thread.\n"
+	"Zero disables.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	gzip_pool,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"16",
+	/* units */	NULL,
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How many finished gzip and how many finished gunzip states to "
+	"keep for reuse, each with its gzip_buffer.\n"
+	"A reused state is reset rather than set up from scratch, which "
+	"for gzip saves allocating its window and hash tables.  States "
+	"made with another gzip_level or gzip_memlevel are not reused.  "
+	"At the default gzip_memlevel an idle gzip state holds about "
+	"256k.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	gzip_level,
 	/* typ */	uint,
@@ -550,6 +947,112 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	h2_backend_streams,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* default */	"100",
+	/* units */	"streams",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Concurrent fetches per connection to a backend with "
+	".http2 = true.\n"
+	"Once all connections have this many streams open, or as many "
+	"as the backend's SETTINGS_MAX_CONCURRENT_STREAMS allows, a new "
+	"connection is made.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	h2_backend_window,
+	/* typ */	bytes,
+	/* min */	"65535b",
+	/* max */	"2147483647b",
+	/* default */	"1m",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"HTTP/2 receive window for backend responses.\n"
+	"Each fetch from a backend with .http2 = true buffers at most "
+	"this much of the response body which it has not yet consumed, "
+	"and the connection window is this times h2_backend_streams.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	h2_header_table_size,
+	/* typ */	bytes,
+	/* min */	"0b",
+	/* max */	"65536b",
+	/* default */	"4096b",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"HTTP/2 HPACK dynamic table size for response headers.\n"
+	"Repeated response headers are sent as an index into this table "
+	"instead of in full.  The client's SETTINGS_HEADER_TABLE_SIZE "
+	"can lower it, but not raise it.  Zero disables the table.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	h2_park,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Let a HTTP/2 session with no streams and nothing buffered give up "
+	"its worker thread to the waiter, and continue on any worker once "
+	"the client sends more.  This saves threads with many idle HTTP/2 "
+	"connections.\n"
+	"A parked session is closed after timeout_idle.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	h2_rx_window,
+	/* typ */	bytes,
+	/* min */	"65535b",
+	/* max */	"2147483647b",
+	/* default */	"65535b",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"HTTP/2 receive window for request bodies.\n"
+	"This is the SETTINGS_INITIAL_WINDOW_SIZE we announce, and each "
+	"stream with a request body buffers at most this much of it in "
+	"memory until the request has consumed it.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	http_chunk_min,
+	/* typ */	bytes_u,
+	/* min */	"0",
+	/* max */	"64k",
+	/* default */	"4k",
+	/* units */	"bytes",
+	/* flags */	0,
+	/* s-text */
+	"Writes smaller than this to a chunked HTTP/1 body are copied "
+	"into a buffer of this size, taken from the workspace, so that "
+	"they go out together as one chunk when it fills up or the body "
+	"is flushed, rather than filling up the I/O vector with small "
+	"pieces.\n"
+	"Zero disables.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	http_gzip_support,
 	/* typ */	bool,
@@ -567,12 +1070,54 @@ PARAM(
 	"  Accept-Encoding: gzip\n"
 	"\n"
 	"Clients that do not support gzip will have their Accept-Encoding "
-	"header removed. For more information on how gzip is implemented "
+	"header removed.  Clients supporting brotli keep a \"br\" in "
+	"it, and beresp.do_brotli also depends on this parameter.\n"
+	"For more information on how gzip is implemented "
 	"please see the chapter on gzip in the Varnish reference.",
 	/* l-text */	"",
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	http_gzip_variants,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Keep gunzip'ed copies of gzip'ed objects for clients which do "
+	"not support gzip.\n"
+	"The first such hit on a gzip'ed object makes a gunzip'ed variant "
+	"of it in the background, stored next to it with the same "
+	"lifetime, and later hits from those clients get the variant "
+	"rather than gunzip'ing the object again.  This trades storage "
+	"for CPU.  ESI objects are left alone.  Does nothing without "
+	"http_gzip_support.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	http_hdr_dict,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"16384",
+	/* default */	"0",
+	/* units */	"header lines",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Size of the dictionary of header lines shared between objects.\n"
+	"Lines seen twice are added, and objects then refer to them "
+	"instead of carrying a copy.  Lines which tend to be unique, "
+	"such as Date:, and objects on persistent storage are left "
+	"alone.\n"
+	"Zero disables the dictionary.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	http_max_hdr,
 	/* typ */	uint,
@@ -591,6 +1136,23 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	http_max_ranges,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	"1000",
+	/* default */	"16",
+	/* units */	"ranges",
+	/* flags */	0,
+	/* s-text */
+	"Maximum number of ranges in a Range header we answer with a "
+	"multipart/byteranges response.  Requests for more ranges get "
+	"the entire object.\n"
+	"Set to one to only support single ranges.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	http_range_support,
 	/* typ */	bool,
@@ -704,6 +1266,41 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	listen_reuseport,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	MUST_RESTART| EXPERIMENTAL,
+	/* s-text */
+	"Open one SO_REUSEPORT socket per thread pool for every listen "
+	"address, and have each pool accept only from its own socket.\n"
+	"This lets the kernel spread new connections over the pools, "
+	"rather than all pools contending for one accept queue.\n"
+	"The number of sockets follows thread_pools when the child is "
+	"started, later pools share them round robin.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	lock_spin,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"10000",
+	/* default */	"100",
+	/* units */	NULL,
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How many times a thread may retry a contended lock of a class "
+	"with short critical sections before it goes to sleep.  Each lock "
+	"adapts its own spin count below this, zero disables spinning.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	lru_interval,
 	/* typ */	timeout,
@@ -722,6 +1319,22 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	lru_size_window,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* default */	"16",
+	/* units */	"objects",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How many unused objects at the cold end of the LRU list a "
+	"stevedore with lru=size looks at when it must make room.  The "
+	"one with the fewest hits per byte is nuked.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	max_esi_depth,
 	/* typ */	uint,
@@ -781,6 +1394,39 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	pack_idle,
+	/* typ */	timeout,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Objects in malloc storage which have not been used for this long "
+	"get their body compressed in the background, and are "
+	"decompressed as they are delivered.  Bodies which are compressed "
+	"already are left alone.\n"
+	"Zero disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	pack_ratio,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	"100",
+	/* default */	"75",
+	/* units */	"%",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"A body is only kept compressed by pack_idle if that takes no "
+	"more than this share of its size.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 #if 0
 /* actual location mgt_param_tbl.c */
 PARAM(
@@ -815,6 +1461,41 @@ PARAM(
 )
 #endif
 
+PARAM(
+	/* name */	pcre_jit_stack,
+	/* typ */	bytes,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"256k",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Size of the PCRE JIT stack of each worker thread.\n"
+	"Regular expressions which need more stack than this are retried "
+	"with the slower interpreter, counted in regex_jit_fallback.\n"
+	"Zero uses the small stack PCRE provides by default.\n"
+	"Changes take effect for new worker threads, and only if Varnish "
+	"was built with the PCRE JIT compiler.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	persistent_load_threads,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* default */	"4",
+	/* units */	NULL,
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How many threads load the segments of a persistent silo at "
+	"startup.  "
+	"The silo thread borrows the extra threads from the worker pools.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	ping_interval,
 	/* typ */	uint,
@@ -846,6 +1527,27 @@ PARAM(
 	/* func */	NULL
 )
 
+#if defined(HAVE_SPLICE)
+  #define XYZZY	0
+#else
+  #define XYZZY	NOT_IMPLEMENTED
+#endif
+PARAM(
+	/* name */	pipe_splice,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"on",
+	/* units */	"bool",
+	/* flags */	XYZZY,
+	/* s-text */
+	"Move the data of PIPE sessions with splice(2) through a pair of "
+	"pipes, instead of copying it through a buffer in varnishd.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+#undef XYZZY
+
 #if 0
 /* actual location mgt_param_tbl.c */
 PARAM(
@@ -873,40 +1575,90 @@ PARAM(
 	/* units */	NULL,
 	/* flags */	0,
 	/* s-text */
-	"Parameters for per worker pool session memory pool.\n"
-	MEMPOOL_TEXT,
+	"Parameters for per worker pool session memory pool.\n"
+	MEMPOOL_TEXT,
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+/* actual location mgt_param_tbl.c */
+PARAM(
+	/* name */	pool_vbo,
+	/* typ */	poolparam,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"10,100,10",
+	/* units */	NULL,
+	/* flags */	0,
+	/* s-text */
+	"Parameters for backend object fetch memory pool.\n"
+	MEMPOOL_TEXT,
+	/* l-text */	"",
+	/* func */	NULL
+)
+#endif
+
+PARAM(
+	/* name */	prefer_ipv6,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	0,
+	/* s-text */
+	"Prefer IPv6 address when connecting to backends which have both "
+	"IPv4 and IPv6 addresses.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	refresh_ahead,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"100",
+	/* default */	"0",
+	/* units */	"%",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"A hit on an object in this last part of its TTL starts a "
+	"background fetch to refresh it, as a hit in grace does, so that "
+	"popular objects are replaced before they expire.  Only objects "
+	"with at least refresh_ahead_hits hits are refreshed, and only "
+	"one fetch is made at a time.\n"
+	"Zero disables this.",
 	/* l-text */	"",
 	/* func */	NULL
 )
 
-/* actual location mgt_param_tbl.c */
 PARAM(
-	/* name */	pool_vbo,
-	/* typ */	poolparam,
-	/* min */	NULL,
+	/* name */	refresh_ahead_hits,
+	/* typ */	uint,
+	/* min */	"0",
 	/* max */	NULL,
-	/* default */	"10,100,10",
-	/* units */	NULL,
-	/* flags */	0,
+	/* default */	"10",
+	/* units */	"hits",
+	/* flags */	EXPERIMENTAL,
 	/* s-text */
-	"Parameters for backend object fetch memory pool.\n"
-	MEMPOOL_TEXT,
+	"How many hits an object must have had before refresh_ahead "
+	"refreshes it.",
 	/* l-text */	"",
 	/* func */	NULL
 )
-#endif
 
 PARAM(
-	/* name */	prefer_ipv6,
-	/* typ */	bool,
-	/* min */	NULL,
+	/* name */	req_body_spill,
+	/* typ */	bytes,
+	/* min */	"0",
 	/* max */	NULL,
-	/* default */	"off",
-	/* units */	"bool",
+	/* default */	"0",
+	/* units */	"bytes",
 	/* flags */	0,
 	/* s-text */
-	"Prefer IPv6 address when connecting to backends which have both "
-	"IPv4 and IPv6 addresses.",
+	"Request bodies which are kept, and may be larger than this, go "
+	"to req.storage, smaller ones to Transient.  Zero sends them all "
+	"to req.storage, if it is set.",
 	/* l-text */	"",
 	/* func */	NULL
 )
@@ -922,6 +1674,8 @@ PARAM(
 	/* s-text */
 	"How many parked request we start for each completed request on "
 	"the object.\n"
+	"Parked requests which can use the object they waited for as it "
+	"is are handed it directly, and are all started at once.\n"
 	"NB: Even with the implict delay of delivery, this parameter "
 	"controls an exponential increase in number of worker threads.",
 	/* l-text */	"",
@@ -989,6 +1743,75 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	stream_wakeup_bytes,
+	/* typ */	bytes,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Clients streaming an object which is still being fetched are "
+	"woken up when this much more of it has arrived, rather than "
+	"every time the fetch adds to it.\n"
+	"With many clients streaming the same object, this cuts down "
+	"on the contention for it.  Clients get the rest of the data "
+	"after stream_wakeup_interval at the latest.\n"
+	"Zero means wake up on every addition.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	stream_wakeup_interval,
+	/* typ */	timeout,
+	/* min */	"0.001",
+	/* max */	NULL,
+	/* default */	"0.010",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How long a client streaming an object waits for "
+	"stream_wakeup_bytes to arrive, before it sends what there is.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	synth_cache,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"100",
+	/* units */	"responses",
+	/* flags */	0,
+	/* s-text */
+	"Maximum number of synthetic responses kept for reuse when "
+	"vcl_synth sets resp.ttl.  The least recently used one gives way "
+	"to a new one.  Zero disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	tag_header,
+	/* typ */	header,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"",
+	/* units */	NULL,
+	/* flags */	0,
+	/* s-text */
+	"Backend response header from which objects get their surrogate "
+	"keys, or tags, when they are fetched.  The keys are separated by "
+	"white space or commas, and the objects under a key can be purged "
+	"with the tag.purge CLI command or std.tag_purge() without a ban.  "
+	"Empty disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	syslog_cli_traffic,
 	/* typ */	bool,
@@ -1023,6 +1846,30 @@ PARAM(
 )
 #undef XYZZY
 
+#if defined(HAVE_TCP_FASTOPEN_CONNECT)
+  #define XYZZY EXPERIMENTAL
+#else
+  #define XYZZY NOT_IMPLEMENTED
+#endif
+PARAM(
+	/* name */	backend_fastopen,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	XYZZY,
+	/* s-text */
+	"Use TCP Fast Open for new backend connections, so the start of "
+	"the backend request goes out with the SYN and a round trip is "
+	"saved where the backend supports it.\n"
+	"With this, a failure to connect is only noticed when the request "
+	"is sent, and ${connect_timeout} no longer applies.",
+	/* l-text */	NULL,
+	/* func */	NULL
+)
+#undef XYZZY
+
 #if defined(HAVE_TCP_KEEP)
   #define XYZZY	EXPERIMENTAL
 #else
@@ -1287,6 +2134,73 @@ PARAM(
 	/* func */	NULL
 )
 
+/* actual location mgt_pool.c */
+PARAM(
+	/* name */	thread_queue_target,
+	/* typ */	timeout,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Acceptable time for client work to wait in a thread-pool queue.\n"
+	"\n"
+	"When everything taken off the queue has waited longer than this "
+	"for a whole thread_queue_interval, the pool stops queueing new "
+	"client work and drops it, like it does above thread_queue_limit, "
+	"until the queue delay is back under target.  Lower priority work, "
+	"see req.priority, is dropped as soon as any queue above it is "
+	"over target.\n"
+	"\n"
+	"Zero disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+/* actual location mgt_pool.c */
+PARAM(
+	/* name */	thread_queue_interval,
+	/* typ */	timeout,
+	/* min */	"0.001",
+	/* max */	NULL,
+	/* default */	"0.1",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How long the queue delay must stay over thread_queue_target "
+	"before client work is dropped.\n"
+	"\n"
+	"This should be a few times the time a typical request takes, so "
+	"short bursts are queued rather than dropped.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+/* actual location mgt_pool.c */
+PARAM(
+	/* name */	thread_queue_fair,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"tasks",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Share the threads of a pool fairly between clients when client "
+	"work has to queue for them.\n"
+	"\n"
+	"Queued work is sorted by client, its IP or the client.identity "
+	"VCL sets for the request, into a fixed set of buckets, and the "
+	"buckets with work take turns, up to this many tasks at a time.  "
+	"One client with many connections then only delays itself, and "
+	"those sharing its bucket.\n"
+	"\n"
+	"Zero queues client work in arrival order.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 /* actual location mgt_pool.c */
 PARAM(
 	/* name */	thread_stats_rate,
@@ -1298,8 +2212,8 @@ PARAM(
 	/* flags */	EXPERIMENTAL,
 	/* s-text */
 	"Worker threads accumulate statistics, and dump these into the "
-	"global stats counters if the lock is free when they finish a job "
-	"(request/fetch etc).\n"
+	"global stats counters when they run out of work, without taking "
+	"any locks.\n"
 	"This parameters defines the maximum number of jobs a worker "
 	"thread may handle, before it is forced to dump its accumulated "
 	"stats into the global counters.",
@@ -1344,6 +2258,61 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	transient_wait,
+	/* typ */	timeout,
+	/* min */	"0.000",
+	/* max */	NULL,
+	/* default */	"0.000",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How long an allocation from a full Transient storage waits for "
+	"other transactions to release space, before the fetch fails.\n"
+	"The size of Transient is set with -s Transient=malloc,<size>.\n"
+	"Zero means fail immediately.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	transit_buffer,
+	/* typ */	bytes,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How far the backend fetch of a streamed pass response may get "
+	"ahead of the client.\n"
+	"Since the client releases the storage it has delivered, this "
+	"bounds the Transient space used by large pass bodies, at the "
+	"cost of holding the backend connection for as long as the "
+	"client takes.\n"
+	"Zero means no limit.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	ttl_jitter,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"100",
+	/* default */	"0",
+	/* units */	"%",
+	/* flags */	0,
+	/* s-text */
+	"Shorten the TTL of fetched objects by a random amount up to this "
+	"share of it, after vcl_backend_response{}, so that objects "
+	"fetched together do not all expire together.  Grace and keep "
+	"are not changed.\n"
+	"Zero disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 #if 0
 /* actual location mgt_param_tbl.c */
 PARAM(
@@ -1497,6 +2466,48 @@ PARAM(
 )
 #endif
 
+PARAM(
+	/* name */	vsl_demand,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Only log the tags which a running log reader has asked for, on "
+	"top of vsl_mask.  With no readers attached, next to nothing is "
+	"logged.\n"
+	"Readers register in the _.vsl_demand directory of the working "
+	"directory when they attach, which takes up to a second to be "
+	"noticed.  Records logged before then are lost to them.  Readers "
+	"in raw mode with -i/-I/-x/-X options ask for the tags those let "
+	"through, all others ask for all tags.  Readers which cannot write "
+	"to the directory, or are built against an older libvarnishapi, "
+	"only see what other readers asked for.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	vsl_packed,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Log Timestamp, ReqAcct, BereqAcct and PipeAcct records with their "
+	"numbers in binary rather than as text.  This saves formatting in "
+	"varnishd and parsing in the log tools, and the records take less "
+	"space in the log.\n"
+	"The log tools render such records as text, but tools built "
+	"against an older libvarnishapi will not understand them.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	vsl_reclen,
 	/* typ */	vsl_reclen,
@@ -1512,6 +2523,82 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	vsl_sample,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* default */	"1",
+	/* units */	"transactions",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Log one in this many transactions in full.  The others are held "
+	"back in their VSL buffer until they end, and then only their "
+	"Begin, Link, ReqStart, method, URL, status, Timestamp, accounting "
+	"and End records are logged.\n"
+	"Transactions with an Error, FetchError, VCL_Error or HttpGarbage "
+	"record, a 5xx status, or which take longer than vsl_sample_slow, "
+	"are always logged in full.  So are transactions which overflow "
+	"vsl_buffer, or have their log flushed before they end, for "
+	"instance by the syncvsl debug flag.\n"
+	"Client and backend transactions are sampled independently.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	vsl_sample_slow,
+	/* typ */	timeout,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"1",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Transactions which take longer than this are logged in full, "
+	"regardless of vsl_sample.\n"
+	"Zero disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	vsl_trace,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"transactions",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Trace one in this many client transactions, and the backend and "
+	"ESI transactions they start.  A traced transaction collects the "
+	"time spent in lookup, on the waiting list, connecting to the "
+	"backend, waiting for its first byte and delivering ESI includes, "
+	"and writes them as Span records when it ends.\n"
+	"Zero disables sampled tracing.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	vsl_trace_slow,
+	/* typ */	timeout,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Also write Span records for transactions which take longer than "
+	"this, whether vsl_trace picked them or not.  This makes every "
+	"transaction collect its spans, in a couple of hundred bytes of "
+	"workspace.\n"
+	"Zero disables this.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	vsl_space,
 	/* typ */	bytes,
@@ -1545,6 +2632,25 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	vsm_hugepage,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	MUST_RESTART,
+	/* s-text */
+	"Ask the kernel to back the VSM memory segment, which holds the "
+	"VSL fifo buffer, with transparent huge pages, in varnishd and in "
+	"the programs reading it.  This only works where the file system "
+	"of the working directory supports it, such as a tmpfs mounted "
+	"with huge=advise.  If the working directory is on a hugetlbfs, "
+	"the segment is made of huge pages regardless.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 #if 0
 /* see mgt_waiter.c */
 PARAM(
@@ -1562,6 +2668,24 @@ PARAM(
 )
 #endif
 
+PARAM(
+	/* name */	waiter_threads,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* default */	"1",
+	/* units */	"threads",
+	/* flags */	MUST_RESTART| EXPERIMENTAL,
+	/* s-text */
+	"Threads per thread pool waiter, for the epoll waiter only.\n"
+	"The connections are split between them by file descriptor, each "
+	"thread has its own epoll instance and timeouts.  Raise this if "
+	"the cache-epoll threads are busy with very many idle "
+	"connections.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	workspace_backend,
 	/* typ */	bytes_u,
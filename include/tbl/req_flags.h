@@ -35,6 +35,10 @@ REQ_FLAG(hash_ignore_busy,	1, 1, "")
 REQ_FLAG(hash_always_miss,	1, 1, "")
 REQ_FLAG(is_hit,		0, 0, "")
 REQ_FLAG(waitinglist,		0, 0, "")
+REQ_FLAG(is_prefetch,		0, 0, "")
+REQ_FLAG(synth_cached,		0, 0, "")
+REQ_FLAG(deliver_parked,	0, 0, "")
+REQ_FLAG(esi_memo,		0, 0, "")
 #undef REQ_FLAG
 
 /*lint -restore */
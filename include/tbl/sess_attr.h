@@ -40,6 +40,10 @@ SESS_ATTR(SERVER_ADDR,	  server_addr,	struct suckaddr,    vsa_suckaddr_len)
 SESS_ATTR(CLIENT_IP,	  client_ip,	char,		    -1)
 SESS_ATTR(CLIENT_PORT,	  client_port,	char,		    -1)
 SESS_ATTR(XPORT_PRIV,	  xport_priv,	uintptr_t,	    sizeof(uintptr_t))
+SESS_ATTR(PROXY_ALPN,	  proxy_alpn,	char,		    -1)
+SESS_ATTR(PROXY_AUTHORITY, proxy_authority, char,	    -1)
+SESS_ATTR(PROXY_TLS_VERSION, proxy_tls_version, char,	    -1)
+SESS_ATTR(PROXY_TLS_CIPHER, proxy_tls_cipher, char,	    -1)
 #undef SESS_ATTR
 
 /*lint -restore */
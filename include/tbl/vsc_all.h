@@ -67,6 +67,30 @@ VSC_DO(SMF, smf, VSC_type_smf, "FILE STORAGE COUNTERS (SMF.*)")
   #undef VSC_DO_SMF
 VSC_DONE(SMF, smf, VSC_type_smf)
 
+VSC_DO(SMD, smd, VSC_type_smd, "DISK STORAGE COUNTERS (SMD.*)")
+  #define VSC_DO_SMD
+    #define VSC_FF VSC_F
+    #include "tbl/vsc_fields.h"
+    #undef VSC_FF
+  #undef VSC_DO_SMD
+VSC_DONE(SMD, smd, VSC_type_smd)
+
+VSC_DO(EXP, exp, VSC_type_exp, "EXPIRY SHARD COUNTERS (EXP.*)")
+  #define VSC_DO_EXP
+    #define VSC_FF VSC_F
+    #include "tbl/vsc_fields.h"
+    #undef VSC_FF
+  #undef VSC_DO_EXP
+VSC_DONE(EXP, exp, VSC_type_exp)
+
+VSC_DO(NUMA, numa, VSC_type_numa, "NUMA NODE COUNTERS (NUMA.*)")
+  #define VSC_DO_NUMA
+    #define VSC_FF VSC_F
+    #include "tbl/vsc_fields.h"
+    #undef VSC_FF
+  #undef VSC_DO_NUMA
+VSC_DONE(NUMA, numa, VSC_type_numa)
+
 VSC_DO(VBE, vbe, VSC_type_vbe, "BACKEND COUNTERS (VBE.*)")
   #define VSC_DO_VBE
     #define VSC_FF VSC_F
@@ -42,6 +42,13 @@ VSC_FF(uptime,			uint64_t, 0, 'c', 'd', info,
 	"How long the child process has been running."
 )
 
+VSC_FF(startup_ms,		uint64_t, 0, 'g', 'i', info,
+    "Child startup time (ms)",
+	"Milliseconds from the fork of the child process until it was"
+	" ready to accept connections, stevedores opened and the active"
+	" VCL loaded."
+)
+
 /*---------------------------------------------------------------------
  * Sessions
  */
@@ -63,6 +70,19 @@ VSC_FF(sess_fail,		uint64_t, 1, 'c', 'i', info,
 	" some resource like file descriptors."
 )
 
+VSC_FF(sess_tls,		uint64_t, 1, 'c', 'i', info,
+    "TLS handshakes",
+	"Count of sessions on a TLS listener handed to kernel TLS"
+	" after a successful handshake."
+)
+
+VSC_FF(sess_tls_fail,		uint64_t, 1, 'c', 'i', info,
+    "TLS handshake failures",
+	"Count of sessions on a TLS listener closed because the"
+	" handshake failed or timed out, or because kernel TLS could"
+	" not take over the connection."
+)
+
 /*---------------------------------------------------------------------*/
 
 VSC_FF(client_req_400,		uint64_t, 1, 'c', 'i', info,
@@ -90,6 +110,32 @@ VSC_FF(cache_hit,		uint64_t, 1, 'c', 'i', info,
 	" client without fetching it from a backend server."
 )
 
+VSC_FF(cache_hit_static,	uint64_t, 1, 'c', 'i', info,
+    "Static cache hits",
+	"Count of cache hits delivered from the pre-serialized headers of"
+	" an object fetched with beresp.do_static, without running"
+	" vcl_deliver."
+)
+
+VSC_FF(cache_refresh_ahead,	uint64_t, 1, 'c', 'i', info,
+    "Refresh-ahead fetches",
+	"Count of background fetches started by a hit near the end of the"
+	" TTL, see the refresh_ahead parameter."
+)
+
+VSC_FF(cache_admitted,		uint64_t, 1, 'c', 'i', info,
+    "Objects admitted to full storage",
+	"Count of fetched objects let into storage which has had to nuke"
+	" objects, at least as popular as the one it was to nuke next."
+	"  See the admission_sketch parameter."
+)
+
+VSC_FF(cache_not_admitted,	uint64_t, 1, 'c', 'i', info,
+    "Objects not admitted to full storage",
+	"Count of fetched objects made hit-for-miss rather than nuke a"
+	" more popular object.  See the admission_sketch parameter."
+)
+
 VSC_FF(cache_hitpass,		uint64_t, 1, 'c', 'i', info,
     "Cache hits for pass.",
 	"Count of hits for pass."
@@ -106,14 +152,26 @@ VSC_FF(cache_miss,		uint64_t, 1, 'c', 'i', info,
 	" backend before delivering it to the client."
 )
 
+VSC_FF(cache_vary_skip,		uint64_t, 1, 'c', 'i', diag,
+    "Variants skipped by hash",
+	"Count of object variants rejected during lookup by comparing"
+	" vary hashes, without looking at the object."
+)
+
 /*---------------------------------------------------------------------*/
 
-VSC_FF(backend_conn,		uint64_t, 0, 'c', 'i', info,
+VSC_FF(backend_conn,		uint64_t, 1, 'c', 'i', info,
     "Backend conn. success",
 	"How many backend connections have successfully been"
 	" established."
 )
 
+VSC_FF(backend_warm,		uint64_t, 1, 'c', 'i', info,
+    "Backend conn. pre-opened",
+	"How many backend connections have been opened ahead of demand,"
+	" see the backend_warm_conns parameter."
+)
+
 VSC_FF(backend_unhealthy,	uint64_t, 0, 'c', 'i', info,
     "Backend conn. not attempted",
 	""
@@ -129,12 +187,19 @@ VSC_FF(backend_fail,		uint64_t, 0, 'c', 'i', info,
 	""
 )
 
-VSC_FF(backend_reuse,		uint64_t, 0, 'c', 'i', info,
+VSC_FF(backend_reuse,		uint64_t, 1, 'c', 'i', info,
     "Backend conn. reuses",
 	"Count of backend connection reuses."
 	" This counter is increased whenever we reuse a recycled connection."
 )
 
+VSC_FF(backend_handoff,		uint64_t, 1, 'c', 'i', diag,
+    "Backend conn. handoffs",
+	"Count of backend connection reuses which did not have to go"
+	" through the waiter, because the connection was recycled"
+	" just before."
+)
+
 VSC_FF(backend_recycle,		uint64_t, 0, 'c', 'i', info,
     "Backend conn. recycles",
 	"Count of backend connection recycles."
@@ -149,6 +214,24 @@ VSC_FF(backend_retry,		uint64_t, 0, 'c', 'i', info,
 	""
 )
 
+VSC_FF(backend_breaker,		uint64_t, 0, 'c', 'i', info,
+    "Backend circuit breaker trips",
+	"How many times a backend was marked sick after"
+	" backend_breaker_fails failed fetches, or after a failed trial"
+	" fetch."
+)
+
+VSC_FF(backend_hedge,		uint64_t, 0, 'c', 'i', info,
+    "Backend hedged requests",
+	"Fetches which were sent to a second backend because the first"
+	" was slow to answer."
+)
+
+VSC_FF(backend_hedge_won,	uint64_t, 0, 'c', 'i', info,
+    "Backend hedged requests won",
+	"Hedged fetches where the second backend answered first."
+)
+
 /*---------------------------------------------------------------------
  * Backend fetch statistics
  */
@@ -208,6 +291,30 @@ VSC_FF(fetch_no_thread,		uint64_t, 1, 'c', 'i', info,
 	"beresp fetch failed, no thread available."
 )
 
+VSC_FF(fetch_parked,		uint64_t, 1, 'c', 'i', info,
+    "Fetches parked",
+	"How many times a fetch gave up its thread while waiting for the"
+	" backend, see the fetch_park parameter."
+)
+
+VSC_FF(fetch_parked_connect,	uint64_t, 1, 'c', 'i', info,
+    "Fetches parked connecting",
+	"How many times a fetch gave up its thread while connecting to the"
+	" backend, see the fetch_park parameter."
+)
+
+VSC_FF(deliver_parked,		uint64_t, 1, 'c', 'i', info,
+    "Deliveries parked",
+	"How many times a delivery gave up its thread while waiting for the"
+	" client to take more data, see the deliver_park parameter."
+)
+
+VSC_FF(h2_parked,		uint64_t, 1, 'c', 'i', info,
+    "HTTP/2 sessions parked",
+	"How many times an idle HTTP/2 session gave up its thread to the"
+	" waiter, see the h2_park parameter."
+)
+
 /*---------------------------------------------------------------------
  * Pools, threads, and sessions
  *    see: cache_pool.c
@@ -238,6 +345,19 @@ VSC_FF(threads_created,		uint64_t, 0, 'c', 'i', info,
 	"Total number of threads created in all pools."
 )
 
+VSC_FF(threads_batched,		uint64_t, 0, 'c', 'i', info,
+    "Threads created ahead",
+	"Number of threads created in a batch beyond the first one."
+	" See also parameter thread_pool_predict."
+)
+
+VSC_FF(threads_kept,		uint64_t, 0, 'c', 'i', info,
+    "Idle threads kept",
+	"Number of times an idle thread was due to be destroyed, but kept"
+	" because the pool was recently busy."
+	" See also parameter thread_pool_predict."
+)
+
 VSC_FF(threads_destroyed,	uint64_t, 0, 'c', 'i', info,
     "Threads destroyed",
 	"Total number of threads destroyed in all pools."
@@ -257,6 +377,56 @@ VSC_FF(thread_queue_len,		uint64_t, 0, 'g', 'i', info,
 	" See also parameter thread_queue_limit."
 )
 
+VSC_FF(thread_steal,		uint64_t, 1, 'c', 'i', info,
+    "Tasks taken from other pools",
+	"Number of queued tasks an idle worker thread took from another"
+	" thread pool instead of going to sleep."
+	" See also parameter thread_pool_steal."
+)
+
+VSC_FF(queued_high,		uint64_t, 1, 'c', 'i', info,
+    "High priority tasks queued",
+	"Number of high priority client tasks which had to wait for a"
+	" thread. See also VCL variable req.priority."
+)
+
+VSC_FF(queue_wait_high,		uint64_t, 1, 'c', 'i', info,
+    "High priority queue wait",
+	"Microseconds high priority client tasks spent waiting for a"
+	" thread, divide by queued_high for the average."
+)
+
+VSC_FF(queued_normal,		uint64_t, 1, 'c', 'i', info,
+    "Normal priority tasks queued",
+	"Number of normal priority client tasks which had to wait for a"
+	" thread."
+)
+
+VSC_FF(queue_wait_normal,	uint64_t, 1, 'c', 'i', info,
+    "Normal priority queue wait",
+	"Microseconds normal priority client tasks spent waiting for a"
+	" thread, divide by queued_normal for the average."
+)
+
+VSC_FF(queued_low,		uint64_t, 1, 'c', 'i', info,
+    "Low priority tasks queued",
+	"Number of low priority client tasks which had to wait for a"
+	" thread, including HTTP/2 streams queued behind more urgent"
+	" ones."
+)
+
+VSC_FF(queue_wait_low,		uint64_t, 1, 'c', 'i', info,
+    "Low priority queue wait",
+	"Microseconds low priority client tasks spent waiting for a"
+	" thread, divide by queued_low for the average."
+)
+
+VSC_FF(queued_fair,		uint64_t, 1, 'c', 'i', info,
+    "Client tasks taken out of turn",
+	"Client tasks taken off a queue ahead of older ones from other"
+	" clients, because it was their turn, see thread_queue_fair."
+)
+
 VSC_FF(busy_sleep,		uint64_t, 1, 'c', 'i', info,
     "Number of requests sent to sleep on busy objhdr",
 	"Number of requests sent to sleep without a worker thread because"
@@ -269,6 +439,23 @@ VSC_FF(busy_wakeup,		uint64_t, 1, 'c', 'i', info,
 	" rescheduled."
 )
 
+VSC_FF(busy_handover,		uint64_t, 1, 'c', 'i', info,
+    "Number of requests handed the object they slept on",
+	"Number of requests woken with a reference to the object they"
+	" waited for, which skip the second lookup."
+)
+
+VSC_FF(busy_rush,		uint64_t, 1, 'c', 'i', diag,
+    "Number of busy objhdr rushes",
+	"Number of times requests were taken off a busy object sleep"
+	" list."
+)
+
+VSC_FF(n_waitinglist,		uint64_t, 1, 'g', 'i', info,
+    "Number of requests on waiting lists",
+	"Number of requests currently sleeping on busy objects."
+)
+
 VSC_FF(busy_killed,		uint64_t, 1, 'c', 'i', info,
     "Number of requests killed after sleep on busy objhdr",
 	"Number of requests killed from the busy object sleep list"
@@ -287,6 +474,13 @@ VSC_FF(sess_dropped,		uint64_t, 0, 'c', 'i', info,
 	" long already. See also parameter thread_queue_limit."
 )
 
+VSC_FF(sess_shed,		uint64_t, 0, 'c', 'i', info,
+    "Sessions dropped for queue delay",
+	"Number of times session was dropped because work had been"
+	" waiting in the queue for too long."
+	" See also parameter thread_queue_target."
+)
+
 /*---------------------------------------------------------------------*/
 
 VSC_FF(n_object,			uint64_t, 1, 'g', 'i', info,
@@ -295,11 +489,79 @@ VSC_FF(n_object,			uint64_t, 1, 'g', 'i', info,
 	" in the cache."
 )
 
+VSC_FF(obj_inline,			uint64_t, 1, 'c', 'i', diag,
+    "Bodies stored with their object",
+	"Number of object bodies which went into the allocation of the"
+	" object itself, rather than into storage of their own."
+)
+
+VSC_FF(sml_packed,			uint64_t, 1, 'c', 'i', diag,
+    "Bodies packed",
+	"Number of object bodies which were compressed in storage after"
+	" being idle, see the pack_idle parameter."
+)
+
+VSC_FF(sml_unpacked,		uint64_t, 1, 'c', 'i', diag,
+    "Packed bodies delivered",
+	"Number of times a packed body was decompressed for delivery."
+)
+
+VSC_FF(sml_pack_saved,		uint64_t, 0, 'g', 'B', info,
+    "Bytes saved by packing",
+	"Bytes of storage which the packed bodies do not take up."
+)
+
+VSC_FF(sml_dedup,			uint64_t, 1, 'c', 'i', diag,
+    "Bodies deduplicated",
+	"Number of object bodies which were found to be the same as a"
+	" body already in storage, and now share its storage segments,"
+	" see the body_dedup parameter."
+)
+
+VSC_FF(sml_dedup_saved,		uint64_t, 0, 'g', 'B', info,
+    "Bytes saved by deduplication",
+	"Bytes of object bodies which share another object's storage."
+)
+
+VSC_FF(snapshot_written,		uint64_t, 1, 'c', 'i', info,
+    "Objects written to snapshots",
+	"Number of objects written to snapshot files by storage.snapshot."
+)
+
+VSC_FF(snapshot_loaded,		uint64_t, 1, 'c', 'i', info,
+    "Objects loaded from snapshots",
+	"Number of objects loaded from snapshot files when the child"
+	" started."
+)
+
+VSC_FF(hdict_entries,		uint64_t, 0, 'g', 'i', diag,
+    "Header dictionary entries",
+	"Number of header lines in the dictionary, see the http_hdr_dict"
+	" parameter."
+)
+
+VSC_FF(hdict_refs,			uint64_t, 0, 'c', 'i', diag,
+    "Header dictionary references",
+	"Number of header lines stored as a reference into the"
+	" dictionary instead of as a copy of their own."
+)
+
 VSC_FF(n_vampireobject,		uint64_t, 1, 'g', 'i', diag,
     "unresurrected objects",
 	"Number of unresurrected objects"
 )
 
+VSC_FF(silo_seg_pending,		uint64_t, 1, 'g', 'i', diag,
+    "Persistent segments to load",
+	"Number of persistent silo segments which still have to be loaded"
+	" at startup."
+)
+
+VSC_FF(silo_seg_loaded,		uint64_t, 1, 'c', 'i', diag,
+    "Persistent segments loaded",
+	"Number of persistent silo segments loaded since startup."
+)
+
 VSC_FF(n_objectcore,		uint64_t, 1, 'g', 'i', info,
     "objectcore structs made",
 	"Approximate number of object metadata elements in the cache."
@@ -317,7 +579,13 @@ VSC_FF(n_backend,		uint64_t, 0, 'g', 'i', info,
 	"Number of backends known to us."
 )
 
-VSC_FF(n_expired,		uint64_t, 0, 'g', 'i', info,
+VSC_FF(n_probe,			uint64_t, 0, 'g', 'i', info,
+    "Number of health probes",
+	"Number of distinct health probes.  Backends with the same"
+	" address and the same probe share one."
+)
+
+VSC_FF(n_expired,		uint64_t, 1, 'g', 'i', info,
     "Number of expired objects",
 	"Number of objects that expired from cache"
 	" because of old age."
@@ -334,11 +602,90 @@ VSC_FF(n_lru_moved,		uint64_t, 0, 'g', 'i', diag,
 	"Number of move operations done on the LRU list."
 )
 
+VSC_FF(transient_pass,		uint64_t, 0, 'g', 'B', info,
+    "Transient bytes for pass",
+	"Bytes of Transient storage held by uncacheable (pass, hit-for-pass)"
+	" objects."
+)
+
+VSC_FF(transient_shortlived,	uint64_t, 0, 'g', 'B', info,
+    "Transient bytes for shortlived",
+	"Bytes of Transient storage held by objects with a lifetime below"
+	" the shortlived parameter, or which could not be stored elsewhere."
+)
+
+VSC_FF(transient_synth,		uint64_t, 0, 'g', 'B', info,
+    "Transient bytes for synth",
+	"Bytes of Transient storage held by synthetic responses from"
+	" vcl_synth and vcl_backend_error."
+)
+
+VSC_FF(transient_reqbody,	uint64_t, 0, 'g', 'B', info,
+    "Transient bytes for req.body",
+	"Bytes of Transient storage held by cached request bodies."
+)
+
+VSC_FF(transient_waits,		uint64_t, 0, 'c', 'i', diag,
+    "Transient allocation waits",
+	"Number of times an allocation found Transient storage full and"
+	" waited for space, see the transient_wait parameter."
+)
+
 VSC_FF(losthdr,			uint64_t, 0, 'c', 'i', info,
     "HTTP header overflows",
 	""
 )
 
+VSC_FF(ws_client_25,		uint64_t, 0, 'c', 'i', diag,
+    "Client workspaces high water in first quarter",
+	"Number of client workspaces released with their high water mark in"
+	" the first quarter of the workspace."
+)
+
+VSC_FF(ws_client_50,		uint64_t, 0, 'c', 'i', diag,
+    "Client workspaces high water in second quarter",
+	"Number of client workspaces released with their high water mark in"
+	" the second quarter of the workspace."
+)
+
+VSC_FF(ws_client_75,		uint64_t, 0, 'c', 'i', diag,
+    "Client workspaces high water in third quarter",
+	"Number of client workspaces released with their high water mark in"
+	" the third quarter of the workspace."
+)
+
+VSC_FF(ws_client_100,		uint64_t, 0, 'c', 'i', diag,
+    "Client workspaces high water in last quarter",
+	"Number of client workspaces released with their high water mark in"
+	" the last quarter of the workspace, overflowed workspaces"
+	" included."
+)
+
+VSC_FF(ws_backend_25,		uint64_t, 0, 'c', 'i', diag,
+    "Backend workspaces high water in first quarter",
+	"Number of backend workspaces released with their high water mark in"
+	" the first quarter of the workspace."
+)
+
+VSC_FF(ws_backend_50,		uint64_t, 0, 'c', 'i', diag,
+    "Backend workspaces high water in second quarter",
+	"Number of backend workspaces released with their high water mark in"
+	" the second quarter of the workspace."
+)
+
+VSC_FF(ws_backend_75,		uint64_t, 0, 'c', 'i', diag,
+    "Backend workspaces high water in third quarter",
+	"Number of backend workspaces released with their high water mark in"
+	" the third quarter of the workspace."
+)
+
+VSC_FF(ws_backend_100,		uint64_t, 0, 'c', 'i', diag,
+    "Backend workspaces high water in last quarter",
+	"Number of backend workspaces released with their high water mark in"
+	" the last quarter of the workspace, overflowed workspaces"
+	" included."
+)
+
 VSC_FF(s_sess,			uint64_t, 1, 'c', 'i', info,
     "Total sessions seen",
 	""
@@ -369,6 +716,12 @@ VSC_FF(s_synth,			uint64_t, 1, 'c', 'i', info,
 	""
 )
 
+VSC_FF(s_synth_hit,		uint64_t, 1, 'c', 'i', info,
+    "Synthetic responses reused",
+	"Count of synthetic responses delivered from a response kept by"
+	" setting resp.ttl in vcl_synth, without running vcl_synth."
+)
+
 VSC_FF(s_req_hdrbytes,		uint64_t, 1, 'c', 'B', info,
     "Request header bytes",
 	"Total request header bytes received"
@@ -466,6 +819,12 @@ VSC_FF(shm_cont,			uint64_t, 0, 'c', 'i', diag,
 	""
 )
 
+VSC_FF(shm_summaries,		uint64_t, 0, 'c', 'i', diag,
+    "SHM transactions logged as summary",
+	"Transactions left out by vsl_sample, of which only a summary"
+	" was logged."
+)
+
 VSC_FF(shm_cycles,		uint64_t, 0, 'c', 'i', diag,
     "SHM cycles through buffer",
 	""
@@ -500,6 +859,20 @@ VSC_FF(vcl_fail,		uint64_t, 1, 'c', 'i', info,
 	"Count of failures which prevented VCL from completing."
 )
 
+VSC_FF(regex_jit_fallback,	uint64_t, 1, 'c', 'i', diag,
+    "Regexp JIT fallbacks",
+	"Count of regular expression matches which ran out of JIT stack"
+	" and were retried with the interpreter."
+	" If this counter is not zero, consider increasing the"
+	" pcre_jit_stack parameter."
+)
+
+VSC_FF(regex_limit,		uint64_t, 1, 'c', 'i', diag,
+    "Regexp match limits",
+	"Count of regular expression matches which were aborted by the"
+	" pcre_match_limit or pcre_match_limit_recursion parameters."
+)
+
 /*--------------------------------------------------------------------*/
 
 VSC_FF(bans,			uint64_t, 0, 'g', 'i', info,
@@ -595,6 +968,35 @@ VSC_FF(bans_persisted_fragmentation, uint64_t, 0, 'g', 'B', diag,
 	" completed bans in the persistent ban lists."
 )
 
+VSC_FF(bans_repl_sent,		uint64_t, 0, 'c', 'i', diag,
+    "Ban batches sent to peers",
+	"Number of batches of bans delivered to the peers in the"
+	" ban_replicate parameter."
+)
+
+VSC_FF(bans_repl_failed,		uint64_t, 0, 'c', 'i', diag,
+    "Ban batches which failed",
+	"Number of times a batch of bans could not be delivered to a"
+	" peer.  The bans are sent again with the next batch."
+)
+
+VSC_FF(bans_repl_dropped,	uint64_t, 0, 'c', 'i', diag,
+    "Bans dropped for peers",
+	"Number of bans not sent to a peer, because too many of them"
+	" were waiting for it."
+)
+
+VSC_FF(bans_repl_recv,		uint64_t, 0, 'c', 'i', diag,
+    "Bans received from peers",
+	"Number of bans passed to std.ban_replay()."
+)
+
+VSC_FF(bans_repl_dups,		uint64_t, 0, 'c', 'i', diag,
+    "Bans from peers already in place",
+	"Number of bans from peers which were not added, because an"
+	" identical ban had been added here since."
+)
+
 /*--------------------------------------------------------------------*/
 
 VSC_FF(n_purges,			uint64_t, 0, 'g', 'i', info,
@@ -607,14 +1009,36 @@ VSC_FF(n_obj_purged,		uint64_t, 0, 'g', 'i', info,
 	""
 )
 
+VSC_FF(n_tag_key,		uint64_t, 1, 'g', 'i', info,
+    "Number of surrogate keys",
+	"Number of distinct keys taken from the tag_header of the objects"
+	" in the cache."
+)
+
+VSC_FF(n_tag_ref,		uint64_t, 1, 'g', 'i', info,
+    "Number of object surrogate keys",
+	"Number of keys of all the objects in the cache, an object with"
+	" three keys counts three times."
+)
+
+VSC_FF(tag_purge,		uint64_t, 1, 'c', 'i', info,
+    "Surrogate key purges",
+	"Number of keys purged with tag.purge or std.tag_purge()."
+)
+
+VSC_FF(tag_purged,		uint64_t, 1, 'c', 'i', info,
+    "Objects purged by surrogate key",
+	""
+)
+
 /*--------------------------------------------------------------------*/
 
-VSC_FF(exp_mailed,		uint64_t, 0, 'c', 'i', diag,
+VSC_FF(exp_mailed,		uint64_t, 1, 'c', 'i', diag,
     "Number of objects mailed to expiry thread",
 	"Number of objects mailed to expiry thread for handling."
 )
 
-VSC_FF(exp_received,		uint64_t, 0, 'c', 'i', diag,
+VSC_FF(exp_received,		uint64_t, 1, 'c', 'i', diag,
     "Number of objects received by expiry thread",
 	"Number of objects received by expiry thread for handling."
 )
@@ -626,16 +1050,28 @@ VSC_FF(hcb_nolock,		uint64_t, 1, 'c', 'i', debug,
 	""
 )
 
-VSC_FF(hcb_lock,			uint64_t, 0, 'c', 'i', debug,
+VSC_FF(hcb_lock,			uint64_t, 1, 'c', 'i', debug,
     "HCB Lookups with lock",
 	""
 )
 
-VSC_FF(hcb_insert,		uint64_t, 0, 'c', 'i', debug,
+VSC_FF(hcb_insert,		uint64_t, 1, 'c', 'i', debug,
     "HCB Inserts",
 	""
 )
 
+VSC_FF(hcb_retry,		uint64_t, 1, 'c', 'i', debug,
+    "HCB Lookup retries",
+	"Count of lookups which found an objhead going away and had to"
+	" retry with the lock held."
+)
+
+VSC_FF(hcb_contended,		uint64_t, 1, 'c', 'i', debug,
+    "HCB Contended locks",
+	"Count of locked lookups which had to wait for the lock of their"
+	" subtree."
+)
+
 /*--------------------------------------------------------------------*/
 
 VSC_FF(esi_errors,		uint64_t, 0, 'c', 'i', diag,
@@ -648,6 +1084,35 @@ VSC_FF(esi_warnings,		uint64_t, 0, 'c', 'i', diag,
 	""
 )
 
+VSC_FF(esi_prefetch,		uint64_t, 1, 'c', 'i', info,
+    "ESI includes prefetched",
+	"ESI includes looked up ahead of delivery, see the esi_prefetch"
+	" parameter."
+)
+
+VSC_FF(esi_memo,		uint64_t, 1, 'c', 'i', info,
+    "ESI includes reused",
+	"ESI includes delivered from an earlier identical include of the"
+	" same page, see the esi_memo parameter."
+)
+
+VSC_FF(cache_warm,		uint64_t, 1, 'c', 'i', info,
+    "Cache warming requests",
+	"Requests run from a URL list by the cache.warm command."
+)
+
+VSC_FF(cache_warm_hit,		uint64_t, 1, 'c', 'i', info,
+    "Cache warming hits",
+	"Cache warming requests which found the object in cache already."
+)
+
+VSC_FF(esi_reuse,		uint64_t, 1, 'c', 'i', info,
+    "ESI parses reused",
+	"Refetched ESI objects whose body was identical to the stale"
+	" object, and which reused its parsed ESI instructions, see the"
+	" esi_reuse parameter."
+)
+
 /*--------------------------------------------------------------------*/
 
 VSC_FF(vmods,			uint64_t, 0, 'g', 'i', info,
@@ -667,6 +1132,18 @@ VSC_FF(n_gunzip,			uint64_t, 0, 'c', 'i', info,
 	""
 )
 
+VSC_FF(n_gzip_parallel,		uint64_t, 0, 'c', 'i', info,
+    "Parallel gzip operations",
+	"Gzip operations done in blocks on helper threads, see the"
+	" gzip_parallel parameter."
+)
+
+VSC_FF(n_gzip_reused,			uint64_t, 0, 'c', 'i', diag,
+    "Reused gzip states",
+	"Gzip, gunzip and test gunzip operations which reused a finished"
+	" state, see the gzip_pool parameter."
+)
+
 VSC_FF(n_test_gunzip,			uint64_t, 0, 'c', 'i', info,
     "Test gunzip operations",
 	"Those operations occur when Varnish receives a compressed"
@@ -674,6 +1151,28 @@ VSC_FF(n_test_gunzip,			uint64_t, 0, 'c', 'i', info,
 	" stream while it's inserted in storage."
 )
 
+VSC_FF(n_gunzip_variant,		uint64_t, 0, 'c', 'i', info,
+    "Identity variants",
+	"Identity variants made of gzip'ed objects, see the"
+	" http_gzip_variants parameter."
+)
+
+VSC_FF(n_gzip_deferred,			uint64_t, 0, 'c', 'i', info,
+    "Deferred gzip copies",
+	"Objects replaced by a gzip'ed copy made after the fetch, see the"
+	" gzip_deferred parameter."
+)
+
+VSC_FF(n_brotli,			uint64_t, 0, 'c', 'i', info,
+    "Brotli operations",
+	""
+)
+
+VSC_FF(n_unbrotli,			uint64_t, 0, 'c', 'i', info,
+    "Unbrotli operations",
+	""
+)
+
 /*--------------------------------------------------------------------*/
 
 VSC_FF(vsm_free,			uint64_t, 0, 'g', 'B', diag,
@@ -713,6 +1212,20 @@ VSC_FF(vsm_overflowed,		uint64_t, 0, 'c', 'B', diag,
 	" increasing the runtime variable vsm_space."
 )
 
+/*---------------------------------------------------------------------
+ * Latency histograms, see include/tbl/vsc_lat.h
+ */
+
+#define VSC_LAT_B(n, d, i, b, s)					\
+VSC_FF(lat_##n##_##b,		uint64_t, 0, 'c', 'i', diag,		\
+    d " up to " #b,							\
+	"Number of events which took at most " #b " and longer than"	\
+	" the bound of the previous bucket."				\
+)
+#define VSC_LAT(n, d)	VSC_LAT_BUCKETS(VSC_LAT_B, n, d)
+#include "tbl/vsc_lat.h"
+#undef VSC_LAT_B
+
 #undef VSC_FF
 
 /*lint -restore */
@@ -124,13 +124,50 @@ VSC_FF(locks,			uint64_t, 0, 'c', 'i', debug,
 	""
 )
 
+VSC_FF(contended,		uint64_t, 0, 'c', 'i', debug,
+    "Contended lock operations",
+	"Lock operations which found the lock held and had to wait."
+)
+
+VSC_FF(spun,			uint64_t, 0, 'c', 'i', debug,
+    "Contended locks taken by spinning",
+	"Contended lock operations which got the lock while spinning,"
+	" without going to sleep, see the lock_spin parameter."
+)
+
+VSC_FF(trylock_fail,		uint64_t, 0, 'c', 'i', debug,
+    "Failed trylock operations",
+	""
+)
+
+VSC_FF(wait_us,			uint64_t, 0, 'c', 'i', debug,
+    "Time waited for the lock (us)",
+	"Only counted while the lck_profile debug bit is set."
+)
+
+VSC_FF(hold_us,			uint64_t, 0, 'c', 'i', debug,
+    "Time the lock was held (us)",
+	"Only counted while the lck_profile debug bit is set."
+)
+
+#include "tbl/vsc_lat.h"
+#define VSC_LCK_WAIT(n, d, i, b, s)					\
+VSC_FF(wait_##b,		uint64_t, 0, 'c', 'i', debug,		\
+    "Lock waits up to " #b,						\
+	"Number of contended lock operations which waited at most " #b	\
+	" and longer than the bound of the previous bucket."		\
+	" Only counted while the lck_profile debug bit is set."		\
+)
+VSC_LAT_BUCKETS(VSC_LCK_WAIT, , )
+#undef VSC_LCK_WAIT
+
 #endif
 
 /**********************************************************************
  * All Stevedores support these counters
  */
 
-#if defined(VSC_DO_SMA) || defined (VSC_DO_SMF)
+#if defined(VSC_DO_SMA) || defined (VSC_DO_SMF) || defined (VSC_DO_SMD)
 VSC_FF(c_req,			uint64_t, 0, 'c', 'i', info,
     "Allocator requests",
 	"Number of times the storage has been asked to provide a storage segment."
@@ -191,6 +228,138 @@ VSC_FF(g_smf_large,		uint64_t, 0, 'g', 'i', info,
 	""
 )
 
+VSC_FF(g_smf_largest,		uint64_t, 0, 'g', 'B', info,
+    "Largest free range",
+	"Number of bytes in the largest contiguous free range."
+	" Allocations larger than this fail no matter how much space"
+	" is available, the further it is below g_space the more"
+	" fragmented the storage is."
+)
+
+#endif
+
+/**********************************************************************/
+
+#ifdef VSC_DO_SMD
+VSC_FF(g_hot,			uint64_t, 0, 'g', 'B', info,
+    "Bytes in memory",
+	"Number of bytes of the storage held in memory, segments being"
+	" filled and written included."
+)
+
+VSC_FF(g_hot_protected,		uint64_t, 0, 'g', 'B', info,
+    "Bytes in memory protected",
+	"Number of bytes in memory belonging to popular objects, which"
+	" are evicted last."
+)
+
+VSC_FF(c_promote,		uint64_t, 0, 'c', 'i', diag,
+    "Segments promoted",
+	"Number of times a segment in memory was put on the protected"
+	" list, because its object has been hit often enough."
+)
+
+VSC_FF(c_demote,		uint64_t, 0, 'c', 'i', diag,
+    "Segments demoted",
+	"Number of times a segment was moved from the protected list"
+	" back to probation to keep the protected list in bounds."
+)
+
+VSC_FF(c_evict,			uint64_t, 0, 'c', 'i', info,
+    "Segments evicted",
+	"Number of storage segments dropped from memory, to be read"
+	" from disk when next delivered."
+)
+
+VSC_FF(c_write,			uint64_t, 0, 'c', 'i', info,
+    "Segments written",
+	"Number of storage segments written to disk."
+)
+
+VSC_FF(c_write_fail,		uint64_t, 0, 'c', 'i', info,
+    "Segment write failures",
+	"Number of storage segments which could not be written to disk"
+	" and stay in memory."
+)
+
+VSC_FF(c_read,			uint64_t, 0, 'c', 'i', info,
+    "Segments read",
+	"Number of storage segments read back from disk."
+)
+
+VSC_FF(c_read_fail,		uint64_t, 0, 'c', 'i', info,
+    "Segment read failures",
+	"Number of storage segments which could not be read from disk,"
+	" failing the delivery."
+)
+
+VSC_FF(c_readahead,		uint64_t, 0, 'c', 'i', diag,
+    "Segments read ahead",
+	"Number of reads started for the segment after the one being"
+	" delivered."
+)
+
+VSC_FF(c_wait,			uint64_t, 0, 'c', 'i', diag,
+    "Waits for reads",
+	"Number of times a delivery waited for a segment to be read."
+)
+#endif
+
+/**********************************************************************/
+
+#ifdef VSC_DO_EXP
+
+VSC_FF(inbox,			uint64_t, 0, 'g', 'i', diag,
+    "Objects in inbox",
+	"Number of objects waiting in the inbox of this expiry shard."
+)
+
+VSC_FF(heap,			uint64_t, 0, 'g', 'i', diag,
+    "Objects in heap",
+	"Number of objects in the binary heap of this expiry shard."
+)
+
+VSC_FF(mailed,			uint64_t, 0, 'c', 'i', diag,
+    "Objects mailed",
+	"Count of objects mailed to this expiry shard."
+)
+
+VSC_FF(received,		uint64_t, 0, 'c', 'i', diag,
+    "Objects received",
+	"Count of objects received from the inbox by this expiry shard."
+)
+
+VSC_FF(expired,			uint64_t, 0, 'c', 'i', diag,
+    "Objects expired",
+	"Count of objects expired by this expiry shard."
+)
+
+#endif
+
+/**********************************************************************/
+
+#ifdef VSC_DO_NUMA
+
+VSC_FF(pools,			uint64_t, 0, 'g', 'i', info,
+    "Thread pools",
+	"Number of thread pools bound to this node."
+)
+
+VSC_FF(sess,			uint64_t, 0, 'c', 'i', info,
+    "Sessions accepted",
+	"Count of sessions accepted by the pools of this node."
+)
+
+VSC_FF(req,			uint64_t, 0, 'c', 'i', info,
+    "Client requests",
+	"Count of client requests handled by the pools of this node."
+)
+
+VSC_FF(fetch,			uint64_t, 0, 'c', 'i', info,
+    "Backend fetches",
+	"Count of backend fetches done by the pools of this node."
+)
+
 #endif
 
 /**********************************************************************/
@@ -249,6 +418,30 @@ VSC_FF(req,			uint64_t, 0, 'c', 'i', info,
 	""
 )
 
+VSC_FF(wait,			uint64_t, 0, 'g', 'i', info,
+    "Fetches waiting for a connection",
+	"Fetches waiting for one of the max_connections, see the"
+	" backend_wait_timeout parameter."
+)
+
+VSC_FF(wait_done,		uint64_t, 0, 'c', 'i', info,
+    "Fetches which got a connection after waiting",
+	""
+)
+
+VSC_FF(wait_timeout,		uint64_t, 0, 'c', 'i', info,
+    "Fetches which waited in vain",
+	"Fetches which did not get a connection within"
+	" backend_wait_timeout, they are counted in MAIN.backend_busy"
+	" as well."
+)
+
+VSC_FF(wait_usec,		uint64_t, 0, 'c', 'i', info,
+    "Microseconds waited for a connection",
+	"Total time fetches waited for a connection, divide by"
+	" wait_done plus wait_timeout for the average."
+)
+
 #endif
 
 /**********************************************************************/
@@ -309,6 +502,18 @@ VSC_FF(randry,			uint64_t, 0, 'c', 'i', debug,
 	""
 )
 
+VSC_FF(mag_hit,			uint64_t, 0, 'c', 'i', debug,
+    "Served by a thread magazine",
+	"Allocations and frees done without the pool lock, from and to"
+	" the magazine of a worker thread."
+)
+
+VSC_FF(mag_miss,		uint64_t, 0, 'c', 'i', debug,
+    "Thread magazine refills or drains",
+	"Allocations which found the worker thread's magazine empty, and"
+	" frees which found it full, and had to go to the pool."
+)
+
 #endif
 
 #undef VSC_FF
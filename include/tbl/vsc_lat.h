@@ -0,0 +1,80 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Latency histograms kept by the worker threads.
+ *
+ * VSC_LAT(name, description) declares a histogram, the buckets of which
+ * appear in the MAIN counters as lat_<name>_<bound>, each counting the
+ * events which took longer than the previous bound and at most <bound>.
+ *
+ * VSC_LAT_BUCKETS(X, name, description) calls
+ *    X(name, description, index, bound, seconds)
+ * for each bucket.
+ */
+
+/*lint -save -e525 -e539 */
+
+#ifndef VSC_LAT_BUCKETS
+#define VSC_LAT_NBUCKET 26
+#define VSC_LAT_BUCKETS(X, n, d) \
+	X(n, d,  0, 1us, 1e-6) \
+	X(n, d,  1, 2us, 2e-6) \
+	X(n, d,  2, 5us, 5e-6) \
+	X(n, d,  3, 10us, 1e-5) \
+	X(n, d,  4, 20us, 2e-5) \
+	X(n, d,  5, 50us, 5e-5) \
+	X(n, d,  6, 100us, 1e-4) \
+	X(n, d,  7, 200us, 2e-4) \
+	X(n, d,  8, 500us, 5e-4) \
+	X(n, d,  9, 1ms, 1e-3) \
+	X(n, d, 10, 2ms, 2e-3) \
+	X(n, d, 11, 5ms, 5e-3) \
+	X(n, d, 12, 10ms, 1e-2) \
+	X(n, d, 13, 20ms, 2e-2) \
+	X(n, d, 14, 50ms, 5e-2) \
+	X(n, d, 15, 100ms, 1e-1) \
+	X(n, d, 16, 200ms, 2e-1) \
+	X(n, d, 17, 500ms, 5e-1) \
+	X(n, d, 18, 1s, 1) \
+	X(n, d, 19, 2s, 2) \
+	X(n, d, 20, 5s, 5) \
+	X(n, d, 21, 10s, 10) \
+	X(n, d, 22, 20s, 20) \
+	X(n, d, 23, 50s, 50) \
+	X(n, d, 24, 100s, 100) \
+	X(n, d, 25, inf, INFINITY)
+#endif
+
+#ifdef VSC_LAT
+VSC_LAT(lookup,	"Cache lookup time")
+VSC_LAT(connect,	"Backend connection time")
+VSC_LAT(ttfb,	"Backend time to first byte")
+VSC_LAT(resp,	"Client response time")
+VSC_LAT(esi,	"ESI include time")
+#undef VSC_LAT
+#endif
+
+/*lint -restore */
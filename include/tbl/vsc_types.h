@@ -60,6 +60,18 @@ VSC_TYPE_F(smf,		"SMF",		"SMF",		"Storage file",
     "File storage counters"
 )
 
+VSC_TYPE_F(smd,		"SMD",		"SMD",		"Storage disk",
+    "Disk storage counters"
+)
+
+VSC_TYPE_F(exp,		"EXP",		"EXP",		"Expiry",
+    "Expiry shard counters"
+)
+
+VSC_TYPE_F(numa,	"NUMA",		"NUMA",		"NUMA node",
+    "NUMA node counters"
+)
+
 VSC_TYPE_F(vbe,		"VBE",		"VBE",		"Backend",
     "Backend counters"
 )
@@ -68,6 +80,10 @@ VSC_TYPE_F(lck,		"LCK",		"LCK",		"Lock",
     "Mutex lock counters"
 )
 
+VSC_TYPE_F(vcl,		"VCL",		"VCL",		"VCL",
+    "Counters declared in VCL"
+)
+
 #undef VSC_TYPE_F
 
 /*lint -restore */
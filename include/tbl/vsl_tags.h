@@ -219,7 +219,7 @@ SLTM(TTL, 0, "TTL set on object",
 	"\t|  |  |  +------------------ Keep\n"
 	"\t|  |  +--------------------- Grace\n"
 	"\t|  +------------------------ TTL\n"
-	"\t+--------------------------- \"RFC\" or \"VCL\"\n"
+	"\t+--------------------------- \"RFC\", \"VCL\" or \"Jitter\"\n"
 	"\n"
 	"The last four fields are only present in \"RFC\" headers.\n\n"
 	"Examples::\n\n"
@@ -541,6 +541,51 @@ SLTM(H2TxBody, 0, "Transmitted HTTP2 frame body",
 	"Binary data"
 )
 
+SLTM(VCL_regex, 0, "VCL regex bundle match",
+	"When VCC has combined several regular expression matches against"
+	" the same variable into one, this logs which of them matched.\n\n"
+	"The format is::\n\n"
+	"\t%d\n"
+	"\t|\n"
+	"\t+- Position of the expression, counting from 1\n"
+	"\n"
+	"Where several match, the one matching earliest in the subject is"
+	" reported.\n\n"
+)
+
+SLTM(Brotli, 0, "Brotli (de)compression performed on object",
+	"A Brotli record is emitted for each instance of brotli"
+	" compression or decompression work performed.\n\n"
+	"The format is::\n\n"
+	"\t%c %c %c %d %d\n"
+	"\t|  |  |  |  |\n"
+	"\t|  |  |  |  +- Bytes output\n"
+	"\t|  |  |  +---- Bytes input\n"
+	"\t|  |  +------- Always '-'\n"
+	"\t|  +---------- 'F': Fetch, 'D': Deliver\n"
+	"\t+------------- 'B': Brotli, 'U': Unbrotli\n"
+	"\n"
+)
+
+SLTM(Span, 0, "Trace span",
+	"Written when a transaction picked by the vsl_trace or"
+	" vsl_trace_slow parameters ends: one for the transaction itself,"
+	" and one for each step timed within it.\n\n"
+	"Span records are not part of any transaction, so readers find"
+	" them in raw mode without having to group the log.\n\n"
+	"The format is::\n\n"
+	"\t%u %u %s %f %f\n"
+	"\t|  |  |  |  |\n"
+	"\t|  |  |  |  +- Duration in seconds\n"
+	"\t|  |  |  +---- Start time\n"
+	"\t|  |  +------- Span: req, bereq, lookup, waitinglist, connect,"
+	" ttfb or esi\n"
+	"\t|  +---------- Parent: the transaction which started this one for"
+	" req and bereq, the transaction itself for the rest\n"
+	"\t+------------- Transaction vxid\n"
+	"\n"
+)
+
 #undef NODEF_NOTICE
 #undef SLTM
 
@@ -42,5 +42,9 @@
   WAITER(epoll)
 #endif
 
+#if defined(HAVE_IO_URING)
+  WAITER(io_uring)
+#endif
+
 WAITER(poll)
 #undef WAITER
@@ -169,6 +169,45 @@ int VSC_Iter(struct VSM_data *vd, struct VSM_fantom *fantom, VSC_iter_f *func,
 	 *	0:	Done
 	 */
 
+struct VSC_value {
+	const struct VSC_point *point;
+	uint64_t value;
+	int64_t delta;			/* since previous snapshot	*/
+	double rate;			/* delta per second		*/
+};
+
+struct VSC_snapshot {
+	struct VSC_value *val;		/* caller owned			*/
+	unsigned space;			/* size of val[]		*/
+	unsigned n;			/* counters found		*/
+	double t;			/* VTIM_mono() of snapshot	*/
+	double dt;			/* since previous, 0 if none	*/
+	unsigned gen;			/* changes with the counter set	*/
+};
+
+int VSC_Snapshot(struct VSM_data *vd, struct VSC_snapshot *snap);
+	/*
+	 * Take a snapshot of all statistics counters not suppressed by
+	 * any "-f" arguments, in the order VSC_Iter would present them.
+	 *
+	 * The counter sections are copied in one pass, which is retried
+	 * if the VSM allocations change while copying, and the values
+	 * are filled into snap->val[].  When the same snap was used for
+	 * the previous snapshot and the set of counters has not changed
+	 * since, delta and rate tell how much each counter moved.
+	 *
+	 * The snap must be zeroed before first use, apart from val and
+	 * space.  If more than space counters are found, only the first
+	 * space are filled in; grow val[] to n, keeping its content,
+	 * and call again.
+	 *
+	 * The points are valid as described for VSC_Iter.
+	 *
+	 * Returns:
+	 *	-1:	No consistent copy could be made
+	 *	>=0:	Number of counters found (snap->n)
+	 */
+
 const struct VSC_level_desc *VSC_LevelDesc(unsigned level);
 
 /**********************************************************************
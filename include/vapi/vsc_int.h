@@ -47,3 +47,35 @@ enum VSC_level_e {
 #define VSC_F(n,t,l,s,f,v,d,e)			t n;
 #define VSC_DONE(u,l,t)			};
 #include "tbl/vsc_all.h"
+
+/*
+ * Segments of VSC_type_vcl hold counters declared from VCL, and describe
+ * themselves: n_field names, followed by the values, each on a cache
+ * line of its own so busy counters do not slow their neighbours down.
+ * Writers fill in the names before n_field.
+ */
+
+#define VSC_VCL_NAMELEN		64
+#define VSC_VCL_DESCLEN		128
+
+struct VSC_vcl_field {
+	char			name[VSC_VCL_NAMELEN];
+	char			sdesc[VSC_VCL_DESCLEN];
+};
+
+struct VSC_vcl_value {
+	uint64_t		value;
+	uint64_t		pad[7];
+};
+
+struct VSC_vcl {
+	uint32_t		n_field;
+	uint32_t		pad[15];
+	struct VSC_vcl_field	field[];
+};
+
+/* Offset of the values in a segment with n fields, and its size */
+#define VSC_VCL_VALOFF(n)						\
+	(sizeof(struct VSC_vcl) + (n) * sizeof(struct VSC_vcl_field))
+#define VSC_VCL_SIZE(n)							\
+	(VSC_VCL_VALOFF(n) + (n) * sizeof(struct VSC_vcl_value))
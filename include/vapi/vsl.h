@@ -86,6 +86,18 @@ struct VSL_cursor {
 	void			*priv_data;
 };
 
+struct VSL_span {
+	const uint32_t		*ptr;	/* First record */
+	const uint32_t		*end;	/* Past the last record */
+	unsigned		n;	/* Number of records */
+	unsigned		priv;
+};
+	/*
+	 * A run of records returned by VSL_NextBatch.  Walk it with
+	 *
+	 *	for (p = span.ptr; p < span.end; p = VSL_NEXT(p))
+	 */
+
 enum VSL_transaction_e {
 	VSL_t_unknown,
 	VSL_t_sess,
@@ -266,6 +278,8 @@ void VSL_ResetError(struct VSL_data *vsl);
 #define VSL_COPT_TAIL		(1 << 0)
 #define VSL_COPT_BATCH		(1 << 1)
 #define VSL_COPT_TAILSTOP	(1 << 2)
+#define VSL_COPT_TAGSKIP	(1 << 3)
+#define VSL_COPT_PARALLEL	(1 << 4)
 struct VSL_cursor *VSL_CursorVSM(struct VSL_data *vsl, struct VSM_data *vsm,
     unsigned options);
        /*
@@ -276,6 +290,12 @@ struct VSL_cursor *VSL_CursorVSM(struct VSL_data *vsl, struct VSM_data *vsm,
 	*   VSL_COPT_TAIL	Start cursor at log tail
 	*   VSL_COPT_BATCH	Return batch records
 	*   VSL_COPT_TAILSTOP	Return EOF when reaching the log tail
+	*   VSL_COPT_TAGSKIP	Skip log segments with no records that
+	*			can pass the -i/-I/-x/-X filters
+	*
+	* The cursor registers with varnishd for the tags it will look
+	* at, see the vsl_demand parameter: those which can pass the
+	* filters with VSL_COPT_TAGSKIP, otherwise all of them.
 	*
 	* Return values:
 	* non-NULL: Pointer to cursor
@@ -286,10 +306,16 @@ struct VSL_cursor *VSL_CursorFile(struct VSL_data *vsl, const char *name,
     unsigned options);
 	/*
 	 * Create a cursor pointing to the beginning of the binary VSL log
-	 * in file name. If name is '-' reads from stdin.
+	 * in file name. If name is '-' reads from stdin.  Regular files
+	 * are mapped into memory and read in place.
 	 *
 	 * Options:
-	 *   NONE
+	 *   VSL_COPT_TAGSKIP	Skip blocks of a VSL_WriteIndexed file with
+	 *			no records that can pass the -i/-I/-x/-X
+	 *			filters
+	 *   VSL_COPT_PARALLEL	Inflate the next deflated block of a mapped
+	 *			file in a helper thread while the records
+	 *			of the current one are read
 	 *
 	 * Return values:
 	 * non-NULL: Pointer to cursor
@@ -337,6 +363,32 @@ int VSL_Next(const struct VSL_cursor *c);
 	 *     -4:	I/O read error - see errno
 	 */
 
+int VSL_NextBatch(const struct VSL_cursor *c, struct VSL_span *span,
+    unsigned max);
+	/*
+	 * Return the next run of up to max records in one call.  The
+	 * records are those VSL_Next would have returned, in the same
+	 * order, and lie back to back in memory.  For a VSM cursor the
+	 * run ends early at the tail of the log, at the wrap of the
+	 * ring and at batch records, so most calls hand back a whole
+	 * batch flushed by a worker.  Other cursors return one record
+	 * per call.
+	 *
+	 * The span stays in place until VSL_ReleaseBatch or the next
+	 * call on c.  On return c->rec points to the last record of the
+	 * span.
+	 *
+	 * Return values: as VSL_Next
+	 */
+
+int VSL_ReleaseBatch(const struct VSL_cursor *c, const struct VSL_span *span);
+	/*
+	 * Release a span returned by VSL_NextBatch, and tell if the
+	 * writer may have overwritten it while it was being read.
+	 *
+	 * Return values: as VSL_Check
+	 */
+
 int VSL_Match(struct VSL_data *vsl, const struct VSL_cursor *c);
 	/*
 	 * Returns true if the record pointed to by cursor matches the
@@ -347,6 +399,43 @@ int VSL_Match(struct VSL_data *vsl, const struct VSL_cursor *c);
 	 *	0:	No match
 	 */
 
+#define VSL_UNPACK_MAX	512
+	/*
+	 * Buffer size for VSL_Unpack() which holds any record varnishd
+	 * packs with the default vsl_reclen.
+	 */
+
+int VSL_Unpack(const uint32_t *ptr, char *buf, size_t len);
+	/*
+	 * Render a record which has VSL_PACKEDMARKER set, see vsl_int.h,
+	 * as the text varnishd would have logged for it.
+	 *
+	 * Arguments:
+	 *   ptr: Pointer to the record
+	 *   buf: Where to put the NUL-terminated text
+	 *   len: Size of buf
+	 *
+	 * Return values:
+	 *   >=0:	Length of the text, truncated to fit buf
+	 *    -1:	Not a packed record, or a malformed one
+	 */
+
+int VSL_Timestamp(const uint32_t *ptr, const char **label, unsigned *llen,
+    double *t);
+	/*
+	 * Take apart a SLT_Timestamp record, packed or not.
+	 *
+	 * Arguments:
+	 *     ptr: Pointer to the record
+	 *   label: If not NULL, set to the start of the label
+	 *    llen: If not NULL, set to the length of the label
+	 *       t: Array of three: absolute time, since start, since last
+	 *
+	 * Return values:
+	 *	0:	OK
+	 *     -1:	Not a Timestamp record, or a malformed one
+	 */
+
 int VSL_Print(const struct VSL_data *vsl, const struct VSL_cursor *c, void *fo);
 	/*
 	 * Print the log record pointed to by cursor to stream.
@@ -462,6 +551,39 @@ VSLQ_dispatch_f VSL_WriteTransactions;
 	 *    !=0:	Return value from either VSL_Next or VSL_Write
 	 */
 
+VSLQ_dispatch_f VSL_WriteIndexed;
+	/*
+	 * Like VSL_WriteTransactions, but collect the records into
+	 * blocks which are written with an index of the vxids, times and
+	 * tags found in them.  VSL_CursorFile uses this to skip blocks
+	 * which can not match the query.  Blocks go out when they are
+	 * full or on VSL_WriteFlush.
+	 *
+	 * Return values:
+	 *	0:	OK
+	 *    !=0:	Return value from either VSL_Next or VSL_WriteFlush
+	 */
+
+int VSL_WriteFlush(struct VSL_data *vsl, void *fo);
+	/*
+	 * Write out the block collected by VSL_WriteIndexed, if any.
+	 *
+	 * Return values:
+	 *	0:	OK
+	 *	-5:	I/O write error - see errno
+	 */
+
+int VSL_WriteDeflate(struct VSL_data *vsl, int level);
+	/*
+	 * Have VSL_WriteFlush deflate the blocks of VSL_WriteIndexed
+	 * at zlib compression level 1-9, or write them as they are for
+	 * level 0.  VSL_CursorFile inflates them again on reading.
+	 *
+	 * Return values:
+	 *	0:	OK
+	 *	-1:	Bad level - see VSL_Error
+	 */
+
 struct VSLQ *VSLQ_New(struct VSL_data *vsl, struct VSL_cursor **cp,
     enum VSL_grouping_e grouping, const char *query);
 	/*
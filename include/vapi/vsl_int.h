@@ -56,6 +56,13 @@
  * Logrecords are NUL-terminated so that string functions can be run
  * directly on the shmlog data.
  *
+ * Records with VSL_PACKEDMARKER set in [n] carry their numbers in
+ * binary, in host byte order, instead of as text:
+ *	SLT_Timestamp	double[3] followed by the NUL-terminated label
+ *	SLT_*Acct	uint64_t[] followed by a NUL
+ * VSL_Unpack() in libvarnishapi renders these as the text they stand
+ * for.  The doubles and integers are not aligned in the record.
+ *
  * Notice that the constants in these macros cannot be changed without
  * changing corresponding magic numbers in varnishd/cache/cache_shmlog.c
  */
@@ -65,12 +72,14 @@
 #define VSL_IDENTMASK		(~(3U<<30))
 
 #define VSL_LENMASK		0xffff
+#define VSL_PACKEDMARKER	(1U<<16)
 #define VSL_WORDS(len)		(((len) + 3) / 4)
 #define VSL_BYTES(words)	((words) * 4)
 #define VSL_END(ptr, len)	((ptr) + 2 + VSL_WORDS(len))
 #define VSL_NEXT(ptr)		VSL_END(ptr, VSL_LEN(ptr))
 #define VSL_LEN(ptr)		((ptr)[0] & VSL_LENMASK)
 #define VSL_TAG(ptr)		((ptr)[0] >> 24)
+#define VSL_PACKED(ptr)		((ptr)[0] & VSL_PACKEDMARKER)
 #define VSL_ID(ptr)		(((ptr)[1]) & VSL_IDENTMASK)
 #define VSL_CLIENT(ptr)		(((ptr)[1]) & VSL_CLIENTMARKER)
 #define VSL_BACKEND(ptr)	(((ptr)[1]) & VSL_BACKENDMARKER)
@@ -0,0 +1,8 @@
+/*
+ * NB:  This file is machine generated, DO NOT EDIT!
+ *
+ * Edit and run lib/libvcc/generate.py instead.
+ */
+
+#define VCS_Version "df8729d"
+#define VCS_Branch "master"
@@ -68,3 +68,11 @@ vct_is(int x, uint16_t y)
 
 /* NB: VCT always operate in ASCII, don't replace 0x0d with \r etc. */
 #define vct_skipcrlf(p) ((p)[0] == 0x0d && (p)[1] == 0x0a ? 2 : 1)
+
+/*
+ * Find the first byte in [b, e) which is a CTL other than HT, or with
+ * VCT_SCAN_SP also SP or HT, returns e if there is none.
+ */
+#define VCT_SCAN_CTL		0
+#define VCT_SCAN_SP		1
+const char *VCT_Scan(const char *b, const char *e, int how);
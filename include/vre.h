@@ -46,16 +46,23 @@ typedef struct vre vre_t;
 
 /* This maps to PCRE error codes */
 #define VRE_ERROR_NOMATCH         (-1)
+#define VRE_ERROR_MATCHLIMIT      (-8)
+#define VRE_ERROR_RECURSIONLIMIT  (-21)
+#define VRE_ERROR_JIT_STACKLIMIT  (-27)
 
 /* And those to PCRE options */
 extern const unsigned VRE_has_jit;
 extern const unsigned VRE_CASELESS;
 extern const unsigned VRE_NOTEMPTY;
+extern const unsigned VRE_NO_JIT;
 
 vre_t *VRE_compile(const char *, int, const char **, int *);
 int VRE_exec(const vre_t *code, const char *subject, int length,
     int startoffset, int options, int *ovector, int ovecsize,
     const volatile struct vre_limits *lim);
+int VRE_exec_mark(const vre_t *code, const char *subject, int length,
+    int options, const char **mark, const volatile struct vre_limits *lim);
+int VRE_jit_stack(size_t size);
 void VRE_free(vre_t **);
 
 #endif /* VRE_H_INCLUDED */
@@ -47,6 +47,19 @@
  *	WS_ReserveLumps added
  *	WS_Inside added
  *	WS_Assert_Allocated added
+ *	struct gethdr_s grew .id field
+ *	VRT_re_bundle added
+ *	struct vrt_ref grew .count and .ns fields
+ *	VRT_prof_count and VRT_prof_call added
+ *	VCL_STRANDS type added
+ *	VRT_StrandsWS, VRT_CollectStrands and VRT_CompareStrands added
+ *	VRT_StreamReqBody added
+ *	VRT_purge_tags added
+ *	VRT_ban_replay added
+ *	vrt_backend grew .http2 field
+ *	vrt_backend grew .path field
+ *	VRT_regsub_fixed added
+ *	VRT_hashprefix added
  * 5.0:
  *	Varnish 5.0 release "better safe than sorry" bump
  * 4.0:
@@ -101,11 +114,22 @@ typedef const struct suckaddr *			VCL_IP;
 typedef const struct vrt_backend_probe *	VCL_PROBE;
 typedef double					VCL_REAL;
 typedef const struct stevedore *		VCL_STEVEDORE;
+typedef const struct strands *			VCL_STRANDS;
 typedef const char *				VCL_STRING;
 typedef double					VCL_TIME;
 typedef struct vcl *				VCL_VCL;
 typedef void					VCL_VOID;
 
+/***********************************************************************
+ * A string made of pieces, for passing concatenations around without
+ * assembling them first.  Pieces can be NULL, meaning empty.
+ */
+
+struct strands {
+	int		n;
+	const char	**p;
+};
+
 /***********************************************************************
  * This is the composite argument we pass to compiled VCL and VRT
  * functions.
@@ -138,7 +162,7 @@ struct vrt_ctx {
 
 	/*
 	 * method specific argument:
-	 *    hash:		struct SHA256Context
+	 *    hash:		struct VSHA256Context
 	 *    synth+error:	struct vsb *
 	 */
 	void				*specific;
@@ -170,6 +194,7 @@ enum gethdr_e { HDR_REQ, HDR_REQ_TOP, HDR_RESP, HDR_OBJ, HDR_BEREQ,
 struct gethdr_s {
 	enum gethdr_e	where;
 	const char	*what;
+	unsigned	id;		/* See vhdr.h, zero if unknown */
 };
 
 extern const void * const vrt_magic_string_end;
@@ -190,12 +215,14 @@ extern const void * const vrt_magic_string_unset;
 	rigid char			*ipv4_addr;		\
 	rigid char			*ipv6_addr;		\
 	rigid char			*port;			\
+	rigid char			*path;			\
 	rigid char			*hosthdr;		\
 	double				connect_timeout;	\
 	double				first_byte_timeout;	\
 	double				between_bytes_timeout;	\
 	unsigned			max_connections;	\
-	unsigned			proxy_header;
+	unsigned			proxy_header;		\
+	unsigned			http2;
 
 #define VRT_BACKEND_HANDLE()			\
 	do {					\
@@ -203,12 +230,14 @@ extern const void * const vrt_magic_string_unset;
 		DA(ipv4_addr);			\
 		DA(ipv6_addr);			\
 		DA(port);			\
+		DA(path);			\
 		DA(hosthdr);			\
 		DN(connect_timeout);		\
 		DN(first_byte_timeout);		\
 		DN(between_bytes_timeout);	\
 		DN(max_connections);		\
 		DN(proxy_header);		\
+		DN(http2);			\
 	} while(0)
 
 struct vrt_backend {
@@ -259,6 +288,8 @@ struct vrt_ref {
 	unsigned	line;
 	unsigned	pos;
 	const char	*token;
+	unsigned long long	count;		/* with vcc_profile */
+	unsigned long long	ns;		/* subroutines only */
 };
 
 /* ACL related */
@@ -278,17 +309,27 @@ int VRT_acl_match(VRT_CTX, VCL_ACL, VCL_IP);
 /* req related */
 
 VCL_BYTES VRT_CacheReqBody(VRT_CTX, VCL_BYTES maxsize);
+int VRT_StreamReqBody(VRT_CTX, VCL_BYTES maxsize);
 
 /* Regexp related */
 void VRT_re_init(void **, const char *);
 void VRT_re_fini(void *);
 int VRT_re_match(VRT_CTX, const char *, void *re);
+int VRT_re_bundle(VRT_CTX, const char *, void *re);
 const char *VRT_regsub(VRT_CTX, int all, const char *, void *, const char *);
+#define VRT_RE_BEGIN	(1U<<0)		/* Literal anchored with ^ */
+#define VRT_RE_END	(1U<<1)		/* Literal anchored with $ */
+const char *VRT_regsub_fixed(VRT_CTX, int all, const char *, unsigned anchor,
+    const char *lit, const char *);
 
 void VRT_ban_string(VRT_CTX, const char *);
+long VRT_ban_replay(VRT_CTX);
 void VRT_purge(VRT_CTX, double ttl, double grace, double keep);
+long VRT_purge_tags(VRT_CTX, const char *keys, unsigned soft);
 
 void VRT_count(VRT_CTX, unsigned);
+void VRT_prof_count(VRT_CTX, unsigned);
+void VRT_prof_call(VRT_CTX, unsigned, void (*)(VRT_CTX));
 void VRT_synth(VRT_CTX, unsigned, const char *);
 void VRT_hit_for_pass(VRT_CTX, VCL_DURATION);
 
@@ -299,6 +340,7 @@ void VRT_handling(VRT_CTX, unsigned hand);
 void VRT_fail(VRT_CTX, const char *fmt, ...) __v_printflike(2,3);
 
 void VRT_hashdata(VRT_CTX, const char *str, ...);
+void VRT_hashprefix(VRT_CTX, const char *str, ...);
 
 /* Simple stuff */
 int VRT_strcmp(const char *s1, const char *s2);
@@ -361,3 +403,6 @@ const char *VRT_BOOL_string(VCL_BOOL);
 const char *VRT_BACKEND_string(VCL_BACKEND);
 const char *VRT_STEVEDORE_string(VCL_STEVEDORE);
 const char *VRT_CollectString(VRT_CTX, const char *p, ...);
+const char *VRT_StrandsWS(struct ws *, const char *, VCL_STRANDS);
+VCL_STRING VRT_CollectStrands(VRT_CTX, VCL_STRANDS);
+int VRT_CompareStrands(VCL_STRANDS, VCL_STRANDS);
@@ -53,17 +53,35 @@
  * UINT_MAX. When taken modulo VSL_SEGMENTS, it gives the current index
  * into the offset array.
  *
+ * The tags array has a bit set for every tag with a record starting in
+ * that segment, records inside batches included.  The bits are set
+ * before the space for the record is reserved, so once segment_n has
+ * moved past a segment, its bits are complete and a reader can skip
+ * the segment if none of the tags it cares about are present.
+ *
  * The format of the actual log is in vapi/vsl_int.h
  *
  */
 
 struct VSL_head {
-#define VSL_HEAD_MARKER		"VSLHEAD1"	/* Incr. as version# */
+#define VSL_HEAD_MARKER		"VSLHEAD2"	/* Incr. as version# */
 	char			marker[VSM_MARKER_LEN];
 	ssize_t			segsize;
 	unsigned		segment_n;
 	ssize_t			offset[VSL_SEGMENTS];
+	uint32_t		tags[VSL_SEGMENTS][SLT__MAX / 32];
 	uint32_t		log[];
 };
 
+/*
+ * Readers register the tags they want in the VSL_DEMANDDIR directory,
+ * next to VSM_FILENAME, with a file named "<pid>.<anything>" holding a
+ * uint32_t[SLT__MAX / 32] bitmap like the tags member above.  With the
+ * vsl_demand parameter, varnishd skips tags which no live reader wants.
+ * Files are written under a name starting with '.' and renamed into
+ * place, so a partial bitmap is never seen.
+ */
+
+#define VSL_DEMANDDIR		"_.vsl_demand"
+
 #endif /* VSL_PRIV_H_INCLUDED */
@@ -116,6 +116,7 @@ struct VSM_head {
 	ssize_t			first;		/* Offset, first chunk */
 	unsigned		alloc_seq;
 	uint64_t		age;
+	unsigned		hugepage;	/* madvise(MADV_HUGEPAGE) */
 };
 
 #endif /* VSM_PRIV_H_INCLUDED */
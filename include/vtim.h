@@ -34,6 +34,7 @@ void VTIM_format(double t, char *p);
 double VTIM_parse(const char *p);
 double VTIM_mono(void);
 double VTIM_real(void);
+double VTIM_real_coarse(void);
 void VTIM_sleep(double t);
 struct timespec VTIM_timespec(double t);
 struct timeval VTIM_timeval(double t);
@@ -31,6 +31,9 @@
  * See also:
  *	http://dl.acm.org/citation.cfm?doid=1785414.1785434
  *	(or: http://queue.acm.org/detail.cfm?id=1814327)
+ *
+ * Compiled with -DTEST_DRIVER this file is a test and benchmark of
+ * the heap layouts, run it with -h for the options.
  */
 
 #include "config.h"
@@ -57,6 +60,11 @@
  */
 #define ROW_SHIFT		16
 
+/*
+ * The rows of a d-ary heap are aligned to this, so that the children
+ * of a node share a cache line.
+ */
+#define DARY_ALIGN		64
 
 #undef PARANOIA
 
@@ -87,6 +95,8 @@ struct binheap {
 	unsigned		page_size;
 	unsigned		page_mask;
 	unsigned		page_shift;
+	unsigned		arity_shift;	/* zero for the B-heap */
+	unsigned		root;
 };
 
 #define VM_AWARE
@@ -178,6 +188,42 @@ child(const struct binheap *bh, unsigned u, unsigned *a, unsigned *b)
 
 #endif
 
+/*
+ * The d-ary heap keeps the d children of a node next to each other, so
+ * picking the smallest of them touches a single cache line, and there
+ * are only log_d(N) levels to go through.  With the root at index d-1
+ * all groups of siblings start at an index divisible by d, and with
+ * the rows aligned they never straddle a cache line, for up to eight
+ * children of 64 bit pointers.
+ */
+
+static unsigned
+dary_parent(const struct binheap *bh, unsigned u)
+{
+
+	return ((u >> bh->arity_shift) + bh->root - 1);
+}
+
+static unsigned
+dary_child(const struct binheap *bh, unsigned u)
+{
+	unsigned v;
+
+	v = u - bh->root + 1;
+	if (v > (UINT_MAX >> bh->arity_shift))
+		return (UINT_MAX);	/* see child() */
+	return (v << bh->arity_shift);
+}
+
+static unsigned
+binheap_parent(const struct binheap *bh, unsigned u)
+{
+
+	if (bh->arity_shift)
+		return (dary_parent(bh, u));
+	return (parent(bh, u));
+}
+
 /* Implementation ----------------------------------------------------*/
 
 static void
@@ -196,21 +242,36 @@ binheap_addrow(struct binheap *bh)
 			bh->array[bh->rows++] = NULL;
 	}
 	assert(ROW(bh, bh->length) == NULL);
-	ROW(bh, bh->length) = malloc(sizeof(**bh->array) * ROW_WIDTH);
+	if (bh->arity_shift) {
+		AZ(posix_memalign((void **)&ROW(bh, bh->length), DARY_ALIGN,
+		    sizeof(**bh->array) * ROW_WIDTH));
+	} else
+		ROW(bh, bh->length) = malloc(sizeof(**bh->array) * ROW_WIDTH);
 	assert(ROW(bh, bh->length));
 	bh->length += ROW_WIDTH;
 }
 
 struct binheap *
-binheap_new(void *priv, binheap_cmp_t *cmp_f, binheap_update_t *update_f)
+binheap_new_dary(void *priv, binheap_cmp_t *cmp_f, binheap_update_t *update_f,
+    unsigned arity)
 {
 	struct binheap *bh;
 	unsigned u;
 
+	assert(arity >= 2 && arity <= 8);
+	AZ(arity & (arity - 1));	/* power of two */
+
 	bh = calloc(sizeof *bh, 1);
 	if (bh == NULL)
 		return (bh);
 	bh->priv = priv;
+	if (arity > 2) {
+		for (u = 1; (1U << u) != arity; u++)
+			;
+		bh->arity_shift = u;
+		bh->root = arity - 1;
+	} else
+		bh->root = ROOT_IDX;
 
 	bh->page_size = (unsigned)getpagesize() / sizeof (void *);
 	bh->page_mask = bh->page_size - 1;
@@ -222,16 +283,23 @@ binheap_new(void *priv, binheap_cmp_t *cmp_f, binheap_update_t *update_f)
 
 	bh->cmp = cmp_f;
 	bh->update = update_f;
-	bh->next = ROOT_IDX;
+	bh->next = bh->root;
 	bh->rows = 16;		/* A tiny-ish number */
 	bh->array = calloc(sizeof *bh->array, bh->rows);
 	assert(bh->array != NULL);
 	binheap_addrow(bh);
-	A(bh, ROOT_IDX) = NULL;
+	A(bh, bh->root) = NULL;
 	bh->magic = BINHEAP_MAGIC;
 	return (bh);
 }
 
+struct binheap *
+binheap_new(void *priv, binheap_cmp_t *cmp_f, binheap_update_t *update_f)
+{
+
+	return (binheap_new_dary(priv, cmp_f, update_f, 2));
+}
+
 static void
 binheap_update(const struct binheap *bh, unsigned u)
 {
@@ -270,10 +338,10 @@ binheap_trickleup(const struct binheap *bh, unsigned u)
 	assert(u < bh->next);
 	assert(A(bh, u) != NULL);
 
-	while (u > ROOT_IDX) {
+	while (u > bh->root) {
 		assert(u < bh->next);
 		assert(A(bh, u) != NULL);
-		v = parent(bh, u);
+		v = binheap_parent(bh, u);
 		assert(v < u);
 		assert(v < bh->next);
 		assert(A(bh, v) != NULL);
@@ -285,6 +353,38 @@ binheap_trickleup(const struct binheap *bh, unsigned u)
 	return (u);
 }
 
+static unsigned
+binheap_trickledown_dary(const struct binheap *bh, unsigned u)
+{
+	unsigned b, v, w, n, d;
+	void **p;
+
+	d = 1U << bh->arity_shift;
+	while (1) {
+		assert(u < bh->next);
+		assert(A(bh, u) != NULL);
+		b = dary_child(bh, u);
+		if (b >= bh->next)
+			return (u);
+
+		/* The siblings are all in the same row */
+		n = bh->next - b < d ? bh->next - b : d;
+		p = &A(bh, b);
+		v = b;
+		for (w = 1; w < n; w++) {
+			assert(p[w] != NULL);
+			if (bh->cmp(bh->priv, p[w], p[v - b]))
+				v = b + w;
+		}
+		assert(v < bh->next);
+		assert(A(bh, v) != NULL);
+		if (bh->cmp(bh->priv, A(bh, u), A(bh, v)))
+			return (u);
+		binhead_swap(bh, u, v);
+		u = v;
+	}
+}
+
 static unsigned
 binheap_trickledown(const struct binheap *bh, unsigned u)
 {
@@ -295,6 +395,9 @@ binheap_trickledown(const struct binheap *bh, unsigned u)
 	assert(u < bh->next);
 	assert(A(bh, u) != NULL);
 
+	if (bh->arity_shift)
+		return (binheap_trickledown_dary(bh, u));
+
 	while (1) {
 		assert(u < bh->next);
 		assert(A(bh, u) != NULL);
@@ -347,8 +450,8 @@ chk(const struct binheap *bh)
 {
 	unsigned u, v;
 
-	for (u = 2; u < bh->next; u++) {
-		v = parent(bh, u);
+	for (u = bh->root + 1; u < bh->next; u++) {
+		v = binheap_parent(bh, u);
 		AZ(bh->cmp(bh->priv, A(bh, u), A(bh, v)));
 	}
 }
@@ -363,7 +466,7 @@ binheap_root(const struct binheap *bh)
 #ifdef PARANOIA
 	chk(bh);
 #endif
-	return (A(bh, ROOT_IDX));
+	return (A(bh, bh->root));
 }
 
 /*
@@ -396,7 +499,7 @@ binheap_delete(struct binheap *bh, unsigned idx)
 
 	assert(bh != NULL);
 	assert(bh->magic == BINHEAP_MAGIC);
-	assert(bh->next > ROOT_IDX);
+	assert(bh->next > bh->root);
 	assert(idx < bh->next);
 	assert(idx > 0);
 	assert(A(bh, idx) != NULL);
@@ -429,6 +532,24 @@ binheap_delete(struct binheap *bh, unsigned idx)
 	}
 }
 
+void
+binheap_destroy(struct binheap **bhp)
+{
+	struct binheap *bh;
+	unsigned u;
+
+	AN(bhp);
+	bh = *bhp;
+	*bhp = NULL;
+	assert(bh != NULL);
+	assert(bh->magic == BINHEAP_MAGIC);
+	assert(bh->next == bh->root);
+	for (u = 0; u < bh->rows; u++)
+		free(bh->array[u]);
+	free(bh->array);
+	free(bh);
+}
+
 /*
  * Move an item up/down after changing its key value
  */
@@ -439,7 +560,7 @@ binheap_reorder(const struct binheap *bh, unsigned idx)
 
 	assert(bh != NULL);
 	assert(bh->magic == BINHEAP_MAGIC);
-	assert(bh->next > ROOT_IDX);
+	assert(bh->next > bh->root);
 	assert(idx < bh->next);
 	assert(idx > 0);
 	assert(A(bh, idx) != NULL);
@@ -456,22 +577,13 @@ binheap_reorder(const struct binheap *bh, unsigned idx)
 #ifdef TEST_DRIVER
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "miniobj.h"
 
 /* Test driver -------------------------------------------------------*/
 
-static void
-vasfail(const char *func, const char *file, int line,
-    const char *cond, int err, int xxx)
-{
-	fprintf(stderr, "PANIC: %s %s %d %s %d %d\n",
-		func, file, line, cond, err, xxx);
-	abort();
-}
-
-vas_f *VAS_Fail = vasfail;
-
 struct foo {
 	unsigned	magic;
 #define FOO_MAGIC	0x23239823
@@ -480,151 +592,229 @@ struct foo {
 	unsigned	n;
 };
 
-#if 1
-#define M 31011091	/* Number of operations */
-#define N 17313102	/* Number of items */
-#else
 #define M 3401		/* Number of operations */
 #define N 1131		/* Number of items */
-#endif
-#define R -1		/* Random modulus */
 
-struct foo *ff[N];
+static struct foo **ff;
 
 static int
-cmp(void *priv, void *a, void *b)
+cmp(void *priv, const void *a, const void *b)
 {
-	struct foo *fa, *fb;
+	const struct foo *fa, *fb;
 
+	(void)priv;
 	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
 	CAST_OBJ_NOTNULL(fb, b, FOO_MAGIC);
 	return (fa->key < fb->key);
 }
 
-void
+static void
 update(void *priv, void *a, unsigned u)
 {
 	struct foo *fa;
 
+	(void)priv;
 	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
 	fa->idx = u;
 }
 
-void
-chk2(struct binheap *bh)
+static void
+chk2(const struct binheap *bh)
 {
 	unsigned u, v;
 	struct foo *fa, *fb;
 
-	for (u = 2; u < bh->next; u++) {
-		v = parent(bh, u);
+	for (u = bh->root + 1; u < bh->next; u++) {
+		v = binheap_parent(bh, u);
 		fa = A(bh, u);
 		fb = A(bh, v);
 		assert(fa->key >= fb->key);
 	}
 }
 
-int
-main(int argc, char **argv)
+static double
+now(void)
+{
+	struct timespec ts;
+
+	AZ(clock_gettime(CLOCK_MONOTONIC, &ts));
+	return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+}
+
+static void
+report(unsigned arity, const char *what, unsigned n, double t0)
+{
+	double t;
+
+	t = now() - t0;
+	printf("%u-ary %-12s %10u %8.3f s %8.1f ns/op\n",
+	    arity, what, n, t, 1e9 * t / n);
+}
+
+static void
+run(unsigned arity, unsigned n_items, unsigned n_ops, int paranoid)
 {
 	struct binheap *bh;
 	unsigned u, v, lr, n;
 	struct foo *fp;
+	double t0;
+
+	bh = binheap_new_dary(NULL, cmp, update, arity);
+	AN(bh);
+	if (arity == 2) {
+		for (n = 2; n; n += n) {
+			child(bh, n - 1, &u, &v);
+			child(bh, n, &u, &v);
+			child(bh, n + 1, &u, &v);
+		}
+	}
 
-	if (0) {
-		srandomdev();
-		u = random();
-		printf("Seed %u\n", u);
-		srandom(u);
+	/* First insert our N elements */
+	t0 = now();
+	for (u = 0; u < n_items; u++) {
+		lr = random();
+		ALLOC_OBJ(ff[u], FOO_MAGIC);
+		assert(ff[u] != NULL);
+		ff[u]->key = lr;
+		ff[u]->n = u;
+		binheap_insert(bh, ff[u]);
+
+		fp = binheap_root(bh);
+		assert(fp->idx == bh->root);
+		assert(fp->key <= lr);
 	}
-	bh = binheap_new(NULL, cmp, update);
-	for (n = 2; n; n += n) {
-		child(bh, n - 1, &u, &v);
-		child(bh, n, &u, &v);
-		child(bh, n + 1, &u, &v);
+	report(arity, "inserts", n_items, t0);
+
+	/* For M cycles, pick the root, insert new */
+	t0 = now();
+	for (u = 0; u < n_ops; u++) {
+		fp = binheap_root(bh);
+		CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+		assert(fp->idx == bh->root);
+		lr = fp->key;
+		binheap_delete(bh, fp->idx);
+		assert(fp->idx == BINHEAP_NOIDX);
+
+		/* Nothing left can be smaller than what we took out */
+		AN(binheap_root(bh));
+		assert(((struct foo *)binheap_root(bh))->key >= lr);
+
+		fp->key = random();
+		binheap_insert(bh, fp);
 	}
-
-	while (1) {
-		/* First insert our N elements */
-		for (u = 0; u < N; u++) {
-			lr = random() % R;
-			ALLOC_OBJ(ff[u], FOO_MAGIC);
-			assert(ff[u] != NULL);
-			ff[u]->key = lr;
-			ff[u]->n = u;
-			binheap_insert(bh, ff[u]);
-
-			fp = binheap_root(bh);
-			assert(fp->idx == 1);
-			assert(fp->key <= lr);
-		}
-		fprintf(stderr, "%d inserts OK\n", N);
-		/* For M cycles, pick the root, insert new */
-		for (u = 0; u < M; u++) {
-			fp = binheap_root(bh);
-			CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
-			assert(fp->idx == 1);
-
-			/*
-			 * It cannot possibly be larger than the last
-			 * value we added
-			 */
-			assert(fp->key <= lr);
-			binheap_delete(bh, fp->idx);
-
-			n = fp->n;
-			ALLOC_OBJ(ff[n], FOO_MAGIC);
-			assert(ff[n] != NULL);
-			FREE_OBJ(fp);
-			fp = ff[n];
-			fp->n = n;
-
-			lr = random() % R;
-			fp->key = lr;
-			binheap_insert(bh, fp);
-		}
-		fprintf(stderr, "%d replacements OK\n", M);
-		/* The remove everything */
-		lr = 0;
-		for (u = 0; u < N; u++) {
-			fp = binheap_root(bh);
-			CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
-			assert(fp->idx == 1);
-			assert(fp->key >= lr);
-			lr = fp->key;
-			binheap_delete(bh, fp->idx);
-			ff[fp->n] = NULL;
-			FREE_OBJ(fp);
-		}
-		fprintf(stderr, "%d removes OK\n", N);
-
-		for (u = 0; u < M; u++) {
-			v = random() % N;
-			if (ff[v] != NULL) {
-				CHECK_OBJ_NOTNULL(ff[v], FOO_MAGIC);
-				AN(ff[v]->idx);
-				if (ff[v]->key & 1) {
-					binheap_delete(bh, ff[v]->idx);
-					assert(ff[v]->idx == BINHEAP_NOIDX);
-					FREE_OBJ(ff[v]);
-					ff[v] = NULL;
-				} else {
-					ff[v]->key = random() % R;
-					binheap_reorder(bh, ff[v]->idx);
-				}
+	report(arity, "replacements", n_ops, t0);
+
+	/* Then remove everything */
+	t0 = now();
+	lr = 0;
+	for (u = 0; u < n_items; u++) {
+		fp = binheap_root(bh);
+		CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+		assert(fp->idx == bh->root);
+		assert(fp->key >= lr);
+		lr = fp->key;
+		binheap_delete(bh, fp->idx);
+		ff[fp->n] = NULL;
+		FREE_OBJ(fp);
+	}
+	AZ(binheap_root(bh));
+	report(arity, "removes", n_items, t0);
+
+	/* Random inserts, deletes and changes of the key */
+	t0 = now();
+	for (u = 0; u < n_ops; u++) {
+		v = random() % n_items;
+		if (ff[v] != NULL) {
+			CHECK_OBJ_NOTNULL(ff[v], FOO_MAGIC);
+			AN(ff[v]->idx);
+			if (ff[v]->key & 1) {
+				binheap_delete(bh, ff[v]->idx);
+				assert(ff[v]->idx == BINHEAP_NOIDX);
+				FREE_OBJ(ff[v]);
+				ff[v] = NULL;
 			} else {
-				ALLOC_OBJ(ff[v], FOO_MAGIC);
-				assert(ff[v] != NULL);
-				ff[v]->key = random() % R;
-				binheap_insert(bh, ff[v]);
-				CHECK_OBJ_NOTNULL(ff[v], FOO_MAGIC);
-				AN(ff[v]->idx);
+				ff[v]->key = random();
+				binheap_reorder(bh, ff[v]->idx);
 			}
-			if (0)
-				chk2(bh);
+		} else {
+			ALLOC_OBJ(ff[v], FOO_MAGIC);
+			assert(ff[v] != NULL);
+			ff[v]->key = random();
+			ff[v]->n = v;
+			binheap_insert(bh, ff[v]);
+			CHECK_OBJ_NOTNULL(ff[v], FOO_MAGIC);
+			AN(ff[v]->idx);
+		}
+		if (paranoid)
+			chk2(bh);
+	}
+	report(arity, "updates", n_ops, t0);
+
+	while ((fp = binheap_root(bh)) != NULL) {
+		binheap_delete(bh, fp->idx);
+		ff[fp->n] = NULL;
+		FREE_OBJ(fp);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: binheap_c_test [-p] [-d arity] [-m ops] [-n items] "
+	    "[-r rounds] [-s seed]\n"
+	    "\t-d arity\t2 (B-heap), 4 or 8, default all of them\n"
+	    "\t-m ops\t\tnumber of operations (%u)\n"
+	    "\t-n items\tnumber of items (%u)\n"
+	    "\t-p\t\tcheck the entire heap after each update\n"
+	    "\t-r rounds\tzero runs forever (1)\n"
+	    "\t-s seed\t\tfor random(3)\n", M, N);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned arity = 0, n_items = N, n_ops = M, rounds = 1, u, a;
+	int ch, paranoid = 0;
+
+	while ((ch = getopt(argc, argv, "d:m:n:pr:s:")) != -1) {
+		switch (ch) {
+		case 'd':
+			arity = strtoul(optarg, NULL, 0);
+			if (arity != 2 && arity != 4 && arity != 8)
+				usage();
+			break;
+		case 'm':
+			n_ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n_items = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			paranoid = 1;
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			srandom(strtoul(optarg, NULL, 0));
+			break;
+		default:
+			usage();
 		}
-		fprintf(stderr, "%d updates OK\n", M);
 	}
+	if (argc != optind || n_items == 0 || n_ops == 0)
+		usage();
+
+	ff = calloc(n_items, sizeof *ff);
+	AN(ff);
+	for (u = 0; rounds == 0 || u < rounds; u++) {
+		for (a = 2; a <= 8; a <<= 1)
+			if (arity == 0 || arity == a)
+				run(a, n_items, n_ops, paranoid);
+	}
+	free(ff);
 	return (0);
 }
 #endif
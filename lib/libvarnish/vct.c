@@ -232,3 +232,200 @@ const uint16_t vct_typtab[256] = {
 	[0xfe]	=	VCT_XMLNAMESTART,
 	[0xff]	=	VCT_XMLNAMESTART,
 };
+
+/*--------------------------------------------------------------------
+ * VCT_Scan() is where HTTP/1 header parsing spends its time, so
+ * it looks at 16 (SSE2, NEON) or 32 (AVX2) bytes at a time where
+ * it can.  A byte is stopped at if it is <= 0x1f (<= 0x20 for
+ * VCT_SCAN_SP) or 0x7f, except HT unless VCT_SCAN_SP, which is the
+ * same as the vct_typtab[] lookups in vct_scan_scalar().
+ */
+
+static const char *
+vct_scan_scalar(const char *b, const char *e, int how)
+{
+
+	if (how == VCT_SCAN_SP) {
+		for (; b < e; b++)
+			if (vct_is(*b, VCT_CTL | VCT_SP))
+				break;
+	} else {
+		for (; b < e; b++)
+			if (vct_isctl(*b) && !vct_issp(*b))
+				break;
+	}
+	return (b);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+static const char *
+vct_scan_sse2(const char *b, const char *e, int how)
+{
+	const __m128i del = _mm_set1_epi8(0x7f);
+	const __m128i ht = _mm_set1_epi8(0x09);
+	__m128i lim, x, m;
+	int u;
+
+	lim = _mm_set1_epi8(how == VCT_SCAN_SP ? 0x20 : 0x1f);
+	for (; e - b >= 16; b += 16) {
+		x = _mm_loadu_si128((const void *)b);
+		m = _mm_or_si128(
+		    _mm_cmpeq_epi8(_mm_min_epu8(x, lim), x),
+		    _mm_cmpeq_epi8(x, del));
+		if (how != VCT_SCAN_SP)
+			m = _mm_andnot_si128(_mm_cmpeq_epi8(x, ht), m);
+		u = _mm_movemask_epi8(m);
+		if (u != 0)
+			return (b + __builtin_ctz(u));
+	}
+	return (vct_scan_scalar(b, e, how));
+}
+
+static const char * __attribute__((target("avx2")))
+vct_scan_avx2(const char *b, const char *e, int how)
+{
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	const __m256i ht = _mm256_set1_epi8(0x09);
+	__m256i lim, x, m;
+	unsigned u;
+
+	lim = _mm256_set1_epi8(how == VCT_SCAN_SP ? 0x20 : 0x1f);
+	for (; e - b >= 32; b += 32) {
+		x = _mm256_loadu_si256((const void *)b);
+		m = _mm256_or_si256(
+		    _mm256_cmpeq_epi8(_mm256_min_epu8(x, lim), x),
+		    _mm256_cmpeq_epi8(x, del));
+		if (how != VCT_SCAN_SP)
+			m = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, ht), m);
+		u = (unsigned)_mm256_movemask_epi8(m);
+		if (u != 0)
+			return (b + __builtin_ctz(u));
+	}
+	return (vct_scan_sse2(b, e, how));
+}
+
+#define VCT_SCAN_SIMD
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+static const char *
+vct_scan_neon(const char *b, const char *e, int how)
+{
+	const uint8x16_t del = vdupq_n_u8(0x7f);
+	const uint8x16_t ht = vdupq_n_u8(0x09);
+	uint8x16_t lim, x, m;
+
+	lim = vdupq_n_u8(how == VCT_SCAN_SP ? 0x20 : 0x1f);
+	for (; e - b >= 16; b += 16) {
+		x = vld1q_u8((const uint8_t *)b);
+		m = vorrq_u8(vcleq_u8(x, lim), vceqq_u8(x, del));
+		if (how != VCT_SCAN_SP)
+			m = vbicq_u8(m, vceqq_u8(x, ht));
+		if (vmaxvq_u8(m) != 0)
+			break;		/* It is in this block */
+	}
+	return (vct_scan_scalar(b, e, how));
+}
+
+#define VCT_SCAN_SIMD
+
+#endif
+
+typedef const char *vct_scan_f(const char *, const char *, int);
+
+static vct_scan_f *
+vct_scan_pick(void)
+{
+
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return (vct_scan_avx2);
+	return (vct_scan_sse2);
+#elif defined(VCT_SCAN_SIMD)
+	return (vct_scan_neon);
+#else
+	return (vct_scan_scalar);
+#endif
+}
+
+const char *
+VCT_Scan(const char *b, const char *e, int how)
+{
+	static vct_scan_f *vct_scan = NULL;
+
+	/* Racing threads all pick the same, so no locking */
+	if (vct_scan == NULL)
+		vct_scan = vct_scan_pick();
+	return (vct_scan(b, e, how));
+}
+
+#ifdef VCT_C_TEST
+/* Compile with: "cc -o foo -DVCT_C_TEST -I../.. -I../../include vct.c" */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vas.h"
+
+static vct_scan_f * const vct_scan_all[] = {
+	vct_scan_scalar,
+#if defined(__x86_64__) && defined(__GNUC__)
+	vct_scan_sse2,
+	vct_scan_avx2,
+#elif defined(VCT_SCAN_SIMD)
+	vct_scan_neon,
+#endif
+};
+
+int
+main(void)
+{
+	char buf[200];
+	const char *r;
+	unsigned n, u, l, o, c;
+	int how;
+
+	/* Each implementation must stop at the same byte as the table */
+	srandom(1);
+	for (n = 0; n < 100000; n++) {
+		l = random() % (sizeof buf - 1);
+		o = random() % 32;
+		if (o > l)
+			o = l;
+		for (u = 0; u < l; u++) {
+			c = random() % 16;
+			if (c == 0)
+				buf[u] = (char)(random() % 256);
+			else if (c == 1)
+				buf[u] = ' ';
+			else if (c == 2)
+				buf[u] = '\t';
+			else
+				buf[u] = (char)(0x21 + random() % 0x5e);
+		}
+		how = n & 1 ? VCT_SCAN_SP : VCT_SCAN_CTL;
+		r = vct_scan_scalar(buf + o, buf + l, how);
+		for (u = 1; u < sizeof vct_scan_all / sizeof vct_scan_all[0];
+		    u++) {
+#if defined(__x86_64__) && defined(__GNUC__)
+			if (vct_scan_all[u] == vct_scan_avx2 &&
+			    !__builtin_cpu_supports("avx2"))
+				continue;
+#endif
+			if (vct_scan_all[u](buf + o, buf + l, how) != r) {
+				printf("Mismatch for implementation %u\n", u);
+				return (1);
+			}
+		}
+		assert(VCT_Scan(buf + o, buf + l, how) == r);
+	}
+	printf("OK\n");
+	return (0);
+}
+#endif
@@ -50,7 +50,8 @@
 #ifdef HAVE_SYS_VFS_H
 #  include <sys/vfs.h>
 #endif
-#if defined(__linux__) && defined(HAVE_FALLOCATE)
+#if defined(__linux__) && \
+    (defined(HAVE_FALLOCATE) || defined(HAVE_SYS_VFS_H))
 #  include <linux/magic.h>
 #endif
 
@@ -216,6 +217,24 @@ VFIL_fsinfo(int fd, unsigned *pbs, uintmax_t *psize, uintmax_t *pspace)
 	return (0);
 }
 
+/*
+ * Returns the huge page size if fd is on a hugetlbfs, zero otherwise.
+ * Files there are made of huge pages, and can only be sized in those.
+ */
+size_t
+VFIL_hugetlbfs(int fd)
+{
+#if defined(__linux__) && defined(HAVE_SYS_VFS_H) && defined(HUGETLBFS_MAGIC)
+	struct statfs stfs;
+
+	if (!fstatfs(fd, &stfs) && stfs.f_type == HUGETLBFS_MAGIC)
+		return (stfs.f_bsize);
+#else
+	(void)fd;
+#endif
+	return (0);
+}
+
 /*
  * Make sure that the file system can accommodate the file of the given
  * size. Will use fallocate if available. If fallocate is not available
@@ -0,0 +1,143 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Name to ID lookup for the well-known HTTP headers.
+ *
+ * VHDR_Init() searches for a seed which hashes all the names in the
+ * table to distinct slots, so a lookup is one hash and at most one
+ * string comparison.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "vas.h"
+#include "vhdr.h"
+
+#define VHDR_SLOTS	256
+
+static const char * const vhdr_names[VHDR_NID] = {
+	[VHDR_NONE] = NULL,
+#define HTTPH(a, b, c) [VHDR_##b] = a,
+#include "tbl/http_headers.h"
+};
+
+static uint8_t vhdr_slot[VHDR_SLOTS];
+static uint32_t vhdr_seed;
+
+static unsigned
+vhdr_hash(uint32_t seed, const char *b, size_t l)
+{
+	uint32_t h = seed;
+
+	while (l-- > 0)
+		h = (h ^ (uint8_t)(*b++ | 0x20)) * 16777619U;
+	return (h >> 24);
+}
+
+void
+VHDR_Init(void)
+{
+	uint32_t seed;
+	unsigned u, s;
+
+	assert(VHDR_NID < VHDR_SLOTS);
+	if (vhdr_seed != 0)
+		return;
+	for (seed = 2166136261U; ; seed++) {
+		memset(vhdr_slot, 0, sizeof vhdr_slot);
+		for (u = 1; u < VHDR_NID; u++) {
+			s = vhdr_hash(seed, vhdr_names[u],
+			    strlen(vhdr_names[u]));
+			if (vhdr_slot[s] != 0)
+				break;
+			vhdr_slot[s] = (uint8_t)u;
+		}
+		if (u == VHDR_NID)
+			break;
+	}
+	vhdr_seed = seed;
+}
+
+unsigned
+VHDR_Id(const char *name, size_t len)
+{
+	unsigned u;
+
+	AN(name);
+	AN(vhdr_seed);
+	u = vhdr_slot[vhdr_hash(vhdr_seed, name, len)];
+	if (u == 0 || strlen(vhdr_names[u]) != len ||
+	    strncasecmp(vhdr_names[u], name, len))
+		return (0);
+	return (u);
+}
+
+const char *
+VHDR_Name(unsigned id)
+{
+
+	assert(id > 0 && id < VHDR_NID);
+	return (vhdr_names[id]);
+}
+
+#ifdef VHDR_C_TEST
+
+#include <stdio.h>
+
+int
+main(int argc, char **argv)
+{
+	unsigned u;
+	char buf[64];
+	size_t l;
+
+	(void)argc;
+	(void)argv;
+
+	VHDR_Init();
+	for (u = 1; u < VHDR_NID; u++) {
+		l = strlen(VHDR_Name(u));
+		assert(l < sizeof buf);
+		memcpy(buf, VHDR_Name(u), l);
+		assert(VHDR_Id(buf, l) == u);
+		buf[0] ^= 0x20;
+		assert(VHDR_Id(buf, l) == u);
+		assert(VHDR_Id(buf, l - 1) != u);
+		buf[l - 1] = '~';
+		assert(VHDR_Id(buf, l) == 0);
+	}
+	assert(VHDR_Id("Host", 4) == VHDR_H_Host);
+	assert(VHDR_Id("host", 4) == VHDR_H_Host);
+	assert(VHDR_Id("X-Varnish", 9) == 0);
+	assert(VHDR_Id("", 0) == 0);
+	printf("%u headers, seed 0x%08x\n", VHDR_NID - 1, vhdr_seed);
+	return (0);
+}
+#endif
@@ -29,6 +29,7 @@
 #include "config.h"
 
 #include <pcre.h>
+#include <pthread.h>
 #include <string.h>
 
 #include "vas.h"	// XXX Flexelint "not used" - but req'ed for assert()
@@ -64,6 +65,60 @@ struct vre {
 const unsigned VRE_CASELESS = PCRE_CASELESS;
 const unsigned VRE_NOTEMPTY = PCRE_NOTEMPTY;
 
+/* Our own, must not collide with any PCRE exec option */
+const unsigned VRE_NO_JIT = 1U << 31;
+
+/*
+ * The JIT machine code runs on a stack of its own, which is only 32k
+ * unless we provide one.  Each thread may register a bigger one with
+ * VRE_jit_stack(), and the regexps find it through this callback.
+ */
+
+#if defined(USE_PCRE_JIT)
+static pthread_once_t vre_jit_once = PTHREAD_ONCE_INIT;
+static pthread_key_t vre_jit_key;
+
+static void
+vre_jit_init(void)
+{
+	AZ(pthread_key_create(&vre_jit_key, NULL));
+}
+
+static pcre_jit_stack *
+vre_jit_stack_cb(void *priv)
+{
+
+	(void)priv;
+	return (pthread_getspecific(vre_jit_key));
+}
+#endif
+
+int
+VRE_jit_stack(size_t size)
+{
+#if defined(USE_PCRE_JIT)
+	pcre_jit_stack *js;
+
+	AZ(pthread_once(&vre_jit_once, vre_jit_init));
+	js = pthread_getspecific(vre_jit_key);
+	if (js != NULL) {
+		AZ(pthread_setspecific(vre_jit_key, NULL));
+		pcre_jit_stack_free(js);
+	}
+	if (size == 0)
+		return (0);
+	if (size < 32 * 1024)
+		size = 32 * 1024;
+	js = pcre_jit_stack_alloc(32 * 1024, (int)size);
+	if (js == NULL)
+		return (-1);
+	AZ(pthread_setspecific(vre_jit_key, js));
+#else
+	(void)size;
+#endif
+	return (0);
+}
+
 vre_t *
 VRE_compile(const char *pattern, int options,
     const char **errptr, int *erroffset)
@@ -96,9 +151,45 @@ VRE_compile(const char *pattern, int options,
 			return (NULL);
 		}
 	}
+#if defined(USE_PCRE_JIT)
+	if (v->re_extra->flags & PCRE_EXTRA_EXECUTABLE_JIT) {
+		AZ(pthread_once(&vre_jit_once, vre_jit_init));
+		pcre_assign_jit_stack(v->re_extra, vre_jit_stack_cb, NULL);
+	}
+#endif
 	return (v);
 }
 
+/*
+ * Run the interpreter, typically after the JIT ran out of stack.  Like
+ * VRE_exec_mark() this works on a copy of the pcre_extra, there may be
+ * other threads using the JIT code of the shared vre_t.
+ */
+
+static int
+VRE_exec_nojit(const vre_t *code, const char *subject, int length,
+    int startoffset, int options, int *ovector, int ovecsize,
+    const volatile struct vre_limits *lim)
+{
+	pcre_extra extra;
+
+	extra = *code->re_extra;
+#if defined(PCRE_EXTRA_EXECUTABLE_JIT)
+	extra.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+#endif
+	if (lim != NULL) {
+		extra.match_limit = lim->match;
+		extra.flags |= PCRE_EXTRA_MATCH_LIMIT;
+		extra.match_limit_recursion = lim->match_recursion;
+		extra.flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+	} else {
+		extra.flags &= ~PCRE_EXTRA_MATCH_LIMIT;
+		extra.flags &= ~PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+	}
+	return (pcre_exec(code->re, &extra, subject, length,
+	    startoffset, options, ovector, ovecsize));
+}
+
 int
 VRE_exec(const vre_t *code, const char *subject, int length,
     int startoffset, int options, int *ovector, int ovecsize,
@@ -112,6 +203,10 @@ VRE_exec(const vre_t *code, const char *subject, int length,
 		ovecsize = sizeof(ov)/sizeof(ov[0]);
 	}
 
+	if (options & VRE_NO_JIT)
+		return (VRE_exec_nojit(code, subject, length, startoffset,
+		    options & ~VRE_NO_JIT, ovector, ovecsize, lim));
+
 	if (lim != NULL) {
 		code->re_extra->match_limit = lim->match;
 		code->re_extra->flags |= PCRE_EXTRA_MATCH_LIMIT;
@@ -126,6 +221,54 @@ VRE_exec(const vre_t *code, const char *subject, int length,
 	    startoffset, options, ovector, ovecsize));
 }
 
+/*
+ * Match, and return the name of the last (*MARK:NAME) passed on the
+ * way, if any.  The pcre_extra is copied because the mark is specific
+ * to this match, while the vre_t is shared.
+ */
+
+int
+VRE_exec_mark(const vre_t *code, const char *subject, int length,
+    int options, const char **mark, const volatile struct vre_limits *lim)
+{
+	pcre_extra extra;
+	int ov[30];
+	int i;
+#if defined(PCRE_EXTRA_MARK)
+	unsigned char *m = NULL;
+#endif
+
+	CHECK_OBJ_NOTNULL(code, VRE_MAGIC);
+	AN(mark);
+	extra = *code->re_extra;
+#if defined(PCRE_EXTRA_EXECUTABLE_JIT)
+	if (options & VRE_NO_JIT)
+		extra.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+#endif
+	options &= ~VRE_NO_JIT;
+	if (lim != NULL) {
+		extra.match_limit = lim->match;
+		extra.flags |= PCRE_EXTRA_MATCH_LIMIT;
+		extra.match_limit_recursion = lim->match_recursion;
+		extra.flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+	} else {
+		extra.flags &= ~PCRE_EXTRA_MATCH_LIMIT;
+		extra.flags &= ~PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+	}
+#if defined(PCRE_EXTRA_MARK)
+	extra.mark = &m;
+	extra.flags |= PCRE_EXTRA_MARK;
+#endif
+	i = pcre_exec(code->re, &extra, subject, length, 0, options,
+	    ov, sizeof ov / sizeof ov[0]);
+#if defined(PCRE_EXTRA_MARK)
+	*mark = (const char *)m;
+#else
+	*mark = NULL;
+#endif
+	return (i);
+}
+
 void
 VRE_free(vre_t **vv)
 {
@@ -42,6 +42,11 @@
 #include <stdint.h>
 #include <string.h>
 
+#ifdef HAVE_SHA_NI
+#  include <cpuid.h>
+#  include <immintrin.h>
+#endif
+
 #include "vas.h"
 #include "vend.h"
 #include "vsha256.h"
@@ -116,7 +121,7 @@ be32dec_vect(uint32_t *dst, const unsigned char *src, size_t len)
  * the 512-bit input block to produce a new state.
  */
 static void
-SHA256_Transform(uint32_t * state, const unsigned char block[64])
+VSHA256_Transform(uint32_t * state, const unsigned char block[64])
 {
 	uint32_t W[64];
 	uint32_t S[8];
@@ -202,6 +207,110 @@ SHA256_Transform(uint32_t * state, const unsigned char block[64])
 		state[i] += S[i];
 }
 
+#ifdef HAVE_SHA_NI
+
+/*
+ * The same compression function using the x86 SHA extensions.  The
+ * instructions work on the state as ABEF and CDGH halves, and do two
+ * rounds at a time.
+ */
+
+static const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+__attribute__((target("sha,sse4.1")))
+static void
+VSHA256_Transform_shani(uint32_t * state, const unsigned char block[64])
+{
+	const __m128i bswap =
+	    _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i s0, s1, abef, cdgh, m[4], k, t;
+	int g;
+
+	/* Rearrange ABCD EFGH into ABEF CDGH */
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const void *)&state[0]), 0xb1);
+	s1 = _mm_shuffle_epi32(_mm_loadu_si128((const void *)&state[4]), 0x1b);
+	s0 = _mm_alignr_epi8(t, s1, 8);
+	s1 = _mm_blend_epi16(s1, t, 0xf0);
+	abef = s0;
+	cdgh = s1;
+
+	/* Four rounds per group, each message quad is reused four groups on */
+	for (g = 0; g < 16; g++) {
+		if (g < 4)
+			m[g] = _mm_shuffle_epi8(_mm_loadu_si128(
+			    (const void *)(block + g * 16)), bswap);
+		k = _mm_add_epi32(m[g & 3],
+		    _mm_loadu_si128((const void *)&K256[g * 4]));
+		s1 = _mm_sha256rnds2_epu32(s1, s0, k);
+		if (g >= 3 && g < 15) {
+			t = _mm_alignr_epi8(m[g & 3], m[(g + 3) & 3], 4);
+			m[(g + 1) & 3] = _mm_sha256msg2_epu32(
+			    _mm_add_epi32(m[(g + 1) & 3], t), m[g & 3]);
+		}
+		s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(k, 0x0e));
+		if (g >= 1 && g < 13)
+			m[(g + 3) & 3] =
+			    _mm_sha256msg1_epu32(m[(g + 3) & 3], m[g & 3]);
+	}
+
+	s0 = _mm_add_epi32(s0, abef);
+	s1 = _mm_add_epi32(s1, cdgh);
+
+	/* And back to ABCD EFGH */
+	t = _mm_shuffle_epi32(s0, 0x1b);
+	s1 = _mm_shuffle_epi32(s1, 0xb1);
+	_mm_storeu_si128((void *)&state[0], _mm_blend_epi16(t, s1, 0xf0));
+	_mm_storeu_si128((void *)&state[4], _mm_alignr_epi8(s1, t, 8));
+}
+
+static int
+VSHA256_Have_shani(void)
+{
+	unsigned a, b, c, d;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return (0);
+	__cpuid(1, a, b, c, d);
+	if (!(c & bit_SSSE3) || !(c & bit_SSE4_1))
+		return (0);
+	__cpuid_count(7, 0, a, b, c, d);
+	return ((b & (1U << 29)) != 0);		/* SHA */
+}
+
+#endif
+
+typedef void sha256_transform_f(uint32_t *, const unsigned char *);
+
+static sha256_transform_f *sha256_transform;
+
+static sha256_transform_f *
+VSHA256_Pick(void)
+{
+
+#ifdef HAVE_SHA_NI
+	if (VSHA256_Have_shani())
+		return (VSHA256_Transform_shani);
+#endif
+	return (VSHA256_Transform);
+}
+
 static const unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -211,7 +320,7 @@ static const unsigned char PAD[64] = {
 
 /* Add padding and terminating bit-count. */
 static void
-SHA256_Pad(SHA256_CTX * ctx)
+VSHA256_Pad(VSHA256_CTX * ctx)
 {
 	unsigned char len[8];
 	uint32_t r, plen;
@@ -226,20 +335,24 @@ SHA256_Pad(SHA256_CTX * ctx)
 	/* Add 1--64 bytes so that the resulting length is 56 mod 64 */
 	r = ctx->count & 0x3f;
 	plen = (r < 56) ? (56 - r) : (120 - r);
-	SHA256_Update(ctx, PAD, (size_t)plen);
+	VSHA256_Update(ctx, PAD, (size_t)plen);
 
 	/* Add the terminating bit-count */
-	SHA256_Update(ctx, len, 8);
+	VSHA256_Update(ctx, len, 8);
 }
 
 /* SHA-256 initialization.  Begins a SHA-256 operation. */
 void
-SHA256_Init(SHA256_CTX * ctx)
+VSHA256_Init(VSHA256_CTX * ctx)
 {
 
 	/* Zero bits processed so far */
 	ctx->count = 0;
 
+	/* Not locked, all threads will come up with the same answer */
+	if (sha256_transform == NULL)
+		sha256_transform = VSHA256_Pick();
+
 	/* Magic initialization constants */
 	ctx->state[0] = 0x6A09E667;
 	ctx->state[1] = 0xBB67AE85;
@@ -253,14 +366,24 @@ SHA256_Init(SHA256_CTX * ctx)
 
 /* Add bytes into the hash */
 void
-SHA256_Update(SHA256_CTX * ctx, const void *in, size_t len)
+VSHA256_Update(VSHA256_CTX * ctx, const void *in, size_t len)
 {
 	uint32_t r, l;
 	const unsigned char *src = in;
 
+	AN(sha256_transform);
+
 	/* Number of bytes left in the buffer from previous updates */
 	r = ctx->count & 0x3f;
 	while (len > 0) {
+		if (r == 0 && len >= 64) {
+			/* Whole blocks need not go through the buffer */
+			sha256_transform(ctx->state, src);
+			len -= 64;
+			src += 64;
+			ctx->count += 64;
+			continue;
+		}
 		l = 64 - r;
 		if (l > len)
 			l = len;
@@ -270,7 +393,7 @@ SHA256_Update(SHA256_CTX * ctx, const void *in, size_t len)
 		ctx->count += l;
 		r = ctx->count & 0x3f;
 		if (r == 0)
-			SHA256_Transform(ctx->state, ctx->buf);
+			sha256_transform(ctx->state, ctx->buf);
 	}
 }
 
@@ -279,11 +402,11 @@ SHA256_Update(SHA256_CTX * ctx, const void *in, size_t len)
  * and clears the context state.
  */
 void
-SHA256_Final(unsigned char digest[32], SHA256_CTX * ctx)
+VSHA256_Final(unsigned char digest[32], VSHA256_CTX * ctx)
 {
 
 	/* Add padding */
-	SHA256_Pad(ctx);
+	VSHA256_Pad(ctx);
 
 	/* Write the hash */
 	be32enc_vect(digest, ctx->state, 32);
@@ -312,21 +435,43 @@ static const struct sha256test {
 	{0xdb, 0x4b, 0xfc, 0xbd, 0x4d, 0xa0, 0xcd, 0x85, 0xa6, 0x0c, 0x3c,
 	 0x37, 0xd3, 0xfb, 0xd8, 0x80, 0x5c, 0x77, 0xf1, 0x5f, 0xc6, 0xb1,
 	 0xfd, 0xfe, 0x61, 0x4e, 0xe0, 0xa7, 0xc8, 0xfd, 0xb4, 0xc0} },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+	{0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26,
+	 0x93, 0x0c, 0x3e, 0x60, 0x39, 0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff,
+	 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1} },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+      "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+	{0xcf, 0x5b, 0x16, 0xa7, 0x78, 0xaf, 0x83, 0x80, 0x03, 0x6c, 0xe5,
+	 0x9e, 0x7b, 0x04, 0x92, 0x37, 0x0b, 0x24, 0x9b, 0x11, 0xe8, 0xf0,
+	 0x7a, 0x51, 0xaf, 0xac, 0x45, 0x03, 0x7a, 0xfe, 0xe9, 0xd1} },
     { NULL }
 };
 
 
-void
-SHA256_Test(void)
+static void
+VSHA256_Test_vectors(void)
 {
-	struct SHA256Context c;
+	struct VSHA256Context c;
 	const struct sha256test *p;
 	unsigned char o[32];
 
 	for (p = sha256test; p->input != NULL; p++) {
-		SHA256_Init(&c);
-		SHA256_Update(&c, p->input, strlen(p->input));
-		SHA256_Final(o, &c);
+		VSHA256_Init(&c);
+		VSHA256_Update(&c, p->input, strlen(p->input));
+		VSHA256_Final(o, &c);
 		AZ(memcmp(o, p->output, 32));
 	}
 }
+
+/* Test the portable implementation, and the one we picked if different */
+
+void
+VSHA256_Test(void)
+{
+
+	sha256_transform = VSHA256_Transform;
+	VSHA256_Test_vectors();
+	sha256_transform = VSHA256_Pick();
+	if (sha256_transform != VSHA256_Transform)
+		VSHA256_Test_vectors();
+}
@@ -64,6 +64,14 @@ vtcp_sa_to_ascii(const void *sa, socklen_t l, char *abuf, unsigned alen,
 
 	assert(abuf == NULL || alen > 0);
 	assert(pbuf == NULL || plen > 0);
+	if (((const struct sockaddr *)sa)->sa_family == AF_UNIX) {
+		/* Same bogo-address as we give UDS sessions */
+		if (abuf != NULL)
+			(void)snprintf(abuf, alen, "0.0.0.0");
+		if (pbuf != NULL)
+			(void)snprintf(pbuf, plen, "0");
+		return;
+	}
 	i = getnameinfo(sa, l, abuf, alen, pbuf, plen,
 	   NI_NUMERICHOST | NI_NUMERICSERV);
 	if (i) {
@@ -270,8 +278,8 @@ VTCP_connected(int s)
 	return (s);
 }
 
-int
-VTCP_connect(const struct suckaddr *name, int msec)
+static int
+vtcp_connect(const struct suckaddr *name, int msec, int fastopen)
 {
 	int s, i;
 	struct pollfd fds[1];
@@ -298,9 +306,24 @@ VTCP_connect(const struct suckaddr *name, int msec)
 	val = 1;
 	AZ(setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &val, sizeof val));
 
+	/*
+	 * With TCP_FASTOPEN_CONNECT the connect returns at once, and the
+	 * SYN goes out with the first data we write.
+	 */
+#ifdef HAVE_TCP_FASTOPEN_CONNECT
+	if (fastopen && setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+	    &val, sizeof val))
+		fastopen = 0;
+#else
+	fastopen = 0;
+#endif
+
 	i = connect(s, sa, sl);
-	if (i == 0)
+	if (i == 0) {
+		if (fastopen)
+			(void)VTCP_blocking(s);
 		return (s);
+	}
 	if (errno != EINPROGRESS) {
 		closefd(&s);
 		return (-1);
@@ -331,6 +354,25 @@ VTCP_connect(const struct suckaddr *name, int msec)
 	return (VTCP_connected(s));
 }
 
+int
+VTCP_connect(const struct suckaddr *name, int msec)
+{
+
+	return (vtcp_connect(name, msec, 0));
+}
+
+/*--------------------------------------------------------------------
+ * Like VTCP_connect(), but with TCP Fast Open where the OS has it, in
+ * which case connection errors only show up when writing or reading.
+ */
+
+int
+VTCP_connect_fastopen(const struct suckaddr *name, int msec)
+{
+
+	return (vtcp_connect(name, msec, 1));
+}
+
 /*--------------------------------------------------------------------
  * When closing a TCP connection, a couple of errno's are legit, we
  * can't be held responsible for the other end wanting to talk to us.
@@ -407,8 +449,8 @@ VTCP_open(const char *addr, const char *def_port, double timeout,
  * avoid conflicts between INADDR_ANY and IN6ADDR_ANY.
  */
 
-int
-VTCP_bind(const struct suckaddr *sa, const char **errp)
+static int
+vtcp_bind(const struct suckaddr *sa, int reuseport, const char **errp)
 {
 	int sd, val, e;
 	socklen_t sl;
@@ -418,6 +460,15 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 	if (errp != NULL)
 		*errp = NULL;
 
+#ifndef SO_REUSEPORT
+	if (reuseport) {
+		if (errp != NULL)
+			*errp = "SO_REUSEPORT";
+		errno = EOPNOTSUPP;
+		return (-1);
+	}
+#endif
+
 	proto = VSA_Get_Proto(sa);
 	sd = socket(proto, SOCK_STREAM, 0);
 	if (sd < 0) {
@@ -434,6 +485,18 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 		errno = e;
 		return (-1);
 	}
+#ifdef SO_REUSEPORT
+	val = 1;
+	if (reuseport &&
+	    setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof val) != 0) {
+		if (errp != NULL)
+			*errp = "setsockopt(SO_REUSEPORT, 1)";
+		e = errno;
+		closefd(&sd);
+		errno = e;
+		return (-1);
+	}
+#endif
 #ifdef IPV6_V6ONLY
 	/* forcibly use separate sockets for IPv4 and IPv6 */
 	val = 1;
@@ -459,6 +522,26 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 	return (sd);
 }
 
+int
+VTCP_bind(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 0, errp));
+}
+
+/*--------------------------------------------------------------------
+ * As VTCP_bind(), but with SO_REUSEPORT, so that several sockets can be
+ * bound to the same address and the kernel spreads the connections
+ * over them.
+ */
+
+int
+VTCP_bind_reuseport(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 1, errp));
+}
+
 /*--------------------------------------------------------------------
  * Given a struct suckaddr, open a socket of the appropriate type, bind it
  * to the requested address, and start listening.
@@ -154,6 +154,31 @@ VTIM_real(void)
 #endif
 }
 
+/*
+ * The coarse clock is the time of the latest timer tick, which the
+ * kernel keeps around, so it is cheaper to read, but can be a few
+ * milliseconds behind VTIM_real().  It is for timeouts and the like,
+ * never for anything we log or measure.
+ */
+
+double
+VTIM_real_coarse(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_REALTIME_COARSE)
+	struct timespec ts;
+
+	AZ(clock_gettime(CLOCK_REALTIME_COARSE, &ts));
+	return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_REALTIME_FAST)
+	struct timespec ts;
+
+	AZ(clock_gettime(CLOCK_REALTIME_FAST, &ts));
+	return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+#else
+	return (VTIM_real());
+#endif
+}
+
 void
 VTIM_format(double t, char *p)
 {
@@ -514,6 +539,14 @@ bench()
 	e = VTIM_real();
 	printf("mono: %fs / %d = %fns - tst val %f\n",
 	    e - s, i, 1e9 * (e - s) / i, t);
+
+	t = 0;
+	s = VTIM_real();
+	for (i=0; i<100000; i++)
+		t += VTIM_real_coarse();
+	e = VTIM_real();
+	printf("real_coarse: %fs / %d = %fns - tst val %f\n",
+	    e - s, i, 1e9 * (e - s) / i, t);
 }
 
 int
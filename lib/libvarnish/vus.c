@@ -0,0 +1,172 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Unix domain sockets.
+ *
+ * There is no resolving to be done, but we keep the calling convention
+ * of VSS_resolver() so that callers can treat the two alike.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "vtcp.h"
+#include "vus.h"
+
+int
+VUS_resolver(const char *path, vus_resolved_f *func, void *priv,
+    const char **err)
+{
+	struct sockaddr_un uds;
+
+	AN(path);
+	AN(err);
+	*err = NULL;
+	if (*path != '/') {
+		*err = "Unix domain socket addresses must be absolute paths";
+		return (-1);
+	}
+	if (strlen(path) + 1 > sizeof(uds.sun_path)) {
+		errno = ENAMETOOLONG;
+		*err = "Path too long for a Unix domain socket";
+		return (-1);
+	}
+	if (func == NULL)
+		return (0);
+
+	memset(&uds, 0, sizeof uds);
+	uds.sun_family = AF_UNIX;
+	bprintf(uds.sun_path, "%s", path);
+	return (func(priv, &uds));
+}
+
+/*--------------------------------------------------------------------
+ * A stale socket file from a previous run would make bind(2) fail, so
+ * we remove whatever is there first.  The file is not removed when the
+ * socket is closed, the next bind will take care of that.
+ */
+
+int
+VUS_bind(const struct sockaddr_un *uds, const char **errp)
+{
+	int sd, e;
+
+	AN(uds);
+	if (errp != NULL)
+		*errp = NULL;
+
+	sd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (sd < 0) {
+		if (errp != NULL)
+			*errp = "socket(2)";
+		return (-1);
+	}
+
+	if (unlink(uds->sun_path) != 0 && errno != ENOENT) {
+		if (errp != NULL)
+			*errp = "unlink(2)";
+		e = errno;
+		closefd(&sd);
+		errno = e;
+		return (-1);
+	}
+
+	if (bind(sd, (const void *)uds, sizeof *uds) != 0) {
+		if (errp != NULL)
+			*errp = "bind(2)";
+		e = errno;
+		closefd(&sd);
+		errno = e;
+		return (-1);
+	}
+	return (sd);
+}
+
+/*--------------------------------------------------------------------
+ * Same timeout semantics as VTCP_connect()
+ */
+
+int
+VUS_connect(const char *path, int msec)
+{
+	int s, i;
+	struct pollfd fds[1];
+	struct sockaddr_un uds;
+
+	if (path == NULL)
+		return (-1);
+	if (strlen(path) + 1 > sizeof(uds.sun_path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	memset(&uds, 0, sizeof uds);
+	uds.sun_family = AF_UNIX;
+	bprintf(uds.sun_path, "%s", path);
+
+	s = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (s < 0)
+		return (s);
+
+	if (msec != 0)
+		(void)VTCP_nonblocking(s);
+
+	i = connect(s, (const void *)&uds, sizeof uds);
+	if (i == 0) {
+		(void)VTCP_blocking(s);
+		return (s);
+	}
+	if (errno != EINPROGRESS) {
+		closefd(&s);
+		return (-1);
+	}
+
+	if (msec < 0)
+		return (s);
+
+	assert(msec > 0);
+	fds[0].fd = s;
+	fds[0].events = POLLWRNORM;
+	fds[0].revents = 0;
+	i = poll(fds, 1, msec);
+
+	if (i == 0) {
+		closefd(&s);
+		errno = ETIMEDOUT;
+		return (-1);
+	}
+
+	return (VTCP_connected(s));
+}
@@ -42,8 +42,11 @@
 #include "vdef.h"
 #include "vas.h"
 #include "miniobj.h"
+#include "vmb.h"
 #include "vqueue.h"
 #include "vsb.h"
+#include "vsm_priv.h"
+#include "vtim.h"
 
 #include "vapi/vsc.h"
 #include "vapi/vsm.h"
@@ -63,6 +66,9 @@ struct vsc_vf {
 	struct VSM_fantom	fantom;
 	struct VSC_section	section;
 	int			order;
+	size_t			copy_off;	/* in vsc->copy */
+	struct VSC_desc		*desc;		/* VSC_type_vcl only */
+	unsigned		n_desc;
 };
 
 struct vsc_pt {
@@ -70,6 +76,8 @@ struct vsc_pt {
 #define VSC_PT_MAGIC		0xa4ff159a
 	VTAILQ_ENTRY(vsc_pt)	list;
 	struct VSC_point	point;
+	const struct vsc_vf	*vf;
+	size_t			off;		/* in vf->fantom */
 };
 
 struct vsc_sf {
@@ -88,6 +96,11 @@ struct vsc {
 	VTAILQ_HEAD(, vsc_pt)	pt_list;
 	VTAILQ_HEAD(, vsc_sf)	sf_list;
 	struct VSM_fantom	iter_fantom;
+	unsigned		gen;		/* bumped on list rebuild */
+
+	/* VSC_Snapshot() */
+	char			*copy;
+	size_t			copy_space;
 };
 
 
@@ -120,6 +133,7 @@ vsc_delete_vf_list(struct vsc *vsc)
 		vf = VTAILQ_FIRST(&vsc->vf_list);
 		CHECK_OBJ_NOTNULL(vf, VSC_VF_MAGIC);
 		VTAILQ_REMOVE(&vsc->vf_list, vf, list);
+		free(vf->desc);
 		FREE_OBJ(vf);
 	}
 }
@@ -163,6 +177,7 @@ VSC_Delete(struct VSM_data *vd)
 	vsc_delete_sf_list(vsc);
 	vsc_delete_pt_list(vsc);
 	vsc_delete_vf_list(vsc);
+	free(vsc->copy);
 	FREE_OBJ(vsc);
 }
 
@@ -282,6 +297,8 @@ vsc_add_pt(struct vsc *vsc, const volatile void *ptr,
 	pt->point.desc = desc;
 	pt->point.ptr = ptr;
 	pt->point.section = &vf->section;
+	pt->vf = vf;
+	pt->off = (const volatile char *)ptr - (const char *)vf->fantom.b;
 
 	VTAILQ_INSERT_TAIL(&vsc->pt_list, pt, list);
 }
@@ -304,6 +321,54 @@ vsc_add_pt(struct vsc *vsc, const volatile void *ptr,
 
 #include "tbl/vsc_all.h"
 
+/*
+ * VSC_type_vcl segments describe their own fields, which we copy out of
+ * the segment, since it may go away underneath us.
+ */
+
+static void
+iter_vcl(struct vsc *vsc, struct vsc_vf *vf)
+{
+	const struct VSC_vcl *h;
+	const struct VSC_vcl_value *v;
+	struct VSC_desc *d;
+	char *s;
+	unsigned u, n;
+
+	CHECK_OBJ_NOTNULL(vsc, VSC_MAGIC);
+	h = vf->fantom.b;
+	n = h->n_field;
+	if (n == 0 || (const char *)vf->fantom.b + VSC_VCL_SIZE(n) >
+	    (const char *)vf->fantom.e)
+		return;
+	VRMB();
+	v = (const void *)((const char *)h + VSC_VCL_VALOFF(n));
+
+	if (vf->desc == NULL) {
+		vf->desc = calloc(n, sizeof *d + sizeof h->field[0]);
+		AN(vf->desc);
+		vf->n_desc = n;
+		s = (char *)(vf->desc + n);
+		for (u = 0; u < n; u++) {
+			d = &vf->desc[u];
+			memcpy(s, &h->field[u], sizeof h->field[0]);
+			s[VSC_VCL_NAMELEN - 1] = '\0';
+			s[sizeof h->field[0] - 1] = '\0';
+			d->name = s;
+			d->ctype = "uint64_t";
+			d->semantics = 'c';
+			d->format = 'i';
+			d->level = &VSC_level_desc_info;
+			d->sdesc = s + VSC_VCL_NAMELEN;
+			d->ldesc = d->sdesc;
+			s += sizeof h->field[0];
+		}
+	}
+	assert(vf->n_desc == n);
+	for (u = 0; u < n; u++)
+		vsc_add_pt(vsc, &v[u].value, &vf->desc[u], vf);
+}
+
 /*--------------------------------------------------------------------
  */
 
@@ -344,6 +409,8 @@ vsc_build_pt_list(struct VSM_data *vd)
 #define VSC_F(n,t,l,s,f,v,d,e)
 #define VSC_DONE(a,b,c)
 #include "tbl/vsc_all.h"
+		if (!strcmp(vf->fantom.type, VSC_type_vcl))
+			iter_vcl(vsc, vf);
 	}
 }
 
@@ -397,6 +464,31 @@ vsc_filter_pt_list(struct VSM_data *vd)
 /*--------------------------------------------------------------------
  */
 
+static void
+vsc_rebuild(struct VSM_data *vd)
+{
+	struct vsc *vsc = vsc_setup(vd);
+
+	vsc_build_vf_list(vd);
+	vsc_build_pt_list(vd);
+	vsc_filter_pt_list(vd);
+	vsc->gen++;
+}
+
+/*
+ * NB: VSM_StillValid() updates the fantom when it returns VSM_similar,
+ * so the answer must be acted upon, asking again would say VSM_valid.
+ */
+
+static void
+vsc_refresh(struct VSM_data *vd)
+{
+	struct vsc *vsc = vsc_setup(vd);
+
+	if (VSM_valid != VSM_StillValid(vd, &vsc->iter_fantom))
+		vsc_rebuild(vd);
+}
+
 int
 VSC_Iter(struct VSM_data *vd, struct VSM_fantom *fantom, VSC_iter_f *func,
     void *priv)
@@ -408,9 +500,7 @@ VSC_Iter(struct VSM_data *vd, struct VSM_fantom *fantom, VSC_iter_f *func,
 	if (VSM_valid != VSM_StillValid(vd, &vsc->iter_fantom)) {
 		/* Tell app that list will be nuked */
 		(void)func(priv, NULL);
-		vsc_build_vf_list(vd);
-		vsc_build_pt_list(vd);
-		vsc_filter_pt_list(vd);
+		vsc_rebuild(vd);
 	}
 	if (fantom != NULL)
 		*fantom = vsc->iter_fantom;
@@ -422,6 +512,89 @@ VSC_Iter(struct VSM_data *vd, struct VSM_fantom *fantom, VSC_iter_f *func,
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Copy all the sections in one go, and retry if the VSM allocations
+ * changed underneath us.  Counters are then read from the copy, so
+ * they are consistent with each other as far as the writers allow.
+ */
+
+static void
+vsc_copy(struct vsc *vsc)
+{
+	struct vsc_vf *vf;
+	size_t l = 0;
+
+	VTAILQ_FOREACH(vf, &vsc->vf_list, list) {
+		vf->copy_off = l;
+		l += (char *)vf->fantom.e - (char *)vf->fantom.b;
+	}
+	if (l > vsc->copy_space) {
+		vsc->copy = realloc(vsc->copy, l);
+		AN(vsc->copy);
+		vsc->copy_space = l;
+	}
+	VTAILQ_FOREACH(vf, &vsc->vf_list, list)
+		memcpy(vsc->copy + vf->copy_off, vf->fantom.b,
+		    (char *)vf->fantom.e - (char *)vf->fantom.b);
+}
+
+int
+VSC_Snapshot(struct VSM_data *vd, struct VSC_snapshot *snap)
+{
+	struct vsc *vsc = vsc_setup(vd);
+	struct vsc_pt *pt;
+	struct VSC_value *v;
+	unsigned seq, u;
+	uint64_t val;
+	double t, dt;
+	int retry;
+
+	AN(snap);
+	AN(snap->val != NULL || snap->space == 0);
+
+	for (retry = 0; ; retry++) {
+		if (retry == 3)
+			return (-1);
+		vsc_refresh(vd);
+		if (vd->head == NULL)
+			return (-1);
+		seq = vd->head->alloc_seq;
+		VRMB();
+		vsc_copy(vsc);
+		VRMB();
+		if (seq == vd->head->alloc_seq)
+			break;
+	}
+
+	t = VTIM_mono();
+	dt = snap->gen == vsc->gen ? t - snap->t : 0.;
+	u = 0;
+	VTAILQ_FOREACH(pt, &vsc->pt_list, list) {
+		CHECK_OBJ_NOTNULL(pt, VSC_PT_MAGIC);
+		if (u >= snap->space) {
+			u++;
+			continue;
+		}
+		memcpy(&val, vsc->copy + pt->vf->copy_off + pt->off,
+		    sizeof val);
+		v = &snap->val[u++];
+		if (dt > 0. && v->point == &pt->point) {
+			v->delta = (int64_t)(val - v->value);
+			v->rate = v->delta / dt;
+		} else {
+			v->delta = 0;
+			v->rate = 0.;
+		}
+		v->point = &pt->point;
+		v->value = val;
+	}
+	snap->gen = vsc->gen;
+	snap->t = t;
+	snap->dt = dt;
+	snap->n = u;
+	return (u);
+}
+
 /*--------------------------------------------------------------------
  */
 
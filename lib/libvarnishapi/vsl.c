@@ -54,9 +54,26 @@
 #include "vapi/vsm.h"
 #include "vapi/vsl.h"
 
+#include "vgz.h"
+
 #include "vsl_api.h"
 #include "vsm_api.h"
 
+/* Block being collected by VSL_WriteIndexed() */
+struct vslw {
+	unsigned			magic;
+#define VSLW_MAGIC			0x3c0e1b92
+	uint32_t			*buf;
+	size_t				len;
+	size_t				space;
+	struct vslf_index		idx;
+
+	/* VSL_WriteDeflate() */
+	int				level;
+	uint32_t			*zbuf;
+	size_t				zspace;
+};
+
 /*--------------------------------------------------------------------*/
 
 const char * const VSL_tags[SLT__MAX] = {
@@ -135,6 +152,12 @@ VSL_Delete(struct VSL_data *vsl)
 	vbit_destroy(vsl->vbm_supress);
 	vsl_IX_free(&vsl->vslf_select);
 	vsl_IX_free(&vsl->vslf_suppress);
+	if (vsl->vslw != NULL) {
+		CHECK_OBJ(vsl->vslw, VSLW_MAGIC);
+		free(vsl->vslw->buf);
+		free(vsl->vslw->zbuf);
+		FREE_OBJ(vsl->vslw);
+	}
 	VSL_ResetError(vsl);
 	FREE_OBJ(vsl);
 }
@@ -168,13 +191,19 @@ vsl_match_IX(struct VSL_data *vsl, const vslf_list *list,
 {
 	enum VSL_tag_e tag;
 	const char *cdata;
-	int len;
+	char ubuf[VSL_UNPACK_MAX];
+	int i, len;
 	const struct vslf *vslf;
 
 	(void)vsl;
 	tag = VSL_TAG(c->rec.ptr);
 	cdata = VSL_CDATA(c->rec.ptr);
 	len = VSL_LEN(c->rec.ptr);
+	i = VSL_Unpack(c->rec.ptr, ubuf, sizeof ubuf);
+	if (i >= 0) {
+		cdata = ubuf;
+		len = i + 1;
+	}
 
 	VTAILQ_FOREACH(vslf, list, list) {
 		CHECK_OBJ_NOTNULL(vslf, VSLF_MAGIC);
@@ -216,6 +245,37 @@ VSL_Match(struct VSL_data *vsl, const struct VSL_cursor *c)
 	return (1);
 }
 
+/*
+ * Work out which tags can make it through VSL_Match(), returns zero if
+ * that is all of them.
+ */
+
+int
+vsl_tagmask(const struct VSL_data *vsl, uint32_t *tags)
+{
+	const struct vslf *vslf;
+	unsigned u, n = 0;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	memset(tags, 0, sizeof(uint32_t) * (SLT__MAX / 32));
+	VTAILQ_FOREACH(vslf, &vsl->vslf_select, list)
+		if (vslf->tags == NULL)
+			return (0);
+	for (u = SLT__Bogus + 1; u < SLT__Reserved; u++) {
+		if (vbit_test(vsl->vbm_supress, u) &&
+		    !vbit_test(vsl->vbm_select, u)) {
+			VTAILQ_FOREACH(vslf, &vsl->vslf_select, list)
+				if (vbit_test(vslf->tags, u))
+					break;
+			if (vslf == NULL)
+				continue;
+		}
+		tags[u >> 5] |= 1U << (u & 31);
+		n++;
+	}
+	return (n < SLT__Reserved - (SLT__Bogus + 1));
+}
+
 static const char * const VSL_transactions[VSL_t__MAX] = {
 	/*                 12345678901234 */
 	[VSL_t_unknown] = "<< Unknown  >>",
@@ -225,6 +285,113 @@ static const char * const VSL_transactions[VSL_t__MAX] = {
 	[VSL_t_raw]	= "<< Record   >>",
 };
 
+/*--------------------------------------------------------------------
+ * Packed records, see vsl_int.h
+ */
+
+int
+VSL_Unpack(const uint32_t *ptr, char *buf, size_t len)
+{
+	const char *d;
+	unsigned l, u;
+	double t[3];
+	uint64_t v;
+	size_t n;
+	int i;
+
+	AN(ptr);
+	AN(buf);
+	assert(len > 0);
+	if (!VSL_PACKED(ptr))
+		return (-1);
+	d = VSL_CDATA(ptr);
+	l = VSL_LEN(ptr);
+	if (l == 0 || d[l - 1] != '\0')
+		return (-1);
+
+	switch (VSL_TAG(ptr)) {
+	case SLT_Timestamp:
+		if (l < sizeof t + 1)
+			return (-1);
+		memcpy(t, d, sizeof t);
+		i = snprintf(buf, len, "%s: %.6f %.6f %.6f",
+		    d + sizeof t, t[0], t[1], t[2]);
+		if (i < 0)
+			return (-1);
+		n = i;
+		break;
+	case SLT_ReqAcct:
+	case SLT_BereqAcct:
+	case SLT_PipeAcct:
+		if (l == 1 || (l - 1) % sizeof v)
+			return (-1);
+		*buf = '\0';
+		n = 0;
+		for (u = 0; u < (l - 1) / sizeof v && n < len; u++) {
+			memcpy(&v, d + u * sizeof v, sizeof v);
+			i = snprintf(buf + n, len - n, "%s%ju",
+			    u ? " " : "", (uintmax_t)v);
+			if (i < 0)
+				return (-1);
+			n += i;
+		}
+		break;
+	default:
+		return (-1);
+	}
+	if (n >= len)
+		n = len - 1;
+	return ((int)n);
+}
+
+int
+VSL_Timestamp(const uint32_t *ptr, const char **label, unsigned *llen,
+    double *t)
+{
+	const char *b, *q;
+	char *p;
+	unsigned l, u;
+
+	AN(ptr);
+	AN(t);
+	if (VSL_TAG(ptr) != SLT_Timestamp)
+		return (-1);
+	b = VSL_CDATA(ptr);
+	l = VSL_LEN(ptr);
+	if (l == 0 || b[l - 1] != '\0')
+		return (-1);
+
+	if (VSL_PACKED(ptr)) {
+		if (l < 3 * sizeof *t + 1)
+			return (-1);
+		memcpy(t, b, 3 * sizeof *t);
+		q = b + 3 * sizeof *t;
+		if (label != NULL)
+			*label = q;
+		if (llen != NULL)
+			*llen = l - 1 - (q - b);
+		return (0);
+	}
+
+	q = strchr(b, ':');
+	if (q == NULL)
+		return (-1);
+	if (label != NULL)
+		*label = b;
+	if (llen != NULL)
+		*llen = q - b;
+	q++;
+	for (u = 0; u < 3; u++) {
+		t[u] = strtod(q, &p);
+		if (p == q)
+			return (-1);
+		q = p;
+	}
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
 #define VSL_PRINT(...)					\
 	do {						\
 		if (0 > fprintf(__VA_ARGS__))		\
@@ -238,7 +405,8 @@ VSL_Print(const struct VSL_data *vsl, const struct VSL_cursor *c, void *fo)
 	uint32_t vxid;
 	unsigned len;
 	const char *data;
-	int type;
+	char ubuf[VSL_UNPACK_MAX];
+	int i, type;
 
 	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
 	if (c == NULL || c->rec.ptr == NULL)
@@ -251,6 +419,11 @@ VSL_Print(const struct VSL_data *vsl, const struct VSL_cursor *c, void *fo)
 	type = VSL_CLIENT(c->rec.ptr) ? 'c' : VSL_BACKEND(c->rec.ptr) ?
 	    'b' : '-';
 	data = VSL_CDATA(c->rec.ptr);
+	i = VSL_Unpack(c->rec.ptr, ubuf, sizeof ubuf);
+	if (i >= 0) {
+		data = ubuf;
+		len = i + 1;
+	}
 
 	if (VSL_tagflags[tag] & SLT_F_BINARY) {
 		VSL_PRINT(fo, "%10u %-14s %c \"", vxid, VSL_tags[tag], type);
@@ -277,6 +450,8 @@ VSL_PrintTerse(const struct VSL_data *vsl, const struct VSL_cursor *c, void *fo)
 	enum VSL_tag_e tag;
 	unsigned len;
 	const char *data;
+	char ubuf[VSL_UNPACK_MAX];
+	int i;
 
 	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
 	if (c == NULL || c->rec.ptr == NULL)
@@ -286,6 +461,11 @@ VSL_PrintTerse(const struct VSL_data *vsl, const struct VSL_cursor *c, void *fo)
 	tag = VSL_TAG(c->rec.ptr);
 	len = VSL_LEN(c->rec.ptr);
 	data = VSL_CDATA(c->rec.ptr);
+	i = VSL_Unpack(c->rec.ptr, ubuf, sizeof ubuf);
+	if (i >= 0) {
+		data = ubuf;
+		len = i + 1;
+	}
 
 	if (VSL_tagflags[tag] & SLT_F_BINARY) {
 		VSL_PRINT(fo, "%-14s \"", VSL_tags[tag]);
@@ -474,3 +654,180 @@ VSL_WriteTransactions(struct VSL_data *vsl, struct VSL_transaction * const pt[],
 		i = VSL_WriteAll(vsl, t->c, fo);
 	return (i);
 }
+
+/*--------------------------------------------------------------------
+ * Indexed writing: records are collected into a block, which goes out
+ * behind a struct vslf_index describing it.
+ */
+
+#define VSLW_BLOCK	(256 * 1024)	/* words */
+
+static void
+vslw_clear(struct vslw *w)
+{
+
+	memset(&w->idx, 0, sizeof w->idx);
+	w->idx.vxid_lo = UINT32_MAX;
+	w->idx.t_lo = UINT32_MAX;
+	w->len = 0;
+}
+
+static void
+vslw_add(struct vslw *w, const uint32_t *p)
+{
+	size_t l;
+	unsigned u;
+	double t, ts[3];
+
+	l = VSL_NEXT(p) - p;
+	if (w->len + l > w->space) {
+		while (w->len + l > w->space)
+			w->space = w->space ? 2 * w->space : VSLW_BLOCK;
+		w->buf = realloc(w->buf, w->space * sizeof *w->buf);
+		AN(w->buf);
+	}
+	memcpy(w->buf + w->len, p, l * sizeof *p);
+	w->len += l;
+
+	u = VSL_TAG(p);
+	w->idx.tags[u >> 5] |= 1U << (u & 31);
+	u = VSL_ID(p);
+	if (u != 0) {
+		if (u < w->idx.vxid_lo)
+			w->idx.vxid_lo = u;
+		if (u > w->idx.vxid_hi)
+			w->idx.vxid_hi = u;
+	}
+	if (VSL_TAG(p) == SLT_Timestamp) {
+		if (VSL_Timestamp(p, NULL, NULL, ts))
+			return;
+		t = ts[0];
+		if (!(t > 0.) || t >= UINT32_MAX)
+			return;
+		if ((uint32_t)t < w->idx.t_lo)
+			w->idx.t_lo = (uint32_t)t;
+		if ((uint32_t)t + 1 > w->idx.t_hi)
+			w->idx.t_hi = (uint32_t)t + 1;
+	}
+}
+
+static struct vslw *
+vslw_get(struct VSL_data *vsl)
+{
+
+	if (vsl->vslw == NULL) {
+		ALLOC_OBJ(vsl->vslw, VSLW_MAGIC);
+		AN(vsl->vslw);
+		vslw_clear(vsl->vslw);
+	}
+	CHECK_OBJ(vsl->vslw, VSLW_MAGIC);
+	return (vsl->vslw);
+}
+
+/*
+ * Deflate the block into zbuf.  A block which does not get any smaller
+ * goes out as it is.
+ */
+
+static const uint32_t *
+vslw_deflate(struct vslw *w)
+{
+	uLongf l;
+	size_t n;
+
+	n = VSL_WORDS(compressBound(VSL_BYTES(w->len)));
+	if (n > w->zspace) {
+		w->zspace = n;
+		w->zbuf = realloc(w->zbuf, VSL_BYTES(w->zspace));
+		AN(w->zbuf);
+	}
+	l = VSL_BYTES(w->zspace);
+	if (compress2((void *)w->zbuf, &l, (const void *)w->buf,
+	    VSL_BYTES(w->len), w->level) != Z_OK ||
+	    VSL_WORDS(l) >= w->len)
+		return (w->buf);
+	n = VSL_WORDS(l);
+	memset((char *)w->zbuf + l, 0, VSL_BYTES(n) - l);
+	w->idx.zlen = l;
+	w->idx.len = n;
+	return (w->zbuf);
+}
+
+int
+VSL_WriteDeflate(struct VSL_data *vsl, int level)
+{
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	if (level < 0 || level > 9)
+		return (vsl_diag(vsl, "Bad deflate level: %d", level));
+	vslw_get(vsl)->level = level;
+	return (0);
+}
+
+int
+VSL_WriteFlush(struct VSL_data *vsl, void *fo)
+{
+	struct vslw *w;
+	const uint32_t *b;
+	size_t r;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	w = vsl->vslw;
+	if (w == NULL || w->len == 0)
+		return (0);
+	CHECK_OBJ(w, VSLW_MAGIC);
+	if (fo == NULL)
+		fo = stdout;
+
+	w->idx.hdr[0] = ((uint32_t)SLT__Reserved << 24) |
+	    (sizeof w->idx - VSL_BYTES(2));
+	w->idx.hdr[1] = 0;
+	w->idx.magic = VSLF_INDEX_MAGIC;
+	w->idx.len = w->len;
+	w->idx.ulen = w->len;
+	w->idx.grouping = vsl->grouping;
+	b = w->buf;
+	if (w->level > 0)
+		b = vslw_deflate(w);
+	r = fwrite(&w->idx, sizeof w->idx, 1, fo);
+	if (r == 1)
+		r = fwrite(b, sizeof *b, w->idx.len, fo);
+	else
+		r = 0;
+	vslw_clear(w);
+	if (r == 0)
+		return (-5);
+	return (0);
+}
+
+int __match_proto__(VSLQ_dispatch_f)
+VSL_WriteIndexed(struct VSL_data *vsl, struct VSL_transaction * const pt[],
+    void *fo)
+{
+	struct VSL_transaction *t;
+	struct vslw *w;
+	int i;
+
+	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
+	if (pt == NULL)
+		return (0);
+	w = vslw_get(vsl);
+
+	for (t = pt[0]; t != NULL; t = *++pt) {
+		while (1) {
+			i = VSL_Next(t->c);
+			if (i < 0)
+				return (i);
+			if (i == 0)
+				break;
+			if (!VSL_Match(vsl, t->c))
+				continue;
+			vslw_add(w, t->c->rec.ptr);
+		}
+	}
+
+	/* Only ever split blocks between dispatches */
+	if (w->len >= VSLW_BLOCK)
+		return (VSL_WriteFlush(vsl, fo));
+	return (0);
+}
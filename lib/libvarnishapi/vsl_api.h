@@ -34,13 +34,56 @@
 /*lint -esym(534, vsl_diag) */
 int vsl_diag(struct VSL_data *vsl, const char *fmt, ...)
     __v_printflike(2, 3);
+int vsl_tagmask(const struct VSL_data *vsl, uint32_t *tags);
 void vsl_vbm_bitset(int bit, void *priv);
 void vsl_vbm_bitclr(int bit, void *priv);
 
+/*
+ * Indexed VSL files (VSL_WriteIndexed) have one of these in front of
+ * every block of records.  It is laid out as a log record with the
+ * SLT__Reserved tag and vxid zero, and is never returned by a cursor.
+ *
+ * The records of a dispatch are never split over two blocks, so a
+ * block holds whole transactions of the grouping it was written with.
+ *
+ * With VSL_WriteDeflate() a block may go out deflated, zlen bytes of
+ * zlib data padded to whole words, which inflate to ulen words.
+ */
+
+struct vslf_index {
+	uint32_t			hdr[2];
+	uint32_t			magic;
+#define VSLF_INDEX_MAGIC		0x5a1d3c71
+	uint32_t			len;		/* words in file */
+	uint32_t			grouping;
+	uint32_t			vxid_lo, vxid_hi;
+	uint32_t			t_lo, t_hi;	/* whole seconds */
+	uint32_t			tags[SLT__MAX / 32];
+	uint32_t			zlen;		/* 0: not deflated */
+	uint32_t			ulen;		/* words in block */
+};
+
+/*
+ * What a query needs from the log: one record with a tag from each of
+ * the n sets.  A cursor may skip parts of the log it knows can not
+ * satisfy this when read with the given grouping.
+ */
+
+#define VSLC_NEED_MAX			4
+
+struct vslc_need {
+	enum VSL_grouping_e		grouping;
+	unsigned			n;
+	uint32_t			tags[VSLC_NEED_MAX][SLT__MAX / 32];
+};
+
 typedef void vslc_delete_f(const struct VSL_cursor *);
 typedef int vslc_next_f(const struct VSL_cursor *);
 typedef int vslc_reset_f(const struct VSL_cursor *);
 typedef int vslc_check_f(const struct VSL_cursor *, const struct VSLC_ptr *);
+typedef void vslc_need_f(const struct VSL_cursor *, const struct vslc_need *);
+typedef int vslc_batch_f(const struct VSL_cursor *, struct VSL_span *,
+    unsigned);
 
 struct vslc_tbl {
 	unsigned			magic;
@@ -50,6 +93,8 @@ struct vslc_tbl {
 	vslc_next_f			*next;
 	vslc_reset_f			*reset;
 	vslc_check_f			*check;
+	vslc_need_f			*need;
+	vslc_batch_f			*batch;
 };
 
 struct vslf {
@@ -63,6 +108,8 @@ struct vslf {
 
 typedef VTAILQ_HEAD(,vslf)		vslf_list;
 
+struct vslw;
+
 struct VSL_data {
 	unsigned			magic;
 #define VSL_MAGIC			0x8E6C92AA
@@ -80,6 +127,10 @@ struct VSL_data {
 	vslf_list			vslf_select;
 	vslf_list			vslf_suppress;
 
+	/* Grouping of the last VSLQ_New(), for VSL_WriteIndexed() */
+	enum VSL_grouping_e		grouping;
+	struct vslw			*vslw;
+
 	int				b_opt;
 	int				c_opt;
 	int				C_opt;
@@ -95,3 +146,5 @@ struct vslq_query *vslq_newquery(struct VSL_data *vsl,
 void vslq_deletequery(struct vslq_query **pquery);
 int vslq_runquery(const struct vslq_query *query,
     struct VSL_transaction * const ptrans[]);
+unsigned vslq_needtags(const struct vslq_query *query,
+    uint32_t (*tags)[SLT__MAX / 32], unsigned max);
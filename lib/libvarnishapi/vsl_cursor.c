@@ -31,10 +31,12 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -42,15 +44,19 @@
 #include "vdef.h"
 #include "vas.h"
 #include "miniobj.h"
+#include "vbm.h"
 #include "vmb.h"
 
 #include "vqueue.h"
 #include "vre.h"
+#include "vsb.h"
 #include "vsl_priv.h"
 
 #include "vapi/vsl.h"
 #include "vapi/vsm.h"
 
+#include "vgz.h"
+
 #include "vsl_api.h"
 #include "vsm_api.h"
 
@@ -68,6 +74,13 @@ struct vslc_vsm {
 	const struct VSL_head		*head;
 	const uint32_t			*end;
 	struct VSLC_ptr			next;
+
+	/* VSL_COPT_TAGSKIP */
+	uint32_t			tags[SLT__MAX / 32];
+	unsigned			skip_n;
+
+	/* Our registration in VSL_DEMANDDIR */
+	char				*demand;
 };
 
 static void
@@ -77,9 +90,70 @@ vslc_vsm_delete(const struct VSL_cursor *cursor)
 
 	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_VSM_MAGIC);
 	assert(&c->cursor == cursor);
+	if (c->demand != NULL) {
+		(void)unlink(c->demand);
+		free(c->demand);
+	}
 	FREE_OBJ(c);
 }
 
+/*
+ * Tell varnishd which tags we want, see vsl_priv.h.  This is best
+ * effort, if the directory is not there or not ours to write, we just
+ * get whatever the other readers asked for.
+ */
+
+static char *
+vslc_vsm_demand(const struct vslc_vsm *c)
+{
+	uint32_t all[SLT__MAX / 32];
+	const uint32_t *tags;
+	struct vsb *vsb;
+	const char *p;
+	char *tmp, *fn;
+	int fd, l;
+
+	CHECK_OBJ_NOTNULL(c->vsm, VSM_MAGIC);
+	AN(c->vsm->fname);
+	if (c->options & VSL_COPT_TAGSKIP)
+		tags = c->tags;
+	else {
+		memset(all, 0xff, sizeof all);
+		tags = all;
+	}
+
+	p = strrchr(c->vsm->fname, '/');
+	l = p == NULL ? 0 : p - c->vsm->fname + 1;
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_printf(vsb, "%.*s%s/.%jd.%p",
+	    l, c->vsm->fname, VSL_DEMANDDIR, (intmax_t)getpid(), c);
+	AZ(VSB_finish(vsb));
+	tmp = strdup(VSB_data(vsb));
+	AN(tmp);
+	VSB_clear(vsb);
+	VSB_printf(vsb, "%.*s%s/%jd.%p",
+	    l, c->vsm->fname, VSL_DEMANDDIR, (intmax_t)getpid(), c);
+	AZ(VSB_finish(vsb));
+	fn = strdup(VSB_data(vsb));
+	AN(fn);
+	VSB_delete(vsb);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0 && write(fd, tags, sizeof all) == sizeof all) {
+		closefd(&fd);
+		if (!rename(tmp, fn)) {
+			free(tmp);
+			return (fn);
+		}
+	} else if (fd >= 0)
+		closefd(&fd);
+	(void)unlink(tmp);
+	free(tmp);
+	free(fn);
+	return (NULL);
+}
+
 /*
  * We tolerate the fact that segment_n wraps around eventually: for the default
  * vsl_space of 80MB and 8 segments, each segment is 10MB long, so we wrap
@@ -114,6 +188,38 @@ vslc_vsm_check(const struct VSL_cursor *cursor, const struct VSLC_ptr *ptr)
 	return (2);
 }
 
+/*
+ * With VSL_COPT_TAGSKIP, jump over whole segments which hold no records
+ * with the tags we are interested in.  A segment can only be judged
+ * once varnishd has moved on from it, before that its tag bits may
+ * still change.
+ */
+
+static void
+vslc_vsm_skip(struct vslc_vsm *c)
+{
+	const uint32_t *t;
+	unsigned u, n;
+
+	while (c->next.priv != c->skip_n) {
+		n = c->head->segment_n;
+		VRMB();
+		if (n == c->next.priv)
+			return;		/* Still being written */
+		t = c->head->tags[c->next.priv % VSL_SEGMENTS];
+		for (u = 0; u < SLT__MAX / 32; u++)
+			if (t[u] & c->tags[u])
+				break;
+		if (u < SLT__MAX / 32) {
+			c->skip_n = c->next.priv;
+			return;
+		}
+		c->next.priv++;
+		c->next.ptr = c->head->log +
+		    c->head->offset[c->next.priv % VSL_SEGMENTS];
+	}
+}
+
 static int
 vslc_vsm_next(const struct VSL_cursor *cursor)
 {
@@ -126,6 +232,9 @@ vslc_vsm_next(const struct VSL_cursor *cursor)
 	CHECK_OBJ_NOTNULL(c->vsm, VSM_MAGIC);
 
 	while (1) {
+		if (c->options & VSL_COPT_TAGSKIP)
+			vslc_vsm_skip(c);
+
 		i = vslc_vsm_check(&c->cursor, &c->next);
 		if (i <= 0)
 			return (-3); /* Overrun */
@@ -175,6 +284,64 @@ vslc_vsm_next(const struct VSL_cursor *cursor)
 	}
 }
 
+/*
+ * Extend the record found by vslc_vsm_next() with the records behind
+ * it, as long as they are complete and in the same stretch of the ring.
+ * The overrun check is done once for the first record, the rest of the
+ * span is newer than that.
+ */
+
+static int
+vslc_vsm_batch(const struct VSL_cursor *cursor, struct VSL_span *span,
+    unsigned max)
+{
+	struct vslc_vsm *c;
+	const uint32_t *p;
+	uint32_t t;
+	int i;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_VSM_MAGIC);
+	assert(&c->cursor == cursor);
+
+	i = vslc_vsm_next(cursor);
+	if (i != 1)
+		return (i);
+	span->ptr = c->cursor.rec.ptr;
+	span->priv = c->cursor.rec.priv;
+	span->n = 1;
+	if (c->options & VSL_COPT_BATCH) {
+		/* Batch records do not iterate with VSL_NEXT */
+		span->end = VSL_NEXT(span->ptr);
+		return (1);
+	}
+
+	p = c->next.ptr;
+	while (span->n < max) {
+		t = *(volatile const uint32_t *)p;
+		if (t == VSL_WRAPMARKER || t == VSL_ENDMARKER)
+			break;
+		if (VSL_TAG(p) == SLT__Batch)
+			break;
+		if ((c->options & VSL_COPT_TAGSKIP) &&
+		    c->next.priv != span->priv)
+			/* Let vslc_vsm_skip() look at the next segment */
+			break;
+		c->cursor.rec.ptr = p;
+		c->cursor.rec.priv = c->next.priv;
+		p = VSL_NEXT(p);
+		while ((p - c->head->log) / c->head->segsize >
+		    c->next.priv % VSL_SEGMENTS)
+			c->next.priv++;
+		span->n++;
+	}
+	c->next.ptr = p;
+	span->end = p;
+
+	assert(c->next.ptr >= c->head->log);
+	assert(c->next.ptr < c->end);
+	return (1);
+}
+
 static int
 vslc_vsm_reset(const struct VSL_cursor *cursor)
 {
@@ -194,6 +361,7 @@ vslc_vsm_reset(const struct VSL_cursor *cursor)
 		/* Start in the same segment varnishd currently is in and
 		   run forward until we see the end */
 		u = c->next.priv = segment_n;
+		c->skip_n = c->next.priv - 1;
 		assert(c->head->offset[c->next.priv % VSL_SEGMENTS] >= 0);
 		c->next.ptr = c->head->log +
 		    c->head->offset[c->next.priv % VSL_SEGMENTS];
@@ -220,6 +388,7 @@ vslc_vsm_reset(const struct VSL_cursor *cursor)
 			assert(c->next.priv % VSL_SEGMENTS != 0);
 			c->next.priv++;
 		}
+		c->skip_n = c->next.priv - 1;
 		assert(c->head->offset[c->next.priv % VSL_SEGMENTS] >= 0);
 		c->next.ptr = c->head->log +
 		    c->head->offset[c->next.priv % VSL_SEGMENTS];
@@ -235,6 +404,7 @@ static const struct vslc_tbl vslc_vsm_tbl = {
 	.next		= vslc_vsm_next,
 	.reset		= vslc_vsm_reset,
 	.check		= vslc_vsm_check,
+	.batch		= vslc_vsm_batch,
 };
 
 struct VSL_cursor *
@@ -268,6 +438,8 @@ VSL_CursorVSM(struct VSL_data *vsl, struct VSM_data *vsm, unsigned options)
 	c->cursor.priv_data = c;
 
 	c->options = options;
+	if ((c->options & VSL_COPT_TAGSKIP) && !vsl_tagmask(vsl, c->tags))
+		c->options &= ~VSL_COPT_TAGSKIP;
 	c->vsm = vsm;
 	c->vf = vf;
 	c->head = head;
@@ -280,10 +452,21 @@ VSL_CursorVSM(struct VSL_data *vsl, struct VSM_data *vsm, unsigned options)
 		FREE_OBJ(c);
 		return (NULL);
 	}
+	c->demand = vslc_vsm_demand(c);
 
 	return (&c->cursor);
 }
 
+/* An inflated block of a VSL_WriteDeflate file */
+struct vslc_zblk {
+	const struct vslf_index		*idx;
+	int				error;
+	uint32_t			*buf;
+	size_t				space;
+	const uint32_t			*p;
+	const uint32_t			*e;
+};
+
 struct vslc_file {
 	unsigned			magic;
 #define VSLC_FILE_MAGIC			0x1D65FFEF
@@ -296,6 +479,32 @@ struct vslc_file {
 
 	struct VSL_cursor		cursor;
 
+	/* Regular files are mapped and read in place */
+	void				*map;
+	size_t				map_len;
+	const uint32_t			*b;
+	const uint32_t			*p;
+	const uint32_t			*e;
+
+	/* Index blocks which can not match these are skipped */
+	unsigned			options;
+	uint32_t			tags[SLT__MAX / 32];
+	struct vslc_need		need;
+
+	/* Records are read from cur while it has any */
+	struct vslc_zblk		zblk[2];
+	struct vslc_zblk		*cur;
+	uint32_t			*zdata;
+	size_t				zspace;
+
+	/* VSL_COPT_PARALLEL: the helper inflates job into ahead */
+	int				helper;
+	int				stop;
+	pthread_t			thread;
+	pthread_mutex_t			mtx;
+	pthread_cond_t			cond;
+	const struct vslf_index		*job;
+	struct vslc_zblk		*ahead;
 };
 
 static void
@@ -305,6 +514,20 @@ vslc_file_delete(const struct VSL_cursor *cursor)
 
 	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_FILE_MAGIC);
 	assert(&c->cursor == cursor);
+	if (c->helper) {
+		AZ(pthread_mutex_lock(&c->mtx));
+		c->stop = 1;
+		AZ(pthread_cond_broadcast(&c->cond));
+		AZ(pthread_mutex_unlock(&c->mtx));
+		AZ(pthread_join(c->thread, NULL));
+		AZ(pthread_cond_destroy(&c->cond));
+		AZ(pthread_mutex_destroy(&c->mtx));
+	}
+	free(c->zblk[0].buf);
+	free(c->zblk[1].buf);
+	free(c->zdata);
+	if (c->map != NULL)
+		AZ(munmap(c->map, c->map_len));
 	if (c->close_fd)
 		(void)close(c->fd);
 	if (c->buf != NULL)
@@ -312,6 +535,233 @@ vslc_file_delete(const struct VSL_cursor *cursor)
 	FREE_OBJ(c);
 }
 
+static int
+vslc_file_overlap(const uint32_t *a, const uint32_t *b)
+{
+	unsigned u;
+
+	for (u = 0; u < SLT__MAX / 32; u++)
+		if (a[u] & b[u])
+			return (1);
+	return (0);
+}
+
+/*
+ * A block can be skipped if it has none of the tags of one of the sets
+ * the query needs, provided it holds whole transactions of the grouping
+ * we read with.  In raw grouping the -i/-I/-x/-X filters work on single
+ * records, so a block with none of the tags they let through is skipped
+ * as well.
+ */
+
+static int
+vslc_file_skip(const struct vslc_file *c, const struct vslf_index *idx)
+{
+	unsigned u;
+
+	if (c->need.grouping == VSL_g_raw &&
+	    (c->options & VSL_COPT_TAGSKIP) &&
+	    !vslc_file_overlap(c->tags, idx->tags))
+		return (1);
+	if (c->need.grouping > idx->grouping)
+		return (0);
+	for (u = 0; u < c->need.n; u++)
+		if (!vslc_file_overlap(c->need.tags[u], idx->tags))
+			return (1);
+	return (0);
+}
+
+static const struct vslf_index *
+vslc_file_idx(const uint32_t *p)
+{
+	const struct vslf_index *idx;
+
+	if (VSL_TAG(p) != SLT__Reserved ||
+	    VSL_LEN(p) != sizeof *idx - VSL_BYTES(2))
+		return (NULL);
+	idx = (const void *)p;
+	if (idx->magic != VSLF_INDEX_MAGIC)
+		return (NULL);
+	if (idx->zlen != 0 && idx->zlen > VSL_BYTES(idx->len))
+		return (NULL);
+	return (idx);
+}
+
+/* Inflate the block behind idx, found at data */
+static void
+vslc_file_inflate(struct vslc_zblk *z, const struct vslf_index *idx,
+    const uint32_t *data)
+{
+	uLongf l;
+
+	AN(idx->zlen);
+	z->idx = idx;
+	z->p = z->e = NULL;
+	if (idx->ulen > z->space) {
+		z->space = idx->ulen;
+		z->buf = realloc(z->buf, VSL_BYTES(z->space));
+		AN(z->buf);
+	}
+	l = VSL_BYTES(idx->ulen);
+	if (uncompress((void *)z->buf, &l, (const void *)data,
+	    idx->zlen) != Z_OK || l != VSL_BYTES(idx->ulen)) {
+		z->error = -4;
+		return;
+	}
+	z->error = 0;
+	z->p = z->buf;
+	z->e = z->buf + idx->ulen;
+}
+
+static void *
+vslc_file_helper(void *priv)
+{
+	struct vslc_file *c;
+	const struct vslf_index *idx;
+	struct vslc_zblk *z;
+
+	CAST_OBJ_NOTNULL(c, priv, VSLC_FILE_MAGIC);
+	AZ(pthread_mutex_lock(&c->mtx));
+	while (!c->stop) {
+		if (c->job == NULL) {
+			AZ(pthread_cond_wait(&c->cond, &c->mtx));
+			continue;
+		}
+		idx = c->job;
+		z = c->ahead;
+		AZ(pthread_mutex_unlock(&c->mtx));
+		vslc_file_inflate(z, idx, (const uint32_t *)(idx + 1));
+		AZ(pthread_mutex_lock(&c->mtx));
+		c->job = NULL;
+		AZ(pthread_cond_broadcast(&c->cond));
+	}
+	AZ(pthread_mutex_unlock(&c->mtx));
+	return (NULL);
+}
+
+/*
+ * Find the next deflated block from p on which will not be skipped,
+ * looking no further than the next index which is not for one.
+ */
+
+static const struct vslf_index *
+vslc_file_lookahead(const struct vslc_file *c, const uint32_t *p)
+{
+	const struct vslf_index *idx;
+
+	while (c->e - p >= VSL_WORDS(sizeof *idx)) {
+		idx = vslc_file_idx(p);
+		if (idx == NULL)
+			return (NULL);
+		p = (const uint32_t *)(idx + 1);
+		if (idx->len > c->e - p)
+			return (NULL);
+		if (!vslc_file_skip(c, idx))
+			return (idx->zlen != 0 ? idx : NULL);
+		p += idx->len;
+	}
+	return (NULL);
+}
+
+/* Inflate the block at c->p, unless the helper has it ready */
+static void
+vslc_file_zblk(struct vslc_file *c, const struct vslf_index *idx)
+{
+	struct vslc_zblk *z;
+
+	if (!c->helper && (c->options & VSL_COPT_PARALLEL)) {
+		/* Started with the first deflated block */
+		AZ(pthread_mutex_init(&c->mtx, NULL));
+		AZ(pthread_cond_init(&c->cond, NULL));
+		AZ(pthread_create(&c->thread, NULL, vslc_file_helper, c));
+		c->helper = 1;
+	}
+	if (!c->helper) {
+		vslc_file_inflate(c->cur, idx, c->p);
+		return;
+	}
+	AZ(pthread_mutex_lock(&c->mtx));
+	while (c->job != NULL)
+		AZ(pthread_cond_wait(&c->cond, &c->mtx));
+	if (c->ahead->idx == idx) {
+		z = c->cur;
+		c->cur = c->ahead;
+		c->ahead = z;
+	} else
+		vslc_file_inflate(c->cur, idx, c->p);
+	c->job = vslc_file_lookahead(c, c->p + idx->len);
+	if (c->job != NULL)
+		AZ(pthread_cond_signal(&c->cond));
+	AZ(pthread_mutex_unlock(&c->mtx));
+}
+
+static int
+vslc_file_index(struct vslc_file *c, const uint32_t *p)
+{
+	const struct vslf_index *idx;
+
+	idx = vslc_file_idx(p);
+	if (idx == NULL)
+		return (0);
+	if (!vslc_file_skip(c, idx) && idx->zlen == 0)
+		return (0);
+	if (idx->len > c->e - c->p) {
+		c->p = c->e;
+		return (0);
+	}
+	if (!vslc_file_skip(c, idx)) {
+		vslc_file_zblk(c, idx);
+		if (c->cur->error)
+			return (c->error = c->cur->error);
+	}
+	c->p += idx->len;
+	return (0);
+}
+
+/* Take the next record from p, if there is a whole one before e */
+static const uint32_t *
+vslc_file_take(const uint32_t **pp, const uint32_t *e)
+{
+	const uint32_t *p;
+	size_t l;
+
+	p = *pp;
+	if (p == NULL || e - p < 2)
+		return (NULL);
+	l = 2 + VSL_WORDS(VSL_LEN(p));
+	if (e - p < l)
+		return (NULL);
+	*pp += l;
+	return (p);
+}
+
+static int
+vslc_file_next_map(struct vslc_file *c)
+{
+	const uint32_t *p;
+	int i;
+
+	while (1) {
+		c->cursor.rec.ptr = NULL;
+		p = vslc_file_take(&c->cur->p, c->cur->e);
+		if (p == NULL) {
+			p = vslc_file_take(&c->p, c->e);
+			if (p == NULL)
+				return (-1);	/* EOF, maybe truncated */
+			if (VSL_TAG(p) == SLT__Reserved) {
+				i = vslc_file_index(c, p);
+				if (i)
+					return (i);
+				continue;
+			}
+		}
+		if (VSL_TAG(p) != SLT__Batch && VSL_TAG(p) != SLT__Reserved)
+			break;
+	}
+	c->cursor.rec.ptr = p;
+	return (1);
+}
+
 /* Read n bytes from fd into buf */
 static ssize_t
 vslc_file_readn(int fd, void *buf, size_t n)
@@ -328,10 +778,31 @@ vslc_file_readn(int fd, void *buf, size_t n)
 	return (t);
 }
 
+/* Read and inflate the deflated block behind idx */
+static int
+vslc_file_readz(struct vslc_file *c, const struct vslf_index *idx)
+{
+	ssize_t i;
+
+	if (idx->len > c->zspace) {
+		c->zspace = idx->len;
+		c->zdata = realloc(c->zdata, VSL_BYTES(c->zspace));
+		AN(c->zdata);
+	}
+	i = vslc_file_readn(c->fd, c->zdata, VSL_BYTES(idx->len));
+	if (i < 0)
+		return (-4);	/* I/O error */
+	if (i == 0)
+		return (-1);	/* EOF */
+	vslc_file_inflate(c->cur, idx, c->zdata);
+	return (c->error = c->cur->error);
+}
+
 static int
 vslc_file_next(const struct VSL_cursor *cursor)
 {
 	struct vslc_file *c;
+	const struct vslf_index *idx;
 	ssize_t i;
 	size_t l;
 
@@ -340,9 +811,13 @@ vslc_file_next(const struct VSL_cursor *cursor)
 
 	if (c->error)
 		return (c->error);
+	if (c->map != NULL)
+		return (vslc_file_next_map(c));
 
 	do {
-		c->cursor.rec.ptr = NULL;
+		c->cursor.rec.ptr = vslc_file_take(&c->cur->p, c->cur->e);
+		if (c->cursor.rec.ptr != NULL)
+			continue;
 		assert(c->buflen >= 2);
 		i = vslc_file_readn(c->fd, c->buf, VSL_BYTES(2));
 		if (i < 0)
@@ -367,7 +842,14 @@ vslc_file_next(const struct VSL_cursor *cursor)
 			assert(i == VSL_BYTES(l - 2));
 		}
 		c->cursor.rec.ptr = c->buf;
-	} while (VSL_TAG(c->cursor.rec.ptr) == SLT__Batch);
+		idx = vslc_file_idx(c->buf);
+		if (idx != NULL && idx->zlen != 0) {
+			i = vslc_file_readz(c, idx);
+			if (i)
+				return (i);
+		}
+	} while (VSL_TAG(c->cursor.rec.ptr) == SLT__Batch ||
+	    VSL_TAG(c->cursor.rec.ptr) == SLT__Reserved);
 	return (1);
 }
 
@@ -379,12 +861,38 @@ vslc_file_reset(const struct VSL_cursor *cursor)
 	return (-1);
 }
 
+static int
+vslc_file_check(const struct VSL_cursor *cursor, const struct VSLC_ptr *ptr)
+{
+	struct vslc_file *c;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_FILE_MAGIC);
+	assert(&c->cursor == cursor);
+
+	/* Mapped records stay put, anything else is in our buffer */
+	if (c->map != NULL && ptr->ptr >= c->b && ptr->ptr < c->e)
+		return (2);
+	return (-1);
+}
+
+static void
+vslc_file_need(const struct VSL_cursor *cursor, const struct vslc_need *need)
+{
+	struct vslc_file *c;
+
+	CAST_OBJ_NOTNULL(c, cursor->priv_data, VSLC_FILE_MAGIC);
+	assert(&c->cursor == cursor);
+	AN(need);
+	c->need = *need;
+}
+
 static const struct vslc_tbl vslc_file_tbl = {
 	.magic		= VSLC_TBL_MAGIC,
 	.delete		= vslc_file_delete,
 	.next		= vslc_file_next,
 	.reset		= vslc_file_reset,
-	.check		= NULL,
+	.check		= vslc_file_check,
+	.need		= vslc_file_need,
 };
 
 struct VSL_cursor *
@@ -395,10 +903,11 @@ VSL_CursorFile(struct VSL_data *vsl, const char *name, unsigned options)
 	int close_fd = 0;
 	char buf[] = VSL_FILE_ID;
 	ssize_t i;
+	struct stat st;
+	void *map = NULL;
 
 	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
 	AN(name);
-	(void)options;
 
 	if (!strcmp(name, "-"))
 		fd = STDIN_FILENO;
@@ -428,8 +937,17 @@ VSL_CursorFile(struct VSL_data *vsl, const char *name, unsigned options)
 		return (NULL);
 	}
 
+	if (close_fd && !fstat(fd, &st) && S_ISREG(st.st_mode) &&
+	    st.st_size > (off_t)sizeof buf) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+			map = NULL;	/* Fall back to read(2) */
+	}
+
 	ALLOC_OBJ(c, VSLC_FILE_MAGIC);
 	if (c == NULL) {
+		if (map != NULL)
+			AZ(munmap(map, st.st_size));
 		if (close_fd)
 			(void)close(fd);
 		vsl_diag(vsl, "Out of memory");
@@ -444,6 +962,21 @@ VSL_CursorFile(struct VSL_data *vsl, const char *name, unsigned options)
 	c->buf = malloc(VSL_BYTES(c->buflen));
 	AN(c->buf);
 
+	c->cur = &c->zblk[0];
+	c->ahead = &c->zblk[1];
+
+	if (map != NULL) {
+		c->map = map;
+		c->map_len = st.st_size;
+		c->b = (const uint32_t *)((const char *)map + sizeof buf);
+		c->p = c->b;
+		c->e = c->b + (st.st_size - sizeof buf) / 4;
+	}
+	c->options = options;
+	if ((c->options & VSL_COPT_TAGSKIP) && !vsl_tagmask(vsl, c->tags))
+		c->options &= ~VSL_COPT_TAGSKIP;
+	c->need.grouping = VSL_g__MAX;
+
 	return (&c->cursor);
 }
 
@@ -479,6 +1012,43 @@ VSL_Next(const struct VSL_cursor *cursor)
 	return ((tbl->next)(cursor));
 }
 
+int
+VSL_NextBatch(const struct VSL_cursor *cursor, struct VSL_span *span,
+    unsigned max)
+{
+	const struct vslc_tbl *tbl;
+	int i;
+
+	CAST_OBJ_NOTNULL(tbl, cursor->priv_tbl, VSLC_TBL_MAGIC);
+	AN(span);
+	assert(max > 0);
+	memset(span, 0, sizeof *span);
+	if (tbl->batch != NULL)
+		return ((tbl->batch)(cursor, span, max));
+	AN(tbl->next);
+	i = (tbl->next)(cursor);
+	if (i != 1)
+		return (i);
+	span->ptr = cursor->rec.ptr;
+	span->end = VSL_NEXT(cursor->rec.ptr);
+	span->priv = cursor->rec.priv;
+	span->n = 1;
+	return (1);
+}
+
+int
+VSL_ReleaseBatch(const struct VSL_cursor *cursor, const struct VSL_span *span)
+{
+	struct VSLC_ptr ptr;
+
+	AN(span);
+	if (span->n == 0)
+		return (2);
+	ptr.ptr = span->ptr;
+	ptr.priv = span->priv;
+	return (VSL_Check(cursor, &ptr));
+}
+
 int
 VSL_Check(const struct VSL_cursor *cursor, const struct VSLC_ptr *ptr)
 {
@@ -42,13 +42,13 @@
 #include "vqueue.h"
 #include "vre.h"
 #include "vtim.h"
-#include "vtree.h"
 
 #include "vapi/vsl.h"
 
 #include "vsl_api.h"
 
-#define VTX_CACHE 10
+#define VTX_ARENA 64
+#define VTX_HASH_BITS 8
 #define VTX_BUFSIZE_MIN 64
 #define VTX_SHMCHUNKS 3
 
@@ -134,9 +134,8 @@ struct vslc_vtx {
 
 struct vtx_key {
 	unsigned		vxid;
-	VRB_ENTRY(vtx_key)	entry;
+	struct vtx_key		*next;	/* Hash chain */
 };
-VRB_HEAD(vtx_tree, vtx_key);
 
 struct vtx {
 	struct vtx_key		key;
@@ -174,6 +173,19 @@ struct vtx {
 	struct vslc_vtx		c;
 };
 
+/*
+ * vtx structures are allocated VTX_ARENA at a time, and go back on the
+ * cache list when retired, rather than being malloc'ed and freed one by
+ * one.  The arenas are only freed with the VSLQ.
+ */
+
+struct vtx_arena {
+	unsigned		magic;
+#define VTX_ARENA_MAGIC		0x5A1F03C6
+	VTAILQ_ENTRY(vtx_arena)	list;
+	struct vtx		vtx[VTX_ARENA];
+};
+
 struct VSLQ {
 	unsigned		magic;
 #define VSLQ_MAGIC		0x23A8BE97
@@ -185,13 +197,14 @@ struct VSLQ {
 	enum VSL_grouping_e	grouping;
 
 	/* Structured mode */
-	struct vtx_tree		tree;
+	struct vtx_key		**hash;
+	unsigned		hash_bits;
 	VTAILQ_HEAD(,vtx)	ready;
 	VTAILQ_HEAD(,vtx)	incomplete;
 	unsigned		n_outstanding;
 	struct chunkhead	shmrefs;
 	VTAILQ_HEAD(,vtx)	cache;
-	unsigned		n_cache;
+	VTAILQ_HEAD(,vtx_arena)	arenas;
 
 	/* Raw mode */
 	struct {
@@ -211,18 +224,65 @@ static int vtx_diag(struct vtx *vtx, const char *msg);
 static int vtx_diag_tag(struct vtx *vtx, const uint32_t *ptr,
     const char *reason);
 
-static inline int
-vtx_keycmp(const struct vtx_key *a, const struct vtx_key *b)
+/*--------------------------------------------------------------------
+ * The vtx's we are tracking, hashed by vxid.  The table is doubled as
+ * the number of outstanding transactions grows past its size, and never
+ * shrunk.
+ */
+
+static inline struct vtx_key **
+vtx_hash_slot(const struct VSLQ *vslq, unsigned vxid)
 {
-	if (a->vxid < b->vxid)
-		return (-1);
-	if (a->vxid > b->vxid)
-		return (1);
-	return (0);
+
+	return (&vslq->hash[(vxid * 0x9E3779B1U) >> (32 - vslq->hash_bits)]);
+}
+
+static void
+vtx_hash_grow(struct VSLQ *vslq)
+{
+	struct vtx_key **old, *key, **slot;
+	unsigned u, n;
+
+	old = vslq->hash;
+	n = 1U << vslq->hash_bits;
+	vslq->hash_bits++;
+	vslq->hash = calloc(2 * n, sizeof *vslq->hash);
+	AN(vslq->hash);
+	for (u = 0; u < n; u++) {
+		while ((key = old[u]) != NULL) {
+			old[u] = key->next;
+			slot = vtx_hash_slot(vslq, key->vxid);
+			key->next = *slot;
+			*slot = key;
+		}
+	}
+	free(old);
 }
 
-VRB_PROTOTYPE_STATIC(vtx_tree, vtx_key, entry, vtx_keycmp)
-VRB_GENERATE_STATIC(vtx_tree, vtx_key, entry, vtx_keycmp)
+static void
+vtx_hash_insert(struct VSLQ *vslq, struct vtx_key *key)
+{
+	struct vtx_key **slot;
+
+	if (vslq->n_outstanding >= 1U << vslq->hash_bits &&
+	    vslq->hash_bits < 24)
+		vtx_hash_grow(vslq);
+	slot = vtx_hash_slot(vslq, key->vxid);
+	key->next = *slot;
+	*slot = key;
+}
+
+static void
+vtx_hash_remove(const struct VSLQ *vslq, struct vtx_key *key)
+{
+	struct vtx_key **slot;
+
+	for (slot = vtx_hash_slot(vslq, key->vxid); *slot != key;
+	    slot = &(*slot)->next)
+		AN(*slot);
+	*slot = key->next;
+	key->next = NULL;
+}
 
 static int
 vslc_raw_next(const struct VSL_cursor *cursor)
@@ -465,23 +525,20 @@ vtx_append(struct VSLQ *vslq, struct vtx *vtx, const struct VSLC_ptr *start,
 	vtx->len += len;
 }
 
-/* Allocate a new vtx structure */
-static struct vtx *
-vtx_new(struct VSLQ *vslq)
+/* Set up the vtx structures of a new arena and put them in the cache */
+static void
+vtx_new_arena(struct VSLQ *vslq)
 {
+	struct vtx_arena *va;
 	struct vtx *vtx;
-	int i;
-
-	AN(vslq);
-	if (vslq->n_cache) {
-		AZ(VTAILQ_EMPTY(&vslq->cache));
-		vtx = VTAILQ_FIRST(&vslq->cache);
-		VTAILQ_REMOVE(&vslq->cache, vtx, list_child);
-		vslq->n_cache--;
-	} else {
-		ALLOC_OBJ(vtx, VTX_MAGIC);
-		AN(vtx);
-
+	int i, u;
+
+	ALLOC_OBJ(va, VTX_ARENA_MAGIC);
+	AN(va);
+	VTAILQ_INSERT_TAIL(&vslq->arenas, va, list);
+	for (u = 0; u < VTX_ARENA; u++) {
+		vtx = &va->vtx[u];
+		vtx->magic = VTX_MAGIC;
 		VTAILQ_INIT(&vtx->child);
 		VTAILQ_INIT(&vtx->shmchunks_free);
 		for (i = 0; i < VTX_SHMCHUNKS; i++) {
@@ -497,7 +554,21 @@ vtx_new(struct VSLQ *vslq)
 		vtx->c.vtx = vtx;
 		vtx->c.cursor.priv_tbl = &vslc_vtx_tbl;
 		vtx->c.cursor.priv_data = &vtx->c;
+		VTAILQ_INSERT_TAIL(&vslq->cache, vtx, list_child);
 	}
+}
+
+/* Allocate a new vtx structure */
+static struct vtx *
+vtx_new(struct VSLQ *vslq)
+{
+	struct vtx *vtx;
+
+	AN(vslq);
+	if (VTAILQ_EMPTY(&vslq->cache))
+		vtx_new_arena(vslq);
+	vtx = VTAILQ_FIRST(&vslq->cache);
+	VTAILQ_REMOVE(&vslq->cache, vtx, list_child);
 
 	CHECK_OBJ_NOTNULL(vtx, VTX_MAGIC);
 	vtx->key.vxid = 0;
@@ -547,7 +618,7 @@ vtx_retire(struct VSLQ *vslq, struct vtx **pvtx)
 	AZ(vtx->n_child);
 	AZ(vtx->n_descend);
 	vtx->n_childready = 0;
-	AN(VRB_REMOVE(vtx_tree, &vslq->tree, &vtx->key));
+	vtx_hash_remove(vslq, &vtx->key);
 	vtx->key.vxid = 0;
 	vtx->flags = 0;
 
@@ -575,25 +646,20 @@ vtx_retire(struct VSLQ *vslq, struct vtx **pvtx)
 	AN(vslq->n_outstanding);
 	vslq->n_outstanding--;
 
-	if (vslq->n_cache < VTX_CACHE) {
-		VTAILQ_INSERT_HEAD(&vslq->cache, vtx, list_child);
-		vslq->n_cache++;
-	} else {
-		FREE_OBJ(vtx);
-		vtx = NULL;
-	}
+	VTAILQ_INSERT_HEAD(&vslq->cache, vtx, list_child);
 }
 
 /* Lookup a vtx by vxid from the managed list */
 static struct vtx *
 vtx_lookup(const struct VSLQ *vslq, unsigned vxid)
 {
-	struct vtx_key lkey, *key;
+	struct vtx_key *key;
 	struct vtx *vtx;
 
 	AN(vslq);
-	lkey.vxid = vxid;
-	key = VRB_FIND(vtx_tree, &vslq->tree, &lkey);
+	for (key = *vtx_hash_slot(vslq, vxid); key != NULL; key = key->next)
+		if (key->vxid == vxid)
+			break;
 	if (key == NULL)
 		return (NULL);
 	CAST_OBJ_NOTNULL(vtx, (void *)key, VTX_MAGIC);
@@ -610,7 +676,8 @@ vtx_add(struct VSLQ *vslq, unsigned vxid)
 	vtx = vtx_new(vslq);
 	AN(vtx);
 	vtx->key.vxid = vxid;
-	AZ(VRB_INSERT(vtx_tree, &vslq->tree, &vtx->key));
+	AZ(vtx_lookup(vslq, vxid));
+	vtx_hash_insert(vslq, &vtx->key);
 	VTAILQ_INSERT_TAIL(&vslq->incomplete, vtx, list_vtx);
 	vslq->n_outstanding++;
 	return (vtx);
@@ -1049,6 +1116,26 @@ vtx_diag_tag(struct vtx *vtx, const uint32_t *ptr, const char *reason)
 	return (-1);
 }
 
+/* Tell the cursor what the query needs, so it can skip what it can */
+static void
+vslq_cursor_need(const struct VSLQ *vslq)
+{
+	const struct vslc_tbl *tbl;
+	struct vslc_need need;
+
+	if (vslq->c == NULL)
+		return;
+	CAST_OBJ_NOTNULL(tbl, vslq->c->priv_tbl, VSLC_TBL_MAGIC);
+	if (tbl->need == NULL)
+		return;
+	memset(&need, 0, sizeof need);
+	need.grouping = vslq->grouping;
+	if (vslq->query != NULL)
+		need.n = vslq_needtags(vslq->query, need.tags,
+		    VSLC_NEED_MAX);
+	tbl->need(vslq->c, &need);
+}
+
 struct VSLQ *
 VSLQ_New(struct VSL_data *vsl, struct VSL_cursor **cp,
     enum VSL_grouping_e grouping, const char *querystring)
@@ -1079,11 +1166,14 @@ VSLQ_New(struct VSL_data *vsl, struct VSL_cursor **cp,
 	vslq->query = query;
 
 	/* Setup normal mode */
-	VRB_INIT(&vslq->tree);
+	vslq->hash_bits = VTX_HASH_BITS;
+	vslq->hash = calloc(1U << vslq->hash_bits, sizeof *vslq->hash);
+	AN(vslq->hash);
 	VTAILQ_INIT(&vslq->ready);
 	VTAILQ_INIT(&vslq->incomplete);
 	VTAILQ_INIT(&vslq->shmrefs);
 	VTAILQ_INIT(&vslq->cache);
+	VTAILQ_INIT(&vslq->arenas);
 
 	/* Setup raw mode */
 	vslq->raw.c.magic = VSLC_RAW_MAGIC;
@@ -1096,6 +1186,8 @@ VSLQ_New(struct VSL_data *vsl, struct VSL_cursor **cp,
 	vslq->raw.ptrans[0] = &vslq->raw.trans;
 	vslq->raw.ptrans[1] = NULL;
 
+	vsl->grouping = grouping;
+	vslq_cursor_need(vslq);
 	return (vslq);
 }
 
@@ -1103,7 +1195,7 @@ void
 VSLQ_Delete(struct VSLQ **pvslq)
 {
 	struct VSLQ *vslq;
-	struct vtx *vtx;
+	struct vtx_arena *va;
 
 	TAKE_OBJ_NOTNULL(vslq, pvslq, VSLQ_MAGIC);
 
@@ -1119,13 +1211,13 @@ VSLQ_Delete(struct VSLQ **pvslq)
 		vslq_deletequery(&vslq->query);
 	AZ(vslq->query);
 
-	while (!VTAILQ_EMPTY(&vslq->cache)) {
-		AN(vslq->n_cache);
-		vtx = VTAILQ_FIRST(&vslq->cache);
-		VTAILQ_REMOVE(&vslq->cache, vtx, list_child);
-		vslq->n_cache--;
-		FREE_OBJ(vtx);
+	while (!VTAILQ_EMPTY(&vslq->arenas)) {
+		va = VTAILQ_FIRST(&vslq->arenas);
+		CHECK_OBJ_NOTNULL(va, VTX_ARENA_MAGIC);
+		VTAILQ_REMOVE(&vslq->arenas, va, list);
+		FREE_OBJ(va);
 	}
+	free(vslq->hash);
 
 	FREE_OBJ(vslq);
 }
@@ -1147,6 +1239,7 @@ VSLQ_SetCursor(struct VSLQ *vslq, struct VSL_cursor **cp)
 		AN(*cp);
 		vslq->c = *cp;
 		*cp = NULL;
+		vslq_cursor_need(vslq);
 	}
 }
 
@@ -29,6 +29,7 @@
  */
 
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -52,11 +53,21 @@
 #include "vsl_api.h"
 #include "vxp.h"
 
+struct vslq_op;
+
 struct vslq_query {
 	unsigned		magic;
 #define VSLQ_QUERY_MAGIC	0x122322A5
 
 	struct vex		*vex;
+
+	/* Compiled program, see vslq_compile() */
+	unsigned		n_op;
+	struct vslq_op		*op;
+	unsigned		n_leaf;
+	const struct vex	**leaf;
+	/* Per tag, the leaves wanting it, terminated by UINT_MAX */
+	unsigned		*tag_leaf[SLT__MAX];
 };
 
 #define VSLQ_TEST_NUMOP(TYPE, PRE_LHS, OP, PRE_RHS)	\
@@ -80,7 +91,7 @@ vslq_test_rec(const struct vex *vex, const struct VSLC_ptr *rec)
 	long long lhs_int = 0;
 	double lhs_float = 0.;
 	const char *b, *e, *q;
-	char *p;
+	char *p, ubuf[VSL_UNPACK_MAX];
 	int i;
 
 	AN(vex);
@@ -88,6 +99,11 @@ vslq_test_rec(const struct vex *vex, const struct VSLC_ptr *rec)
 
 	b = VSL_CDATA(rec->ptr);
 	e = b + VSL_LEN(rec->ptr) - 1;
+	i = VSL_Unpack(rec->ptr, ubuf, sizeof ubuf);
+	if (i >= 0) {
+		b = ubuf;
+		e = b + i;
+	}
 
 	/* Prefix */
 	if (vex->lhs->prefix != NULL) {
@@ -217,32 +233,153 @@ vslq_test_rec(const struct vex *vex, const struct VSLC_ptr *rec)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * The vex tree is compiled into a flat program, with the leaves (the
+ * record tests) numbered, and every operator after its operands.  The
+ * records of a transaction group are then walked once, and each record
+ * is only shown to the leaves which want its tag.  A leaf is true once a
+ * record matched it, and the program is evaluated in three-valued logic
+ * each time a leaf turns true, so we can stop as soon as the outcome is
+ * known.  Leaves still open at the end are false.
+ */
+
+#define VSLQ_F		0
+#define VSLQ_U		1
+#define VSLQ_T		2
+
+struct vslq_op {
+	unsigned		tok;		/* T_OR, T_AND, T_NOT or 0 */
+	unsigned		a, b;		/* Operand ops */
+	unsigned		leaf;
+};
+
 static int
-vslq_test(const struct vex *vex, struct VSL_transaction * const ptrans[])
+vslq_level(const struct vex_lhs *lhs, const struct VSL_transaction *t)
+{
+
+	if (lhs->level < 0)
+		return (1);
+	if (lhs->level_pm < 0)
+		/* OK if less than or equal */
+		return (t->level <= lhs->level);
+	if (lhs->level_pm > 0)
+		/* OK if greater than or equal */
+		return (t->level >= lhs->level);
+	/* OK if equal */
+	return (t->level == lhs->level);
+}
+
+static unsigned
+vslq_count(const struct vex *vex, unsigned *nleaf)
 {
-	struct VSL_transaction *t;
-	int i;
 
 	CHECK_OBJ_NOTNULL(vex, VEX_MAGIC);
-	CHECK_OBJ_NOTNULL(vex->lhs, VEX_LHS_MAGIC);
-	AN(vex->lhs->tags);
+	switch (vex->tok) {
+	case T_OR:
+	case T_AND:
+		return (1 + vslq_count(vex->a, nleaf) +
+		    vslq_count(vex->b, nleaf));
+	case T_NOT:
+		return (1 + vslq_count(vex->a, nleaf));
+	default:
+		(*nleaf)++;
+		return (1);
+	}
+}
+
+static unsigned
+vslq_compile(struct vslq_query *query, const struct vex *vex)
+{
+	struct vslq_op op;
 
+	CHECK_OBJ_NOTNULL(vex, VEX_MAGIC);
+	memset(&op, 0, sizeof op);
+	switch (vex->tok) {
+	case T_OR:
+	case T_AND:
+		AN(vex->a);
+		AN(vex->b);
+		op.tok = vex->tok;
+		op.a = vslq_compile(query, vex->a);
+		op.b = vslq_compile(query, vex->b);
+		break;
+	case T_NOT:
+		AN(vex->a);
+		AZ(vex->b);
+		op.tok = vex->tok;
+		op.a = vslq_compile(query, vex->a);
+		break;
+	default:
+		CHECK_OBJ_NOTNULL(vex->lhs, VEX_LHS_MAGIC);
+		AN(vex->lhs->tags);
+		op.leaf = query->n_leaf;
+		query->leaf[query->n_leaf++] = vex;
+		break;
+	}
+	query->op[query->n_op] = op;
+	return (query->n_op++);
+}
+
+static int
+vslq_eval(const struct vslq_query *query, const unsigned char *hit,
+    unsigned char *st)
+{
+	const struct vslq_op *op;
+	unsigned u;
+
+	for (u = 0; u < query->n_op; u++) {
+		op = &query->op[u];
+		switch (op->tok) {
+		case T_OR:
+			if (st[op->a] == VSLQ_T || st[op->b] == VSLQ_T)
+				st[u] = VSLQ_T;
+			else if (st[op->a] == VSLQ_F && st[op->b] == VSLQ_F)
+				st[u] = VSLQ_F;
+			else
+				st[u] = VSLQ_U;
+			break;
+		case T_AND:
+			if (st[op->a] == VSLQ_F || st[op->b] == VSLQ_F)
+				st[u] = VSLQ_F;
+			else if (st[op->a] == VSLQ_T && st[op->b] == VSLQ_T)
+				st[u] = VSLQ_T;
+			else
+				st[u] = VSLQ_U;
+			break;
+		case T_NOT:
+			st[u] = VSLQ_T - st[op->a];
+			break;
+		default:
+			st[u] = hit[op->leaf];
+			break;
+		}
+	}
+	return (st[query->n_op - 1]);
+}
+
+static int
+vslq_exec(const struct vslq_query *query,
+    struct VSL_transaction * const ptrans[])
+{
+	struct VSL_transaction *t;
+	const struct vex *vex;
+	unsigned char hit[query->n_leaf];
+	unsigned char active[query->n_leaf];
+	unsigned char st[query->n_op];
+	const unsigned *lp;
+	unsigned u, n;
+	int i, r;
+
+	memset(hit, VSLQ_U, sizeof hit);
 	for (t = ptrans[0]; t != NULL; t = *++ptrans) {
-		if (vex->lhs->level >= 0) {
-			if (vex->lhs->level_pm < 0) {
-				/* OK if less than or equal */
-				if (t->level > vex->lhs->level)
-					continue;
-			} else if (vex->lhs->level_pm > 0) {
-				/* OK if greater than or equal */
-				if (t->level < vex->lhs->level)
-					continue;
-			} else {
-				/* OK if equal */
-				if (t->level != vex->lhs->level)
-					continue;
-			}
+		n = 0;
+		for (u = 0; u < query->n_leaf; u++) {
+			active[u] = hit[u] == VSLQ_U &&
+			    vslq_level(query->leaf[u]->lhs, t);
+			n += active[u];
 		}
+		if (n == 0)
+			continue;
 
 		AZ(VSL_ResetCursor(t->c));
 		while (1) {
@@ -254,51 +391,60 @@ vslq_test(const struct vex *vex, struct VSL_transaction * const ptrans[])
 			assert(i == 1);
 			AN(t->c->rec.ptr);
 
-			if (!vbit_test(vex->lhs->tags, VSL_TAG(t->c->rec.ptr)))
+			lp = query->tag_leaf[VSL_TAG(t->c->rec.ptr)];
+			if (lp == NULL)
 				continue;
-
-			i = vslq_test_rec(vex, &t->c->rec);
-			if (i)
-				return (i);
+			r = VSLQ_U;
+			for (; *lp != UINT_MAX; lp++) {
+				if (!active[*lp])
+					continue;
+				vex = query->leaf[*lp];
+				if (!vslq_test_rec(vex, &t->c->rec))
+					continue;
+				hit[*lp] = VSLQ_T;
+				active[*lp] = 0;
+				r = vslq_eval(query, hit, st);
+				if (r != VSLQ_U)
+					return (r == VSLQ_T);
+			}
 		}
 	}
 
-	return (0);
+	for (u = 0; u < query->n_leaf; u++)
+		if (hit[u] == VSLQ_U)
+			hit[u] = VSLQ_F;
+	return (vslq_eval(query, hit, st) == VSLQ_T);
 }
 
-static int
-vslq_exec(const struct vex *vex, struct VSL_transaction * const ptrans[])
+static void
+vslq_newprog(struct vslq_query *query)
 {
-	int r;
-
-	CHECK_OBJ_NOTNULL(vex, VEX_MAGIC);
-
-	switch (vex->tok) {
-	case T_OR:
-		AN(vex->a);
-		AN(vex->b);
-		r = vslq_exec(vex->a, ptrans);
-		if (r != 0)
-			return (r);
-		return (vslq_exec(vex->b, ptrans));
-	case T_AND:
-		AN(vex->a);
-		AN(vex->b);
-		r = vslq_exec(vex->a, ptrans);
-		if (r <= 0)
-			return (r);
-		return (vslq_exec(vex->b, ptrans));
-	case T_NOT:
-		AN(vex->a);
-		AZ(vex->b);
-		r = vslq_exec(vex->a, ptrans);
-		if (r < 0)
-			return (r);
-		return (!r);
-	default:
-		return (vslq_test(vex, ptrans));
+	unsigned n, u, t;
+
+	n = vslq_count(query->vex, &query->n_leaf);
+	query->op = calloc(n, sizeof *query->op);
+	AN(query->op);
+	query->leaf = calloc(query->n_leaf, sizeof *query->leaf);
+	AN(query->leaf);
+	query->n_leaf = 0;
+	(void)vslq_compile(query, query->vex);
+	assert(query->n_op == n);
+
+	for (t = 0; t < SLT__MAX; t++) {
+		n = 0;
+		for (u = 0; u < query->n_leaf; u++)
+			if (vbit_test(query->leaf[u]->lhs->tags, t))
+				n++;
+		if (n == 0)
+			continue;
+		query->tag_leaf[t] = calloc(n + 1, sizeof **query->tag_leaf);
+		AN(query->tag_leaf[t]);
+		n = 0;
+		for (u = 0; u < query->n_leaf; u++)
+			if (vbit_test(query->leaf[u]->lhs->tags, t))
+				query->tag_leaf[t][n++] = u;
+		query->tag_leaf[t][n] = UINT_MAX;
 	}
-	NEEDLESS(return 0);
 }
 
 struct vslq_query *
@@ -322,6 +468,7 @@ vslq_newquery(struct VSL_data *vsl, enum VSL_grouping_e grouping,
 		ALLOC_OBJ(query, VSLQ_QUERY_MAGIC);
 		XXXAN(query);
 		query->vex = vex;
+		vslq_newprog(query);
 	}
 	VSB_destroy(&vsb);
 	return (query);
@@ -331,9 +478,15 @@ void
 vslq_deletequery(struct vslq_query **pquery)
 {
 	struct vslq_query *query;
+	unsigned t;
 
 	TAKE_OBJ_NOTNULL(query, pquery, VSLQ_QUERY_MAGIC);
 
+	for (t = 0; t < SLT__MAX; t++)
+		free(query->tag_leaf[t]);
+	free(query->op);
+	free(query->leaf);
+
 	AN(query->vex);
 	vex_Free(&query->vex);
 	AZ(query->vex);
@@ -341,6 +494,55 @@ vslq_deletequery(struct vslq_query **pquery)
 	FREE_OBJ(query);
 }
 
+/*
+ * Every leaf needs a record with one of its tags to be true, so a
+ * matching transaction has a record from the tags of each side of an
+ * "and", and from the tags of either side of an "or".  Nothing can be
+ * said about a "not".
+ */
+
+static unsigned
+vslq_need(const struct vex *vex, uint32_t (*tags)[SLT__MAX / 32],
+    unsigned max)
+{
+	uint32_t b[1][SLT__MAX / 32];
+	unsigned n, t;
+
+	CHECK_OBJ_NOTNULL(vex, VEX_MAGIC);
+	if (max == 0)
+		return (0);
+	switch (vex->tok) {
+	case T_AND:
+		n = vslq_need(vex->a, tags, max);
+		return (n + vslq_need(vex->b, tags + n, max - n));
+	case T_OR:
+		if (vslq_need(vex->a, tags, 1) == 0 ||
+		    vslq_need(vex->b, b, 1) == 0)
+			return (0);
+		for (t = 0; t < SLT__MAX / 32; t++)
+			tags[0][t] |= b[0][t];
+		return (1);
+	case T_NOT:
+		return (0);
+	default:
+		CHECK_OBJ_NOTNULL(vex->lhs, VEX_LHS_MAGIC);
+		memset(tags[0], 0, sizeof tags[0]);
+		for (t = 0; t < SLT__MAX; t++)
+			if (vbit_test(vex->lhs->tags, t))
+				tags[0][t >> 5] |= 1U << (t & 31);
+		return (1);
+	}
+}
+
+unsigned
+vslq_needtags(const struct vslq_query *query,
+    uint32_t (*tags)[SLT__MAX / 32], unsigned max)
+{
+
+	CHECK_OBJ_NOTNULL(query, VSLQ_QUERY_MAGIC);
+	return (vslq_need(query->vex, tags, max));
+}
+
 int
 vslq_runquery(const struct vslq_query *query,
     struct VSL_transaction * const ptrans[])
@@ -350,7 +552,7 @@ vslq_runquery(const struct vslq_query *query,
 
 	CHECK_OBJ_NOTNULL(query, VSLQ_QUERY_MAGIC);
 
-	r = vslq_exec(query->vex, ptrans);
+	r = vslq_exec(query, ptrans);
 	for (t = ptrans[0]; t != NULL; t = *++ptrans)
 		AZ(VSL_ResetCursor(t->c));
 	return (r);
@@ -270,6 +270,10 @@ VSM_Open(struct VSM_data *vd)
 		return (vsm_diag(vd, "Cannot mmap %s: %s",
 		    vd->fname, strerror(errno)));
 	}
+#ifdef MADV_HUGEPAGE
+	if (slh.hugepage)
+		(void)madvise(v, slh.shm_size, MADV_HUGEPAGE);
+#endif
 	vd->head = v;
 	vd->b = v;
 	vd->e = vd->b + slh.shm_size;
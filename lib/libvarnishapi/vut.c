@@ -110,6 +110,23 @@ vut_dispatch(struct VSL_data *vsl, struct VSL_transaction * const trans[],
 	return (i);
 }
 
+/*
+ * In raw mode the tools only look at records passing VSL_Match(), so
+ * the cursor may skip log segments without any of those.  With -k the
+ * skipped records would no longer be counted, so leave that alone.
+ */
+
+static unsigned
+vut_copt(void)
+{
+	unsigned opt;
+
+	opt = (VUT.d_opt ? VSL_COPT_TAILSTOP : VSL_COPT_TAIL) | VSL_COPT_BATCH;
+	if (VUT.g_arg == VSL_g_raw && VUT.k_arg < 0)
+		opt |= VSL_COPT_TAGSKIP;
+	return (opt);
+}
+
 void
 VUT_Error(int status, const char *fmt, ...)
 {
@@ -252,7 +269,8 @@ VUT_Setup(void)
 	/* Setup input */
 	if (VUT.r_arg) {
 		REPLACE(VUT.name, VUT.r_arg);
-		c = VSL_CursorFile(VUT.vsl, VUT.r_arg, 0);
+		c = VSL_CursorFile(VUT.vsl, VUT.r_arg,
+		    (vut_copt() & VSL_COPT_TAGSKIP) | VSL_COPT_PARALLEL);
 		if (c == NULL)
 			VUT_Error(1, "%s", VSL_Error(VUT.vsl));
 	} else {
@@ -269,9 +287,7 @@ VUT_Setup(void)
 			i = VSM_Open(VUT.vsm);
 			if (!i)
 				c = VSL_CursorVSM(VUT.vsl, VUT.vsm,
-				    (VUT.d_opt ? VSL_COPT_TAILSTOP :
-					VSL_COPT_TAIL)
-				    | VSL_COPT_BATCH);
+				    vut_copt());
 			if (c)
 				break;
 
@@ -382,9 +398,7 @@ VUT_Main(void)
 				VSM_ResetError(VUT.vsm);
 				continue;
 			}
-			c = VSL_CursorVSM(VUT.vsl, VUT.vsm,
-			    (VUT.d_opt ? VSL_COPT_TAILSTOP : VSL_COPT_TAIL)
-			    | VSL_COPT_BATCH);
+			c = VSL_CursorVSM(VUT.vsl, VUT.vsm, vut_copt());
 			if (c == NULL) {
 				VSL_ResetError(VUT.vsl);
 				VSM_Close(VUT.vsm);
@@ -184,7 +184,9 @@ sp_variables = [
 		('client',),
 		('client',), """
 		Identification of the client, used to load balance
-		in the client director. Defaults to the client's IP
+		in the client director, and to share the threads out
+		between clients when thread_queue_fair is set, for the
+		rest of the session. Defaults to the client's IP
 		address.
 		"""
 	),
@@ -220,6 +222,39 @@ sp_variables = [
 		specified by the -n parameter.
 		"""
 	),
+	('proxy.alpn',
+		'STRING',
+		('both',),
+		(), """
+		The ALPN protocol the PROXY protocol v2 header said was
+		negotiated with the client.  Not set if there was none.
+		"""
+	),
+	('proxy.authority',
+		'STRING',
+		('both',),
+		(), """
+		The host name the client asked for (TLS SNI), from the
+		PROXY protocol v2 header.  Not set if there was none.
+		"""
+	),
+	('proxy.tls_version',
+		'STRING',
+		('both',),
+		(), """
+		The TLS version of the client connection, for instance
+		"TLSv1.2", from the PROXY protocol v2 header.  Not set if
+		there was none.
+		"""
+	),
+	('proxy.tls_cipher',
+		'STRING',
+		('both',),
+		(), """
+		The TLS cipher of the client connection, from the PROXY
+		protocol v2 header.  Not set if there was none.
+		"""
+	),
 	('req',
 		'HTTP',
 		('client',),
@@ -290,6 +325,22 @@ sp_variables = [
 		Deprecated and scheduled for removal with varnish release 7.
 		"""
 	),
+	('req.priority',
+		'INT',
+		('client',),
+		('client',), """
+		Priority class of this request when it has to wait for a
+		worker thread, such as after sleeping on a busy object,
+		and of its background fetches.  Negative is low, zero is
+		normal and positive is high priority.  Under load the
+		classes share the threads four to two to one, and low
+		priority work is dropped first.
+
+		ESI sub-requests start out with the priority of their top
+		request, all others with zero.  It is kept across
+		restarts.
+		"""
+	),
 	('req.xid',
 		'STRING',
 		('client',),
@@ -562,6 +613,31 @@ sp_variables = [
 		cache.  Defaults to false.
 		"""
 	),
+	('beresp.do_brotli',
+		'BOOL',
+		('backend_response', 'backend_error'),
+		('backend_response', 'backend_error'), """
+		Boolean. Compress the object with brotli before storing
+		it, gunzip'ing it first if necessary.  Defaults to false.
+		Clients which do not accept brotli get the object
+		uncompressed.  Takes precedence over beresp.do_gzip, but
+		is ignored for ESI objects, when http_gzip_support is off
+		or if Varnish was built without brotli.
+		"""
+	),
+	('beresp.do_static',
+		'BOOL',
+		('backend_response',),
+		('backend_response',), """
+		Boolean. Store the response headers ready to send as well,
+		so that hits on the object are delivered without running
+		vcl_deliver or rebuilding the headers.  Only plain 200
+		responses without Content-Encoding, ESI or compression by
+		Varnish qualify, and only simple HTTP/1 GET requests without
+		Range or conditional headers take the shortcut.  Defaults to
+		false.
+		"""
+	),
 	('beresp.was_304',
 		'BOOL',
 		('backend_response', 'backend_error'),
@@ -779,6 +855,17 @@ sp_variables = [
 		The corresponding HTTP header.
 		"""
 	),
+	('resp.ttl',
+		'DURATION',
+		('synth',),
+		('synth',), """
+		Keep this synthetic response for reuse for this long.  Until
+		then, synth() with the same status and reason from this VCL
+		delivers a copy, with fresh Date and X-Varnish headers,
+		without running vcl_synth.  Defaults to zero, which does not
+		keep the response.  See also the synth_cache parameter.
+		"""
+	),
 	('resp.is_streaming',
 		'BOOL',
 		('deliver', 'synth'),
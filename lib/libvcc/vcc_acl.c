@@ -46,7 +46,7 @@
 #include "vrt.h"
 
 struct acl_e {
-	VTAILQ_ENTRY(acl_e)	list;
+	VRB_ENTRY(acl_e)	branch;
 	unsigned char		data[VRT_ACL_MAXADDR + 1];
 	unsigned		mask;
 	unsigned		not;
@@ -67,9 +67,9 @@ struct acl_e {
 	} while (0)
 
 static int
-vcl_acl_cmp(struct acl_e *ae1, struct acl_e *ae2)
+vcl_acl_cmp(const struct acl_e *ae1, const struct acl_e *ae2)
 {
-	unsigned char *p1, *p2;
+	const unsigned char *p1, *p2;
 	unsigned m;
 
 	p1 = ae1->data;
@@ -93,13 +93,15 @@ vcl_acl_cmp(struct acl_e *ae1, struct acl_e *ae2)
 	return (0);
 }
 
+VRB_PROTOTYPE_STATIC(acl_tree, acl_e, branch, vcl_acl_cmp)
+VRB_GENERATE_STATIC(acl_tree, acl_e, branch, vcl_acl_cmp)
+
 
 static void
 vcc_acl_add_entry(struct vcc *tl, const struct acl_e *ae, int l,
     const unsigned char *u, int fam)
 {
 	struct acl_e *ae2, *aen;
-	int i;
 
 	if (fam == PF_INET && ae->mask > 32) {
 		VSB_printf(tl->sb,
@@ -129,52 +131,41 @@ vcc_acl_add_entry(struct vcc *tl, const struct acl_e *ae, int l,
 
 	memcpy(aen->data + 1, u, l);
 
-	VTAILQ_FOREACH(ae2, &tl->acl, list) {
-		i = vcl_acl_cmp(aen, ae2);
-		if (i == 0) {
-			/*
-			 * If the two rules agree, silently ignore it
-			 * XXX: is that counter intuitive ?
-			 */
-			if (aen->not == ae2->not)
-				return;
-			VSB_printf(tl->sb, "Conflicting ACL entries:\n");
-			vcc_ErrWhere(tl, ae2->t_addr);
-			VSB_printf(tl->sb, "vs:\n");
-			vcc_ErrWhere(tl, aen->t_addr);
-			return;
-		}
-		/*
-		 * We could eliminate pointless rules here, for instance in:
-		 *	"10.1.0.1";
-		 *	"10.1";
-		 * The first rule is clearly pointless, as the second one
-		 * covers it.
-		 *
-		 * We do not do this however, because the shmlog may
-		 * be used to gather statistics.
-		 */
-		if (i < 0) {
-			VTAILQ_INSERT_BEFORE(ae2, aen, list);
-			return;
-		}
-	}
-	VTAILQ_INSERT_TAIL(&tl->acl, aen, list);
+	/*
+	 * We could eliminate pointless rules here, for instance in:
+	 *	"10.1.0.1";
+	 *	"10.1";
+	 * The first rule is clearly pointless, as the second one
+	 * covers it.
+	 *
+	 * We do not do this however, because the shmlog may
+	 * be used to gather statistics.
+	 */
+	ae2 = VRB_INSERT(acl_tree, &tl->acl, aen);
+	if (ae2 == NULL)
+		return;
+	/*
+	 * If the two rules agree, silently ignore it
+	 * XXX: is that counter intuitive ?
+	 */
+	if (aen->not == ae2->not)
+		return;
+	VSB_printf(tl->sb, "Conflicting ACL entries:\n");
+	vcc_ErrWhere(tl, ae2->t_addr);
+	VSB_printf(tl->sb, "vs:\n");
+	vcc_ErrWhere(tl, aen->t_addr);
 }
 
 static void
 vcc_acl_try_getaddrinfo(struct vcc *tl, struct acl_e *ae)
 {
-	struct addrinfo *res0, *res, hint;
+	const struct addrinfo *res0, *res;
 	struct sockaddr_in *sin4;
 	struct sockaddr_in6 *sin6;
 	unsigned char *u, i4, i6;
 	int error;
 
-	memset(&hint, 0, sizeof hint);
-	hint.ai_family = PF_UNSPEC;
-	hint.ai_socktype = SOCK_STREAM;
-	error = getaddrinfo(ae->addr, "0", &hint, &res0);
+	error = vcc_Getaddrinfo(tl, ae->addr, &res0);
 	if (error) {
 		if (ae->para) {
 			VSB_printf(tl->sb,
@@ -226,11 +217,8 @@ vcc_acl_try_getaddrinfo(struct vcc *tl, struct acl_e *ae)
 				res->ai_family, PF(ae->t_addr));
 			continue;
 		}
-		if (tl->err)
-			freeaddrinfo(res0);
 		ERRCHK(tl);
 	}
-	freeaddrinfo(res0);
 
 	if (ae->t_mask != NULL && i4 > 0 && i6 > 0) {
 		VSB_printf(tl->sb,
@@ -342,39 +330,268 @@ vcc_acl_entry(struct vcc *tl)
 }
 
 /*********************************************************************
- * Emit a function to match the ACL we have collected
+ * Emit the VSL message for a matching entry as a C string
  */
 
 static void
-vcc_acl_emit(struct vcc *tl, const char *acln, int anon)
+vcc_acl_emit_log(const struct vcc *tl, const struct acl_e *ae,
+    const char *acln)
+{
+	struct token *t;
+
+	Fh(tl, 0, "\"%sMATCH %s \" ", ae->not ? "NEG_" : "", acln);
+	t = ae->t_addr;
+	do {
+		if (t->tok == CSTR) {
+			Fh(tl, 0, " \"\\\"\" ");
+			EncToken(tl->fh, t);
+			Fh(tl, 0, " \"\\\"\" ");
+		} else
+			Fh(tl, 0, " \"%.*s\"", PF(t));
+		if (t == ae->t_mask)
+			break;
+		t = VTAILQ_NEXT(t, list);
+		AN(t);
+	} while (ae->t_mask != NULL);
+}
+
+/*********************************************************************
+ * Large ACLs are compiled into tables of address ranges.
+ *
+ * The entries of one family are prefixes, which are either disjoint
+ * or nested, so the address space splits into ranges where the same
+ * longest prefix applies, at most two per entry.  Each range is
+ * stored as its first address and the index of the entry, or -1, in
+ * a sorted table which the match function binary searches.
+ */
+
+#define ACL_TABLE_MIN	64	/* Entries before we use tables */
+
+struct acl_r {
+	unsigned char		lo[VRT_ACL_MAXADDR];
+	int			e;
+};
+
+struct acl_p {
+	const struct acl_e	*ae;
+	int			e;
+	unsigned char		lo[VRT_ACL_MAXADDR];
+	unsigned char		hi[VRT_ACL_MAXADDR];
+};
+
+static int
+vcc_acl_p_cmp(const void *a, const void *b)
+{
+	const struct acl_p *p1 = a, *p2 = b;
+	int i;
+
+	i = memcmp(p1->lo, p2->lo, sizeof p1->lo);
+	if (i != 0)
+		return (i);
+	/* Wider prefix first */
+	CMP(p1->ae->mask, p2->ae->mask);
+	return (0);
+}
+
+static void
+vcc_acl_r_add(struct acl_r *r, unsigned *nr, const unsigned char *lo, int e)
+{
+
+	if (*nr > 0 && !memcmp(r[*nr - 1].lo, lo, sizeof r->lo)) {
+		/* A prefix starting where the previous range started */
+		r[*nr - 1].e = e;
+		if (*nr > 1 && r[*nr - 2].e == e)
+			(*nr)--;
+		return;
+	}
+	if (*nr > 0 && r[*nr - 1].e == e)
+		return;
+	memcpy(r[*nr].lo, lo, sizeof r->lo);
+	r[*nr].e = e;
+	(*nr)++;
+}
+
+/* Close the innermost open prefix, the enclosing one applies after it */
+static void
+vcc_acl_r_pop(struct acl_r *r, unsigned *nr, struct acl_p **stk,
+    unsigned *sp, unsigned l)
+{
+	unsigned char nxt[VRT_ACL_MAXADDR];
+	int i;
+
+	assert(*sp > 0);
+	memcpy(nxt, stk[--(*sp)]->hi, sizeof nxt);
+	for (i = l - 1; i >= 0; i--)
+		if (++nxt[i] != 0)
+			break;
+	if (i < 0)
+		return;		/* Ran to the end of the address space */
+	vcc_acl_r_add(r, nr, nxt, *sp > 0 ? stk[*sp - 1]->e : -1);
+}
+
+static void
+vcc_acl_emit_table(const struct vcc *tl, const char *acln, int fam,
+    unsigned l)
+{
+	struct acl_e *ae;
+	struct acl_p *p, **stk;
+	struct acl_r *r;
+	unsigned n, np, nr, sp, u, b;
+	int e;
+
+	n = 0;
+	VRB_FOREACH(ae, acl_tree, &tl->acl)
+		if (ae->data[0] == fam)
+			n++;
+	if (n == 0)
+		return;
+	p = calloc(n, sizeof *p);
+	stk = calloc(n, sizeof *stk);
+	r = calloc(2 * n + 1, sizeof *r);
+	AN(p);
+	AN(stk);
+	AN(r);
+
+	np = 0;
+	e = 0;
+	VRB_FOREACH(ae, acl_tree, &tl->acl) {
+		if (ae->data[0] == fam) {
+			p[np].ae = ae;
+			p[np].e = e;
+			for (u = 0; u < l; u++) {
+				b = ae->mask - 8 - 8 * u;
+				if (ae->mask < 8 + 8 * u)
+					b = 0;
+				else if (b > 8)
+					b = 8;
+				b = (0xff00 >> b) & 0xff;
+				p[np].lo[u] = ae->data[u + 1] & b;
+				p[np].hi[u] = p[np].lo[u] | (~b & 0xff);
+			}
+			np++;
+		}
+		e++;
+	}
+	assert(np == n);
+	qsort(p, n, sizeof *p, vcc_acl_p_cmp);
+
+	nr = 0;
+	sp = 0;
+	vcc_acl_r_add(r, &nr, r[0].lo, -1);
+	for (u = 0; u < n; u++) {
+		while (sp > 0 && memcmp(stk[sp - 1]->hi, p[u].lo, l) < 0)
+			vcc_acl_r_pop(r, &nr, stk, &sp, l);
+		vcc_acl_r_add(r, &nr, p[u].lo, p[u].e);
+		stk[sp++] = &p[u];
+	}
+	while (sp > 0)
+		vcc_acl_r_pop(r, &nr, stk, &sp, l);
+	assert(nr <= 2 * n + 1);
+
+	Fh(tl, 0, "\nstatic const struct {\n");
+	if (l == 4)
+		Fh(tl, 0, "\tunsigned\t\tlo;\n");
+	else
+		Fh(tl, 0, "\tunsigned char\t\tlo[%u];\n", l);
+	Fh(tl, 0, "\tint\t\t\te;\n");
+	Fh(tl, 0, "} acl_%d_named_%s[%u] = {\n", fam, acln, nr);
+	for (u = 0; u < nr; u++) {
+		if (l == 4) {
+			Fh(tl, 0, "\t{ 0x%02x%02x%02x%02xU, %d },\n",
+			    r[u].lo[0], r[u].lo[1], r[u].lo[2], r[u].lo[3],
+			    r[u].e);
+			continue;
+		}
+		Fh(tl, 0, "\t{ \"");
+		for (b = 0; b < l; b++)
+			Fh(tl, 0, "\\%03o", r[u].lo[b]);
+		Fh(tl, 0, "\", %d },\n", r[u].e);
+	}
+	Fh(tl, 0, "};\n");
+
+	free(p);
+	free(stk);
+	free(r);
+}
+
+static void
+vcc_acl_emit_lookup(const struct vcc *tl, const char *acln, int fam,
+    unsigned l)
+{
+	struct acl_e *ae;
+
+	VRB_FOREACH(ae, acl_tree, &tl->acl)
+		if (ae->data[0] == fam)
+			break;
+	if (ae == NULL)
+		return;
+
+	Fh(tl, 0, "\tif (fam == %d) {\n", fam);
+	if (l == 4)
+		Fh(tl, 0, "\t\tunsigned k;\n\n");
+	else
+		Fh(tl, 0, "\t\tint i;\n\n");
+	Fh(tl, 0, "\t\tlo = 0;\n");
+	Fh(tl, 0, "\t\thi = (int)(sizeof acl_%d_named_%s /"
+	    " sizeof acl_%d_named_%s[0]) - 1;\n", fam, acln, fam, acln);
+	if (l == 4)
+		Fh(tl, 0, "\t\tk = (unsigned)a[0] << 24 | a[1] << 16 |"
+		    " a[2] << 8 | a[3];\n");
+	Fh(tl, 0, "\t\twhile (lo < hi) {\n");
+	Fh(tl, 0, "\t\t\tm = (lo + hi + 1) / 2;\n");
+	if (l == 4) {
+		Fh(tl, 0, "\t\t\tif (acl_%d_named_%s[m].lo <= k)\n",
+		    fam, acln);
+	} else {
+		Fh(tl, 0, "\t\t\tfor (i = 0; i < %u &&\n", l - 1);
+		Fh(tl, 0, "\t\t\t    acl_%d_named_%s[m].lo[i] == a[i]; i++)\n",
+		    fam, acln);
+		Fh(tl, 0, "\t\t\t\tcontinue;\n");
+		Fh(tl, 0, "\t\t\tif (acl_%d_named_%s[m].lo[i] <= a[i])\n",
+		    fam, acln);
+	}
+	Fh(tl, 0, "\t\t\t\tlo = m;\n");
+	Fh(tl, 0, "\t\t\telse\n");
+	Fh(tl, 0, "\t\t\t\thi = m - 1;\n");
+	Fh(tl, 0, "\t\t}\n");
+	Fh(tl, 0, "\t\te = acl_%d_named_%s[lo].e;\n", fam, acln);
+	Fh(tl, 0, "\t}\n");
+}
+
+static void
+vcc_acl_emit_tables(struct vcc *tl, const char *acln)
+{
+	struct acl_e *ae;
+
+	vcc_acl_emit_table(tl, acln, PF_INET, 4);
+	vcc_acl_emit_table(tl, acln, PF_INET6, 16);
+
+	Fh(tl, 0, "\nstatic const struct {\n");
+	Fh(tl, 0, "\tint\t\t\tnot;\n");
+	Fh(tl, 0, "\tconst char\t\t*log;\n");
+	Fh(tl, 0, "} acl_e_named_%s[] = {\n", acln);
+	VRB_FOREACH(ae, acl_tree, &tl->acl) {
+		Fh(tl, 0, "\t{ %u, ", ae->not);
+		vcc_acl_emit_log(tl, ae, acln);
+		Fh(tl, 0, " },\n");
+	}
+	Fh(tl, 0, "};\n");
+}
+
+/*********************************************************************
+ * Small ACLs are compiled into nested comparisons, one per byte
+ */
+
+static void
+vcc_acl_emit_cascade(const struct vcc *tl, const char *acln, int anon)
 {
 	struct acl_e *ae;
 	int depth, l, m, i;
 	unsigned at[VRT_ACL_MAXADDR + 1];
-	struct token *t;
-	struct inifin *ifp;
 
-	Fh(tl, 0, "\nstatic int __match_proto__(acl_match_f)\n");
-	Fh(tl, 0,
-	    "match_acl_%s_%s(VRT_CTX, const VCL_IP p)\n",
-	    anon ? "anon" : "named", acln);
-	Fh(tl, 0, "{\n");
-	Fh(tl, 0, "\tconst unsigned char *a;\n");
-	Fh(tl, 0, "\tint fam;\n");
-	Fh(tl, 0, "\n");
-	Fh(tl, 0, "\tfam = VRT_VSA_GetPtr(p, &a);\n");
-	Fh(tl, 0, "\tif (fam < 0) {\n");
-	Fh(tl, 0, "\t\tVRT_acl_log(ctx, \"NO_FAM %s\");\n", acln);
-	Fh(tl, 0, "\t\treturn(0);\n");
-	Fh(tl, 0, "\t}\n\n");
-	if (!tl->err_unref && !anon) {
-		ifp = New_IniFin(tl);
-		VSB_printf(ifp->ini,
-			"\tif (0) match_acl_named_%s(0, 0);\n", acln);
-	}
 	depth = -1;
 	at[0] = 256;
-	VTAILQ_FOREACH(ae, &tl->acl, list) {
+	VRB_FOREACH(ae, acl_tree, &tl->acl) {
 
 		/* Find how much common prefix we have */
 		for (l = 0; l <= depth && l * 8 < ae->mask - 7; l++) {
@@ -417,21 +634,8 @@ vcc_acl_emit(struct vcc *tl, const char *acln, int anon)
 		i = (ae->mask + 7) / 8;
 
 		if (!anon) {
-			Fh(tl, 0, "\t%*sVRT_acl_log(ctx, \"%sMATCH %s \" ",
-			    -i, "", ae->not ? "NEG_" : "", acln);
-			t = ae->t_addr;
-			do {
-				if (t->tok == CSTR) {
-					Fh(tl, 0, " \"\\\"\" ");
-					EncToken(tl->fh, t);
-					Fh(tl, 0, " \"\\\"\" ");
-				} else
-					Fh(tl, 0, " \"%.*s\"", PF(t));
-				if (t == ae->t_mask)
-					break;
-				t = VTAILQ_NEXT(t, list);
-				AN(t);
-			} while (ae->t_mask != NULL);
+			Fh(tl, 0, "\t%*sVRT_acl_log(ctx, ", -i, "");
+			vcc_acl_emit_log(tl, ae, acln);
 			Fh(tl, 0, ");\n");
 		}
 
@@ -441,6 +645,58 @@ vcc_acl_emit(struct vcc *tl, const char *acln, int anon)
 	/* Unwind */
 	for (; 0 <= depth; depth--)
 		Fh(tl, 0, "\t%*.*s}\n", depth, depth, "");
+}
+
+/*********************************************************************
+ * Emit a function to match the ACL we have collected
+ */
+
+static void
+vcc_acl_emit(struct vcc *tl, const char *acln, int anon)
+{
+	struct acl_e *ae;
+	unsigned n;
+	struct inifin *ifp;
+
+	n = 0;
+	VRB_FOREACH(ae, acl_tree, &tl->acl)
+		n++;
+	if (anon)
+		n = 0;		/* Not worth it, and no logging */
+	if (n >= ACL_TABLE_MIN)
+		vcc_acl_emit_tables(tl, acln);
+
+	Fh(tl, 0, "\nstatic int __match_proto__(acl_match_f)\n");
+	Fh(tl, 0,
+	    "match_acl_%s_%s(VRT_CTX, const VCL_IP p)\n",
+	    anon ? "anon" : "named", acln);
+	Fh(tl, 0, "{\n");
+	Fh(tl, 0, "\tconst unsigned char *a;\n");
+	Fh(tl, 0, "\tint fam;\n");
+	if (n >= ACL_TABLE_MIN) {
+		Fh(tl, 0, "\tint lo, hi, m, e = -1;\n");
+	}
+	Fh(tl, 0, "\n");
+	Fh(tl, 0, "\tfam = VRT_VSA_GetPtr(p, &a);\n");
+	Fh(tl, 0, "\tif (fam < 0) {\n");
+	Fh(tl, 0, "\t\tVRT_acl_log(ctx, \"NO_FAM %s\");\n", acln);
+	Fh(tl, 0, "\t\treturn(0);\n");
+	Fh(tl, 0, "\t}\n\n");
+	if (!tl->err_unref && !anon) {
+		ifp = New_IniFin(tl);
+		VSB_printf(ifp->ini,
+			"\tif (0) match_acl_named_%s(0, 0);\n", acln);
+	}
+	if (n >= ACL_TABLE_MIN) {
+		vcc_acl_emit_lookup(tl, acln, PF_INET, 4);
+		vcc_acl_emit_lookup(tl, acln, PF_INET6, 16);
+		Fh(tl, 0, "\tif (e >= 0) {\n");
+		Fh(tl, 0, "\t\tVRT_acl_log(ctx, acl_e_named_%s[e].log);\n",
+		    acln);
+		Fh(tl, 0, "\t\treturn (!acl_e_named_%s[e].not);\n", acln);
+		Fh(tl, 0, "\t}\n");
+	} else
+		vcc_acl_emit_cascade(tl, acln, anon);
 
 	/* Deny by default */
 	if (!anon)
@@ -463,7 +719,7 @@ vcc_Acl_Hack(struct vcc *tl, char *b, size_t bl)
 	char acln[32];
 	unsigned tcond;
 
-	VTAILQ_INIT(&tl->acl);
+	VRB_INIT(&tl->acl);
 	tcond = tl->t->tok;
 	vcc_NextToken(tl);
 	bprintf(acln, "%u", tl->unique++);
@@ -480,7 +736,7 @@ vcc_ParseAcl(struct vcc *tl)
 	char *acln;
 
 	vcc_NextToken(tl);
-	VTAILQ_INIT(&tl->acl);
+	VRB_INIT(&tl->acl);
 
 	vcc_ExpectCid(tl, "ACL");
 	ERRCHK(tl);
@@ -33,6 +33,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <strings.h>
 
 #include "vcc_compile.h"
 #include "libvcc.h"
@@ -175,13 +176,37 @@ parse_ban(struct vcc *tl)
 
 /*--------------------------------------------------------------------*/
 
+/*
+ * Arguments made only of string constants and req.http.host are the
+ * same for many requests, so the runtime may keep the hash state after
+ * them around, see VRT_hashprefix().
+ */
+
+static int
+vcc_hash_is_prefix(const struct token *t)
+{
+
+	for (; t->tok != ')'; t = VTAILQ_NEXT(t, list)) {
+		if (t->tok == CSTR || t->tok == '+')
+			continue;
+		if (t->tok == ID && t->e - t->b == 13 &&
+		    !strncasecmp(t->b, "req.http.host", 13))
+			continue;
+		return (0);
+	}
+	return (1);
+}
+
 static void
 parse_hash_data(struct vcc *tl)
 {
 	vcc_NextToken(tl);
 	SkipToken(tl, '(');
 
-	Fb(tl, 1, "VRT_hashdata(ctx,\n  ");
+	if (vcc_hash_is_prefix(tl->t))
+		Fb(tl, 1, "VRT_hashprefix(ctx,\n  ");
+	else
+		Fb(tl, 1, "VRT_hashdata(ctx,\n  ");
 	vcc_Expr(tl, STRING_LIST);
 	ERRCHK(tl);
 	Fb(tl, 1, ");\n");
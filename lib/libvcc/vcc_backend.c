@@ -34,6 +34,7 @@
 #include <string.h>
 
 #include "vcc_compile.h"
+#include "vus.h"
 
 /*--------------------------------------------------------------------
  * Struct sockaddr is not really designed to be a compile time
@@ -70,6 +71,27 @@ Emit_Sockaddr(struct vcc *tl, const struct token *t_host,
 	Fb(tl, 0, "\t.port = \"%s\",\n", pa);
 }
 
+/*--------------------------------------------------------------------
+ * A Unix domain socket backend, nothing to resolve, but we check that
+ * the path can be used before the VCL gets any further.
+ */
+
+static void
+Emit_UDS_Path(struct vcc *tl, const struct token *t_path)
+{
+	const char *err;
+
+	AN(t_path->dec);
+	if (VUS_resolver(t_path->dec, NULL, NULL, &err) != 0) {
+		VSB_printf(tl->sb, "%s:\n", err);
+		vcc_ErrWhere(tl, t_path);
+		return;
+	}
+	Fb(tl, 0, "\t.path = ");
+	EncToken(tl->fb, t_path);
+	Fb(tl, 0, ",\n");
+}
+
 /*--------------------------------------------------------------------
  * Parse a backend probe specification
  */
@@ -282,6 +304,7 @@ vcc_ParseHostDef(struct vcc *tl, const struct token *t_be, const char *vgcname)
 	struct token *t_val;
 	struct token *t_host = NULL;
 	struct token *t_port = NULL;
+	struct token *t_path = NULL;
 	struct token *t_hosthdr = NULL;
 	struct fld_spec *fs;
 	struct inifin *ifp;
@@ -291,8 +314,9 @@ vcc_ParseHostDef(struct vcc *tl, const struct token *t_be, const char *vgcname)
 	double t;
 
 	fs = vcc_FldSpec(tl,
-	    "!host",
+	    "?host",
 	    "?port",
+	    "?path",
 	    "?host_header",
 	    "?connect_timeout",
 	    "?first_byte_timeout",
@@ -300,6 +324,7 @@ vcc_ParseHostDef(struct vcc *tl, const struct token *t_be, const char *vgcname)
 	    "?probe",
 	    "?max_connections",
 	    "?proxy_header",
+	    "?http2",
 	    NULL);
 
 	SkipToken(tl, '{');
@@ -343,6 +368,12 @@ vcc_ParseHostDef(struct vcc *tl, const struct token *t_be, const char *vgcname)
 			t_port = tl->t;
 			vcc_NextToken(tl);
 			SkipToken(tl, ';');
+		} else if (vcc_IdIs(t_field, "path")) {
+			ExpectErr(tl, CSTR);
+			assert(tl->t->dec != NULL);
+			t_path = tl->t;
+			vcc_NextToken(tl);
+			SkipToken(tl, ';');
 		} else if (vcc_IdIs(t_field, "host_header")) {
 			ExpectErr(tl, CSTR);
 			assert(tl->t->dec != NULL);
@@ -384,6 +415,21 @@ vcc_ParseHostDef(struct vcc *tl, const struct token *t_be, const char *vgcname)
 			}
 			SkipToken(tl, ';');
 			Fb(tl, 0, "\t.proxy_header = %u,\n", u);
+		} else if (vcc_IdIs(t_field, "http2")) {
+			ExpectErr(tl, ID);
+			if (vcc_IdIs(tl->t, "true"))
+				u = 1;
+			else if (vcc_IdIs(tl->t, "false"))
+				u = 0;
+			else {
+				VSB_printf(tl->sb,
+				    ".http2 must be true or false\n");
+				vcc_ErrWhere(tl, tl->t);
+				return;
+			}
+			vcc_NextToken(tl);
+			SkipToken(tl, ';');
+			Fb(tl, 0, "\t.http2 = %u,\n", u);
 		} else if (vcc_IdIs(t_field, "probe") && tl->t->tok == '{') {
 			vcc_ParseProbeSpec(tl, NULL, &p);
 			Fb(tl, 0, "\t.probe = &%s,\n", p);
@@ -416,21 +462,46 @@ vcc_ParseHostDef(struct vcc *tl, const struct token *t_be, const char *vgcname)
 	vcc_FieldsOk(tl, fs);
 	ERRCHK(tl);
 
-	/* Check that the hostname makes sense */
-	assert(t_host != NULL);
-	Emit_Sockaddr(tl, t_host, t_port);
-	ERRCHK(tl);
+	if (t_host == NULL && t_path == NULL) {
+		VSB_printf(tl->sb, "Expected .host or .path.\n");
+		vcc_ErrWhere(tl, t_be);
+		return;
+	}
+	if (t_host != NULL && t_path != NULL) {
+		VSB_printf(tl->sb, "Cannot have both .host and .path.\n");
+		vcc_ErrWhere(tl, t_be);
+		return;
+	}
+
+	if (t_path != NULL) {
+		if (t_port != NULL) {
+			VSB_printf(tl->sb, ".port makes no sense with .path\n");
+			vcc_ErrWhere(tl, t_port);
+			return;
+		}
+		Emit_UDS_Path(tl, t_path);
+		ERRCHK(tl);
+	} else {
+		/* Check that the hostname makes sense */
+		Emit_Sockaddr(tl, t_host, t_port);
+		ERRCHK(tl);
+	}
 
 	ExpectErr(tl, '}');
 
 	/* We have parsed it all, emit the ident string */
 
-	/* Emit the hosthdr field, fall back to .host if not specified */
+	/*
+	 * Emit the hosthdr field, fall back to .host if not specified,
+	 * and to localhost for .path backends.
+	 */
 	Fb(tl, 0, "\t.hosthdr = ");
 	if (t_hosthdr != NULL)
 		EncToken(tl->fb, t_hosthdr);
-	else
+	else if (t_host != NULL)
 		EncToken(tl->fb, t_host);
+	else
+		Fb(tl, 0, "\"localhost\"");
 	Fb(tl, 0, ",\n");
 
 	/* Close the struct */
@@ -63,6 +63,8 @@
 
 #include "libvcc.h"
 #include "vfil.h"
+#include "vhdr.h"
+#include "vtim.h"
 
 struct method method_tab[] = {
 	{ "none", 0U, 0},
@@ -554,8 +556,10 @@ vcc_CompileSource(struct vcc *tl, struct source *sp)
 	const struct var *v;
 	struct vsb *vsb;
 	struct inifin *ifp;
+	double t0, t_lex, t_parse;
 	int i;
 
+	t0 = VTIM_mono();
 	vcc_Expr_Init(tl);
 
 	for (v = vcc_vars; v->name != NULL; v++) {
@@ -605,6 +609,10 @@ vcc_CompileSource(struct vcc *tl, struct source *sp)
 	if (tl->err)
 		return (NULL);
 
+	/* Look up host names all at once, rather than as we parse */
+	vcc_Resolve_Ahead(tl);
+	t_lex = VTIM_mono();
+
 	/* Parse the token string */
 	tl->t = VTAILQ_FIRST(&tl->tokens);
 	vcc_Parse(tl);
@@ -634,6 +642,7 @@ vcc_CompileSource(struct vcc *tl, struct source *sp)
 	/* Check that all variable uses are legal */
 	if (vcc_CheckUses(tl) || tl->err)
 		return (NULL);
+	t_parse = VTIM_mono();
 
 	/* Tie vcl_init/fini in */
 	ifp = New_IniFin(tl);
@@ -647,10 +656,23 @@ vcc_CompileSource(struct vcc *tl, struct source *sp)
 		    "void __match_proto__(vcl_func_f) "
 		    "VGC_function_%s(VRT_CTX);\n",
 		    method_tab[i].name);
-		Fc(tl, 1, "\nvoid __match_proto__(vcl_func_f)\n");
+		if (tl->profile) {
+			AN(tl->mcnt[i]);
+			Fh(tl, 1, "static void VGC_body_%s(VRT_CTX);\n",
+			    method_tab[i].name);
+			Fc(tl, 1, "\nvoid __match_proto__(vcl_func_f)\n");
+			Fc(tl, 1, "VGC_function_%s(VRT_CTX)\n",
+			    method_tab[i].name);
+			Fc(tl, 1, "{\n");
+			Fc(tl, 1, "  VRT_prof_call(ctx, %u, VGC_body_%s);\n",
+			    tl->mcnt[i], method_tab[i].name);
+			Fc(tl, 1, "}\n");
+		}
+		Fc(tl, 1, "\n%s __match_proto__(vcl_func_f)\n",
+		    tl->profile ? "static void" : "void");
 		Fc(tl, 1,
-		    "VGC_function_%s(VRT_CTX)\n",
-		    method_tab[i].name);
+		    "VGC_%s_%s(VRT_CTX)\n",
+		    tl->profile ? "body" : "function", method_tab[i].name);
 		AZ(VSB_finish(tl->fm[i]));
 		Fc(tl, 1, "{\n");
 		/*
@@ -689,6 +711,15 @@ vcc_CompileSource(struct vcc *tl, struct source *sp)
 	VSB_cat(vsb, VSB_data(tl->fc));
 
 	AZ(VSB_finish(vsb));
+
+	/*
+	 * Not in the C source, which is what the compiled VCL cache
+	 * is keyed on.
+	 */
+	if (tl->profile)
+		VSB_printf(tl->sb, "VCC phase times: lex %.3fs parse %.3fs"
+		    " emit %.3fs (%u symbols)\n", t_lex - t0,
+		    t_parse - t_lex, VTIM_mono() - t_parse, tl->nsymbols);
 	return (vsb);
 }
 
@@ -728,11 +759,14 @@ VCC_New(void)
 	struct vcc *tl;
 	int i;
 
+	VHDR_Init();
+
 	ALLOC_OBJ(tl, VCC_MAGIC);
 	AN(tl);
 	VTAILQ_INIT(&tl->inifin);
 	VTAILQ_INIT(&tl->tokens);
 	VTAILQ_INIT(&tl->sources);
+	VTAILQ_INIT(&tl->dns);
 
 	tl->nsources = 0;
 
@@ -818,6 +852,14 @@ VCC_Unsafe_Path(struct vcc *vcc, unsigned u)
 	vcc->unsafe_path = u;
 }
 
+void
+VCC_Profile(struct vcc *vcc, unsigned u)
+{
+
+	CHECK_OBJ_NOTNULL(vcc, VCC_MAGIC);
+	vcc->profile = u;
+}
+
 /*--------------------------------------------------------------------
  * Configure settings
  */
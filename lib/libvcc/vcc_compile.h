@@ -39,6 +39,7 @@
 #include "vdef.h"
 #include "vqueue.h"
 #include "vsb.h"
+#include "vtree.h"
 
 
 #include "vcc_token_defs.h"
@@ -50,6 +51,8 @@
 struct vsb;
 struct token;
 struct sockaddr_storage;
+struct suckaddr;
+struct addrinfo;
 
 #define isident1(c) (isalpha(c))
 #define isident(c) (isalpha(c) || isdigit(c) || (c) == '_' || (c) == '-')
@@ -117,9 +120,11 @@ struct symbol {
 	unsigned			magic;
 #define SYMBOL_MAGIC			0x3368c9fb
 	VTAILQ_ENTRY(symbol)		list;
-	VTAILQ_HEAD(,symbol)		children;
+	VTAILQ_HEAD(symbolhead,symbol)	children;
 
 	struct symbol			*parent;
+	struct symbol			*hnext;
+	unsigned			hash;
 	const char			*vmod;
 
 	char				*name;
@@ -173,8 +178,12 @@ struct vcc {
 	unsigned		err_unref;
 	unsigned		allow_inline_c;
 	unsigned		unsafe_path;
+	unsigned		profile;
 
 	struct symbol		*symbols;
+	struct symbol		**symtab;	/* vcc_symb.c */
+	unsigned		nsymtab;
+	unsigned		nsymbols;
 
 	struct inifinhead	inifin;
 	unsigned		ninifin;
@@ -200,8 +209,11 @@ struct vcc {
 	int			err;
 	struct proc		*curproc;
 	struct proc		*mprocs[VCL_MET_MAX];
+	unsigned		mcnt[VCL_MET_MAX];	/* vcc_profile */
 
-	VTAILQ_HEAD(, acl_e)	acl;
+	VRB_HEAD(acl_tree, acl_e)	acl;
+
+	VTAILQ_HEAD(, vcc_dns)	dns;		/* vcc_dns.c */
 
 	int			nprobe;
 
@@ -271,6 +283,14 @@ void *TlAlloc(struct vcc *tl, unsigned len);
 char *TlDup(struct vcc *tl, const char *s);
 char *TlDupTok(struct vcc *tl, const struct token *tok);
 
+/* vcc_dns.c */
+void vcc_Resolve_Ahead(struct vcc *);
+int vcc_Resolver(struct vcc *, const char *addr, const char *def_port,
+    int (*func)(void *, const struct suckaddr *), void *priv,
+    const char **err);
+int vcc_Getaddrinfo(struct vcc *, const char *host,
+    const struct addrinfo **res);
+
 /* vcc_expr.c */
 double vcc_DoubleVal(struct vcc *tl);
 void vcc_Duration(struct vcc *tl, double *);
@@ -295,6 +315,10 @@ void vcc_Parse(struct vcc *tl);
 
 /* vcc_utils.c */
 const char *vcc_regexp(struct vcc *tl);
+int vcc_regexp_bundleable(const char *);
+const char *vcc_regexp_fixed(struct vcc *, const char *, unsigned *);
+const char *vcc_regexp_bundle(struct vcc *, struct token * const *,
+    unsigned);
 void Resolve_Sockaddr(struct vcc *tl, const char *host, const char *defport,
     const char **ipv4, const char **ipv4_ascii, const char **ipv6,
     const char **ipv6_ascii, const char **p_ascii, int maxips,
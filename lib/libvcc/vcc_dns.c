@@ -0,0 +1,317 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Name resolution for backend hosts and ACL entries.
+ *
+ * The parser resolves names one at a time as it comes across them, which
+ * makes a VCL with hundreds of host names as slow to compile as that many
+ * DNS round trips.  Before parsing, we pick the names out of the token
+ * list and resolve them on a handful of threads.  The parser then gets
+ * its answers from here, including the errors, exactly as if it had
+ * asked getaddrinfo(3) itself.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vcc_compile.h"
+
+#include "vsa.h"
+#include "vss.h"
+
+#define VCC_DNS_THREADS		16
+
+struct vcc_dns {
+	unsigned		magic;
+#define VCC_DNS_MAGIC		0x5a3e0c17
+	VTAILQ_ENTRY(vcc_dns)	list;
+	int			acl;
+	int			done;
+	char			*host;
+	const char		*port;
+
+	/* ACL entries: getaddrinfo(3) */
+	struct addrinfo		*res;
+	int			gai_error;
+
+	/* Backends and IP constants: VSS_resolver() */
+	struct suckaddr		**vsa;
+	unsigned		nvsa;
+	const char		*err;
+};
+
+struct vcc_dns_pool {
+	pthread_mutex_t		mtx;
+	struct vcc_dns		*next;
+};
+
+/*--------------------------------------------------------------------*/
+
+static int __match_proto__(vss_resolved_f)
+vcc_dns_collect(void *priv, const struct suckaddr *vsa)
+{
+	struct vcc_dns *d;
+
+	CAST_OBJ_NOTNULL(d, priv, VCC_DNS_MAGIC);
+	d->vsa = realloc(d->vsa, (d->nvsa + 1L) * sizeof *d->vsa);
+	AN(d->vsa);
+	d->vsa[d->nvsa] = VSA_Clone(vsa);
+	AN(d->vsa[d->nvsa]);
+	d->nvsa++;
+	return (0);
+}
+
+static void
+vcc_dns_resolve(struct vcc_dns *d)
+{
+	struct addrinfo hint;
+
+	CHECK_OBJ_NOTNULL(d, VCC_DNS_MAGIC);
+	AZ(d->done);
+	if (d->acl) {
+		memset(&hint, 0, sizeof hint);
+		hint.ai_family = PF_UNSPEC;
+		hint.ai_socktype = SOCK_STREAM;
+		d->gai_error = getaddrinfo(d->host, d->port, &hint, &d->res);
+	} else
+		(void)VSS_resolver(d->host, d->port, vcc_dns_collect, d,
+		    &d->err);
+	d->done = 1;
+}
+
+static struct vcc_dns *
+vcc_dns_find(struct vcc *tl, int acl, const char *host, const char *port)
+{
+	struct vcc_dns *d;
+
+	VTAILQ_FOREACH(d, &tl->dns, list)
+		if (d->acl == acl && !strcmp(d->host, host) &&
+		    !strcmp(d->port, port))
+			return (d);
+	ALLOC_OBJ(d, VCC_DNS_MAGIC);
+	AN(d);
+	d->acl = acl;
+	d->host = strdup(host);
+	AN(d->host);
+	d->port = port;
+	VTAILQ_INSERT_TAIL(&tl->dns, d, list);
+	return (d);
+}
+
+static struct vcc_dns *
+vcc_dns_get(struct vcc *tl, int acl, const char *host, const char *port)
+{
+	struct vcc_dns *d;
+
+	d = vcc_dns_find(tl, acl, host, port);
+	if (!d->done)
+		vcc_dns_resolve(d);
+	return (d);
+}
+
+/*--------------------------------------------------------------------
+ * Drop in for VSS_resolver()
+ */
+
+int
+vcc_Resolver(struct vcc *tl, const char *addr, const char *def_port,
+    vss_resolved_f *func, void *priv, const char **err)
+{
+	struct vcc_dns *d;
+	unsigned u;
+	int ret = 0;
+
+	d = vcc_dns_get(tl, 0, addr, def_port);
+	*err = d->err;
+	if (d->err != NULL)
+		return (-1);
+	for (u = 0; u < d->nvsa && ret == 0; u++)
+		ret = func(priv, d->vsa[u]);
+	return (ret);
+}
+
+/*--------------------------------------------------------------------
+ * Drop in for getaddrinfo(3) with the hints ACLs use.  The result
+ * belongs to the compiler and must not be freed.
+ */
+
+int
+vcc_Getaddrinfo(struct vcc *tl, const char *host,
+    const struct addrinfo **res)
+{
+	struct vcc_dns *d;
+
+	d = vcc_dns_get(tl, 1, host, "0");
+	*res = d->res;
+	return (d->gai_error);
+}
+
+/*--------------------------------------------------------------------
+ * Resolve ahead of the parser
+ */
+
+static void *
+vcc_dns_thread(void *priv)
+{
+	struct vcc_dns_pool *dp;
+	struct vcc_dns *d;
+
+	dp = priv;
+	while (1) {
+		AZ(pthread_mutex_lock(&dp->mtx));
+		d = dp->next;
+		if (d != NULL)
+			dp->next = VTAILQ_NEXT(d, list);
+		AZ(pthread_mutex_unlock(&dp->mtx));
+		if (d == NULL)
+			return (NULL);
+		vcc_dns_resolve(d);
+	}
+}
+
+/* Collect the entries of an ACL, which we know are strings */
+
+static struct token *
+vcc_dns_acl(struct vcc *tl, struct token *t)
+{
+	char *p;
+
+	for (; t != NULL && t->tok != '}'; t = VTAILQ_NEXT(t, list)) {
+		if (t->tok != CSTR || t->dec == NULL)
+			continue;
+		p = strdup(t->dec);
+		AN(p);
+		p[strcspn(p, "/")] = '\0';
+		(void)vcc_dns_find(tl, 1, p, "0");
+		free(p);
+	}
+	return (t);
+}
+
+/* Collect .host and .port of a backend, as Emit_Sockaddr() puts them */
+
+static struct token *
+vcc_dns_backend(struct vcc *tl, struct token *t)
+{
+	const struct token *t_host = NULL, *t_port = NULL, *tv;
+	char buf[256];
+	int depth = 0, i;
+
+	for (; t != NULL; t = VTAILQ_NEXT(t, list)) {
+		if (t->tok == '{')
+			depth++;
+		else if (t->tok == '}' && --depth == 0)
+			break;
+		if (depth != 1 || t->tok != '.')
+			continue;
+		tv = VTAILQ_NEXT(t, list);
+		if (tv == NULL || tv->tok != ID)
+			continue;
+		tv = VTAILQ_NEXT(tv, list);
+		if (tv == NULL || tv->tok != '=')
+			continue;
+		tv = VTAILQ_NEXT(tv, list);
+		if (tv == NULL || tv->tok != CSTR || tv->dec == NULL)
+			continue;
+		if (vcc_IdIs(VTAILQ_NEXT(t, list), "host"))
+			t_host = tv;
+		else if (vcc_IdIs(VTAILQ_NEXT(t, list), "port"))
+			t_port = tv;
+	}
+	if (t_host == NULL)
+		return (t);
+	if (t_port != NULL)
+		i = snprintf(buf, sizeof buf, "%s %s", t_host->dec, t_port->dec);
+	else
+		i = snprintf(buf, sizeof buf, "%s", t_host->dec);
+	/* Too long for Emit_Sockaddr() anyway */
+	if (i >= 0 && i < (int)sizeof buf)
+		(void)vcc_dns_find(tl, 0, buf, "80");
+	return (t);
+}
+
+void
+vcc_Resolve_Ahead(struct vcc *tl)
+{
+	struct vcc_dns_pool dp[1];
+	pthread_t thr[VCC_DNS_THREADS];
+	struct token *t, *tn;
+	struct vcc_dns *d;
+	unsigned n = 0, u;
+	int depth = 0;
+
+	for (t = VTAILQ_FIRST(&tl->tokens); t != NULL;
+	    t = VTAILQ_NEXT(t, list)) {
+		if (t->tok == '{')
+			depth++;
+		else if (t->tok == '}')
+			depth--;
+		if (depth != 0 || t->tok != ID)
+			continue;
+		tn = VTAILQ_NEXT(t, list);
+		if (tn == NULL || tn->tok != ID)
+			continue;
+		tn = VTAILQ_NEXT(tn, list);
+		if (tn == NULL || tn->tok != '{')
+			continue;
+		if (vcc_IdIs(t, "acl"))
+			t = vcc_dns_acl(tl, VTAILQ_NEXT(tn, list));
+		else if (vcc_IdIs(t, "backend"))
+			t = vcc_dns_backend(tl, tn);
+		if (t == NULL)
+			break;
+	}
+
+	VTAILQ_FOREACH(d, &tl->dns, list)
+		n++;
+	/* A single name is no faster on a thread of its own */
+	if (n < 2)
+		return;
+	if (n > VCC_DNS_THREADS)
+		n = VCC_DNS_THREADS;
+
+	AZ(pthread_mutex_init(&dp->mtx, NULL));
+	dp->next = VTAILQ_FIRST(&tl->dns);
+	for (u = 0; u < n; u++)
+		if (pthread_create(&thr[u], NULL, vcc_dns_thread, dp))
+			break;
+	/* With no threads at all, the parser resolves as it goes */
+	n = u;
+	for (u = 0; u < n; u++)
+		AZ(pthread_join(thr[u], NULL));
+	AZ(pthread_mutex_destroy(&dp->mtx));
+	if (n == 0)
+		return;
+	VTAILQ_FOREACH(d, &tl->dns, list)
+		AN(d->done);
+}
@@ -31,6 +31,7 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -207,6 +208,8 @@ struct expr {
 #define EXPR_VAR	(1<<0)
 #define EXPR_CONST	(1<<1)
 #define EXPR_STR_CONST	(1<<2)
+	const char	*cstr;		/* Value of constant STRING */
+	unsigned	nstr;		/* Pieces in STRING_LIST */
 	struct token	*t1, *t2;
 };
 
@@ -218,6 +221,8 @@ vcc_isconst(const struct expr *e)
 }
 
 static void vcc_expr0(struct vcc *tl, struct expr **e, vcc_type_t fmt);
+static struct expr *vcc_mk_expr(vcc_type_t fmt, const char *str, ...)
+    __v_printflike(2, 3);
 
 static struct expr *
 vcc_new_expr(void)
@@ -230,13 +235,10 @@ vcc_new_expr(void)
 	e->vsb = VSB_new_auto();
 	e->fmt = VOID;
 	e->constant = EXPR_VAR;
+	e->nstr = 1;
 	return (e);
 }
 
-static struct expr *
-vcc_mk_expr(vcc_type_t fmt, const char *str, ...)
-    __v_printflike(2, 3);
-
 static struct expr *
 vcc_mk_expr(vcc_type_t fmt, const char *str, ...)
 {
@@ -262,6 +264,83 @@ vcc_delete_expr(struct expr *e)
 	FREE_OBJ(e);
 }
 
+/*--------------------------------------------------------------------
+ * Constant folding
+ *
+ * Constant BOOLs are always created by vcc_mk_bool(), so their value
+ * can be read back from the C source.  The C compiler takes care of
+ * the arithmetic and of the branches which end up under "if (0==1)",
+ * but it cannot see through the VRT functions we emit for comparisons.
+ */
+
+static struct expr *
+vcc_mk_bool(int b)
+{
+	struct expr *e;
+
+	e = vcc_mk_expr(BOOL, "(0==%d)", b ? 0 : 1);
+	e->constant = EXPR_CONST;
+	return (e);
+}
+
+static int
+vcc_boolval(const struct expr *e)
+{
+
+	CHECK_OBJ_NOTNULL(e, EXPR_MAGIC);
+	if (e->fmt != BOOL || !vcc_isconst(e))
+		return (-1);
+	if (!strcmp(VSB_data(e->vsb), "(0==0)"))
+		return (1);
+	assert(!strcmp(VSB_data(e->vsb), "(0==1)"));
+	return (0);
+}
+
+static int
+vcc_numval(const struct expr *e, double *d)
+{
+	char *p;
+
+	CHECK_OBJ_NOTNULL(e, EXPR_MAGIC);
+	if (!vcc_isconst(e))
+		return (0);
+	errno = 0;
+	*d = strtod(VSB_data(e->vsb), &p);
+	return (errno == 0 && *p == '\0' && p != VSB_data(e->vsb));
+}
+
+/*
+ * Fold "e1 op e2" if both sides are known, returns NULL otherwise
+ */
+
+static struct expr *
+vcc_fold_cmp(unsigned tok, const struct expr *e1, const struct expr *e2)
+{
+	double d1, d2;
+	int i;
+
+	if (e1->fmt == STRING && e1->cstr != NULL && e2->cstr != NULL) {
+		i = strcmp(e1->cstr, e2->cstr);
+	} else if (e1->fmt == INT || e1->fmt == REAL ||
+	    e1->fmt == DURATION || e1->fmt == BYTES) {
+		if (!vcc_numval(e1, &d1) || !vcc_numval(e2, &d2))
+			return (NULL);
+		i = (d1 > d2) - (d1 < d2);
+	} else
+		return (NULL);
+
+	switch (tok) {
+	case T_EQ:	return (vcc_mk_bool(i == 0));
+	case T_NEQ:	return (vcc_mk_bool(i != 0));
+	case T_LEQ:	return (vcc_mk_bool(i <= 0));
+	case T_GEQ:	return (vcc_mk_bool(i >= 0));
+	case '<':	return (vcc_mk_bool(i < 0));
+	case '>':	return (vcc_mk_bool(i > 0));
+	default:	WRONG("Unknown comparison");
+	}
+	NEEDLESS(return (NULL));
+}
+
 /*--------------------------------------------------------------------
  * We want to get the indentation right in the emitted C code so we have
  * to represent it symbolically until we are ready to render.
@@ -327,6 +406,26 @@ vcc_expr_edit(vcc_type_t fmt, const char *p, struct expr *e1,
 	return (e);
 }
 
+/*--------------------------------------------------------------------
+ * Turn a STRING or STRING_LIST into STRANDS, a compound literal which
+ * lives as long as the enclosing block, which is long enough for the
+ * function call it is an argument to.
+ */
+
+static struct expr *
+vcc_expr_strands(struct expr *e)
+{
+	char buf[128];
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(e, EXPR_MAGIC);
+	assert(e->fmt == STRING || e->fmt == STRING_LIST);
+	n = e->nstr;
+	bprintf(buf, "&(struct strands){.n = %u, .p = (const char *[%u]){"
+	    "\v+\n\v1\v-\n}}", n, n);
+	return (vcc_expr_edit(STRANDS, buf, e, NULL));
+}
+
 /*--------------------------------------------------------------------
  * Expand finished expression into C-source code
  */
@@ -416,6 +515,8 @@ vcc_Eval_Regsub(struct vcc *tl, struct expr **e, const struct symbol *sym,
 	struct expr *e2;
 	int all = sym->eval_priv == NULL ? 0 : 1;
 	const char *p;
+	unsigned anchor;
+	struct vsb *vsb;
 	char buf[128];
 
 	(void)fmt;
@@ -429,11 +530,23 @@ vcc_Eval_Regsub(struct vcc *tl, struct expr **e, const struct symbol *sym,
 
 	SkipToken(tl, ',');
 	ExpectErr(tl, CSTR);
-	p = vcc_regexp(tl);
-	vcc_NextToken(tl);
-
-	bprintf(buf, "VRT_regsub(ctx, %d,\v+\n\v1,\n%s", all, p);
-	*e = vcc_expr_edit(STRING, buf, e2, *e);
+	p = vcc_regexp_fixed(tl, tl->t->dec, &anchor);
+	if (p != NULL) {
+		vcc_NextToken(tl);
+		vsb = VSB_new_auto();
+		AN(vsb);
+		VSB_printf(vsb, "VRT_regsub_fixed(ctx, %d,\v+\n\v1,\n%u, ",
+		    all, anchor);
+		VSB_quote(vsb, p, -1, VSB_QUOTE_CSTR);
+		AZ(VSB_finish(vsb));
+		*e = vcc_expr_edit(STRING, VSB_data(vsb), e2, *e);
+		VSB_destroy(&vsb);
+	} else {
+		p = vcc_regexp(tl);
+		vcc_NextToken(tl);
+		bprintf(buf, "VRT_regsub(ctx, %d,\v+\n\v1,\n%s", all, p);
+		*e = vcc_expr_edit(STRING, buf, e2, *e);
+	}
 
 	SkipToken(tl, ',');
 	vcc_expr0(tl, &e2, STRING);
@@ -562,6 +675,19 @@ vcc_do_arg(struct vcc *tl, struct func_arg *fa)
 		}
 		fa->result = vcc_mk_expr(VOID, "\"%.*s\"", PF(tl->t));
 		SkipToken(tl, ID);
+	} else if (fa->type == STRANDS) {
+		vcc_expr0(tl, &e2, STRING_LIST);
+		ERRCHK(tl);
+		if (e2->fmt != STRING_LIST) {
+			VSB_printf(tl->sb, "Wrong argument type.");
+			VSB_printf(tl->sb, "  Expected %s.",
+				fa->type->name);
+			VSB_printf(tl->sb, "  Got %s.\n",
+				e2->fmt->name);
+			vcc_ErrWhere2(tl, e2->t1, tl->t);
+			return;
+		}
+		fa->result = vcc_expr_strands(e2);
 	} else {
 		vcc_expr0(tl, &e2, fa->type);
 		ERRCHK(tl);
@@ -768,6 +894,11 @@ vcc_expr4(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 		vcc_expr0(tl, &e2, fmt);
 		ERRCHK(tl);
 		SkipToken(tl, ')');
+		if (vcc_isconst(e2) || e2->fmt == STRING_LIST) {
+			/* Literals and lists of pieces need no parentheses */
+			*e = e2;
+			return;
+		}
 		*e = vcc_expr_edit(e2->fmt, "(\v1)", e2, NULL);
 		return;
 	}
@@ -835,6 +966,7 @@ vcc_expr4(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 			e1 = vcc_new_expr();
 			EncToken(e1->vsb, tl->t);
 			e1->fmt = STRING;
+			e1->cstr = tl->t->dec;
 			AZ(VSB_finish(e1->vsb));
 		}
 		e1->t1 = tl->t;
@@ -956,6 +1088,8 @@ static void
 vcc_expr_string_add(struct vcc *tl, struct expr **e, struct expr *e2)
 {
 	vcc_type_t f2;
+	unsigned n;
+	char *p;
 
 	AN(e);
 	AN(*e);
@@ -977,20 +1111,35 @@ vcc_expr_string_add(struct vcc *tl, struct expr **e, struct expr *e2)
 		if (vcc_isconst(*e) && vcc_isconst(e2)) {
 			assert((*e)->fmt == STRING);
 			assert(e2->fmt == STRING);
+			if ((*e)->cstr != NULL && e2->cstr != NULL) {
+				p = TlAlloc(tl, strlen((*e)->cstr) +
+				    strlen(e2->cstr) + 1);
+				AN(p);
+				strcpy(p, (*e)->cstr);
+				strcat(p, e2->cstr);
+			} else
+				p = NULL;
 			*e = vcc_expr_edit(STRING, "\v1\n\v2", *e, e2);
 			(*e)->constant = EXPR_CONST;
+			(*e)->cstr = p;
 		} else if (((*e)->constant & EXPR_STR_CONST) &&
 		    vcc_isconst(e2)) {
 			assert((*e)->fmt == STRING_LIST);
 			assert(e2->fmt == STRING);
+			n = (*e)->nstr;
 			*e = vcc_expr_edit(STRING_LIST, "\v1\n\v2", *e, e2);
 			(*e)->constant = EXPR_VAR | EXPR_STR_CONST;
+			(*e)->nstr = n;
 		} else if (e2->fmt == STRING && vcc_isconst(e2)) {
+			n = (*e)->nstr + e2->nstr;
 			*e = vcc_expr_edit(STRING_LIST, "\v1,\n\v2", *e, e2);
 			(*e)->constant = EXPR_VAR | EXPR_STR_CONST;
+			(*e)->nstr = n;
 		} else {
+			n = (*e)->nstr + e2->nstr;
 			*e = vcc_expr_edit(STRING_LIST, "\v1,\n\v2", *e, e2);
 			(*e)->constant = EXPR_VAR;
+			(*e)->nstr = n;
 		}
 		e2 = NULL;
 	}
@@ -1141,8 +1290,8 @@ static const struct cmps {
 
 	{STRING,	T_EQ,	"!VRT_strcmp(\v1, \v2)" },
 	{STRING,	T_NEQ,	"VRT_strcmp(\v1, \v2)" },
-	{STRING_LIST,	T_EQ,	"!VRT_strcmp(\v1, \v2)" },
-	{STRING_LIST,	T_NEQ,	"VRT_strcmp(\v1, \v2)" },
+	{STRING_LIST,	T_EQ,	NULL },		/* VRT_CompareStrands */
+	{STRING_LIST,	T_NEQ,	NULL },
 
 	{VOID, 0, NULL}
 };
@@ -1152,7 +1301,7 @@ static const struct cmps {
 static void
 vcc_expr_cmp(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 {
-	struct expr *e2;
+	struct expr *e1, *e2;
 	const struct cmps *cp;
 	char buf[256];
 	const char *re;
@@ -1172,13 +1321,27 @@ vcc_expr_cmp(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 	for (cp = vcc_cmps; cp->fmt != VOID; cp++)
 		if ((*e)->fmt == cp->fmt && tl->t->tok == cp->token)
 			break;
-	if (cp->fmt != VOID) {
+	if (cp->fmt == STRING_LIST) {
+		/* Compare the pieces, rather than assembling the string */
 		vcc_NextToken(tl);
-		if ((*e)->fmt == STRING_LIST) {
-			// XXX: This is not optimal, but we can't pass two
-			// STRING_LIST's to a function anyway...
-			vcc_expr_tostring(tl, e, STRING);
+		vcc_expr_strfold(tl, &e2, STRING_LIST);
+		ERRCHK(tl);
+		if (e2->fmt != STRING_LIST) {
+			VSB_printf(tl->sb, "Comparison of different types: ");
+			VSB_printf(tl->sb, "%s ", (*e)->fmt->name);
+			vcc_ErrToken(tl, tk);
+			VSB_printf(tl->sb, " %s\n", e2->fmt->name);
+			vcc_ErrWhere(tl, tk);
+			return;
 		}
+		bprintf(buf, "%sVRT_CompareStrands(\v1,\n\v2)",
+		    cp->token == T_EQ ? "!" : "");
+		*e = vcc_expr_edit(BOOL, buf,
+		    vcc_expr_strands(*e), vcc_expr_strands(e2));
+		return;
+	}
+	if (cp->fmt != VOID) {
+		vcc_NextToken(tl);
 		vcc_expr_strfold(tl, &e2, (*e)->fmt);
 		ERRCHK(tl);
 		if (e2->fmt != (*e)->fmt) { /* XXX */
@@ -1189,6 +1352,14 @@ vcc_expr_cmp(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 			vcc_ErrWhere(tl, tk);
 			return;
 		}
+		e1 = vcc_fold_cmp(cp->token, *e, e2);
+		if (e1 != NULL) {
+			e1->t1 = (*e)->t1;
+			vcc_delete_expr(*e);
+			vcc_delete_expr(e2);
+			*e = e1;
+			return;
+		}
 		*e = vcc_expr_edit(BOOL, cp->emit, *e, e2);
 		return;
 	}
@@ -1287,6 +1458,11 @@ vcc_expr_not(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 	tk = tl->t;
 	vcc_expr_cmp(tl, &e2, fmt);
 	ERRCHK(tl);
+	if (e2->fmt == BOOL && vcc_boolval(e2) >= 0) {
+		*e = vcc_mk_bool(!vcc_boolval(e2));
+		vcc_delete_expr(e2);
+		return;
+	}
 	if (e2->fmt == BOOL) {
 		*e = vcc_expr_edit(BOOL, "!(\v1)", e2, NULL);
 		return;
@@ -1307,13 +1483,14 @@ vcc_expr_cand(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 {
 	struct expr *e2;
 	struct token *tk;
+	unsigned n;
 
 	*e = NULL;
 	vcc_expr_not(tl, e, fmt);
 	ERRCHK(tl);
 	if ((*e)->fmt != BOOL || tl->t->tok != T_CAND)
 		return;
-	*e = vcc_expr_edit(BOOL, "(\v+\n\v1", *e, NULL);
+	n = 0;
 	while (tl->t->tok == T_CAND) {
 		vcc_NextToken(tl);
 		tk = tl->t;
@@ -1326,9 +1503,101 @@ vcc_expr_cand(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 			vcc_ErrWhere2(tl, tk, tl->t);
 			return;
 		}
+		if (vcc_boolval(*e) == 0 || vcc_boolval(e2) == 1) {
+			vcc_delete_expr(e2);
+			continue;
+		}
+		if (vcc_boolval(*e) == 1) {
+			vcc_delete_expr(*e);
+			*e = e2;
+			continue;
+		}
+		if (n++ == 0)
+			*e = vcc_expr_edit(BOOL, "(\v+\n\v1", *e, NULL);
 		*e = vcc_expr_edit(BOOL, "\v1\v-\n&&\v+\n\v2", *e, e2);
 	}
-	*e = vcc_expr_edit(BOOL, "\v1\v-\n)", *e, NULL);
+	if (n > 0)
+		*e = vcc_expr_edit(BOOL, "\v1\v-\n)", *e, NULL);
+}
+
+/*--------------------------------------------------------------------
+ * A run of "VAR ~ CString" alternatives against the same variable,
+ * as in:
+ *	req.url ~ "^/a" || req.url ~ "^/b" || req.url ~ "^/c"
+ * is compiled into a single regexp with one branch per alternative,
+ * so the subject is only matched once.  Variables can be read any
+ * number of times without side-effects, so this does not change the
+ * outcome, only which branch is reported to match.
+ */
+
+static int
+vcc_expr_rebundle(struct vcc *tl, struct expr **e, vcc_type_t fmt)
+{
+	struct token *tv, *t, *tn, *tr[64];
+	const struct symbol *sym;
+	const char *re;
+	char buf[256];
+	unsigned n, u;
+
+	if (fmt != BOOL || tl->t->tok != ID)
+		return (0);
+	tv = tl->t;
+	n = 0;
+	for (t = tv; n < sizeof tr / sizeof tr[0]; t = tn) {
+		tn = VTAILQ_NEXT(t, list);
+		if (tn == NULL || tn->tok != '~')
+			break;
+		tn = VTAILQ_NEXT(tn, list);
+		if (tn == NULL || tn->tok != CSTR ||
+		    !vcc_regexp_bundleable(tn->dec))
+			break;
+		tr[n] = tn;
+		tn = VTAILQ_NEXT(tn, list);
+		AN(tn);
+		if (tn->tok == T_CAND)
+			break;		/* Binds tighter than '||' */
+		n++;
+		if (tn->tok != T_COR)
+			break;
+		tn = VTAILQ_NEXT(tn, list);
+		if (tn == NULL || tn->tok != ID ||
+		    tn->e - tn->b != tv->e - tv->b ||
+		    memcmp(tn->b, tv->b, tv->e - tv->b))
+			break;
+	}
+	if (n < 2)
+		return (0);
+
+	sym = VCC_SymbolTok(tl, NULL, tv, SYM_VAR, 0);
+	if (sym == NULL || (sym->fmt != STRING && sym->fmt != HEADER))
+		return (0);
+
+	vcc_expr_strfold(tl, e, fmt);
+	if (tl->err)
+		return (1);
+	if ((*e)->fmt == STRING_LIST)
+		vcc_expr_tostring(tl, e, STRING);
+	assert((*e)->fmt == STRING);
+
+	/* We have looked at all the tokens already */
+	for (u = 0; u < n; u++) {
+		if (u > 0) {
+			assert(tl->t->tok == T_COR);
+			vcc_NextToken(tl);
+			assert(tl->t->tok == ID);
+			vcc_NextToken(tl);
+		}
+		assert(tl->t->tok == '~');
+		vcc_NextToken(tl);
+		assert(tl->t == tr[u]);
+		vcc_NextToken(tl);
+	}
+	re = vcc_regexp_bundle(tl, tr, n);
+	if (re == NULL)
+		return (1);
+	bprintf(buf, "VRT_re_bundle(ctx, \v1, %s)", re);
+	*e = vcc_expr_edit(BOOL, buf, *e, NULL);
+	return (1);
 }
 
 /*--------------------------------------------------------------------
@@ -1342,16 +1611,18 @@ vcc_expr0(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 {
 	struct expr *e2;
 	struct token *tk;
+	unsigned n = 0;
 
 	*e = NULL;
-	vcc_expr_cand(tl, e, fmt);
+	if (!vcc_expr_rebundle(tl, e, fmt))
+		vcc_expr_cand(tl, e, fmt);
 	ERRCHK(tl);
 	if ((*e)->fmt == BOOL && tl->t->tok == T_COR) {
-		*e = vcc_expr_edit(BOOL, "(\v+\n\v1", *e, NULL);
 		while (tl->t->tok == T_COR) {
 			vcc_NextToken(tl);
 			tk = tl->t;
-			vcc_expr_cand(tl, &e2, fmt);
+			if (!vcc_expr_rebundle(tl, &e2, fmt))
+				vcc_expr_cand(tl, &e2, fmt);
 			ERRCHK(tl);
 			if (e2->fmt != BOOL) {
 				VSB_printf(tl->sb,
@@ -1360,9 +1631,22 @@ vcc_expr0(struct vcc *tl, struct expr **e, vcc_type_t fmt)
 				vcc_ErrWhere2(tl, tk, tl->t);
 				return;
 			}
+			if (vcc_boolval(*e) == 1 || vcc_boolval(e2) == 0) {
+				vcc_delete_expr(e2);
+				continue;
+			}
+			if (vcc_boolval(*e) == 0) {
+				vcc_delete_expr(*e);
+				*e = e2;
+				continue;
+			}
+			if (n++ == 0)
+				*e = vcc_expr_edit(BOOL, "(\v+\n\v1", *e,
+				    NULL);
 			*e = vcc_expr_edit(BOOL, "\v1\v-\n||\v+\n\v2", *e, e2);
 		}
-		*e = vcc_expr_edit(BOOL, "\v1\v-\n)", *e, NULL);
+		if (n > 0)
+			*e = vcc_expr_edit(BOOL, "\v1\v-\n)", *e, NULL);
 	}
 	if (fmt != (*e)->fmt && (fmt == STRING || fmt == STRING_LIST)) {
 		vcc_expr_tostring(tl, e, fmt);
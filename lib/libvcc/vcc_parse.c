@@ -47,7 +47,8 @@ static void vcc_Compound(struct vcc *tl);
 } while (0)
 
 #define C(tl, sep)	do {					\
-	Fb(tl, 1, "VRT_count(ctx, %u)%s\n", ++tl->cnt, sep);	\
+	Fb(tl, 1, "VRT_%scount(ctx, %u)%s\n",			\
+	    tl->profile ? "prof_" : "", ++tl->cnt, sep);	\
 	tl->t->cnt = tl->cnt;					\
 } while (0)
 
@@ -231,6 +232,10 @@ vcc_ParseFunction(struct vcc *tl)
 			(void)vcc_AddDef(tl, tl->t, SYM_SUB);
 			vcc_AddRef(tl, tl->t, SYM_SUB);
 			tl->mprocs[m] = vcc_AddProc(tl, tl->t);
+			if (tl->profile) {
+				tl->mcnt[m] = ++tl->cnt;
+				tl->t->cnt = tl->cnt;
+			}
 		}
 		tl->curproc = tl->mprocs[m];
 		Fb(tl, 1, "  /* ... from ");
@@ -247,9 +252,22 @@ vcc_ParseFunction(struct vcc *tl)
 		}
 		tl->curproc = vcc_AddProc(tl, tl->t);
 		Fh(tl, 0, "void VGC_function_%.*s(VRT_CTX);\n", PF(tl->t));
-		Fc(tl, 1, "\nvoid __match_proto__(vcl_func_t)\n");
-		Fc(tl, 1, "VGC_function_%.*s(VRT_CTX)\n",
-		    PF(tl->t));
+		if (tl->profile) {
+			/* Time the body, whichever way it returns */
+			tl->t->cnt = ++tl->cnt;
+			Fh(tl, 0, "static void VGC_body_%.*s(VRT_CTX);\n",
+			    PF(tl->t));
+			Fc(tl, 1, "\nvoid __match_proto__(vcl_func_t)\n");
+			Fc(tl, 1, "VGC_function_%.*s(VRT_CTX)\n", PF(tl->t));
+			Fc(tl, 1, "{\n");
+			Fc(tl, 1, "  VRT_prof_call(ctx, %u, VGC_body_%.*s);\n",
+			    tl->cnt, PF(tl->t));
+			Fc(tl, 1, "}\n");
+		}
+		Fc(tl, 1, "\n%s __match_proto__(vcl_func_t)\n",
+		    tl->profile ? "static void" : "void");
+		Fc(tl, 1, "VGC_%s_%.*s(VRT_CTX)\n",
+		    tl->profile ? "body" : "function", PF(tl->t));
 	}
 	vcc_NextToken(tl);
 	tl->indent += INDENT;
@@ -30,6 +30,7 @@
 
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -81,6 +82,102 @@ vcc_new_symbol(struct vcc *tl, const char *b, const char *e)
 	sym->name[e - b] = '\0';
 	sym->nlen = e - b;
 	VTAILQ_INIT(&sym->children);
+	tl->nsymbols++;
+	return (sym);
+}
+
+/*--------------------------------------------------------------------
+ * Children are kept in sorted lists, which is the order the walkers
+ * and the xref table present them in, but generated VCL with thousands
+ * of backends makes searching those lists the bulk of the compile.
+ * The first child of each name is therefore also hashed on the
+ * (parent, name) pair, and the list is only walked along the run of
+ * children sharing that name.
+ */
+
+static unsigned
+vcc_symhash(const struct symbol *parent, const char *b, size_t l)
+{
+	uintptr_t u;
+	unsigned h = 2166136261U;
+
+	for (u = (uintptr_t)parent; u != 0; u >>= 8)
+		h = (h ^ (u & 0xff)) * 16777619U;
+	while (l-- > 0)
+		h = (h ^ (unsigned char)*b++) * 16777619U;
+	return (h);
+}
+
+static int
+vcc_symcmp(const struct symbol *sym, const char *b, size_t l)
+{
+	int i;
+
+	i = strncmp(sym->name, b, l);
+	if (i != 0)
+		return (i);
+	if (sym->nlen > l)
+		return (1);
+	return (sym->nlen < l ? -1 : 0);
+}
+
+static struct symbol *
+vcc_symtab_lookup(const struct vcc *tl, const struct symbol *parent,
+    const char *b, size_t l, unsigned h)
+{
+	struct symbol *sym;
+
+	if (tl->nsymtab == 0)
+		return (NULL);
+	for (sym = tl->symtab[h & (tl->nsymtab - 1)]; sym != NULL;
+	    sym = sym->hnext) {
+		if (sym->hash == h && sym->parent == parent &&
+		    sym->nlen == l && !memcmp(sym->name, b, l))
+			return (sym);
+	}
+	return (NULL);
+}
+
+static void
+vcc_symtab_insert(struct vcc *tl, struct symbol *sym)
+{
+	struct symbol **tab, *s, *s2;
+	unsigned n, u;
+
+	if (tl->nsymbols > tl->nsymtab) {
+		n = tl->nsymtab == 0 ? 256 : tl->nsymtab * 4;
+		tab = calloc(n, sizeof *tab);
+		AN(tab);
+		for (u = 0; u < tl->nsymtab; u++) {
+			for (s = tl->symtab[u]; s != NULL; s = s2) {
+				s2 = s->hnext;
+				s->hnext = tab[s->hash & (n - 1)];
+				tab[s->hash & (n - 1)] = s;
+			}
+		}
+		free(tl->symtab);
+		tl->symtab = tab;
+		tl->nsymtab = n;
+	}
+	u = sym->hash & (tl->nsymtab - 1);
+	sym->hnext = tl->symtab[u];
+	tl->symtab[u] = sym;
+}
+
+/* Where a name not yet present under parent goes in the sorted list */
+
+static struct symbol *
+vcc_symsucc(const struct symbol *parent, const char *b, size_t l)
+{
+	struct symbol *sym;
+
+	sym = VTAILQ_LAST(&parent->children, symbolhead);
+	if (sym == NULL || vcc_symcmp(sym, b, l) < 0)
+		return (NULL);
+	VTAILQ_FOREACH(sym, &parent->children, list)
+		if (vcc_symcmp(sym, b, l) > 0)
+			break;
+	AN(sym);
 	return (sym);
 }
 
@@ -90,8 +187,9 @@ VCC_Symbol(struct vcc *tl, struct symbol *parent,
 {
 	const char *q;
 	struct symbol *sym, *sym2 = NULL;
+	unsigned h;
 	size_t l;
-	int i;
+	int first;
 
 	if (tl->symbols == NULL)
 		tl->symbols = vcc_new_symbol(tl, "<root>", NULL);
@@ -113,17 +211,15 @@ VCC_Symbol(struct vcc *tl, struct symbol *parent,
 	l = q - b;
 	assert(l > 0);
 
-	VTAILQ_FOREACH(sym, &parent->children, list) {
-		i = strncmp(sym->name, b, l);
-		if (i < 0)
-			continue;
-		if (i > 0 || l < sym->nlen) {
+	h = vcc_symhash(parent, b, l);
+	sym = vcc_symtab_lookup(tl, parent, b, l, h);
+	first = (sym == NULL);
+	for (; sym != NULL; sym = VTAILQ_NEXT(sym, list)) {
+		if (vcc_symcmp(sym, b, l) != 0) {
 			sym2 = sym;
 			sym = NULL;
 			break;
 		}
-		if (l > sym->nlen)
-			continue;
 		if (q < e)
 			break;
 		if (kind != SYM_NONE && sym->kind != kind)
@@ -142,8 +238,13 @@ VCC_Symbol(struct vcc *tl, struct symbol *parent,
 	if (sym == NULL && create < 1)
 		return (sym);
 	if (sym == NULL) {
+		if (first)
+			sym2 = vcc_symsucc(parent, b, l);
 		sym = vcc_new_symbol(tl, b, q);
 		sym->parent = parent;
+		sym->hash = h;
+		if (first)
+			vcc_symtab_insert(tl, sym);
 		if (sym2 != NULL)
 			VTAILQ_INSERT_BEFORE(sym2, sym, list);
 		else
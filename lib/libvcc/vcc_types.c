@@ -132,6 +132,12 @@ const struct type STEVEDORE[1] = {{
 	.tostring =		"VRT_STEVEDORE_string(\v1)",
 }};
 
+const struct type STRANDS[1] = {{
+	.magic =		TYPE_MAGIC,
+	.name =			"STRANDS",
+	.tostring =		"VRT_CollectStrands(ctx,\v+\n\v1\v-\n)",
+}};
+
 const struct type STRING[1] = {{
 	.magic =		TYPE_MAGIC,
 	.name =			"STRING",
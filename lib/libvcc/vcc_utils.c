@@ -37,6 +37,7 @@
 
 #include "vcc_compile.h"
 
+#include "vct.h"
 #include "vre.h"
 #include "vrt.h"
 #include "vsa.h"
@@ -45,27 +46,30 @@
 
 /*--------------------------------------------------------------------*/
 
-const char *
-vcc_regexp(struct vcc *tl)
+static int
+vcc_regexp_check(struct vcc *tl, const char *re, const struct token *t)
 {
-	char buf[BUFSIZ], *p;
-	vre_t *t;
+	vre_t *vre;
 	const char *error;
 	int erroroffset;
-	struct inifin *ifp;
 
-	Expect(tl, CSTR);
-	if (tl->err)
-		return (NULL);
-	memset(&t, 0, sizeof t);
-	t = VRE_compile(tl->t->dec, 0, &error, &erroroffset);
-	if (t == NULL) {
+	vre = VRE_compile(re, 0, &error, &erroroffset);
+	if (vre == NULL) {
 		VSB_printf(tl->sb,
 		    "Regexp compilation error:\n\n%s\n\n", error);
-		vcc_ErrWhere(tl, tl->t);
-		return (NULL);
+		vcc_ErrWhere(tl, t);
+		return (-1);
 	}
-	VRE_free(&t);
+	VRE_free(&vre);
+	return (0);
+}
+
+static const char *
+vcc_regexp_emit(struct vcc *tl, const char *re)
+{
+	char buf[BUFSIZ], *p;
+	struct inifin *ifp;
+
 	bprintf(buf, "VGC_re_%u", tl->unique++);
 	p = TlAlloc(tl, strlen(buf) + 1);
 	strcpy(p, buf);
@@ -73,12 +77,143 @@ vcc_regexp(struct vcc *tl)
 	Fh(tl, 0, "static void *%s;\n", buf);
 	ifp = New_IniFin(tl);
 	VSB_printf(ifp->ini, "\tVRT_re_init(&%s, ",buf);
-	EncToken(ifp->ini, tl->t);
+	VSB_quote(ifp->ini, re, -1, VSB_QUOTE_CSTR);
 	VSB_printf(ifp->ini, ");");
 	VSB_printf(ifp->fin, "\t\tVRT_re_fini(%s);", buf);
 	return (p);
 }
 
+const char *
+vcc_regexp(struct vcc *tl)
+{
+
+	Expect(tl, CSTR);
+	if (tl->err)
+		return (NULL);
+	if (vcc_regexp_check(tl, tl->t->dec, tl->t))
+		return (NULL);
+	return (vcc_regexp_emit(tl, tl->t->dec));
+}
+
+/*--------------------------------------------------------------------
+ * Regexps can be bundled into one alternation, if wrapping them in a
+ * group cannot change what they match: No back references or group
+ * numbers, no verbs and no options or quoting which reach past the
+ * end of the group.  Anything doubtful is left alone.
+ */
+
+int
+vcc_regexp_bundleable(const char *re)
+{
+	static const char * const ok[] = {
+		"(?:", "(?i)", "(?i:", "(?=", "(?!", "(?<=", "(?<!", "(?>",
+		NULL
+	};
+	const char * const *o;
+	const char *p;
+
+	for (p = re; *p != '\0'; p++) {
+		if (*p == '\\') {
+			p++;
+			if (*p == '\0' || vct_isdigit(*p) ||
+			    strchr("gkQ", *p) != NULL)
+				return (0);
+			continue;
+		}
+		if (*p != '(')
+			continue;
+		if (p[1] == '*')
+			return (0);
+		if (p[1] != '?')
+			continue;
+		for (o = ok; *o != NULL; o++)
+			if (!strncmp(p, *o, strlen(*o)))
+				break;
+		if (*o == NULL)
+			return (0);
+	}
+	return (1);
+}
+
+/*
+ * The branches are marked with their number, so the match can tell
+ * which one it was, see VRT_re_bundle().
+ */
+
+const char *
+vcc_regexp_bundle(struct vcc *tl, struct token * const *t, unsigned n)
+{
+	struct vsb *vsb;
+	const char *p;
+	unsigned u;
+
+	AN(n);
+	vsb = VSB_new_auto();
+	AN(vsb);
+	for (u = 0; u < n; u++) {
+		assert(t[u]->tok == CSTR);
+		if (vcc_regexp_check(tl, t[u]->dec, t[u])) {
+			VSB_destroy(&vsb);
+			return (NULL);
+		}
+		AN(vcc_regexp_bundleable(t[u]->dec));
+		VSB_printf(vsb, "%s(?:%s)(*MARK:%u)",
+		    u == 0 ? "" : "|", t[u]->dec, u + 1);
+	}
+	AZ(VSB_finish(vsb));
+	p = NULL;
+	if (!vcc_regexp_check(tl, VSB_data(vsb), t[0]))
+		p = vcc_regexp_emit(tl, VSB_data(vsb));
+	VSB_destroy(&vsb);
+	return (p);
+}
+
+/*--------------------------------------------------------------------
+ * A regexp which is just a literal string, possibly anchored with ^
+ * and/or $, can be done with string compares, see VRT_regsub_fixed().
+ * Return the literal without its escapes and the anchors, or NULL if
+ * it takes PCRE.
+ */
+
+const char *
+vcc_regexp_fixed(struct vcc *tl, const char *re, unsigned *anchor)
+{
+	struct vsb *vsb;
+	const char *p;
+	char *r;
+
+	AN(anchor);
+	*anchor = 0;
+	p = re;
+	if (*p == '^') {
+		*anchor |= VRT_RE_BEGIN;
+		p++;
+	}
+	vsb = VSB_new_auto();
+	AN(vsb);
+	for (; *p != '\0'; p++) {
+		if (*p == '\\') {
+			if (p[1] == '\0' || vct_isdigit(p[1]) ||
+			    vct_isalpha(p[1]))
+				break;
+			p++;
+		} else if (*p == '$' && p[1] == '\0') {
+			*anchor |= VRT_RE_END;
+			continue;
+		} else if (strchr(".[]|()?*+{}^$", *p) != NULL)
+			break;
+		if (*p == '\n')
+			break;
+		VSB_putc(vsb, *p);
+	}
+	AZ(VSB_finish(vsb));
+	r = NULL;
+	if (*p == '\0' && VSB_len(vsb) > 0)
+		r = TlDup(tl, VSB_data(vsb));
+	VSB_destroy(&vsb);
+	return (r);
+}
+
 /*
  * The IPv6 crew royally screwed up the entire idea behind
  * struct sockaddr, see libvarnish/vsa.c for blow-by-blow account.
@@ -208,7 +343,7 @@ Resolve_Sockaddr(struct vcc *tl,
 	rss->vsb = VSB_new_auto();
 	AN(rss->vsb);
 
-	error = VSS_resolver(host, def_port, rs_callback, rss, &err);
+	error = vcc_Resolver(tl, host, def_port, rs_callback, rss, &err);
 	AZ(VSB_finish(rss->vsb));
 	if (err != NULL) {
 		VSB_printf(tl->sb,
@@ -34,6 +34,7 @@
 
 #include "vcc_compile.h"
 #include "vct.h"
+#include "vhdr.h"
 
 /*--------------------------------------------------------------------*/
 
@@ -77,8 +78,8 @@ vcc_Var_Wildcard(struct vcc *tl, struct symbol *parent,
 
 	/* Create the static identifier */
 	Fh(tl, 0, "static const struct gethdr_s %s =\n", VSB_data(vsb) + 1);
-	Fh(tl, 0, "    { %s, \"\\%03o%.*s:\"};\n",
-	    vh->rname, u, (int)(e - b), b);
+	Fh(tl, 0, "    { %s, \"\\%03o%.*s:\", %u };\n",
+	    vh->rname, u, (int)(e - b), b, VHDR_Id(b, e - b));
 
 	/* Create the symbol r/l values */
 	v->rname = TlDup(tl, VSB_data(vsb));
@@ -46,6 +46,37 @@
 #  define TBLS 1
 #endif /* BYFOUR */
 
+/*
+  Hardware CRC-32, picked at run time: carry-less multiplication folding
+  (Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+  Instruction") on x86, and the CRC32 instructions of ARMv8.  Anything else,
+  and any CPU without them, uses the tables.
+ */
+#if !defined(NO_CRC32_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#  define CRC32_PCLMUL
+#  include <stdint.h>
+#  include <immintrin.h>
+   local z_crc_t crc32_pclmul OF((z_crc_t, const unsigned char FAR *,
+                        uInt));
+#endif
+#if !defined(NO_CRC32_SIMD) && defined(__GNUC__) && \
+    defined(__aarch64__) && defined(__linux__)
+#  define CRC32_ARMV8
+#  include <stdint.h>
+#  include <arm_acle.h>
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+   local z_crc_t crc32_armv8 OF((z_crc_t, const unsigned char FAR *,
+                        uInt));
+#endif
+#if defined(CRC32_PCLMUL) || defined(CRC32_ARMV8)
+#  define CRC32_SIMD
+#  define CRC32_SIMD_MIN 64     /* shorter than that, the tables win */
+   local int crc32_simd = -1;   /* unknown, no or yes */
+   local void crc32_simd_probe OF((void));
+#endif
+
 /* Local functions for crc concatenation */
 local unsigned long gf2_matrix_times OF((unsigned long *mat,
                                          unsigned long vec));
@@ -213,6 +244,27 @@ unsigned long ZEXPORT crc32(crc, buf, len)
         make_crc_table();
 #endif /* DYNAMIC_CRC_TABLE */
 
+#ifdef CRC32_SIMD
+    if (crc32_simd < 0)
+        crc32_simd_probe();
+    if (crc32_simd && len >= CRC32_SIMD_MIN) {
+        uInt chunk;
+
+#  ifdef CRC32_PCLMUL
+        /* Whole 16 byte blocks, the CRC stays pre-conditioned between */
+        chunk = len & ~(uInt)15;
+        crc = (z_crc_t)~crc32_pclmul(~(z_crc_t)crc, buf, chunk);
+#  else
+        chunk = len;
+        crc = (z_crc_t)~crc32_armv8(~(z_crc_t)crc, buf, chunk);
+#  endif
+        len -= chunk;
+        if (len == 0)
+            return crc;
+        buf += chunk;
+    }
+#endif /* CRC32_SIMD */
+
 #ifdef BYFOUR
     if (sizeof(void *) == sizeof(ptrdiff_t)) {
         z_crc_t endian;
@@ -323,6 +375,160 @@ local unsigned long crc32_big(crc, buf, len)
 
 #define GF2_DIM 32      /* dimension of GF(2) vectors (length of CRC) */
 
+#ifdef CRC32_SIMD
+
+/* ========================================================================= */
+local void crc32_simd_probe()
+{
+#  ifdef CRC32_PCLMUL
+    __builtin_cpu_init();
+    crc32_simd = __builtin_cpu_supports("pclmul") &&
+        __builtin_cpu_supports("sse4.1");
+#  else
+    crc32_simd = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#  endif
+}
+
+#endif /* CRC32_SIMD */
+
+#ifdef CRC32_PCLMUL
+
+/* ========================================================================= */
+/*
+  Fold four 128 bit lanes over the buffer, then those into one, and Barrett
+  reduce that to the CRC.  The constants are the bit-reflected x^n mod P(x)
+  of the paper, for the gzip polynomial.  crc is pre- and post-conditioned
+  (inverted) by the caller, len is a multiple of 16 and at least 64.
+ */
+__attribute__((target("sse4.1,pclmul")))
+local z_crc_t crc32_pclmul(crc, buf, len)
+    z_crc_t crc;
+    const unsigned char FAR *buf;
+    uInt len;
+{
+    static const uint64_t __attribute__((aligned(16))) k1k2[] =
+        { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t __attribute__((aligned(16))) k3k4[] =
+        { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t __attribute__((aligned(16))) k5k0[] =
+        { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t __attribute__((aligned(16))) poly[] =
+        { 0x01db710641, 0x01f7011641 };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(const void *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(const void *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(const void *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(const void *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_load_si128((const __m128i *)(const void *)k1k2);
+    buf += 64;
+    len -= 64;
+
+    /* Four lanes in parallel */
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i *)(const void *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(const void *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(const void *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(const void *)(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        len -= 64;
+    }
+
+    /* Four lanes into one */
+    x0 = _mm_load_si128((const __m128i *)(const void *)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* The remaining 16 byte blocks */
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)(const void *)buf);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    /* 128 bits to 64 */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i *)(const void *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((const __m128i *)(const void *)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (z_crc_t)_mm_extract_epi32(x1, 1);
+}
+
+#endif /* CRC32_PCLMUL */
+
+#ifdef CRC32_ARMV8
+
+/* ========================================================================= */
+/* crc is pre- and post-conditioned (inverted) by the caller */
+__attribute__((target("+crc")))
+local z_crc_t crc32_armv8(crc, buf, len)
+    z_crc_t crc;
+    const unsigned char FAR *buf;
+    uInt len;
+{
+    uint64_t u8;
+    uint32_t u4;
+
+    while (len && ((ptrdiff_t)buf & 7)) {
+        crc = __crc32b(crc, *buf++);
+        len--;
+    }
+    while (len >= 8) {
+        zmemcpy(&u8, buf, 8);
+        crc = __crc32d(crc, u8);
+        buf += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        zmemcpy(&u4, buf, 4);
+        crc = __crc32w(crc, u4);
+        buf += 4;
+        len -= 4;
+    }
+    while (len--)
+        crc = __crc32b(crc, *buf++);
+    return crc;
+}
+
+#endif /* CRC32_ARMV8 */
+
 /* ========================================================================= */
 local unsigned long gf2_matrix_times(mat, vec)
     unsigned long *mat;
@@ -51,6 +51,14 @@
 
 #include "deflate.h"
 
+/* Compare matches eight bytes at a time, where loads can be unaligned */
+#if !defined(NO_MATCH64) && defined(__GNUC__) && \
+    defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#  define MATCH64
+#  include <stdint.h>
+#endif
+
 extern const char deflate_copyright[];
 const char deflate_copyright[] =
    " deflate 1.2.8 Copyright 1995-2013 Jean-loup Gailly and Mark Adler ";
@@ -1176,7 +1184,9 @@ local uInt longest_match(s, cur_match)
     register ush scan_start = *(ushf*)scan;
     register ush scan_end   = *(ushf*)(scan+best_len-1);
 #else
+#ifndef MATCH64
     register Bytef *strend = s->window + s->strstart + MAX_MATCH;
+#endif
     register Byte scan_end1  = scan[best_len-1];
     register Byte scan_end   = scan[best_len];
 #endif
@@ -1258,6 +1268,27 @@ local uInt longest_match(s, cur_match)
         scan += 2, match++;
         Assert(*scan == *match, "match[2]?");
 
+#ifdef MATCH64
+        /* Same as below, strstart+3 to strstart+258 in 32 words: the
+         * first differing byte is the lowest non-zero byte of the xor.
+         */
+        len = 3;
+        do {
+            uint64_t sw, mw;
+
+            zmemcpy(&sw, scan + len - 2, sizeof sw);
+            zmemcpy(&mw, match + len - 2, sizeof mw);
+            if (sw != mw) {
+                len += __builtin_ctzll(sw ^ mw) >> 3;
+                break;
+            }
+            len += sizeof sw;
+        } while (len < MAX_MATCH);
+        if (len > MAX_MATCH)
+            len = MAX_MATCH;
+        scan -= 2;
+#else /* MATCH64 */
+
         /* We check for insufficient lookahead only every 8th comparison;
          * the 256th check will be made at strstart+258.
          */
@@ -1272,6 +1303,7 @@ local uInt longest_match(s, cur_match)
 
         len = MAX_MATCH - (int)(strend - scan);
         scan = strend - MAX_MATCH;
+#endif /* MATCH64 */
 
 #endif /* UNALIGNED_OK */
 
@@ -29,6 +29,37 @@
 #  define PUP(a) *++(a)
 #endif
 
+/* Matches at least this long are copied with memcpy() rather than bytewise */
+#define CHUNK_MIN 16
+
+local unsigned char FAR *chunk_copy OF((unsigned char FAR *out,
+                        unsigned dist, unsigned len));
+
+/*
+   Copy len bytes from dist bytes back in the output, out and the result are
+   in the PUP() sense.  Each memcpy() doubles the distance between source and
+   destination, so the copy never overlaps and never writes past out + len.
+ */
+local unsigned char FAR *chunk_copy(out, dist, len)
+unsigned char FAR *out;
+unsigned dist;
+unsigned len;
+{
+    unsigned char FAR *w = out + OFF;
+    unsigned char FAR *s = w - dist;
+    unsigned n;
+
+    while (len) {
+        n = (unsigned)(w - s);
+        if (n > len)
+            n = len;
+        zmemcpy(w, s, n);
+        w += n;
+        len -= n;
+    }
+    return w - OFF;
+}
+
 /*
    Decode literal, length, and distance codes and write out the resulting
    literal and match bytes until either not enough input or output is
@@ -218,9 +249,8 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                         from += wsize - op;
                         if (op < len) {         /* some from window */
                             len -= op;
-                            do {
-                                PUP(out) = PUP(from);
-                            } while (--op);
+                            zmemcpy(out + OFF, from + OFF, op);
+                            out += op;
                             from = out - dist;  /* rest from output */
                         }
                     }
@@ -229,16 +259,14 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                         op -= wnext;
                         if (op < len) {         /* some from end of window */
                             len -= op;
-                            do {
-                                PUP(out) = PUP(from);
-                            } while (--op);
+                            zmemcpy(out + OFF, from + OFF, op);
+                            out += op;
                             from = window - OFF;
                             if (wnext < len) {  /* some from start of window */
                                 op = wnext;
                                 len -= op;
-                                do {
-                                    PUP(out) = PUP(from);
-                                } while (--op);
+                                zmemcpy(out + OFF, from + OFF, op);
+                                out += op;
                                 from = out - dist;      /* rest from output */
                             }
                         }
@@ -247,9 +275,8 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                         from += wnext - op;
                         if (op < len) {         /* some from window */
                             len -= op;
-                            do {
-                                PUP(out) = PUP(from);
-                            } while (--op);
+                            zmemcpy(out + OFF, from + OFF, op);
+                            out += op;
                             from = out - dist;  /* rest from output */
                         }
                     }
@@ -265,6 +292,9 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                             PUP(out) = PUP(from);
                     }
                 }
+                else if (len >= CHUNK_MIN) {
+                    out = chunk_copy(out, dist, len);
+                }
                 else {
                     from = out - dist;          /* copy direct from output */
                     do {                        /* minimum length is three */
@@ -544,3 +544,11 @@ vmod_test_probe(VRT_CTX, VCL_PROBE probe, VCL_PROBE same)
 	CHECK_OBJ_ORNULL(same, VRT_BACKEND_PROBE_MAGIC);
 	AZ(same == NULL || probe == same);
 }
+
+VCL_STRING
+vmod_concatenate(VRT_CTX, VCL_STRANDS s)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	return (VRT_CollectStrands(ctx, s));
+}
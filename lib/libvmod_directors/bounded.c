@@ -0,0 +1,209 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Consistent hashing with bounded loads.
+ *
+ * Backends are ranked by rendezvous hashing of the object digest, and the
+ * first healthy one with fewer than load_factor times the average number
+ * of fetches in flight gets the job.
+ *
+ * The fetches in flight are counted by vdir_add_tracked().
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "cache/cache.h"
+#include "cache/cache_director.h"
+
+#include "vbm.h"
+#include "vend.h"
+#include "vrt.h"
+
+#include "vdir.h"
+
+#include "vcc_if.h"
+
+struct vmod_directors_bounded {
+	unsigned				magic;
+#define VMOD_DIRECTORS_BOUNDED_MAGIC		0x2a9d41c5
+	struct vdir				*vd;
+	VCL_REAL				load_factor;
+};
+
+static unsigned __match_proto__(vdi_healthy_f)
+vmod_bounded_healthy(const struct director *dir, const struct busyobj *bo,
+    double *changed)
+{
+	struct vmod_directors_bounded *bd;
+
+	CAST_OBJ_NOTNULL(bd, dir->priv, VMOD_DIRECTORS_BOUNDED_MAGIC);
+	return (vdir_any_healthy(bd->vd, bo, changed));
+}
+
+/*
+ * Walk the backends in the order of their score for this key, and take
+ * the first healthy one below the cap.  Called with the vdir locked, so
+ * n cannot change under us.
+ */
+
+static VCL_BACKEND
+vmod_bounded_pick(const struct vmod_directors_bounded *bd,
+    struct busyobj *bo, uint32_t key, unsigned n)
+{
+	struct vdir_track *vt, *first = NULL;
+	unsigned u, total = 0, cap, best, tries;
+	uint32_t s, best_s;
+	size_t tried_sz = VBITMAP_SZ(n);
+	char tried_spc[tried_sz];
+	struct vbitmap *tried;
+
+	tried = vbit_init(tried_spc, tried_sz);
+	AN(tried);
+
+	for (u = 0; u < n; u++) {
+		vt = vdir_track(bd->vd->backend[u]);
+		total += vt->inflight;
+	}
+	cap = (unsigned)ceil(bd->load_factor * (total + 1) / n);
+
+	for (tries = 0; tries < n; tries++) {
+		best = n;
+		best_s = 0;
+		for (u = 0; u < n; u++) {
+			if (vbit_test(tried, u))
+				continue;
+			vt = vdir_track(bd->vd->backend[u]);
+			s = vdir_score(key, vt->hash);
+			if (best == n || s > best_s) {
+				best = u;
+				best_s = s;
+			}
+		}
+		assert(best < n);
+		vbit_set(tried, best);
+		vt = vdir_track(bd->vd->backend[best]);
+		if (!vt->dir->healthy(vt->dir, bo, NULL))
+			continue;
+		if (vt->inflight < cap)
+			return (vt->dir);
+		if (first == NULL)
+			first = vt;
+	}
+	/* Everybody healthy is busy, stay with the first choice */
+	if (first != NULL)
+		return (first->dir);
+	return (NULL);
+}
+
+static const struct director * __match_proto__(vdi_resolve_f)
+vmod_bounded_resolve(const struct director *dir, struct worker *wrk,
+    struct busyobj *bo)
+{
+	struct vmod_directors_bounded *bd;
+	VCL_BACKEND be = NULL;
+
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CAST_OBJ_NOTNULL(bd, dir->priv, VMOD_DIRECTORS_BOUNDED_MAGIC);
+
+	vdir_rdlock(bd->vd);
+	if (bd->vd->n_backend > 0)
+		be = vmod_bounded_pick(bd, bo, vbe32dec(bo->digest),
+		    bd->vd->n_backend);
+	vdir_unlock(bd->vd);
+	return (be);
+}
+
+VCL_VOID __match_proto__()
+vmod_bounded__init(VRT_CTX, struct vmod_directors_bounded **bdp,
+    const char *vcl_name, VCL_REAL load_factor)
+{
+	struct vmod_directors_bounded *bd;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(bdp);
+	AZ(*bdp);
+	ALLOC_OBJ(bd, VMOD_DIRECTORS_BOUNDED_MAGIC);
+	AN(bd);
+	*bdp = bd;
+	if (load_factor < 1.0) {
+		VRT_fail(ctx, "%s: load_factor must be at least 1.0",
+		    vcl_name);
+		load_factor = 1.0;
+	}
+	bd->load_factor = load_factor;
+	vdir_new(&bd->vd, "bounded", vcl_name, vmod_bounded_healthy,
+	    vmod_bounded_resolve, bd);
+}
+
+VCL_VOID __match_proto__()
+vmod_bounded__fini(struct vmod_directors_bounded **bdp)
+{
+	struct vmod_directors_bounded *bd;
+
+	bd = *bdp;
+	*bdp = NULL;
+	CHECK_OBJ_NOTNULL(bd, VMOD_DIRECTORS_BOUNDED_MAGIC);
+	vdir_delete(&bd->vd);
+	FREE_OBJ(bd);
+}
+
+VCL_VOID __match_proto__()
+vmod_bounded_add_backend(VRT_CTX,
+    struct vmod_directors_bounded *bd, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(bd, VMOD_DIRECTORS_BOUNDED_MAGIC);
+	CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+	if (be->resolve != NULL) {
+		VRT_fail(ctx, "%s: %s is a director, not a backend",
+		    bd->vd->dir->vcl_name, be->vcl_name);
+		return;
+	}
+	vdir_add_tracked(bd->vd, be, 1.0);
+}
+
+VCL_VOID __match_proto__()
+vmod_bounded_remove_backend(VRT_CTX,
+    struct vmod_directors_bounded *bd, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(bd, VMOD_DIRECTORS_BOUNDED_MAGIC);
+	vdir_remove_tracked(bd->vd, be);
+}
+
+VCL_BACKEND __match_proto__()
+vmod_bounded_backend(VRT_CTX, struct vmod_directors_bounded *bd)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(bd, VMOD_DIRECTORS_BOUNDED_MAGIC);
+	return (bd->vd->dir);
+}
@@ -34,6 +34,7 @@
 #include "cache/cache_director.h"
 
 #include "vrt.h"
+#include "vbm.h"
 #include "vcc_if.h"
 
 #include "vdir.h"
@@ -61,7 +62,7 @@ vmod_fallback_resolve(const struct director *dir, struct worker *wrk,
     struct busyobj *bo)
 {
 	struct vmod_directors_fallback *fb;
-	unsigned u;
+	unsigned u, n, cur = 0;
 	VCL_BACKEND be = NULL;
 
 	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
@@ -69,20 +70,27 @@ vmod_fallback_resolve(const struct director *dir, struct worker *wrk,
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	CAST_OBJ_NOTNULL(fb, dir->priv, VMOD_DIRECTORS_FALLBACK_MAGIC);
 
-	vdir_wrlock(fb->vd);
-	if (!fb->st)
-		fb->cur = 0;
-	for (u = 0; u < fb->vd->n_backend; u++) {
-		be = fb->vd->backend[fb->cur];
+	/* We may only hold the read lock, so walk a local index */
+	vdir_lock_healthy(fb->vd, bo);
+	n = fb->vd->n_backend;
+	if (fb->st && fb->cur < n)
+		cur = fb->cur;
+	for (u = 0; u < n; u++) {
+		be = fb->vd->backend[cur];
 		CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
-		if (be->healthy(be, bo, NULL))
+		if (!vbit_test(fb->vd->vbm, cur))
 			break;
-		if (++fb->cur == fb->vd->n_backend)
-			fb->cur = 0;
+		if (++cur == n)
+			cur = 0;
 	}
 	vdir_unlock(fb->vd);
-	if (u == fb->vd->n_backend)
-		be = NULL;
+	if (u == n)
+		return (NULL);
+	if (fb->st && u > 0) {
+		vdir_wrlock(fb->vd);
+		fb->cur = cur;
+		vdir_unlock(fb->vd);
+	}
 	return (be);
 }
 
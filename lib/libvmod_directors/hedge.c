@@ -0,0 +1,196 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Round-robin over backends, sending slow fetches to the next healthy
+ * backend as well, see vbe_dir_hedge().
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache/cache.h"
+#include "cache/cache_director.h"
+
+#include "vbm.h"
+#include "vrt.h"
+
+#include "vdir.h"
+
+#include "vcc_if.h"
+
+struct vmod_directors_hedge {
+	unsigned				magic;
+#define VMOD_DIRECTORS_HEDGE_MAGIC		0x0c6f3a9d
+	struct vdir				*vd;
+	unsigned				nxt;
+	double					delay;
+};
+
+static unsigned __match_proto__(vdi_healthy_f)
+vmod_hedge_healthy(const struct director *dir, const struct busyobj *bo,
+    double *changed)
+{
+	struct vmod_directors_hedge *hd;
+
+	CAST_OBJ_NOTNULL(hd, dir->priv, VMOD_DIRECTORS_HEDGE_MAGIC);
+	return (vdir_any_healthy(hd->vd, bo, changed));
+}
+
+/* The next healthy backend, and the one after that as the hedge */
+
+static VCL_BACKEND
+vmod_hedge_pick(struct vmod_directors_hedge *hd, const struct busyobj *bo,
+    VCL_BACKEND *alt)
+{
+	VCL_BACKEND be = NULL;
+	unsigned u, n, nxt, start, first = 0;
+
+	*alt = NULL;
+	vdir_lock_healthy(hd->vd, bo);
+	n = hd->vd->n_backend;
+	start = hd->nxt;
+	for (u = 0; u < n; u++) {
+		nxt = (start + u) % n;
+		if (vbit_test(hd->vd->vbm, nxt))
+			continue;
+		if (be == NULL) {
+			be = hd->vd->backend[nxt];
+			first = nxt;
+		} else {
+			*alt = hd->vd->backend[nxt];
+			break;
+		}
+	}
+	if (be != NULL)
+		hd->nxt = first + 1;
+	vdir_unlock(hd->vd);
+	return (be);
+}
+
+static int __match_proto__(vdi_gethdrs_f)
+vmod_hedge_gethdrs(const struct director *dir, struct worker *wrk,
+    struct busyobj *bo)
+{
+	struct vmod_directors_hedge *hd;
+	VCL_BACKEND be, alt;
+
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CAST_OBJ_NOTNULL(hd, dir->priv, VMOD_DIRECTORS_HEDGE_MAGIC);
+
+	be = vmod_hedge_pick(hd, bo, &alt);
+	if (be == NULL) {
+		VSLb(bo->vsl, SLT_FetchError,
+		    "Director %s returned no backend", dir->vcl_name);
+		return (-1);
+	}
+	CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+	bo->director_resp = be;
+	bo->hedge = alt;
+	bo->hedge_delay = hd->delay;
+	return (be->gethdrs(be, wrk, bo));
+}
+
+static enum sess_close __match_proto__(vdi_http1pipe_f)
+vmod_hedge_http1pipe(const struct director *dir, struct req *req,
+    struct busyobj *bo)
+{
+	struct vmod_directors_hedge *hd;
+	VCL_BACKEND be, alt;
+
+	CAST_OBJ_NOTNULL(hd, dir->priv, VMOD_DIRECTORS_HEDGE_MAGIC);
+	be = vmod_hedge_pick(hd, bo, &alt);
+	if (be == NULL || be->http1pipe == NULL) {
+		VSLb(bo->vsl, SLT_VCL_Error, "Backend does not support pipe");
+		return (SC_TX_ERROR);
+	}
+	return (be->http1pipe(be, req, bo));
+}
+
+VCL_VOID __match_proto__()
+vmod_hedge__init(VRT_CTX, struct vmod_directors_hedge **hdp,
+    const char *vcl_name, VCL_DURATION delay)
+{
+	struct vmod_directors_hedge *hd;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(hdp);
+	AZ(*hdp);
+	ALLOC_OBJ(hd, VMOD_DIRECTORS_HEDGE_MAGIC);
+	AN(hd);
+	*hdp = hd;
+	hd->delay = delay;
+	vdir_new(&hd->vd, "hedge", vcl_name, vmod_hedge_healthy, NULL, hd);
+	hd->vd->dir->gethdrs = vmod_hedge_gethdrs;
+	hd->vd->dir->http1pipe = vmod_hedge_http1pipe;
+}
+
+VCL_VOID __match_proto__()
+vmod_hedge__fini(struct vmod_directors_hedge **hdp)
+{
+	struct vmod_directors_hedge *hd;
+
+	hd = *hdp;
+	*hdp = NULL;
+	CHECK_OBJ_NOTNULL(hd, VMOD_DIRECTORS_HEDGE_MAGIC);
+	vdir_delete(&hd->vd);
+	FREE_OBJ(hd);
+}
+
+VCL_VOID __match_proto__()
+vmod_hedge_add_backend(VRT_CTX,
+    struct vmod_directors_hedge *hd, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(hd, VMOD_DIRECTORS_HEDGE_MAGIC);
+	CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+	if (be->resolve != NULL) {
+		VRT_fail(ctx, "%s: %s is a director, not a backend",
+		    hd->vd->dir->vcl_name, be->vcl_name);
+		return;
+	}
+	(void)vdir_add_backend(hd->vd, be, 1.0);
+}
+
+VCL_VOID __match_proto__()
+vmod_hedge_remove_backend(VRT_CTX,
+    struct vmod_directors_hedge *hd, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(hd, VMOD_DIRECTORS_HEDGE_MAGIC);
+	vdir_remove_backend(hd->vd, be, &hd->nxt);
+}
+
+VCL_BACKEND __match_proto__()
+vmod_hedge_backend(VRT_CTX, struct vmod_directors_hedge *hd)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(hd, VMOD_DIRECTORS_HEDGE_MAGIC);
+	return (hd->vd->dir);
+}
@@ -0,0 +1,192 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Least loaded backend, by fetches in flight or by time to first byte.
+ *
+ * Rather than looking at all backends, we draw two at random and take
+ * the better one ("power of two choices"), which is about as good and
+ * does not depend on the number of backends.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache/cache.h"
+#include "cache/cache_director.h"
+
+#include "vrnd.h"
+#include "vrt.h"
+
+#include "vdir.h"
+
+#include "vcc_if.h"
+
+struct vmod_directors_least {
+	unsigned				magic;
+#define VMOD_DIRECTORS_LEAST_MAGIC		0x7c1b90e4
+	struct vdir				*vd;
+	unsigned				by_ttfb;
+};
+
+/*
+ * Lower is better.  Backends without a measurement yet score zero, so
+ * they get tried.
+ */
+static double
+least_score(const struct vmod_directors_least *ld, const struct vdir_track *vt)
+{
+
+	if (ld->by_ttfb)
+		return (vt->ttfb * (vt->inflight + 1));
+	return (vt->inflight);
+}
+
+static unsigned __match_proto__(vdi_healthy_f)
+vmod_least_healthy(const struct director *dir, const struct busyobj *bo,
+    double *changed)
+{
+	struct vmod_directors_least *ld;
+
+	CAST_OBJ_NOTNULL(ld, dir->priv, VMOD_DIRECTORS_LEAST_MAGIC);
+	return (vdir_any_healthy(ld->vd, bo, changed));
+}
+
+static const struct director * __match_proto__(vdi_resolve_f)
+vmod_least_resolve(const struct director *dir, struct worker *wrk,
+    struct busyobj *bo)
+{
+	struct vmod_directors_least *ld;
+	struct vdir_track *vt, *pick[2] = { NULL, NULL };
+	VCL_BACKEND be = NULL;
+	unsigned n, u, v;
+	double s, best = 0.0;
+
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CAST_OBJ_NOTNULL(ld, dir->priv, VMOD_DIRECTORS_LEAST_MAGIC);
+
+	vdir_rdlock(ld->vd);
+	n = ld->vd->n_backend;
+	if (n == 0) {
+		vdir_unlock(ld->vd);
+		return (NULL);
+	}
+
+	u = VRND_RandomTestable() % n;
+	v = n > 1 ? (u + 1 + VRND_RandomTestable() % (n - 1)) % n : u;
+	vt = vdir_track(ld->vd->backend[u]);
+	if (vt->dir->healthy(vt->dir, bo, NULL))
+		pick[0] = vt;
+	vt = vdir_track(ld->vd->backend[v]);
+	if (v != u && vt->dir->healthy(vt->dir, bo, NULL))
+		pick[1] = vt;
+
+	if (pick[0] == NULL && pick[1] == NULL) {
+		/* Unlucky draw, look at them all */
+		for (u = 0; u < n; u++) {
+			vt = vdir_track(ld->vd->backend[u]);
+			if (!vt->dir->healthy(vt->dir, bo, NULL))
+				continue;
+			s = least_score(ld, vt);
+			if (pick[0] == NULL || s < best) {
+				pick[0] = vt;
+				best = s;
+			}
+		}
+	} else if (pick[0] == NULL ||
+	    (pick[1] != NULL && least_score(ld, pick[1]) <
+	     least_score(ld, pick[0]))) {
+		pick[0] = pick[1];
+	}
+	if (pick[0] != NULL)
+		be = pick[0]->dir;
+	vdir_unlock(ld->vd);
+	return (be);
+}
+
+VCL_VOID __match_proto__()
+vmod_least__init(VRT_CTX, struct vmod_directors_least **ldp,
+    const char *vcl_name, VCL_ENUM by)
+{
+	struct vmod_directors_least *ld;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(ldp);
+	AZ(*ldp);
+	ALLOC_OBJ(ld, VMOD_DIRECTORS_LEAST_MAGIC);
+	AN(ld);
+	*ldp = ld;
+	ld->by_ttfb = !strcmp(by, "TTFB");
+	vdir_new(&ld->vd, "least", vcl_name, vmod_least_healthy,
+	    vmod_least_resolve, ld);
+}
+
+VCL_VOID __match_proto__()
+vmod_least__fini(struct vmod_directors_least **ldp)
+{
+	struct vmod_directors_least *ld;
+
+	ld = *ldp;
+	*ldp = NULL;
+	CHECK_OBJ_NOTNULL(ld, VMOD_DIRECTORS_LEAST_MAGIC);
+	vdir_delete(&ld->vd);
+	FREE_OBJ(ld);
+}
+
+VCL_VOID __match_proto__()
+vmod_least_add_backend(VRT_CTX,
+    struct vmod_directors_least *ld, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ld, VMOD_DIRECTORS_LEAST_MAGIC);
+	CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+	if (be->resolve != NULL) {
+		VRT_fail(ctx, "%s: %s is a director, not a backend",
+		    ld->vd->dir->vcl_name, be->vcl_name);
+		return;
+	}
+	vdir_add_tracked(ld->vd, be, 1.0);
+}
+
+VCL_VOID __match_proto__()
+vmod_least_remove_backend(VRT_CTX,
+    struct vmod_directors_least *ld, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ld, VMOD_DIRECTORS_LEAST_MAGIC);
+	vdir_remove_tracked(ld->vd, be);
+}
+
+VCL_BACKEND __match_proto__()
+vmod_least_backend(VRT_CTX, struct vmod_directors_least *ld)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ld, VMOD_DIRECTORS_LEAST_MAGIC);
+	return (ld->vd->dir);
+}
@@ -0,0 +1,246 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Peering between the caches of a cluster.
+ *
+ * The peers, one of which is ourselves, are ranked by rendezvous hashing
+ * of the object digest, the same way on every node, and the first
+ * healthy one owns the object.  A fetch for an object owned by another
+ * peer goes there first, marked with a header so that the owner goes to
+ * the origin itself.  Concurrent requests for the object are coalesced
+ * on the owner like any other, so the origin sees a single fetch for
+ * the whole cluster.
+ *
+ * If the owner does not answer within the first_byte_timeout of its
+ * backend, the fetch falls back to the origin.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache.h"
+#include "cache/cache_director.h"
+
+#include "vend.h"
+#include "vrt.h"
+
+#include "vdir.h"
+
+#include "vcc_if.h"
+
+struct vmod_directors_peer {
+	unsigned				magic;
+#define VMOD_DIRECTORS_PEER_MAGIC		0x51c7e0a3
+	struct vdir				*vd;
+	VCL_BACKEND				origin;
+	VCL_BACKEND				self;
+	char					*hdr;	// http_GetHdr() style
+};
+
+static unsigned __match_proto__(vdi_healthy_f)
+vmod_peer_healthy(const struct director *dir, const struct busyobj *bo,
+    double *changed)
+{
+	struct vmod_directors_peer *pd;
+
+	CAST_OBJ_NOTNULL(pd, dir->priv, VMOD_DIRECTORS_PEER_MAGIC);
+	return (pd->origin->healthy(pd->origin, bo, changed));
+}
+
+/* The healthy peer owning the object, NULL if that is ourselves */
+
+static VCL_BACKEND
+vmod_peer_owner(struct vmod_directors_peer *pd, const struct busyobj *bo)
+{
+	struct vdir_track *vt, *best;
+	unsigned u, n;
+	uint32_t key, s, best_s = 0;
+
+	key = vbe32dec(bo->digest);
+	vdir_rdlock(pd->vd);
+	n = pd->vd->n_backend;
+	best = NULL;
+	for (u = 0; u < n; u++) {
+		vt = vdir_track(pd->vd->backend[u]);
+		if (vt->be != pd->self && !vt->be->healthy(vt->be, bo, NULL))
+			continue;
+		s = vdir_score(key, vt->hash);
+		if (best == NULL || s > best_s) {
+			best = vt;
+			best_s = s;
+		}
+	}
+	vdir_unlock(pd->vd);
+	if (best == NULL || best->be == pd->self)
+		return (NULL);
+	return (best->dir);
+}
+
+static int __match_proto__(vdi_gethdrs_f)
+vmod_peer_gethdrs(const struct director *dir, struct worker *wrk,
+    struct busyobj *bo)
+{
+	struct vmod_directors_peer *pd;
+	const struct director *d = NULL;
+	const char *m;
+	int had_host;
+
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CAST_OBJ_NOTNULL(pd, dir->priv, VMOD_DIRECTORS_PEER_MAGIC);
+
+	/* Passes, peer requests and the like go to the origin */
+	m = http_GetMethod(bo->bereq);
+	if (!bo->do_pass && !http_GetHdr(bo->bereq, pd->hdr, NULL) &&
+	    (!strcmp(m, "GET") || !strcmp(m, "HEAD")))
+		d = vmod_peer_owner(pd, bo);
+
+	if (d != NULL) {
+		had_host = http_GetHdr(bo->bereq, H_Host, NULL);
+		http_PrintfHeader(bo->bereq, "%s 1", pd->hdr + 1);
+		bo->director_resp = d;
+		if (!d->gethdrs(d, wrk, bo))
+			return (0);
+		VSLb(bo->vsl, SLT_Debug, "Peer %s failed, going to %s",
+		    d->vcl_name, pd->origin->vcl_name);
+		http_Unset(bo->bereq, pd->hdr);
+		if (!had_host)
+			http_Unset(bo->bereq, H_Host);
+	}
+
+	for (d = pd->origin; d != NULL && d->resolve != NULL; )
+		d = d->resolve(d, wrk, bo);
+	if (d == NULL) {
+		VSLb(bo->vsl, SLT_FetchError,
+		    "Director %s returned no backend", pd->origin->vcl_name);
+		return (-1);
+	}
+	bo->director_resp = d;
+	return (d->gethdrs(d, wrk, bo));
+}
+
+static enum sess_close __match_proto__(vdi_http1pipe_f)
+vmod_peer_http1pipe(const struct director *dir, struct req *req,
+    struct busyobj *bo)
+{
+	struct vmod_directors_peer *pd;
+	const struct director *d;
+
+	CAST_OBJ_NOTNULL(pd, dir->priv, VMOD_DIRECTORS_PEER_MAGIC);
+	for (d = pd->origin; d != NULL && d->resolve != NULL; )
+		d = d->resolve(d, req->wrk, bo);
+	if (d == NULL || d->http1pipe == NULL) {
+		VSLb(bo->vsl, SLT_VCL_Error, "Backend does not support pipe");
+		return (SC_TX_ERROR);
+	}
+	return (d->http1pipe(d, req, bo));
+}
+
+VCL_VOID __match_proto__()
+vmod_peer__init(VRT_CTX, struct vmod_directors_peer **pdp,
+    const char *vcl_name, VCL_BACKEND origin, VCL_STRING header)
+{
+	struct vmod_directors_peer *pd;
+	size_t l;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(pdp);
+	AZ(*pdp);
+	ALLOC_OBJ(pd, VMOD_DIRECTORS_PEER_MAGIC);
+	AN(pd);
+	*pdp = pd;
+	CHECK_OBJ_NOTNULL(origin, DIRECTOR_MAGIC);
+	pd->origin = origin;
+	if (header == NULL || *header == '\0' || strchr(header, ':') ||
+	    strlen(header) > 126) {
+		VRT_fail(ctx, "%s: bad header name", vcl_name);
+		header = "X-Peer";
+	}
+	l = strlen(header);
+	pd->hdr = malloc(l + 3);
+	AN(pd->hdr);
+	pd->hdr[0] = (char)(l + 1);
+	memcpy(pd->hdr + 1, header, l);
+	strcpy(pd->hdr + 1 + l, ":");
+	vdir_new(&pd->vd, "peer", vcl_name, vmod_peer_healthy, NULL, pd);
+	pd->vd->dir->gethdrs = vmod_peer_gethdrs;
+	pd->vd->dir->http1pipe = vmod_peer_http1pipe;
+}
+
+VCL_VOID __match_proto__()
+vmod_peer__fini(struct vmod_directors_peer **pdp)
+{
+	struct vmod_directors_peer *pd;
+
+	pd = *pdp;
+	*pdp = NULL;
+	CHECK_OBJ_NOTNULL(pd, VMOD_DIRECTORS_PEER_MAGIC);
+	vdir_delete(&pd->vd);
+	free(pd->hdr);
+	FREE_OBJ(pd);
+}
+
+VCL_VOID __match_proto__()
+vmod_peer_add_backend(VRT_CTX,
+    struct vmod_directors_peer *pd, VCL_BACKEND be, VCL_BOOL self)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(pd, VMOD_DIRECTORS_PEER_MAGIC);
+	CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+	if (be->resolve != NULL) {
+		VRT_fail(ctx, "%s: %s is a director, not a backend",
+		    pd->vd->dir->vcl_name, be->vcl_name);
+		return;
+	}
+	vdir_add_tracked(pd->vd, be, 1.0);
+	if (self)
+		pd->self = be;
+	else if (pd->self == be)
+		pd->self = NULL;
+}
+
+VCL_VOID __match_proto__()
+vmod_peer_remove_backend(VRT_CTX,
+    struct vmod_directors_peer *pd, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(pd, VMOD_DIRECTORS_PEER_MAGIC);
+	vdir_remove_tracked(pd->vd, be);
+	if (pd->self == be)
+		pd->self = NULL;
+}
+
+VCL_BACKEND __match_proto__()
+vmod_peer_backend(VRT_CTX, struct vmod_directors_peer *pd)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(pd, VMOD_DIRECTORS_PEER_MAGIC);
+	return (pd->vd->dir);
+}
@@ -34,6 +34,7 @@
 #include "cache/cache_director.h"
 
 #include "vrt.h"
+#include "vbm.h"
 #include "vcc_if.h"
 
 #include "vdir.h"
@@ -68,13 +69,13 @@ vmod_rr_resolve(const struct director *dir, struct worker *wrk,
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	CAST_OBJ_NOTNULL(rr, dir->priv, VMOD_DIRECTORS_ROUND_ROBIN_MAGIC);
-	vdir_rdlock(rr->vd);
+	vdir_lock_healthy(rr->vd, bo);
 	for (u = 0; u < rr->vd->n_backend; u++) {
 		nxt = rr->nxt %= rr->vd->n_backend;
 		be = rr->vd->backend[nxt];
 		rr->nxt++;
 		CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
-		if (be->healthy(be, bo, NULL))
+		if (!vbit_test(rr->vd->vbm, nxt))
 			break;
 	}
 	vdir_unlock(rr->vd);
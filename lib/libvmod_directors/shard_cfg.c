@@ -224,19 +224,82 @@ shardcfg_clear(VRT_CTX, struct vmod_priv *priv, const struct sharddir *shardd)
 
 typedef int (*compar)( const void*, const void* );
 
+static int shardcfg_backend_cmp(const struct shard_backend *,
+    const struct shard_backend *);
+
 static int
 circlepoint_compare(const struct shard_circlepoint *a,
     const struct shard_circlepoint *b)
 {
-	return (a->point == b->point) ? 0 : ((a->point > b->point) ? 1 : -1);
+	if (a->point != b->point)
+		return ((a->point > b->point) ? 1 : -1);
+	return (a->host == b->host) ? 0 : ((a->host > b->host) ? 1 : -1);
+}
+
+/*
+ * Split the key space in about as many buckets as there are points on the
+ * circle, each pointing to the first point at or after its lowest key.
+ * Past the last point, we stick to it like the binary search used to.
+ */
+#define SHARD_BUCKET_BITS_MAX	20
+
+static void
+shardcfg_hashbucket(struct sharddir *shardd)
+{
+	unsigned b, bits, i, n;
+	uint32_t lo;
+
+	AZ(shardd->hashbucket);
+	n = shardd->n_backend * shardd->replicas;
+	assert(n > 0);
+	for (bits = 1; bits < SHARD_BUCKET_BITS_MAX && (1U << bits) < n; bits++)
+		continue;
+	shardd->hashbucket_shift = 32 - bits;
+	shardd->hashbucket = calloc(1U << bits, sizeof *shardd->hashbucket);
+	AN(shardd->hashbucket);
+
+	for (b = 0, i = 0; b < (1U << bits); b++) {
+		lo = (uint32_t)b << shardd->hashbucket_shift;
+		while (i < n - 1 && shardd->hashcircle[i].point < lo)
+			i++;
+		shardd->hashbucket[b] = i;
+	}
 }
 
+/* the replicas points of one backend, the first is its canon_point */
 static void
-shardcfg_hashcircle(struct sharddir *shardd, VCL_INT replicas, enum alg_e alg)
+shardcfg_backend_points(struct sharddir *shardd, unsigned host,
+    struct shard_circlepoint *cp)
 {
-	int i, j;
+	struct shard_backend *b;
 	const char *ident;
-	int len;
+	int j, len;
+
+	assert(host < shardd->n_backend);
+	b = &shardd->backend[host];
+	CHECK_OBJ_NOTNULL(b->backend, DIRECTOR_MAGIC);
+
+	ident = b->ident ? b->ident : b->backend->vcl_name;
+
+	assert(ident[0] != '\0');
+
+	len = strlen(ident) + 12; // log10(UINT32_MAX) + 2;
+
+	char s[len];
+
+	for (j = 0; j < shardd->replicas; j++) {
+		assert(snprintf(s, len, "%s%d", ident, j) < len);
+		cp[j].point = shard_hash_f[shardd->alg](s);
+		cp[j].host = host;
+	}
+	/* not used in current interface */
+	b->canon_point = cp[0].point;
+}
+
+static void
+shardcfg_hashcircle(struct sharddir *shardd)
+{
+	unsigned i;
 
 	CHECK_OBJ_NOTNULL(shardd, SHARDDIR_MAGIC);
 	AZ(shardd->hashcircle);
@@ -244,49 +307,128 @@ shardcfg_hashcircle(struct sharddir *shardd, VCL_INT replicas, enum alg_e alg)
 	assert(shardd->n_backend > 0);
 	AN(shardd->backend);
 
-	shardd->hashcircle = calloc(shardd->n_backend * replicas,
+	shardd->hashcircle = calloc(shardd->n_backend * shardd->replicas,
 		sizeof(struct shard_circlepoint));
 	AN(shardd->hashcircle);
 
-	shardd->replicas = replicas;
-
-	for (i = 0; i < shardd->n_backend; i++) {
-		CHECK_OBJ_NOTNULL(shardd->backend[i].backend, DIRECTOR_MAGIC);
+	for (i = 0; i < shardd->n_backend; i++)
+		shardcfg_backend_points(shardd, i,
+		    &shardd->hashcircle[i * shardd->replicas]);
+	qsort( (void *) shardd->hashcircle,
+	    shardd->n_backend * shardd->replicas,
+	    sizeof (struct shard_circlepoint), (compar) circlepoint_compare);
+}
 
-		ident = shardd->backend[i].ident
-		    ? shardd->backend[i].ident
-		    : shardd->backend[i].backend->vcl_name;
+/*
+ * Derive the circle from the one of the previous configuration with the
+ * same replicas and alg: the points of the backends which stayed are
+ * taken over in order with their new host index, and merged with the
+ * sorted points of the backends which were added.  Only the added
+ * backends are hashed and sorted.
+ */
 
-		assert(ident[0] != '\0');
+static void
+shardcfg_hashcircle_diff(struct sharddir *shardd, const struct sharddir *old)
+{
+	struct shard_circlepoint *add, *hc, cp;
+	unsigned *map;		// old host -> new host + 1, 0: removed
+	unsigned i, j, k, n_add, n_old, n;
+	const unsigned r = shardd->replicas;
 
-		len = strlen(ident) + 12; // log10(UINT32_MAX) + 2;
+	CHECK_OBJ_NOTNULL(shardd, SHARDDIR_MAGIC);
+	CHECK_OBJ_NOTNULL(old, SHARDDIR_MAGIC);
+	AZ(shardd->hashcircle);
+	AN(old->hashcircle);
+	assert(old->replicas == r);
+	assert(old->alg == shardd->alg);
+	assert(shardd->n_backend > 0);
 
-		char s[len];
+	map = calloc(old->n_backend + 1, sizeof *map);
+	AN(map);
+	add = calloc(shardd->n_backend * r, sizeof *add);
+	AN(add);
 
-		for (j = 0; j < replicas; j++) {
-			assert(snprintf(s, len, "%s%d", ident, j) < len);
-			shardd->hashcircle[i * replicas + j].point =
-			    shard_hash_f[alg](s);
-			shardd->hashcircle[i * replicas + j].host = i;
+	n_add = 0;
+	for (i = 0; i < shardd->n_backend; i++) {
+		/* most backends keep their index */
+		j = i;
+		if (j >= old->n_backend || map[j] != 0 ||
+		    shardcfg_backend_cmp(&shardd->backend[i],
+		    &old->backend[j])) {
+			for (j = 0; j < old->n_backend; j++)
+				if (map[j] == 0 &&
+				    !shardcfg_backend_cmp(&shardd->backend[i],
+				    &old->backend[j]))
+					break;
 		}
-		/* not used in current interface */
-		shardd->backend[i].canon_point =
-		    shardd->hashcircle[i * replicas].point;
+		if (j < old->n_backend) {
+			map[j] = i + 1;
+			shardd->backend[i].canon_point =
+			    old->backend[j].canon_point;
+			continue;
+		}
+		shardcfg_backend_points(shardd, i, &add[n_add * r]);
+		n_add++;
 	}
-	qsort( (void *) shardd->hashcircle, shardd->n_backend * replicas,
-	    sizeof (struct shard_circlepoint), (compar) circlepoint_compare);
+	n_add *= r;
+	qsort(add, n_add, sizeof *add, (compar) circlepoint_compare);
+
+	n = shardd->n_backend * r;
+	hc = calloc(n, sizeof *hc);
+	AN(hc);
+
+	n_old = old->n_backend * r;
+	for (i = j = k = 0; k < n; k++) {
+		while (i < n_old && map[old->hashcircle[i].host] == 0)
+			i++;
+		if (i < n_old) {
+			cp.point = old->hashcircle[i].point;
+			cp.host = map[old->hashcircle[i].host] - 1;
+		}
+		if (i < n_old && (j == n_add ||
+		    circlepoint_compare(&cp, &add[j]) <= 0)) {
+			hc[k] = cp;
+			i++;
+		} else {
+			assert(j < n_add);
+			hc[k] = add[j++];
+		}
+	}
+	assert(j == n_add);
+
+	/*
+	 * New host numbers can reorder points which share a hash value,
+	 * so finish like qsort() would have with an insertion sort, which
+	 * only moves within such runs.
+	 */
+	for (k = 1; k < n; k++) {
+		cp = hc[k];
+		for (i = k; i > 0 && circlepoint_compare(&hc[i - 1], &cp) > 0;
+		    i--)
+			hc[i] = hc[i - 1];
+		hc[i] = cp;
+	}
+
+	free(map);
+	free(add);
+	shardd->hashcircle = hc;
+}
+
+static void
+shardcfg_hashcircle_debug(const struct sharddir *shardd)
+{
+	unsigned i;
 
 	if ((shardd->debug_flags & SHDBG_CIRCLE) == 0)
 		return;
 
-	for (i = 0; i < shardd->n_backend; i++)
-		for (j = 0; j < replicas; j++)
-			SHDBG(SHDBG_CIRCLE, shardd,
-			    "hashcircle[%5ld] = "
-			    "{point = %8x, host = %2u}\n",
-			    i * replicas + j,
-			    shardd->hashcircle[i * replicas + j].point,
-			    shardd->hashcircle[i * replicas + j].host);
+	for (i = 0; i < shardd->n_backend * shardd->replicas; i++)
+		SHDBG(SHDBG_CIRCLE, shardd,
+		    "hashcircle[%5u] = "
+		    "{point = %8x, host = %2u}\n",
+		    i,
+		    shardd->hashcircle[i].point,
+		    shardd->hashcircle[i].host);
 }
 
 /*
@@ -566,13 +708,57 @@ shardcfg_apply_change(VRT_CTX, struct sharddir *shardd,
 /*
  * ============================================================
  * top reconfiguration function
+ *
+ * The new configuration is built on a copy of the backends, outside the
+ * director lock, so lookups only wait for the pointers to be swapped.
+ * Reconfigurations are serialized by cfg_mtx.
  */
 
+static void
+shardcfg_copy(struct sharddir *dst, const struct sharddir *src)
+{
+	unsigned i;
+
+	CHECK_OBJ_NOTNULL(src, SHARDDIR_MAGIC);
+	INIT_OBJ(dst, SHARDDIR_MAGIC);
+	dst->name = src->name;
+	dst->debug_flags = src->debug_flags;
+	dst->l_backend = src->l_backend;
+	if (src->backend == NULL)
+		return;
+	dst->backend = malloc(dst->l_backend * sizeof *dst->backend);
+	AN(dst->backend);
+	for (i = 0; i < src->n_backend; i++) {
+		shardcfg_backend_copyin(&dst->backend[i], &src->backend[i]);
+		dst->backend[i].canon_point = src->backend[i].canon_point;
+	}
+	dst->n_backend = src->n_backend;
+}
+
+static void
+shardcfg_swap(struct sharddir *a, struct sharddir *b)
+{
+	struct sharddir t;
+
+#define SWAP(f)	do { t.f = a->f; a->f = b->f; b->f = t.f; } while (0)
+	SWAP(n_backend);
+	SWAP(l_backend);
+	SWAP(backend);
+	SWAP(hashcircle);
+	SWAP(hashbucket);
+	SWAP(hashbucket_shift);
+	SWAP(replicas);
+	SWAP(alg);
+#undef SWAP
+}
+
 VCL_BOOL
 shardcfg_reconfigure(VRT_CTX, struct vmod_priv *priv,
     struct sharddir *shardd, VCL_INT replicas, enum alg_e alg)
 {
 	struct shard_change *change;
+	struct sharddir cfg[1];
+	VCL_BOOL r = 1;
 
 	CHECK_OBJ_NOTNULL(shardd, SHARDDIR_MAGIC);
 	if (replicas <= 0) {
@@ -588,24 +774,36 @@ shardcfg_reconfigure(VRT_CTX, struct vmod_priv *priv,
 	if (VSTAILQ_FIRST(&change->tasks) == NULL)
 		return 1;
 
-	sharddir_wrlock(shardd);
+	AZ(pthread_mutex_lock(&shardd->cfg_mtx));
 
-	shardcfg_apply_change(ctx, shardd, change);
+	shardcfg_copy(cfg, shardd);
+	shardcfg_apply_change(ctx, cfg, change);
 	shard_change_finish(change);
 
-	if (shardd->hashcircle)
-		free(shardd->hashcircle);
-	shardd->hashcircle = NULL;
-
-	if (shardd->n_backend == 0) {
+	if (cfg->n_backend == 0) {
 		shard_err0(ctx, shardd, ".reconfigure() no backends");
-		sharddir_unlock(shardd);
-		return 0;
+		r = 0;
+	} else {
+		cfg->replicas = replicas;
+		cfg->alg = alg;
+		if (shardd->hashcircle != NULL &&
+		    shardd->replicas == replicas && shardd->alg == alg)
+			shardcfg_hashcircle_diff(cfg, shardd);
+		else
+			shardcfg_hashcircle(cfg);
+		shardcfg_hashbucket(cfg);
+		shardcfg_hashcircle_debug(cfg);
 	}
 
-	shardcfg_hashcircle(shardd, replicas, alg);
+	sharddir_wrlock(shardd);
+	shardcfg_swap(shardd, cfg);
 	sharddir_unlock(shardd);
-	return (1);
+
+	AZ(pthread_mutex_unlock(&shardd->cfg_mtx));
+
+	/* the previous configuration, which nobody can see any more */
+	shardcfg_delete(cfg);
+	return (r);
 }
 
 /*
@@ -625,6 +823,8 @@ shardcfg_delete(const struct sharddir *shardd)
 		free(shardd->backend);
 	if (shardd->hashcircle)
 		free(shardd->hashcircle);
+	if (shardd->hashbucket)
+		free(shardd->hashbucket);
 }
 
 VCL_VOID
@@ -88,33 +88,24 @@ sharddir_err(VRT_CTX, enum VSL_tag_e tag,  const char *fmt, ...)
 	va_end(ap);
 }
 
+/*
+ * first point on the circle at or after key, or the last one
+ *
+ * the bucket gets us there or to less than a handful of points before it
+ */
 static int
 shard_lookup(const struct sharddir *shardd, const uint32_t key)
 {
 	CHECK_OBJ_NOTNULL(shardd, SHARDDIR_MAGIC);
+	AN(shardd->hashbucket);
+
+	const unsigned n = shardd->n_backend * shardd->replicas;
+	unsigned i;
 
-	const int n = shardd->n_backend * shardd->replicas;
-	int idx = -1, high = n, low = 0, i;
-
-	do {
-	    i = (high + low) / 2 ;
-	    if (shardd->hashcircle[i].point == key)
-		idx = i;
-	    else if (i == n - 1)
-		idx = n - 1;
-	    else if (shardd->hashcircle[i].point < key &&
-		     shardd->hashcircle[i+1].point >= key)
-		idx = i + 1;
-	    else if (shardd->hashcircle[i].point > key)
-		if (i == 0)
-		    idx = 0;
-		else
-		    high = i;
-	    else
-		low = i;
-	} while (idx == -1);
-
-	return idx;
+	i = shardd->hashbucket[key >> shardd->hashbucket_shift];
+	while (i < n - 1 && shardd->hashcircle[i].point < key)
+		i++;
+	return (i);
 }
 
 static int
@@ -192,6 +183,7 @@ sharddir_new(struct sharddir **sharddp, const char *vcl_name)
 	*sharddp = shardd;
 	shardd->name = vcl_name;
 	AZ(pthread_rwlock_init(&shardd->mtx, NULL));
+	AZ(pthread_mutex_init(&shardd->cfg_mtx, NULL));
 }
 
 void
@@ -206,6 +198,7 @@ sharddir_delete(struct sharddir **sharddp)
 	CHECK_OBJ_NOTNULL(shardd, SHARDDIR_MAGIC);
 	shardcfg_delete(shardd);
 	AZ(pthread_rwlock_destroy(&shardd->mtx));
+	AZ(pthread_mutex_destroy(&shardd->cfg_mtx));
 	FREE_OBJ(shardd);
 }
 
@@ -53,6 +53,8 @@ struct sharddir {
 	uint32_t				debug_flags;
 
 	pthread_rwlock_t			mtx;
+	/* serializes reconfigurations, see shardcfg_reconfigure() */
+	pthread_mutex_t				cfg_mtx;
 
 	const char				*name;
 
@@ -61,10 +63,14 @@ struct sharddir {
 	struct shard_backend			*backend;
 
 	struct shard_circlepoint		*hashcircle;
+	/* first hashcircle index per key range, see shard_lookup() */
+	unsigned				*hashbucket;
+	unsigned				hashbucket_shift;
 
 	VCL_DURATION				rampup_duration;
 	VCL_REAL				warmup;
 	VCL_INT					replicas;
+	enum alg_e				alg;
 };
 
 static inline VCL_BACKEND
@@ -35,6 +35,7 @@
 
 #include "vrt.h"
 #include "vbm.h"
+#include "vtim.h"
 
 #include "vdir.h"
 
@@ -47,6 +48,10 @@ vdir_expand(struct vdir *vd, unsigned n)
 	AN(vd->backend);
 	vd->weight = realloc(vd->weight, n * sizeof *vd->weight);
 	AN(vd->weight);
+	vd->h_idx = realloc(vd->h_idx, n * sizeof *vd->h_idx);
+	AN(vd->h_idx);
+	vd->h_cum = realloc(vd->h_cum, n * sizeof *vd->h_cum);
+	AN(vd->h_cum);
 	vd->l_backend = n;
 }
 
@@ -74,17 +79,25 @@ vdir_new(struct vdir **vdp, const char *name, const char *vcl_name,
 	vd->dir->resolve = resolve;
 	vd->vbm = vbit_new(8);
 	AN(vd->vbm);
+	VTAILQ_INIT(&vd->tracks);
 }
 
 void
 vdir_delete(struct vdir **vdp)
 {
 	struct vdir *vd;
+	struct vdir_track *vt;
 
 	TAKE_OBJ_NOTNULL(vd, vdp, VDIR_MAGIC);
 
+	while ((vt = VTAILQ_FIRST(&vd->tracks)) != NULL) {
+		VTAILQ_REMOVE(&vd->tracks, vt, list);
+		FREE_OBJ(vt);
+	}
 	free(vd->backend);
 	free(vd->weight);
+	free(vd->h_idx);
+	free(vd->h_cum);
 	AZ(pthread_rwlock_destroy(&vd->mtx));
 	free(vd->dir->vcl_name);
 	FREE_OBJ(vd->dir);
@@ -113,6 +126,59 @@ vdir_unlock(struct vdir *vd)
 	AZ(pthread_rwlock_unlock(&vd->mtx));
 }
 
+/*--------------------------------------------------------------------
+ * Asking every backend if it is healthy on every pick adds up with many
+ * backends, so we remember the answers until the health generation
+ * moves, see VDI_HealthGen().  This assumes the health of our backends
+ * only ever changes with VDI_HealthChanged(), which holds for backends
+ * and for all the directors we stack on top of them.
+ */
+
+static void
+vdir_update_healthy(struct vdir *vd, const struct busyobj *bo, unsigned gen)
+{
+	VCL_BACKEND be;
+	unsigned u, n = 0, first = 1;
+	double a = 0.0, c;
+
+	vd->h_changed = 0;
+	for (u = 0; u < vd->n_backend; u++) {
+		be = vd->backend[u];
+		CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+		if (be->healthy(be, bo, &c)) {
+			vbit_clr(vd->vbm, u);
+			a += vd->weight[u];
+			vd->h_idx[n] = u;
+			vd->h_cum[n++] = a;
+		} else
+			vbit_set(vd->vbm, u);
+		/* What vdir_any_healthy() reports: up to the first healthy */
+		if (first && c > vd->h_changed)
+			vd->h_changed = c;
+		if (n > 0)
+			first = 0;
+	}
+	vd->n_healthy = n;
+	vd->h_gen = gen;
+}
+
+/* Returns with the vdir read- or write-locked and the health cache valid */
+
+void
+vdir_lock_healthy(struct vdir *vd, const struct busyobj *bo)
+{
+	unsigned gen;
+
+	gen = VDI_HealthGen();
+	vdir_rdlock(vd);
+	if (gen != 0 && vd->h_gen == gen)
+		return;
+	vdir_unlock(vd);
+	vdir_wrlock(vd);
+	if (gen == 0 || vd->h_gen != gen)
+		vdir_update_healthy(vd, bo, gen);
+}
+
 
 unsigned
 vdir_add_backend(struct vdir *vd, VCL_BACKEND be, double weight)
@@ -129,6 +195,7 @@ vdir_add_backend(struct vdir *vd, VCL_BACKEND be, double weight)
 	vd->backend[u] = be;
 	vd->weight[u] = weight;
 	vd->total_weight += weight;
+	vd->h_gen = 0;
 	vdir_unlock(vd);
 	return (u);
 }
@@ -155,6 +222,7 @@ vdir_remove_backend(struct vdir *vd, VCL_BACKEND be, unsigned *cur)
 	memmove(&vd->backend[u], &vd->backend[u+1], n * sizeof(vd->backend[0]));
 	memmove(&vd->weight[u], &vd->weight[u+1], n * sizeof(vd->weight[0]));
 	vd->n_backend--;
+	vd->h_gen = 0;
 
 	if (cur) {
 		assert(*cur <= vd->n_backend);
@@ -169,67 +237,48 @@ vdir_remove_backend(struct vdir *vd, VCL_BACKEND be, unsigned *cur)
 unsigned
 vdir_any_healthy(struct vdir *vd, const struct busyobj *bo, double *changed)
 {
-	unsigned retval = 0;
-	VCL_BACKEND be;
-	unsigned u;
-	double c;
+	unsigned retval;
 
 	CHECK_OBJ_NOTNULL(vd, VDIR_MAGIC);
 	CHECK_OBJ_ORNULL(bo, BUSYOBJ_MAGIC);
-	vdir_rdlock(vd);
+	vdir_lock_healthy(vd, bo);
+	retval = vd->n_healthy > 0;
 	if (changed != NULL)
-		*changed = 0;
-	for (u = 0; u < vd->n_backend; u++) {
-		be = vd->backend[u];
-		CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
-		retval = be->healthy(be, bo, &c);
-		if (changed != NULL && c > *changed)
-			*changed = c;
-		if (retval)
-			break;
-	}
+		*changed = vd->h_changed;
 	vdir_unlock(vd);
 	return (retval);
 }
 
+/* The first healthy backend whose running weight total exceeds w */
+
 static unsigned
-vdir_pick_by_weight(const struct vdir *vd, double w,
-    const struct vbitmap *blacklist)
+vdir_pick_by_weight(const struct vdir *vd, double w)
 {
-	double a = 0.0;
-	VCL_BACKEND be = NULL;
-	unsigned u;
+	unsigned lo = 0, hi, m;
 
-	AN(blacklist);
-	for (u = 0; u < vd->n_backend; u++) {
-		be = vd->backend[u];
-		CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
-		if (vbit_test(blacklist, u))
-			continue;
-		a += vd->weight[u];
-		if (w < a)
-			return (u);
+	hi = vd->n_healthy - 1;
+	while (lo < hi) {
+		m = lo + (hi - lo) / 2;
+		if (w < vd->h_cum[m])
+			hi = m;
+		else
+			lo = m + 1;
 	}
-	WRONG("");
+	assert(w < vd->h_cum[lo]);
+	return (vd->h_idx[lo]);
 }
 
 VCL_BACKEND
 vdir_pick_be(struct vdir *vd, double w, const struct busyobj *bo)
 {
 	unsigned u;
-	double tw = 0.0;
+	double tw;
 	VCL_BACKEND be = NULL;
 
-	vdir_wrlock(vd);
-	for (u = 0; u < vd->n_backend; u++) {
-		if (vd->backend[u]->healthy(vd->backend[u], bo, NULL)) {
-			vbit_clr(vd->vbm, u);
-			tw += vd->weight[u];
-		} else
-			vbit_set(vd->vbm, u);
-	}
+	vdir_lock_healthy(vd, bo);
+	tw = vd->n_healthy > 0 ? vd->h_cum[vd->n_healthy - 1] : 0.0;
 	if (tw > 0.0) {
-		u = vdir_pick_by_weight(vd, w * tw, vd->vbm);
+		u = vdir_pick_by_weight(vd, w * tw);
 		assert(u < vd->n_backend);
 		be = vd->backend[u];
 		CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
@@ -237,3 +286,186 @@ vdir_pick_be(struct vdir *vd, double w, const struct busyobj *bo)
 	vdir_unlock(vd);
 	return (be);
 }
+
+/*--------------------------------------------------------------------
+ * Tracked backends
+ *
+ * Directors which care about what their backends are up to add them
+ * wrapped in a director of ours, which passes the work on.  It counts the
+ * fetches in flight from gethdrs to finish, and keeps a moving average of
+ * how long gethdrs takes: connect, send and wait for the first byte.
+ *
+ * The wrappers stay until the vdir goes away, a fetch may still be using
+ * one after its backend was removed.
+ */
+
+#define VDIR_TTFB_WEIGHT	0.25
+
+static unsigned __match_proto__(vdi_healthy_f)
+vdir_track_healthy(const struct director *dir, const struct busyobj *bo,
+    double *changed)
+{
+	struct vdir_track *vt;
+
+	vt = vdir_track(dir);
+	return (vt->be->healthy(vt->be, bo, changed));
+}
+
+static int __match_proto__(vdi_gethdrs_f)
+vdir_track_gethdrs(const struct director *dir, struct worker *wrk,
+    struct busyobj *bo)
+{
+	struct vdir_track *vt;
+	double t;
+	int i;
+
+	vt = vdir_track(dir);
+	/* We want to see the whole of it */
+	bo->can_park = 0;
+	(void)__sync_add_and_fetch(&vt->inflight, 1);
+	t = VTIM_mono();
+	i = vt->be->gethdrs(vt->be, wrk, bo);
+	if (i) {
+		/* No finish after a failed gethdrs */
+		(void)__sync_sub_and_fetch(&vt->inflight, 1);
+		return (i);
+	}
+	/* Racing updates lose a sample, no harm done */
+	t = VTIM_mono() - t;
+	if (vt->ttfb == 0.0)
+		vt->ttfb = t;
+	else
+		vt->ttfb += (t - vt->ttfb) * VDIR_TTFB_WEIGHT;
+	return (0);
+}
+
+static int __match_proto__(vdi_getbody_f)
+vdir_track_getbody(const struct director *dir, struct worker *wrk,
+    struct busyobj *bo)
+{
+	struct vdir_track *vt;
+
+	vt = vdir_track(dir);
+	if (vt->be->getbody == NULL)
+		return (0);
+	return (vt->be->getbody(vt->be, wrk, bo));
+}
+
+static const struct suckaddr * __match_proto__(vdi_getip_f)
+vdir_track_getip(const struct director *dir, struct worker *wrk,
+    struct busyobj *bo)
+{
+	struct vdir_track *vt;
+
+	vt = vdir_track(dir);
+	if (vt->be->getip == NULL)
+		return (NULL);
+	return (vt->be->getip(vt->be, wrk, bo));
+}
+
+static void __match_proto__(vdi_finish_f)
+vdir_track_finish(const struct director *dir, struct worker *wrk,
+    struct busyobj *bo)
+{
+	struct vdir_track *vt;
+
+	vt = vdir_track(dir);
+	vt->be->finish(vt->be, wrk, bo);
+	assert(vt->inflight > 0);
+	(void)__sync_sub_and_fetch(&vt->inflight, 1);
+}
+
+static enum sess_close __match_proto__(vdi_http1pipe_f)
+vdir_track_http1pipe(const struct director *dir, struct req *req,
+    struct busyobj *bo)
+{
+	struct vdir_track *vt;
+	enum sess_close sc;
+
+	vt = vdir_track(dir);
+	if (vt->be->http1pipe == NULL) {
+		VSLb(bo->vsl, SLT_VCL_Error, "Backend does not support pipe");
+		return (SC_TX_ERROR);
+	}
+	(void)__sync_add_and_fetch(&vt->inflight, 1);
+	sc = vt->be->http1pipe(vt->be, req, bo);
+	(void)__sync_sub_and_fetch(&vt->inflight, 1);
+	return (sc);
+}
+
+static void __match_proto__(vdi_panic_f)
+vdir_track_panic(const struct director *dir, struct vsb *vsb)
+{
+	struct vdir_track *vt;
+
+	vt = vdir_track(dir);
+	VSB_printf(vsb, "inflight = %u,\n", vt->inflight);
+	VSB_printf(vsb, "ttfb = %f,\n", vt->ttfb);
+	VDI_Panic(vt->be, vsb, "backend");
+}
+
+static struct vdir_track *
+vdir_track_find(const struct vdir *vd, VCL_BACKEND be)
+{
+	struct vdir_track *vt;
+
+	VTAILQ_FOREACH(vt, &vd->tracks, list)
+		if (vt->be == be)
+			return (vt);
+	return (NULL);
+}
+
+void
+vdir_add_tracked(struct vdir *vd, VCL_BACKEND be, double weight)
+{
+	struct vdir_track *vt;
+	const char *p;
+
+	CHECK_OBJ_NOTNULL(vd, VDIR_MAGIC);
+	CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+	AZ(be->resolve);
+
+	vdir_wrlock(vd);
+	vt = vdir_track_find(vd, be);
+	if (vt == NULL) {
+		ALLOC_OBJ(vt, VDIR_TRACK_MAGIC);
+		AN(vt);
+		vt->be = be;
+		/* FNV-1a, so it does not change with VCL reloads */
+		vt->hash = 0x811c9dc5;
+		for (p = be->vcl_name; *p != '\0'; p++) {
+			vt->hash ^= (uint8_t)*p;
+			vt->hash *= 0x01000193;
+		}
+		INIT_OBJ(vt->dir, DIRECTOR_MAGIC);
+		vt->dir->name = "tracked";
+		vt->dir->vcl_name = be->vcl_name;
+		vt->dir->priv = vt;
+		vt->dir->healthy = vdir_track_healthy;
+		vt->dir->gethdrs = vdir_track_gethdrs;
+		vt->dir->getbody = vdir_track_getbody;
+		vt->dir->getip = vdir_track_getip;
+		vt->dir->finish = vdir_track_finish;
+		vt->dir->http1pipe = vdir_track_http1pipe;
+		vt->dir->panic = vdir_track_panic;
+		VTAILQ_INSERT_TAIL(&vd->tracks, vt, list);
+	}
+	vdir_unlock(vd);
+	vdir_remove_backend(vd, vt->dir, NULL);
+	(void)vdir_add_backend(vd, vt->dir, weight);
+}
+
+void
+vdir_remove_tracked(struct vdir *vd, VCL_BACKEND be)
+{
+	struct vdir_track *vt;
+
+	CHECK_OBJ_NOTNULL(vd, VDIR_MAGIC);
+	if (be == NULL)
+		return;
+	vdir_rdlock(vd);
+	vt = vdir_track_find(vd, be);
+	vdir_unlock(vd);
+	if (vt != NULL)
+		vdir_remove_backend(vd, vt->dir, NULL);
+}
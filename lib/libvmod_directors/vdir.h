@@ -28,6 +28,21 @@
 
 struct vbitmap;
 
+/*
+ * A backend wrapped in a director of ours, keeping track of its fetches,
+ * see vdir_add_tracked()
+ */
+struct vdir_track {
+	unsigned				magic;
+#define VDIR_TRACK_MAGIC			0x5d0f72e9
+	VTAILQ_ENTRY(vdir_track)		list;
+	VCL_BACKEND				be;
+	uint32_t				hash;	// of vcl_name
+	unsigned				inflight;
+	double					ttfb;	// moving avg, 0: none
+	struct director				dir[1];
+};
+
 struct vdir {
 	unsigned				magic;
 #define VDIR_MAGIC				0x99f4b726
@@ -38,17 +53,57 @@ struct vdir {
 	double					*weight;
 	double					total_weight;
 	struct director				*dir;
-	struct vbitmap				*vbm;
+	struct vbitmap				*vbm;	// sick backends
+	VTAILQ_HEAD(, vdir_track)		tracks;
+
+	/*
+	 * Health of the backends as of VDI_HealthGen() == h_gen, 0: stale.
+	 * h_cum[] is the running total of weight over the healthy ones,
+	 * in backend[] order, h_idx[] their index into backend[].
+	 */
+	unsigned				h_gen;
+	unsigned				n_healthy;
+	unsigned				*h_idx;
+	double					*h_cum;
+	double					h_changed;
 };
 
+static inline struct vdir_track *
+vdir_track(VCL_BACKEND dir)
+{
+	struct vdir_track *vt;
+
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(vt, dir->priv, VDIR_TRACK_MAGIC);
+	return (vt);
+}
+
+/* Rendezvous hashing score of a tracked backend for a key */
+static inline uint32_t
+vdir_score(uint32_t key, uint32_t seed)
+{
+	uint32_t h = key ^ seed;
+
+	/* murmur3 finalizer */
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return (h);
+}
+
 void vdir_new(struct vdir **vdp, const char *name, const char *vcl_name,
     vdi_healthy_f *healthy, vdi_resolve_f *resolve, void *priv);
 void vdir_delete(struct vdir **vdp);
 void vdir_rdlock(struct vdir *vd);
 void vdir_wrlock(struct vdir *vd);
 void vdir_unlock(struct vdir *vd);
+void vdir_lock_healthy(struct vdir *vd, const struct busyobj *);
 unsigned vdir_add_backend(struct vdir *, VCL_BACKEND be, double weight);
 void vdir_remove_backend(struct vdir *, VCL_BACKEND be, unsigned *cur);
 unsigned vdir_any_healthy(struct vdir *, const struct busyobj *,
     double *changed);
 VCL_BACKEND vdir_pick_be(struct vdir *, double w, const struct busyobj *);
+void vdir_add_tracked(struct vdir *, VCL_BACKEND be, double weight);
+void vdir_remove_tracked(struct vdir *, VCL_BACKEND be);
@@ -36,6 +36,7 @@
 
 #include "cache/cache.h"
 
+#include "vct.h"
 #include "vrnd.h"
 #include "vrt.h"
 #include "vtcp.h"
@@ -228,16 +229,32 @@ vmod_timestamp(VRT_CTX, VCL_STRING label)
 }
 
 VCL_BOOL __match_proto__(td_std_cache_req_body)
-vmod_cache_req_body(VRT_CTX, VCL_BYTES size)
+vmod_cache_req_body(VRT_CTX, VCL_BYTES size, VCL_BOOL stream)
 {
 	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 	if (size < 0)
 		size = 0;
+	if (stream)
+		return (VRT_StreamReqBody(ctx, (size_t)size) < 0 ? 0 : 1);
 	if (VRT_CacheReqBody(ctx, (size_t)size) < 0)
 		return (0);
 	return (1);
 }
 
+VCL_INT __match_proto__(td_std_tag_purge)
+vmod_tag_purge(VRT_CTX, VCL_STRING keys, VCL_BOOL soft)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	return (VRT_purge_tags(ctx, keys, soft));
+}
+
+VCL_INT __match_proto__(td_std_ban_replay)
+vmod_ban_replay(VRT_CTX)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	return (VRT_ban_replay(ctx));
+}
+
 VCL_STRING __match_proto__(td_std_strstr)
 vmod_strstr(VRT_CTX, VCL_STRING s1, VCL_STRING s2)
 {
@@ -247,6 +264,74 @@ vmod_strstr(VRT_CTX, VCL_STRING s1, VCL_STRING s2)
 	return (strstr(s1, s2));
 }
 
+/*
+ * Does the range from an Accept* header match the value [b...e>?  Ranges
+ * match the same value, values starting with them and a '-' (languages)
+ * and, for "type/" "*", values starting with "type/".
+ */
+
+static int
+std_accept_match(const struct http_qval *qv, const char *b, const char *e)
+{
+	size_t l = qv->e - qv->b;
+
+	if (l == 1 && *qv->b == '*')
+		return (1);
+	if (l >= 2 && qv->e[-1] == '*' && qv->e[-2] == '/')
+		return (e - b > l - 1 && !strncasecmp(b, qv->b, l - 1));
+	if (e - b == l)
+		return (!strncasecmp(b, qv->b, l));
+	return (e - b > l && b[l] == '-' && !strncasecmp(b, qv->b, l));
+}
+
+VCL_STRING __match_proto__(td_std_accept)
+vmod_accept(VRT_CTX, VCL_STRING hdr, VCL_STRING supported,
+    VCL_STRING fallback)
+{
+	struct http_qval qv[32];
+	const char *b, *e, *bb = NULL, *be = NULL;
+	double q, bq = 0.;
+	size_t l, ql;
+	unsigned n, u;
+	char *r;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	n = http_QList(hdr, qv, 32);
+	for (b = supported; n > 0 && b != NULL && *b != '\0'; b = e) {
+		while (*b == ',' || vct_issp(*b))
+			b++;
+		for (e = b; *e != '\0' && *e != ',' && !vct_issp(*e); e++)
+			continue;
+		if (e == b)
+			continue;
+		/* The most specific range which matches has the say */
+		q = 0.;
+		ql = 0;
+		for (u = 0; u < n; u++) {
+			l = qv[u].e - qv[u].b;
+			if (l > ql && std_accept_match(&qv[u], b, e)) {
+				q = qv[u].q;
+				ql = l;
+			}
+		}
+		if (q > bq) {
+			bq = q;
+			bb = b;
+			be = e;
+		}
+	}
+	if (bb == NULL)
+		return (fallback);
+	r = WS_Alloc(ctx->ws, (be - bb) + 1);
+	if (r == NULL) {
+		VRT_fail(ctx, "std.accept: out of workspace");
+		return (NULL);
+	}
+	memcpy(r, bb, be - bb);
+	r[be - bb] = '\0';
+	return (r);
+}
+
 VCL_STRING __match_proto__(td_std_getenv)
 vmod_getenv(VRT_CTX, VCL_STRING name)
 {
@@ -0,0 +1,204 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Cookies are parsed once per task into pointer pairs into the header,
+ * kept in the PRIV_TASK.  Filtering only drops pairs, and the header is
+ * only put together again if VCL asks for it.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache/cache.h"
+
+#include "vrt.h"
+#include "vct.h"
+
+#include "vcc_if.h"
+#include "vmod_std.h"
+
+struct std_cookies {
+	unsigned		magic;
+#define STD_COOKIES_MAGIC	0x3e7f08c1
+	unsigned		n;
+	const char		**pp;	/* n pairs of name=value begin, end */
+};
+
+static struct std_cookies *
+std_cookies(VRT_CTX, struct vmod_priv *priv)
+{
+	struct std_cookies *sc;
+
+	AN(priv);
+	if (priv->priv != NULL) {
+		CAST_OBJ_NOTNULL(sc, priv->priv, STD_COOKIES_MAGIC);
+		return (sc);
+	}
+	sc = WS_Alloc(ctx->ws, sizeof *sc);
+	if (sc == NULL) {
+		VRT_fail(ctx, "std.cookie: out of workspace");
+		return (NULL);
+	}
+	INIT_OBJ(sc, STD_COOKIES_MAGIC);
+	priv->priv = sc;
+	return (sc);
+}
+
+VCL_VOID __match_proto__(td_std_cookie_parse)
+vmod_cookie_parse(VRT_CTX, struct vmod_priv *priv, VCL_STRING cookie)
+{
+	struct std_cookies *sc;
+	const char *p, *b, *e;
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	sc = std_cookies(ctx, priv);
+	if (sc == NULL)
+		return;
+	sc->n = 0;
+	if (cookie == NULL)
+		return;
+
+	for (n = 1, p = cookie; *p != '\0'; p++)
+		if (*p == ';')
+			n++;
+	sc->pp = WS_Alloc(ctx->ws, n * 2 * sizeof *sc->pp);
+	if (sc->pp == NULL) {
+		VRT_fail(ctx, "std.cookie_parse: out of workspace");
+		return;
+	}
+
+	for (p = cookie; *p != '\0'; p = e) {
+		while (*p == ';' || vct_issp(*p))
+			p++;
+		for (e = p; *e != '\0' && *e != ';'; e++)
+			continue;
+		for (b = e; b > p && vct_issp(b[-1]); b--)
+			continue;
+		if (b == p)
+			continue;
+		assert(sc->n < n);
+		sc->pp[sc->n * 2] = p;
+		sc->pp[sc->n * 2 + 1] = b;
+		sc->n++;
+	}
+}
+
+VCL_VOID __match_proto__(td_std_cookie_filter)
+vmod_cookie_filter(VRT_CTX, struct vmod_priv *priv, VCL_STRING keep,
+    VCL_STRING drop)
+{
+	struct std_cookies *sc;
+	unsigned u, n;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	sc = std_cookies(ctx, priv);
+	if (sc == NULL)
+		return;
+	if (keep != NULL && *keep == '\0')
+		keep = NULL;
+	if (drop != NULL && *drop == '\0')
+		drop = NULL;
+	for (u = n = 0; u < sc->n; u++) {
+		if (keep != NULL &&
+		    !std_inlist(keep, sc->pp[u * 2], sc->pp[u * 2 + 1]))
+			continue;
+		if (drop != NULL &&
+		    std_inlist(drop, sc->pp[u * 2], sc->pp[u * 2 + 1]))
+			continue;
+		sc->pp[n * 2] = sc->pp[u * 2];
+		sc->pp[n * 2 + 1] = sc->pp[u * 2 + 1];
+		n++;
+	}
+	sc->n = n;
+}
+
+VCL_STRING __match_proto__(td_std_cookie_get)
+vmod_cookie_get(VRT_CTX, struct vmod_priv *priv, VCL_STRING name)
+{
+	struct std_cookies *sc;
+	const char *b, *e;
+	size_t l;
+	unsigned u;
+	char *r;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	if (name == NULL || *name == '\0')
+		return (NULL);
+	sc = std_cookies(ctx, priv);
+	if (sc == NULL)
+		return (NULL);
+	l = strlen(name);
+	for (u = 0; u < sc->n; u++) {
+		b = sc->pp[u * 2];
+		e = sc->pp[u * 2 + 1];
+		if (e - b <= l || b[l] != '=' || memcmp(b, name, l))
+			continue;
+		b += l + 1;
+		r = WS_Alloc(ctx->ws, (e - b) + 1);
+		if (r == NULL) {
+			VRT_fail(ctx, "std.cookie_get: out of workspace");
+			return (NULL);
+		}
+		memcpy(r, b, e - b);
+		r[e - b] = '\0';
+		return (r);
+	}
+	return (NULL);
+}
+
+VCL_STRING __match_proto__(td_std_cookie_string)
+vmod_cookie_string(VRT_CTX, struct vmod_priv *priv)
+{
+	struct std_cookies *sc;
+	unsigned u, l;
+	char *r, *p;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	sc = std_cookies(ctx, priv);
+	if (sc == NULL)
+		return (NULL);
+	l = 1;
+	for (u = 0; u < sc->n; u++)
+		l += (sc->pp[u * 2 + 1] - sc->pp[u * 2]) + 2;
+	r = WS_Alloc(ctx->ws, l);
+	if (r == NULL) {
+		VRT_fail(ctx, "std.cookie_string: out of workspace");
+		return (NULL);
+	}
+	p = r;
+	for (u = 0; u < sc->n; u++) {
+		if (u > 0) {
+			*p++ = ';';
+			*p++ = ' ';
+		}
+		memcpy(p, sc->pp[u * 2], sc->pp[u * 2 + 1] - sc->pp[u * 2]);
+		p += sc->pp[u * 2 + 1] - sc->pp[u * 2];
+	}
+	*p++ = '\0';
+	assert(p <= r + l);
+	return (r);
+}
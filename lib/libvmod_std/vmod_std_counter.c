@@ -0,0 +1,262 @@
+/*-
+ * Copyright (c) 2018 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Counters and histograms declared from VCL.  Each object gets a
+ * VSC_type_vcl segment of its own for the lifetime of the VCL, named
+ * after the VCL, which describes its fields to varnishstat and friends.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache/cache.h"
+
+#include "vct.h"
+#include "vmb.h"
+#include "vrt.h"
+
+#include "vcc_if.h"
+
+#define STD_HIST_MAX		15
+
+struct std_vsc {
+	struct VSC_vcl		*seg;
+	volatile struct VSC_vcl_value	*val;
+	unsigned		n;
+};
+
+/*--------------------------------------------------------------------*/
+
+static void
+std_vsc_new(VRT_CTX, struct std_vsc *sv, unsigned n)
+{
+	char ident[VSM_IDENT_LEN];
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(n);
+	(void)snprintf(ident, sizeof ident, "%s", VCL_Name(ctx->vcl));
+	sv->seg = VSM_Alloc(VSC_VCL_SIZE(n), VSC_CLASS, VSC_type_vcl, ident);
+	AN(sv->seg);
+	sv->val = (void *)((char *)sv->seg + VSC_VCL_VALOFF(n));
+	sv->n = n;
+}
+
+static void
+std_vsc_field(struct std_vsc *sv, unsigned u, const char *name,
+    const char *suffix, const char *sdesc)
+{
+
+	assert(u < sv->n);
+	/* Overlong names have failed the VCL already, just truncate */
+	(void)snprintf(sv->seg->field[u].name, sizeof sv->seg->field[u].name,
+	    "%s%s", name, suffix);
+	(void)snprintf(sv->seg->field[u].sdesc,
+	    sizeof sv->seg->field[u].sdesc, "%s", sdesc);
+}
+
+static void
+std_vsc_publish(struct std_vsc *sv)
+{
+
+	VWMB();
+	sv->seg->n_field = sv->n;
+}
+
+static void
+std_vsc_fini(struct std_vsc *sv)
+{
+
+	VSM_Free(sv->seg);
+	sv->seg = NULL;
+	sv->val = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+
+struct vmod_std_counter {
+	unsigned		magic;
+#define VMOD_STD_COUNTER_MAGIC	0x4e1c27a1
+	struct std_vsc		vsc[1];
+};
+
+VCL_VOID
+vmod_counter__init(VRT_CTX, struct vmod_std_counter **cp,
+    const char *vcl_name, VCL_STRING description)
+{
+	struct vmod_std_counter *c;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(cp);
+	AZ(*cp);
+	AN(vcl_name);
+	if (strlen(vcl_name) >= VSC_VCL_NAMELEN)
+		VRT_fail(ctx, "std.counter: %s: name longer than %d characters",
+		    vcl_name, VSC_VCL_NAMELEN - 1);
+	ALLOC_OBJ(c, VMOD_STD_COUNTER_MAGIC);
+	AN(c);
+	*cp = c;
+	std_vsc_new(ctx, c->vsc, 1);
+	std_vsc_field(c->vsc, 0, vcl_name, "",
+	    description != NULL ? description : "");
+	std_vsc_publish(c->vsc);
+}
+
+VCL_VOID
+vmod_counter__fini(struct vmod_std_counter **cp)
+{
+	struct vmod_std_counter *c;
+
+	c = *cp;
+	*cp = NULL;
+	CHECK_OBJ_NOTNULL(c, VMOD_STD_COUNTER_MAGIC);
+	std_vsc_fini(c->vsc);
+	FREE_OBJ(c);
+}
+
+VCL_VOID
+vmod_counter_increment(VRT_CTX, struct vmod_std_counter *c, VCL_INT n)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(c, VMOD_STD_COUNTER_MAGIC);
+	if (n > 0)
+		(void)__sync_fetch_and_add(&c->vsc->val[0].value,
+		    (uint64_t)n);
+}
+
+VCL_INT
+vmod_counter_get(VRT_CTX, struct vmod_std_counter *c)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(c, VMOD_STD_COUNTER_MAGIC);
+	return ((VCL_INT)c->vsc->val[0].value);
+}
+
+/*--------------------------------------------------------------------*/
+
+struct vmod_std_histogram {
+	unsigned		magic;
+#define VMOD_STD_HISTOGRAM_MAGIC	0x7d2c0a4b
+	unsigned		n_bound;
+	double			bound[STD_HIST_MAX];
+	struct std_vsc		vsc[1];
+};
+
+static unsigned
+std_hist_parse(VRT_CTX, const char *vcl_name, const char *s, double *bound)
+{
+	unsigned n = 0;
+	char *e;
+	double d;
+
+	while (s != NULL && *s != '\0') {
+		if (*s == ',' || vct_issp(*s)) {
+			s++;
+			continue;
+		}
+		d = strtod(s, &e);
+		if (e == s || (*e != '\0' && *e != ',' && !vct_issp(*e))) {
+			VRT_fail(ctx, "std.histogram: %s: bad bucket \"%s\"",
+			    vcl_name, s);
+			return (0);
+		}
+		if (n == STD_HIST_MAX) {
+			VRT_fail(ctx, "std.histogram: %s: more than %d buckets",
+			    vcl_name, STD_HIST_MAX);
+			return (0);
+		}
+		if (n > 0 && d <= bound[n - 1]) {
+			VRT_fail(ctx, "std.histogram: %s: buckets not ascending",
+			    vcl_name);
+			return (0);
+		}
+		bound[n++] = d;
+		s = e;
+	}
+	return (n);
+}
+
+VCL_VOID
+vmod_histogram__init(VRT_CTX, struct vmod_std_histogram **hp,
+    const char *vcl_name, VCL_STRING buckets, VCL_STRING description)
+{
+	struct vmod_std_histogram *h;
+	char suffix[32], *p;
+	const char *d;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(hp);
+	AZ(*hp);
+	AN(vcl_name);
+	if (strlen(vcl_name) + sizeof "_le_" + 12 > VSC_VCL_NAMELEN)
+		VRT_fail(ctx, "std.histogram: %s: name too long", vcl_name);
+	ALLOC_OBJ(h, VMOD_STD_HISTOGRAM_MAGIC);
+	AN(h);
+	*hp = h;
+	h->n_bound = std_hist_parse(ctx, vcl_name, buckets, h->bound);
+	d = description != NULL ? description : "";
+
+	std_vsc_new(ctx, h->vsc, h->n_bound + 1);
+	for (u = 0; u < h->n_bound; u++) {
+		bprintf(suffix, "_le_%g", h->bound[u]);
+		/* Keep the name a single component for VSC field filters */
+		for (p = suffix; *p != '\0'; p++)
+			if (*p == '.')
+				*p = '_';
+		std_vsc_field(h->vsc, u, vcl_name, suffix, d);
+	}
+	std_vsc_field(h->vsc, u, vcl_name, "_inf", d);
+	std_vsc_publish(h->vsc);
+}
+
+VCL_VOID
+vmod_histogram__fini(struct vmod_std_histogram **hp)
+{
+	struct vmod_std_histogram *h;
+
+	h = *hp;
+	*hp = NULL;
+	CHECK_OBJ_NOTNULL(h, VMOD_STD_HISTOGRAM_MAGIC);
+	std_vsc_fini(h->vsc);
+	FREE_OBJ(h);
+}
+
+VCL_VOID
+vmod_histogram_observe(VRT_CTX, struct vmod_std_histogram *h,
+    VCL_REAL value)
+{
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(h, VMOD_STD_HISTOGRAM_MAGIC);
+	for (u = 0; u < h->n_bound; u++)
+		if (value <= h->bound[u])
+			break;
+	(void)__sync_fetch_and_add(&h->vsc->val[u].value, 1);
+}
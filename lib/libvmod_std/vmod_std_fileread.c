@@ -25,45 +25,60 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  *
- * XXX: It might make sense to use just a single global list of all files
- * XXX: and use the call-private pointer to point to the file instance on
- * XXX: that list.
- * XXX: Duplicates in the global list can be avoided by examining the
- * XXX: dev+inode fields of the stat structure.
- * XXX: Individual files would need to be refcounted, so they can be
- * XXX: deleted when no VCL's reference them.
+ * Files are shared between call sites, and between VCLs, by name and
+ * refresh interval.  The call site keeps a pointer to its file in the
+ * PRIV_CALL, so the usual lookup takes no lock.
  *
- * XXX: We should periodically stat(2) the filename and check if the
- * XXX: underlying file has been updated.
+ * Files with a refresh interval are watched by a single thread, which
+ * stat(2)s them that often and reads them again when they change.  The
+ * new contents are swapped in atomically.  Strings which have been
+ * handed out may still be in use by running tasks, so the old contents
+ * are only freed with the file, when no VCL references it any more.
  */
 
 #include "config.h"
 
+#include <sys/stat.h>
+
+#include <errno.h>
 #include <stdlib.h>
 
 #include "cache/cache.h"
 
 #include "vrt.h"
 #include "vfil.h"
+#include "vtim.h"
 
 #include "vcc_if.h"
 
+struct frold {
+	char				*contents;
+	VTAILQ_ENTRY(frold)		list;
+};
+
 struct frfile {
 	unsigned			magic;
 #define CACHED_FILE_MAGIC 0xa8e9d87a
 	char				*file_name;
-	char				*contents;
+	char * volatile			contents;
 	int				refcount;
+	double				refresh;
+	double				t_next;
+	struct stat			st;
+	VTAILQ_HEAD(, frold)		old;
 	VTAILQ_ENTRY(frfile)		list;
 };
 
 static VTAILQ_HEAD(, frfile)	frlist = VTAILQ_HEAD_INITIALIZER(frlist);
 static pthread_mutex_t		frmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		frcond = PTHREAD_COND_INITIALIZER;
+static int			frthread;
 
 static void
 free_frfile(void *ptr)
 {
 	struct frfile *frf;
+	struct frold *fro;
 
 	CAST_OBJ_NOTNULL(frf, ptr, CACHED_FILE_MAGIC);
 
@@ -74,57 +89,140 @@ free_frfile(void *ptr)
 		VTAILQ_REMOVE(&frlist, frf, list);
 	AZ(pthread_mutex_unlock(&frmtx));
 	if (frf != NULL) {
+		while ((fro = VTAILQ_FIRST(&frf->old)) != NULL) {
+			VTAILQ_REMOVE(&frf->old, fro, list);
+			free(fro->contents);
+			free(fro);
+		}
 		free(frf->contents);
 		free(frf->file_name);
 		FREE_OBJ(frf);
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Look for changes to the file, must hold frmtx
+ */
+
+static void
+frfile_check(struct frfile *frf, double now)
+{
+	struct frold *fro;
+	struct stat st;
+	char *s;
+
+	CHECK_OBJ_NOTNULL(frf, CACHED_FILE_MAGIC);
+	frf->t_next = now + frf->refresh;
+	if (stat(frf->file_name, &st))
+		return;
+	if (st.st_dev == frf->st.st_dev && st.st_ino == frf->st.st_ino &&
+	    st.st_size == frf->st.st_size &&
+	    st.st_mtime == frf->st.st_mtime &&
+	    st.st_ctime == frf->st.st_ctime)
+		return;
+	s = VFIL_readfile(NULL, frf->file_name, NULL);
+	if (s == NULL)
+		return;
+	fro = calloc(1, sizeof *fro);
+	if (fro == NULL) {
+		free(s);
+		return;
+	}
+	frf->st = st;
+	fro->contents = frf->contents;
+	VTAILQ_INSERT_TAIL(&frf->old, fro, list);
+	frf->contents = s;
+}
+
+static void * __match_proto__()
+frfile_thread(void *priv)
+{
+	struct frfile *frf;
+	struct timespec ts;
+	double now, t;
+
+	(void)priv;
+	AZ(pthread_mutex_lock(&frmtx));
+	while (1) {
+		now = VTIM_real();
+		t = now + 60.;
+		VTAILQ_FOREACH(frf, &frlist, list) {
+			if (frf->refresh == 0.)
+				continue;
+			if (frf->t_next <= now)
+				frfile_check(frf, now);
+			if (frf->t_next < t)
+				t = frf->t_next;
+		}
+		ts = VTIM_timespec(t);
+		(void)pthread_cond_timedwait(&frcond, &frmtx, &ts);
+	}
+	NEEDLESS(AZ(pthread_mutex_unlock(&frmtx)));
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------*/
+
 VCL_STRING __match_proto__(td_std_fileread)
 vmod_fileread(VRT_CTX, struct vmod_priv *priv,
-    VCL_STRING file_name)
+    VCL_STRING file_name, VCL_DURATION refresh)
 {
 	struct frfile *frf = NULL;
+	pthread_t thr;
+	void *old;
 	char *s;
 
 	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 	AN(priv);
 
-	if (priv->priv != NULL) {
-		CAST_OBJ_NOTNULL(frf, priv->priv, CACHED_FILE_MAGIC);
-		if (!strcmp(file_name, frf->file_name))
+	if (refresh < 0.)
+		refresh = 0.;
+	frf = priv->priv;
+	if (frf != NULL) {
+		CHECK_OBJ(frf, CACHED_FILE_MAGIC);
+		if (refresh == frf->refresh && !strcmp(file_name, frf->file_name))
 			return (frf->contents);
 	}
 
 	AZ(pthread_mutex_lock(&frmtx));
-	if (frf != NULL)
-		frf->refcount--;
+	if (priv->priv != frf) {
+		/* Someone else got here first, try again */
+		AZ(pthread_mutex_unlock(&frmtx));
+		return (vmod_fileread(ctx, priv, file_name, refresh));
+	}
 	VTAILQ_FOREACH(frf, &frlist, list) {
-		if (!strcmp(file_name, frf->file_name)) {
-			frf->refcount++;
+		if (refresh == frf->refresh && !strcmp(file_name, frf->file_name))
 			break;
-		}
-	}
-	AZ(pthread_mutex_unlock(&frmtx));
-	if (frf != NULL) {
-		priv->free = free_frfile;
-		priv->priv = frf;
-		return (frf->contents);
 	}
-
-	s = VFIL_readfile(NULL, file_name, NULL);
-	if (s != NULL) {
+	if (frf == NULL) {
+		s = VFIL_readfile(NULL, file_name, NULL);
+		if (s == NULL) {
+			AZ(pthread_mutex_unlock(&frmtx));
+			return (NULL);
+		}
 		ALLOC_OBJ(frf, CACHED_FILE_MAGIC);
 		AN(frf);
 		frf->file_name = strdup(file_name);
 		AN(frf->file_name);
-		frf->refcount = 1;
 		frf->contents = s;
-		priv->free = free_frfile;
-		priv->priv = frf;
-		AZ(pthread_mutex_lock(&frmtx));
+		frf->refresh = refresh;
+		VTAILQ_INIT(&frf->old);
+		(void)stat(file_name, &frf->st);
+		frf->t_next = VTIM_real() + refresh;
 		VTAILQ_INSERT_HEAD(&frlist, frf, list);
-		AZ(pthread_mutex_unlock(&frmtx));
+		if (refresh > 0. && !frthread) {
+			AZ(pthread_create(&thr, NULL, frfile_thread, NULL));
+			AZ(pthread_detach(thr));
+			frthread = 1;
+		} else if (refresh > 0.)
+			AZ(pthread_cond_signal(&frcond));
 	}
-	return (s);
+	frf->refcount++;
+	old = priv->priv;
+	priv->free = free_frfile;
+	priv->priv = frf;
+	AZ(pthread_mutex_unlock(&frmtx));
+	if (old != NULL)
+		free_frfile(old);
+	return (frf->contents);
 }
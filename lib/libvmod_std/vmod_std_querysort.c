@@ -33,32 +33,102 @@
 #include "cache/cache.h"
 
 #include "vrt.h"
+#include "vct.h"
 
 #include "vcc_if.h"
+#include "vmod_std.h"
+
+/*
+ * Parameters are kept as pointer pairs, begin and end, in one workspace
+ * reservation behind the space for the result.  Typical URLs have a
+ * handful of parameters, so they are insertion sorted, only long query
+ * strings go to qsort(3).
+ */
+
+#define QS_ISORT_MAX	16
+
+static int
+qs_cmp(const char * const *pa, const char * const *pb)
+{
+	size_t la, lb;
+	int i;
+
+	la = pa[1] - pa[0];
+	lb = pb[1] - pb[0];
+	i = memcmp(pa[0], pb[0], la < lb ? la : lb);
+	if (i != 0)
+		return (i);
+	return ((la > lb) - (la < lb));
+}
 
 static int
 compa(const void *a, const void *b)
 {
-	const char * const *pa = a;
-	const char * const *pb = b;
-	const char *a1, *b1;
 
-	for(a1 = pa[0], b1 = pb[0]; a1 < pa[1] && b1 < pb[1]; a1++, b1++)
-		if (*a1 != *b1)
-			return (*a1 - *b1);
+	return (qs_cmp(a, b));
+}
+
+static void
+qs_sort(const char **pp, unsigned n)
+{
+	const char *t[2];
+	unsigned i, j;
+
+	if (n > QS_ISORT_MAX) {
+		qsort(pp, n, sizeof(*pp) * 2, compa);
+		return;
+	}
+	for (i = 1; i < n; i++) {
+		t[0] = pp[i * 2];
+		t[1] = pp[i * 2 + 1];
+		for (j = i; j > 0 && qs_cmp(pp + (j - 1) * 2, t) > 0; j--) {
+			pp[j * 2] = pp[(j - 1) * 2];
+			pp[j * 2 + 1] = pp[(j - 1) * 2 + 1];
+		}
+		pp[j * 2] = t[0];
+		pp[j * 2 + 1] = t[1];
+	}
+}
+
+/*
+ * Is the name of the parameter in [b...e> on the list?  List entries
+ * are separated by commas or white space, a trailing '*' makes the
+ * entry match all names starting with it.  Also used for cookies.
+ */
+
+int
+std_inlist(const char *l, const char *b, const char *e)
+{
+	const char *n, *le;
+	size_t nl, ll;
+
+	for (n = b; n < e && *n != '='; n++)
+		continue;
+	nl = n - b;
+	while (*l != '\0') {
+		while (*l == ',' || vct_issp(*l))
+			l++;
+		for (le = l; *le != '\0' && *le != ',' && !vct_issp(*le); le++)
+			continue;
+		ll = le - l;
+		if (ll > 0 && l[ll - 1] == '*') {
+			if (nl >= ll - 1 && !memcmp(b, l, ll - 1))
+				return (1);
+		} else if (ll > 0 && nl == ll && !memcmp(b, l, ll))
+			return (1);
+		l = le;
+	}
 	return (0);
 }
 
-VCL_STRING __match_proto__(td_std_querysort)
-vmod_querysort(VRT_CTX, VCL_STRING url)
+static VCL_STRING
+qs_normalize(VRT_CTX, VCL_STRING url, VCL_STRING keep, VCL_STRING drop)
 {
-	const char *cq, *cu;
-	char *p, *r;
+	const char *cu, *cq, *b;
 	const char **pp;
-	const char **pe;
-	unsigned u;
-	int np;
-	int i;
+	char *r, *p;
+	unsigned u, n, nmax, len, i;
+	int filtered = 0;
 
 	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 
@@ -69,63 +139,85 @@ vmod_querysort(VRT_CTX, VCL_STRING url)
 	cu = strchr(url, '?');
 	if (cu == NULL)
 		return (url);
+	if (keep != NULL && *keep == '\0')
+		keep = NULL;
+	if (drop != NULL && *drop == '\0')
+		drop = NULL;
 
 	/* Spot single-param queries */
-	cq = strchr(cu, '&');
-	if (cq == NULL)
+	if (keep == NULL && drop == NULL && strchr(cu, '&') == NULL)
 		return (url);
 
-	r = WS_Copy(ctx->ws, url, -1);
-	if (r == NULL)
-		return (url);
-
-	u = WS_ReserveLumps(ctx->ws, sizeof(const char **));
-	pp = (const char**)(void*)(ctx->ws->f);
-	if (u < 4) {
+	len = strlen(url);
+	u = WS_Reserve(ctx->ws, 0);
+	r = ctx->ws->f;
+	if (u < PRNDUP(len + 1) + 2 * sizeof *pp) {
 		WS_Release(ctx->ws, 0);
 		WS_MarkOverflow(ctx->ws);
 		return (url);
 	}
-	pe = pp + u;
-
-	/* Collect params as pointer pairs */
-	np = 0;
-	pp[np++] = 1 + cu;
-	for (cq = 1 + cu; *cq != '\0'; cq++) {
-		if (*cq == '&') {
-			if (pp + 3 > pe) {
+	pp = (void *)(r + PRNDUP(len + 1));
+	nmax = (u - PRNDUP(len + 1)) / (2 * sizeof *pp);
+
+	/* Collect params as pointer pairs, skip empty and filtered ones */
+	n = 0;
+	for (b = cq = cu + 1; ; cq++) {
+		if (*cq != '&' && *cq != '\0')
+			continue;
+		if (cq > b && ((keep != NULL && !std_inlist(keep, b, cq)) ||
+		    (drop != NULL && std_inlist(drop, b, cq))))
+			filtered = 1;
+		else if (cq > b) {
+			if (n == nmax) {
 				WS_Release(ctx->ws, 0);
 				WS_MarkOverflow(ctx->ws);
 				return (url);
 			}
-			pp[np++] = cq;
-			/* Skip trivially empty params */
-			while(cq[1] == '&')
-				cq++;
-			pp[np++] = cq + 1;
+			pp[n * 2] = b;
+			pp[n * 2 + 1] = cq;
+			n++;
 		}
+		if (*cq == '\0')
+			break;
+		b = cq + 1;
 	}
-	pp[np++] = cq;
-	assert(!(np & 1));
-
-	qsort(pp, np / 2, sizeof(*pp) * 2, compa);
 
-	/* Emit sorted params */
-	p = 1 + r + (cu - url);
-	cq = "";
-	for (i = 0; i < np; i += 2) {
-		/* Ignore any edge-case zero length params */
-		if (pp[i + 1] == pp[i])
-			continue;
-		assert(pp[i + 1] > pp[i]);
-		if (*cq)
-			*p++ = *cq;
-		memcpy(p, pp[i], pp[i + 1] - pp[i]);
-		p += pp[i + 1] - pp[i];
-		cq = "&";
+	qs_sort(pp, n);
+
+	/* Emit sorted params, lose the '?' if we filtered them all */
+	p = r;
+	memcpy(p, url, cu - url);
+	p += cu - url;
+	if (n > 0 || !filtered)
+		*p++ = '?';
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			*p++ = '&';
+		memcpy(p, pp[i * 2], pp[i * 2 + 1] - pp[i * 2]);
+		p += pp[i * 2 + 1] - pp[i * 2];
 	}
-	*p = '\0';
+	*p++ = '\0';
+	assert(p <= r + len + 1);
 
-	WS_Release(ctx->ws, 0);
+	if (!strcmp(r, url)) {
+		/* Already normalized */
+		WS_Release(ctx->ws, 0);
+		return (url);
+	}
+	WS_Release(ctx->ws, p - r);
 	return (r);
 }
+
+VCL_STRING __match_proto__(td_std_querysort)
+vmod_querysort(VRT_CTX, VCL_STRING url)
+{
+
+	return (qs_normalize(ctx, url, NULL, NULL));
+}
+
+VCL_STRING __match_proto__(td_std_queryfilter)
+vmod_queryfilter(VRT_CTX, VCL_STRING url, VCL_STRING keep, VCL_STRING drop)
+{
+
+	return (qs_normalize(ctx, url, keep, drop));
+}